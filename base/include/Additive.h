@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <array>
 #include <map>
 #include <vector>
 
@@ -14,16 +15,25 @@ namespace midikraft {
 	//! A helper class to manage the harmonics of an Additive Synthesizer like the Kawai K3
 	class Additive {
 	public:
-		//! First value is the harmonic number (1-based, 1 is the fundamental), second value its amplitude in [0,1];
+		//! The waves are 256 samples long, so the highest harmonic that can be represented is 127
+		static const int kMaxHarmonic = 127;
+		static const size_t kWaveLength = 256;
+
+		//! Harmonic number (1-based, 1 is the fundamental) to its amplitude in [0,1]. Stored densely, silent harmonics have amplitude 0
 		class Harmonics {
 		public:
+			Harmonics();
+
 			void setHarmonic(int harmonicNumber, float value);
+			float harmonic(int harmonicNumber) const;
 
-			std::map<int, float> harmonics() { return harmonics_; }
-			std::map<int, float> const harmonics() const { return harmonics_; }
+			//! Indexed by harmonic number, index 0 is unused. No copy, prefer this for rendering
+			std::array<float, kMaxHarmonic + 1> const &amplitudes() const { return amplitudes_; }
+			//! Only the harmonics with an amplitude above 0
+			std::map<int, float> harmonics() const;
 
 		private:
-			std::map<int, float> harmonics_;
+			std::array<float, kMaxHarmonic + 1> amplitudes_;
 		};
 
 		static std::vector<float> createSamplesFromHarmonics(Harmonics const &harmonics);
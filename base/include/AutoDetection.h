@@ -28,11 +28,14 @@ namespace midikraft {
 
 	private:
 		void findSynth(SimpleDiscoverableDevice *synth, ProgressHandler *progressHandler);
-		bool checkSynth(SimpleDiscoverableDevice *synth);
+		std::vector<bool> checkSynths(std::vector<SimpleDiscoverableDevice *> const &synths);
+		std::vector<SimpleDiscoverableDevice *> synthsReplyingAnywhere(std::vector<SimpleDiscoverableDevice *> const &synths);
+		std::vector<std::shared_ptr<IsSynth>> startListening(std::vector<SimpleDiscoverableDevice *> const &synths);
 		void listenerToAllFound(std::vector<std::shared_ptr<SimpleDiscoverableDevice>> &allSynths);
 
 		MidiController::HandlerHandle handler_;
-		std::weak_ptr<IsSynth> isSynth_; // The synth currently detected by the single callback function. Can be expired in case we gave up on this
+		CriticalSection listeningLock_;
+		std::vector<std::weak_ptr<IsSynth>> listening_; // The synths currently detected by the single callback function. Can be expired in case we gave up on this
 	};
 
 }
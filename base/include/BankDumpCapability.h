@@ -21,11 +21,34 @@ namespace midikraft {
 		virtual TPatchVector patchesFromSysexBank(std::vector<MidiMessage> const& messages) const = 0;
 	};
 
+	// Optional for bank dumps that pack many patches. The bank is first split into the bytes of each patch, then every slice is decoded on its own,
+	// so Synth::loadSysex can decode and fingerprint the patches of a big bank on several threads instead of calling patchesFromSysexBank()
+	class BankDumpSplitCapability {
+	public:
+		struct Slice {
+			size_t message; // Index into the messages of the bank dump
+			size_t offset; // Of the first byte of the patch in the raw data of that message
+			size_t size;
+		};
+
+		// In program order. Return an empty vector if this bank can't be split, it is then loaded with patchesFromSysexBank()
+		virtual std::vector<Slice> splitSysexBank(std::vector<MidiMessage> const &messages) const = 0;
+		// Called from several threads at the same time. Return nullptr if the slice can't be decoded, the patch is skipped then
+		virtual std::shared_ptr<DataFile> patchFromBankSlice(std::vector<MidiMessage> const &messages, Slice const &slice, int indexInBank) const = 0;
+	};
+
 	// This means we can request a bank dump
 	class BankDumpRequestCapability  {
 	public:
 		virtual std::vector<MidiMessage> requestBankDump(MidiBankNumber bankNo) const = 0;
 	};
 
+	// This means we can write a whole bank into the synth with one bulk transfer, instead of sending one program dump per patch
+	class BankSendCapability {
+	public:
+		// The patches are in program order and fill the bank completely. Return an empty vector if the bank cannot be written this way
+		virtual std::vector<MidiMessage> createBankMessages(MidiBankNumber bankNo, TPatchVector const &patches) const = 0;
+	};
+
 
 }
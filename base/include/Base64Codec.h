@@ -0,0 +1,33 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace midikraft {
+
+	// Standard base64 (RFC 4648, with padding) for sysex of any size. The output is sized exactly before anything is written,
+	// so encoding and decoding allocate once. Decoding skips whitespace, so line broken text from other tools is fine too
+	class Base64Codec {
+	public:
+		static size_t encodedLength(size_t dataLength);
+		static size_t maxDecodedLength(size_t textLength);
+
+		static std::string encode(uint8_t const *data, size_t length);
+		static std::string encode(std::vector<uint8_t> const &data);
+		// Appends to outText
+		static void encode(uint8_t const *data, size_t length, std::string &outText);
+
+		// Returns false and leaves outData empty if the text contains anything but base64 characters, whitespace and padding at the end
+		static bool decode(char const *text, size_t length, std::vector<uint8_t> &outData);
+		static bool decode(std::string const &text, std::vector<uint8_t> &outData);
+	};
+
+}
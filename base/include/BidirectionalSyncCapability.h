@@ -12,7 +12,20 @@ namespace midikraft {
 
 	class BidirectionalSyncCapability {
 		public:
+		struct ParameterChange {
+			std::shared_ptr<SynthParameterDefinition> param;
+			int value;
+		};
+
 		virtual bool determineParameterChangeFromSysex(std::vector<juce::MidiMessage> const& messages, std::shared_ptr<SynthParameterDefinition> *outParam, int& outValue) = 0;
+
+		// For a burst of messages, e.g. all that came in with one MIDI callback while a knob is turned. Only the last value of each parameter is returned,
+		// in the order the parameters first changed. The default passes the whole burst to determineParameterChangeFromSysex, as one change may span
+		// several messages. Synths can do better by decoding the address and looking it up in a SysexParameterLookup built once
+		virtual std::vector<ParameterChange> determineParameterChangesFromSysex(std::vector<juce::MidiMessage> const& messages);
+
+		// Return true if every message is a parameter change of its own, then the default above asks determineParameterChangeFromSysex for each one
+		virtual bool parameterChangesAreSingleMessages() const { return false; }
 	};
 
 }
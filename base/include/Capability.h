@@ -6,7 +6,11 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
 
 namespace midikraft {
 
@@ -28,35 +32,92 @@ namespace midikraft {
 		static D *hasCapability(S *input);
 	};
 
+	namespace detail {
+
+		// Where the capability of an object is found. This only depends on the dynamic type of the object, so the dynamic_casts are done once per type 
+		// and the pointer adjustment is remembered. Only the answer of a RuntimeCapability is asked for each time, as it can differ per object
+		struct CapabilityLookup {
+			enum Kind { None, Static, Runtime } kind;
+			std::ptrdiff_t offset;
+		};
+
+		template <class T, class S>
+		std::ptrdiff_t pointerOffset(S *from, T *to) {
+			return reinterpret_cast<char const *>(to) - reinterpret_cast<char const *>(from);
+		}
+
+		template <class T, class S>
+		T *applyOffset(S *from, std::ptrdiff_t offset) {
+			return reinterpret_cast<T *>(reinterpret_cast<char *>(from) + offset);
+		}
+
+		template <class D, class S>
+		CapabilityLookup const &lookupCapability(S *input) {
+			// One table per thread, so lookups need no locking
+			thread_local std::unordered_map<std::type_index, CapabilityLookup> cache;
+			std::type_index type(typeid(*input));
+			auto found = cache.find(type);
+			if (found != cache.end()) {
+				return found->second;
+			}
+			CapabilityLookup lookup{ CapabilityLookup::None, 0 };
+			auto runtimeCapability = dynamic_cast<RuntimeCapability<D> *>(input);
+			if (runtimeCapability) {
+				lookup = { CapabilityLookup::Runtime, pointerOffset(input, runtimeCapability) };
+			}
+			else {
+				auto capability = dynamic_cast<D *>(input);
+				if (capability) {
+					lookup = { CapabilityLookup::Static, pointerOffset(input, capability) };
+				}
+			}
+			return cache.emplace(type, lookup).first->second;
+		}
+
+	}
+
 	template <class D, class S>
 	D * midikraft::Capability::hasCapability(S *input)
 	{
-		auto runtimeCapability = dynamic_cast<RuntimeCapability<D> const *>(input);
-		if (runtimeCapability) {
+		if (!input) {
+			return nullptr;
+		}
+		auto const &lookup = detail::lookupCapability<D>(input);
+		switch (lookup.kind) {
+		case detail::CapabilityLookup::Runtime: {
 			D *capability;
-			if (runtimeCapability->hasCapability(&capability)) {
+			if (detail::applyOffset<RuntimeCapability<D>>(input, lookup.offset)->hasCapability(&capability)) {
 				return capability;
 			}
 			else {
 				return nullptr;
 			}
 		}
-		else {
-			return dynamic_cast<D *>(input);
+		case detail::CapabilityLookup::Static:
+			return detail::applyOffset<D>(input, lookup.offset);
+		default:
+			return nullptr;
 		}
 	}
 
 	template <class D, class S>
 	std::shared_ptr<D> midikraft::Capability::hasCapability(std::shared_ptr<S> const &input)
 	{
-		std::shared_ptr<RuntimeCapability<D>> runtimeCapability = std::dynamic_pointer_cast<RuntimeCapability<D>>(input);
-		if (runtimeCapability) {
+		if (!input) {
+			return nullptr;
+		}
+		auto const &lookup = detail::lookupCapability<D>(input.get());
+		switch (lookup.kind) {
+		case detail::CapabilityLookup::Runtime: {
 			std::shared_ptr<D> out;
-			runtimeCapability->hasCapability(out);
+			detail::applyOffset<RuntimeCapability<D>>(input.get(), lookup.offset)->hasCapability(out);
 			return out;
 		}
-		else {
-			return std::dynamic_pointer_cast<D>(input);
+		case detail::CapabilityLookup::Static:
+			// Shares ownership with the input, like dynamic_pointer_cast does
+			return std::shared_ptr<D>(input, detail::applyOffset<D>(input.get(), lookup.offset));
+		default:
+			return nullptr;
 		}
 	}
 
@@ -0,0 +1,61 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "SynthParameterDefinition.h"
+
+#include <array>
+#include <unordered_map>
+
+namespace midikraft {
+
+	// Routes incoming controller messages to the parameters that map to them, without asking every parameter about every message.
+	// The table is built once by looking at the messages each SynthParameterControllerMappingCapability creates: a single CC is keyed by its
+	// channel and controller number, an NRPN by its channel and parameter number. Incoming NRPNs are assembled per channel, and only the
+	// parameters found under the key are asked to decode the value. Parameters mapped to anything else are still checked one by one.
+	// Not thread safe, the NRPN state is kept between messages, so feed it from the MIDI thread only
+	class ControllerMappingTable {
+	public:
+		struct Match {
+			std::shared_ptr<SynthParameterDefinition> param;
+			int value;
+		};
+
+		ControllerMappingTable(std::shared_ptr<Synth> synth, MidiChannel channel);
+		ControllerMappingTable(std::vector<std::shared_ptr<SynthParameterDefinition>> const &definitions, MidiChannel channel);
+
+		// True if the message completes a controller value of a mapped parameter
+		bool process(MidiMessage const &message, Match &outMatch);
+		void reset(); // Forget the partial NRPNs
+
+		size_t mappedCount() const; // Found via the table
+		size_t unmappedCount() const; // Checked one by one
+
+	private:
+		struct Mapping {
+			std::shared_ptr<SynthParameterDefinition> definition;
+			SynthParameterControllerMappingCapability *mapping;
+		};
+		struct NrpnState {
+			int parameterMsb = -1;
+			int parameterLsb = -1;
+			int valueMsb = -1;
+		};
+
+		static uint32 ccKey(int channel, int controller);
+		static uint32 nrpnKey(int channel, int parameter);
+		bool matchAny(std::vector<Mapping> const &candidates, std::vector<MidiMessage> const &messages, Match &outMatch) const;
+		bool processNrpn(int channel, int lsbValue, Match &outMatch);
+
+		std::unordered_map<uint32, std::vector<Mapping>> byKey_;
+		std::vector<Mapping> unmapped_;
+		size_t mappedCount_;
+		std::array<NrpnState, 16> nrpn_;
+	};
+
+}
@@ -25,6 +25,18 @@ namespace midikraft {
 		virtual bool isDataFile(const MidiMessage &message, int dataTypeID) const = 0;
 		virtual std::vector<std::shared_ptr<DataFile>> loadData(std::vector<MidiMessage> messages, int dataTypeID) const = 0;
 		virtual std::vector<DataFileDescription> dataTypeNames() const = 0;
+
+		static const int kNoDataType = -1;
+		// The data type the message belongs to, or kNoDataType. Called for every message when loading files, so override it if the type can be
+		// told from the message header in one go. The default asks isDataFile for each type and returns the first that matches
+		virtual int dataTypeOfMessage(const MidiMessage &message, int numberOfDataTypes) const {
+			for (int dataType = 0; dataType < numberOfDataTypes; dataType++) {
+				if (isDataFile(message, dataType)) {
+					return dataType;
+				}
+			}
+			return kNoDataType;
+		}
 	};
 
 }
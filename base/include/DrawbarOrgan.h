@@ -37,7 +37,11 @@ namespace midikraft {
 
 		static Additive::Harmonics HarmonicsFromRegistration(std::string const &registrationString);
 
-		static std::vector<Drawbar> hammondDrawbars();
+		// The rendered waves of the two lists above, in the same order. Computed once on first use, e.g. for the previews of all registrations
+		static std::vector<std::vector<float>> const &popularRegistrationSamples();
+		static std::vector<std::vector<float>> const &pipeOrganStopSamples();
+
+		static std::vector<Drawbar> const &hammondDrawbars();
 	};
 
 }
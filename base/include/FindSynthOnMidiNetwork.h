@@ -21,11 +21,12 @@ namespace midikraft {
 
 		virtual void handleIncomingMidiMessage(MidiInput* source, const MidiMessage& message) override;
 
-		std::vector<MidiNetworkLocation> locations() { return found_; }
-		void restart() { found_.clear(); }
+		std::vector<MidiNetworkLocation> locations();
+		void restart();
 
 	private:
 		DiscoverableDevice & synth_;
+		CriticalSection foundLock_; // Replies come in on the MIDI thread while the detection thread reads them
 		std::vector<MidiNetworkLocation> found_;
 	};
 
@@ -36,17 +37,27 @@ namespace midikraft {
 		// Implementation of task
 		virtual void run() override;
 
-		static std::vector<MidiNetworkLocation> detectSynth(DiscoverableDevice &synth, ProgressHandler *progressHandler);
+		enum class DetectionMode {
+			SEQUENTIAL, // Probe one output after the other, one sleep per output
+			BROADCAST // Probe all outputs at once and bisect only where replies came back
+		};
+
+		static std::vector<MidiNetworkLocation> detectSynth(DiscoverableDevice &synth, ProgressHandler *progressHandler, DetectionMode mode = DetectionMode::SEQUENTIAL);
 
 	private:
-		FindSynthOnMidiNetwork(DiscoverableDevice &synth, std::string const &text, ProgressHandler *progressHandler);
+		FindSynthOnMidiNetwork(DiscoverableDevice &synth, std::string const &text, ProgressHandler *progressHandler, DetectionMode mode);
 		virtual ~FindSynthOnMidiNetwork() override;
 
+		void probeOutputs(std::shared_ptr<IsSynth> callback, std::vector<juce::MidiDeviceInfo> const &outputs, size_t from, size_t to);
+		void sendDetectMessages(juce::MidiDeviceInfo const &output);
+		void recordLocations(std::shared_ptr<IsSynth> callback, juce::MidiDeviceInfo const &output);
+
 		MidiController::HandlerHandle handler_;
 		std::weak_ptr<IsSynth> isSynth_; // The synth that is to be detected
 		DiscoverableDevice &synth_;
 		std::vector<MidiNetworkLocation> locations_;
 		ProgressHandler *progressHandler_;
+		DetectionMode mode_;
 	};
 
 }
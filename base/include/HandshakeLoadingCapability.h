@@ -22,6 +22,11 @@ namespace midikraft {
 		virtual std::shared_ptr<ProtocolState> createStateObject() = 0;
 		virtual void startDownload(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<ProtocolState> saveState) = 0;
 		virtual bool isNextMessage(MidiMessage const &message, std::vector<MidiMessage> &answer, std::shared_ptr<ProtocolState> state) = 0;
+
+		// If the synth doesn't send its next message in time, the last message sent to it is repeated. After the retries the download fails
+		// instead of waiting forever. A timeout of 0 waits forever
+		virtual int stepTimeoutMilliseconds() const { return 2000; }
+		virtual int maxStepRetries() const { return 2; }
 	};
 
 }
\ No newline at end of file
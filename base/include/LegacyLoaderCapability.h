@@ -11,6 +11,10 @@ namespace midikraft {
 		virtual std::string additionalFileExtensions() = 0;
 		virtual bool supportsExtension(std::string const &filename) = 0;
 		virtual TPatchVector load(std::string const &filename, std::vector<uint8> const &fileContent) = 0;
+		// Called with the memory mapped file. Override this to parse in place, the default makes a copy and calls load()
+		virtual TPatchVector loadFromMemory(std::string const &filename, uint8 const *data, size_t size) {
+			return load(filename, std::vector<uint8>(data, data + size));
+		}
 	};
 }
 
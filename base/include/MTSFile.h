@@ -9,6 +9,7 @@
 #include "JuceHeader.h"
 
 #include "Patch.h"
+#include "MidiController.h"
 #include "MidiTuning.h"
 #include "StoredPatchNameCapability.h"
 
@@ -22,6 +23,25 @@ namespace midikraft {
         virtual bool changeNameStoredInPatch(std::string const& name) override;
 
 		std::vector<MidiMessage> createMidiMessagesFromDataFile(MidiProgramNumber placeToStore);
+
+		// All tunings in one go, the first into the given place and the others into the places following it
+		static std::vector<MidiMessage> createBulkMessages(std::vector<std::shared_ptr<MTSFile>> const &tunings, MidiProgramNumber firstPlace);
+		// Queued on the output's send thread with the pacing (and the device's own limits), returns immediately. The finished handler is called from that thread
+		static MidiSendQueue::JobID sendTunings(std::shared_ptr<SafeMidiOutput> output, std::vector<std::shared_ptr<MTSFile>> const &tunings, MidiProgramNumber firstPlace,
+			MidiSendPacing const &pacing, TMidiSendFinished onFinished = nullptr);
+
+		// For the MTS real time single note tuning change, the pitch a key plays as semitone plus a fraction in 1/16384 of a semitone
+		struct NoteTuning {
+			int key;
+			int semitone;
+			int fraction;
+
+			static NoteTuning fromFrequency(int key, double hz);
+		};
+		// Retunes the keys while they sound. Up to 127 keys fit into one message, more are split
+		static std::vector<MidiMessage> createSingleNoteTuningChange(int deviceID, int tuningProgram, std::vector<NoteTuning> const &notes);
+		// For microtonal performance: only the latest tuning per key is kept, and all keys changed since are sent at the output's live edit rate
+		static void sendSingleNoteTuningCoalesced(std::shared_ptr<SafeMidiOutput> output, int deviceID, int tuningProgram, NoteTuning const &note);
 	};
 
 }
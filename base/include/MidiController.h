@@ -8,10 +8,20 @@
 
 #include "JuceHeader.h"
 
+#include <array>
+#include <atomic>
+#include <future>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 #include "DebounceTimer.h"
+#include "MidiLogQueue.h"
+#include "MidiParameterCoalescer.h"
+#include "MidiSendQueue.h"
+#include "MidiTelemetry.h"
+#include "MidiRequest.h"
 
 /*
 inline bool operator <(const juce::MidiDeviceInfo &a, const juce::MidiDeviceInfo &b)
@@ -37,24 +47,70 @@ namespace midikraft {
 
 	typedef std::function<void(MidiInput *source, MidiMessage const &message)> MidiCallback;
 
+	// A cheap pre-filter for message handlers, evaluated by the MidiController before the handler is called.
+	// The status byte range is resolved into a dispatch table when the handler is registered, so e.g. MIDI clock never reaches a sysex-only handler
+	struct MidiMessageFilter {
+		juce::String inputIdentifier; // Empty means messages from all inputs
+		uint8 minStatus = 0x80;
+		uint8 maxStatus = 0xff;
+		std::vector<uint8> sysexPrefix; // Compared to the sysex data following the 0xf0, e.g. the manufacturer ID. Only applied to sysex messages
+
+		static MidiMessageFilter all();
+		static MidiMessageFilter nonRealtime(); // Everything but the system realtime messages 0xf8 to 0xff
+		static MidiMessageFilter sysexOnly(std::vector<uint8> const &prefix = {});
+		MidiMessageFilter fromInput(juce::String const &identifier) const;
+
+		bool matches(MidiInput *source, MidiMessage const &message) const;
+	};
+
 	class SafeMidiOutput {
 	public:
 		SafeMidiOutput(MidiController *controller, MidiOutput *midiOutput);
 
 		void sendMessageNow(const MidiMessage& message);
 		void sendMessageDebounced(const MidiMessage &message, int milliseconds);
+		// For live editing, e.g. with SynthParameterLiveEditCapability::setValueMessages. Only the latest messages per parameter key are kept and sent
+		// at most once per flush interval, paced by the device limits. Unlike the debounced send, any number of parameters can change at the same time
+		void sendParameterCoalesced(std::string const &parameterKey, std::vector<MidiMessage> const &messages);
+		void setParameterFlushInterval(int milliseconds);
 		void sendBlockOfMessagesFullSpeed(const MidiBuffer& buffer);
+		// These return immediately. With device limits, or while blocks are queued, the block is paced on the send thread in order with the others
 		void sendBlockOfMessagesFullSpeed(const std::vector<MidiMessage>& buffer);
-		void sendBlockOfMessagesThrottled(const std::vector<MidiMessage>& buffer, int millisecondsWait);
+		void sendBlockOfMessagesThrottled(const std::vector<MidiMessage>& buffer, int millisecondsWait); // Queued, but blocks until the messages are sent
+
+		// Queue the messages on this output's send thread and return immediately. The finished handler is called from that thread
+		MidiSendQueue::JobID sendBlockOfMessagesPaced(const std::vector<MidiMessage>& buffer, MidiSendPacing const &pacing, TMidiSendFinished onFinished = nullptr);
+		// Same for sending code, e.g. a synth's sendBlockOfMessagesToSynth(). The FullSpeed blocks it sends are paced with the pacing given
+		MidiSendQueue::JobID runOnSendThread(std::function<void()> work, MidiSendPacing const &pacing, TMidiSendFinished onFinished = nullptr);
+		bool cancelSend(MidiSendQueue::JobID job);
+		void cancelAllSends();
+
+		// The limits of the device (or the interface in between), applied to everything sent to it. With anything but full speed,
+		// the FullSpeed methods queue their blocks to go out as fast as these limits allow instead of bursting
+		void setDevicePacing(MidiSendPacing const &pacing);
+		MidiSendPacing devicePacing() const;
 
         juce::MidiDeviceInfo deviceInfo() const;
 		std::string name() const;
 		bool isValid() const;
 
 	private:
+		MidiSendQueue &sendQueue();
+		// The send queue if a FullSpeed block has to be paced, would overtake queued blocks or is sent from the send thread, else nullptr
+		MidiSendQueue *sendQueueForBlock();
+		void sendThroughQueue(MidiSendQueue &queue, std::vector<MidiMessage> const &buffer);
+		MidiParameterCoalescer &parameterCoalescer();
+		void sendPacedNow(MidiMessage const &message, MidiSendPacing const &pacing, double &notBeforeMs);
+
 		MidiOutput * midiOut_;
 		MidiController *controller_;
 		DebounceTimer debouncer_;
+		CriticalSection sendQueueLock_;
+		std::unique_ptr<MidiSendQueue> sendQueue_; // Only created when the first paced block is sent, so unused outputs don't get a thread
+		std::unique_ptr<MidiParameterCoalescer> parameterCoalescer_; // Same, created with the first live edit. Guarded by the send queue lock
+		std::atomic<int> parameterFlushIntervalMs_;
+		CriticalSection pacingLock_;
+		MidiSendPacing devicePacing_;
 	};
 
 	enum class MidiLogLevel {
@@ -63,7 +119,7 @@ namespace midikraft {
 	};
 
 	// TODO - another example of bad naming. This is rather the "MidiDeviceManager"
-	class MidiController : public ChangeBroadcaster, private MidiInputCallback, private Timer
+	class MidiController : public ChangeBroadcaster, private MidiInputCallback
 	{
 	public:
 		typedef juce::Uuid HandlerHandle;
@@ -77,10 +133,24 @@ namespace midikraft {
 
 		//TODO - I think these should have an optional expiration date/timeout with a timeout handler, like when the expected response doesn't happen
 		void addMessageHandler(HandlerHandle const &handle, MidiCallback handler);
+		void addMessageHandler(HandlerHandle const &handle, MidiMessageFilter const &filter, MidiCallback handler);
 		bool removeMessageHandler(HandlerHandle const &handle);
 
+		// Send the messages and wait for the first incoming message the predicate accepts. Any number of requests can be outstanding at the same time.
+		// The future throws a std::runtime_error on timeout, the handler is called with answered false instead. It is called from the MIDI or the timeout thread
+		std::future<MidiMessage> sendRequest(juce::MidiDeviceInfo const &output, std::vector<MidiMessage> const &request, TIsAnswerPredicate isAnswer, int timeOutInMilliseconds = 2000);
+		void sendRequest(juce::MidiDeviceInfo const &output, std::vector<MidiMessage> const &request, TIsAnswerPredicate isAnswer, int timeOutInMilliseconds, TMidiReplyHandler onReply);
+
 		void setMidiLogFunction(std::function<void(const MidiMessage& message, const String& source, bool)>);
-		void logMidiMessage(const MidiMessage& message, const String& source, bool isOut);
+		void logMidiMessage(const MidiMessage& message, const String& source, bool isOut); // Never blocks, the log function is called later from the log thread
+		uint64 droppedMidiLogMessages() const;
+
+		// Throughput and dispatch time per device, and the latencies of the downloads
+		MidiTelemetry &telemetry();
+
+		// Runs the message through the pending requests and the handlers exactly as if it had arrived from the input. The source may be nullptr for
+		// messages that didn't come from a device, e.g. a replayed log or a benchmark. Handlers must then not rely on it
+		void dispatchIncomingMidiMessage(MidiInput *source, MidiMessage const &message);
 
 		bool enableMidiOutput(juce::MidiDeviceInfo const &newOutput);
 		std::shared_ptr<SafeMidiOutput> getMidiOutput(juce::MidiDeviceInfo const &name);
@@ -95,28 +165,69 @@ namespace midikraft {
 		std::set<juce::MidiDeviceInfo> currentInputs(bool withHistory);
 		std::set<juce::MidiDeviceInfo> currentOutputs(bool withHistory);
 
+		// The devices in the order the OS reports them. This is a cached snapshot, updated whenever the OS reports a change in the device list
+		std::vector<juce::MidiDeviceInfo> availableInputs() const;
+		std::vector<juce::MidiDeviceInfo> availableOutputs() const;
+
 		void setMidiLogLevel(MidiLogLevel level);
 
+		// Per output device throughput limits, persisted in the settings by device identifier
+		void setOutputPacing(juce::MidiDeviceInfo const &output, MidiSendPacing const &pacing);
+		MidiSendPacing outputPacing(juce::MidiDeviceInfo const &output) const;
+
 	private:
 		// Implementation of Callback
 		virtual void handleIncomingMidiMessage(MidiInput* source, const MidiMessage& message) override;
-		virtual void timerCallback() override;
+		void deviceListChanged();
+
+		// Enumerating the devices is an OS call, so it is only done when the OS tells us something changed. All lookups go to the maps in this snapshot
+		struct DeviceSnapshot {
+			std::vector<juce::MidiDeviceInfo> inputs, outputs;
+			std::unordered_map<std::string, juce::MidiDeviceInfo> inputsByIdentifier, outputsByIdentifier;
+			std::unordered_map<std::string, juce::MidiDeviceInfo> inputsByName, outputsByName;
+		};
+		void refreshDeviceSnapshot();
+		std::shared_ptr<DeviceSnapshot const> devices() const;
 
 
 		static MidiController *instance_;
 
-		// The list of handlers needs to be locked for thread-safe access
+		// The handlers are an immutable snapshot, replaced as a whole with std::atomic_store whenever a handler is added or removed.
+		// This way the MIDI thread can dispatch without taking a lock or copying, the lock only serializes the writers
+		struct Handler {
+			MidiMessageFilter filter;
+			MidiCallback callback;
+		};
+		typedef std::map<HandlerHandle, std::shared_ptr<Handler const>> HandlerMap;
+
+		// One slot per channel message type (0x8n to 0xen), and one per system status byte (0xf0 to 0xff)
+		static constexpr size_t kDispatchSlots = 7 + 16;
+		static size_t dispatchSlot(uint8 status);
+		void pushToMidiLog(const MidiMessage& message, const String& source, bool isOut);
+		struct HandlerSnapshot {
+			HandlerMap handlers;
+			std::array<std::vector<Handler const *>, kDispatchSlots> dispatch;
+		};
+		static std::shared_ptr<HandlerSnapshot const> buildSnapshot(HandlerMap const &handlers);
+
 		CriticalSection messageHandlerList_;
-		std::map<HandlerHandle, MidiCallback> messageHandlers_;
+		std::shared_ptr<HandlerSnapshot const> messageHandlers_;
+
+		std::shared_ptr<DeviceSnapshot const> devices_;
+		DebounceTimer deviceListDebouncer_; // Declared before the connection, so no notification can arrive once it is gone
+		juce::MidiDeviceListConnection deviceListConnection_;
 
 		std::set<juce::MidiDeviceInfo> knownInputs_, historyOfAllInputs_;
 		std::set<juce::MidiDeviceInfo> knownOutputs_, historyOfAllOutpus_;
+		CriticalSection outputsLock_; // For the two maps below, as getMidiOutput() is called from the MIDI and send threads too
 		std::map<String, std::unique_ptr<MidiOutput>> outputsOpen_;
 		std::map<String, std::shared_ptr<SafeMidiOutput>> safeOutputs_;
 		std::map<String, std::unique_ptr<MidiInput>> inputsOpen_;
-		std::function<void(const MidiMessage& message, const String& source, bool)> midiLogFunction_;
+		std::unique_ptr<MidiLogQueue> midiLog_;
+		MidiRequestTracker requests_;
+		MidiTelemetry telemetry_;
 
-		MidiLogLevel midiLogLevel_;
+		std::atomic<MidiLogLevel> midiLogLevel_;
 	};
 	
 }
@@ -0,0 +1,59 @@
+/*
+   Copyright (c) 2019 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <memory>
+
+namespace midikraft {
+
+	// Decouples the MIDI threads from the (usually slow, UI bound) MIDI log function. Producers push into a bounded lock-free ring buffer
+	// and never block - if the buffer is full, the message is counted as dropped instead. A single consumer thread drains the buffer in batches.
+	class MidiLogQueue : private Thread {
+	public:
+		typedef std::function<void(const MidiMessage& message, const String& source, bool isOut)> TLogFunction;
+
+		MidiLogQueue(size_t capacity = 4096); // Rounded up to a power of two
+		virtual ~MidiLogQueue() override;
+
+		void setLogFunction(TLogFunction logFunction);
+		bool hasLogFunction() const;
+
+		// Safe to call from any number of threads at the same time. Returns false if the message had to be dropped
+		bool push(const MidiMessage& message, const String& source, bool isOut);
+
+		uint64 loggedCount() const;
+		uint64 droppedCount() const;
+
+	private:
+		void run() override;
+		bool pop(MidiMessage& message, String& source, bool& isOut);
+
+		struct Slot {
+			std::atomic<size_t> sequence;
+			MidiMessage message;
+			String source;
+			bool isOut;
+		};
+
+		std::unique_ptr<Slot[]> slots_;
+		size_t mask_;
+		std::atomic<size_t> enqueuePos_;
+		size_t dequeuePos_; // Only touched by the consumer thread
+
+		CriticalSection logFunctionLock_; // Only taken by the consumer and setLogFunction, never by the producers
+		TLogFunction logFunction_;
+		std::atomic<bool> hasLogFunction_;
+
+		std::atomic<uint64> logged_;
+		std::atomic<uint64> dropped_;
+		uint64 droppedReported_;
+	};
+
+}
@@ -0,0 +1,46 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <map>
+
+namespace midikraft {
+
+	// For live editing of one MIDI output. Each parameter only keeps the messages of its latest value, and all pending parameters are sent together
+	// at most once per flush interval. So moving many controls at the same time neither floods the output nor loses any of them.
+	// The first change after a quiet period goes out right away
+	class MidiParameterCoalescer : private Thread {
+	public:
+		typedef std::function<void(std::vector<MidiMessage> const &)> TSendFunction;
+
+		static const int kDefaultFlushIntervalMs = 10;
+
+		MidiParameterCoalescer(String const &name, TSendFunction sendFunction, int flushIntervalMs = kDefaultFlushIntervalMs);
+		virtual ~MidiParameterCoalescer() override; // Drops what is still pending
+
+		// Replaces the pending messages of the parameter, if any. Parameters are sent in the order they first changed since the last flush
+		void setValue(std::string const &parameterKey, std::vector<MidiMessage> const &messages);
+		void clear();
+
+		void setFlushInterval(int milliseconds);
+		int flushInterval() const;
+
+	private:
+		void run() override;
+
+		TSendFunction sendFunction_;
+		std::atomic<int> flushIntervalMs_;
+		CriticalSection pendingLock_;
+		std::map<std::string, size_t> pendingIndex_; // Into pending_
+		std::vector<std::vector<MidiMessage>> pending_;
+		WaitableEvent wakeUp_;
+	};
+
+}
@@ -8,12 +8,49 @@
 
 #include "JuceHeader.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+
 namespace midikraft {
 
+	typedef std::function<bool(MidiMessage const &)> TIsAnswerPredicate;
+	typedef std::function<void(bool answered, MidiMessage const &answer)> TMidiReplyHandler;
+
+	// Keeps track of any number of outstanding requests. Each incoming message answers the oldest request whose predicate matches it,
+	// requests without answer are expired by a single timeout thread sleeping on a condition variable until the next deadline
+	class MidiRequestTracker {
+	public:
+		MidiRequestTracker();
+		~MidiRequestTracker(); // Expires all outstanding requests
+
+		void add(TIsAnswerPredicate isAnswer, int timeOutInMilliseconds, TMidiReplyHandler onReply);
+		bool hasPendingRequests() const;
+		bool handleIncomingMidiMessage(MidiMessage const &message); // True if it answered a request
+
+	private:
+		void expireRequests();
+
+		struct PendingRequest {
+			TIsAnswerPredicate isAnswer;
+			std::chrono::steady_clock::time_point deadline;
+			TMidiReplyHandler onReply;
+		};
+
+		mutable std::mutex lock_;
+		std::condition_variable changed_;
+		std::list<PendingRequest> pending_;
+		std::atomic<bool> hasPending_;
+		bool shutdown_;
+		std::thread timeoutThread_; // Started with the first request
+	};
 
 	class MidiRequest {
 	public:
-		typedef std::function<bool(MidiMessage const &)> TIsAnswerPredicate;
+		typedef midikraft::TIsAnswerPredicate TIsAnswerPredicate;
 
 		MidiRequest(juce::MidiDeviceInfo const& midiOutput, std::vector<MidiMessage> const& request, TIsAnswerPredicate pred);
 		MidiMessage blockForReply();
@@ -26,4 +63,4 @@ namespace midikraft {
 		TIsAnswerPredicate pred_;
 	};
 
-}
\ No newline at end of file
+}
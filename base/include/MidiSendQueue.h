@@ -0,0 +1,87 @@
+/*
+   Copyright (c) 2019 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <deque>
+
+namespace midikraft {
+
+	// How fast messages may be sent to a device. Vintage gear often needs a pause between sysex messages, and can't
+	// even take the full wire speed of 31250 baud, which is 3125 bytes per second with start and stop bits
+	struct MidiSendPacing {
+		static const int kMidiWireBytesPerSecond = 3125;
+
+		int gapMilliseconds = 0; // Minimum pause after each message
+		int bytesPerSecond = 0; // 0 means no byte budget, else the pause after a message is stretched to fit the budget
+		int postSysexGapMilliseconds = 0; // Minimum pause after a sysex message, many synths need time to digest them
+
+		static MidiSendPacing fullSpeed();
+		static MidiSendPacing throttled(int gapMilliseconds);
+		static MidiSendPacing wireRate(int gapMilliseconds = 0);
+
+		bool isFullSpeed() const;
+		double pauseAfterMs(MidiMessage const &message) const;
+
+		// The stricter of both, used to apply a device's limits on top of what the sender requested
+		static MidiSendPacing strictest(MidiSendPacing const &a, MidiSendPacing const &b);
+
+		// Compact text form for the settings file
+		std::string toString() const;
+		static MidiSendPacing fromString(std::string const &text);
+	};
+
+	typedef std::function<void(bool completed)> TMidiSendFinished;
+
+	// A scheduler thread for one MIDI output. Blocks of messages are queued as jobs and sent in order with the requested pacing,
+	// so the caller returns immediately instead of sleeping between the messages
+	class MidiSendQueue : private Thread {
+	public:
+		typedef uint64 JobID;
+		typedef std::function<void(MidiMessage const&)> TSendFunction;
+
+		MidiSendQueue(String const &name, TSendFunction sendFunction);
+		virtual ~MidiSendQueue() override; // Cancels all remaining jobs
+
+		// The finished handler is called from the send thread, with false if the job was canceled
+		JobID enqueue(std::vector<MidiMessage> const& messages, MidiSendPacing const &pacing, TMidiSendFinished onFinished = nullptr);
+		// Runs the work on the send thread, in order with the other jobs. Whatever it sends via sendFromJob() is paced with the pacing given here
+		JobID enqueue(std::function<void()> work, MidiSendPacing const &pacing, TMidiSendFinished onFinished = nullptr);
+		bool cancel(JobID job);
+		void cancelAll();
+
+		bool isIdle() const;
+		bool isSendThread() const;
+
+		// Only for the work of a job, called on the send thread. Sends right away with that job's pacing, false if the job was canceled meanwhile
+		bool sendFromJob(std::vector<MidiMessage> const &messages);
+
+	private:
+		void run() override;
+		bool sendPaced(std::vector<MidiMessage> const &messages, MidiSendPacing const &pacing); // False if canceled meanwhile
+		bool pauseAfter(MidiMessage const &message, MidiSendPacing const &pacing); // False if canceled meanwhile
+
+		struct Job {
+			JobID id = 0;
+			std::vector<MidiMessage> messages;
+			MidiSendPacing pacing;
+			TMidiSendFinished onFinished;
+			std::function<void()> work; // Instead of the messages, if set
+		};
+
+		TSendFunction sendFunction_;
+		CriticalSection jobLock_;
+		std::deque<Job> jobs_;
+		JobID nextJobID_;
+		JobID currentJob_; // 0 if none is being sent
+		bool cancelCurrent_;
+		MidiSendPacing currentPacing_; // Of the job being sent, only used on the send thread
+		WaitableEvent wakeUp_;
+	};
+
+}
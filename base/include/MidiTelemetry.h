@@ -0,0 +1,98 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace midikraft {
+
+	// Counts of durations in fixed buckets, so percentiles can be told without keeping every single value
+	class LatencyHistogram {
+	public:
+		static constexpr std::array<double, 12> kBucketLimitsMs = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+
+		void add(double milliseconds);
+		void merge(LatencyHistogram const &other);
+
+		size_t count() const;
+		double meanMs() const;
+		double maxMs() const;
+		// The upper limit of the bucket the percentile falls into, or the maximum for the last bucket. 0 if empty
+		double percentileMs(double percentile) const;
+		std::array<size_t, kBucketLimitsMs.size() + 1> const &buckets() const; // The last one counts everything above the highest limit
+
+	private:
+		std::array<size_t, kBucketLimitsMs.size() + 1> buckets_{};
+		size_t count_ = 0;
+		double totalMs_ = 0.0;
+		double maxMs_ = 0.0;
+	};
+
+	struct MidiPortStatistics {
+		std::string device;
+		uint64 messagesIn = 0;
+		uint64 bytesIn = 0;
+		uint64 messagesOut = 0;
+		uint64 bytesOut = 0;
+		double firstActivityMs = 0.0; // Time::getMillisecondCounterHiRes() of the first and the last message, to calculate the rates over
+		double lastActivityMs = 0.0;
+		LatencyHistogram dispatch; // Time the MIDI thread spent in the handlers per incoming message
+
+		double bytesInPerSecond() const;
+		double bytesOutPerSecond() const;
+	};
+
+	struct DownloadStatistics {
+		std::string synth;
+		uint64 requests = 0; // Including the retries
+		uint64 replies = 0;
+		uint64 timeouts = 0; // No complete reply before the deadline, the request is retried
+		uint64 gaps = 0; // Given up after the last retry
+		LatencyHistogram replyLatency; // From sending the request to the dump being complete
+	};
+
+	// Where the time of a slow bank download goes - the synth, the interface or our code. Per MIDI device throughput and handler dispatch time,
+	// recorded by the MidiController, and request to reply latency and timeouts per synth, recorded by the downloads. Safe to use from any thread
+	class MidiTelemetry {
+	public:
+		MidiTelemetry();
+
+		void recordMessage(String const &device, bool isOut, size_t bytes);
+		void recordDispatch(String const &device, double milliseconds);
+		// Both of the above for an incoming message, taking the lock only once on the MIDI thread
+		void recordIncoming(String const &device, size_t bytes, double dispatchMilliseconds);
+
+		void recordRequest(std::string const &synth);
+		void recordReply(std::string const &synth, double latencyMs);
+		void recordTimeout(std::string const &synth);
+		void recordGap(std::string const &synth);
+
+		std::vector<MidiPortStatistics> portStatistics() const;
+		std::vector<DownloadStatistics> downloadStatistics() const;
+		void reset();
+
+		// Off by default. If on, each download writes a one line summary of its latencies and timeouts into the log
+		void setLogDownloadSummaries(bool enabled);
+		bool logDownloadSummaries() const;
+
+	private:
+		MidiPortStatistics &port(String const &device);
+		static void countMessage(MidiPortStatistics &stats, bool isOut, size_t bytes, double nowMs);
+
+		CriticalSection lock_;
+		std::map<juce::String, MidiPortStatistics> ports_;
+		std::map<std::string, DownloadStatistics> downloads_;
+		std::atomic<bool> logDownloadSummaries_;
+	};
+
+}
@@ -0,0 +1,59 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+
+namespace midikraft {
+
+	struct OperationTiming {
+		size_t calls = 0; // Number of times the operation ran
+		double totalMs = 0.0; // Wall clock time spent in it, summed up
+		double maxMs = 0.0; // Longest single call
+	};
+
+	// Wall clock time spent in operations, summed up per operation name. To quantify a performance change on real data, or to spot a regression
+	// in the field, without a separate benchmark build. Safe to use from any thread
+	class OperationStatistics {
+	public:
+		// Measures from construction to destruction, does nothing while the statistics are disabled
+		class Timer {
+		public:
+			Timer(OperationStatistics &statistics, char const *operation);
+			~Timer();
+			Timer(Timer const &) = delete;
+			Timer &operator=(Timer const &) = delete;
+
+		private:
+			OperationStatistics &statistics_;
+			char const *operation_; // Must be a string literal or otherwise outlive the timer
+			double startMs_;
+		};
+
+		explicit OperationStatistics(bool enabled = true);
+
+		// Used by the sysex parsing, MIDI dispatch, categorization and file formats. Off by default, as the MIDI dispatch is hot
+		static OperationStatistics &global();
+
+		void setEnabled(bool enabled);
+		bool isEnabled() const;
+
+		void record(char const *operation, double elapsedMs);
+		std::map<std::string, OperationTiming> snapshot() const;
+		void reset();
+
+	private:
+		std::atomic<bool> enabled_;
+		CriticalSection lock_;
+		std::map<std::string, OperationTiming> timings_;
+	};
+
+}
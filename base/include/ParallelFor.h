@@ -0,0 +1,53 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace midikraft {
+
+	// Runs work(i) for all i in [0, count) on up to one thread per core. The threads grab batches of indexes from a shared counter, so a slow
+	// item doesn't hold up the others. Once work throws, no new batches are started, and the first exception is rethrown by join()
+	class ParallelFor {
+	public:
+		// Starts the threads and returns right away, e.g. to report progress while they work. The destructor stops and joins them
+		ParallelFor(size_t count, std::function<void(size_t)> work, size_t batchSize = 1);
+		~ParallelFor();
+
+		ParallelFor(ParallelFor const &) = delete;
+		ParallelFor &operator=(ParallelFor const &) = delete;
+
+		void stop(); // No new items are started, the ones running are finished
+		bool isFinished() const;
+		void join();
+
+		// Blocks until done, the calling thread works as well. With only one batch, or when called from the work of another ParallelFor, no thread is
+		// started at all, so nested loops don't start cores times cores threads
+		static void run(size_t count, std::function<void(size_t)> const &work, size_t batchSize = 1);
+		static size_t threadsFor(size_t count, size_t batchSize);
+
+	private:
+		ParallelFor(size_t count, std::function<void(size_t)> work, size_t batchSize, size_t backgroundThreads);
+		void worker();
+
+		size_t count_;
+		size_t batchSize_;
+		std::function<void(size_t)> work_;
+		std::atomic<size_t> next_;
+		std::atomic<bool> stop_;
+		std::atomic<size_t> running_;
+		std::mutex errorLock_;
+		std::exception_ptr firstError_;
+		std::vector<std::thread> threads_;
+	};
+
+}
@@ -0,0 +1,60 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "SynthParameterDefinition.h"
+
+#include <limits>
+
+namespace midikraft {
+
+	// Values of all parameters of many patches, one row per patch, stored row after row. An array parameter takes one column per element
+	struct ParameterMatrix {
+		static constexpr int kMissing = std::numeric_limits<int>::min(); // The patch had no value for the parameter
+
+		size_t rows = 0;
+		size_t columns = 0;
+		std::vector<int> values;
+
+		int at(size_t row, size_t column) const { return values[row * columns + column]; }
+		int const *row(size_t row) const { return values.data() + row * columns; }
+	};
+
+	// Decodes every parameter of many patches of the same synth in one go. The parameter definitions and their capabilities are looked up 
+	// once when the decoder is constructed, so decoding only calls valueInPatch for each parameter and patch.
+	// Reuse a decoder for all patches of a synth, but build a new one if the synth's parameter definitions can change
+	class ParameterBatchDecoder {
+	public:
+		struct Parameter {
+			std::shared_ptr<SynthParameterDefinition> definition;
+			SynthParameterDefinition::ParamType type;
+			SynthIntParameterCapability const *intValue; // Set for INT and LOOKUP parameters
+			SynthVectorParameterCapability const *vectorValue; // Set for INT_ARRAY and LOOKUP_ARRAY parameters
+			int sysexIndex;
+			int minValue;
+			int maxValue;
+			size_t firstColumn;
+			size_t width; // Columns taken in the matrix. For arrays the span of sysex indexes, longer values are cut off
+		};
+
+		explicit ParameterBatchDecoder(std::shared_ptr<Synth> synth);
+		explicit ParameterBatchDecoder(std::vector<std::shared_ptr<SynthParameterDefinition>> const &definitions);
+
+		std::vector<Parameter> const &parameters() const;
+		size_t columns() const;
+
+		ParameterMatrix decode(TPatchVector const &patches) const;
+		// Decodes into a row that must have room for columns() values
+		void decode(DataFile const &patch, int *row) const;
+
+	private:
+		std::vector<Parameter> parameters_;
+		size_t columns_;
+	};
+
+}
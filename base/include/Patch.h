@@ -8,6 +8,7 @@
 
 #include "Synth.h"
 #include "Tag.h"
+#include "SharedPatchData.h"
 
 namespace midikraft {
 
@@ -17,6 +18,7 @@ namespace midikraft {
 	public:
 		DataFile(int dataTypeID);
 		DataFile(int dataTypeID, Synth::PatchData const &patchdata);
+		DataFile(int dataTypeID, SharedPatchData const &patchdata); // Shares the bytes instead of copying them
         DataFile(DataFile const& other) = default;
         virtual ~DataFile() = default;
 
@@ -24,19 +26,38 @@ namespace midikraft {
 
 		// Direct byte access functions
 		void setData(Synth::PatchData const &data);
+		void setData(Synth::PatchData &&data);
+		void setData(SharedPatchData const &data);
 		virtual void setDataFromSysex(MidiMessage const &message);
 		virtual Synth::PatchData const &data() const;
+		SharedPatchData const &sharedData() const; // To hand the bytes on to another DataFile without copying them
 		virtual int at(int sysExIndex) const;
 		virtual void setAt(int sysExIndex, uint8 value);
 
 		std::vector<juce::MidiMessage> asMidiMessages() const;
 
+		// Fingerprint cache, filled by Synth::fingerprint() and dropped whenever the bytes are modified via the setters above.
+		// The cache remembers which synth calculated it, as the fingerprint algorithm is synth specific
+		bool cachedFingerprint(Synth const *synth, std::string &outFingerprint) const;
+		void cacheFingerprint(Synth const *synth, std::string const &fingerprint) const;
+
 	protected:
+		// Subclasses that modify data_ directly must call this, else a stale fingerprint is returned
+		void invalidateFingerprint();
+
 		// Just any ID you want to give it
 		int dataTypeID_;
 
-		// Direct byte storage
-		Synth::PatchData data_;
+		// Direct byte storage, shared between copies of this DataFile. Subclasses write via data_.mutableBytes(), which unshares it first
+		SharedPatchData data_;
+
+	private:
+		struct CachedFingerprint {
+			Synth const *synth;
+			std::string fingerprint;
+		};
+		// Used with std::atomic_load/store, as the same DataFile is shared by many PatchHolders and might be hashed from several threads
+		mutable std::shared_ptr<CachedFingerprint const> fingerprint_;
 	};
 
 	class Patch : public DataFile {
@@ -30,6 +30,13 @@ namespace midikraft {
 		virtual std::vector<MidiMessage> patchToProgramDumpSysex(std::shared_ptr<DataFile> patch, MidiProgramNumber programNumber) const = 0;
 	};
 
+	// Implement this if the synth can queue program dump requests, so the Librarian can keep more than one request in flight while downloading a bank.
+	// The replies are put back in order via getProgramNumber()
+	class ProgramDumpPipeliningCapability {
+	public:
+		virtual int programDumpRequestWindow() const = 0; // Number of requests outstanding at the same time, 1 means stop-and-wait
+	};
+
 	class DefaultProgramPlaceInsteadOfEditBufferCapability {
 	public:
 		virtual MidiProgramNumber getDefaultProgramPlace() const = 0;
@@ -0,0 +1,53 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+namespace midikraft {
+
+	// Sysex bytes shared by all copies of a DataFile. The buffer itself is never modified once it is shared, 
+	// writing through mutableBytes() first makes a private copy if anybody else still holds on to it (copy on write)
+	class SharedPatchData {
+	public:
+		typedef std::vector<uint8> Bytes;
+
+		SharedPatchData() = default;
+		SharedPatchData(Bytes const &bytes) : buffer_(std::make_shared<Bytes>(bytes)) {}
+		SharedPatchData(Bytes &&bytes) : buffer_(std::make_shared<Bytes>(std::move(bytes))) {}
+		SharedPatchData(uint8 const *data, size_t size) : buffer_(std::make_shared<Bytes>(data, data + size)) {}
+
+		Bytes const &bytes() const { return buffer_ ? *buffer_ : emptyBytes(); }
+		uint8 const *data() const { return bytes().data(); }
+		size_t size() const { return buffer_ ? buffer_->size() : 0; }
+		bool empty() const { return size() == 0; }
+		uint8 operator[](size_t index) const { return (*buffer_)[index]; }
+		uint8 at(size_t index) const { return bytes().at(index); }
+
+		// Only call this from the thread owning the DataFile, a copy taken concurrently on another thread would see the write
+		Bytes &mutableBytes() {
+			if (!buffer_) {
+				buffer_ = std::make_shared<Bytes>();
+			}
+			else if (buffer_.use_count() > 1) {
+				buffer_ = std::make_shared<Bytes>(*buffer_);
+			}
+			return *buffer_;
+		}
+
+		bool sharesBufferWith(SharedPatchData const &other) const { return buffer_ && buffer_ == other.buffer_; }
+
+	private:
+		static Bytes const &emptyBytes() {
+			static const Bytes kEmpty;
+			return kEmpty;
+		}
+
+		std::shared_ptr<Bytes> buffer_;
+	};
+
+}
@@ -27,4 +27,24 @@ namespace midikraft {
 		virtual TPatchVector loadPatchesFromStream(std::vector<MidiMessage> const &streamDump) const = 0;
 	};
 
+	// Implement this if the synth can take the requests for the next stream elements while it is still sending the current one, so the Librarian
+	// keeps requests in flight instead of waiting for each element. Requests for elements past the end of the stream should return no messages
+	class StreamLoadPipeliningCapability {
+	public:
+		virtual int streamElementsRequestedAhead(StreamLoadCapability::StreamType streamType) const = 0; // In addition to the one being received, 0 means wait
+	};
+
+	// Implement this to have the stream checked one message at a time. Else isStreamComplete() and shouldStreamAdvance() get all messages received so far,
+	// after every single message
+	class StreamTrackingCapability {
+	public:
+		struct StreamTracker {
+			virtual ~StreamTracker() = default;
+			// Called once for each message of the stream, in order. Returns how many stream elements that message completed, usually 0 or 1
+			virtual int addMessage(MidiMessage const &message) = 0;
+			virtual bool isComplete() const = 0;
+		};
+		virtual std::shared_ptr<StreamTracker> createStreamTracker(StreamLoadCapability::StreamType streamType) const = 0;
+	};
+
 }
@@ -24,6 +24,7 @@ namespace midikraft {
 
 	class SendTarget;
 	class DataFile;
+	class BankDumpSplitCapability;
 	class Patch;
 
 	typedef std::vector<std::shared_ptr<DataFile>> TPatchVector;
@@ -38,6 +39,11 @@ namespace midikraft {
 		virtual std::shared_ptr<DataFile> patchFromPatchData(const Synth::PatchData &data, MidiProgramNumber place) const = 0;
 		virtual bool isOwnSysex(MidiMessage const &message) const = 0;
 
+		// Override this to speed up finding out which synth a sysex file is for. Return the bytes after F0 that all of your sysex messages start with,
+		// e.g. the manufacturer ID and a model byte, several if there are. isOwnSysex is then only asked for messages with one of these prefixes.
+		// The default, an empty list, means isOwnSysex is asked for every message
+		virtual std::vector<std::vector<uint8>> sysexHeaderPrefixes() const;
+
 		// Override this to make a prettier program name. This is the old version that expects the program number equal to program number + bank number times bank size
 		// Use friendlyProgramAndBankName instead
 		//[[deprecated]]
@@ -54,6 +60,15 @@ namespace midikraft {
 		// Override this if you disagree with the default implementation of calculating the fingerprint with an md5 of the filtered patch data
 		virtual std::string calculateFingerprint(std::shared_ptr<DataFile> patch) const;
 
+		// Override this and return false if your calculateFingerprint() must not be called from more than one thread at a time
+		virtual bool canCalculateFingerprintsConcurrently() const;
+
+		// Cached version of calculateFingerprint, the result is stored on the DataFile until its bytes change. Use this instead of calling calculateFingerprint directly
+		std::string fingerprint(std::shared_ptr<DataFile> patch) const;
+
+		// Batch version of fingerprint(), hashing all patches not yet cached on a number of worker threads. Returns the fingerprints in the order of the input
+		std::vector<std::string> fingerprints(TPatchVector const &patches) const;
+
 		// Override this if you have some words for the user of this synth to properly do the manual setup steps that might be required for vintage gear
 		virtual std::string setupHelpText() const;
 
@@ -64,11 +79,20 @@ namespace midikraft {
 		virtual void sendDataFileToSynth(std::shared_ptr<DataFile> dataFile, std::shared_ptr<SendTarget> target);
 		virtual void sendBlockOfMessagesToSynth(juce::MidiDeviceInfo const &midiOutput, std::vector<MidiMessage> const& buffer);
 
+		// Queue a call of sendBlockOfMessagesToSynth() on the output's send thread and return immediately. What it sends at full speed is paced with this synth's pacing.
+		// The finished handler is called from the send thread, and the synth must stay alive until then
+		virtual MidiSendQueue::JobID enqueueBlockOfMessagesToSynth(juce::MidiDeviceInfo const &midiOutput, std::vector<MidiMessage> const& buffer, TMidiSendFinished onFinished = nullptr);
+		// Override this if the synth needs pauses between messages, or can't take data at the full MIDI wire rate
+		virtual MidiSendPacing sendPacing() const;
+
 		// Helper methods
 		static int sizeOfBank(std::shared_ptr<Synth>, int zeroBasedBankNumber);
 		static MidiBankNumber bankNumberFromInt(std::shared_ptr<Synth>, int zeroBasedBankNumber);
 
 	private:
+		void appendToWindow(std::vector<MidiMessage> &window, MidiMessage const &message) const;
+		TPatchVector patchesFromSplitBank(BankDumpSplitCapability *splitter, std::vector<MidiMessage> const &bankDump);
+
 		size_t maxNumberMessagesPerPatch_; // UGLY global configuration which can be overriden by environment variable ORM_MAX_MSG_PER_PATCH. Default was 10, which was large enough for refaceDX but too small for other synths.
 	};
 
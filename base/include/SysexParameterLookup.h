@@ -0,0 +1,37 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "SynthParameterDefinition.h"
+
+namespace midikraft {
+
+	// Finds the parameter stored at a sysex index in constant time, e.g. to decode parameter change messages a synth sends while its knobs are turned.
+	// Build it once per synth from its parameter definitions, and build a new one if these can change. Elements of array parameters are found as well
+	class SysexParameterLookup {
+	public:
+		struct Entry {
+			std::shared_ptr<SynthParameterDefinition> definition;
+			int element; // Position within an array parameter, 0 for everything else
+		};
+
+		explicit SysexParameterLookup(std::shared_ptr<Synth> synth);
+		explicit SysexParameterLookup(std::vector<std::shared_ptr<SynthParameterDefinition>> const &definitions);
+
+		// nullptr if there is no parameter at that index
+		Entry const *find(int sysexIndex) const;
+		bool empty() const;
+
+	private:
+		void add(int sysexIndex, Entry const &entry);
+
+		int firstIndex_;
+		std::vector<Entry> entries_; // By sysex index minus the first index, without a definition where there is no parameter
+	};
+
+}
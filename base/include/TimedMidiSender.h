@@ -10,23 +10,38 @@
 
 #include "MidiController.h"
 
+#include <queue>
+
 namespace midikraft {
 
-	class TimedMidiSender : private Timer {
+	// Sends messages at a given time in the future from its own high priority thread, independent of how busy the message thread is
+	class TimedMidiSender : private Thread {
 	public:
-		TimedMidiSender(int sampleRate);
+		TimedMidiSender(int sampleRate); // The sample rate is no longer needed for the timing and only kept for compatibility
 		virtual ~TimedMidiSender() override;
 
 		void addMessageToBuffer(juce::MidiDeviceInfo const &midiOutput, MidiMessage &message, double timeRelativeToNowInS);
 
-		void timerCallback() override;
-
 	private:
-		int sampleRate_;
-		int previousSampleNumber_;
+		void run() override;
+
+		struct ScheduledMessage {
+			double dueMs;
+			uint64 sequence; // Keeps messages due at the same time in the order they were added
+			std::shared_ptr<SafeMidiOutput> output;
+			MidiMessage message;
+
+			bool operator >(ScheduledMessage const &other) const {
+				return dueMs > other.dueMs || (dueMs == other.dueMs && sequence > other.sequence);
+			}
+		};
+
 		double startTime_;
-		std::map<String, MidiBuffer> midiBuffer_;
-		std::map<String, MidiDeviceInfo> midiDevices_;
+		CriticalSection queueLock_;
+		std::priority_queue<ScheduledMessage, std::vector<ScheduledMessage>, std::greater<ScheduledMessage>> queue_;
+		uint64 nextSequence_;
+		std::map<String, std::shared_ptr<SafeMidiOutput>> outputs_; // Resolved once per device, so the send thread never has to ask the MidiController
+		WaitableEvent wakeUp_;
 	};
 
 }
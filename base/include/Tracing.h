@@ -0,0 +1,70 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace midikraft {
+
+	// Records spans of time per thread while a trace is running, for when something like an import is slow and we need to see where the time goes.
+	// Writing a span is one atomic increment into a preallocated buffer, no lock. When the buffer is full further spans are counted, but dropped.
+	// The result can be loaded into chrome://tracing or ui.perfetto.dev
+	class Tracing {
+	public:
+		static void start(size_t capacity = 1 << 16); // Discards the previous trace
+		static void stop();
+		static bool isRunning();
+
+		// Spans recorded so far and the number dropped because the buffer was full
+		static size_t recordedSpans();
+		static size_t droppedSpans();
+
+		// Chrome trace event JSON of the spans finished so far. Can be called while the trace is running
+		static bool writeChromeTrace(File const &file);
+		static std::string chromeTraceJson();
+
+		static int64_t nowNs();
+		static uint32_t currentThread(); // Small numbers instead of the OS thread IDs, in the order the threads first traced something
+		static void record(char const *name, std::string &&detail, int64_t startNs, int64_t endNs);
+
+	private:
+		struct Span;
+		struct Buffer;
+		static std::shared_ptr<Buffer> buffer();
+		static std::shared_ptr<Buffer> sBuffer_; // Only accessed with the atomic shared_ptr functions
+	};
+
+	// Measures from construction to destruction. The name must be a string literal or otherwise outlive the span. Does nothing while no trace is running
+	class TraceSpan {
+	public:
+		explicit TraceSpan(char const *name, std::string detail = std::string());
+		// The detail is only built while a trace is running, pass a lambda returning it when that costs something, e.g. formatting or a virtual call
+		template<typename TMakeDetail, typename = std::enable_if_t<std::is_invocable_r_v<std::string, TMakeDetail>>>
+		TraceSpan(char const *name, TMakeDetail &&makeDetail) : name_(name), startNs_(-1) {
+			if (Tracing::isRunning()) {
+				detail_ = makeDetail();
+				startNs_ = Tracing::nowNs();
+			}
+		}
+		~TraceSpan();
+		TraceSpan(TraceSpan const &) = delete;
+		TraceSpan &operator=(TraceSpan const &) = delete;
+
+	private:
+		char const *name_;
+		std::string detail_;
+		int64_t startNs_;
+	};
+
+}
@@ -11,42 +11,59 @@ namespace midikraft {
 		// This is just a sinus series, so theoretically we could run a loop and sum up sine functions...
 		// But this is what the inverse FFT is for, isn't it?
 
-		// Create the FFT object with 256 bins (2^8)
-		dsp::FFT fft(8);
+		// The FFT object with 256 bins (2^8) precomputes its twiddle factors, so it is only created once. perform() doesn't modify it
+		static const dsp::FFT fft(8);
 
 		// Build the input array
-		std::vector<dsp::Complex<float>> input(256);
-		for (auto harmonic : harmonics.harmonics()) {
-            if (harmonic.first > 0) {
-                input[static_cast<size_t>(harmonic.first)] = dsp::Complex<float>(0.0f, harmonic.second);
-            }
-            else {
-                jassertfalse;
-            }
+		std::vector<dsp::Complex<float>> input(kWaveLength);
+		auto const &amplitudes = harmonics.amplitudes();
+		for (size_t harmonic = 1; harmonic < amplitudes.size(); harmonic++) {
+			input[harmonic] = dsp::Complex<float>(0.0f, amplitudes[harmonic]);
 		}
 
 		// Reserve output array and run inverse transform
-		std::vector<dsp::Complex<float>> output(256);
-		fft.perform(&input[0], &output[0], true);
+		std::vector<dsp::Complex<float>> output(kWaveLength);
+		fft.perform(input.data(), output.data(), true);
 
 		// Extract usable part of wave...
-		std::vector<float> result;
-		for (auto o : output) {
-			result.push_back(o.real());
+		std::vector<float> result(kWaveLength);
+		for (size_t i = 0; i < kWaveLength; i++) {
+			result[i] = output[i].real();
 		}
 		return result;
+	}
 
+	Additive::Harmonics::Harmonics()
+	{
+		amplitudes_.fill(0.0f);
 	}
 
 	void Additive::Harmonics::setHarmonic(int harmonicNumber, float value)
 	{
-		if (value > 0.0f) {
-			harmonics_[harmonicNumber] = value;
+		if (harmonicNumber < 1 || harmonicNumber > kMaxHarmonic) {
+			jassertfalse;
+			return;
+		}
+		amplitudes_[static_cast<size_t>(harmonicNumber)] = value > 0.0f ? value : 0.0f;
+	}
+
+	float Additive::Harmonics::harmonic(int harmonicNumber) const
+	{
+		if (harmonicNumber < 1 || harmonicNumber > kMaxHarmonic) {
+			return 0.0f;
 		}
-		else {
-			auto found = harmonics_.find(harmonicNumber);
-			if (found != harmonics_.end()) harmonics_.erase(found);
+		return amplitudes_[static_cast<size_t>(harmonicNumber)];
+	}
+
+	std::map<int, float> Additive::Harmonics::harmonics() const
+	{
+		std::map<int, float> result;
+		for (int harmonic = 1; harmonic <= kMaxHarmonic; harmonic++) {
+			if (amplitudes_[static_cast<size_t>(harmonic)] > 0.0f) {
+				result[harmonic] = amplitudes_[static_cast<size_t>(harmonic)];
+			}
 		}
+		return result;
 	}
 
 }
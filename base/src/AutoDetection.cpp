@@ -26,9 +26,16 @@ namespace midikraft {
 
 	AutoDetection::AutoDetection() : handler_(MidiController::makeOneHandle())
 	{
-		MidiController::instance()->addMessageHandler(handler_, [this](MidiInput *source, MidiMessage const &midimessage) {
-			if (!isSynth_.expired()) {
-				isSynth_.lock()->handleIncomingMidiMessage(source, midimessage);
+		MidiController::instance()->addMessageHandler(handler_, MidiMessageFilter::nonRealtime(), [this](MidiInput *source, MidiMessage const &midimessage) {
+			std::vector<std::weak_ptr<IsSynth>> listening;
+			{
+				ScopedLock lock(listeningLock_);
+				listening = listening_;
+			}
+			for (auto const &isSynth : listening) {
+				if (auto callback = isSynth.lock()) {
+					callback->handleIncomingMidiMessage(source, midimessage);
+				}
 			}
 		});
 	}
@@ -41,10 +48,24 @@ namespace midikraft {
 	void AutoDetection::autoconfigure(std::vector<std::shared_ptr<SimpleDiscoverableDevice>> &allSynths, ProgressHandler *progressHandler)
 	{
 		spdlog::debug("Starting auto configure of all synths");
-		// For all devices that are discoverable, run the find method
+		// Hack - if the wait time is negative, don't autodetect. This needs to be replaced by some proper dynamic cast
+		std::vector<SimpleDiscoverableDevice *> candidates;
 		for (auto synthHolder : allSynths) {
-			if (synthHolder) {
-				findSynth(synthHolder.get(), progressHandler);
+			if (synthHolder && synthHolder->deviceDetectSleepMS() >= 0) {
+				candidates.push_back(synthHolder.get());
+			}
+		}
+
+		// First ask all synths on all outputs at the same time, so the synths not connected cost a single sleep together.
+		// Only for the ones replying we need to run the find method to figure out where they are
+		auto replying = synthsReplyingAnywhere(candidates);
+		for (auto synth : candidates) {
+			if (progressHandler && progressHandler->shouldAbort()) break;
+			if (std::find(replying.cbegin(), replying.cend(), synth) != replying.cend()) {
+				findSynth(synth, progressHandler);
+			}
+			else {
+				spdlog::error("No {} could be detected - is it turned on?", synth->getName());
 			}
 		}
 		listenerToAllFound(allSynths);
@@ -55,7 +76,7 @@ namespace midikraft {
 	void AutoDetection::quickconfigure(std::vector<std::shared_ptr<SimpleDiscoverableDevice>> &allSynths)
 	{
 		spdlog::debug("Starting quick configure of all synths");
-		// For all devices that are discoverable, run the find method
+		std::vector<SimpleDiscoverableDevice *> candidates;
 		for (auto &synthHolder : allSynths) {
 			if (synthHolder) {
 				auto synth = synthHolder.get();
@@ -65,16 +86,23 @@ namespace midikraft {
 				if (synthHolder->deviceDetectSleepMS() < 0) {
 					continue;
 				}
-				if (!checkSynth(synth)) {
-					spdlog::warn(
-						"Lost communication with {} on channel {} of device {} - please rerun auto-detect synths!",
-							 synth->getName(), synth->channel().toOneBasedInt(), synth->midiOutput().name.toStdString());
-				}
-				else {
-					spdlog::info("Detected {} on channel {} of device {}",
-						synth->getName(), synth->channel().toOneBasedInt(), synth->midiOutput().name.toStdString());
-				}
+				candidates.push_back(synth);
+			}
 		}
+
+		// Check all synths at once, this takes as long as the slowest synth instead of the sum of all
+		auto ok = checkSynths(candidates);
+		for (size_t i = 0; i < candidates.size(); i++) {
+			auto synth = candidates[i];
+			if (!ok[i]) {
+				spdlog::warn(
+					"Lost communication with {} on channel {} of device {} - please rerun auto-detect synths!",
+					synth->getName(), synth->channel().toOneBasedInt(), synth->midiOutput().name.toStdString());
+			}
+			else {
+				spdlog::info("Detected {} on channel {} of device {}",
+					synth->getName(), synth->channel().toOneBasedInt(), synth->midiOutput().name.toStdString());
+			}
 		}
 		listenerToAllFound(allSynths);
 		spdlog::debug("Quick configure of all synths done, notifying listeners");
@@ -121,7 +149,7 @@ namespace midikraft {
 			progressHandler->setMessage(fmt::format("Trying to detect {}...", synth->getName()));
 		}
 
-		auto locations = FindSynthOnMidiNetwork::detectSynth(*synth, progressHandler);
+		auto locations = FindSynthOnMidiNetwork::detectSynth(*synth, progressHandler, FindSynthOnMidiNetwork::DetectionMode::BROADCAST);
 		if (locations.size() > 0) {
 			for (auto loc : locations) {
 				spdlog::info("Found {} on channel {} replying on device {} when sending to {} on channel {}",
@@ -141,47 +169,112 @@ namespace midikraft {
 		}
 	}
 
-	bool AutoDetection::checkSynth(SimpleDiscoverableDevice *synth) {
-		// Hack - if the wait time is negative, don't autodetect. This needs to be replaced by some proper dynamic cast
-		if (synth->deviceDetectSleepMS() < 0) {
-			return false;
-		}
-
-		// This is the fast version of the FindSynthOnMidiNetwork routine - just a single pass to see if the synth responds
-		std::shared_ptr<IsSynth> callback = std::make_shared<IsSynth>(*synth);
-		isSynth_ = callback;
-		MidiController::instance()->enableMidiInput(synth->midiInput());
-
-		// Send the detect message
-		int deviceDetectId = 0x7f;
-		if (synth->needsChannelSpecificDetection())
-		{
-			// Only use the channel when the device needs a channel as parameter. Most synths react on the 0x7f generic device value.
-			deviceDetectId = synth->channel().toZeroBasedInt() & 0x7f;
-		}
-		auto detectMessage = synth->deviceDetect(deviceDetectId);
-		// As of Dec 2020 the only Synth that needs more than one message for detection seems to be the Matrix 6, which is fast. 
-		//TODO:  I cannot use the synth's sendBlockOfMessagesToSynth() here because I do not have a synth pointer. Smell?
-		MidiController::instance()->getMidiOutput(synth->midiOutput())->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessage));
-
-		// Sleep as long as the synth thinks is enough
-		Thread::sleep(synth->deviceDetectSleepMS());
-
-		// Check if we found it
-		bool ok = false;
-		for (auto found : callback->locations()) {
-			if (found.input == synth->midiInput() && found.midiChannel.toZeroBasedInt() == synth->channel().toZeroBasedInt()) {
-				ok = true;
-				// Super special case - we might want to terminate the successful device detection with a special message sent to the same output as the detect message!
-				MidiMessage endDetectMessage;
-				if (synth->endDeviceDetect(endDetectMessage)) {
-					MidiController::instance()->getMidiOutput(synth->midiOutput())->sendMessageNow(endDetectMessage);
+	std::vector<std::shared_ptr<IsSynth>> AutoDetection::startListening(std::vector<SimpleDiscoverableDevice *> const &synths)
+	{
+		std::vector<std::shared_ptr<IsSynth>> callbacks;
+		ScopedLock lock(listeningLock_);
+		listening_.clear();
+		for (auto synth : synths) {
+			callbacks.push_back(std::make_shared<IsSynth>(*synth));
+			listening_.push_back(callbacks.back());
+		}
+		return callbacks;
+	}
+
+	std::vector<bool> AutoDetection::checkSynths(std::vector<SimpleDiscoverableDevice *> const &synths) {
+		// This is the fast version of the FindSynthOnMidiNetwork routine - just a single pass to see if the synths respond where we expect them.
+		// All synths are asked at the same time, as each checks only replies on its own input and channel
+		auto callbacks = startListening(synths);
+		std::set<juce::MidiDeviceInfo> inputs;
+		int sleepMS = 0;
+		for (auto synth : synths) {
+			if (inputs.insert(synth->midiInput()).second) {
+				MidiController::instance()->enableMidiInput(synth->midiInput());
+			}
+
+			// Send the detect message
+			int deviceDetectId = 0x7f;
+			if (synth->needsChannelSpecificDetection())
+			{
+				// Only use the channel when the device needs a channel as parameter. Most synths react on the 0x7f generic device value.
+				deviceDetectId = synth->channel().toZeroBasedInt() & 0x7f;
+			}
+			auto detectMessage = synth->deviceDetect(deviceDetectId);
+			// As of Dec 2020 the only Synth that needs more than one message for detection seems to be the Matrix 6, which is fast. 
+			//TODO:  I cannot use the synth's sendBlockOfMessagesToSynth() here because I do not have a synth pointer. Smell?
+			MidiController::instance()->getMidiOutput(synth->midiOutput())->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessage));
+			sleepMS = std::max(sleepMS, synth->deviceDetectSleepMS());
+		}
+
+		// Sleep as long as the slowest synth thinks is enough
+		Thread::sleep(sleepMS);
+
+		// Check if we found them
+		std::vector<bool> result;
+		for (size_t i = 0; i < synths.size(); i++) {
+			auto synth = synths[i];
+			bool ok = false;
+			for (auto found : callbacks[i]->locations()) {
+				if (found.input == synth->midiInput() && found.midiChannel.toZeroBasedInt() == synth->channel().toZeroBasedInt()) {
+					ok = true;
+					// Super special case - we might want to terminate the successful device detection with a special message sent to the same output as the detect message!
+					MidiMessage endDetectMessage;
+					if (synth->endDeviceDetect(endDetectMessage)) {
+						MidiController::instance()->getMidiOutput(synth->midiOutput())->sendMessageNow(endDetectMessage);
+					}
 				}
 			}
+			synth->setWasDetected(ok);
+			result.push_back(ok);
+		}
+		startListening({});
+		for (auto const &input : inputs) {
+			MidiController::instance()->disableMidiInput(input);
+		}
+		return result;
+	}
+
+	std::vector<SimpleDiscoverableDevice *> AutoDetection::synthsReplyingAnywhere(std::vector<SimpleDiscoverableDevice *> const &synths)
+	{
+		if (synths.empty()) return {};
+
+		// Send every synth's detect messages to every output, and listen on every input for a single sleep window
+		auto callbacks = startListening(synths);
+		auto inputs = MidiController::instance()->availableInputs();
+		auto outputs = MidiController::instance()->availableOutputs();
+		for (auto const &input : inputs) {
+			MidiController::instance()->enableMidiInput(input);
+		}
+		int sleepMS = 0;
+		for (auto synth : synths) {
+			std::vector<MidiMessage> detectMessages;
+			if (synth->needsChannelSpecificDetection()) {
+				for (int channel = 0; channel < 16; channel++) {
+					auto messages = synth->deviceDetect(channel);
+					detectMessages.insert(detectMessages.end(), messages.begin(), messages.end());
+				}
+			}
+			else {
+				detectMessages = synth->deviceDetect(0x7f);
+			}
+			for (auto const &output : outputs) {
+				MidiController::instance()->getMidiOutput(output)->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessages));
+			}
+			sleepMS = std::max(sleepMS, synth->deviceDetectSleepMS());
+		}
+		Thread::sleep(sleepMS);
+
+		std::vector<SimpleDiscoverableDevice *> result;
+		for (size_t i = 0; i < synths.size(); i++) {
+			if (!callbacks[i]->locations().empty()) {
+				result.push_back(synths[i]);
+			}
+		}
+		startListening({});
+		for (auto const &input : inputs) {
+			MidiController::instance()->disableMidiInput(input);
 		}
-		MidiController::instance()->disableMidiInput(synth->midiInput());
-		synth->setWasDetected(ok);
-		return ok;
+		return result;
 	}
 
 	void AutoDetection::listenerToAllFound(std::vector<std::shared_ptr<SimpleDiscoverableDevice>> &allSynths) {
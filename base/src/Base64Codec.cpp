@@ -0,0 +1,140 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Base64Codec.h"
+
+#include <array>
+
+namespace midikraft {
+
+	namespace {
+
+		const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		const uint8_t kInvalid = 0xff;
+		const uint8_t kWhitespace = 0xfe;
+		const uint8_t kPadding = 0xfd;
+
+		std::array<uint8_t, 256> buildDecodeTable() {
+			std::array<uint8_t, 256> table;
+			table.fill(kInvalid);
+			for (uint8_t i = 0; i < 64; i++) {
+				table[(uint8_t)kAlphabet[i]] = i;
+			}
+			for (char c : { ' ', '\t', '\r', '\n' }) {
+				table[(uint8_t)c] = kWhitespace;
+			}
+			table[(uint8_t)'='] = kPadding;
+			return table;
+		}
+
+		const std::array<uint8_t, 256> kDecodeTable = buildDecodeTable();
+
+	}
+
+	size_t Base64Codec::encodedLength(size_t dataLength)
+	{
+		return (dataLength + 2) / 3 * 4;
+	}
+
+	size_t Base64Codec::maxDecodedLength(size_t textLength)
+	{
+		return textLength / 4 * 3 + 3;
+	}
+
+	std::string Base64Codec::encode(uint8_t const* data, size_t length)
+	{
+		std::string result;
+		encode(data, length, result);
+		return result;
+	}
+
+	std::string Base64Codec::encode(std::vector<uint8_t> const& data)
+	{
+		return encode(data.data(), data.size());
+	}
+
+	void Base64Codec::encode(uint8_t const* data, size_t length, std::string& outText)
+	{
+		size_t start = outText.size();
+		outText.resize(start + encodedLength(length));
+		char* out = &outText[0] + start;
+		size_t i = 0;
+		// Whole groups of three bytes first, the tail is padded
+		for (; i + 3 <= length; i += 3) {
+			uint32_t group = (uint32_t(data[i]) << 16) | (uint32_t(data[i + 1]) << 8) | data[i + 2];
+			*out++ = kAlphabet[(group >> 18) & 0x3f];
+			*out++ = kAlphabet[(group >> 12) & 0x3f];
+			*out++ = kAlphabet[(group >> 6) & 0x3f];
+			*out++ = kAlphabet[group & 0x3f];
+		}
+		size_t rest = length - i;
+		if (rest > 0) {
+			uint32_t group = uint32_t(data[i]) << 16;
+			if (rest == 2) {
+				group |= uint32_t(data[i + 1]) << 8;
+			}
+			*out++ = kAlphabet[(group >> 18) & 0x3f];
+			*out++ = kAlphabet[(group >> 12) & 0x3f];
+			*out++ = rest == 2 ? kAlphabet[(group >> 6) & 0x3f] : '=';
+			*out++ = '=';
+		}
+	}
+
+	bool Base64Codec::decode(char const* text, size_t length, std::vector<uint8_t>& outData)
+	{
+		outData.resize(maxDecodedLength(length));
+		uint8_t* out = outData.data();
+		uint32_t group = 0;
+		int collected = 0;
+		int padding = 0;
+		for (size_t i = 0; i < length; i++) {
+			uint8_t value = kDecodeTable[(uint8_t)text[i]];
+			if (value < 64) {
+				if (padding > 0) {
+					// Nothing but padding may follow padding
+					outData.clear();
+					return false;
+				}
+				group = (group << 6) | value;
+				if (++collected == 4) {
+					*out++ = uint8_t(group >> 16);
+					*out++ = uint8_t(group >> 8);
+					*out++ = uint8_t(group);
+					group = 0;
+					collected = 0;
+				}
+			}
+			else if (value == kPadding) {
+				padding++;
+			}
+			else if (value != kWhitespace) {
+				outData.clear();
+				return false;
+			}
+		}
+		// A last group without or with padding: two characters make one byte, three make two
+		if (collected == 1 || padding > 2 || (padding > 0 && collected + padding != 4)) {
+			outData.clear();
+			return false;
+		}
+		if (collected == 2) {
+			*out++ = uint8_t(group >> 4);
+		}
+		else if (collected == 3) {
+			*out++ = uint8_t(group >> 10);
+			*out++ = uint8_t(group >> 2);
+		}
+		outData.resize(size_t(out - outData.data()));
+		return true;
+	}
+
+	bool Base64Codec::decode(std::string const& text, std::vector<uint8_t>& outData)
+	{
+		return decode(text.data(), text.size(), outData);
+	}
+
+}
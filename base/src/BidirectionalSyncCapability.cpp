@@ -0,0 +1,43 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "BidirectionalSyncCapability.h"
+
+namespace midikraft {
+
+	std::vector<BidirectionalSyncCapability::ParameterChange> BidirectionalSyncCapability::determineParameterChangesFromSysex(std::vector<juce::MidiMessage> const& messages)
+	{
+		std::vector<ParameterChange> result;
+		if (!parameterChangesAreSingleMessages()) {
+			std::shared_ptr<SynthParameterDefinition> param;
+			int value;
+			if (determineParameterChangeFromSysex(messages, &param, value) && param) {
+				result.push_back({ param, value });
+			}
+			return result;
+		}
+
+		std::map<SynthParameterDefinition *, size_t> positions;
+		std::vector<juce::MidiMessage> single(1); // Reused for every message of the burst
+		for (auto const& message : messages) {
+			single[0] = message;
+			std::shared_ptr<SynthParameterDefinition> param;
+			int value;
+			if (determineParameterChangeFromSysex(single, &param, value) && param) {
+				auto found = positions.find(param.get());
+				if (found != positions.end()) {
+					result[found->second].value = value;
+				}
+				else {
+					positions[param.get()] = result.size();
+					result.push_back({ param, value });
+				}
+			}
+		}
+		return result;
+	}
+
+}
@@ -0,0 +1,186 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "ControllerMappingTable.h"
+
+#include "Capability.h"
+#include "DetailedParametersCapability.h"
+
+namespace midikraft {
+
+	namespace {
+
+		const int kNrpnParameterMsb = 99;
+		const int kNrpnParameterLsb = 98;
+		const int kRpnParameterMsb = 101;
+		const int kRpnParameterLsb = 100;
+		const int kDataEntryMsb = 6;
+		const int kDataEntryLsb = 38;
+
+		std::vector<std::shared_ptr<SynthParameterDefinition>> definitionsOf(std::shared_ptr<Synth> synth) {
+			auto detailed = Capability::hasCapability<DetailedParametersCapability>(synth);
+			if (detailed) {
+				return detailed->allParameterDefinitions();
+			}
+			return {};
+		}
+
+	}
+
+	ControllerMappingTable::ControllerMappingTable(std::shared_ptr<Synth> synth, MidiChannel channel) : ControllerMappingTable(definitionsOf(synth), channel)
+	{
+	}
+
+	ControllerMappingTable::ControllerMappingTable(std::vector<std::shared_ptr<SynthParameterDefinition>> const& definitions, MidiChannel channel) : mappedCount_(0)
+	{
+		for (auto const& definition : definitions) {
+			if (!definition) continue;
+			auto mapping = Capability::hasCapability<SynthParameterControllerMappingCapability>(definition.get());
+			if (!mapping) continue;
+
+			// Any valid value will do, only the controller numbers are of interest
+			int sampleValue = 0;
+			if (auto range = Capability::hasCapability<SynthIntValueParameterCapability>(definition.get())) {
+				sampleValue = range->minValue();
+			}
+			auto messages = mapping->createParameterMessages(sampleValue, channel);
+
+			int messageChannel = -1;
+			int parameterMsb = -1;
+			int parameterLsb = -1;
+			int controller = -1;
+			int controllers = 0;
+			bool onlyControllers = !messages.empty();
+			for (auto const& message : messages) {
+				if (!message.isController() || (messageChannel != -1 && message.getChannel() - 1 != messageChannel)) {
+					onlyControllers = false;
+					break;
+				}
+				messageChannel = message.getChannel() - 1;
+				switch (message.getControllerNumber()) {
+				case kNrpnParameterMsb: parameterMsb = message.getControllerValue(); break;
+				case kNrpnParameterLsb: parameterLsb = message.getControllerValue(); break;
+				default: controller = message.getControllerNumber(); controllers++;
+				}
+			}
+
+			Mapping entry{ definition, mapping };
+			if (onlyControllers && parameterMsb != -1 && parameterLsb != -1) {
+				byKey_[nrpnKey(messageChannel, (parameterMsb << 7) | parameterLsb)].push_back(entry);
+				mappedCount_++;
+			}
+			else if (onlyControllers && parameterMsb == -1 && parameterLsb == -1 && controllers == 1) {
+				byKey_[ccKey(messageChannel, controller)].push_back(entry);
+				mappedCount_++;
+			}
+			else {
+				unmapped_.push_back(entry);
+			}
+		}
+	}
+
+	uint32 ControllerMappingTable::ccKey(int channel, int controller)
+	{
+		return ((uint32)channel << 16) | (uint32)controller;
+	}
+
+	uint32 ControllerMappingTable::nrpnKey(int channel, int parameter)
+	{
+		return (1u << 24) | ((uint32)channel << 16) | (uint32)parameter;
+	}
+
+	bool ControllerMappingTable::matchAny(std::vector<Mapping> const& candidates, std::vector<MidiMessage> const& messages, Match& outMatch) const
+	{
+		for (auto const& candidate : candidates) {
+			int value;
+			if (candidate.mapping->messagesMatchParameter(messages, value)) {
+				outMatch = { candidate.definition, value };
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ControllerMappingTable::process(MidiMessage const& message, Match& outMatch)
+	{
+		if (!message.isController()) {
+			return matchAny(unmapped_, { message }, outMatch);
+		}
+
+		int channel = message.getChannel() - 1;
+		int value = message.getControllerValue();
+		auto& state = nrpn_[(size_t)channel];
+		switch (message.getControllerNumber()) {
+		case kNrpnParameterMsb:
+			state.parameterMsb = value;
+			state.valueMsb = -1;
+			return false;
+		case kNrpnParameterLsb:
+			state.parameterLsb = value;
+			state.valueMsb = -1;
+			return false;
+		case kRpnParameterMsb:
+		case kRpnParameterLsb:
+			// Data entry now belongs to an RPN, which is never mapped
+			state = NrpnState();
+			return false;
+		case kDataEntryMsb:
+			if (state.parameterMsb != -1 && state.parameterLsb != -1) {
+				state.valueMsb = value;
+				return processNrpn(channel, -1, outMatch);
+			}
+			break;
+		case kDataEntryLsb:
+			if (state.parameterMsb != -1 && state.parameterLsb != -1 && state.valueMsb != -1) {
+				return processNrpn(channel, value, outMatch);
+			}
+			break;
+		default:
+			break;
+		}
+
+		auto found = byKey_.find(ccKey(channel, message.getControllerNumber()));
+		if (found != byKey_.end() && matchAny(found->second, { message }, outMatch)) {
+			return true;
+		}
+		return matchAny(unmapped_, { message }, outMatch);
+	}
+
+	bool ControllerMappingTable::processNrpn(int channel, int lsbValue, Match& outMatch)
+	{
+		auto const& state = nrpn_[(size_t)channel];
+		auto found = byKey_.find(nrpnKey(channel, (state.parameterMsb << 7) | state.parameterLsb));
+		if (found == byKey_.end()) {
+			return false;
+		}
+		// Hand the parameter the whole NRPN as it would send it, so it decides itself if it wants the value LSB as well
+		std::vector<MidiMessage> messages = {
+			MidiMessage::controllerEvent(channel + 1, kNrpnParameterMsb, state.parameterMsb),
+			MidiMessage::controllerEvent(channel + 1, kNrpnParameterLsb, state.parameterLsb),
+			MidiMessage::controllerEvent(channel + 1, kDataEntryMsb, state.valueMsb)
+		};
+		if (lsbValue != -1) {
+			messages.push_back(MidiMessage::controllerEvent(channel + 1, kDataEntryLsb, lsbValue));
+		}
+		return matchAny(found->second, messages, outMatch);
+	}
+
+	void ControllerMappingTable::reset()
+	{
+		nrpn_.fill(NrpnState());
+	}
+
+	size_t ControllerMappingTable::mappedCount() const
+	{
+		return mappedCount_;
+	}
+
+	size_t ControllerMappingTable::unmappedCount() const
+	{
+		return unmapped_.size();
+	}
+
+}
@@ -314,12 +314,13 @@ namespace midikraft {
 	{
 		// Parse the string - there should be 9 digits in there, ignore spaces
 		Additive::Harmonics harmonics;
+		auto const &drawbars = hammondDrawbars();
 		size_t position = 0;
 		for (char c : registrationString) {
-			if (c >= '0' && c <= '8') {
+			if (c >= '0' && c <= '8' && position < drawbars.size()) {
 				// Valid character
 				int value = c - '0';
-				harmonics.setHarmonic(hammondDrawbars()[position].harmonic_number_, static_cast<float>(value) / 8.0f);
+				harmonics.setHarmonic(drawbars[position].harmonic_number_, static_cast<float>(value) / 8.0f);
 				position++;
 			}
 			else if (c != ' ') {
@@ -330,9 +331,31 @@ namespace midikraft {
 		return harmonics;
 	}
 
-	std::vector<midikraft::Drawbar> DrawbarOrgan::hammondDrawbars()
+	static std::vector<std::vector<float>> renderRegistrations(std::vector<DrawbarOrgan::RegistrationDefinition> const &registrations)
 	{
-		std::vector<Drawbar> kHammondDrawbars = {
+		std::vector<std::vector<float>> result;
+		result.reserve(registrations.size());
+		for (auto const &registration : registrations) {
+			result.push_back(Additive::createSamplesFromHarmonics(registration.second));
+		}
+		return result;
+	}
+
+	std::vector<std::vector<float>> const &DrawbarOrgan::popularRegistrationSamples()
+	{
+		static const std::vector<std::vector<float>> kSamples = renderRegistrations(popularRegistrations);
+		return kSamples;
+	}
+
+	std::vector<std::vector<float>> const &DrawbarOrgan::pipeOrganStopSamples()
+	{
+		static const std::vector<std::vector<float>> kSamples = renderRegistrations(pipeOrganStops);
+		return kSamples;
+	}
+
+	std::vector<midikraft::Drawbar> const &DrawbarOrgan::hammondDrawbars()
+	{
+		static const std::vector<Drawbar> kHammondDrawbars = {
 			Drawbar("16'", Drawbar::BROWN, "Sub-octave", "Bass", 1),
 			Drawbar("5 2/3'", Drawbar::BROWN, "5th", "Quint", 3),
 			Drawbar("8'", Drawbar::WHITE, "Unison", "Neutral", 2),
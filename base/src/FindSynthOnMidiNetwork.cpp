@@ -21,14 +21,27 @@ namespace midikraft {
 		MidiChannel channel = synth_.channelIfValidDeviceResponse(message);
 		if (channel.isValid()) {
 			synth_.setWasDetected(true);
+			ScopedLock lock(foundLock_);
 			found_.push_back(MidiNetworkLocation(source->getDeviceInfo(), MidiDeviceInfo(), channel));
 		}
 	}
 
-	FindSynthOnMidiNetwork::FindSynthOnMidiNetwork(DiscoverableDevice &synth, std::string const &text, ProgressHandler *progressHandler) :
-		Thread(text), handler_(MidiController::makeOneHandle()), synth_(synth), progressHandler_(progressHandler)
+	std::vector<MidiNetworkLocation> IsSynth::locations()
 	{
-		MidiController::instance()->addMessageHandler(handler_, [this](MidiInput *source, MidiMessage const &midimessage) {
+		ScopedLock lock(foundLock_);
+		return found_;
+	}
+
+	void IsSynth::restart()
+	{
+		ScopedLock lock(foundLock_);
+		found_.clear();
+	}
+
+	FindSynthOnMidiNetwork::FindSynthOnMidiNetwork(DiscoverableDevice &synth, std::string const &text, ProgressHandler *progressHandler, DetectionMode mode) :
+		Thread(text), handler_(MidiController::makeOneHandle()), synth_(synth), progressHandler_(progressHandler), mode_(mode)
+	{
+		MidiController::instance()->addMessageHandler(handler_, MidiMessageFilter::nonRealtime(), [this](MidiInput *source, MidiMessage const &midimessage) {
 			if (!isSynth_.expired()) {
 				isSynth_.lock()->handleIncomingMidiMessage(source, midimessage);
 			}
@@ -44,8 +57,10 @@ namespace midikraft {
 	{
 		// We will do the following - select a MIDI in, and send the "Device ID" message to all MIDI outs.
 		// If none found, repeat with the next MIDI in
-		int midiIns = MidiInput::getAvailableDevices().size();
-		int midiOuts = MidiOutput::getAvailableDevices().size();
+		auto midiInputs = MidiController::instance()->availableInputs();
+		auto midiOutputs = MidiController::instance()->availableOutputs();
+		int midiIns = (int) midiInputs.size();
+		int midiOuts = (int) midiOutputs.size();
 
 		// This detector can be enabled on all ins during the scan
 		std::shared_ptr<IsSynth> callback = std::make_shared<IsSynth>(synth_);
@@ -53,66 +68,103 @@ namespace midikraft {
 
 		// Loop over all inputs and enable them, add the callback
 		for (int input = 0; input < midiIns; input++) {
-			auto inputName = MidiInput::getAvailableDevices()[input];
+			auto inputName = midiInputs[input];
 			MidiController::instance()->enableMidiInput(inputName);
 		}
 
-		// Now loop over outputs
-		for (int output = 0; output < midiOuts; output++) {
-			if (progressHandler_ && progressHandler_->shouldAbort()) break;
-			callback->restart();
-			if (synth_.needsChannelSpecificDetection()) {
-				// Test all 16 channels
-				for (int channel = 0; channel < 16; channel++) {
-					// Send the synth detection signal
-					auto detectMessage = synth_.deviceDetect(channel);
-					//TODO:  I cannot use the synth's sendBlockOfMessagesToSynth() here because I do not have a synth pointer. Smell?
-					MidiController::instance()->getMidiOutput(MidiOutput::getAvailableDevices()[output])->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessage));
-				}
-			}
-			else {
-				// Just one message is enough - use a "broadcast" channel or sysex device ID as parameter
-				auto detectMessage = synth_.deviceDetect(0x7f);
-				//TODO:  I cannot use the synth's sendBlockOfMessagesToSynth() here because I do not have a synth pointer. Smell?
-				MidiController::instance()->getMidiOutput(MidiOutput::getAvailableDevices()[output])->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessage));
-			}
+		if (mode_ == DetectionMode::BROADCAST) {
+			probeOutputs(callback, midiOutputs, 0, midiOutputs.size());
+		}
+		else {
+			// Now loop over outputs
+			for (int output = 0; output < midiOuts; output++) {
+				if (progressHandler_ && progressHandler_->shouldAbort()) break;
+				callback->restart();
+				sendDetectMessages(midiOutputs[output]);
+
+				// Sleep
+				Thread::sleep(synth_.deviceDetectSleepMS());
+
+				// must check this as often as possible, because this is
+				// how we know if the user's pressed 'cancel'
+				if (threadShouldExit())
+					break;
+
+				// this will update the progress bar on the dialog box
+				if (progressHandler_) progressHandler_->setProgressPercentage(output / (double)midiOuts);
 
-			// Sleep
-			Thread::sleep(synth_.deviceDetectSleepMS());
-
-			// must check this as often as possible, because this is
-			// how we know if the user's pressed 'cancel'
-			if (threadShouldExit())
-				break;
-
-			// this will update the progress bar on the dialog box
-			if (progressHandler_) progressHandler_->setProgressPercentage(output / (double)midiOuts);
-
-			// Copy results
-			for (auto const &found : callback->locations()) {
-				auto withOutput = found;
-				withOutput.output = MidiOutput::getAvailableDevices()[output];
-				locations_.push_back(withOutput);
-				// Super special case - we might want to terminate the successful device detection with a special message sent to the same output as the detect message!
-				MidiMessage endDetectMessage;
-				if (synth_.endDeviceDetect(endDetectMessage)) {
-					MidiController::instance()->getMidiOutput(MidiOutput::getAvailableDevices()[output])->sendMessageNow(endDetectMessage);
-				}
+				recordLocations(callback, midiOutputs[output]);
 			}
 		}
 
 		// Loop over all inputs and turn them off, remove callback
 		for (int input = 0; input < midiIns; input++) {
-			auto inputName = MidiInput::getAvailableDevices()[input];
+			auto inputName = midiInputs[input];
 			MidiController::instance()->disableMidiInput(inputName);
 		}
 		
 	}
 
-	std::vector<MidiNetworkLocation> FindSynthOnMidiNetwork::detectSynth(DiscoverableDevice &synth, ProgressHandler *progressHandler)
+	void FindSynthOnMidiNetwork::probeOutputs(std::shared_ptr<IsSynth> callback, std::vector<juce::MidiDeviceInfo> const &outputs, size_t from, size_t to)
+	{
+		if (from >= to || threadShouldExit() || (progressHandler_ && progressHandler_->shouldAbort())) return;
+
+		// Send to the whole range at once and wait only once. Silence rules out all of them, else bisect to find out which outputs the replies belong to.
+		// With no synth found this is a single sleep, and each synth found costs about log2(outputs) more
+		callback->restart();
+		for (size_t output = from; output < to; output++) {
+			sendDetectMessages(outputs[output]);
+		}
+		Thread::sleep(synth_.deviceDetectSleepMS());
+		if (threadShouldExit()) return;
+
+		if (callback->locations().empty() || to - from == 1) {
+			recordLocations(callback, outputs[from]);
+			if (progressHandler_) progressHandler_->setProgressPercentage(to / (double)outputs.size());
+			return;
+		}
+		size_t middle = from + (to - from) / 2;
+		probeOutputs(callback, outputs, from, middle);
+		probeOutputs(callback, outputs, middle, to);
+	}
+
+	void FindSynthOnMidiNetwork::sendDetectMessages(juce::MidiDeviceInfo const &output)
+	{
+		//TODO:  I cannot use the synth's sendBlockOfMessagesToSynth() here because I do not have a synth pointer. Smell?
+		if (synth_.needsChannelSpecificDetection()) {
+			// Test all 16 channels
+			for (int channel = 0; channel < 16; channel++) {
+				// Send the synth detection signal
+				auto detectMessage = synth_.deviceDetect(channel);
+				MidiController::instance()->getMidiOutput(output)->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessage));
+			}
+		}
+		else {
+			// Just one message is enough - use a "broadcast" channel or sysex device ID as parameter
+			auto detectMessage = synth_.deviceDetect(0x7f);
+			MidiController::instance()->getMidiOutput(output)->sendBlockOfMessagesFullSpeed(MidiHelpers::bufferFromMessages(detectMessage));
+		}
+	}
+
+	void FindSynthOnMidiNetwork::recordLocations(std::shared_ptr<IsSynth> callback, juce::MidiDeviceInfo const &output)
+	{
+		// Copy results
+		for (auto const &found : callback->locations()) {
+			auto withOutput = found;
+			withOutput.output = output;
+			locations_.push_back(withOutput);
+			// Super special case - we might want to terminate the successful device detection with a special message sent to the same output as the detect message!
+			MidiMessage endDetectMessage;
+			if (synth_.endDeviceDetect(endDetectMessage)) {
+				MidiController::instance()->getMidiOutput(output)->sendMessageNow(endDetectMessage);
+			}
+		}
+	}
+
+	std::vector<MidiNetworkLocation> FindSynthOnMidiNetwork::detectSynth(DiscoverableDevice &synth, ProgressHandler *progressHandler, DetectionMode mode)
 	{
 		auto nameCap = dynamic_cast<NamedDeviceCapability*>(&synth);
-		FindSynthOnMidiNetwork m(synth, fmt::format("Looking for {} on your MIDI network...", nameCap ? nameCap->getName() : "'invalid name'"), progressHandler);
+		FindSynthOnMidiNetwork m(synth, fmt::format("Looking for {} on your MIDI network...", nameCap ? nameCap->getName() : "'invalid name'"), progressHandler, mode);
 		m.startThread();
 		if (m.waitForThreadToExit(15000))
 		{
@@ -8,12 +8,16 @@
 
 #include "MidiHelpers.h"
 
+#include <spdlog/spdlog.h>
+
 namespace midikraft {
 
 	class RunMidiLoopDetection : public Thread {
 	public:
 		RunMidiLoopDetection(std::weak_ptr<ProgressHandler> progressHandler) : Thread("MIDI Loop Detection"), progressHandler_(progressHandler) {
-			MidiController::instance()->addMessageHandler(handler_, [this](MidiInput *source, MidiMessage const &midimessage) {
+			// Known before the handler is installed and never changed afterwards, so the MIDI threads can read it without a lock
+			outputs_ = MidiController::instance()->availableOutputs();
+			MidiController::instance()->addMessageHandler(handler_, MidiMessageFilter::nonRealtime(), [this](MidiInput *source, MidiMessage const &midimessage) {
 				handleIncomingMidiMessage(source, midimessage);
 			});
 		}
@@ -26,64 +30,93 @@ namespace midikraft {
 		void run() override
 		{
 			// Listen to all devices connected at the same time
-			for (auto const &input : MidiInput::getAvailableDevices()) {
+			for (auto const &input : MidiController::instance()->availableInputs()) {
 				MidiController::instance()->enableMidiInput(input);
 			}
 
-			// Now loop over outputs
-			size_t output_count = 0;
-			for (auto const &output: MidiOutput::getAvailableDevices()) {
+			// Probe all outputs at once. Each output gets its own payload, so an echo tells which output it came from, and the whole
+			// detection only needs one listening window no matter how many ports there are
+			for (size_t index = 0; index < outputs_.size(); index++) {
 				if (!progressHandler_.expired() && progressHandler_.lock()->shouldAbort()) break;
+				if (threadShouldExit()) break;
 
-				// Just one message is enough - test sysex loop
-				currentOut_ = output;
-				MidiController::instance()->getMidiOutput(currentOut_)->sendMessageNow(loopDetectionSysexMessage_);
-
-				// Then test note loop
-				MidiController::instance()->getMidiOutput(currentOut_)->sendMessageNow(loopDetectionNoteOnMessage_);
-
-				// Sleep
-				Thread::sleep(200);
+				// Just one message is enough - test sysex loop, then test note loop
+				auto output = MidiController::instance()->getMidiOutput(outputs_[index]);
+				output->sendMessageNow(sysexProbe(index));
+				output->sendMessageNow(noteProbe(index));
+			}
+			if (!progressHandler_.expired()) {
+				progressHandler_.lock()->setProgressPercentage(0.5);
+			}
 
-				// must check this as often as possible, because this is
-				// how we know if the user's pressed 'cancel'
-				if (threadShouldExit())
-					break;
+			// Wait for the echoes. Checking often, because this is how we know if the user's pressed 'cancel'
+			auto waitUntil = Time::getMillisecondCounter() + kListenMilliseconds;
+			while (Time::getMillisecondCounter() < waitUntil && !threadShouldExit()) {
+				if (!progressHandler_.expired() && progressHandler_.lock()->shouldAbort()) break;
+				Thread::sleep(10);
+			}
 
-				// this will update the progress bar on the dialog box
-				if (!progressHandler_.expired()) {
-					progressHandler_.lock()->setProgressPercentage(++output_count / (double)MidiOutput::getAvailableDevices().size());
-				}
+			// this will update the progress bar on the dialog box
+			if (!progressHandler_.expired()) {
+				progressHandler_.lock()->setProgressPercentage(1.0);
 			}
 		}
 
 	private:
 		friend class LoopDetection;
 
+		static const uint32 kListenMilliseconds = 200;
+
 		MidiController::HandlerHandle handler_;
 		std::weak_ptr<ProgressHandler> progressHandler_;
 
-		// Use a MIDI Sysex Universal Device Detect message and see if this comes back
-		//MidiMessage loopDetectionSysexMessage_ = MidiHelpers::sysexMessage({ 0x7e, 0x7f /* all sysex channels */, 0x06, 0x01 });
-		MidiMessage loopDetectionSysexMessage_ = MidiHelpers::sysexMessage({ 0x7e, 0x7f /* all sysex channels */, 0x06, 0x02 }); // Useless "Identity Reply" package
-		MidiMessage loopDetectionNoteOnMessage_ = MidiMessage::noteOn(0xf, 0, (uint8) 1); // Don't use velocity 0, as this might be called erroneously note-off by JUCE
+		// Use a MIDI Sysex Universal Device "Identity Reply" package, which no device should react to. It carries the non-commercial manufacturer ID 
+		// so it can't be mistaken for a real identity reply, followed by the output index in two 7 bit bytes
+		static MidiMessage sysexProbe(size_t outputIndex) {
+			return MidiHelpers::sysexMessage({ 0x7e, 0x7f /* all sysex channels */, 0x06, 0x02, 0x7d, (uint8)((outputIndex >> 7) & 0x7f), (uint8)(outputIndex & 0x7f) });
+		}
+
+		// Note number and velocity carry the output index. Don't use velocity 0, as this might be called erroneously note-off by JUCE
+		static MidiMessage noteProbe(size_t outputIndex) {
+			return MidiMessage::noteOn(0xf, (int)(outputIndex % 128), (uint8)(1 + (outputIndex / 128) % 127));
+		}
 
-		juce::MidiDeviceInfo currentOut_;
+		std::vector<juce::MidiDeviceInfo> outputs_;
 		std::vector<MidiLoop> loops_;
+		CriticalSection loopsLock_; // The echoes arrive on the MIDI threads
+
+		// Only if the message is exactly the probe sent to that output, so unrelated traffic can't be taken for a loop
+		void recordLoop(size_t outputIndex, MidiInput *source, MidiLoopType type, MidiMessage const &received) {
+			if (outputIndex >= outputs_.size()) {
+				return;
+			}
+			auto probe = type == MidiLoopType::Sysex ? sysexProbe(outputIndex) : noteProbe(outputIndex);
+			if (probe.getRawDataSize() != received.getRawDataSize() || memcmp(probe.getRawData(), received.getRawData(), (size_t)probe.getRawDataSize()) != 0) {
+				return;
+			}
+			ScopedLock lock(loopsLock_);
+			for (auto const &loop : loops_) {
+				if (loop.type == type && loop.midiOutput == outputs_[outputIndex] && loop.midiInput == source->getDeviceInfo()) {
+					return;
+				}
+			}
+			loops_.push_back({ outputs_[outputIndex], source->getDeviceInfo(), type });
+		}
 
 		void handleIncomingMidiMessage(MidiInput * source, MidiMessage const & midimessage)
 		{
-			 // See if this is our sysex loop detection message
+			// See if this is one of our sysex loop detection messages
 			if (midimessage.isSysEx()) {
-				if (MidiHelpers::equalSysexMessageContent(midimessage, loopDetectionSysexMessage_)) {
+				auto data = midimessage.getSysExData();
+				if (midimessage.getSysExDataSize() == 7 && data[0] == 0x7e && data[1] == 0x7f && data[2] == 0x06 && data[3] == 0x02 && data[4] == 0x7d) {
 					// Looks like a loop
-					loops_.push_back({ currentOut_, source->getDeviceInfo(), MidiLoopType::Sysex });
+					recordLoop(((size_t)data[5] << 7) | data[6], source, MidiLoopType::Sysex, midimessage);
 				}
 			}
 			else if (midimessage.isNoteOn()) {
-				if (midimessage.getChannel() == 0x0f && midimessage.getNoteNumber() == 0 && midimessage.getVelocity() == 1) {
+				if (midimessage.getChannel() == 0x0f && midimessage.getVelocity() >= 1) {
 					// Oops, this is a loop
-					loops_.push_back({ currentOut_, source->getDeviceInfo(), MidiLoopType::Note });
+					recordLoop((size_t)(midimessage.getVelocity() - 1) * 128 + (size_t)midimessage.getNoteNumber(), source, MidiLoopType::Note, midimessage);
 				}
 			}
 		}
@@ -93,16 +126,14 @@ namespace midikraft {
 	{
 		RunMidiLoopDetection detector(progressHandler);
 		detector.startThread();
-		if (detector.waitForThreadToExit(15000))
-		{
-			// thread finished normally..
-			return detector.loops_;
-		}
-		else
+		if (!detector.waitForThreadToExit(15000))
 		{
-			// user pressed the cancel button respectively timeout, return empty list
-			return std::vector<MidiLoop>();
+			// Only if sending to an output got stuck, keep what has been found until now
+			spdlog::warn("MIDI loop detection timed out, the result might be incomplete");
+			detector.stopThread(1000);
 		}
+		ScopedLock lock(detector.loopsLock_);
+		return detector.loops_;
 
 	}
 
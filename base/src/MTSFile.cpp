@@ -8,8 +8,19 @@
 
 #include "MidiHelpers.h"
 
+#include <cmath>
+#include <iterator>
+
+#include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
+namespace {
+
+	// The most key entries an MTS single note tuning change can carry, the count is a single data byte
+	const size_t kMaxNotesPerTuningChange = 127;
+
+}
+
 std::string midikraft::MTSFile::name() const
 {
 	MidiTuning result;
@@ -36,3 +47,59 @@ std::vector<juce::MidiMessage> midikraft::MTSFile::createMidiMessagesFromDataFil
 	copyOfData[4] = (uint8) placeToStore.toZeroBasedDiscardingBank();
 	return { MidiHelpers::sysexMessage(copyOfData) };
 }
+
+std::vector<juce::MidiMessage> midikraft::MTSFile::createBulkMessages(std::vector<std::shared_ptr<MTSFile>> const& tunings, MidiProgramNumber firstPlace)
+{
+	std::vector<MidiMessage> result;
+	int place = firstPlace.toZeroBasedDiscardingBank();
+	for (size_t i = 0; i < tunings.size(); i++) {
+		if (!tunings[i]) continue;
+		if (place > 0x7f) {
+			spdlog::warn("Only 128 tuning programs can be addressed, skipping the remaining {} tunings", tunings.size() - i);
+			break;
+		}
+		auto messages = tunings[i]->createMidiMessagesFromDataFile(MidiProgramNumber::fromZeroBase(place++));
+		std::move(messages.begin(), messages.end(), std::back_inserter(result));
+	}
+	return result;
+}
+
+midikraft::MidiSendQueue::JobID midikraft::MTSFile::sendTunings(std::shared_ptr<SafeMidiOutput> output, std::vector<std::shared_ptr<MTSFile>> const& tunings, MidiProgramNumber firstPlace,
+	MidiSendPacing const& pacing, TMidiSendFinished onFinished)
+{
+	return output->sendBlockOfMessagesPaced(createBulkMessages(tunings, firstPlace), pacing, onFinished);
+}
+
+midikraft::MTSFile::NoteTuning midikraft::MTSFile::NoteTuning::fromFrequency(int key, double hz)
+{
+	// Semitones above MIDI note 0, with A4 = 440 Hz being note 69
+	double semitones = 69.0 + 12.0 * std::log2(hz / 440.0);
+	semitones = std::min(std::max(semitones, 0.0), 127.0 + 16383.0 / 16384.0);
+	int semitone = (int)std::floor(semitones);
+	int fraction = std::min((int)std::round((semitones - semitone) * 16384.0), 16383);
+	return { key, semitone, fraction };
+}
+
+std::vector<juce::MidiMessage> midikraft::MTSFile::createSingleNoteTuningChange(int deviceID, int tuningProgram, std::vector<NoteTuning> const& notes)
+{
+	std::vector<MidiMessage> result;
+	for (size_t start = 0; start < notes.size(); start += kMaxNotesPerTuningChange) {
+		size_t count = std::min(kMaxNotesPerTuningChange, notes.size() - start);
+		// Universal realtime, MIDI tuning standard, single note tuning change. It has no checksum
+		std::vector<uint8> data({ 0x7f, (uint8)(deviceID & 0x7f), 0x08, 0x02, (uint8)(tuningProgram & 0x7f), (uint8)count });
+		for (size_t i = start; i < start + count; i++) {
+			auto const& note = notes[i];
+			data.push_back((uint8)(note.key & 0x7f));
+			data.push_back((uint8)(note.semitone & 0x7f));
+			data.push_back((uint8)((note.fraction >> 7) & 0x7f));
+			data.push_back((uint8)(note.fraction & 0x7f));
+		}
+		result.push_back(MidiHelpers::sysexMessage(data));
+	}
+	return result;
+}
+
+void midikraft::MTSFile::sendSingleNoteTuningCoalesced(std::shared_ptr<SafeMidiOutput> output, int deviceID, int tuningProgram, NoteTuning const& note)
+{
+	output->sendParameterCoalesced(fmt::format("mts-note-{}-{}-{}", deviceID, tuningProgram, note.key), createSingleNoteTuningChange(deviceID, tuningProgram, { note }));
+}
@@ -10,14 +10,18 @@
 #include "Logger.h"
 
 #include "MidiHelpers.h"
+#include "OperationStatistics.h"
+#include "Settings.h"
 
 #include <spdlog/spdlog.h>
 #include "SpdLogJuce.h"
 
 namespace midikraft {
 
+	const int kDeviceListSettleMilliseconds = 100;
+
 	SafeMidiOutput::SafeMidiOutput(MidiController *controller, MidiOutput *midiOutput) :
-		midiOut_(midiOutput), controller_(controller)
+		midiOut_(midiOutput), controller_(controller), parameterFlushIntervalMs_(MidiParameterCoalescer::kDefaultFlushIntervalMs)
 	{
 	}
 
@@ -39,8 +43,29 @@ namespace midikraft {
 			milliseconds);
 	}
 
+	void SafeMidiOutput::sendParameterCoalesced(std::string const &parameterKey, std::vector<MidiMessage> const &messages)
+	{
+		parameterCoalescer().setValue(parameterKey, messages);
+	}
+
+	void SafeMidiOutput::setParameterFlushInterval(int milliseconds)
+	{
+		ScopedLock lock(sendQueueLock_);
+		parameterFlushIntervalMs_ = milliseconds;
+		if (parameterCoalescer_) {
+			parameterCoalescer_->setFlushInterval(milliseconds);
+		}
+	}
+
 	void SafeMidiOutput::sendBlockOfMessagesFullSpeed(const MidiBuffer& buffer) {
-		if (midiOut_) {
+		if (auto queue = sendQueueForBlock()) {
+			std::vector<MidiMessage> messages;
+			for (auto message : buffer) {
+				messages.push_back(message.getMessage());
+			}
+			sendThroughQueue(*queue, messages);
+		}
+		else if (midiOut_) {
 			MidiBuffer filtered = MidiHelpers::removeEmptySysexMessages(buffer);
 			for (auto message : filtered) {
 				auto m = message.getMessage();
@@ -52,7 +77,10 @@ namespace midikraft {
 
 	void SafeMidiOutput::sendBlockOfMessagesFullSpeed(const std::vector<MidiMessage>& buffer)
 	{
-		if (midiOut_) {
+		if (auto queue = sendQueueForBlock()) {
+			sendThroughQueue(*queue, buffer);
+		}
+		else if (midiOut_) {
 			for (const auto& message : buffer) {
 				if (MidiHelpers::isEmptySysex(message)) continue;
 				midiOut_->sendMessageNow(message);
@@ -62,15 +90,122 @@ namespace midikraft {
 	}
 
 	void SafeMidiOutput::sendBlockOfMessagesThrottled(const std::vector<MidiMessage>& buffer, int millisecondsWait) {
-		//TODO - this blocks the UI thread, but I don't want any logic to continue right now here.
-		if (midiOut_) {
-			for (const auto& message : buffer) {
-				if (MidiHelpers::isEmptySysex(message)) continue;
-				Thread::sleep(millisecondsWait);
-				midiOut_->sendMessageNow(message);
-				controller_->logMidiMessage(message, midiOut_->getName(), true);
+		// Callers rely on the messages being out when this returns, but it still goes through the queue to keep its place among the queued blocks
+		auto pacing = MidiSendPacing::throttled(millisecondsWait);
+		if (sendQueue().isSendThread()) {
+			// From a job's work, waiting for the queue would never return
+			if (midiOut_) {
+				auto strictest = MidiSendPacing::strictest(pacing, devicePacing());
+				double notBefore = 0.0;
+				for (const auto& message : buffer) {
+					if (MidiHelpers::isEmptySysex(message)) continue;
+					sendPacedNow(message, strictest, notBefore);
+				}
 			}
+			return;
+		}
+		WaitableEvent sent;
+		sendBlockOfMessagesPaced(buffer, pacing, [&sent](bool) {
+			sent.signal();
+		});
+		sent.wait(-1);
+	}
+
+	MidiSendQueue::JobID SafeMidiOutput::sendBlockOfMessagesPaced(const std::vector<MidiMessage>& buffer, MidiSendPacing const &pacing, TMidiSendFinished onFinished)
+	{
+		std::vector<MidiMessage> filtered;
+		std::copy_if(buffer.cbegin(), buffer.cend(), std::back_inserter(filtered), [](MidiMessage const& message) { return !MidiHelpers::isEmptySysex(message); });
+		return sendQueue().enqueue(filtered, MidiSendPacing::strictest(pacing, devicePacing()), onFinished);
+	}
+
+	MidiSendQueue::JobID SafeMidiOutput::runOnSendThread(std::function<void()> work, MidiSendPacing const &pacing, TMidiSendFinished onFinished)
+	{
+		return sendQueue().enqueue(work, MidiSendPacing::strictest(pacing, devicePacing()), onFinished);
+	}
+
+	MidiSendQueue *SafeMidiOutput::sendQueueForBlock()
+	{
+		if (midiOut_ && !devicePacing().isFullSpeed()) {
+			return &sendQueue();
+		}
+		ScopedLock lock(sendQueueLock_);
+		if (sendQueue_ && (sendQueue_->isSendThread() || !sendQueue_->isIdle())) {
+			return sendQueue_.get();
+		}
+		return nullptr;
+	}
+
+	void SafeMidiOutput::sendThroughQueue(MidiSendQueue &queue, std::vector<MidiMessage> const &buffer)
+	{
+		std::vector<MidiMessage> filtered;
+		std::copy_if(buffer.cbegin(), buffer.cend(), std::back_inserter(filtered), [](MidiMessage const& message) { return !MidiHelpers::isEmptySysex(message); });
+		if (queue.isSendThread()) {
+			// Sent by a job's work, e.g. a synth's sendBlockOfMessagesToSynth(), so it gets that job's pacing
+			queue.sendFromJob(filtered);
+		}
+		else {
+			queue.enqueue(filtered, devicePacing());
+		}
+	}
+
+	void SafeMidiOutput::sendPacedNow(MidiMessage const &message, MidiSendPacing const &pacing, double &notBeforeMs)
+	{
+		// Only wait as long as the previous message still needs, so a block goes out at exactly the fastest rate the device takes
+		auto now = Time::getMillisecondCounterHiRes();
+		if (notBeforeMs > now) {
+			Thread::sleep((int)std::ceil(notBeforeMs - now));
 		}
+		midiOut_->sendMessageNow(message);
+		controller_->logMidiMessage(message, midiOut_->getName(), true);
+		notBeforeMs = Time::getMillisecondCounterHiRes() + pacing.pauseAfterMs(message);
+	}
+
+	void SafeMidiOutput::setDevicePacing(MidiSendPacing const &pacing)
+	{
+		ScopedLock lock(pacingLock_);
+		devicePacing_ = pacing;
+	}
+
+	MidiSendPacing SafeMidiOutput::devicePacing() const
+	{
+		ScopedLock lock(pacingLock_);
+		return devicePacing_;
+	}
+
+	bool SafeMidiOutput::cancelSend(MidiSendQueue::JobID job)
+	{
+		return sendQueue().cancel(job);
+	}
+
+	void SafeMidiOutput::cancelAllSends()
+	{
+		ScopedLock lock(sendQueueLock_);
+		if (sendQueue_) {
+			sendQueue_->cancelAll();
+		}
+	}
+
+	MidiSendQueue& SafeMidiOutput::sendQueue()
+	{
+		ScopedLock lock(sendQueueLock_);
+		if (!sendQueue_) {
+			sendQueue_ = std::make_unique<MidiSendQueue>(String(name()), [this](MidiMessage const& message) {
+				sendMessageNow(message);
+			});
+		}
+		return *sendQueue_;
+	}
+
+	MidiParameterCoalescer& SafeMidiOutput::parameterCoalescer()
+	{
+		ScopedLock lock(sendQueueLock_);
+		if (!parameterCoalescer_) {
+			// Waits on the coalescer's thread until sent, so a slow device makes the coalescer keep only the latest values instead of filling the queue
+			parameterCoalescer_ = std::make_unique<MidiParameterCoalescer>(String(name()), [this](std::vector<MidiMessage> const& messages) {
+				sendBlockOfMessagesThrottled(messages, 0);
+			}, parameterFlushIntervalMs_);
+		}
+		return *parameterCoalescer_;
 	}
 
 	juce::MidiDeviceInfo SafeMidiOutput::deviceInfo() const
@@ -91,7 +226,48 @@ namespace midikraft {
 		return midiOut_ != nullptr && midiOut_->getIdentifier().isNotEmpty();
 	}
 
-	MidiController::MidiController() : midiLogLevel_(MidiLogLevel::SYSEX_ONLY)
+	MidiMessageFilter MidiMessageFilter::all()
+	{
+		return MidiMessageFilter();
+	}
+
+	MidiMessageFilter MidiMessageFilter::nonRealtime()
+	{
+		MidiMessageFilter result;
+		result.maxStatus = 0xf7;
+		return result;
+	}
+
+	MidiMessageFilter MidiMessageFilter::sysexOnly(std::vector<uint8> const &prefix)
+	{
+		MidiMessageFilter result;
+		result.minStatus = 0xf0;
+		result.maxStatus = 0xf0;
+		result.sysexPrefix = prefix;
+		return result;
+	}
+
+	MidiMessageFilter MidiMessageFilter::fromInput(juce::String const &identifier) const
+	{
+		MidiMessageFilter result = *this;
+		result.inputIdentifier = identifier;
+		return result;
+	}
+
+	bool MidiMessageFilter::matches(MidiInput *source, MidiMessage const &message) const
+	{
+		if (message.getRawDataSize() < 1) return false;
+		auto status = message.getRawData()[0];
+		if (status < minStatus || status > maxStatus) return false;
+		if (inputIdentifier.isNotEmpty() && (source == nullptr || source->getIdentifier() != inputIdentifier)) return false;
+		if (!sysexPrefix.empty() && message.isSysEx()) {
+			if (message.getSysExDataSize() < (int) sysexPrefix.size()) return false;
+			return std::equal(sysexPrefix.cbegin(), sysexPrefix.cend(), message.getSysExData());
+		}
+		return true;
+	}
+
+	MidiController::MidiController() : messageHandlers_(buildSnapshot(HandlerMap())), midiLog_(std::make_unique<MidiLogQueue>()), midiLogLevel_(MidiLogLevel::SYSEX_ONLY)
 	{
 		if (instance_ != nullptr) {
 			throw std::runtime_error("This is a singleton, can't create twice");
@@ -99,10 +275,18 @@ namespace midikraft {
 		instance_ = this;
 
 		// Find the current list of connected MIDI ports
+		refreshDeviceSnapshot();
 		knownOutputs_ = currentOutputs(false);
 		knownInputs_ = currentInputs(false);
 
-		startTimer(500); // Do start a timer monitoring new devices from appearing and known devices from disappearing, as there is USB after all
+		// Get notified of new devices appearing and known devices disappearing, as there is USB after all.
+		// Plugging in an interface reports each of its ports on its own, so a burst of notifications is handled with one enumeration after it has settled
+		deviceListConnection_ = juce::MidiDeviceListConnection::make([this]() {
+			deviceListDebouncer_.callDebounced([this]() {
+				refreshDeviceSnapshot();
+				deviceListChanged();
+			}, kDeviceListSettleMilliseconds);
+		});
 	}
 
 	MidiController * MidiController::instance()
@@ -120,9 +304,15 @@ namespace midikraft {
 	}
 
 	void MidiController::logMidiMessage(const MidiMessage& message, const String& source, bool isOut) {
-		if (midiLogFunction_) {
+		// Every message sent passes here, so this is where they are counted. Incoming ones are counted together with their dispatch time
+		telemetry_.recordMessage(source, isOut, (size_t)message.getRawDataSize());
+		pushToMidiLog(message, source, isOut);
+	}
+
+	void MidiController::pushToMidiLog(const MidiMessage& message, const String& source, bool isOut) {
+		if (midiLog_->hasLogFunction()) {
 			bool doLog = false;
-			switch (midiLogLevel_) {
+			switch (midiLogLevel_.load()) {
 			case MidiLogLevel::SYSEX_ONLY:
 				doLog = message.isSysEx();
 				break;
@@ -134,30 +324,40 @@ namespace midikraft {
 			}
 			if (doLog)
 			{
-				midiLogFunction_(message, source, isOut);
+				midiLog_->push(message, source, isOut);
 			}
 		}
 	}
 
+	uint64 MidiController::droppedMidiLogMessages() const
+	{
+		return midiLog_->droppedCount();
+	}
+
+	MidiTelemetry& MidiController::telemetry()
+	{
+		return telemetry_;
+	}
+
 	bool MidiController::enableMidiOutput(juce::MidiDeviceInfo const &newOutput)
 	{
 		if (newOutput.identifier.isEmpty()) return false;
 
+		ScopedLock lock(outputsLock_);
 		// Check if it is already open
 		if (outputsOpen_.find(newOutput.identifier) == outputsOpen_.end()) {
-			auto devices = MidiOutput::getAvailableDevices();
-			for (const auto& device : devices) {
-				if (device.identifier == newOutput.identifier) {
-					auto newDevice = juce::MidiOutput::openDevice(device.identifier);
-					if (newDevice) {
-						// Take responsibility for the lifetime of the returned output
-						newDevice.swap(outputsOpen_[newOutput.identifier]);
-						spdlog::trace("MIDI output {} opened with ID {}", newOutput.name, device.identifier);
-						return true;
-					}
-					spdlog::error("MIDI output {} could not be opened, maybe it is turned off or used by another software?", newOutput.name);
-					return false;
+			auto snapshot = devices();
+			auto device = snapshot->outputsByIdentifier.find(newOutput.identifier.toStdString());
+			if (device != snapshot->outputsByIdentifier.end()) {
+				auto newDevice = juce::MidiOutput::openDevice(device->second.identifier);
+				if (newDevice) {
+					// Take responsibility for the lifetime of the returned output
+					newDevice.swap(outputsOpen_[newOutput.identifier]);
+					spdlog::trace("MIDI output {} opened with ID {}", newOutput.name, device->second.identifier);
+					return true;
 				}
+				spdlog::error("MIDI output {} could not be opened, maybe it is turned off or used by another software?", newOutput.name);
+				return false;
 			}
 			spdlog::info("Could not find MIDI output {}, device disconnected?", newOutput.name);
 			return false;
@@ -166,11 +366,12 @@ namespace midikraft {
 	}
 
 	void MidiController::setMidiLogFunction(std::function<void(const MidiMessage& message, const String& source, bool isOut)> logFunction) {
-		midiLogFunction_ = logFunction;
+		midiLog_->setLogFunction(logFunction);
 	}
 
 	std::shared_ptr<SafeMidiOutput> MidiController::getMidiOutput(juce::MidiDeviceInfo const &midiOutput)
 	{
+		ScopedLock lock(outputsLock_);
 		if (safeOutputs_.find(midiOutput.identifier) == safeOutputs_.end() || !safeOutputs_[midiOutput.identifier]->isValid()) {
 			if (outputsOpen_.find(midiOutput.identifier) == outputsOpen_.end()) {
 				// Lazy open
@@ -181,6 +382,7 @@ namespace midikraft {
 				}
 			}
 			safeOutputs_[midiOutput.identifier] = std::make_shared<SafeMidiOutput>(this, outputsOpen_[midiOutput.identifier].get());
+			safeOutputs_[midiOutput.identifier]->setDevicePacing(outputPacing(midiOutput));
 		}
 		return safeOutputs_[midiOutput.identifier];
 	}
@@ -190,28 +392,29 @@ namespace midikraft {
 		// Do not and never open a MIDI Input with an empty identifier, as this is a "catch all" function for JUCE, and you suddenly get duplicated messages everywhere!
 		if (toEnable.identifier.isEmpty()) return false;
 
-		for (const auto& device : MidiInput::getAvailableDevices()) {
-			if (device.identifier == toEnable.identifier) {
-				// Has this device already been opened?
-				if (inputsOpen_.find(toEnable.identifier) == inputsOpen_.end()) {
-					inputsOpen_[toEnable.identifier] = juce::MidiInput::openDevice(device.identifier, this);
-					if (inputsOpen_[toEnable.identifier]) {
-						inputsOpen_[toEnable.identifier]->start();
-						spdlog::trace("MIDI input {} opened with ID {}", toEnable.name, device.identifier);
-						return true;
-					}
-					else {
-						inputsOpen_.erase(toEnable.identifier);
-						spdlog::error("MIDI input {} could not be opened, maybe it is locked by another software running?", toEnable.name);
-						return false;
-					}
-				}
-				else {
-					// Make sure it is still open and running. This could happen when e.g. a MIDI USB device is removed and inserted back in
+		auto snapshot = devices();
+		auto found = snapshot->inputsByIdentifier.find(toEnable.identifier.toStdString());
+		if (found != snapshot->inputsByIdentifier.end()) {
+			auto const& device = found->second;
+			// Has this device already been opened?
+			if (inputsOpen_.find(toEnable.identifier) == inputsOpen_.end()) {
+				inputsOpen_[toEnable.identifier] = juce::MidiInput::openDevice(device.identifier, this);
+				if (inputsOpen_[toEnable.identifier]) {
 					inputsOpen_[toEnable.identifier]->start();
-					spdlog::trace("MIDI input device {} restarted, id is {}", toEnable.name, toEnable.identifier);
+					spdlog::trace("MIDI input {} opened with ID {}", toEnable.name, device.identifier);
 					return true;
 				}
+				else {
+					inputsOpen_.erase(toEnable.identifier);
+					spdlog::error("MIDI input {} could not be opened, maybe it is locked by another software running?", toEnable.name);
+					return false;
+				}
+			}
+			else {
+				// Make sure it is still open and running. This could happen when e.g. a MIDI USB device is removed and inserted back in
+				inputsOpen_[toEnable.identifier]->start();
+				spdlog::trace("MIDI input device {} restarted, id is {}", toEnable.name, toEnable.identifier);
+				return true;
 			}
 		}
 		spdlog::error("MIDI input {} could not be opened, not found. Please plugin/turn on the device.", toEnable.name);
@@ -233,26 +436,63 @@ namespace midikraft {
 
 	// These methods handle callbacks from the midi device
 	void MidiController::handleIncomingMidiMessage(MidiInput* source, const MidiMessage& message) {
-		logMidiMessage(message, source->getName(), false);
+		dispatchIncomingMidiMessage(source, message);
+	}
 
-		// Call all currently registered handlers, but make sure to iterate over a copy of the list as it might get modified while the handlers run
-		// First the new style handlers;
-		std::vector < std::function<void(MidiInput *, MidiMessage const &)>> newhandlers;
-		{
-			ScopedLock lock(messageHandlerList_);
-			for (auto const &handler : messageHandlers_) {
-				newhandlers.push_back(handler.second);
+	void MidiController::dispatchIncomingMidiMessage(MidiInput *source, MidiMessage const &message) {
+		OperationStatistics::Timer timer(OperationStatistics::global(), "MidiController::handleIncomingMidiMessage");
+		String sourceName = source ? source->getName() : String("(no device)");
+		pushToMidiLog(message, sourceName, false);
+		auto dispatchStartMs = Time::getMillisecondCounterHiRes();
+
+		// Call all currently registered handlers. The snapshot stays alive and unchanged while we iterate, even if handlers are added or removed meanwhile
+		if (requests_.hasPendingRequests()) {
+			requests_.handleIncomingMidiMessage(message);
+		}
+
+		// Only the handlers whose status range covers this message are in the slot, the remaining filter conditions are checked per handler
+		if (message.getRawDataSize() >= 1) {
+			auto handlers = std::atomic_load(&messageHandlers_);
+			for (auto handler : handlers->dispatch[dispatchSlot(message.getRawData()[0])]) {
+				if (handler->filter.matches(source, message)) {
+					handler->callback(source, message);
+				}
 			}
 		}
-		for (auto const &handler : newhandlers) {
-			handler(source, message);
+		telemetry_.recordIncoming(sourceName, (size_t)message.getRawDataSize(), Time::getMillisecondCounterHiRes() - dispatchStartMs);
+	}
+
+	size_t MidiController::dispatchSlot(uint8 status)
+	{
+		if (status < 0xf0) {
+			// Data bytes can't be a status, so they are lumped in with the note offs which will then reject them via the filter
+			return status < 0x80 ? 0 : (size_t) ((status >> 4) - 8);
+		}
+		return 7 + (size_t) (status & 0x0f);
+	}
+
+	std::shared_ptr<MidiController::HandlerSnapshot const> MidiController::buildSnapshot(HandlerMap const &handlers)
+	{
+		auto snapshot = std::make_shared<HandlerSnapshot>();
+		snapshot->handlers = handlers;
+		for (auto const &handler : snapshot->handlers) {
+			// Enter the handler into every slot of which at least one status byte lies in the filter's range
+			std::array<bool, kDispatchSlots> covered{};
+			for (int status = handler.second->filter.minStatus; status <= handler.second->filter.maxStatus; status++) {
+				covered[dispatchSlot((uint8) status)] = true;
+			}
+			for (size_t slot = 0; slot < kDispatchSlots; slot++) {
+				if (covered[slot]) {
+					snapshot->dispatch[slot].push_back(handler.second.get());
+				}
+			}
 		}
+		return snapshot;
 	}
 
-	//TODO This can be replaced by a MidiDeviceListConnection now
-	void MidiController::timerCallback()
+	void MidiController::deviceListChanged()
 	{
-		 // Check if all devices are still there. We won't get notified, so better be safe than sorry and let's count them!
+		 // Check which devices are gone and which are new
 		bool dirty = false;
 		
 		// Check if all open devices are still there, else stop them and delete them
@@ -288,18 +528,21 @@ namespace midikraft {
 		// Now the same for the Output devices
 		std::vector<String> toDeleteOutput;
 		auto outputDevices = currentOutputs(false);
-		for (auto output = outputsOpen_.begin(); output != outputsOpen_.end(); output++) {
-			if (std::none_of(outputDevices.cbegin(), outputDevices.cend(), [output](juce::MidiDeviceInfo const& info) { return info.identifier == output->first;  })) {
-				spdlog::info("MIDI Output {} unplugged", output->second->getName());
-				output->second.reset();
-				toDeleteOutput.push_back(output->first);
-				dirty = true;
+		{
+			ScopedLock lock(outputsLock_);
+			for (auto output = outputsOpen_.begin(); output != outputsOpen_.end(); output++) {
+				if (std::none_of(outputDevices.cbegin(), outputDevices.cend(), [output](juce::MidiDeviceInfo const& info) { return info.identifier == output->first;  })) {
+					spdlog::info("MIDI Output {} unplugged", output->second->getName());
+					output->second.reset();
+					toDeleteOutput.push_back(output->first);
+					dirty = true;
+				}
 			}
-		}
 
-		for (auto del : toDeleteOutput) {
-			outputsOpen_.erase(del);
-			safeOutputs_.erase(del);
+			for (auto del : toDeleteOutput) {
+				outputsOpen_.erase(del);
+				safeOutputs_.erase(del);
+			}
 		}
 
 		// Check if any new devices came up
@@ -322,9 +565,8 @@ namespace midikraft {
 
 	std::set<juce::MidiDeviceInfo> MidiController::currentInputs(bool withHistory)
 	{
-		std::set<juce::MidiDeviceInfo> inputDevices;
-		auto availableInputs = MidiInput::getAvailableDevices();
-		std::for_each(availableInputs.begin(), availableInputs.end(), [&](MidiDeviceInfo device) {inputDevices.emplace(device); });
+		auto snapshot = devices();
+		std::set<juce::MidiDeviceInfo> inputDevices(snapshot->inputs.begin(), snapshot->inputs.end());
 		if (withHistory) {
 			inputDevices.insert(historyOfAllInputs_.begin(), historyOfAllInputs_.end());
 		}
@@ -333,22 +575,83 @@ namespace midikraft {
 
 	std::set<juce::MidiDeviceInfo> MidiController::currentOutputs(bool withHistory)
 	{
-		std::set<juce::MidiDeviceInfo> outputDevices;
-		auto availableOuputs = MidiOutput::getAvailableDevices();
-		std::for_each(availableOuputs.begin(), availableOuputs.end(), [&](MidiDeviceInfo device) {outputDevices.emplace(device); });
+		auto snapshot = devices();
+		std::set<juce::MidiDeviceInfo> outputDevices(snapshot->outputs.begin(), snapshot->outputs.end());
 		if (withHistory) {
 			outputDevices.insert(historyOfAllOutpus_.begin(), historyOfAllOutpus_.end());
 		}
 		return outputDevices;
 	}
 
+	std::vector<juce::MidiDeviceInfo> MidiController::availableInputs() const
+	{
+		return devices()->inputs;
+	}
+
+	std::vector<juce::MidiDeviceInfo> MidiController::availableOutputs() const
+	{
+		return devices()->outputs;
+	}
+
+	void MidiController::refreshDeviceSnapshot()
+	{
+		auto snapshot = std::make_shared<DeviceSnapshot>();
+		auto inputs = MidiInput::getAvailableDevices();
+		auto outputs = MidiOutput::getAvailableDevices();
+		snapshot->inputs.assign(inputs.begin(), inputs.end());
+		snapshot->outputs.assign(outputs.begin(), outputs.end());
+		for (auto const& input : snapshot->inputs) {
+			snapshot->inputsByIdentifier.emplace(input.identifier.toStdString(), input);
+			snapshot->inputsByName.emplace(input.name.toStdString(), input); // With duplicate names, the first one wins as in the linear search before
+		}
+		for (auto const& output : snapshot->outputs) {
+			snapshot->outputsByIdentifier.emplace(output.identifier.toStdString(), output);
+			snapshot->outputsByName.emplace(output.name.toStdString(), output);
+		}
+		std::atomic_store(&devices_, std::shared_ptr<DeviceSnapshot const>(snapshot));
+	}
+
+	std::shared_ptr<MidiController::DeviceSnapshot const> MidiController::devices() const
+	{
+		return std::atomic_load(&devices_);
+	}
+
 	void MidiController::setMidiLogLevel(MidiLogLevel level) {
 		midiLogLevel_ = level;
 	}
 
+	static std::string outputPacingKey(juce::MidiDeviceInfo const &output)
+	{
+		return "midiOutputPacing-" + output.identifier.toStdString();
+	}
+
+	void MidiController::setOutputPacing(juce::MidiDeviceInfo const &output, MidiSendPacing const &pacing)
+	{
+		if (output.identifier.isEmpty()) return;
+		Settings::instance().set(outputPacingKey(output), pacing.toString());
+		ScopedLock lock(outputsLock_);
+		auto safeOutput = safeOutputs_.find(output.identifier);
+		if (safeOutput != safeOutputs_.end()) {
+			safeOutput->second->setDevicePacing(pacing);
+		}
+	}
+
+	MidiSendPacing MidiController::outputPacing(juce::MidiDeviceInfo const &output) const
+	{
+		if (output.identifier.isEmpty()) return MidiSendPacing::fullSpeed();
+		return MidiSendPacing::fromString(Settings::instance().get(outputPacingKey(output), ""));
+	}
+
     juce::MidiDeviceInfo MidiController::getMidiOutputByIdentifier(const String &identifier)
     {
-        for (auto const& output : currentOutputs(true))
+        auto snapshot = devices();
+        auto found = snapshot->outputsByIdentifier.find(identifier.toStdString());
+        if (found != snapshot->outputsByIdentifier.end())
+        {
+            return found->second;
+        }
+        // Fall back to devices seen earlier but currently not connected
+        for (auto const& output : historyOfAllOutpus_)
         {
             if (output.identifier == identifier)
             {
@@ -360,11 +663,18 @@ namespace midikraft {
 
     juce::MidiDeviceInfo MidiController::getMidiInputByIdentifier(const String &identifier)
     {
-        for (auto const& output : currentInputs(true))
+        auto snapshot = devices();
+        auto found = snapshot->inputsByIdentifier.find(identifier.toStdString());
+        if (found != snapshot->inputsByIdentifier.end())
         {
-            if (output.identifier == identifier)
+            return found->second;
+        }
+        // Fall back to devices seen earlier but currently not connected
+        for (auto const& input : historyOfAllInputs_)
+        {
+            if (input.identifier == identifier)
             {
-                return output;
+                return input;
             }
         }
         return MidiDeviceInfo();
@@ -372,11 +682,17 @@ namespace midikraft {
 
 	juce::MidiDeviceInfo MidiController::getMidiOutputByName(const String &name)
 	{
-		for (auto const& output : currentOutputs(true))
+		auto snapshot = devices();
+		auto found = snapshot->outputsByName.find(name.toStdString());
+		if (found != snapshot->outputsByName.end())
+		{
+			return found->second;
+		}
+		for (auto const& device : historyOfAllOutpus_)
 		{
-			if (output.name == name)
+			if (device.name == name)
 			{
-				return output;
+				return device;
 			}
 		}
 		return MidiDeviceInfo(name, "");
@@ -384,25 +700,61 @@ namespace midikraft {
 
 	juce::MidiDeviceInfo MidiController::getMidiInputByName(const String &name)
 	{
-		for (auto const& output : currentInputs(true))
+		auto snapshot = devices();
+		auto found = snapshot->inputsByName.find(name.toStdString());
+		if (found != snapshot->inputsByName.end())
+		{
+			return found->second;
+		}
+		for (auto const& device : historyOfAllInputs_)
 		{
-			if (output.name == name)
+			if (device.name == name)
 			{
-				return output;
+				return device;
 			}
 		}
 		return MidiDeviceInfo(name, "");
 	}
 
+	std::future<MidiMessage> MidiController::sendRequest(juce::MidiDeviceInfo const &output, std::vector<MidiMessage> const &request, TIsAnswerPredicate isAnswer, int timeOutInMilliseconds)
+	{
+		auto promise = std::make_shared<std::promise<MidiMessage>>();
+		auto result = promise->get_future();
+		sendRequest(output, request, isAnswer, timeOutInMilliseconds, [promise](bool answered, MidiMessage const &answer) {
+			if (answered) {
+				promise->set_value(answer);
+			}
+			else {
+				promise->set_exception(std::make_exception_ptr(std::runtime_error("Timeout while waiting for MIDI request reply")));
+			}
+		});
+		return result;
+	}
+
+	void MidiController::sendRequest(juce::MidiDeviceInfo const &output, std::vector<MidiMessage> const &request, TIsAnswerPredicate isAnswer, int timeOutInMilliseconds, TMidiReplyHandler onReply)
+	{
+		// Register first, the answer might arrive before the send returns
+		requests_.add(isAnswer, timeOutInMilliseconds, onReply);
+		getMidiOutput(output)->sendBlockOfMessagesFullSpeed(request);
+	}
+
 	void MidiController::addMessageHandler(HandlerHandle const &handle, MidiCallback handler) {
+		addMessageHandler(handle, MidiMessageFilter::all(), handler);
+	}
+
+	void MidiController::addMessageHandler(HandlerHandle const &handle, MidiMessageFilter const &filter, MidiCallback handler) {
 		ScopedLock lock(messageHandlerList_);
-		messageHandlers_.insert(std::make_pair(handle, handler));
+		HandlerMap updated = messageHandlers_->handlers;
+		updated.insert(std::make_pair(handle, std::make_shared<Handler const>(Handler{ filter, handler })));
+		std::atomic_store(&messageHandlers_, buildSnapshot(updated));
 	}
 
 	bool MidiController::removeMessageHandler(HandlerHandle const &handle) {
 		ScopedLock lock(messageHandlerList_);
-		if (messageHandlers_.find(handle) != messageHandlers_.end()) {
-			messageHandlers_.erase(handle);
+		if (messageHandlers_->handlers.find(handle) != messageHandlers_->handlers.end()) {
+			HandlerMap updated = messageHandlers_->handlers;
+			updated.erase(handle);
+			std::atomic_store(&messageHandlers_, buildSnapshot(updated));
 			return true;
 		}
 		jassertfalse;
@@ -0,0 +1,141 @@
+/*
+   Copyright (c) 2019 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "MidiLogQueue.h"
+
+#include <spdlog/spdlog.h>
+
+namespace midikraft {
+
+	// The consumer wakes up at this interval and takes everything that accumulated, so the producers never need to signal anything
+	const int kLogPollIntervalMs = 20;
+	const int kMaxBatchSize = 256;
+
+	MidiLogQueue::MidiLogQueue(size_t capacity) : Thread("MIDI Log"), enqueuePos_(0), dequeuePos_(0), hasLogFunction_(false), logged_(0), dropped_(0), droppedReported_(0)
+	{
+		size_t size = 2;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		slots_.reset(new Slot[size]);
+		mask_ = size - 1;
+		for (size_t i = 0; i < size; i++) {
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+			slots_[i].isOut = false;
+		}
+		startThread();
+	}
+
+	MidiLogQueue::~MidiLogQueue()
+	{
+		stopThread(1000);
+	}
+
+	void MidiLogQueue::setLogFunction(TLogFunction logFunction)
+	{
+		ScopedLock lock(logFunctionLock_);
+		logFunction_ = logFunction;
+		hasLogFunction_.store((bool)logFunction_);
+	}
+
+	bool MidiLogQueue::hasLogFunction() const
+	{
+		return hasLogFunction_.load(std::memory_order_relaxed);
+	}
+
+	bool MidiLogQueue::push(const MidiMessage& message, const String& source, bool isOut)
+	{
+		// Bounded multi producer ring buffer, each slot's sequence number tells whether it is free for the position we want to write
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;) {
+			slot = &slots_[pos & mask_];
+			size_t seq = slot->sequence.load(std::memory_order_acquire);
+			auto diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				// The consumer hasn't caught up, rather lose a log line than stall the MIDI thread
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else {
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		slot->message = message;
+		slot->source = source;
+		slot->isOut = isOut;
+		slot->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool MidiLogQueue::pop(MidiMessage& message, String& source, bool& isOut)
+	{
+		Slot* slot = &slots_[dequeuePos_ & mask_];
+		size_t seq = slot->sequence.load(std::memory_order_acquire);
+		if (seq != dequeuePos_ + 1) {
+			// Empty, or the producer that claimed this slot is still writing
+			return false;
+		}
+		message = std::move(slot->message);
+		source = std::move(slot->source);
+		isOut = slot->isOut;
+		slot->sequence.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+		dequeuePos_++;
+		return true;
+	}
+
+	uint64 MidiLogQueue::loggedCount() const
+	{
+		return logged_.load(std::memory_order_relaxed);
+	}
+
+	uint64 MidiLogQueue::droppedCount() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+	void MidiLogQueue::run()
+	{
+		struct Entry {
+			MidiMessage message;
+			String source;
+			bool isOut;
+		};
+		std::vector<Entry> batch(kMaxBatchSize);
+		while (!threadShouldExit()) {
+			wait(kLogPollIntervalMs);
+			for (;;) {
+				// Take a batch out of the ring buffer first, so the slots are free again before the slow log function runs
+				size_t count = 0;
+				while (count < batch.size() && pop(batch[count].message, batch[count].source, batch[count].isOut)) {
+					count++;
+				}
+				if (count == 0) break;
+				{
+					ScopedLock lock(logFunctionLock_);
+					if (logFunction_) {
+						for (size_t i = 0; i < count; i++) {
+							logFunction_(batch[i].message, batch[i].source, batch[i].isOut);
+						}
+					}
+				}
+				logged_.fetch_add(count, std::memory_order_relaxed);
+				if (threadShouldExit()) return;
+			}
+			auto dropped = dropped_.load(std::memory_order_relaxed);
+			if (dropped != droppedReported_) {
+				spdlog::warn("MIDI log could not keep up, dropped {} messages", dropped - droppedReported_);
+				droppedReported_ = dropped;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,87 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "MidiParameterCoalescer.h"
+
+namespace midikraft {
+
+	MidiParameterCoalescer::MidiParameterCoalescer(String const &name, TSendFunction sendFunction, int flushIntervalMs) : Thread("MIDI Live Edit " + name),
+		sendFunction_(sendFunction), flushIntervalMs_(std::max(1, flushIntervalMs))
+	{
+		startThread();
+	}
+
+	MidiParameterCoalescer::~MidiParameterCoalescer()
+	{
+		clear();
+		signalThreadShouldExit();
+		wakeUp_.signal();
+		stopThread(1000);
+	}
+
+	void MidiParameterCoalescer::setValue(std::string const &parameterKey, std::vector<MidiMessage> const &messages)
+	{
+		{
+			ScopedLock lock(pendingLock_);
+			auto found = pendingIndex_.find(parameterKey);
+			if (found != pendingIndex_.end()) {
+				pending_[found->second] = messages;
+				return;
+			}
+			pendingIndex_[parameterKey] = pending_.size();
+			pending_.push_back(messages);
+		}
+		wakeUp_.signal();
+	}
+
+	void MidiParameterCoalescer::clear()
+	{
+		ScopedLock lock(pendingLock_);
+		pendingIndex_.clear();
+		pending_.clear();
+	}
+
+	void MidiParameterCoalescer::setFlushInterval(int milliseconds)
+	{
+		flushIntervalMs_ = std::max(1, milliseconds);
+	}
+
+	int MidiParameterCoalescer::flushInterval() const
+	{
+		return flushIntervalMs_;
+	}
+
+	void MidiParameterCoalescer::run()
+	{
+		while (!threadShouldExit()) {
+			std::vector<std::vector<MidiMessage>> toSend;
+			{
+				ScopedLock lock(pendingLock_);
+				toSend.swap(pending_);
+				pendingIndex_.clear();
+			}
+			if (toSend.empty()) {
+				wakeUp_.wait(-1);
+				continue;
+			}
+
+			auto flushStartMs = Time::getMillisecondCounterHiRes();
+			std::vector<MidiMessage> block;
+			for (auto const &messages : toSend) {
+				block.insert(block.end(), messages.cbegin(), messages.cend());
+			}
+			sendFunction_(block);
+
+			// Changes coming in until the next flush overwrite each other, that is the whole point
+			double nextFlushMs = flushStartMs + flushIntervalMs_;
+			double now;
+			while (!threadShouldExit() && (now = Time::getMillisecondCounterHiRes()) < nextFlushMs) {
+				wakeUp_.wait((int)std::ceil(nextFlushMs - now));
+			}
+		}
+	}
+
+}
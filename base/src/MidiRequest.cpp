@@ -11,6 +11,90 @@
 
 namespace midikraft {
 
+	MidiRequestTracker::MidiRequestTracker() : hasPending_(false), shutdown_(false)
+	{
+	}
+
+	MidiRequestTracker::~MidiRequestTracker()
+	{
+		std::list<PendingRequest> expired;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			shutdown_ = true;
+			expired.swap(pending_);
+			hasPending_ = false;
+		}
+		changed_.notify_all();
+		if (timeoutThread_.joinable()) {
+			timeoutThread_.join();
+		}
+		for (auto const &request : expired) {
+			request.onReply(false, MidiMessage());
+		}
+	}
+
+	void MidiRequestTracker::add(TIsAnswerPredicate isAnswer, int timeOutInMilliseconds, TMidiReplyHandler onReply)
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			pending_.push_back({ isAnswer, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeOutInMilliseconds), onReply });
+			hasPending_ = true;
+			if (!timeoutThread_.joinable()) {
+				timeoutThread_ = std::thread([this]() { expireRequests(); });
+			}
+		}
+		changed_.notify_all();
+	}
+
+	bool MidiRequestTracker::hasPendingRequests() const
+	{
+		return hasPending_;
+	}
+
+	bool MidiRequestTracker::handleIncomingMidiMessage(MidiMessage const &message)
+	{
+		TMidiReplyHandler answered;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			for (auto request = pending_.begin(); request != pending_.end(); request++) {
+				if (request->isAnswer(message)) {
+					answered = request->onReply;
+					pending_.erase(request);
+					hasPending_ = !pending_.empty();
+					break;
+				}
+			}
+		}
+		if (answered) {
+			// Called outside the lock so the handler may issue the next request right away
+			answered(true, message);
+			return true;
+		}
+		return false;
+	}
+
+	void MidiRequestTracker::expireRequests()
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		while (!shutdown_) {
+			if (pending_.empty()) {
+				changed_.wait(lock);
+				continue;
+			}
+			auto next = std::min_element(pending_.begin(), pending_.end(), [](PendingRequest const &a, PendingRequest const &b) { return a.deadline < b.deadline; });
+			if (next->deadline > std::chrono::steady_clock::now()) {
+				changed_.wait_until(lock, next->deadline);
+				continue;
+			}
+			auto onReply = next->onReply;
+			pending_.erase(next);
+			hasPending_ = !pending_.empty();
+			lock.unlock();
+			onReply(false, MidiMessage());
+			lock.lock();
+		}
+	}
+
 	midikraft::MidiRequest::MidiRequest(juce::MidiDeviceInfo const &midiOutput, std::vector<MidiMessage> const &request, TIsAnswerPredicate pred) : output_(midiOutput), request_(request), pred_(pred)
 	{
 	}
@@ -30,25 +114,12 @@ namespace midikraft {
 
 	juce::MidiMessage midikraft::MidiRequest::blockForReply()
 	{
-		auto handler = midikraft::MidiController::makeOneHandle();
-		bool answered = false;
-		MidiMessage answer;
-		midikraft::MidiController::instance()->addMessageHandler(handler, [this, &answered, &answer](MidiInput *source, MidiMessage const &message) {
-			ignoreUnused(source);
-			if (pred_(message)) {
-				answer = message;
-				answered = true;
-			}
-		});
-		midikraft::MidiController::instance()->getMidiOutput(output_)->sendBlockOfMessagesFullSpeed(request_);
+		auto reply = midikraft::MidiController::instance()->sendRequest(output_, request_, pred_);
 		try {
-			blockUntilTrue([&answered]() { return answered; });
-			midikraft::MidiController::instance()->removeMessageHandler(handler);
-			return answer;
+			return reply.get();
 		}
 		catch (std::runtime_error &e) {
 			ignoreUnused(e);
-			midikraft::MidiController::instance()->removeMessageHandler(handler);
 			throw std::runtime_error("PyTschirp: Timeout while waiting for edit buffer midi message");
 		}
 	}
@@ -0,0 +1,267 @@
+/*
+   Copyright (c) 2019 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "MidiSendQueue.h"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+namespace midikraft {
+
+	MidiSendPacing MidiSendPacing::fullSpeed()
+	{
+		return MidiSendPacing();
+	}
+
+	MidiSendPacing MidiSendPacing::throttled(int gapMilliseconds)
+	{
+		MidiSendPacing result;
+		result.gapMilliseconds = gapMilliseconds;
+		return result;
+	}
+
+	MidiSendPacing MidiSendPacing::wireRate(int gapMilliseconds)
+	{
+		MidiSendPacing result;
+		result.gapMilliseconds = gapMilliseconds;
+		result.bytesPerSecond = kMidiWireBytesPerSecond;
+		return result;
+	}
+
+	bool MidiSendPacing::isFullSpeed() const
+	{
+		return gapMilliseconds <= 0 && bytesPerSecond <= 0 && postSysexGapMilliseconds <= 0;
+	}
+
+	double MidiSendPacing::pauseAfterMs(MidiMessage const &message) const
+	{
+		// The gap, or as long as the bytes just sent take at the allowed rate, whichever is longer
+		double pause = std::max(gapMilliseconds, 0);
+		if (message.isSysEx()) {
+			pause = std::max(pause, (double)postSysexGapMilliseconds);
+		}
+		if (bytesPerSecond > 0) {
+			pause = std::max(pause, message.getRawDataSize() * 1000.0 / bytesPerSecond);
+		}
+		return pause;
+	}
+
+	MidiSendPacing MidiSendPacing::strictest(MidiSendPacing const &a, MidiSendPacing const &b)
+	{
+		MidiSendPacing result;
+		result.gapMilliseconds = std::max(a.gapMilliseconds, b.gapMilliseconds);
+		result.postSysexGapMilliseconds = std::max(a.postSysexGapMilliseconds, b.postSysexGapMilliseconds);
+		if (a.bytesPerSecond > 0 && b.bytesPerSecond > 0) {
+			result.bytesPerSecond = std::min(a.bytesPerSecond, b.bytesPerSecond);
+		}
+		else {
+			result.bytesPerSecond = std::max(a.bytesPerSecond, b.bytesPerSecond);
+		}
+		return result;
+	}
+
+	std::string MidiSendPacing::toString() const
+	{
+		return fmt::format("{},{},{}", gapMilliseconds, bytesPerSecond, postSysexGapMilliseconds);
+	}
+
+	MidiSendPacing MidiSendPacing::fromString(std::string const &text)
+	{
+		MidiSendPacing result;
+		StringArray parts;
+		parts.addTokens(String(text), ",", "");
+		if (parts.size() == 3) {
+			result.gapMilliseconds = std::max(parts[0].getIntValue(), 0);
+			result.bytesPerSecond = std::max(parts[1].getIntValue(), 0);
+			result.postSysexGapMilliseconds = std::max(parts[2].getIntValue(), 0);
+		}
+		return result;
+	}
+
+	MidiSendQueue::MidiSendQueue(String const &name, TSendFunction sendFunction) : Thread("MIDI Send " + name), sendFunction_(sendFunction),
+		nextJobID_(1), currentJob_(0), cancelCurrent_(false)
+	{
+		startThread();
+	}
+
+	MidiSendQueue::~MidiSendQueue()
+	{
+		cancelAll();
+		signalThreadShouldExit();
+		wakeUp_.signal();
+		stopThread(1000);
+	}
+
+	MidiSendQueue::JobID MidiSendQueue::enqueue(std::vector<MidiMessage> const& messages, MidiSendPacing const &pacing, TMidiSendFinished onFinished)
+	{
+		JobID id;
+		{
+			ScopedLock lock(jobLock_);
+			id = nextJobID_++;
+			jobs_.push_back({ id, messages, pacing, onFinished, nullptr });
+		}
+		wakeUp_.signal();
+		return id;
+	}
+
+	MidiSendQueue::JobID MidiSendQueue::enqueue(std::function<void()> work, MidiSendPacing const &pacing, TMidiSendFinished onFinished)
+	{
+		JobID id;
+		{
+			ScopedLock lock(jobLock_);
+			id = nextJobID_++;
+			jobs_.push_back({ id, {}, pacing, onFinished, work });
+		}
+		wakeUp_.signal();
+		return id;
+	}
+
+	bool MidiSendQueue::cancel(JobID job)
+	{
+		TMidiSendFinished canceledHandler;
+		{
+			ScopedLock lock(jobLock_);
+			if (currentJob_ == job) {
+				// The send thread will notify the job's handler once it notices
+				cancelCurrent_ = true;
+				wakeUp_.signal();
+				return true;
+			}
+			auto found = std::find_if(jobs_.begin(), jobs_.end(), [job](Job const& j) { return j.id == job; });
+			if (found == jobs_.end()) {
+				return false;
+			}
+			canceledHandler = found->onFinished;
+			jobs_.erase(found);
+		}
+		if (canceledHandler) {
+			canceledHandler(false);
+		}
+		return true;
+	}
+
+	void MidiSendQueue::cancelAll()
+	{
+		std::deque<Job> canceled;
+		{
+			ScopedLock lock(jobLock_);
+			canceled.swap(jobs_);
+			if (currentJob_ != 0) {
+				cancelCurrent_ = true;
+				wakeUp_.signal();
+			}
+		}
+		for (auto const& job : canceled) {
+			if (job.onFinished) {
+				job.onFinished(false);
+			}
+		}
+	}
+
+	bool MidiSendQueue::isIdle() const
+	{
+		ScopedLock lock(jobLock_);
+		return currentJob_ == 0 && jobs_.empty();
+	}
+
+	bool MidiSendQueue::isSendThread() const
+	{
+		return Thread::getCurrentThreadId() == getThreadId();
+	}
+
+	bool MidiSendQueue::sendFromJob(std::vector<MidiMessage> const &messages)
+	{
+		jassert(isSendThread());
+		{
+			ScopedLock lock(jobLock_);
+			if (cancelCurrent_) {
+				return false;
+			}
+		}
+		return sendPaced(messages, currentPacing_);
+	}
+
+	void MidiSendQueue::run()
+	{
+		while (!threadShouldExit()) {
+			Job job;
+			{
+				ScopedLock lock(jobLock_);
+				if (!jobs_.empty()) {
+					job = std::move(jobs_.front());
+					jobs_.pop_front();
+					currentJob_ = job.id;
+					cancelCurrent_ = false;
+				}
+			}
+			if (job.id == 0) {
+				wakeUp_.wait(-1);
+				continue;
+			}
+
+			bool completed = true;
+			if (job.work) {
+				currentPacing_ = job.pacing;
+				try {
+					job.work();
+				}
+				catch (std::exception &e) {
+					spdlog::error("Failed to send MIDI messages: {}", e.what());
+					completed = false;
+				}
+			}
+			else {
+				completed = sendPaced(job.messages, job.pacing);
+			}
+			{
+				ScopedLock lock(jobLock_);
+				if (cancelCurrent_ && job.work) {
+					completed = false;
+				}
+				currentJob_ = 0;
+				cancelCurrent_ = false;
+			}
+			if (!completed) {
+				spdlog::debug("Canceled sending of MIDI messages after partial transmission");
+			}
+			if (job.onFinished) {
+				job.onFinished(completed);
+			}
+		}
+	}
+
+	bool MidiSendQueue::sendPaced(std::vector<MidiMessage> const &messages, MidiSendPacing const &pacing)
+	{
+		for (size_t i = 0; i < messages.size(); i++) {
+			sendFunction_(messages[i]);
+			// Also pause after the last message, the next job might go to the same device
+			if (!pauseAfter(messages[i], pacing) && i + 1 < messages.size()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool MidiSendQueue::pauseAfter(MidiMessage const &message, MidiSendPacing const &pacing)
+	{
+		auto deadline = Time::getMillisecondCounter() + (uint32)std::ceil(pacing.pauseAfterMs(message));
+		for (;;) {
+			{
+				ScopedLock lock(jobLock_);
+				if (cancelCurrent_ || threadShouldExit()) {
+					return false;
+				}
+			}
+			auto now = Time::getMillisecondCounter();
+			if (now >= deadline) {
+				return true;
+			}
+			// New jobs signal the event as well, so keep waiting for the rest of the pause after a wake up
+			wakeUp_.wait((int)(deadline - now));
+		}
+	}
+
+}
@@ -0,0 +1,203 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "MidiTelemetry.h"
+
+namespace midikraft {
+
+	void LatencyHistogram::add(double milliseconds)
+	{
+		size_t bucket = 0;
+		while (bucket < kBucketLimitsMs.size() && milliseconds > kBucketLimitsMs[bucket]) {
+			bucket++;
+		}
+		buckets_[bucket]++;
+		count_++;
+		totalMs_ += milliseconds;
+		maxMs_ = std::max(maxMs_, milliseconds);
+	}
+
+	void LatencyHistogram::merge(LatencyHistogram const& other)
+	{
+		for (size_t i = 0; i < buckets_.size(); i++) {
+			buckets_[i] += other.buckets_[i];
+		}
+		count_ += other.count_;
+		totalMs_ += other.totalMs_;
+		maxMs_ = std::max(maxMs_, other.maxMs_);
+	}
+
+	size_t LatencyHistogram::count() const
+	{
+		return count_;
+	}
+
+	double LatencyHistogram::meanMs() const
+	{
+		return count_ > 0 ? totalMs_ / count_ : 0.0;
+	}
+
+	double LatencyHistogram::maxMs() const
+	{
+		return maxMs_;
+	}
+
+	double LatencyHistogram::percentileMs(double percentile) const
+	{
+		if (count_ == 0) {
+			return 0.0;
+		}
+		size_t rank = (size_t)std::ceil(percentile / 100.0 * count_);
+		size_t seen = 0;
+		for (size_t bucket = 0; bucket < kBucketLimitsMs.size(); bucket++) {
+			seen += buckets_[bucket];
+			if (seen >= rank) {
+				return std::min(kBucketLimitsMs[bucket], maxMs_);
+			}
+		}
+		return maxMs_;
+	}
+
+	std::array<size_t, LatencyHistogram::kBucketLimitsMs.size() + 1> const& LatencyHistogram::buckets() const
+	{
+		return buckets_;
+	}
+
+	double MidiPortStatistics::bytesInPerSecond() const
+	{
+		double seconds = (lastActivityMs - firstActivityMs) / 1000.0;
+		return seconds > 0.0 ? bytesIn / seconds : 0.0;
+	}
+
+	double MidiPortStatistics::bytesOutPerSecond() const
+	{
+		double seconds = (lastActivityMs - firstActivityMs) / 1000.0;
+		return seconds > 0.0 ? bytesOut / seconds : 0.0;
+	}
+
+	MidiTelemetry::MidiTelemetry() : logDownloadSummaries_(false)
+	{
+	}
+
+	MidiPortStatistics& MidiTelemetry::port(String const& device)
+	{
+		auto found = ports_.find(device);
+		if (found == ports_.end()) {
+			found = ports_.emplace(device, MidiPortStatistics()).first;
+			found->second.device = device.toStdString();
+		}
+		return found->second;
+	}
+
+	void MidiTelemetry::recordMessage(String const& device, bool isOut, size_t bytes)
+	{
+		auto now = Time::getMillisecondCounterHiRes();
+		ScopedLock lock(lock_);
+		countMessage(port(device), isOut, bytes, now);
+	}
+
+	void MidiTelemetry::recordIncoming(String const& device, size_t bytes, double dispatchMilliseconds)
+	{
+		auto now = Time::getMillisecondCounterHiRes();
+		ScopedLock lock(lock_);
+		auto& stats = port(device);
+		countMessage(stats, false, bytes, now);
+		stats.dispatch.add(dispatchMilliseconds);
+	}
+
+	void MidiTelemetry::countMessage(MidiPortStatistics &stats, bool isOut, size_t bytes, double nowMs)
+	{
+		if (stats.messagesIn == 0 && stats.messagesOut == 0) {
+			stats.firstActivityMs = nowMs;
+		}
+		stats.lastActivityMs = nowMs;
+		if (isOut) {
+			stats.messagesOut++;
+			stats.bytesOut += bytes;
+		}
+		else {
+			stats.messagesIn++;
+			stats.bytesIn += bytes;
+		}
+	}
+
+	void MidiTelemetry::recordDispatch(String const& device, double milliseconds)
+	{
+		ScopedLock lock(lock_);
+		port(device).dispatch.add(milliseconds);
+	}
+
+	void MidiTelemetry::recordRequest(std::string const& synth)
+	{
+		ScopedLock lock(lock_);
+		auto& stats = downloads_[synth];
+		stats.synth = synth;
+		stats.requests++;
+	}
+
+	void MidiTelemetry::recordReply(std::string const& synth, double latencyMs)
+	{
+		ScopedLock lock(lock_);
+		auto& stats = downloads_[synth];
+		stats.synth = synth;
+		stats.replies++;
+		stats.replyLatency.add(latencyMs);
+	}
+
+	void MidiTelemetry::recordTimeout(std::string const& synth)
+	{
+		ScopedLock lock(lock_);
+		auto& stats = downloads_[synth];
+		stats.synth = synth;
+		stats.timeouts++;
+	}
+
+	void MidiTelemetry::recordGap(std::string const& synth)
+	{
+		ScopedLock lock(lock_);
+		auto& stats = downloads_[synth];
+		stats.synth = synth;
+		stats.gaps++;
+	}
+
+	std::vector<MidiPortStatistics> MidiTelemetry::portStatistics() const
+	{
+		ScopedLock lock(lock_);
+		std::vector<MidiPortStatistics> result;
+		for (auto const& entry : ports_) {
+			result.push_back(entry.second);
+		}
+		return result;
+	}
+
+	std::vector<DownloadStatistics> MidiTelemetry::downloadStatistics() const
+	{
+		ScopedLock lock(lock_);
+		std::vector<DownloadStatistics> result;
+		for (auto const& entry : downloads_) {
+			result.push_back(entry.second);
+		}
+		return result;
+	}
+
+	void MidiTelemetry::reset()
+	{
+		ScopedLock lock(lock_);
+		ports_.clear();
+		downloads_.clear();
+	}
+
+	void MidiTelemetry::setLogDownloadSummaries(bool enabled)
+	{
+		logDownloadSummaries_ = enabled;
+	}
+
+	bool MidiTelemetry::logDownloadSummaries() const
+	{
+		return logDownloadSummaries_;
+	}
+
+}
@@ -0,0 +1,64 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "OperationStatistics.h"
+
+namespace midikraft {
+
+	OperationStatistics::Timer::Timer(OperationStatistics& statistics, char const* operation) : statistics_(statistics), operation_(operation),
+		startMs_(statistics.isEnabled() ? Time::getMillisecondCounterHiRes() : -1.0)
+	{
+	}
+
+	OperationStatistics::Timer::~Timer()
+	{
+		if (startMs_ >= 0.0) {
+			statistics_.record(operation_, Time::getMillisecondCounterHiRes() - startMs_);
+		}
+	}
+
+	OperationStatistics::OperationStatistics(bool enabled) : enabled_(enabled)
+	{
+	}
+
+	OperationStatistics& OperationStatistics::global()
+	{
+		static OperationStatistics sGlobal(false);
+		return sGlobal;
+	}
+
+	void OperationStatistics::setEnabled(bool enabled)
+	{
+		enabled_ = enabled;
+	}
+
+	bool OperationStatistics::isEnabled() const
+	{
+		return enabled_;
+	}
+
+	void OperationStatistics::record(char const* operation, double elapsedMs)
+	{
+		ScopedLock lock(lock_);
+		auto& timing = timings_[operation];
+		timing.calls++;
+		timing.totalMs += elapsedMs;
+		timing.maxMs = std::max(timing.maxMs, elapsedMs);
+	}
+
+	std::map<std::string, OperationTiming> OperationStatistics::snapshot() const
+	{
+		ScopedLock lock(lock_);
+		return timings_;
+	}
+
+	void OperationStatistics::reset()
+	{
+		ScopedLock lock(lock_);
+		timings_.clear();
+	}
+
+}
@@ -0,0 +1,115 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+namespace midikraft {
+
+	// Set while the current thread runs the work of a ParallelFor
+	thread_local bool tInsideParallelFor = false;
+
+	ParallelFor::ParallelFor(size_t count, std::function<void(size_t)> work, size_t batchSize) : ParallelFor(count, work, batchSize, threadsFor(count, batchSize))
+	{
+	}
+
+	ParallelFor::ParallelFor(size_t count, std::function<void(size_t)> work, size_t batchSize, size_t backgroundThreads) : count_(count), batchSize_(std::max((size_t)1, batchSize)),
+		work_(work), next_(0), stop_(false), running_(backgroundThreads)
+	{
+		for (size_t t = 0; t < backgroundThreads; t++) {
+			threads_.emplace_back([this]() {
+				worker();
+				running_--;
+			});
+		}
+	}
+
+	ParallelFor::~ParallelFor()
+	{
+		stop();
+		for (auto &thread : threads_) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+	}
+
+	void ParallelFor::stop()
+	{
+		stop_ = true;
+	}
+
+	bool ParallelFor::isFinished() const
+	{
+		return running_ == 0;
+	}
+
+	void ParallelFor::join()
+	{
+		for (auto &thread : threads_) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+		std::exception_ptr error;
+		{
+			std::lock_guard<std::mutex> lock(errorLock_);
+			std::swap(error, firstError_);
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	void ParallelFor::run(size_t count, std::function<void(size_t)> const &work, size_t batchSize)
+	{
+		size_t numThreads = tInsideParallelFor ? 1 : threadsFor(count, batchSize);
+		if (numThreads < 2) {
+			for (size_t i = 0; i < count; i++) {
+				work(i);
+			}
+			return;
+		}
+		ParallelFor workers(count, work, batchSize, numThreads - 1);
+		workers.worker();
+		workers.join();
+	}
+
+	size_t ParallelFor::threadsFor(size_t count, size_t batchSize)
+	{
+		batchSize = std::max((size_t)1, batchSize);
+		return std::min((size_t)std::max(1u, std::thread::hardware_concurrency()), (count + batchSize - 1) / batchSize);
+	}
+
+	void ParallelFor::worker()
+	{
+		// The calling thread of run() works as well, it might already be inside another ParallelFor
+		bool wasInside = tInsideParallelFor;
+		tInsideParallelFor = true;
+		while (!stop_) {
+			size_t start = next_.fetch_add(batchSize_);
+			if (start >= count_) {
+				break;
+			}
+			size_t end = std::min(start + batchSize_, count_);
+			try {
+				for (size_t i = start; i < end && !stop_; i++) {
+					work_(i);
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(errorLock_);
+				if (!firstError_) {
+					firstError_ = std::current_exception();
+				}
+				stop_ = true;
+			}
+		}
+		tInsideParallelFor = wasInside;
+	}
+
+}
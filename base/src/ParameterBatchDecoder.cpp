@@ -0,0 +1,109 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "ParameterBatchDecoder.h"
+
+#include "Capability.h"
+#include "DetailedParametersCapability.h"
+#include "Patch.h"
+
+#include <algorithm>
+
+namespace midikraft {
+
+	namespace {
+
+		std::vector<std::shared_ptr<SynthParameterDefinition>> definitionsOf(std::shared_ptr<Synth> synth) {
+			auto detailed = Capability::hasCapability<DetailedParametersCapability>(synth);
+			if (detailed) {
+				return detailed->allParameterDefinitions();
+			}
+			return {};
+		}
+
+	}
+
+	ParameterBatchDecoder::ParameterBatchDecoder(std::shared_ptr<Synth> synth) : ParameterBatchDecoder(definitionsOf(synth))
+	{
+	}
+
+	ParameterBatchDecoder::ParameterBatchDecoder(std::vector<std::shared_ptr<SynthParameterDefinition>> const& definitions) : columns_(0)
+	{
+		for (auto const& definition : definitions) {
+			if (!definition) continue;
+			Parameter parameter{ definition, definition->type(), nullptr, nullptr, 0, 0, 0, columns_, 1 };
+			switch (parameter.type) {
+			case SynthParameterDefinition::ParamType::INT:
+			case SynthParameterDefinition::ParamType::LOOKUP:
+				parameter.intValue = Capability::hasCapability<SynthIntParameterCapability>(definition.get());
+				break;
+			case SynthParameterDefinition::ParamType::INT_ARRAY:
+			case SynthParameterDefinition::ParamType::LOOKUP_ARRAY:
+				parameter.vectorValue = Capability::hasCapability<SynthVectorParameterCapability>(definition.get());
+				if (parameter.vectorValue) {
+					parameter.width = (size_t)std::max(1, parameter.vectorValue->endSysexIndex() - parameter.vectorValue->sysexIndex());
+				}
+				break;
+			}
+			SynthIntValueParameterCapability const* range = parameter.intValue 
+				? static_cast<SynthIntValueParameterCapability const*>(parameter.intValue) 
+				: static_cast<SynthIntValueParameterCapability const*>(parameter.vectorValue);
+			if (!range) {
+				// Can't be read as a number, e.g. a text only parameter
+				continue;
+			}
+			parameter.sysexIndex = range->sysexIndex();
+			parameter.minValue = range->minValue();
+			parameter.maxValue = range->maxValue();
+			columns_ += parameter.width;
+			parameters_.push_back(parameter);
+		}
+	}
+
+	std::vector<ParameterBatchDecoder::Parameter> const& ParameterBatchDecoder::parameters() const
+	{
+		return parameters_;
+	}
+
+	size_t ParameterBatchDecoder::columns() const
+	{
+		return columns_;
+	}
+
+	ParameterMatrix ParameterBatchDecoder::decode(TPatchVector const& patches) const
+	{
+		ParameterMatrix matrix;
+		matrix.rows = patches.size();
+		matrix.columns = columns_;
+		matrix.values.assign(matrix.rows * matrix.columns, ParameterMatrix::kMissing);
+		for (size_t r = 0; r < patches.size(); r++) {
+			if (patches[r]) {
+				decode(*patches[r], matrix.values.data() + r * columns_);
+			}
+		}
+		return matrix;
+	}
+
+	void ParameterBatchDecoder::decode(DataFile const& patch, int* row) const
+	{
+		std::vector<int> arrayValue;
+		for (auto const& parameter : parameters_) {
+			int* out = row + parameter.firstColumn;
+			if (parameter.intValue) {
+				int value;
+				*out = parameter.intValue->valueInPatch(patch, value) ? value : ParameterMatrix::kMissing;
+			}
+			else {
+				arrayValue.clear();
+				bool valid = parameter.vectorValue->valueInPatch(patch, arrayValue);
+				for (size_t i = 0; i < parameter.width; i++) {
+					out[i] = valid && i < arrayValue.size() ? arrayValue[i] : ParameterMatrix::kMissing;
+				}
+			}
+		}
+	}
+
+}
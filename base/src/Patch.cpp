@@ -20,26 +20,48 @@ namespace midikraft {
 	{
 	}
 
+	DataFile::DataFile(int dataTypeID, SharedPatchData const &patchdata) : dataTypeID_(dataTypeID), data_(patchdata)
+	{
+	}
+
 	int DataFile::dataTypeID() const
 	{
 		return dataTypeID_;
 	}
 
 	void DataFile::setData(Synth::PatchData const &data)
+	{
+		data_ = SharedPatchData(data);
+		invalidateFingerprint();
+	}
+
+	void DataFile::setData(Synth::PatchData &&data)
+	{
+		data_ = SharedPatchData(std::move(data));
+		invalidateFingerprint();
+	}
+
+	void DataFile::setData(SharedPatchData const &data)
 	{
 		data_ = data;
+		invalidateFingerprint();
 	}
 
 	void DataFile::setDataFromSysex(MidiMessage const &message)
 	{
-		data_ = std::vector<uint8>(message.getSysExData(), message.getSysExData() + message.getSysExDataSize());
+		data_ = SharedPatchData(message.getSysExData(), (size_t) message.getSysExDataSize());
+		invalidateFingerprint();
 	}
 
 	Synth::PatchData const & DataFile::data() const
 	{
-		return data_;
+		return data_.bytes();
 	}
 
+	SharedPatchData const &DataFile::sharedData() const
+	{
+		return data_;
+	}
 
 	int DataFile::at(int sysExIndex) const
 	{
@@ -49,15 +71,39 @@ namespace midikraft {
 	void DataFile::setAt(int sysExIndex, uint8 value)
 	{
 		jassert(((size_t) sysExIndex) < data_.size());
-        if (sysExIndex >= 0)
-		    data_[(size_t) sysExIndex] = value;
+        if (sysExIndex >= 0) {
+			if (data_[(size_t)sysExIndex] != value) {
+				data_.mutableBytes()[(size_t)sysExIndex] = value;
+				invalidateFingerprint();
+			}
+		}
         else
             jassertfalse;
 	}
 
 	std::vector<juce::MidiMessage> DataFile::asMidiMessages() const
 	{
-		return Sysex::vectorToMessages(data_);
+		return Sysex::vectorToMessages(data_.bytes());
+	}
+
+	bool DataFile::cachedFingerprint(Synth const *synth, std::string &outFingerprint) const
+	{
+		auto cached = std::atomic_load(&fingerprint_);
+		if (cached && cached->synth == synth) {
+			outFingerprint = cached->fingerprint;
+			return true;
+		}
+		return false;
+	}
+
+	void DataFile::cacheFingerprint(Synth const *synth, std::string const &fingerprint) const
+	{
+		std::atomic_store(&fingerprint_, std::make_shared<CachedFingerprint const>(CachedFingerprint{ synth, fingerprint }));
+	}
+
+	void DataFile::invalidateFingerprint()
+	{
+		std::atomic_store(&fingerprint_, std::shared_ptr<CachedFingerprint const>());
 	}
 
 	Synth::PatchData Patch::blankOut(std::vector<Range<size_t>> const &blankoutZones, Synth::PatchData const &inputData)
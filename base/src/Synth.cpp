@@ -12,6 +12,9 @@
 #include "MidiHelpers.h"
 #include "Logger.h"
 #include "Sysex.h"
+#include "OperationStatistics.h"
+#include "ParallelFor.h"
+#include "Tracing.h"
 
 #include "HasBanksCapability.h"
 #include "EditBufferCapability.h"
@@ -23,6 +26,8 @@
 #include "StoredPatchNameCapability.h"
 #include "StoredPatchNumberCapability.h"
 
+#include <set>
+
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 #include "SpdLogJuce.h"
@@ -88,15 +93,106 @@ namespace midikraft {
 		return md5.toHexString().toStdString();
 	}
 
+	bool Synth::canCalculateFingerprintsConcurrently() const
+	{
+		// The default implementation only reads the patch data, which is safe
+		return true;
+	}
+
+	std::string Synth::fingerprint(std::shared_ptr<DataFile> patch) const
+	{
+		std::string result;
+		if (!patch->cachedFingerprint(this, result)) {
+			result = calculateFingerprint(patch);
+			patch->cacheFingerprint(this, result);
+		}
+		return result;
+	}
+
+	std::vector<std::string> Synth::fingerprints(TPatchVector const &patches) const
+	{
+		std::vector<std::string> result(patches.size());
+		std::vector<size_t> missing;
+		for (size_t i = 0; i < patches.size(); i++) {
+			if (!patches[i]->cachedFingerprint(this, result[i])) {
+				missing.push_back(i);
+			}
+		}
+
+		// Small batches, so a slow patch doesn't hold up the others. Only go parallel if it is worth starting the threads
+		const size_t kBatchSize = 32;
+		if (!canCalculateFingerprintsConcurrently() || missing.size() / kBatchSize < 2) {
+			for (auto i : missing) {
+				result[i] = fingerprint(patches[i]);
+			}
+			return result;
+		}
+		ParallelFor::run(missing.size(), [&](size_t m) {
+			result[missing[m]] = fingerprint(patches[missing[m]]);
+		}, kBatchSize);
+		return result;
+	}
+
 	std::string Synth::setupHelpText() const
 	{
 		// Default is nothing special
 		return "No special setup information is provided. I'd say, read the manual!";
 	}
 
+	std::vector<std::vector<uint8>> Synth::sysexHeaderPrefixes() const
+	{
+		// Unknown, so every message is a candidate
+		return {};
+	}
+
+	TPatchVector Synth::patchesFromSplitBank(BankDumpSplitCapability *splitter, std::vector<MidiMessage> const &bankDump)
+	{
+		TraceSpan span("Synth::patchesFromSplitBank", [this]() { return getName(); });
+		auto slices = splitter->splitSysexBank(bankDump);
+		if (slices.empty()) {
+			return {};
+		}
+
+		// Decoded in small batches like fingerprints(), each slot of decoded is written by one worker only
+		TPatchVector decoded(slices.size());
+		ParallelFor::run(slices.size(), [&](size_t i) {
+			auto const &slice = slices[i];
+			if (slice.message >= bankDump.size() || slice.offset + slice.size > (size_t) bankDump[slice.message].getRawDataSize()) {
+				spdlog::warn("Bank slice for patch #{} lies outside of the bank dump, skipping it", i);
+				return;
+			}
+			decoded[i] = splitter->patchFromBankSlice(bankDump, slice, (int) i);
+			if (!decoded[i]) {
+				spdlog::warn("Error decoding patch #{} of bank dump, skipping it", i);
+			}
+		}, 8);
+
+		TPatchVector result;
+		result.reserve(decoded.size());
+		for (auto &patch : decoded) {
+			if (patch) {
+				result.push_back(std::move(patch));
+			}
+		}
+		// Hash them while they are fresh, also in parallel. Whoever stores or compares the patches later finds the fingerprint cached
+		fingerprints(result);
+		return result;
+	}
+
+	void Synth::appendToWindow(std::vector<MidiMessage> &window, MidiMessage const &message) const
+	{
+		// The window is kept and handed to the capabilities as it is, so each message is copied once instead of the whole window once per message
+		window.push_back(message);
+		if (window.size() > maxNumberMessagesPerPatch_) {
+			spdlog::debug("Dropping message during parsing as potential number of MIDI messages per patch is larger than {}", maxNumberMessagesPerPatch_);
+			window.erase(window.begin(), window.begin() + (window.size() - maxNumberMessagesPerPatch_));
+		}
+	}
+
 	TPatchVector Synth::loadSysex(std::vector<MidiMessage> const &sysexMessages)
 	{
-		
+		OperationStatistics::Timer timer(OperationStatistics::global(), "Synth::loadSysex");
+		TraceSpan span("Synth::loadSysex", [this]() { return getName(); });
 
 		// Now that we have a list of messages, let's see if there are (hopefully) any patches between them
 		auto editBufferSynth = midikraft::Capability::hasCapability<EditBufferCapability>(this);
@@ -109,106 +205,105 @@ namespace midikraft {
 			return streamDumpSynth->loadPatchesFromStream(sysexMessages);
 		}
 		else {
-			// The other Synth types load message by message
-			TPatchVector results;
-			std::map<std::string, std::shared_ptr<midikraft::DataFile>> programDumpsById;
-			if (programDumpSynth) {
-				std::deque<MidiMessage> currentProgramDumps;
-				int patchNo = 0;
-				for (auto message : sysexMessages) {
-					// Try to parse and load these messages as program dumps
-					if (programDumpSynth->isMessagePartOfProgramDump(message).isPartOfProgramDump) {
-						currentProgramDumps.push_back(message);
-						while (currentProgramDumps.size() > maxNumberMessagesPerPatch_) {
-							spdlog::debug("Dropping message during parsing as potential number of MIDI messages per patch is larger than {}", maxNumberMessagesPerPatch_);
-							currentProgramDumps.pop_front();
+			// The other Synth types load message by message. This is one pass over the messages, each message is offered to every capability
+			// and collected in that capability's own window. A message can be part of more than one kind of dump, so there is no early out
+			std::vector<MidiMessage> programWindow, editBufferWindow, bankWindow;
+			programWindow.reserve(maxNumberMessagesPerPatch_ + 1);
+			editBufferWindow.reserve(maxNumberMessagesPerPatch_ + 1);
+			bankWindow.reserve(maxNumberMessagesPerPatch_ + 1);
+			TPatchVector programDumps, editBuffers, bankPatches, dataFiles;
+			std::set<std::string> programDumpIds;
+			int programNo = 0;
+			int editBufferNo = 0;
+			int dataTypes = dataFileLoadSynth ? static_cast<int>(dataFileLoadSynth->dataTypeNames().size()) : 0;
+			std::vector<MidiMessage> dataRun;
+			int dataRunType = DataFileLoadCapability::kNoDataType;
+			auto flushDataRun = [&]() {
+				if (!dataRun.empty()) {
+					auto items = dataFileLoadSynth->loadData(std::move(dataRun), dataRunType);
+					std::copy(items.begin(), items.end(), std::back_inserter(dataFiles));
+					dataRun.clear();
+				}
+			};
+			for (auto const &message : sysexMessages) {
+				// Try to parse and load these messages as program dumps
+				if (programDumpSynth && programDumpSynth->isMessagePartOfProgramDump(message).isPartOfProgramDump) {
+					appendToWindow(programWindow, message);
+					if (programDumpSynth->isSingleProgramDump(programWindow)) {
+						auto patch = programDumpSynth->patchFromProgramDumpSysex(programWindow);
+						if (patch) {
+							programDumps.push_back(patch);
+							programDumpIds.insert(fingerprint(patch));
 						}
-						std::vector<MidiMessage> slidingWindow(currentProgramDumps.begin(), currentProgramDumps.end());
-						if (programDumpSynth->isSingleProgramDump(slidingWindow)) {
-							auto patch = programDumpSynth->patchFromProgramDumpSysex(slidingWindow);
-							if (patch) {
-								results.push_back(patch);
-								programDumpsById[calculateFingerprint(patch)] = patch;
-							}
-							else {
-								spdlog::warn("Error decoding program dump for patch #{}, skipping it. {}", patchNo, Sysex::dumpSysexToString(slidingWindow));
-							}
-							currentProgramDumps.clear();
-							patchNo++;
+						else {
+							spdlog::warn("Error decoding program dump for patch #{}, skipping it. {}", programNo, Sysex::dumpSysexToString(programWindow));
 						}
+						programWindow.clear();
+						programNo++;
 					}
 				}
-			}
 
-			if (editBufferSynth) {
-				std::deque<MidiMessage> currentEditBuffers;
 				// Try to parse and load these messages as edit buffers
-				int patchNo = 0;
-				for (auto message : sysexMessages) {
-					if (editBufferSynth->isMessagePartOfEditBuffer(message).isPartOfEditBufferDump) {
-						currentEditBuffers.push_back(message);
-						if (currentEditBuffers.size() > maxNumberMessagesPerPatch_) {
-							spdlog::debug("Dropping message during parsing as potential number of MIDI messages per patch is larger than {}", maxNumberMessagesPerPatch_);
-							currentEditBuffers.pop_front();
+				if (editBufferSynth && editBufferSynth->isMessagePartOfEditBuffer(message).isPartOfEditBufferDump) {
+					appendToWindow(editBufferWindow, message);
+					if (editBufferSynth->isEditBufferDump(editBufferWindow)) {
+						auto patch = editBufferSynth->patchFromSysex(editBufferWindow);
+						if (patch) {
+							editBuffers.push_back(patch);
 						}
-						std::vector<MidiMessage> slidingWindow(currentEditBuffers.begin(), currentEditBuffers.end());
-						if (editBufferSynth->isEditBufferDump(slidingWindow)) {
-							auto patch = editBufferSynth->patchFromSysex(slidingWindow);
-							if (patch) {
-								auto id = calculateFingerprint(patch);
-								if (programDumpsById.find(id) == programDumpsById.end()) {
-									results.push_back(patch);
-								}
-								else {
-									// Ignore edit buffer, as we already loaded a program dump with the same ID. This happens for 
-									// synths where program dumps will make edit buffers to be detected, like the Reface DX adaptation.
-								}
-							}
-							else {
-								spdlog::warn("Error decoding edit buffer dump for patch #{}, skipping it. {}", patchNo, Sysex::dumpSysexToString(slidingWindow));
-							}
-							currentEditBuffers.clear();
-							patchNo++;
+						else {
+							spdlog::warn("Error decoding edit buffer dump for patch #{}, skipping it. {}", editBufferNo, Sysex::dumpSysexToString(editBufferWindow));
 						}
+						editBufferWindow.clear();
+						editBufferNo++;
 					}
 				}
-			}
 
-			if (bankDumpSynth) {
-				std::deque<MidiMessage> currentBank;
 				// Try to parse and load these messages as a bank dump
-				for (auto message : sysexMessages) {
-					if (bankDumpSynth->isBankDump(message)) {
-						currentBank.push_back(message);
-						if (currentBank.size() > maxNumberMessagesPerPatch_) {
-							spdlog::debug("Dropping message during parsing as potential number of MIDI messages per patch is larger than {}", maxNumberMessagesPerPatch_);
-							currentBank.pop_front();
+				if (bankDumpSynth && bankDumpSynth->isBankDump(message)) {
+					appendToWindow(bankWindow, message);
+					if (bankDumpSynth->isBankDumpFinished(bankWindow)) {
+						TPatchVector morePatches;
+						auto splitter = midikraft::Capability::hasCapability<BankDumpSplitCapability>(this);
+						if (splitter) {
+							morePatches = patchesFromSplitBank(splitter, bankWindow);
 						}
-						std::vector<MidiMessage> slidingWindow(currentBank.begin(), currentBank.end());
-						if (bankDumpSynth->isBankDumpFinished(slidingWindow)) {
-							auto morePatches = bankDumpSynth->patchesFromSysexBank(slidingWindow);
-							spdlog::info("Loaded bank dump with {} patches", morePatches.size());
-							std::copy(morePatches.begin(), morePatches.end(), std::back_inserter(results));
-							currentBank.clear();
+						if (morePatches.empty()) {
+							morePatches = bankDumpSynth->patchesFromSysexBank(bankWindow);
 						}
+						spdlog::info("Loaded bank dump with {} patches", morePatches.size());
+						std::copy(morePatches.begin(), morePatches.end(), std::back_inserter(bankPatches));
+						bankWindow.clear();
 					}
 				}
-			}
 
-			// Ty to parse and load the message as a data file
-			if (dataFileLoadSynth) {
-				// Should test all data file types!
-				for (auto message : sysexMessages) {
-					for (int dataType = 0; dataType < static_cast<int>(dataFileLoadSynth->dataTypeNames().size()); dataType++) {
-						if (dataFileLoadSynth->isDataFile(message, dataType)) {
-							// Hit, we can load this
-							auto items = dataFileLoadSynth->loadData({ message }, dataType);
-							std::copy(items.begin(), items.end(), std::back_inserter(results));
-						}
+				// Try to parse and load the message as a data file. Consecutive messages of the same type are loaded with one call
+				if (dataFileLoadSynth) {
+					int dataType = dataFileLoadSynth->dataTypeOfMessage(message, dataTypes);
+					if (dataType != dataRunType) {
+						flushDataRun();
+						dataRunType = dataType;
+					}
+					if (dataType != DataFileLoadCapability::kNoDataType) {
+						dataRun.push_back(message);
 					}
 				}
 			}
+			flushDataRun();
 
+			// Same order of results as if each kind had been loaded on its own
+			TPatchVector results = programDumps;
+			for (auto const &patch : editBuffers) {
+				if (programDumpIds.find(fingerprint(patch)) == programDumpIds.end()) {
+					results.push_back(patch);
+				}
+				else {
+					// Ignore edit buffer, as we already loaded a program dump with the same ID. This happens for 
+					// synths where program dumps will make edit buffers to be detected, like the Reface DX adaptation.
+				}
+			}
+			std::copy(bankPatches.begin(), bankPatches.end(), std::back_inserter(results));
+			std::copy(dataFiles.begin(), dataFiles.end(), std::back_inserter(results));
 			return results;
 		}
 	}
@@ -338,6 +433,19 @@ namespace midikraft {
 		MidiController::instance()->getMidiOutput(midiOutput)->sendBlockOfMessagesFullSpeed(buffer);
 	}
 
+	MidiSendQueue::JobID Synth::enqueueBlockOfMessagesToSynth(juce::MidiDeviceInfo const& midiOutput, std::vector<MidiMessage> const& buffer, TMidiSendFinished onFinished)
+	{
+		// Through sendBlockOfMessagesToSynth(), so synths overriding it get their messages sent the same way as without the queue
+		return MidiController::instance()->getMidiOutput(midiOutput)->runOnSendThread([this, midiOutput, buffer]() {
+			sendBlockOfMessagesToSynth(midiOutput, buffer);
+		}, sendPacing(), onFinished);
+	}
+
+	MidiSendPacing Synth::sendPacing() const
+	{
+		return MidiSendPacing::fullSpeed();
+	}
+
 
 	int Synth::sizeOfBank(std::shared_ptr<Synth> synth, int zeroBasedBankNumber)
 	{
@@ -0,0 +1,95 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "SysexParameterLookup.h"
+
+#include "Capability.h"
+#include "DetailedParametersCapability.h"
+
+#include <spdlog/spdlog.h>
+
+namespace midikraft {
+
+	namespace {
+
+		// Sysex indexes are offsets into a patch, so anything above this is not a real index and would only blow up the table
+		const int kMaxSysexIndex = 1 << 16;
+
+		std::vector<std::shared_ptr<SynthParameterDefinition>> definitionsOf(std::shared_ptr<Synth> synth) {
+			auto detailed = Capability::hasCapability<DetailedParametersCapability>(synth);
+			if (detailed) {
+				return detailed->allParameterDefinitions();
+			}
+			return {};
+		}
+
+	}
+
+	SysexParameterLookup::SysexParameterLookup(std::shared_ptr<Synth> synth) : SysexParameterLookup(definitionsOf(synth))
+	{
+	}
+
+	SysexParameterLookup::SysexParameterLookup(std::vector<std::shared_ptr<SynthParameterDefinition>> const& definitions) : firstIndex_(0)
+	{
+		for (auto const& definition : definitions) {
+			if (!definition) continue;
+			switch (definition->type()) {
+			case SynthParameterDefinition::ParamType::INT:
+			case SynthParameterDefinition::ParamType::LOOKUP:
+				if (auto intValue = Capability::hasCapability<SynthIntParameterCapability>(definition.get())) {
+					add(intValue->sysexIndex(), { definition, 0 });
+				}
+				break;
+			case SynthParameterDefinition::ParamType::INT_ARRAY:
+			case SynthParameterDefinition::ParamType::LOOKUP_ARRAY:
+				if (auto vectorValue = Capability::hasCapability<SynthVectorParameterCapability>(definition.get())) {
+					for (int index = vectorValue->sysexIndex(); index < vectorValue->endSysexIndex(); index++) {
+						add(index, { definition, index - vectorValue->sysexIndex() });
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	void SysexParameterLookup::add(int sysexIndex, Entry const& entry)
+	{
+		if (sysexIndex < 0 || sysexIndex > kMaxSysexIndex) {
+			spdlog::warn("Parameter {} has sysex index {} out of range, ignoring it for parameter change lookup", entry.definition->name(), sysexIndex);
+			return;
+		}
+		if (entries_.empty()) {
+			firstIndex_ = sysexIndex;
+		}
+		else if (sysexIndex < firstIndex_) {
+			entries_.insert(entries_.begin(), (size_t)(firstIndex_ - sysexIndex), Entry{ nullptr, 0 });
+			firstIndex_ = sysexIndex;
+		}
+		size_t position = (size_t)(sysexIndex - firstIndex_);
+		if (position >= entries_.size()) {
+			entries_.resize(position + 1, Entry{ nullptr, 0 });
+		}
+		if (entries_[position].definition) {
+			// Some synths list a parameter twice, e.g. in a layer overview. The first definition wins, as in the editor
+			return;
+		}
+		entries_[position] = entry;
+	}
+
+	SysexParameterLookup::Entry const* SysexParameterLookup::find(int sysexIndex) const
+	{
+		if (sysexIndex < firstIndex_) return nullptr;
+		size_t position = (size_t)(sysexIndex - firstIndex_);
+		if (position >= entries_.size() || !entries_[position].definition) return nullptr;
+		return &entries_[position];
+	}
+
+	bool SysexParameterLookup::empty() const
+	{
+		return entries_.empty();
+	}
+
+}
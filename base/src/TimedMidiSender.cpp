@@ -11,60 +11,82 @@
 
 namespace midikraft {
 
-	TimedMidiSender::TimedMidiSender(int sampleRate) : sampleRate_(sampleRate), previousSampleNumber_(0)
+	// Below this, the OS timer is too coarse to wait on, so the last stretch is spent yielding
+	const double kSpinThresholdMs = 2.0;
+
+	TimedMidiSender::TimedMidiSender(int sampleRate) : Thread("Timed MIDI Sender"), nextSequence_(0)
 	{
+		ignoreUnused(sampleRate);
 		startTime_ = (Time::getMillisecondCounterHiRes() * 0.001);
-		// This is jittery like hell but for now we will be ok
-		startTimer(50);
+		startThread(Thread::Priority::highest);
 	}
 
 	TimedMidiSender::~TimedMidiSender()
 	{
-		stopTimer();
+		signalThreadShouldExit();
+		wakeUp_.signal();
+		stopThread(1000);
 	}
 
 	void TimedMidiSender::addMessageToBuffer(juce::MidiDeviceInfo const &midiOutput, MidiMessage &message, double timeRelativeToNowInS)
 	{
-		auto timestamp = Time::getMillisecondCounterHiRes() * 0.001 + timeRelativeToNowInS - startTime_;
+		auto now = Time::getMillisecondCounterHiRes();
+		auto timestamp = now * 0.001 + timeRelativeToNowInS - startTime_;
 		message.setTimeStamp(timestamp);
-		auto sampleNumber = (int)(timestamp * sampleRate_);
-		if (midiBuffer_.find(midiOutput.identifier) == midiBuffer_.end()) {
-			midiBuffer_[midiOutput.identifier] = MidiBuffer();
-		}
 		jassert(message.getRawDataSize() <= 65535);
-		midiDevices_[midiOutput.identifier] = midiOutput; // Save for later
-		midiBuffer_[midiOutput.identifier].addEvent(message, sampleNumber);
+		{
+			ScopedLock lock(queueLock_);
+			auto output = outputs_.find(midiOutput.identifier);
+			if (output == outputs_.end() || !output->second->isValid()) {
+				outputs_[midiOutput.identifier] = midikraft::MidiController::instance()->getMidiOutput(midiOutput);
+				output = outputs_.find(midiOutput.identifier);
+			}
+			queue_.push({ now + timeRelativeToNowInS * 1000.0, nextSequence_++, output->second, message });
+		}
+		// The new message might be due before the one the thread currently waits for
+		wakeUp_.signal();
 	}
 
-	void TimedMidiSender::timerCallback()
+	void TimedMidiSender::run()
 	{
-		auto currentTime = Time::getMillisecondCounterHiRes() * 0.001 - startTime_;
-		auto currentSampleNumber = (int)(currentTime * sampleRate_);
-
-		for (auto &buffer : midiBuffer_) {
-			MidiBuffer outputEvents;
-			for (auto m : buffer.second)
+		std::vector<ScheduledMessage> due; // Reused, the messages are sent without holding the lock so adding more never waits for the device
+		while (!threadShouldExit()) {
+			double waitMs = -1.0;
 			{
-				if (m.samplePosition > currentSampleNumber)
-					break;
-
-				MidiMessage message = m.getMessage();
-				message.setTimeStamp(m.samplePosition / sampleRate_);
-				outputEvents.addEvent(message, 0);
+				ScopedLock lock(queueLock_);
+				auto now = Time::getMillisecondCounterHiRes();
+				while (!queue_.empty() && queue_.top().dueMs <= now) {
+					due.push_back(queue_.top());
+					queue_.pop();
+				}
+				if (!queue_.empty()) {
+					waitMs = queue_.top().dueMs - now;
+				}
 			}
-
-			if (!outputEvents.isEmpty()) {
-				if (midiDevices_.find(buffer.first) != midiDevices_.end()) {
-					midikraft::MidiController::instance()->getMidiOutput(midiDevices_[buffer.first])->sendBlockOfMessagesFullSpeed(outputEvents);
+			for (auto const &message : due) {
+				if (message.output && message.output->isValid()) {
+					message.output->sendMessageNow(message.message);
 				}
 				else {
 					SimpleLogger::instance()->postMessageOncePerRun("Can't send to unknown MIDI output - program error?");
 				}
 			}
-			buffer.second.clear(previousSampleNumber_, currentSampleNumber - previousSampleNumber_); 
+			if (!due.empty()) {
+				due.clear();
+				// Sending took time, so look at the queue again before waiting
+				continue;
+			}
+			if (waitMs < 0.0) {
+				wakeUp_.wait(-1);
+			}
+			else if (waitMs > kSpinThresholdMs) {
+				// Wake up a bit early and spend the rest yielding, to get below the OS timer granularity
+				wakeUp_.wait((int)(waitMs - kSpinThresholdMs));
+			}
+			else {
+				Thread::yield();
+			}
 		}
-
-		previousSampleNumber_ = currentSampleNumber;
 	}
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,177 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Tracing.h"
+
+#include <chrono>
+#include <fmt/format.h>
+
+namespace midikraft {
+
+	struct Tracing::Span {
+		char const *name = nullptr;
+		std::string detail;
+		uint32_t thread = 0;
+		int64_t startNs = 0;
+		int64_t durationNs = 0;
+		std::atomic<bool> complete{ false };
+	};
+
+	struct Tracing::Buffer {
+		explicit Buffer(size_t capacity) : spans(capacity), next(0), dropped(0), originNs(Tracing::nowNs()) {}
+
+		std::vector<Span> spans;
+		std::atomic<size_t> next;
+		std::atomic<size_t> dropped;
+		int64_t originNs; // Timestamps in the export are relative to the start of the trace
+	};
+
+	namespace {
+		std::atomic<bool> sRunning(false);
+		std::atomic<uint32_t> sNextThread(1);
+
+		std::string jsonEscaped(std::string const &text) {
+			std::string result;
+			result.reserve(text.size());
+			for (char c : text) {
+				switch (c) {
+				case '"': result += "\\\""; break;
+				case '\\': result += "\\\\"; break;
+				case '\n': result += "\\n"; break;
+				case '\r': result += "\\r"; break;
+				case '\t': result += "\\t"; break;
+				default:
+					if ((unsigned char)c < 0x20) {
+						result += fmt::format("\\u{:04x}", (int)c);
+					}
+					else {
+						result += c;
+					}
+				}
+			}
+			return result;
+		}
+	}
+
+	std::shared_ptr<Tracing::Buffer> Tracing::sBuffer_;
+
+	void Tracing::start(size_t capacity)
+	{
+		// Spans still running from before write into the old buffer, which stays alive until they are done
+		std::atomic_store(&sBuffer_, std::make_shared<Buffer>(std::max((size_t)1, capacity)));
+		sRunning = true;
+	}
+
+	void Tracing::stop()
+	{
+		sRunning = false;
+	}
+
+	bool Tracing::isRunning()
+	{
+		return sRunning;
+	}
+
+	std::shared_ptr<Tracing::Buffer> Tracing::buffer()
+	{
+		return std::atomic_load(&sBuffer_);
+	}
+
+	size_t Tracing::recordedSpans()
+	{
+		auto traceBuffer = buffer();
+		return traceBuffer ? std::min(traceBuffer->next.load(), traceBuffer->spans.size()) : 0;
+	}
+
+	size_t Tracing::droppedSpans()
+	{
+		auto traceBuffer = buffer();
+		return traceBuffer ? traceBuffer->dropped.load() : 0;
+	}
+
+	int64_t Tracing::nowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	uint32_t Tracing::currentThread()
+	{
+		thread_local uint32_t thread = sNextThread++;
+		return thread;
+	}
+
+	void Tracing::record(char const* name, std::string&& detail, int64_t startNs, int64_t endNs)
+	{
+		auto traceBuffer = buffer();
+		if (!traceBuffer) return;
+		size_t index = traceBuffer->next.fetch_add(1);
+		if (index >= traceBuffer->spans.size()) {
+			traceBuffer->dropped++;
+			return;
+		}
+		// Each slot is handed out only once, so nobody else writes to it. The flag publishes it to the export
+		auto& span = traceBuffer->spans[index];
+		span.name = name;
+		span.detail = std::move(detail);
+		span.thread = currentThread();
+		span.startNs = startNs;
+		span.durationNs = endNs - startNs;
+		span.complete.store(true, std::memory_order_release);
+	}
+
+	std::string Tracing::chromeTraceJson()
+	{
+		std::string json = "{\"traceEvents\":[";
+		auto traceBuffer = buffer();
+		if (traceBuffer) {
+			bool first = true;
+			size_t count = std::min(traceBuffer->next.load(), traceBuffer->spans.size());
+			for (size_t i = 0; i < count; i++) {
+				auto const& span = traceBuffer->spans[i];
+				if (!span.complete.load(std::memory_order_acquire)) continue;
+				// Chrome expects microseconds, fractions keep the nanoseconds
+				json += fmt::format("{}\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}", first ? "" : ",", jsonEscaped(span.name), span.thread,
+					(span.startNs - traceBuffer->originNs) / 1000.0, span.durationNs / 1000.0);
+				if (!span.detail.empty()) {
+					json += fmt::format(",\"args\":{{\"detail\":\"{}\"}}", jsonEscaped(span.detail));
+				}
+				json += "}";
+				first = false;
+			}
+		}
+		json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+		return json;
+	}
+
+	bool Tracing::writeChromeTrace(File const& file)
+	{
+		file.deleteFile();
+		FileOutputStream out(file);
+		if (!out.openedOk()) {
+			return false;
+		}
+		auto json = chromeTraceJson();
+		bool ok = out.write(json.data(), json.size());
+		out.flush();
+		return ok && out.getStatus().wasOk();
+	}
+
+	TraceSpan::TraceSpan(char const* name, std::string detail) : name_(name), startNs_(-1)
+	{
+		if (Tracing::isRunning()) {
+			detail_ = std::move(detail);
+			startNs_ = Tracing::nowNs();
+		}
+	}
+
+	TraceSpan::~TraceSpan()
+	{
+		if (startNs_ >= 0) {
+			Tracing::record(name_, std::move(detail_), startNs_, Tracing::nowNs());
+		}
+	}
+
+}
@@ -0,0 +1,105 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace midikraft {
+
+	namespace bench {
+
+		namespace {
+			volatile size_t gSink = 0;
+
+			double elapsedMs(std::function<void()> const &work) {
+				auto start = std::chrono::steady_clock::now();
+				work();
+				return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			void report(std::string const &name, size_t items, std::vector<double> runs) {
+				std::sort(runs.begin(), runs.end());
+				double median = runs[runs.size() / 2];
+				if (items > 0 && median > 0.0) {
+					printf("%-56s %10.3f ms  (min %10.3f, max %10.3f)  %12.0f items/s\n", name.c_str(), median, runs.front(), runs.back(), items / (median / 1000.0));
+				}
+				else {
+					printf("%-56s %10.3f ms  (min %10.3f, max %10.3f)\n", name.c_str(), median, runs.front(), runs.back());
+				}
+				fflush(stdout);
+			}
+		}
+
+		Suite::Suite(std::string const &name, std::function<void(Options const &)> run) : name_(name), run_(run)
+		{
+			registry().push_back(this);
+		}
+
+		std::string const & Suite::name() const
+		{
+			return name_;
+		}
+
+		void Suite::run(Options const &options) const
+		{
+			run_(options);
+		}
+
+		std::vector<Suite *> const & Suite::all()
+		{
+			auto &suites = registry();
+			std::sort(suites.begin(), suites.end(), [](Suite *a, Suite *b) { return a->name() < b->name(); });
+			return suites;
+		}
+
+		std::vector<Suite *> & Suite::registry()
+		{
+			// Function local, as the suites register from static initializers of other translation units
+			static std::vector<Suite *> suites;
+			return suites;
+		}
+
+		bool selected(Options const &options, std::string const &name)
+		{
+			return options.filter.empty() || name.find(options.filter) != std::string::npos;
+		}
+
+		double measure(Options const &options, std::string const &name, size_t items, std::function<void()> const &work)
+		{
+			if (!selected(options, name)) {
+				return -1.0;
+			}
+			work();
+			std::vector<double> runs;
+			for (int i = 0; i < std::max(1, options.repetitions); i++) {
+				runs.push_back(elapsedMs(work));
+			}
+			report(name, items, runs);
+			std::sort(runs.begin(), runs.end());
+			return runs[runs.size() / 2];
+		}
+
+		double measureOnce(Options const &options, std::string const &name, size_t items, std::function<void()> const &work)
+		{
+			if (!selected(options, name)) {
+				return -1.0;
+			}
+			double ms = elapsedMs(work);
+			report(name, items, { ms });
+			return ms;
+		}
+
+		void consume(size_t value)
+		{
+			gSink = gSink + value;
+		}
+
+	}
+
+}
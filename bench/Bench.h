@@ -0,0 +1,59 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal timing harness for midikraft_bench. Deliberately free of JUCE, so suites that only need plain C++ (e.g. the selection kernels)
+// can also be built and run on their own
+namespace midikraft {
+
+	namespace bench {
+
+		struct Options {
+			std::vector<size_t> sizes = { 1000, 10000, 100000 }; // Number of patches in the libraries the database suites create
+			size_t scaleSize = 1000000; // Number of patches for the scale suites, which take a few minutes at the default
+			std::string filter; // Only cases whose "suite/case" name contains this are run
+			int repetitions = 5; // Timed runs after one warm up run
+			std::string workDirectory; // Database files are created here, empty for the system's temp directory
+		};
+
+		// A suite registers itself with a static instance, main() runs all registered suites in the order of their names
+		class Suite {
+		public:
+			Suite(std::string const &name, std::function<void(Options const &)> run);
+
+			std::string const &name() const;
+			void run(Options const &options) const;
+
+			static std::vector<Suite *> const &all();
+
+		private:
+			static std::vector<Suite *> &registry();
+
+			std::string name_;
+			std::function<void(Options const &)> run_;
+		};
+
+		// True if the case matches the --filter given on the command line
+		bool selected(Options const &options, std::string const &name);
+
+		// Runs work once to warm up, then options.repetitions times, and prints the fastest, median and slowest run. items is used to print a rate,
+		// pass 0 if there is no meaningful unit. Returns the median in milliseconds, or a negative number if the case was not selected
+		double measure(Options const &options, std::string const &name, size_t items, std::function<void()> const &work);
+		// For work that can only be done once, e.g. filling an empty database
+		double measureOnce(Options const &options, std::string const &name, size_t items, std::function<void()> const &work);
+
+		// Keeps the compiler from dropping the computation of a result that is otherwise unused
+		void consume(size_t value);
+
+	}
+
+}
@@ -0,0 +1,77 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+	void usage()
+	{
+		printf("Usage: midikraft_bench [--filter text] [--sizes 1000,10000,...] [--scale n] [--repetitions n] [--dir path] [--list]\n");
+		printf("Runs the benchmarks of all suites whose \"suite/case\" name contains the filter text\n");
+	}
+
+	std::vector<size_t> parseSizes(std::string const &text)
+	{
+		std::vector<size_t> result;
+		std::stringstream stream(text);
+		std::string item;
+		while (std::getline(stream, item, ',')) {
+			auto value = std::strtoull(item.c_str(), nullptr, 10);
+			if (value > 0) {
+				result.push_back((size_t) value);
+			}
+		}
+		return result;
+	}
+
+}
+
+int main(int argc, char *argv[])
+{
+	midikraft::bench::Options options;
+	bool listOnly = false;
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--filter") && hasValue) {
+			options.filter = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--sizes") && hasValue) {
+			options.sizes = parseSizes(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--scale") && hasValue) {
+			options.scaleSize = (size_t) std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--repetitions") && hasValue) {
+			options.repetitions = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--dir") && hasValue) {
+			options.workDirectory = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--list")) {
+			listOnly = true;
+		}
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	for (auto suite : midikraft::bench::Suite::all()) {
+		if (listOnly) {
+			printf("%s\n", suite->name().c_str());
+			continue;
+		}
+		printf("== %s\n", suite->name().c_str());
+		suite->run(options);
+	}
+	return 0;
+}
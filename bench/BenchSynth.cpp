@@ -0,0 +1,269 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "BenchSynth.h"
+
+#include <fmt/format.h>
+
+namespace midikraft {
+
+	namespace bench {
+
+		namespace {
+			const uint8 kManufacturerNonCommercial = 0x7d;
+			const uint8 kProgramDump = 0x01;
+			const uint8 kEditBufferDump = 0x02;
+			const uint8 kBankDump = 0x03;
+			const uint8 kRequestProgram = 0x10;
+			const uint8 kRequestEditBuffer = 0x11;
+			const uint8 kStoreEditBuffer = 0x12;
+
+			// splitmix64, good enough to make patches that differ in most bytes
+			uint64 mix(uint64 x) {
+				x += 0x9e3779b97f4a7c15ULL;
+				x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+				return x ^ (x >> 31);
+			}
+
+			const char *kNameWords[] = { "Brass", "Pad", "Lead", "Bass", "Strings", "Bell", "Organ", "Pluck", "Sweep", "Choir", "Keys", "Drone", "Poly", "Sync", "Wobble", "Glass" };
+
+			class BenchPatch : public Patch {
+			public:
+				BenchPatch(Synth::PatchData const &data, MidiProgramNumber place) : Patch(0, data), place_(place) {}
+
+				MidiProgramNumber patchNumber() const override {
+					return place_;
+				}
+
+			private:
+				MidiProgramNumber place_;
+			};
+		}
+
+		BenchSynth::BenchSynth(std::string const &name, uint8 model) : name_(name), model_(model)
+		{
+		}
+
+		Synth::PatchData BenchSynth::patchData(uint64 seed)
+		{
+			Synth::PatchData result(kPatchSize);
+			uint64 state = seed;
+			for (size_t i = 0; i < kPatchSize; i += 8) {
+				state = mix(state);
+				for (size_t b = 0; b < 8 && i + b < kPatchSize; b++) {
+					result[i + b] = (uint8) ((state >> (b * 8)) & 0x7f);
+				}
+			}
+			return result;
+		}
+
+		std::vector<MidiMessage> BenchSynth::programDump(int program, Synth::PatchData const &data) const
+		{
+			std::vector<uint8> body = { kManufacturerNonCommercial, model_, kProgramDump, (uint8) (program & 0x7f) };
+			body.insert(body.end(), data.begin(), data.end());
+			return { sysex(body) };
+		}
+
+		std::vector<MidiMessage> BenchSynth::editBufferDump(Synth::PatchData const &data) const
+		{
+			std::vector<uint8> body = { kManufacturerNonCommercial, model_, kEditBufferDump };
+			body.insert(body.end(), data.begin(), data.end());
+			return { sysex(body) };
+		}
+
+		std::vector<MidiMessage> BenchSynth::bankDump(int bank, uint64 firstSeed) const
+		{
+			std::vector<uint8> body = { kManufacturerNonCommercial, model_, kBankDump, (uint8) (bank & 0x7f) };
+			body.reserve(body.size() + kBankSize * kPatchSize);
+			for (int i = 0; i < kBankSize; i++) {
+				auto data = patchData(firstSeed + (uint64) i);
+				body.insert(body.end(), data.begin(), data.end());
+			}
+			return { sysex(body) };
+		}
+
+		std::string BenchSynth::getName() const
+		{
+			return name_;
+		}
+
+		std::shared_ptr<DataFile> BenchSynth::patchFromPatchData(const Synth::PatchData &data, MidiProgramNumber place) const
+		{
+			return std::make_shared<BenchPatch>(data, place);
+		}
+
+		bool BenchSynth::isOwnSysex(MidiMessage const &message) const
+		{
+			return message.isSysEx() && message.getSysExDataSize() > 2 && message.getSysExData()[0] == kManufacturerNonCommercial && message.getSysExData()[1] == model_;
+		}
+
+		std::vector<std::vector<uint8>> BenchSynth::sysexHeaderPrefixes() const
+		{
+			return { { kManufacturerNonCommercial, model_ } };
+		}
+
+		std::vector<MidiMessage> BenchSynth::requestPatch(int patchNo) const
+		{
+			return { sysex({ kManufacturerNonCommercial, model_, kRequestProgram, (uint8) (patchNo & 0x7f) }) };
+		}
+
+		bool BenchSynth::isSingleProgramDump(const std::vector<MidiMessage>& messages) const
+		{
+			return messages.size() == 1 && isCommand(messages[0], kProgramDump, kPatchSize + 1);
+		}
+
+		MidiProgramNumber BenchSynth::getProgramNumber(const std::vector<MidiMessage> &messages) const
+		{
+			if (isSingleProgramDump(messages)) {
+				return MidiProgramNumber::fromZeroBase(messages[0].getSysExData()[3]);
+			}
+			return MidiProgramNumber::invalidProgram();
+		}
+
+		std::shared_ptr<DataFile> BenchSynth::patchFromProgramDumpSysex(const std::vector<MidiMessage>& messages) const
+		{
+			if (!isSingleProgramDump(messages)) {
+				return nullptr;
+			}
+			auto payload = messages[0].getSysExData() + 4;
+			return patchFromPatchData(Synth::PatchData(payload, payload + kPatchSize), getProgramNumber(messages));
+		}
+
+		std::vector<MidiMessage> BenchSynth::patchToProgramDumpSysex(std::shared_ptr<DataFile> patch, MidiProgramNumber programNumber) const
+		{
+			return programDump(programNumber.toZeroBasedDiscardingBank(), patch->data());
+		}
+
+		std::vector<MidiMessage> BenchSynth::requestEditBufferDump() const
+		{
+			return { sysex({ kManufacturerNonCommercial, model_, kRequestEditBuffer }) };
+		}
+
+		bool BenchSynth::isEditBufferDump(const std::vector<MidiMessage> &messages) const
+		{
+			return messages.size() == 1 && isCommand(messages[0], kEditBufferDump, kPatchSize);
+		}
+
+		std::shared_ptr<DataFile> BenchSynth::patchFromSysex(const std::vector<MidiMessage>& messages) const
+		{
+			if (!isEditBufferDump(messages)) {
+				return nullptr;
+			}
+			auto payload = messages[0].getSysExData() + 3;
+			return patchFromPatchData(Synth::PatchData(payload, payload + kPatchSize), MidiProgramNumber::invalidProgram());
+		}
+
+		std::vector<MidiMessage> BenchSynth::patchToSysex(std::shared_ptr<DataFile> patch) const
+		{
+			return editBufferDump(patch->data());
+		}
+
+		MidiMessage BenchSynth::saveEditBufferToProgram(int programNumber)
+		{
+			return sysex({ kManufacturerNonCommercial, model_, kStoreEditBuffer, (uint8) (programNumber & 0x7f) });
+		}
+
+		bool BenchSynth::isBankDump(const MidiMessage& message) const
+		{
+			return isCommand(message, kBankDump, 1 + kBankSize * kPatchSize);
+		}
+
+		bool BenchSynth::isBankDumpFinished(std::vector<MidiMessage> const &bankDump) const
+		{
+			return bankDump.size() == 1 && isBankDump(bankDump[0]);
+		}
+
+		TPatchVector BenchSynth::patchesFromSysexBank(std::vector<MidiMessage> const& messages) const
+		{
+			TPatchVector result;
+			for (auto const &message : messages) {
+				if (!isBankDump(message)) {
+					continue;
+				}
+				auto bank = MidiBankNumber::fromZeroBase(message.getSysExData()[3], kBankSize);
+				auto payload = message.getSysExData() + 4;
+				for (int i = 0; i < kBankSize; i++) {
+					auto start = payload + i * kPatchSize;
+					result.push_back(patchFromPatchData(Synth::PatchData(start, start + kPatchSize), MidiProgramNumber::fromZeroBaseWithBank(bank, i)));
+				}
+			}
+			return result;
+		}
+
+		bool BenchSynth::isCommand(MidiMessage const &message, uint8 command, size_t payloadSize) const
+		{
+			return isOwnSysex(message) && message.getSysExDataSize() == (int) (3 + payloadSize) && message.getSysExData()[2] == command;
+		}
+
+		MidiMessage BenchSynth::sysex(std::vector<uint8> const &body) const
+		{
+			return MidiMessage::createSysExMessage(body.data(), (int) body.size());
+		}
+
+		std::vector<PatchHolder> syntheticLibrary(std::shared_ptr<BenchSynth> synth, std::vector<Category> const &categories, size_t count, uint64 firstSeed)
+		{
+			std::vector<PatchHolder> result;
+			result.reserve(count);
+			const size_t kWords = sizeof(kNameWords) / sizeof(kNameWords[0]);
+			for (size_t i = 0; i < count; i++) {
+				uint64 seed = firstSeed + i;
+				uint64 r = mix(seed ^ 0x5eed);
+				int program = (int) (seed % BenchSynth::kBankSize);
+				auto bank = MidiBankNumber::fromZeroBase((int) ((seed / BenchSynth::kBankSize) % 8), BenchSynth::kBankSize);
+				// A few hundred imports, as if the library had been built from many files
+				auto filename = fmt::format("bench_{}.syx", seed / 1000);
+				auto source = std::make_shared<FromFileSource>(filename, "/bench/" + filename, MidiProgramNumber::fromZeroBase(program));
+				auto patch = synth->patchFromPatchData(BenchSynth::patchData(seed), MidiProgramNumber::fromZeroBaseWithBank(bank, program));
+				PatchHolder holder(synth, source, patch);
+				holder.setName(fmt::format("{} {} {}", kNameWords[r % kWords], kNameWords[(r >> 8) % kWords], seed));
+				holder.setBank(bank);
+				holder.setPatchNumber(MidiProgramNumber::fromZeroBaseWithBank(bank, program));
+				if (r % 7 == 0) {
+					holder.setFavorite(Favorite(true));
+				}
+				holder.setHidden(r % 13 == 0);
+				if (!categories.empty()) {
+					holder.setCategory(categories[(r >> 16) % categories.size()], true);
+					if ((r >> 24) % 3 == 0) {
+						holder.setCategory(categories[(r >> 32) % categories.size()], true);
+					}
+				}
+				result.push_back(holder);
+			}
+			return result;
+		}
+
+		std::vector<Category> defaultCategories()
+		{
+			std::vector<Category> result;
+			std::vector<std::string> names = { "Lead", "Pad", "Brass", "Organ", "Keys", "Bass", "Arp", "Pluck", "Drone", "Drum", "Bell", "SFX", "Ambient", "Wind", "Voice" };
+			for (int i = 0; i < (int) names.size(); i++) {
+				result.emplace_back(std::make_shared<CategoryDefinition>(CategoryDefinition{ i, true, names[(size_t) i], Colours::grey }));
+			}
+			return result;
+		}
+
+		std::string temporaryFile(Options const &options, std::string const &filename)
+		{
+			File directory = options.workDirectory.empty() ? File::getSpecialLocation(File::tempDirectory) : File(options.workDirectory);
+			directory.createDirectory();
+			auto file = directory.getChildFile(String(filename));
+			file.deleteFile();
+			return file.getFullPathName().toStdString();
+		}
+
+		std::string temporaryDatabaseFile(Options const &options, std::string const &name)
+		{
+			// WAL and shared memory files of an earlier run would be applied to the fresh file otherwise
+			temporaryFile(options, name + ".db3-wal");
+			temporaryFile(options, name + ".db3-shm");
+			return temporaryFile(options, name + ".db3");
+		}
+
+	}
+
+}
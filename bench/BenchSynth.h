@@ -0,0 +1,86 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Bench.h"
+
+#include "Synth.h"
+#include "Patch.h"
+#include "ProgramDumpCapability.h"
+#include "EditBufferCapability.h"
+#include "BankDumpCapability.h"
+#include "PatchHolder.h"
+
+namespace midikraft {
+
+	namespace bench {
+
+		// Made up synth for the benchmarks, nothing is ever sent to a MIDI output. Uses the non-commercial manufacturer ID 7D followed by a model byte,
+		// so several of them can be told apart:
+		//   F0 7D <model> 01 <program> <data> F7      program dump
+		//   F0 7D <model> 02 <data> F7                edit buffer dump
+		//   F0 7D <model> 03 <bank> <data>... F7      bank dump of kBankSize patches
+		class BenchSynth : public Synth, public ProgramDumpCabability, public EditBufferCapability, public BankDumpCapability {
+		public:
+			static const size_t kPatchSize = 128;
+			static const int kBankSize = 128;
+
+			BenchSynth(std::string const &name, uint8 model);
+
+			// Deterministic patch data, different for each seed
+			static Synth::PatchData patchData(uint64 seed);
+			std::vector<MidiMessage> programDump(int program, Synth::PatchData const &data) const;
+			std::vector<MidiMessage> editBufferDump(Synth::PatchData const &data) const;
+			std::vector<MidiMessage> bankDump(int bank, uint64 firstSeed) const;
+
+			// Synth
+			std::string getName() const override;
+			std::shared_ptr<DataFile> patchFromPatchData(const Synth::PatchData &data, MidiProgramNumber place) const override;
+			bool isOwnSysex(MidiMessage const &message) const override;
+			std::vector<std::vector<uint8>> sysexHeaderPrefixes() const override;
+
+			// ProgramDumpCabability
+			std::vector<MidiMessage> requestPatch(int patchNo) const override;
+			bool isSingleProgramDump(const std::vector<MidiMessage>& messages) const override;
+			MidiProgramNumber getProgramNumber(const std::vector<MidiMessage> &messages) const override;
+			std::shared_ptr<DataFile> patchFromProgramDumpSysex(const std::vector<MidiMessage>& messages) const override;
+			std::vector<MidiMessage> patchToProgramDumpSysex(std::shared_ptr<DataFile> patch, MidiProgramNumber programNumber) const override;
+
+			// EditBufferCapability
+			std::vector<MidiMessage> requestEditBufferDump() const override;
+			bool isEditBufferDump(const std::vector<MidiMessage> &messages) const override;
+			std::shared_ptr<DataFile> patchFromSysex(const std::vector<MidiMessage>& messages) const override;
+			std::vector<MidiMessage> patchToSysex(std::shared_ptr<DataFile> patch) const override;
+			MidiMessage saveEditBufferToProgram(int programNumber) override;
+
+			// BankDumpCapability
+			bool isBankDump(const MidiMessage& message) const override;
+			bool isBankDumpFinished(std::vector<MidiMessage> const &bankDump) const override;
+			TPatchVector patchesFromSysexBank(std::vector<MidiMessage> const& messages) const override;
+
+		private:
+			bool isCommand(MidiMessage const &message, uint8 command, size_t payloadSize) const;
+			MidiMessage sysex(std::vector<uint8> const &body) const;
+
+			std::string name_;
+			uint8 model_;
+		};
+
+		// A library of count patches of the synth with varied names, favorites, hidden flags, categories, imports and bank places,
+		// the patch data made from the seeds firstSeed to firstSeed + count - 1
+		std::vector<PatchHolder> syntheticLibrary(std::shared_ptr<BenchSynth> synth, std::vector<Category> const &categories, size_t count, uint64 firstSeed = 0);
+
+		// The default categories of a new database, for benchmarks that run without one
+		std::vector<Category> defaultCategories();
+
+		// A fresh file name in the work directory, any existing file of that name is removed first
+		std::string temporaryFile(Options const &options, std::string const &filename);
+		std::string temporaryDatabaseFile(Options const &options, std::string const &name);
+
+	}
+
+}
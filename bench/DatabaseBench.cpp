@@ -0,0 +1,180 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Bench.h"
+#include "BenchSynth.h"
+
+#include "PatchDatabase.h"
+#include "PatchList.h"
+
+#include <fmt/format.h>
+
+namespace midikraft {
+
+	namespace bench {
+
+		namespace {
+
+			void runDatabaseSuite(Options const &options, size_t size)
+			{
+				auto synth = std::make_shared<BenchSynth>("Bench Synth", 0x01);
+				std::vector<std::shared_ptr<Synth>> synths = { synth };
+				PatchDatabase db(temporaryDatabaseFile(options, fmt::format("midikraft_bench_{}", size)), PatchDatabase::OpenMode::READ_WRITE_NO_BACKUPS);
+				auto categories = db.getCategories();
+				auto library = syntheticLibrary(synth, categories, size);
+				auto label = [size](std::string const &name) { return fmt::format("database/{} {}", name, size); };
+
+				// The merge modifies the vector passed in, so each merge gets its own copy
+				std::vector<PatchHolder> newPatches;
+				auto toInsert = library;
+				measureOnce(options, label("merge new"), size, [&]() {
+					db.mergePatchesIntoDatabase(toInsert, newPatches, nullptr, PatchDatabase::UPDATE_ALL);
+				});
+				// Everything is known now, so this is the update path of a re-import
+				auto toUpdate = library;
+				measureOnce(options, label("merge existing"), size, [&]() {
+					db.mergePatchesIntoDatabase(toUpdate, newPatches, nullptr, PatchDatabase::UPDATE_NAME | PatchDatabase::UPDATE_CATEGORIES);
+				});
+
+				PatchFilter all(synths);
+				PatchFilter favorites(synths);
+				favorites.onlyFaves = true;
+				PatchFilter category(synths);
+				if (!categories.empty()) {
+					category.categories.insert(categories[0]);
+				}
+				PatchFilter byName(synths);
+				byName.name = "Pad";
+				PatchFilter byImport(synths);
+				auto imports = db.getImportsList(synth.get());
+				if (!imports.empty()) {
+					byImport.importID = imports.front().id;
+				}
+				std::vector<std::pair<std::string, PatchFilter>> filters = { { "all", all }, { "favorites", favorites }, { "category", category }, { "name", byName }, { "import", byImport } };
+
+				// The result cache would answer every repetition after the first, measure the queries themselves
+				db.setQueryResultCacheSize(0);
+				for (bool useIndex : { true, false }) {
+					db.setMetadataIndexEnabled(useIndex);
+					for (auto const &filter : filters) {
+						measure(options, label(fmt::format("count {}{}", filter.first, useIndex ? "" : " (SQL)")), 0, [&]() {
+							consume((size_t) db.getPatchesCount(filter.second));
+						});
+					}
+				}
+				db.setMetadataIndexEnabled(true);
+
+				PatchFilter byNameOrder(synths);
+				byNameOrder.orderBy = PatchOrdering::Order_by_Name;
+				measure(options, label("first page of 100"), 100, [&]() {
+					consume(db.getPatches(byNameOrder, 0, 100).size());
+				});
+				measure(options, label("middle page of 100 by offset"), 100, [&]() {
+					consume(db.getPatches(byNameOrder, (int) size / 2, 100).size());
+				});
+				measure(options, label("summaries page of 100"), 100, [&]() {
+					consume(db.getPatchSummaries(byNameOrder, (int) size / 2, 100).size());
+				});
+				measure(options, label("page with total"), 100, [&]() {
+					int total = 0;
+					consume(db.getPatches(byNameOrder, 0, 100, total).size() + (size_t) total);
+				});
+				std::vector<std::pair<std::string, PatchOrdering>> orderings = { { "unordered", PatchOrdering::No_ordering }, { "name", PatchOrdering::Order_by_Name },
+					{ "import", PatchOrdering::Order_by_Import_id }, { "program", PatchOrdering::Order_by_ProgramNo }, { "bank", PatchOrdering::Order_by_BankNo } };
+				for (auto const &ordering : orderings) {
+					PatchFilter ordered(favorites);
+					ordered.orderBy = ordering.second;
+					measure(options, label(fmt::format("favorites page of 100 by {}", ordering.first)), 100, [&]() {
+						consume(db.getPatches(ordered, (int) size / 20, 100).size());
+					});
+				}
+				measure(options, label("keyset paging through all"), size, [&]() {
+					PatchPageToken token;
+					while (!token.atEnd) {
+						PatchPageToken next;
+						consume(db.getPatches(byNameOrder, token, 500, next).size());
+						token = next;
+					}
+				});
+
+				auto list = std::make_shared<PatchList>("midikraft_bench_list", "Bench list");
+				list->setPatches(std::vector<PatchHolder>(library.begin(), library.begin() + (ptrdiff_t) std::min<size_t>(1000, size)));
+				ListInfo info{ list->id(), list->name() };
+				std::map<std::string, std::weak_ptr<Synth>> synthMap = { { synth->getName(), synth } };
+				measure(options, label(fmt::format("put list of {}", list->patches().size())), list->patches().size(), [&]() {
+					db.putPatchList(list);
+				});
+				measure(options, label("load list"), list->patches().size(), [&]() {
+					auto loaded = db.getPatchList(info, synthMap);
+					consume(loaded ? loaded->patches().size() : 0);
+				});
+				measure(options, label("add and remove patch in list"), 0, [&]() {
+					db.addPatchToList(info, library.back(), 0);
+					db.removePatchFromList(info.id, synth->getName(), library.back().md5(), 0);
+				});
+				PatchFilter inList(synths);
+				inList.listID = info.id;
+				inList.orderBy = PatchOrdering::Order_by_Place_in_List;
+				measure(options, label("list page of 100 by place"), 100, [&]() {
+					consume(db.getPatches(inList, 0, 100).size());
+				});
+
+				db.setQueryResultCacheSize(32);
+				db.getPatchesCount(favorites);
+				measure(options, label("count favorites (cached)"), 0, [&]() {
+					consume((size_t) db.getPatchesCount(favorites));
+				});
+
+				int flip = 0;
+				measure(options, label("bulk favorite on filter"), 0, [&]() {
+					consume((size_t) db.bulkUpdate(category, PatchDatabase::UPDATE_FAVORITE, (flip++ % 2) ? 1 : 0));
+				});
+				if (categories.size() > 1) {
+					measure(options, label("bulk category on filter"), 0, [&]() {
+						consume((size_t) db.bulkUpdateCategory(byName, categories[1], flip++ % 2 == 0));
+					});
+				}
+				std::vector<CategoryDefinition> definitions;
+				for (auto const &c : categories) {
+					definitions.push_back(*c.def());
+				}
+				measure(options, label("update category definitions"), 0, [&]() {
+					db.updateCategories(definitions);
+				});
+				size_t edits = std::min<size_t>(1000, library.size());
+				measure(options, label("deferred edits flushed"), edits, [&]() {
+					for (size_t i = 0; i < edits; i++) {
+						auto patch = library[i];
+						patch.setHidden((flip + i) % 2 == 0);
+						db.putPatchDeferred(patch, PatchDatabase::UPDATE_HIDDEN);
+					}
+					db.flushPendingWrites();
+					flip++;
+				});
+
+				measureOnce(options, label("reindex all"), size, [&]() {
+					consume((size_t) db.reindexPatches(all));
+				});
+				measureOnce(options, label("similarity index build"), size, [&]() {
+					consume(db.findSimilarPatches(library.front(), 10).size());
+				});
+				measure(options, label("similar patches"), 0, [&]() {
+					consume(db.findSimilarPatches(library[library.size() / 2], 10).size());
+				});
+			}
+
+			Suite databaseSuite("database", [](Options const &options) {
+				ScopedJuceInitialiser_GUI juceRuntime;
+				for (auto size : options.sizes) {
+					runDatabaseSuite(options, size);
+				}
+			});
+
+		}
+
+	}
+
+}
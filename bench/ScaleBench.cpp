@@ -0,0 +1,105 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Bench.h"
+#include "BenchSynth.h"
+
+#include "PatchDatabase.h"
+
+#include <fmt/format.h>
+
+namespace midikraft {
+
+	namespace bench {
+
+		namespace {
+
+			const size_t kChunkSize = 100000; // Patches generated and merged at a time, so the whole library is never in memory
+
+			void runScale(Options const &options, size_t size)
+			{
+				auto synth = std::make_shared<BenchSynth>("Bench Synth", 0x01);
+				std::vector<std::shared_ptr<Synth>> synths = { synth };
+				PatchDatabase db(temporaryDatabaseFile(options, "midikraft_bench_scale"), PatchDatabase::OpenMode::READ_WRITE_NO_BACKUPS);
+				auto categories = db.getCategories();
+				auto label = [size](std::string const &name) { return fmt::format("scale/{} {}", name, size); };
+
+				measureOnce(options, label("insert"), size, [&]() {
+					for (size_t first = 0; first < size; first += kChunkSize) {
+						auto chunk = syntheticLibrary(synth, categories, std::min(kChunkSize, size - first), first);
+						std::vector<PatchHolder> newPatches;
+						db.mergePatchesIntoDatabase(chunk, newPatches, nullptr, PatchDatabase::UPDATE_ALL);
+					}
+				});
+
+				PatchFilter all(synths);
+				PatchFilter favorites(synths);
+				favorites.onlyFaves = true;
+				PatchFilter anyCategory(synths);
+				PatchFilter allCategories(synths);
+				if (categories.size() > 1) {
+					anyCategory.categories = { categories[0], categories[1] };
+					allCategories.categories = anyCategory.categories;
+					allCategories.andCategories = true;
+				}
+				PatchFilter untagged(synths);
+				untagged.onlyUntagged = true;
+				PatchFilter visible(synths);
+				visible.showHidden = false;
+				PatchFilter combined(anyCategory);
+				combined.onlyFaves = true;
+				combined.showHidden = false;
+				std::vector<std::pair<std::string, PatchFilter>> filters = { { "all", all }, { "favorites", favorites }, { "any of two categories", anyCategory },
+					{ "both categories", allCategories }, { "untagged", untagged }, { "not hidden", visible }, { "favorite visible category", combined } };
+
+				// Measure the queries, not the result cache. With the metadata index the flag and category filters run through the selection kernels
+				db.setQueryResultCacheSize(0);
+				measureOnce(options, label("metadata index build"), size, [&]() {
+					consume((size_t) db.getPatchesCount(favorites));
+				});
+				for (bool useIndex : { true, false }) {
+					db.setMetadataIndexEnabled(useIndex);
+					for (auto const &filter : filters) {
+						measure(options, label(fmt::format("count {}{}", filter.first, useIndex ? "" : " (SQL)")), 0, [&]() {
+							consume((size_t) db.getPatchesCount(filter.second));
+						});
+					}
+					PatchFilter page(combined);
+					page.orderBy = PatchOrdering::Order_by_Name;
+					measure(options, label(fmt::format("first page of 100 favorite visible category by name{}", useIndex ? "" : " (SQL)")), 100, [&]() {
+						consume(db.getPatches(page, 0, 100).size());
+					});
+				}
+				db.setMetadataIndexEnabled(true);
+
+				PatchFilter byName(synths);
+				byName.orderBy = PatchOrdering::Order_by_Name;
+				measure(options, label("page of 100 in the middle by name via offset"), 100, [&]() {
+					consume(db.getPatches(byName, (int) size / 2, 100).size());
+				});
+				// Walk to the middle once, then time only the page after it, which is what scrolling does
+				PatchPageToken middle;
+				for (size_t skipped = 0; skipped < size / 2 && !middle.atEnd; skipped += 10000) {
+					PatchPageToken next;
+					db.getPatches(byName, middle, 10000, next);
+					middle = next;
+				}
+				measure(options, label("page of 100 in the middle by name via keyset"), 100, [&]() {
+					PatchPageToken next;
+					consume(db.getPatches(byName, middle, 100, next).size());
+				});
+			}
+
+			Suite scaleSuite("scale", [](Options const &options) {
+				ScopedJuceInitialiser_GUI juceRuntime;
+				runScale(options, options.scaleSize);
+			});
+
+		}
+
+	}
+
+}
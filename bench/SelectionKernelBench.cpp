@@ -0,0 +1,104 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Bench.h"
+
+#include "SelectionBitmap.h"
+
+#include <string>
+
+// Only needs the database's SelectionBitmap.cpp, no JUCE, so this suite can also be compiled on its own with Bench.cpp and BenchMain.cpp
+namespace midikraft {
+
+	namespace bench {
+
+		namespace {
+
+			struct Columns {
+				std::vector<int32_t> type;
+				std::vector<uint64_t> categories;
+				std::vector<uint8_t> flags; // Favorite and hidden state, as in PatchMetadataIndex
+			};
+
+			Columns makeColumns(size_t rows)
+			{
+				Columns result;
+				result.type.resize(rows);
+				result.categories.resize(rows);
+				result.flags.resize(rows);
+				uint64_t state = 0x2545f4914f6cdd1dULL;
+				for (size_t i = 0; i < rows; i++) {
+					// xorshift64
+					state ^= state << 13;
+					state ^= state >> 7;
+					state ^= state << 17;
+					result.type[i] = (int32_t) (state % 4);
+					result.categories[i] = (state >> 8) & ((1ULL << 15) - 1) & (state >> 24);
+					result.flags[i] = (uint8_t) ((state >> 40) % 9);
+				}
+				return result;
+			}
+
+			// The row by row evaluation the kernels replace, as a baseline
+			void keepRowByRow(SelectionBitmap &selection, Columns const &columns, int32_t type, uint64_t category, uint16_t acceptedFlags)
+			{
+				for (size_t row = 0; row < selection.size(); row++) {
+					if (columns.type[row] != type || (columns.categories[row] & category) == 0 || ((acceptedFlags >> columns.flags[row]) & 1) == 0) {
+						selection.reset(row);
+					}
+				}
+			}
+
+			void runKernels(Options const &options, size_t rows)
+			{
+				auto columns = makeColumns(rows);
+				std::string suffix = std::to_string(rows) + " rows (" + SelectionKernels::implementation() + ")";
+				const uint64_t kCategory = 1ULL << 3;
+				const uint16_t kAccepted = 0x0155;
+
+				measure(options, "kernels/keepEqual " + suffix, rows, [&]() {
+					SelectionBitmap selection(rows, true);
+					SelectionKernels::keepEqual(selection, columns.type.data(), 1);
+					consume(selection.count());
+				});
+				measure(options, "kernels/keepMasked any " + suffix, rows, [&]() {
+					SelectionBitmap selection(rows, true);
+					SelectionKernels::keepMasked(selection, columns.categories.data(), kCategory, 0, true);
+					consume(selection.count());
+				});
+				measure(options, "kernels/keepMasked all " + suffix, rows, [&]() {
+					SelectionBitmap selection(rows, true);
+					SelectionKernels::keepMasked(selection, columns.categories.data(), 0x0f, 0x0f, false);
+					consume(selection.count());
+				});
+				measure(options, "kernels/keepAcceptedFlags " + suffix, rows, [&]() {
+					SelectionBitmap selection(rows, true);
+					SelectionKernels::keepAcceptedFlags(selection, columns.flags.data(), kAccepted);
+					consume(selection.count());
+				});
+				measure(options, "kernels/type, category and flags " + suffix, rows, [&]() {
+					SelectionBitmap selection(rows, true);
+					SelectionKernels::keepEqual(selection, columns.type.data(), 1);
+					SelectionKernels::keepMasked(selection, columns.categories.data(), kCategory, 0, true);
+					SelectionKernels::keepAcceptedFlags(selection, columns.flags.data(), kAccepted);
+					consume(selection.count());
+				});
+				measure(options, "kernels/type, category and flags row by row " + std::to_string(rows) + " rows", rows, [&]() {
+					SelectionBitmap selection(rows, true);
+					keepRowByRow(selection, columns, 1, kCategory, kAccepted);
+					consume(selection.count());
+				});
+			}
+
+			Suite kernelSuite("kernels", [](Options const &options) {
+				runKernels(options, options.scaleSize);
+			});
+
+		}
+
+	}
+
+}
@@ -0,0 +1,167 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "Bench.h"
+#include "BenchSynth.h"
+
+#include "MidiController.h"
+#include "AutomaticCategory.h"
+#include "PatchInterchangeFormat.h"
+#include "CategoryBitfield.h"
+
+#include <fmt/format.h>
+
+namespace midikraft {
+
+	namespace bench {
+
+		namespace {
+
+			const int kBanks = 8;
+			const size_t kLibrarySize = 10000;
+
+			void benchLoadSysex(Options const &options, std::shared_ptr<BenchSynth> synth)
+			{
+				std::vector<MidiMessage> programDumps, editBuffers, bankDumps;
+				for (int bank = 0; bank < kBanks; bank++) {
+					for (int program = 0; program < BenchSynth::kBankSize; program++) {
+						auto data = BenchSynth::patchData((uint64) (bank * BenchSynth::kBankSize + program));
+						auto dump = synth->programDump(program, data);
+						programDumps.insert(programDumps.end(), dump.begin(), dump.end());
+						auto editBuffer = synth->editBufferDump(data);
+						editBuffers.insert(editBuffers.end(), editBuffer.begin(), editBuffer.end());
+					}
+					auto bankDump = synth->bankDump(bank, (uint64) (bank * BenchSynth::kBankSize));
+					bankDumps.insert(bankDumps.end(), bankDump.begin(), bankDump.end());
+				}
+				size_t patches = (size_t) (kBanks * BenchSynth::kBankSize);
+				measure(options, fmt::format("sysex/loadSysex {} program dumps", programDumps.size()), patches, [&]() {
+					consume(synth->loadSysex(programDumps).size());
+				});
+				measure(options, fmt::format("sysex/loadSysex {} edit buffers", editBuffers.size()), patches, [&]() {
+					consume(synth->loadSysex(editBuffers).size());
+				});
+				measure(options, fmt::format("sysex/loadSysex {} bank dumps", bankDumps.size()), patches, [&]() {
+					consume(synth->loadSysex(bankDumps).size());
+				});
+				// Not own sysex of this synth mixed in, as in a file recorded from a busy MIDI network
+				auto other = std::make_shared<BenchSynth>("Other Synth", 0x02);
+				std::vector<MidiMessage> mixed;
+				for (size_t i = 0; i < programDumps.size(); i++) {
+					mixed.push_back(programDumps[i]);
+					auto foreign = other->programDump((int) (i % BenchSynth::kBankSize), BenchSynth::patchData(i + 100000));
+					mixed.insert(mixed.end(), foreign.begin(), foreign.end());
+				}
+				measure(options, fmt::format("sysex/loadSysex {} mixed messages", mixed.size()), patches, [&]() {
+					consume(synth->loadSysex(mixed).size());
+				});
+			}
+
+			void benchDispatch(Options const &options, std::shared_ptr<BenchSynth> synth)
+			{
+				auto controller = MidiController::instance();
+				std::vector<MidiMessage> messages;
+				auto sysex = synth->programDump(0, BenchSynth::patchData(0));
+				for (int i = 0; i < 1000; i++) {
+					messages.push_back(MidiMessage::noteOn(1, i % 128, (uint8) 100));
+					messages.push_back(MidiMessage::controllerEvent(1, 74, i % 128));
+					messages.push_back(MidiMessage::midiClock());
+					messages.push_back(sysex[0]);
+				}
+				for (int handlerCount : { 1, 16, 128 }) {
+					// Like a running application: most handlers only want the sysex of their own synth, some see everything but realtime
+					size_t called = 0;
+					std::vector<MidiController::HandlerHandle> handles;
+					for (int i = 0; i < handlerCount; i++) {
+						auto handle = MidiController::makeOneHandle();
+						uint8 model = (uint8) (1 + i % 100);
+						auto filter = i % 8 == 7 ? MidiMessageFilter::nonRealtime() : MidiMessageFilter::sysexOnly({ 0x7d, model });
+						controller->addMessageHandler(handle, filter, [&called](MidiInput *, MidiMessage const &) {
+							called++;
+						});
+						handles.push_back(handle);
+					}
+					measure(options, fmt::format("sysex/dispatch {} messages to {} handlers", messages.size(), handlerCount), messages.size(), [&]() {
+						for (auto const &message : messages) {
+							controller->dispatchIncomingMidiMessage(nullptr, message);
+						}
+					});
+					consume(called);
+					for (auto const &handle : handles) {
+						controller->removeMessageHandler(handle);
+					}
+				}
+			}
+
+			void benchCategories(Options const &options, std::vector<PatchHolder> const &library)
+			{
+				auto categories = defaultCategories();
+				std::vector<std::shared_ptr<CategoryDefinition>> definitions;
+				for (auto const &category : categories) {
+					definitions.push_back(category.def());
+				}
+				CategoryBitfield bitfield(definitions);
+				std::vector<int64> bitfields(library.size());
+				measure(options, fmt::format("sysex/category set to bitfield {}", library.size()), library.size(), [&]() {
+					for (size_t i = 0; i < library.size(); i++) {
+						bitfields[i] = bitfield.categorySetAsBitfield(library[i].categorySet());
+					}
+				});
+				measure(options, fmt::format("sysex/category bitfield to set {}", library.size()), library.size(), [&]() {
+					CategorySet set;
+					for (auto value : bitfields) {
+						bitfield.makeSetOfCategoriesFromBitfield(set, value);
+						consume(set.size());
+					}
+				});
+				measure(options, fmt::format("sysex/category bitfield to std::set {}", library.size()), library.size(), [&]() {
+					for (auto value : bitfields) {
+						std::set<Category> set;
+						bitfield.makeSetOfCategoriesFromBitfield(set, value);
+						consume(set.size());
+					}
+				});
+
+				auto detector = std::make_shared<AutomaticCategory>(categories);
+				measure(options, fmt::format("sysex/determineAutomaticCategories {}", library.size()), library.size(), [&]() {
+					for (auto const &patch : library) {
+						consume(detector->determineAutomaticCategories(patch).size());
+					}
+				});
+			}
+
+			void benchInterchangeFormat(Options const &options, std::shared_ptr<BenchSynth> synth, std::vector<PatchHolder> const &library)
+			{
+				std::map<std::string, std::shared_ptr<Synth>> synths = { { synth->getName(), synth } };
+				auto detector = std::make_shared<AutomaticCategory>(defaultCategories());
+				for (auto const &extension : { std::string(".json"), std::string(".kkarchive") }) {
+					auto filename = temporaryFile(options, "midikraft_bench" + extension);
+					measure(options, fmt::format("sysex/interchange save {}{}", library.size(), extension), library.size(), [&]() {
+						PatchInterchangeFormat::save(library, filename);
+					});
+					measure(options, fmt::format("sysex/interchange load {}{}", library.size(), extension), library.size(), [&]() {
+						consume(PatchInterchangeFormat::load(synths, filename, detector).size());
+					});
+					File(filename).deleteFile();
+				}
+			}
+
+			Suite sysexSuite("sysex", [](Options const &options) {
+				ScopedJuceInitialiser_GUI juceRuntime;
+				auto synth = std::make_shared<BenchSynth>("Bench Synth", 0x01);
+				auto library = syntheticLibrary(synth, defaultCategories(), kLibrarySize);
+				benchLoadSysex(options, synth);
+				benchDispatch(options, synth);
+				benchCategories(options, library);
+				benchInterchangeFormat(options, synth, library);
+				MidiController::shutdown();
+			});
+
+		}
+
+	}
+
+}
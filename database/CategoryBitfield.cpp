@@ -12,28 +12,51 @@ namespace midikraft {
 
 	//std::vector<std::string> kLegacyBitIndexNames = { "Lead", "Pad", "Brass", "Organ", "Keys", "Bass", "Arp", "Pluck", "Drone", "Drum", "Bell", "SFX", "Ambient", "Wind",  "Voice" };
 
-	CategoryBitfield::CategoryBitfield(std::vector<std::shared_ptr<CategoryDefinition>> const &bitNames) : bitNames_(bitNames)
+	CategoryBitfield::CategoryBitfield(std::vector<std::shared_ptr<CategoryDefinition>> const &bitNames) : bitNames_(bitNames),
+		definitionsByBit_(CategorySet::kMaxCategories), knownBits_(0)
 	{
+		for (auto const &bit : bitNames_) {
+			if (bit->id >= 0 && bit->id < CategorySet::kMaxCategories) {
+				if (!definitionsByBit_[(size_t) bit->id]) {
+					definitionsByBit_[(size_t) bit->id] = bit;
+					knownBits_ |= 1ULL << bit->id;
+				}
+			}
+			else {
+				jassertfalse;
+			}
+		}
 	}
 
 	void midikraft::CategoryBitfield::makeSetOfCategoriesFromBitfield(std::set<Category> &cats, int64 bitfield) const
+	{
+		CategorySet result;
+		makeSetOfCategoriesFromBitfield(result, bitfield);
+		cats = result.asSet();
+	}
+
+	void CategoryBitfield::makeSetOfCategoriesFromBitfield(CategorySet &cats, int64 bitfield) const
 	{
 		cats.clear();
-		for (int i = 0; i < 63; i++) {
-			if (bitfield & (1LL << i)) {
-				// This bit is set, find the category that has this bitindex
-				bool found = false;
-				for (auto bit : bitNames_) {
-					if (i == bit->id) {
-						found = true;
-						cats.insert(Category(bit));
-					}
-				}
-				if (!found) {
-					jassertfalse;
-				}
-			}
+		uint64 bits = (uint64) bitfield;
+		if (bits & ~knownBits_) {
+			// A bit is set we have no category for
+			jassertfalse;
 		}
+		bits &= knownBits_;
+		// Only visit the bits set
+		while (bits) {
+			int i = 0;
+			while (!(bits & (1ULL << i))) i++;
+			cats.insert(Category(definitionsByBit_[(size_t) i]));
+			bits &= bits - 1;
+		}
+	}
+
+	juce::int64 CategoryBitfield::categorySetAsBitfield(CategorySet const &categories) const
+	{
+		jassert((categories.bits() & ~knownBits_) == 0);
+		return (juce::int64) (categories.bits() & knownBits_);
 	}
 
 	juce::int64 CategoryBitfield::categorySetAsBitfield(std::set<Category> const &categories) const
@@ -15,7 +15,9 @@ namespace midikraft {
 		CategoryBitfield(std::vector<std::shared_ptr<CategoryDefinition>> const &bitNames);
 
 		void makeSetOfCategoriesFromBitfield(std::set<Category> &cats, int64 bitfield) const;
+		void makeSetOfCategoriesFromBitfield(CategorySet &cats, int64 bitfield) const;
 		juce::int64 categorySetAsBitfield(std::set<Category> const &categories) const;
+		juce::int64 categorySetAsBitfield(CategorySet const &categories) const;
 
 		int maxBitIndex() const;
 
@@ -23,6 +25,8 @@ namespace midikraft {
 		int bitIndexForCategory(Category &category) const;
 
 		std::vector<std::shared_ptr<CategoryDefinition>> bitNames_;
+		std::vector<std::shared_ptr<CategoryDefinition>> definitionsByBit_; // Indexed by bit index, nullptr for unused bits
+		uint64 knownBits_;
 	};
 
 }
@@ -8,6 +8,9 @@
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <set>
+
 #include "Logger.h"
 
 std::string toString(Aws::String const &aws) {
@@ -194,3 +197,282 @@ bool DynamoDeleteItem::performDelete(const Aws::DynamoDB::DynamoDBClient &dynamo
 	}
 	return true;
 }
+
+// BatchWriteItem takes at most 25 items, BatchGetItem at most 100 keys per request
+const size_t kBatchWriteLimit = 25;
+const size_t kBatchGetLimit = 100;
+
+DynamoBatchRunner::DynamoBatchRunner(int maxInFlight, int maxAttempts) :
+	maxInFlight_(std::max(1, maxInFlight)), maxAttempts_(std::max(1, maxAttempts)), inFlight_(0), failed_(0)
+{
+}
+
+void DynamoBatchRunner::add(TJob job)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	queue_.push_back({ job, 0, std::chrono::steady_clock::now() });
+}
+
+bool DynamoBatchRunner::run()
+{
+	std::unique_lock<std::mutex> lock(lock_);
+	while (!queue_.empty() || inFlight_ > 0) {
+		if (queue_.empty() || inFlight_ >= maxInFlight_) {
+			changed_.wait(lock);
+			continue;
+		}
+		// Retries are appended, so the front is the one that has waited longest
+		auto now = std::chrono::steady_clock::now();
+		auto ready = std::find_if(queue_.begin(), queue_.end(), [now](Pending const &pending) { return pending.notBefore <= now; });
+		if (ready == queue_.end()) {
+			auto earliest = std::min_element(queue_.begin(), queue_.end(), [](Pending const &a, Pending const &b) { return a.notBefore < b.notBefore; });
+			changed_.wait_until(lock, earliest->notBefore);
+			continue;
+		}
+		Pending pending = *ready;
+		queue_.erase(ready);
+		inFlight_++;
+		lock.unlock();
+		pending.job(pending.attempt, [this, pending](Outcome outcome) {
+			std::lock_guard<std::mutex> lock(lock_);
+			inFlight_--;
+			if (outcome == Outcome::Retry) {
+				if (pending.attempt + 1 < maxAttempts_) {
+					queue_.push_back({ pending.job, pending.attempt + 1, std::chrono::steady_clock::now() + backoff(pending.attempt + 1) });
+				}
+				else {
+					failed_++;
+				}
+			}
+			else if (outcome == Outcome::Failed) {
+				failed_++;
+			}
+			changed_.notify_all();
+		});
+		lock.lock();
+	}
+	return failed_ == 0;
+}
+
+std::chrono::milliseconds DynamoBatchRunner::backoff(int attempt)
+{
+	// Full jitter, so throttled requests don't come back all at the same time
+	int cap = (int)std::min((int64)10000, (int64)50 << std::min(attempt, 10));
+	return std::chrono::milliseconds(Random::getSystemRandom().nextInt(cap));
+}
+
+bool DynamoChangeTracker::hasChanged(std::string const &itemKey, DynamoDict const &item) const
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	auto found = synced_.find(itemKey);
+	return found == synced_.end() || found->second != fingerprint(item);
+}
+
+void DynamoChangeTracker::markSynced(std::string const &itemKey, std::string const &fingerprint)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	synced_[itemKey] = fingerprint;
+}
+
+void DynamoChangeTracker::forget(std::string const &itemKey)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	synced_.erase(itemKey);
+}
+
+std::string DynamoChangeTracker::fingerprint(DynamoDict const &item)
+{
+	// The map is ordered by attribute name, so the same content always gives the same fingerprint
+	std::string content;
+	for (auto const &attribute : item) {
+		content += toString(attribute.first);
+		content.push_back('\0');
+		content += toString(attribute.second.Jsonize().View().WriteCompact());
+		content.push_back('\0');
+	}
+	return MD5(content.data(), content.size()).toHexString().toStdString();
+}
+
+bool DynamoChangeTracker::load(File const &stateFile)
+{
+	if (!stateFile.existsAsFile()) {
+		return false;
+	}
+	StringArray lines;
+	stateFile.readLines(lines);
+	std::lock_guard<std::mutex> lock(lock_);
+	synced_.clear();
+	for (auto const &line : lines) {
+		int tab = line.lastIndexOfChar('\t');
+		if (tab > 0) {
+			synced_[line.substring(0, tab).toStdString()] = line.substring(tab + 1).toStdString();
+		}
+	}
+	return true;
+}
+
+bool DynamoChangeTracker::save(File const &stateFile) const
+{
+	// One line per item, the key then a tab and the fingerprint. Item keys with a newline in them would break this, ours are synth names and MD5s
+	String content;
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		for (auto const &synced : synced_) {
+			content << String(synced.first) << "\t" << String(synced.second) << "\n";
+		}
+	}
+	return stateFile.replaceWithText(content);
+}
+
+DynamoBatchWriter::DynamoBatchWriter(DynamoChangeTracker *tracker, int maxInFlight) : tracker_(tracker), maxInFlight_(maxInFlight), written_(0), skipped_(0)
+{
+}
+
+bool DynamoBatchWriter::put(std::string const &table, std::string const &itemKey, DynamoDict const &item)
+{
+	std::string fingerprint;
+	if (tracker_) {
+		if (!tracker_->hasChanged(itemKey, item)) {
+			skipped_++;
+			return false;
+		}
+		fingerprint = DynamoChangeTracker::fingerprint(item);
+	}
+	Aws::DynamoDB::Model::WriteRequest request;
+	request.SetPutRequest(Aws::DynamoDB::Model::PutRequest().WithItem(item));
+	pending_[table].push_back({ itemKey, fingerprint, request });
+	return true;
+}
+
+void DynamoBatchWriter::remove(std::string const &table, std::string const &itemKey, DynamoDict const &keys)
+{
+	Aws::DynamoDB::Model::WriteRequest request;
+	request.SetDeleteRequest(Aws::DynamoDB::Model::DeleteRequest().WithKey(keys));
+	pending_[table].push_back({ itemKey, "", request });
+}
+
+bool DynamoBatchWriter::flush(const Aws::DynamoDB::DynamoDBClient &dynamoClient)
+{
+	DynamoBatchRunner runner(maxInFlight_);
+	for (auto &tableEntries : pending_) {
+		std::string table = tableEntries.first;
+		auto &entries = tableEntries.second;
+		for (size_t start = 0; start < entries.size(); start += kBatchWriteLimit) {
+			// What is still to be written of this chunk. Shrinks to the unprocessed items after each attempt
+			auto chunk = std::make_shared<std::vector<Entry>>(entries.begin() + start, entries.begin() + std::min(entries.size(), start + kBatchWriteLimit));
+			runner.add([this, &dynamoClient, table, chunk](int attempt, std::function<void(DynamoBatchRunner::Outcome)> finished) {
+				ignoreUnused(attempt);
+				Aws::Vector<Aws::DynamoDB::Model::WriteRequest> requests;
+				for (auto const &entry : *chunk) {
+					requests.push_back(entry.request);
+				}
+				Aws::DynamoDB::Model::BatchWriteItemRequest batch;
+				batch.AddRequestItems(table.c_str(), requests);
+				dynamoClient.BatchWriteItemAsync(batch, [this, table, chunk, finished](const Aws::DynamoDB::DynamoDBClient *, const Aws::DynamoDB::Model::BatchWriteItemRequest &,
+					const Aws::DynamoDB::Model::BatchWriteItemOutcome &outcome, const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+					if (!outcome.IsSuccess()) {
+						// Throttling and server errors are worth another try, anything else will fail again
+						if (outcome.GetError().ShouldRetry()) {
+							finished(DynamoBatchRunner::Outcome::Retry);
+						}
+						else {
+							SimpleLogger::instance()->postMessage(toString(outcome.GetError().GetMessage()));
+							finished(DynamoBatchRunner::Outcome::Failed);
+						}
+						return;
+					}
+					// Everything not reported back as unprocessed has been written
+					std::set<std::string> unprocessed;
+					auto const &unprocessedItems = outcome.GetResult().GetUnprocessedItems();
+					auto forTable = unprocessedItems.find(table.c_str());
+					if (forTable != unprocessedItems.end()) {
+						for (auto const &request : forTable->second) {
+							unprocessed.insert(toString(request.Jsonize().View().WriteCompact()));
+						}
+					}
+					std::vector<Entry> remaining;
+					for (auto const &entry : *chunk) {
+						if (unprocessed.count(toString(entry.request.Jsonize().View().WriteCompact()))) {
+							remaining.push_back(entry);
+						}
+						else {
+							written_++;
+							if (tracker_) {
+								if (entry.fingerprint.empty()) {
+									tracker_->forget(entry.itemKey);
+								}
+								else {
+									tracker_->markSynced(entry.itemKey, entry.fingerprint);
+								}
+							}
+						}
+					}
+					chunk->swap(remaining);
+					finished(chunk->empty() ? DynamoBatchRunner::Outcome::Done : DynamoBatchRunner::Outcome::Retry);
+				});
+			});
+		}
+	}
+	pending_.clear();
+	bool success = runner.run();
+	if (!success) {
+		SimpleLogger::instance()->postMessage("Some items could not be written to DynamoDB even after retrying, run the sync again later");
+	}
+	return success;
+}
+
+size_t DynamoBatchWriter::writtenCount() const
+{
+	return written_;
+}
+
+size_t DynamoBatchWriter::skippedCount() const
+{
+	return skipped_;
+}
+
+bool dynamoBatchGet(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::string const &table, std::vector<DynamoDict> const &keys, std::function<void(TDynamoMap &result)> resultHandler, int maxInFlight)
+{
+	DynamoBatchRunner runner(maxInFlight);
+	auto handlerLock = std::make_shared<std::mutex>();
+	for (size_t start = 0; start < keys.size(); start += kBatchGetLimit) {
+		auto chunk = std::make_shared<Aws::Vector<TDynamoMap>>(keys.begin() + start, keys.begin() + std::min(keys.size(), start + kBatchGetLimit));
+		runner.add([&dynamoClient, table, chunk, resultHandler, handlerLock](int attempt, std::function<void(DynamoBatchRunner::Outcome)> finished) {
+			ignoreUnused(attempt);
+			Aws::DynamoDB::Model::BatchGetItemRequest batch;
+			batch.AddRequestItems(table.c_str(), Aws::DynamoDB::Model::KeysAndAttributes().WithKeys(*chunk));
+			dynamoClient.BatchGetItemAsync(batch, [table, chunk, resultHandler, handlerLock, finished](const Aws::DynamoDB::DynamoDBClient *, const Aws::DynamoDB::Model::BatchGetItemRequest &,
+				const Aws::DynamoDB::Model::BatchGetItemOutcome &outcome, const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+				if (!outcome.IsSuccess()) {
+					if (outcome.GetError().ShouldRetry()) {
+						finished(DynamoBatchRunner::Outcome::Retry);
+					}
+					else {
+						SimpleLogger::instance()->postMessage(toString(outcome.GetError().GetMessage()));
+						finished(DynamoBatchRunner::Outcome::Failed);
+					}
+					return;
+				}
+				auto const &responses = outcome.GetResult().GetResponses();
+				auto forTable = responses.find(table.c_str());
+				if (forTable != responses.end()) {
+					std::lock_guard<std::mutex> lock(*handlerLock);
+					for (auto item : forTable->second) {
+						resultHandler(item);
+					}
+				}
+				// Only ask again for the keys the service didn't get to
+				auto const &unprocessedKeys = outcome.GetResult().GetUnprocessedKeys();
+				auto unprocessed = unprocessedKeys.find(table.c_str());
+				if (unprocessed != unprocessedKeys.end() && !unprocessed->second.GetKeys().empty()) {
+					*chunk = unprocessed->second.GetKeys();
+					finished(DynamoBatchRunner::Outcome::Retry);
+				}
+				else {
+					finished(DynamoBatchRunner::Outcome::Done);
+				}
+			});
+		});
+	}
+	return runner.run();
+}
@@ -15,6 +15,13 @@
 #include <aws/dynamodb/model/UpdateItemRequest.h>
 #include <aws/dynamodb/model/DeleteItemRequest.h>
 #include <aws/dynamodb/model/QueryRequest.h>
+#include <aws/dynamodb/model/BatchWriteItemRequest.h>
+#include <aws/dynamodb/model/BatchGetItemRequest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 
 typedef Aws::DynamoDB::Model::AttributeValue TDynamoValue;
 typedef Aws::Map<Aws::String, TDynamoValue> TDynamoMap;
@@ -55,6 +62,91 @@ public:
 	bool performDelete(const Aws::DynamoDB::DynamoDBClient &dynamoClient);
 };
 
+// Runs many requests against DynamoDB with a bounded number in flight at the same time. A job is started with its attempt number and must call
+// finished exactly once, from any thread. Retry puts the job back into the queue to be started again after an exponential backoff with jitter -
+// use that for throttling errors and unprocessed items. A job that failed, or is still to be retried after maxAttempts, makes run() return false
+class DynamoBatchRunner {
+public:
+	enum class Outcome {
+		Done,
+		Retry,
+		Failed // Won't succeed on another try
+	};
+	typedef std::function<void(int attempt, std::function<void(Outcome outcome)> finished)> TJob;
+
+	explicit DynamoBatchRunner(int maxInFlight = 8, int maxAttempts = 10);
+
+	void add(TJob job);
+	bool run(); // Blocks until all jobs are done or given up
+
+private:
+	struct Pending {
+		TJob job;
+		int attempt;
+		std::chrono::steady_clock::time_point notBefore;
+	};
+
+	std::chrono::milliseconds backoff(int attempt);
+
+	int maxInFlight_;
+	int maxAttempts_;
+	std::mutex lock_;
+	std::condition_variable changed_;
+	std::deque<Pending> queue_;
+	int inFlight_;
+	int failed_; // Including those given up after the last attempt
+};
+
+// Remembers a fingerprint of every item as last uploaded, so a sync only sends the items that changed since
+class DynamoChangeTracker {
+public:
+	bool hasChanged(std::string const &itemKey, DynamoDict const &item) const;
+	void markSynced(std::string const &itemKey, std::string const &fingerprint);
+	void forget(std::string const &itemKey);
+
+	static std::string fingerprint(DynamoDict const &item);
+
+	bool load(File const &stateFile);
+	bool save(File const &stateFile) const;
+
+private:
+	mutable std::mutex lock_;
+	std::map<std::string, std::string> synced_;
+};
+
+// Collects puts and deletes and sends them with BatchWriteItem, 25 items per request and several requests at the same time.
+// Items the service reports as unprocessed are sent again with a backoff. With a change tracker, unchanged items are not sent at all
+class DynamoBatchWriter {
+public:
+	explicit DynamoBatchWriter(DynamoChangeTracker *tracker = nullptr, int maxInFlight = 8);
+
+	// The itemKey identifies the item for the change tracker, it is not used otherwise. Returns false if the item is unchanged and was skipped
+	bool put(std::string const &table, std::string const &itemKey, DynamoDict const &item);
+	void remove(std::string const &table, std::string const &itemKey, DynamoDict const &keys);
+
+	// Sends everything collected. Returns false if some items could not be written even after retrying
+	bool flush(const Aws::DynamoDB::DynamoDBClient &dynamoClient);
+	size_t writtenCount() const;
+	size_t skippedCount() const;
+
+private:
+	struct Entry {
+		std::string itemKey;
+		std::string fingerprint; // Empty for deletes
+		Aws::DynamoDB::Model::WriteRequest request;
+	};
+
+	DynamoChangeTracker *tracker_;
+	int maxInFlight_;
+	std::map<std::string, std::vector<Entry>> pending_; // By table
+	std::atomic<size_t> written_;
+	size_t skipped_;
+};
+
+// Fetches many items by key with BatchGetItem, 100 keys per request and several requests at the same time. The handler is called for each item found,
+// one at a time but from the SDK's threads and in no particular order. Returns false if some keys could not be fetched, because of an error or after retrying
+bool dynamoBatchGet(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::string const &table, std::vector<DynamoDict> const &keys, std::function<void(TDynamoMap &result)> resultHandler, int maxInFlight = 8);
+
 // Base Helper functions
 std::string toString(Aws::String const &aws);
 int toInteger(Aws::String const &aws);
@@ -0,0 +1,87 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "ImportFolderIndex.h"
+
+#include <spdlog/spdlog.h>
+
+namespace midikraft {
+
+	ImportFolderIndex::ImportFolderIndex(PatchDatabase& database, std::string const& synthName) : database_(database), synthName_(synthName)
+	{
+		known_ = database_.getImportedFiles(synthName_);
+	}
+
+	bool ImportFolderIndex::isUnchanged(File const& file)
+	{
+		auto found = known_.find(file.getFullPathName().toStdString());
+		if (found == known_.end()) {
+			return false;
+		}
+		auto& info = found->second;
+		if (info.size != file.getSize()) {
+			return false;
+		}
+		int64_t modified = file.getLastModificationTime().toMilliseconds();
+		if (info.modified == modified) {
+			return true;
+		}
+		// Copied or touched, only reading the content tells. Still much cheaper than parsing and merging it again
+		if (contentHash(file) == info.hash) {
+			info.modified = modified;
+			touched_.push_back(info);
+			return true;
+		}
+		return false;
+	}
+
+	Librarian::TFileFilter ImportFolderIndex::filter()
+	{
+		return [this](File const& file) {
+			return !isUnchanged(file);
+		};
+	}
+
+	void ImportFolderIndex::recordImport(Array<File> const& files, std::vector<PatchHolder> const& loaded, std::string const& importId)
+	{
+		std::vector<ImportedFileInfo> toStore;
+		toStore.swap(touched_);
+		auto loadedFrom = sourceFiles(loaded);
+		for (auto const& file : files) {
+			if (loadedFrom.find(file.getFullPathName().toStdString()) == loadedFrom.end()) {
+				continue;
+			}
+			ImportedFileInfo info{ synthName_, file.getFullPathName().toStdString(), file.getSize(), file.getLastModificationTime().toMilliseconds(), contentHash(file), importId };
+			known_[info.path] = info;
+			toStore.push_back(info);
+		}
+		if (!database_.putImportedFiles(toStore)) {
+			spdlog::warn("Could not store the import folder index, the files will be loaded again next time");
+		}
+	}
+
+	std::string ImportFolderIndex::contentHash(File const& file)
+	{
+		return MD5(file).toHexString().toStdString();
+	}
+
+	std::set<std::string> ImportFolderIndex::sourceFiles(std::vector<PatchHolder> const& loaded)
+	{
+		std::set<std::string> result;
+		for (auto const& patch : loaded) {
+			auto source = patch.sourceInfo();
+			// Loading several files wraps the file source into a bulk import source
+			if (auto bulk = std::dynamic_pointer_cast<FromBulkImportSource>(source)) {
+				source = bulk->individualInfo();
+			}
+			if (auto fileSource = std::dynamic_pointer_cast<FromFileSource>(source)) {
+				result.insert(fileSource->fullpath());
+			}
+		}
+		return result;
+	}
+
+}
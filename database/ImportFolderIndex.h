@@ -0,0 +1,44 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "PatchDatabase.h"
+#include "Librarian.h"
+
+#include <set>
+
+namespace midikraft {
+
+	// Remembers which files of an import folder have been imported already, so re-importing the folder only loads new or changed files.
+	// A file counts as unchanged if size and modification time match, or if only the time differs but the content hash is still the same.
+	// Use it from one thread only
+	class ImportFolderIndex {
+	public:
+		// The files are tracked per synth, importing the same folder for another synth reads all files again
+		ImportFolderIndex(PatchDatabase &database, std::string const &synthName);
+
+		bool isUnchanged(File const &file);
+		// To hand to Librarian::loadSysexPatchesFromDirectory
+		Librarian::TFileFilter filter();
+
+		// Call after the patches loaded from the files have been merged into the database. Only files at least one of the loaded patches came from are recorded,
+		// so a file that failed to load is tried again next time
+		void recordImport(Array<File> const &files, std::vector<PatchHolder> const &loaded, std::string const &importId);
+
+	private:
+		static std::string contentHash(File const &file);
+		static std::set<std::string> sourceFiles(std::vector<PatchHolder> const &loaded);
+
+		PatchDatabase &database_;
+		std::string synthName_;
+		std::map<std::string, ImportedFileInfo> known_;
+		std::vector<ImportedFileInfo> touched_; // Content unchanged, but with a new modification time to be stored
+	};
+
+}
@@ -6,12 +6,12 @@
 
 #include "JsonSerialization.h"
 
+#include "Base64Codec.h"
 #include "JsonSchema.h"
 #include "RapidjsonHelper.h"
 #include "Synth.h"
 
 #include <boost/format.hpp>
-#include <boost/beast/core/detail/base64.hpp>
 
 namespace midikraft {
 
@@ -40,23 +40,15 @@ namespace midikraft {
 	}
 
 	std::string JsonSerialization::dataToString(std::vector<uint8> const &data) {
-		std::string binaryString;
-		for (auto byte : data) {
-			binaryString.push_back(byte);
-		}
-		// See https://stackoverflow.com/questions/7053538/how-do-i-encode-a-string-to-base64-using-only-boost
-		std::vector<char> buffer(2048);
-		size_t lengthWritten = boost::beast::detail::base64::encode(buffer.data(), data.data(), buffer.size());
-		jassert(lengthWritten < 2048);
-		std::string result(buffer.data(), lengthWritten);
-		return result;
+		return Base64Codec::encode(data);
 	}
 
 	std::vector<uint8> JsonSerialization::stringToData(std::string const string)
 	{
-		std::vector<uint8> outBuffer(2048, 0);
-		auto decoded_bytes = boost::beast::detail::base64::decode(outBuffer.data(), string.c_str(), 2048);
-		outBuffer.resize(decoded_bytes.first); // Trim output so it contains only the written part
+		std::vector<uint8> outBuffer;
+		if (!Base64Codec::decode(string, outBuffer)) {
+			jassertfalse;
+		}
 		return outBuffer;
 	}
 
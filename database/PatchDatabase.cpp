@@ -5,6 +5,8 @@
 */
 
 #include "PatchDatabase.h"
+#include "PatchMetadataIndex.h"
+#include "PatchSimilarityIndex.h"
 
 #include "Capability.h"
 #include "Patch.h"
@@ -13,6 +15,7 @@
 #include "SynthBank.h"
 #include "StoredPatchNameCapability.h"
 #include "HasBanksCapability.h"
+#include "StoredTagCapability.h"
 
 #include "JsonSchema.h"
 #include "JsonSerialization.h"
@@ -20,15 +23,26 @@
 #include "ProgressHandler.h"
 
 #include "FileHelpers.h"
+#include "ParallelFor.h"
+#include "Tracing.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 #include "SpdLogJuce.h"
 
+#include <SQLiteCpp/Backup.h>
 #include <SQLiteCpp/Database.h>
 #include <SQLiteCpp/Statement.h>
-#include <SQLiteCpp/Transaction.h>
 
 #include <SQLiteCpp/../../sqlite3/sqlite3.h> //TODO How to use the underlying site3 correctly?
 
@@ -36,39 +50,1080 @@ namespace midikraft {
 
 	const std::string kDataBaseFileName = "SysexDatabaseOfAllPatches.db3";
 	const std::string kDataBaseBackupSuffix = "-backup";
+	const size_t kMaxBackupBytes = 500000000;
+	// Distance between the order keys of consecutive list entries, leaving room to insert or move entries between them without renumbering
+	const int64_t kListOrderGap = 1024;
+	const size_t kMinBackupsKept = 3;
+	// Results of getPatches and getPatchesCount kept by default, most recently used first
+	const size_t kResultCacheEntries = 32;
+	// How long a write waits for the lock held by another connection, e.g. the background maintenance, before failing with SQLITE_BUSY
+	const int kBusyTimeoutMilliseconds = 5000;
+	// The maintenance after opening waits this long, so it doesn't compete with loading the first patches
+	const int kMaintenanceDelayMilliseconds = 10000;
+	// Rows ANALYZE looks at per index. The statistics are approximate then, but good enough for the planner and never take long to collect
+	const int kAnalysisLimit = 1000;
+	// Deferred metadata edits are collected for this long before they are written together
+	const int kWriteBehindIntervalMilliseconds = 500;
+
+	const int SCHEMA_VERSION = 25;
+	/* History */
+	/* 1 - Initial schema */
+	/* 2 - adding hidden flag (aka deleted) */
+	/* 3 - adding type integer to patch (to differentiate voice, patch, layer, tuning...) */
+	/* 4 - forgot to migrate existing data NULL to 0 */
+	/* 5 - adding bank number column for better sorting of multi-imports */
+	/* 6 - adding the table categories to track which bit index is used for which tag */
+	/* 7 - adding the table lists to allow storing lists of patches */
+	/* 8 - adding synth name, timestamp and banknumber to patch list to allow store synth banks */
+	/* 9 - adding foreign key to make sure no patch is deleted that belongs to a list */
+	/* 10 - drop tables created by upgrade to 9, needing retry with database connection */
+	/* 11 - adding an index to speed up the duplicate name search, as suggested by chatGPT */
+	/* 12 - adding an index to speed up the import list building */
+	/* 13 - adding comment to the patch table */
+	/* 14 - adding the table patch_category as an indexable many to many relation between patches and categories */
+	/* 15 - adding an index to read patch lists in order */
+	/* 16 - adding the table imported_files to skip unchanged files when importing a folder again */
+	/* 17 - adding the trigger maintained table name_counts for the duplicate name filter */
+	/* 18 - adding the trigger maintained change journal */
+	/* 19 - adding data_encoding to the patch table to store large BLOBs compressed */
+	/* 20 - moving the patch data into the content addressed table blobs, so identical sysex is stored only once */
+	/* 21 - adding the trigger maintained table import_counts for the imports list */
+	/* 22 - adding indexes for each patch ordering and for finding the lists a patch is in */
+	/* 23 - keying imported_files by synth and path, so the same folder can be imported for more than one synth */
+	/* 24 - ordering indexes on COALESCE(midiProgramNo, -1), matching the keyset paging expressions */
+
+	// Joined to get the patch data, as the columns blob_data and blob_encoding
+	const std::string kPatchDataJoin = " LEFT JOIN blobs ON blobs.blob_hash = patches.blob_hash";
+
+	// How a data BLOB is stored. NULL in databases from before schema 19 means raw
+	const int kDataEncodingRaw = 0;
+	const int kDataEncodingZlib = 1; // Original length as 32 bit little endian, then the zlib stream
+	// Only BLOBs of at least this size are compressed, and only if that saves at least an eighth. A single patch is usually too small to bother
+	const size_t kMinCompressedDataBytes = 4096;
+	// A stored original length beyond this, or beyond what deflate can expand the stream to (at most 1032:1), is damage and not allocated
+	const size_t kMaxDecodedDataBytes = 64 * 1024 * 1024;
+	const size_t kMaxDeflateExpansion = 1032;
+
+	int encodePatchData(std::vector<uint8> const& data, bool compress, std::vector<uint8>& outStored) {
+		// Returns the encoding to store. If not raw, the bytes for the data column are in outStored
+		if (!compress || data.size() < kMinCompressedDataBytes) {
+			return kDataEncodingRaw;
+		}
+		MemoryOutputStream stored;
+		stored.writeInt((int)data.size());
+		{
+			GZIPCompressorOutputStream zlib(stored, 9);
+			zlib.write(data.data(), data.size());
+		}
+		if (stored.getDataSize() > data.size() - data.size() / 8) {
+			return kDataEncodingRaw;
+		}
+		auto bytes = static_cast<uint8 const*>(stored.getData());
+		outStored.assign(bytes, bytes + stored.getDataSize());
+		return kDataEncodingZlib;
+	}
+
+	bool decodePatchData(SQLite::Column const& dataColumn, int encoding, std::vector<uint8>& outData) {
+		auto bytes = static_cast<uint8 const*>(dataColumn.getBlob());
+		size_t size = (size_t)dataColumn.getBytes();
+		if (encoding == kDataEncodingRaw) {
+			outData.assign(bytes, bytes + size);
+			return true;
+		}
+		if (encoding != kDataEncodingZlib || size < 4) {
+			spdlog::error("Patch data with unknown encoding {}, ignoring patch. Was the database written by a newer version?", encoding);
+			return false;
+		}
+		size_t originalSize = (size_t)ByteOrder::littleEndianInt(bytes);
+		if (originalSize > kMaxDecodedDataBytes || originalSize > (size - 4) * kMaxDeflateExpansion) {
+			spdlog::error("Compressed patch data claims {} bytes from {} stored, damaged, ignoring patch", originalSize, size - 4);
+			return false;
+		}
+		GZIPDecompressorInputStream zlib(new MemoryInputStream(bytes + 4, size - 4, false), true);
+		outData.resize(originalSize);
+		if (originalSize > 0 && zlib.read(outData.data(), (int)originalSize) != (int)originalSize) {
+			spdlog::error("Compressed patch data is damaged, ignoring patch");
+			return false;
+		}
+		return true;
+	}
+
+	std::string favoriteHiddenCondition(PatchFilter const& filter) {
+		// Show Hidden and Show Faves are special in that they can be combined
+		// and need explicit code for the 4 cases. Empty if the flags don't restrict the result
+		if (filter.onlyFaves) {
+			if (filter.showHidden) {
+				if (filter.showUndecided) {
+					// No op, just retrieve all
+					return "";
+				}
+				else
+				{
+					// Don't show all
+					return "(hidden == 1 OR favorite == 1)";
+				}
+			}
+			else
+			{
+				if (filter.showUndecided) {
+					// Everything that is not hidden
+					return "(hidden is null or hidden != 1)";
+				}
+				else
+				{
+					// Only favorites that are not hidden
+					return "(favorite == 1) AND (hidden is null or hidden != 1)";
+				}
+			}
+		}
+		else {
+			if (filter.showHidden) {
+				if (filter.showUndecided) {
+					// All that's not favorite
+					return "(favorite != 1)";
+				}
+				else
+				{
+					// Only hidden
+					return "(hidden == 1)";
+				}
+			}
+			else
+			{
+				if (filter.showUndecided) {
+					// Everything that is not hidden and not fave
+					return "(favorite != 1) AND (hidden is null or hidden != 1)";
+				}
+				else
+				{
+					// All that is not hidden
+					return "(hidden is null or hidden != 1)";
+				}
+			}
+		}
+	}
+
+	unsigned updateChoicesFilteredOn(PatchFilter const& filter) {
+		// The metadata edits that can change which rows the filter matches, from the same conditions buildWhereClause() emits
+		unsigned choices = 0;
+		auto flags = favoriteHiddenCondition(filter);
+		if (flags.find("favorite") != std::string::npos) choices |= PatchDatabase::UPDATE_FAVORITE;
+		if (flags.find("hidden") != std::string::npos) choices |= PatchDatabase::UPDATE_HIDDEN;
+		if (filter.onlyUntagged || !filter.categories.empty()) choices |= PatchDatabase::UPDATE_CATEGORIES;
+		if (!filter.name.empty()) choices |= PatchDatabase::UPDATE_NAME | PatchDatabase::UPDATE_COMMENT;
+		if (filter.onlyDuplicateNames) choices |= PatchDatabase::UPDATE_NAME;
+		return choices;
+	}
+
+	// Cancellation check for the query running on the current thread, polled by the SQLite progress handler
+	thread_local std::function<bool()> const* tCurrentQueryCancelled = nullptr;
+
+	int queryProgressHandler(void*) {
+		// A non-zero return value makes SQLite abort the running statement with SQLITE_INTERRUPT
+		return (tCurrentQueryCancelled && (*tCurrentQueryCancelled)()) ? 1 : 0;
+	}
+
+	// Installs a cancellation check for all queries run on this thread while in scope
+	class ScopedQueryCancellation {
+	public:
+		explicit ScopedQueryCancellation(std::function<bool()> isCancelled) : isCancelled_(isCancelled), previous_(tCurrentQueryCancelled) {
+			tCurrentQueryCancelled = &isCancelled_;
+		}
+		~ScopedQueryCancellation() {
+			tCurrentQueryCancelled = previous_;
+		}
+
+	private:
+		std::function<bool()> isCancelled_;
+		std::function<bool()> const* previous_;
+	};
+
+	// Scratch space for turning the rows of one query into PatchHolders. The decode buffer keeps its capacity from row to row, and as most rows
+	// share a handful of category combinations, each distinct bitfield is turned into a CategorySet only once per query
+	class QueryRowScratch {
+	public:
+		explicit QueryRowScratch(CategoryBitfield const& categoryBits) : categoryBits_(categoryBits) {}
+
+		CategoryBitfield const& categoryBits() const {
+			return categoryBits_;
+		}
+
+		std::vector<uint8>& patchData() {
+			return patchData_;
+		}
+
+		CategorySet const& categorySet(int64 bitfield) {
+			auto found = categorySets_.find(bitfield);
+			if (found == categorySets_.end()) {
+				CategorySet categories;
+				categoryBits_.makeSetOfCategoriesFromBitfield(categories, bitfield);
+				found = categorySets_.emplace(bitfield, categories).first;
+			}
+			return found->second;
+		}
+
+	private:
+		CategoryBitfield categoryBits_;
+		std::vector<uint8> patchData_;
+		std::unordered_map<int64, CategorySet> categorySets_;
+	};
+
+	// Collects timing and the SQLite statement counters of the filter dependent queries, keyed by their SQL text. That text only depends on the
+	// combination of filter settings, not on the values bound, so each entry tells how one kind of filter performs
+	class QueryProfiler {
+	public:
+		// Covers the execution of one statement, from after binding until it goes out of scope. Only the time spent in step() counts as the query,
+		// the rest, e.g. turning the rows into patches, is recorded as decode time on its own
+		class Scope {
+		public:
+			Scope(QueryProfiler& profiler, SQLite::Database& db, SQLite::Statement& statement, std::string const& sql) :
+				profiler_(profiler), db_(db), statement_(statement), sql_(sql), rows_(0), stepMs_(0.0), startMs_(Time::getMillisecondCounterHiRes()) {
+			}
+			~Scope() {
+				double totalMs = Time::getMillisecondCounterHiRes() - startMs_;
+				profiler_.record(db_, statement_, sql_, rows_, stepMs_, std::max(0.0, totalMs - stepMs_));
+			}
+			Scope(Scope const&) = delete;
+			Scope& operator=(Scope const&) = delete;
+
+			// Use instead of executeStep() on the statement
+			bool step() {
+				double start = Time::getMillisecondCounterHiRes();
+				bool hasRow = statement_.executeStep();
+				stepMs_ += Time::getMillisecondCounterHiRes() - start;
+				if (hasRow) {
+					rows_++;
+				}
+				return hasRow;
+			}
+
+		private:
+			QueryProfiler& profiler_;
+			SQLite::Database& db_;
+			SQLite::Statement& statement_;
+			std::string const& sql_;
+			int64_t rows_;
+			double stepMs_;
+			double startMs_;
+		};
+
+		QueryProfiler() : slowQueryMs_(250.0) {}
+
+		void setSlowQueryThreshold(double milliseconds) {
+			slowQueryMs_ = milliseconds;
+		}
+
+		std::vector<PatchDatabase::QueryProfile> profiles() const {
+			ScopedLock lock(lock_);
+			std::vector<PatchDatabase::QueryProfile> result;
+			for (auto const& entry : profiles_) {
+				result.push_back(entry.second);
+			}
+			std::sort(result.begin(), result.end(), [](PatchDatabase::QueryProfile const& a, PatchDatabase::QueryProfile const& b) { return a.totalMs > b.totalMs; });
+			return result;
+		}
+
+		void reset() {
+			ScopedLock lock(lock_);
+			profiles_.clear();
+		}
+
+	private:
+		void record(SQLite::Database& db, SQLite::Statement& statement, std::string const& sql, int64_t rows, double elapsedMs, double decodeMs) {
+			// Reset the counters, so they are per execution also for a statement that gets reused
+			auto stmt = statement.getPreparedStatement();
+			int64_t fullScanSteps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+			int64_t sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+			int64_t autoIndexRows = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+			double threshold = slowQueryMs_;
+			bool slow = threshold >= 0.0 && elapsedMs >= threshold;
+			bool needsPlan = false;
+			{
+				ScopedLock lock(lock_);
+				auto& profile = profiles_[sql];
+				if (profile.executions == 0) {
+					profile.sql = sql;
+				}
+				profile.executions++;
+				profile.totalMs += elapsedMs;
+				profile.decodeMs += decodeMs;
+				profile.maxMs = std::max(profile.maxMs, elapsedMs);
+				profile.rowsReturned += rows;
+				profile.fullScanSteps += fullScanSteps;
+				profile.sorts += sorts > 0 ? 1 : 0;
+				profile.autoIndexRows += autoIndexRows;
+				if (slow) {
+					profile.slowExecutions++;
+					needsPlan = profile.queryPlan.empty();
+				}
+			}
+			if (!slow) {
+				return;
+			}
+			std::string plan = needsPlan ? explain(db, sql) : "";
+			spdlog::warn("Slow query took {:.0f} ms, returned {} rows after {} full scan steps: {}{}", elapsedMs, rows, fullScanSteps, sql, plan.empty() ? "" : "\n" + plan);
+			if (!plan.empty()) {
+				ScopedLock lock(lock_);
+				profiles_[sql].queryPlan = plan;
+			}
+		}
+
+		static std::string explain(SQLite::Database& db, std::string const& sql) {
+			// The plan doesn't depend on the values, so the unbound variables are fine
+			std::string plan;
+			try {
+				SQLite::Statement explainQuery(db, "EXPLAIN QUERY PLAN " + sql);
+				while (explainQuery.executeStep()) {
+					if (!plan.empty()) plan += "\n";
+					plan += explainQuery.getColumn("detail").getString();
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::warn("Could not get the query plan: {}", ex.what());
+			}
+			return plan;
+		}
+
+		std::atomic<double> slowQueryMs_;
+		CriticalSection lock_;
+		std::map<std::string, PatchDatabase::QueryProfile> profiles_;
+	};
+
+	// Remembers the most recently used results of getPatches and getPatchesCount, so going back to a view shown before needs no query at all.
+	// Every entry is tagged with the write generation it was read at, any write to the database makes all of them stale
+	class QueryResultCache {
+	public:
+		enum class Kind { COUNT, OFFSET_PAGE, KEYSET_PAGE };
+
+		QueryResultCache(size_t maxEntries) : maxEntries_(maxEntries) {}
+
+		void setMaxEntries(size_t maxEntries) {
+			ScopedLock lock(lock_);
+			maxEntries_ = maxEntries;
+			trim();
+		}
+
+		bool isEnabled() {
+			ScopedLock lock(lock_);
+			return maxEntries_ > 0;
+		}
+
+		bool findCount(uint64_t generation, PatchFilter const& filter, int& outCount) {
+			return find(generation, Kind::COUNT, filter, 0, 0, nullptr, [&outCount](Entry const& entry) {
+				outCount = entry.count;
+			});
+		}
+
+		bool findPage(uint64_t generation, PatchFilter const& filter, int skip, int limit, PatchPageToken const* after, std::vector<PatchHolder>& outPatches, PatchPageToken* outNext) {
+			std::vector<CachedPatch> cached;
+			if (!find(generation, after ? Kind::KEYSET_PAGE : Kind::OFFSET_PAGE, filter, skip, limit, after, [&cached, outNext](Entry const& entry) {
+				cached = entry.patches;
+				if (outNext) {
+					*outNext = entry.next;
+				}
+				})) {
+				return false;
+			}
+			outPatches.clear();
+			outPatches.reserve(cached.size());
+			for (auto const& patch : cached) {
+				outPatches.push_back(attach(patch));
+			}
+			return true;
+		}
+
+		void putCount(uint64_t generation, PatchFilter const& filter, int count) {
+			Entry entry{ Kind::COUNT, PatchFilterHash()(filter), generation, filter, 0, 0, {}, count, {}, {} };
+			put(std::move(entry));
+		}
+
+		void putPage(uint64_t generation, PatchFilter const& filter, int skip, int limit, PatchPageToken const* after, std::vector<PatchHolder> const& patches, PatchPageToken const* next) {
+			if (patches.size() > kMaxCachedPatches) {
+				// Don't keep a copy of a whole library around
+				return;
+			}
+			std::vector<CachedPatch> cached;
+			cached.reserve(patches.size());
+			for (auto const& patch : patches) {
+				if (!patch.patch()) {
+					return;
+				}
+				cached.push_back(detach(patch));
+			}
+			Entry entry{ after ? Kind::KEYSET_PAGE : Kind::OFFSET_PAGE, PatchFilterHash()(filter), generation, filter, skip, limit, after ? *after : PatchPageToken(), 0, std::move(cached), next ? *next : PatchPageToken() };
+			put(std::move(entry));
+		}
+
+	private:
+		static const size_t kMaxCachedPatches = 5000;
+
+		// Callers change the patches they get, e.g. setName() pokes the name into the DataFile. So the cache keeps a copy of the bytes only,
+		// and every result gets DataFiles of its own, created from them on first access
+		struct CachedPatch {
+			PatchHolder holder;
+			std::shared_ptr<Synth::PatchData const> data;
+			std::string md5;
+		};
+
+		static void makeLazy(PatchHolder& holder, std::shared_ptr<Synth::PatchData const> data, std::string const& md5) {
+			auto synth = holder.smartSynth();
+			auto program = holder.patchNumber();
+			holder.setLazyPatch([synth, data, program]() -> std::shared_ptr<DataFile> {
+				return synth ? synth->patchFromPatchData(*data, program) : nullptr;
+				}, md5);
+		}
+
+		static CachedPatch detach(PatchHolder const& patch) {
+			CachedPatch cached{ patch, std::make_shared<Synth::PatchData const>(patch.patch()->data()), patch.md5() };
+			// Don't keep the caller's DataFile alive
+			makeLazy(cached.holder, cached.data, cached.md5);
+			return cached;
+		}
+
+		static PatchHolder attach(CachedPatch const& cached) {
+			PatchHolder result = cached.holder;
+			makeLazy(result, cached.data, cached.md5);
+			return result;
+		}
+
+		struct Entry {
+			Kind kind;
+			size_t hash;
+			uint64_t generation;
+			PatchFilter filter;
+			int skip;
+			int limit;
+			PatchPageToken after;
+			int count;
+			std::vector<CachedPatch> patches;
+			PatchPageToken next;
+		};
+
+		static bool sameToken(PatchPageToken const& a, PatchPageToken const& b) {
+			return a.ordering == b.ordering && a.lastKey == b.lastKey && a.atEnd == b.atEnd;
+		}
+
+		// The result is copied out by use while the lock is held
+		bool find(uint64_t generation, Kind kind, PatchFilter const& filter, int skip, int limit, PatchPageToken const* after, std::function<void(Entry const&)> const& use) {
+			size_t hash = PatchFilterHash()(filter);
+			ScopedLock lock(lock_);
+			for (auto entry = entries_.begin(); entry != entries_.end(); entry++) {
+				if (entry->hash == hash && entry->kind == kind && entry->skip == skip && entry->limit == limit && entry->filter == filter && (!after || sameToken(entry->after, *after))) {
+					if (entry->generation != generation) {
+						entries_.erase(entry);
+						return false;
+					}
+					// Most recently used goes to the front
+					entries_.splice(entries_.begin(), entries_, entry);
+					use(entries_.front());
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void put(Entry&& entry) {
+			ScopedLock lock(lock_);
+			if (maxEntries_ == 0) {
+				return;
+			}
+			entries_.push_front(std::move(entry));
+			trim();
+		}
+
+		void trim() {
+			while (entries_.size() > maxEntries_) {
+				entries_.pop_back();
+			}
+		}
+
+		size_t maxEntries_;
+		std::list<Entry> entries_;
+		CriticalSection lock_;
+	};
+
+	// Keeps prepared statements alive keyed by their SQL text, so the hot queries are compiled only once per database connection.
+	// Filter queries put their IN lists into the SQL, so there are many different texts. Only the most recently used are kept
+	class StatementCache {
+	private:
+		struct Entry {
+			std::unique_ptr<SQLite::Statement> statement;
+			bool inUse;
+			uint64_t lastUsed;
+		};
+
+	public:
+		// Handed out by acquire(), resets the statement and returns it to the cache when going out of scope
+		class CachedStatement {
+		public:
+			CachedStatement(StatementCache* cache, Entry* entry) : cache_(cache), entry_(entry), statement_(entry->statement.get()) {}
+			explicit CachedStatement(std::unique_ptr<SQLite::Statement> uncached) : cache_(nullptr), entry_(nullptr), owned_(std::move(uncached)), statement_(owned_.get()) {}
+			CachedStatement(CachedStatement&& other) noexcept : cache_(other.cache_), entry_(other.entry_), owned_(std::move(other.owned_)), statement_(other.statement_) {
+				other.cache_ = nullptr;
+				other.entry_ = nullptr;
+				other.statement_ = nullptr;
+			}
+			CachedStatement(CachedStatement const&) = delete;
+			CachedStatement& operator=(CachedStatement const&) = delete;
+			~CachedStatement() {
+				if (cache_ && entry_) {
+					cache_->release(entry_);
+				}
+			}
+
+			SQLite::Statement* operator->() const { return statement_; }
+			SQLite::Statement& operator*() const { return *statement_; }
+
+		private:
+			StatementCache* cache_;
+			Entry* entry_;
+			std::unique_ptr<SQLite::Statement> owned_;
+			SQLite::Statement* statement_;
+		};
+
+		static const size_t kDefaultMaxEntries = 64;
+
+		explicit StatementCache(SQLite::Database& db, size_t maxEntries = kDefaultMaxEntries) : db_(db), maxEntries_(std::max((size_t)1, maxEntries)), useCounter_(0), hits_(0), misses_(0) {}
+
+		CachedStatement acquire(std::string const& sql) {
+			ScopedLock lock(lock_);
+			auto found = cache_.find(sql);
+			if (found != cache_.end()) {
+				if (!found->second.inUse) {
+					hits_++;
+					found->second.inUse = true;
+					found->second.lastUsed = ++useCounter_;
+					return CachedStatement(this, &found->second);
+				}
+				// The same statement is already in use (nested or from another thread), use a throw away statement
+				misses_++;
+				return CachedStatement(std::make_unique<SQLite::Statement>(db_, sql));
+			}
+			misses_++;
+			// Compile first, so a failing statement does not leave an empty entry behind
+			auto statement = std::make_unique<SQLite::Statement>(db_, sql);
+			if (cache_.size() >= maxEntries_ && !evictLeastRecentlyUsed()) {
+				// All are in use, don't grow beyond the limit
+				return CachedStatement(std::move(statement));
+			}
+			auto& entry = cache_[sql];
+			entry.statement = std::move(statement);
+			entry.inUse = true;
+			entry.lastUsed = ++useCounter_;
+			return CachedStatement(this, &entry);
+		}
+
+		void clear() {
+			ScopedLock lock(lock_);
+			for (auto it = cache_.begin(); it != cache_.end(); ) {
+				if (!it->second.inUse) {
+					it = cache_.erase(it);
+				}
+				else {
+					it++;
+				}
+			}
+		}
+
+		PatchDatabase::StatementCacheStatistics statistics() const {
+			ScopedLock lock(lock_);
+			return { hits_, misses_, cache_.size() };
+		}
+
+	private:
+		bool evictLeastRecentlyUsed() {
+			// A linear scan, but only on a miss, which has to compile a statement anyway
+			auto oldest = cache_.end();
+			for (auto it = cache_.begin(); it != cache_.end(); it++) {
+				if (!it->second.inUse && (oldest == cache_.end() || it->second.lastUsed < oldest->second.lastUsed)) {
+					oldest = it;
+				}
+			}
+			if (oldest == cache_.end()) {
+				return false;
+			}
+			cache_.erase(oldest);
+			return true;
+		}
+
+		void release(Entry* entry) {
+			ScopedLock lock(lock_);
+			try {
+				// Make sure the statement does not hold any read lock on the database and carries no values into the next use
+				entry->statement->reset();
+				entry->statement->clearBindings();
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR resetting cached statement: SQL Exception {}", ex.what());
+			}
+			entry->inUse = false;
+		}
+
+		SQLite::Database& db_;
+		std::map<std::string, Entry> cache_;
+		size_t maxEntries_;
+		uint64_t useCounter_;
+		size_t hits_;
+		size_t misses_;
+		CriticalSection lock_;
+	};
+
+	// Serializes the writes to the writer connection. The UI thread, the write behind queue and the import pipeline all write through the same connection,
+	// without this a statement of one would end up inside the transaction of another. Reentrant, so a write can call other writes
+	class WriterLock {
+	public:
+		WriterLock() : depth_(0), transactions_(0) {}
+
+		void lock() {
+			mutex_.lock();
+			if (depth_++ == 0) {
+				owner_ = std::this_thread::get_id();
+			}
+		}
+
+		bool try_lock() {
+			if (!mutex_.try_lock()) {
+				return false;
+			}
+			if (depth_++ == 0) {
+				owner_ = std::this_thread::get_id();
+			}
+			return true;
+		}
+
+		void unlock() {
+			if (--depth_ == 0) {
+				owner_ = std::thread::id();
+			}
+			mutex_.unlock();
+		}
+
+		bool isHeldByCurrentThread() const {
+			return owner_.load() == std::this_thread::get_id();
+		}
+
+	private:
+		friend class WriteTransaction;
+
+		std::recursive_mutex mutex_;
+		std::atomic<std::thread::id> owner_;
+		int depth_;
+		int transactions_; // Open WriteTransactions of the owner, only touched while holding the lock
+	};
+
+	// Use this instead of SQLite::Transaction for all writes. Holds the writer lock until it is done, and inside another write transaction 
+	// of the same thread it becomes a savepoint, so functions doing their own transaction can be combined into a bigger one
+	class WriteTransaction {
+	public:
+		WriteTransaction(WriterLock& lock, SQLite::Database& db) : lock_(lock), db_(db), committed_(false) {
+			std::unique_lock<WriterLock> guard(lock_);
+			level_ = lock_.transactions_;
+			db_.exec(level_ == 0 ? std::string("BEGIN") : fmt::format("SAVEPOINT write_{}", level_));
+			lock_.transactions_++;
+			guard.release();
+		}
+
+		WriteTransaction(WriteTransaction const&) = delete;
+		WriteTransaction& operator=(WriteTransaction const&) = delete;
+
+		~WriteTransaction() {
+			if (!committed_) {
+				try {
+					if (level_ == 0) {
+						db_.exec("ROLLBACK");
+					}
+					else {
+						db_.exec(fmt::format("ROLLBACK TO write_{}", level_));
+						db_.exec(fmt::format("RELEASE write_{}", level_));
+					}
+				}
+				catch (SQLite::Exception& ex) {
+					spdlog::error("DATABASE ERROR rolling back transaction: SQL Exception {}", ex.what());
+				}
+				lock_.transactions_--;
+			}
+			lock_.unlock();
+		}
+
+		void commit() {
+			if (committed_) {
+				throw SQLite::Exception("Program error - transaction already committed");
+			}
+			db_.exec(level_ == 0 ? std::string("COMMIT") : fmt::format("RELEASE write_{}", level_));
+			committed_ = true;
+			lock_.transactions_--;
+		}
+
+	private:
+		WriterLock& lock_;
+		SQLite::Database& db_;
+		int level_;
+		bool committed_;
+	};
+
+	static std::string synchronousPragma(DatabasePerformanceProfile::Synchronous synchronous) {
+		switch (synchronous) {
+		case DatabasePerformanceProfile::Synchronous::OFF: return "PRAGMA synchronous = OFF";
+		case DatabasePerformanceProfile::Synchronous::NORMAL: return "PRAGMA synchronous = NORMAL";
+		case DatabasePerformanceProfile::Synchronous::FULL: return "PRAGMA synchronous = FULL";
+		case DatabasePerformanceProfile::Synchronous::EXTRA: return "PRAGMA synchronous = EXTRA";
+		}
+		return "PRAGMA synchronous = FULL";
+	}
+
+	// The per connection part of the profile, none of this is persisted in the database file
+	static void applyConnectionProfile(SQLite::Database& db, DatabasePerformanceProfile const& profile) {
+		try {
+			// Negative means KiB instead of pages
+			db.exec(fmt::format("PRAGMA cache_size = -{}", std::max(0, profile.cacheSizeKiB)));
+			db.exec(fmt::format("PRAGMA mmap_size = {}", std::max((int64_t)0, profile.mmapSizeBytes)));
+			db.exec(profile.tempStoreInMemory ? "PRAGMA temp_store = MEMORY" : "PRAGMA temp_store = DEFAULT");
+			db.exec(fmt::format("PRAGMA analysis_limit = {}", kAnalysisLimit));
+		}
+		catch (SQLite::Exception& ex) {
+			spdlog::warn("Failed to apply the performance settings to the database connection: {}", ex.what());
+		}
+	}
+
+	// A small pool of read-only connections to the same database file. With WAL journaling, these can read while the writer connection
+	// is inside a long transaction. When no reader can be opened or all are busy, the writer connection is used instead. So is it for the thread
+	// holding the writer lock, the readers can't see the transaction that thread has not committed yet
+	class ReaderPool {
+	private:
+		struct Reader {
+			std::unique_ptr<SQLite::Database> db;
+			std::unique_ptr<StatementCache> statements; // Declared after db, so it is destroyed first
+			bool inUse;
+		};
+
+	public:
+		class ReadConnection {
+		public:
+			ReadConnection(ReaderPool* pool, Reader* reader) : pool_(pool), reader_(reader), db_(reader->db.get()), statements_(reader->statements.get()) {}
+			ReadConnection(SQLite::Database& writer, StatementCache& writerStatements) : pool_(nullptr), reader_(nullptr), db_(&writer), statements_(&writerStatements) {}
+			ReadConnection(ReadConnection&& other) noexcept : pool_(other.pool_), reader_(other.reader_), db_(other.db_), statements_(other.statements_) {
+				other.pool_ = nullptr;
+				other.reader_ = nullptr;
+			}
+			ReadConnection(ReadConnection const&) = delete;
+			ReadConnection& operator=(ReadConnection const&) = delete;
+			~ReadConnection() {
+				if (pool_ && reader_) {
+					pool_->release(reader_);
+				}
+			}
+
+			SQLite::Database& db() const { return *db_; }
+			StatementCache& statements() const { return *statements_; }
+
+		private:
+			ReaderPool* pool_;
+			Reader* reader_;
+			SQLite::Database* db_;
+			StatementCache* statements_;
+		};
+
+		ReaderPool(SQLite::Database& writer, StatementCache& writerStatements, WriterLock const& writerLock, size_t maxReaders, DatabasePerformanceProfile const& profile) : writer_(writer), 
+			writerStatements_(writerStatements), writerLock_(writerLock), maxReaders_(maxReaders), profile_(profile), disabled_(false) {
+			// A second connection to an in-memory database would see a different, empty database
+			if (writer_.getFilename().empty() || writer_.getFilename() == ":memory:") {
+				disabled_ = true;
+			}
+		}
+
+		ReadConnection acquire() {
+			if (writerLock_.isHeldByCurrentThread()) {
+				// This thread is in the middle of a write, only the writer connection sees what it has written so far
+				return ReadConnection(writer_, writerStatements_);
+			}
+			ScopedLock lock(lock_);
+			if (!disabled_) {
+				for (auto& reader : readers_) {
+					if (!reader->inUse) {
+						reader->inUse = true;
+						return ReadConnection(this, reader.get());
+					}
+				}
+				if (readers_.size() < maxReaders_) {
+					try {
+						auto reader = std::make_unique<Reader>();
+						reader->db = std::make_unique<SQLite::Database>(writer_.getFilename(), SQLite::OPEN_READONLY);
+						applyConnectionProfile(*reader->db, profile_);
+						sqlite3_progress_handler(reader->db->getHandle(), 1000, queryProgressHandler, nullptr);
+						reader->statements = std::make_unique<StatementCache>(*reader->db);
+						reader->inUse = true;
+						readers_.push_back(std::move(reader));
+						return ReadConnection(this, readers_.back().get());
+					}
+					catch (SQLite::Exception& ex) {
+						spdlog::warn("Could not open additional read connection to database, using the main connection: {}", ex.what());
+						disabled_ = true;
+					}
+				}
+			}
+			return ReadConnection(writer_, writerStatements_);
+		}
+
+	private:
+		void release(Reader* reader) {
+			ScopedLock lock(lock_);
+			reader->inUse = false;
+		}
+
+		SQLite::Database& writer_;
+		StatementCache& writerStatements_;
+		WriterLock const& writerLock_;
+		size_t maxReaders_;
+		DatabasePerformanceProfile profile_;
+		bool disabled_;
+		std::vector<std::unique_ptr<Reader>> readers_;
+		CriticalSection lock_;
+	};
+
+	// Copies the database file a few pages at a time using an extra connection, pausing between the steps so the application's own connections
+	// are never locked out for long. Should the database be written to during the backup, sqlite restarts the copy by itself. After maxRestarts of those
+	// the rest is copied in one step while holding the writer lock, so a steady stream of writes can't keep the backup from ever finishing.
+	// The copy goes to a temporary file first, so an aborted backup never looks like a complete one
+	class BackgroundBackup : public Thread {
+	public:
+		BackgroundBackup(File databaseFile, File backupFile, int pagesPerStep, int pauseMilliseconds, int maxRestarts, WriterLock& writerLock, std::function<void(bool)> finished) :
+			Thread("DatabaseBackup"), databaseFile_(databaseFile), backupFile_(backupFile), pagesPerStep_(pagesPerStep), pauseMilliseconds_(pauseMilliseconds),
+			maxRestarts_(maxRestarts), writerLock_(writerLock), finished_(finished)
+		{
+		}
+
+		~BackgroundBackup() override {
+			stopThread(5000);
+		}
+
+		void run() override {
+			File partialFile = backupFile_.withFileExtension(backupFile_.getFileExtension() + ".partial");
+			bool success = false;
+			try {
+				SQLite::Database source(databaseFile_.getFullPathName().toStdString().c_str(), SQLite::OPEN_READONLY);
+				SQLite::Database destination(partialFile.getFullPathName().toStdString().c_str(), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+				SQLite::Backup backup(destination, source);
+				int result;
+				int restarts = 0;
+				int remaining = -1;
+				do {
+					result = backup.executeStep(pagesPerStep_);
+					// More pages left than before the step means a write made sqlite start over
+					int nowRemaining = backup.getRemainingPageCount();
+					if (remaining >= 0 && nowRemaining > remaining) {
+						restarts++;
+					}
+					remaining = nowRemaining;
+					if (result != SQLITE_DONE && restarts >= maxRestarts_) {
+						spdlog::debug("Background backup restarted {} times by writes, finishing it while holding off writes", restarts);
+						while (!threadShouldExit() && !writerLock_.try_lock()) {
+							wait(pauseMilliseconds_);
+						}
+						if (!threadShouldExit()) {
+							std::unique_lock<WriterLock> holdWrites(writerLock_, std::adopt_lock);
+							result = backup.executeStep(-1);
+						}
+						break;
+					}
+					if (result != SQLITE_DONE) {
+						wait(pauseMilliseconds_);
+					}
+				} while (result != SQLITE_DONE && !threadShouldExit());
+				success = result == SQLITE_DONE;
+			}
+			catch (SQLite::Exception& e) {
+				spdlog::error("Background backup of database {} failed: {}", databaseFile_.getFullPathName(), e.what());
+			}
+			if (success) {
+				success = partialFile.moveFileTo(backupFile_);
+				if (success) {
+					spdlog::info("Database backed up to {}", backupFile_.getFullPathName());
+				}
+				else {
+					spdlog::error("Failed to rename background backup to {}, please check file permissions", backupFile_.getFullPathName());
+				}
+			}
+			if (!success) {
+				partialFile.deleteFile();
+			}
+			if (finished_) {
+				finished_(success);
+			}
+		}
+
+	private:
+		File databaseFile_;
+		File backupFile_;
+		int pagesPerStep_;
+		int pauseMilliseconds_;
+		int maxRestarts_;
+		WriterLock& writerLock_;
+		std::function<void(bool)> finished_;
+	};
 
-	const int SCHEMA_VERSION = 13;
-	/* History */
-	/* 1 - Initial schema */
-	/* 2 - adding hidden flag (aka deleted) */
-	/* 3 - adding type integer to patch (to differentiate voice, patch, layer, tuning...) */
-	/* 4 - forgot to migrate existing data NULL to 0 */
-	/* 5 - adding bank number column for better sorting of multi-imports */
-	/* 6 - adding the table categories to track which bit index is used for which tag */
-	/* 7 - adding the table lists to allow storing lists of patches */
-	/* 8 - adding synth name, timestamp and banknumber to patch list to allow store synth banks */
-	/* 9 - adding foreign key to make sure no patch is deleted that belongs to a list */
-	/* 10 - drop tables created by upgrade to 9, needing retry with database connection */
-	/* 11 - adding an index to speed up the duplicate name search, as suggested by chatGPT */
-	/* 12 - adding an index to speed up the import list building */
-	/* 13 - adding comment to the patch table */
+	// Refreshes the query planner statistics on an extra connection a while after the database has been opened, so opening never waits for it, 
+	// and then again at the interval given. ANALYZE is limited to sampling the indexes, and only runs when an index has no statistics yet, e.g. because
+	// a migration just created it. Otherwise PRAGMA optimize decides what needs a refresh. No VACUUM, that needs the database exclusively for as long as it takes to rewrite the whole file, and it would renumber the rows the full text index refers to
+	class BackgroundMaintenance : public Thread {
+	public:
+		BackgroundMaintenance(File databaseFile, int delayMilliseconds, int intervalMilliseconds) : Thread("DatabaseMaintenance"), databaseFile_(databaseFile), 
+			delayMilliseconds_(delayMilliseconds), intervalMilliseconds_(intervalMilliseconds), connection_(nullptr)
+		{
+		}
+
+		~BackgroundMaintenance() override {
+			signalThreadShouldExit();
+			notify();
+			{
+				ScopedLock lock(connectionLock_);
+				if (connection_) {
+					sqlite3_interrupt(connection_);
+				}
+			}
+			stopThread(5000);
+		}
+
+		void run() override {
+			wait(delayMilliseconds_);
+			while (!threadShouldExit()) {
+				runMaintenance();
+				if (intervalMilliseconds_ <= 0) {
+					break;
+				}
+				wait(intervalMilliseconds_);
+			}
+		}
+
+	private:
+		void runMaintenance() {
+			std::unique_ptr<SQLite::Database> db;
+			try {
+				db = std::make_unique<SQLite::Database>(databaseFile_.getFullPathName().toStdString().c_str(), SQLite::OPEN_READWRITE);
+				db->setBusyTimeout(kBusyTimeoutMilliseconds);
+				setConnection(db->getHandle());
+				auto startTime = Time::getMillisecondCounterHiRes();
+				db->exec(fmt::format("PRAGMA analysis_limit = {}", kAnalysisLimit));
+				if (!db->tableExists("sqlite_stat1") || hasIndexWithoutStatistics(*db)) {
+					db->exec("ANALYZE");
+				}
+				else {
+					db->exec("PRAGMA optimize");
+				}
+				SQLite::Statement pages(*db, "SELECT * FROM pragma_page_count, pragma_freelist_count");
+				if (pages.executeStep()) {
+					auto pageCount = pages.getColumn(0).getInt64();
+					auto freePages = pages.getColumn(1).getInt64();
+					if (pageCount > 0 && freePages * 4 > pageCount) {
+						spdlog::info("{} of {} pages of the database are unused, sqlite will fill them up again before the file grows", freePages, pageCount);
+					}
+				}
+				spdlog::debug("Database maintenance took {:.0f} ms", Time::getMillisecondCounterHiRes() - startTime);
+			}
+			catch (SQLite::Exception& e) {
+				if (!threadShouldExit()) {
+					spdlog::warn("Background maintenance of database {} failed: {}", databaseFile_.getFullPathName(), e.what());
+				}
+			}
+			setConnection(nullptr);
+		}
+
+		static bool hasIndexWithoutStatistics(SQLite::Database& db) {
+			// Empty tables never get statistics, but analyzing them again costs nothing
+			SQLite::Statement query(db, "SELECT 1 FROM sqlite_master WHERE type = 'index' AND NOT EXISTS (SELECT 1 FROM sqlite_stat1 WHERE sqlite_stat1.idx = sqlite_master.name) LIMIT 1");
+			return query.executeStep();
+		}
+
+		void setConnection(sqlite3* connection) {
+			ScopedLock lock(connectionLock_);
+			connection_ = connection;
+		}
+
+		File databaseFile_;
+		int delayMilliseconds_;
+		int intervalMilliseconds_;
+		CriticalSection connectionLock_;
+		sqlite3* connection_; // While open, so the destructor can interrupt a running statement
+	};
 
 	class PatchDatabase::PatchDataBaseImpl {
 	public:
-		PatchDataBaseImpl(std::string const& databaseFile, OpenMode mode)
+		PatchDataBaseImpl(std::string const& databaseFile, OpenMode mode, DatabasePerformanceProfile const& profile)
 			: db_(databaseFile.c_str(), mode == OpenMode::READ_ONLY ? SQLite::OPEN_READONLY : (SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)), bitfield({}),
-			mode_(mode)
+			mode_(mode), profile_(profile), categoryTableVersion_(1), categoryCacheVersion_(0), hasFullTextIndex_(false), statements_(db_), readers_(db_, statements_, writer_, 3, profile),
+			patchesVersion_(0), metadataIndexEnabled_(true), dataCompressionEnabled_(true), writeGeneration_(0), resultCache_(kResultCacheEntries)
 		{
+			File dbFile(db_.getFilename());
+			modifiedAtOpen_ = lastModificationTime(dbFile);
+			db_.setBusyTimeout(kBusyTimeoutMilliseconds);
+			if (mode_ != OpenMode::READ_ONLY && !db_.tableExists("patches")) {
+				// Has to be set before the first table is created, after that it would take a VACUUM to change
+				db_.exec(fmt::format("PRAGMA page_size = {}", profile_.pageSize));
+			}
+			applyConnectionProfile(db_, profile_);
+			enableWriteAheadLog();
 			createSchema();
-			manageBackupDiskspace(kDataBaseBackupSuffix);
-			categoryDefinitions_ = getCategories();
+			createFullTextIndex();
+			// Unlike sqlite3_interrupt this only affects the thread that installed a ScopedQueryCancellation, not all statements of the connection
+			sqlite3_progress_handler(db_.getHandle(), 1000, queryProgressHandler, nullptr);
+			manageBackupDiskspace(dbFile, kDataBaseBackupSuffix, kMaxBackupBytes, kMinBackupsKept);
+			getCategories();
+			if (mode_ != OpenMode::READ_ONLY && dbFile.existsAsFile()) {
+				backgroundMaintenance_ = std::make_unique<BackgroundMaintenance>(dbFile, kMaintenanceDelayMilliseconds, std::max(0, profile_.optimizeIntervalMinutes) * 60000);
+				backgroundMaintenance_->startThread(Thread::Priority::low);
+			}
 		}
 
 		~PatchDataBaseImpl() {
+			backgroundMaintenance_.reset();
+			if (mode_ != OpenMode::READ_ONLY) {
+				// Recommended before closing, it looks at what the queries of this session would have needed
+				try {
+					db_.exec("PRAGMA optimize");
+				}
+				catch (SQLite::Exception& ex) {
+					spdlog::warn("PRAGMA optimize failed when closing the database: {}", ex.what());
+				}
+			}
+			// An unfinished background backup is abandoned, the full backup below supersedes it anyway
+			backgroundBackup_.reset();
 			// Only make the automatic database backup when we are not in read only mode, else there is nothing to backup
 			if (mode_ == OpenMode::READ_WRITE) {
-				PatchDataBaseImpl::makeDatabaseBackup(kDataBaseBackupSuffix);
+				if (isLatestBackupCurrent()) {
+					spdlog::info("Database unchanged since the last backup, not making another one");
+				}
+				else {
+					PatchDataBaseImpl::makeDatabaseBackup(kDataBaseBackupSuffix);
+				}
+			}
+		}
+
+		static Time lastModificationTime(File const& databaseFile) {
+			// With WAL, recent writes might only be in the -wal file next to the database
+			auto result = databaseFile.getLastModificationTime();
+			File wal(databaseFile.getFullPathName() + "-wal");
+			if (wal.existsAsFile()) {
+				result = std::max(result, wal.getLastModificationTime());
+			}
+			return result;
+		}
+
+		bool isLatestBackupCurrent() {
+			// Nothing was written through this connection, the migrations and the categories created on open included, and the newest backup
+			// was made after the last write of an earlier session. Else there might be changes a crashed session never backed up
+			if (sqlite3_total_changes(db_.getHandle()) != 0) {
+				return false;
 			}
+			File dbFile(db_.getFilename());
+			if (!dbFile.existsAsFile()) {
+				return false;
+			}
+			auto backups = dbFile.getParentDirectory().findChildFiles(File::TypesOfFileToFind::findFiles, false, dbFile.getFileNameWithoutExtension() + kDataBaseBackupSuffix + "*" + dbFile.getFileExtension());
+			for (auto const& backup : backups) {
+				if (backup.getLastModificationTime() >= modifiedAtOpen_) {
+					return true;
+				}
+			}
+			return false;
 		}
 
 		std::string makeDatabaseBackup(String const& suffix) {
@@ -97,6 +1152,34 @@ namespace midikraft {
 			db.backup(backupFile.getFullPathName().toStdString().c_str(), SQLite::Database::Save);
 		}
 
+		bool startBackgroundBackup(String const& suffix, int minBackupsKept, size_t maxBackupBytes) {
+			File dbFile(db_.getFilename());
+			if (!dbFile.existsAsFile()) {
+				// In memory database, nothing to copy
+				return false;
+			}
+			if (isBackgroundBackupRunning()) {
+				spdlog::warn("Background backup already in progress, not starting another one");
+				return false;
+			}
+			// 256 pages are 1 MB with the default page size, with a short break after each step the copy won't compete with the UI for the database
+			const int kPagesPerStep = 256;
+			const int kPauseMilliseconds = 5;
+			const int kMaxRestarts = 3;
+			File backupCopy(dbFile.getParentDirectory().getNonexistentChildFile(dbFile.getFileNameWithoutExtension() + suffix, dbFile.getFileExtension(), false));
+			backgroundBackup_ = std::make_unique<BackgroundBackup>(dbFile, backupCopy, kPagesPerStep, kPauseMilliseconds, kMaxRestarts, writer_, [dbFile, suffix, minBackupsKept, maxBackupBytes](bool success) {
+				if (success) {
+					manageBackupDiskspace(dbFile, suffix, maxBackupBytes, (size_t) std::max(1, minBackupsKept));
+				}
+			});
+			backgroundBackup_->startThread();
+			return true;
+		}
+
+		bool isBackgroundBackupRunning() const {
+			return backgroundBackup_ && backgroundBackup_->isThreadRunning();
+		}
+
 		void backupIfNecessary(bool& done) {
 			if (!done && mode_ == PatchDatabase::OpenMode::READ_WRITE) {
 				makeDatabaseBackup("-before-migration");
@@ -105,9 +1188,8 @@ namespace midikraft {
 		}
 
 		//TODO a better strategy than the last 3 backups would be to group by week, month, to keep older ones
-		void manageBackupDiskspace(String suffix) {
-			// Build a list of all backups on disk and calculate the size of it. Do not keep more than 500 mio bytes or the last 3 copies if they together make up more than 500 mio bytes
-			File activeDBFile(db_.getFilename());
+		static void manageBackupDiskspace(File activeDBFile, String suffix, size_t maxBackupBytes, size_t minBackupsKept) {
+			// Build a list of all backups on disk and calculate the size of it. Do not keep more than maxBackupBytes, but at least the last minBackupsKept copies
 			File backupDirectory(activeDBFile.getParentDirectory());
 			auto backupsFiles = backupDirectory.findChildFiles(File::TypesOfFileToFind::findFiles, false, activeDBFile.getFileNameWithoutExtension() + suffix + "*" + activeDBFile.getFileExtension());
 			size_t backupSize = 0;
@@ -118,7 +1200,7 @@ namespace midikraft {
 			backupsFiles.sort(sortComperator, false);
 			for (auto file : backupsFiles) {
 				backupSize += file.getSize();
-				if (backupSize > 500000000 && numKept > 2) {
+				if (backupSize > maxBackupBytes && numKept >= minBackupsKept) {
 					//SimpleLogger::instance()->postMessage("Removing database backup file to keep disk space used below 50 million bytes: " + file.getFullPathName());
 					if (!file.deleteFile()) {
 						spdlog::error("Error - failed to remove extra backup file, please check file permissions: {}", file.getFullPathName());
@@ -156,35 +1238,35 @@ namespace midikraft {
 
 			if (currentVersion < 2) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				db_.exec("ALTER TABLE patches ADD COLUMN hidden INTEGER");
 				db_.exec("UPDATE schema_version SET number = 2");
 				transaction.commit();
 			}
 			if (currentVersion < 3) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				db_.exec("ALTER TABLE patches ADD COLUMN type INTEGER");
 				db_.exec("UPDATE schema_version SET number = 3");
 				transaction.commit();
 			}
 			if (currentVersion < 4) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				db_.exec("UPDATE patches SET type = 0 WHERE type is NULL");
 				db_.exec("UPDATE schema_version SET number = 4");
 				transaction.commit();
 			}
 			if (currentVersion < 5) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				db_.exec("ALTER TABLE patches ADD COLUMN midiBankNo INTEGER");
 				db_.exec("UPDATE schema_version SET number = 5");
 				transaction.commit();
 			}
 			if (currentVersion < 6) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				if (!db_.tableExists("categories")) {
 					//TODO This code should actually never be executed, because the createSchema() already has created the table. Create Table statements don't belong into the migrteSchema method
 					db_.exec("CREATE TABLE categories (bitIndex INTEGER UNIQUE, name TEXT, color TEXT, active INTEGER)");
@@ -195,7 +1277,7 @@ namespace midikraft {
 			}
 			if (currentVersion < 7) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				if (!db_.tableExists("lists")) {
 					db_.exec("CREATE TABLE IF NOT EXISTS lists(id TEXT PRIMARY KEY, name TEXT NOT NULL)");
 				}
@@ -210,7 +1292,7 @@ namespace midikraft {
 			}
 			if (currentVersion < 8) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				try {
 					db_.exec("ALTER TABLE lists ADD COLUMN synth TEXT");
 					db_.exec("ALTER TABLE lists ADD COLUMN midi_bank_number INTEGER");
@@ -225,7 +1307,7 @@ namespace midikraft {
 			if (currentVersion < 9) {
 				backupIfNecessary(hasBackuped);
 				db_.exec("PRAGMA foreign_keys = OFF");
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				auto table1 = migrateTable("patches", std::bind(&PatchDataBaseImpl::createPatchTable, this),
 					{ "synth", "md5", "name", "data", "favorite", "sourceID", "sourceName", "sourceInfo", "midiProgramNo", "categories", "categoryUserDecision", "hidden", "type", "midiBankNo" });
 				auto table2 = migrateTable("patch_in_list", std::bind(&PatchDataBaseImpl::createPatchInListTable, this),
@@ -243,11 +1325,11 @@ namespace midikraft {
 				db_.exec(fmt::format("DROP TABLE IF EXISTS {}", "patch_in_list_old").c_str());
 				db_.exec("UPDATE schema_version SET number = 10");
 				db_.exec("PRAGMA foreign_keys = ON");
-				db_.exec("VACUUM");
+				// No VACUUM here - on large databases it blocks the startup for a long time, and sqlite will reuse the free pages anyway
 			}
 			if (currentVersion < 11) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				/// These can't be deleted within a transaction
 				db_.exec("CREATE INDEX IF NOT EXISTS patch_synth_name_idx ON patches (synth, name)");
 				db_.exec("UPDATE schema_version SET number = 11");
@@ -255,7 +1337,7 @@ namespace midikraft {
 			}
 			if (currentVersion < 12) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				/// These can't be deleted within a transaction
 				db_.exec("CREATE INDEX IF NOT EXISTS patch_sourceid_idx ON patches (sourceID)");
 				db_.exec("UPDATE schema_version SET number = 12");
@@ -263,13 +1345,124 @@ namespace midikraft {
 			}
 			if (currentVersion < 13) {
 				backupIfNecessary(hasBackuped);
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				if (!hasRecreatedPatchTable) {
 					db_.exec("ALTER TABLE patches ADD COLUMN comment TEXT");
 				}
 				db_.exec("UPDATE schema_version SET number = 13");
 				transaction.commit();
 			}
+			if (currentVersion < 14) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createPatchCategoryTable();
+				// Fill the new table from the bitfields stored with each patch
+				db_.exec("DELETE FROM patch_category");
+				db_.exec("WITH RECURSIVE bits(bit) AS (SELECT 0 UNION ALL SELECT bit + 1 FROM bits WHERE bit < 62) "
+					"INSERT INTO patch_category (synth, md5, bitIndex) SELECT patches.synth, patches.md5, bits.bit FROM patches JOIN bits ON (patches.categories >> bits.bit) & 1 == 1");
+				db_.exec("UPDATE schema_version SET number = 14");
+				transaction.commit();
+			}
+			if (currentVersion < 15) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				// List order keys are now sparse, so inserts and moves only need to update a single row. Spread out the existing dense numbers
+				db_.exec("CREATE INDEX IF NOT EXISTS patch_in_list_order_idx ON patch_in_list (id, order_num)");
+				db_.exec(fmt::format("UPDATE patch_in_list SET order_num = order_num * {}", kListOrderGap).c_str());
+				db_.exec("UPDATE schema_version SET number = 15");
+				transaction.commit();
+			}
+			if (currentVersion < 16) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createImportedFilesTable();
+				db_.exec("UPDATE schema_version SET number = 16");
+				transaction.commit();
+			}
+			if (currentVersion < 17) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createNameCountTable();
+				db_.exec("DELETE FROM name_counts");
+				db_.exec("INSERT INTO name_counts (synth, name, count) SELECT synth, name, COUNT(*) FROM patches WHERE name IS NOT NULL GROUP BY synth, name");
+				db_.exec("UPDATE schema_version SET number = 17");
+				transaction.commit();
+			}
+			if (currentVersion < 18) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createChangeJournal();
+				db_.exec("UPDATE schema_version SET number = 18");
+				transaction.commit();
+			}
+			if (currentVersion < 19) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				// Existing rows stay raw until they are rewritten
+				if (!hasRecreatedPatchTable) {
+					db_.exec("ALTER TABLE patches ADD COLUMN data_encoding INTEGER");
+				}
+				db_.exec("UPDATE schema_version SET number = 19");
+				transaction.commit();
+			}
+			if (currentVersion < 20) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				if (!hasRecreatedPatchTable) {
+					db_.exec("ALTER TABLE patches ADD COLUMN blob_hash TEXT");
+				}
+				createBlobTable();
+				moveDataIntoBlobs();
+				db_.exec("UPDATE schema_version SET number = 20");
+				transaction.commit();
+			}
+			if (currentVersion < 21) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createImportCountTable();
+				db_.exec("DELETE FROM import_counts");
+				db_.exec("INSERT INTO import_counts (synth, import_id, count) SELECT synth, sourceID, COUNT(*) FROM patches WHERE sourceID IS NOT NULL GROUP BY synth, sourceID");
+				db_.exec("UPDATE schema_version SET number = 21");
+				transaction.commit();
+			}
+			if (currentVersion < 22) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createOrderingIndexes();
+				db_.exec("UPDATE schema_version SET number = 22");
+				transaction.commit();
+			}
+			if (currentVersion < 23) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				// The old rows don't say which synth they were imported for. This only means the files are read once more on the next import of their folder
+				db_.exec("DROP TABLE IF EXISTS imported_files");
+				createImportedFilesTable();
+				db_.exec("UPDATE schema_version SET number = 23");
+				transaction.commit();
+			}
+			if (currentVersion < 24) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				// Same names, new expressions, so they need to be dropped to be created again
+				db_.exec("DROP INDEX IF EXISTS patch_order_import_idx");
+				db_.exec("DROP INDEX IF EXISTS patch_order_name_idx");
+				db_.exec("DROP INDEX IF EXISTS patch_order_program_idx");
+				db_.exec("DROP INDEX IF EXISTS patch_order_bank_idx");
+				createOrderingIndexes();
+				db_.exec("UPDATE schema_version SET number = 24");
+				transaction.commit();
+			}
+			if (currentVersion < 25) {
+				backupIfNecessary(hasBackuped);
+				WriteTransaction transaction(writer_, db_);
+				createSyncedBanksTable();
+				// Best guess for banks synced before, their list content. The next sync replaces it
+				db_.exec("INSERT OR IGNORE INTO synced_banks (id, position, md5) SELECT pil.id, ROW_NUMBER() OVER(PARTITION BY pil.id ORDER BY pil.order_num) - 1, pil.md5 "
+					"FROM patch_in_list AS pil JOIN lists ON lists.id = pil.id WHERE lists.last_synced IS NOT NULL AND lists.last_synced > 0");
+				db_.exec("UPDATE schema_version SET number = 25");
+				transaction.commit();
+			}
 		}
 
 		void insertDefaultCategories() {
@@ -292,19 +1485,206 @@ namespace midikraft {
 
 		void createPatchTable() {
 			db_.exec("CREATE TABLE IF NOT EXISTS patches (synth TEXT NOT NULL, md5 TEXT NOT NULL, name TEXT, type INTEGER, data BLOB, favorite INTEGER, hidden INTEGER, sourceID TEXT, sourceName TEXT,"
-				" sourceInfo TEXT, midiBankNo INTEGER, midiProgramNo INTEGER, categories INTEGER, categoryUserDecision INTEGER, comment TEXT, PRIMARY KEY (synth, md5))");
+				" sourceInfo TEXT, midiBankNo INTEGER, midiProgramNo INTEGER, categories INTEGER, categoryUserDecision INTEGER, comment TEXT, data_encoding INTEGER, blob_hash TEXT, PRIMARY KEY (synth, md5))");
+		}
+
+		void createBlobTable() {
+			// The sysex of the patches by hash of its content. A blob is deleted by the triggers as soon as no patch refers to it anymore
+			db_.exec("CREATE TABLE IF NOT EXISTS blobs(blob_hash TEXT PRIMARY KEY, blob_data BLOB NOT NULL, blob_encoding INTEGER NOT NULL)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_blob_idx ON patches (blob_hash)");
+			std::string release = "DELETE FROM blobs WHERE blob_hash = old.blob_hash AND NOT EXISTS (SELECT 1 FROM patches WHERE blob_hash = old.blob_hash); ";
+			db_.exec("CREATE TRIGGER IF NOT EXISTS blobs_release_delete AFTER DELETE ON patches WHEN old.blob_hash IS NOT NULL BEGIN " + release + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS blobs_release_update AFTER UPDATE OF blob_hash ON patches WHEN old.blob_hash IS NOT NULL AND old.blob_hash IS NOT new.blob_hash BEGIN "
+				+ release + "END");
+		}
+
+		void moveDataIntoBlobs() {
+			// Only the storage changes, so the journal entries written by the update triggers are removed again
+			int64_t journalBefore = 0;
+			{
+				SQLite::Statement latest(db_, "SELECT COALESCE(MAX(seq), 0) FROM changes");
+				if (latest.executeStep()) {
+					journalBefore = latest.getColumn(0).getInt64();
+				}
+			}
+			std::vector<std::pair<int64_t, std::string>> hashes;
+			{
+				SQLite::Statement select(db_, "SELECT rowid, data, data_encoding FROM patches WHERE data IS NOT NULL");
+				while (select.executeStep()) {
+					std::vector<uint8> patchData;
+					if (decodePatchData(select.getColumn("data"), select.getColumn("data_encoding").getInt(), patchData)) {
+						hashes.emplace_back(select.getColumn("rowid").getInt64(), storePatchData(patchData));
+					}
+				}
+			}
+			SQLite::Statement update(db_, "UPDATE patches SET blob_hash = :HSH, data = NULL, data_encoding = NULL WHERE rowid = :ROW");
+			for (auto const& [row, hash] : hashes) {
+				update.bind(":HSH", hash);
+				update.bind(":ROW", row);
+				update.exec();
+				update.reset();
+			}
+			SQLite::Statement cleanJournal(db_, "DELETE FROM changes WHERE seq > :SEQ");
+			cleanJournal.bind(":SEQ", journalBefore);
+			cleanJournal.exec();
+			spdlog::info("Moved the data of {} patches into the blob table", hashes.size());
+		}
+
+		std::string storePatchData(std::vector<uint8> const& data) {
+			// Returns the hash to refer to the data from the patch. Data already stored for another patch is not written again
+			auto hash = SHA256(data.data(), data.size()).toHexString().toStdString();
+			auto exists = statements_.acquire("SELECT 1 FROM blobs WHERE blob_hash = :HSH");
+			exists->bind(":HSH", hash);
+			if (!exists->executeStep()) {
+				auto insert = statements_.acquire("INSERT INTO blobs (blob_hash, blob_data, blob_encoding) VALUES (?, ?, ?)");
+				insert->bind(1, hash);
+				int index = 2;
+				bindPatchData(*insert, index, data);
+				insert->exec();
+			}
+			return hash;
+		}
+
+		bool readPatchData(SQLite::Statement& query, std::vector<uint8>& outData) {
+			// The query must include the columns of kPatchDataJoin
+			auto dataColumn = query.getColumn("blob_data");
+			return dataColumn.isBlob() && decodePatchData(dataColumn, query.getColumn("blob_encoding").getInt(), outData);
+		}
+
+		void createPatchCategoryTable() {
+			db_.exec("CREATE TABLE IF NOT EXISTS patch_category(synth TEXT NOT NULL, md5 TEXT NOT NULL, bitIndex INTEGER NOT NULL, PRIMARY KEY (synth, md5, bitIndex), "
+				"FOREIGN KEY(synth, md5) REFERENCES patches(synth, md5) ON DELETE CASCADE)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_category_bit_idx ON patch_category (bitIndex, synth, md5)");
+		}
+
+		void createOrderingIndexes() {
+			// One per PatchOrdering, on exactly the expressions of keysetColumns(), so a grid page of one synth is read in index order instead of sorting
+			// all its patches. The name ordering also serves the duplicate name filter, like patch_synth_name_idx does
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_order_import_idx ON patches (synth, COALESCE(sourceID, ''), COALESCE(midiBankNo, -1), COALESCE(midiProgramNo, -1))");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_order_name_idx ON patches (synth, COALESCE(name, ''), COALESCE(midiBankNo, -1), COALESCE(midiProgramNo, -1))");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_order_program_idx ON patches (synth, COALESCE(midiProgramNo, -1), COALESCE(name, ''))");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_order_bank_idx ON patches (synth, COALESCE(midiBankNo, -1), COALESCE(midiProgramNo, -1), COALESCE(name, ''))");
+			// For the lists a patch is in, and for the foreign key check when a patch is deleted
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_in_list_patch_idx ON patch_in_list (synth, md5)");
 		}
 
 		void createPatchInListTable() {
 			db_.exec("CREATE TABLE IF NOT EXISTS patch_in_list(id TEXT NOT NULL, synth TEXT NOT NULL, md5 TEXT NOT NULL, order_num INTEGER NOT NULL, FOREIGN KEY(synth, md5) REFERENCES patches(synth, md5))");
 		}
 
+		void createNameCountTable() {
+			// How many patches of a synth share a name, for the duplicate name filter. Maintained by triggers. NULL names are never counted, 
+			// they can't be duplicates in SQL anyway
+			db_.exec("CREATE TABLE IF NOT EXISTS name_counts(synth TEXT NOT NULL, name TEXT NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (synth, name))");
+			db_.exec("CREATE INDEX IF NOT EXISTS name_counts_duplicates_idx ON name_counts (synth, name) WHERE count > 1");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_insert AFTER INSERT ON patches WHEN new.name IS NOT NULL BEGIN "
+				"INSERT INTO name_counts (synth, name, count) VALUES (new.synth, new.name, 1) ON CONFLICT(synth, name) DO UPDATE SET count = count + 1; END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_delete AFTER DELETE ON patches WHEN old.name IS NOT NULL BEGIN "
+				"UPDATE name_counts SET count = count - 1 WHERE synth = old.synth AND name = old.name; "
+				"DELETE FROM name_counts WHERE synth = old.synth AND name = old.name AND count <= 0; END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_update AFTER UPDATE OF synth, name ON patches WHEN old.synth IS NOT new.synth OR old.name IS NOT new.name BEGIN "
+				"UPDATE name_counts SET count = count - 1 WHERE synth = old.synth AND name = old.name; "
+				"DELETE FROM name_counts WHERE synth = old.synth AND name = old.name AND count <= 0; "
+				"INSERT INTO name_counts (synth, name, count) SELECT new.synth, new.name, 1 WHERE new.name IS NOT NULL ON CONFLICT(synth, name) DO UPDATE SET count = count + 1; END");
+		}
+
+		void createImportCountTable() {
+			// How many patches of a synth belong to an import, for the imports list. Maintained by triggers like name_counts
+			db_.exec("CREATE TABLE IF NOT EXISTS import_counts(synth TEXT NOT NULL, import_id TEXT NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (synth, import_id))");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS import_counts_insert AFTER INSERT ON patches WHEN new.sourceID IS NOT NULL BEGIN "
+				"INSERT INTO import_counts (synth, import_id, count) VALUES (new.synth, new.sourceID, 1) ON CONFLICT(synth, import_id) DO UPDATE SET count = count + 1; END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS import_counts_delete AFTER DELETE ON patches WHEN old.sourceID IS NOT NULL BEGIN "
+				"UPDATE import_counts SET count = count - 1 WHERE synth = old.synth AND import_id = old.sourceID; "
+				"DELETE FROM import_counts WHERE synth = old.synth AND import_id = old.sourceID AND count <= 0; END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS import_counts_update AFTER UPDATE OF synth, sourceID ON patches WHEN old.synth IS NOT new.synth OR old.sourceID IS NOT new.sourceID BEGIN "
+				"UPDATE import_counts SET count = count - 1 WHERE synth = old.synth AND import_id = old.sourceID; "
+				"DELETE FROM import_counts WHERE synth = old.synth AND import_id = old.sourceID AND count <= 0; "
+				"INSERT INTO import_counts (synth, import_id, count) SELECT new.synth, new.sourceID, 1 WHERE new.sourceID IS NOT NULL ON CONFLICT(synth, import_id) DO UPDATE SET count = count + 1; END");
+		}
+
+		void createChangeJournal() {
+			// Append only log of all modifications of patches, lists and categories, written by triggers. The sequence number never goes down,
+			// so a sync only needs to remember the last one it has seen. The journal starts empty, so a first sync still has to compare everything
+			db_.exec("CREATE TABLE IF NOT EXISTS changes(seq INTEGER PRIMARY KEY AUTOINCREMENT, kind INTEGER NOT NULL, operation INTEGER NOT NULL, "
+				"synth TEXT, md5 TEXT, list_id TEXT, bit_index INTEGER, changed_at INTEGER NOT NULL)");
+			std::string now = "CAST((julianday('now') - 2440587.5) * 86400000 AS INTEGER)";
+			std::string patchChange = "INSERT INTO changes (kind, operation, synth, md5, changed_at) VALUES ({}, {}, {}.synth, {}.md5, " + now + "); ";
+			std::string listChange = "INSERT INTO changes (kind, operation, synth, list_id, changed_at) VALUES ({}, {}, {}, {}.id, " + now + "); ";
+			std::string categoryChange = "INSERT INTO changes (kind, operation, bit_index, changed_at) VALUES ({}, {}, {}.bitIndex, " + now + "); ";
+			auto patchKind = static_cast<int>(ChangeKind::Patch);
+			auto listKind = static_cast<int>(ChangeKind::List);
+			auto categoryKind = static_cast<int>(ChangeKind::Category);
+			auto insert = static_cast<int>(ChangeOperation::Insert);
+			auto update = static_cast<int>(ChangeOperation::Update);
+			auto remove = static_cast<int>(ChangeOperation::Delete);
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_patch_insert AFTER INSERT ON patches BEGIN " + fmt::format(patchChange, patchKind, insert, "new", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_patch_delete AFTER DELETE ON patches BEGIN " + fmt::format(patchChange, patchKind, remove, "old", "old") + "END");
+			// Reindexing changes the key, which for a sync is the old patch gone and a new one there
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_patch_update AFTER UPDATE ON patches WHEN old.synth IS new.synth AND old.md5 IS new.md5 BEGIN "
+				+ fmt::format(patchChange, patchKind, update, "new", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_patch_rekey AFTER UPDATE ON patches WHEN old.synth IS NOT new.synth OR old.md5 IS NOT new.md5 BEGIN "
+				+ fmt::format(patchChange, patchKind, remove, "old", "old") + fmt::format(patchChange, patchKind, insert, "new", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_list_insert AFTER INSERT ON lists BEGIN " + fmt::format(listChange, listKind, insert, "new.synth", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_list_update AFTER UPDATE ON lists BEGIN " + fmt::format(listChange, listKind, update, "new.synth", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_list_delete AFTER DELETE ON lists BEGIN " + fmt::format(listChange, listKind, remove, "old.synth", "old") + "END");
+			// A change of the content of a list is an update of the list
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_list_content_insert AFTER INSERT ON patch_in_list BEGIN " + fmt::format(listChange, listKind, update, "NULL", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_list_content_update AFTER UPDATE ON patch_in_list BEGIN " + fmt::format(listChange, listKind, update, "NULL", "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_list_content_delete AFTER DELETE ON patch_in_list BEGIN " + fmt::format(listChange, listKind, update, "NULL", "old") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_category_insert AFTER INSERT ON categories BEGIN " + fmt::format(categoryChange, categoryKind, insert, "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_category_update AFTER UPDATE ON categories BEGIN " + fmt::format(categoryChange, categoryKind, update, "new") + "END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS changes_category_delete AFTER DELETE ON categories BEGIN " + fmt::format(categoryChange, categoryKind, remove, "old") + "END");
+		}
+
+		void createImportedFilesTable() {
+			db_.exec("CREATE TABLE IF NOT EXISTS imported_files(synth TEXT NOT NULL, path TEXT NOT NULL, size INTEGER, modified INTEGER, hash TEXT, import_id TEXT, PRIMARY KEY (synth, path))");
+		}
+
+		void createSyncedBanksTable() {
+			// What the synth has in its banks as of the last sync. Only written by putSyncedBank, so editing the bank list doesn't change it
+			db_.exec("CREATE TABLE IF NOT EXISTS synced_banks(id TEXT NOT NULL, position INTEGER NOT NULL, md5 TEXT NOT NULL, PRIMARY KEY (id, position))");
+		}
+
+		void enableWriteAheadLog() {
+			// WAL allows the read connections to continue while the writer is in a transaction. This setting is persistent in the database file
+			if (mode_ != OpenMode::READ_ONLY) {
+				try {
+					SQLite::Statement journalMode(db_, "PRAGMA journal_mode = WAL");
+					if (journalMode.executeStep() && journalMode.getColumn(0).getString() != "wal") {
+						spdlog::warn("Database does not support WAL journaling, reads will wait for writes to finish");
+					}
+					db_.exec(synchronousPragma(mode_ == OpenMode::READ_WRITE_NO_BACKUPS ? profile_.synchronousNoBackups : profile_.synchronous));
+				}
+				catch (SQLite::Exception& ex) {
+					spdlog::warn("Failed to switch database to WAL journal mode: {}", ex.what());
+				}
+			}
+		}
+
+		bool isSchemaCurrent() {
+			if (!db_.tableExists("schema_version")) {
+				return false;
+			}
+			SQLite::Statement schemaQuery(db_, "SELECT number FROM schema_version");
+			return schemaQuery.executeStep() && schemaQuery.getColumn(0).getInt() == SCHEMA_VERSION;
+		}
+
 		void createSchema() {
 			db_.exec("PRAGMA foreign_keys = ON");
+			if (isSchemaCurrent()) {
+				// Fast path for the usual case, all tables and indexes have been created when the database got this schema version
+				return;
+			}
 
-			SQLite::Transaction transaction(db_);
-			if (!db_.tableExists("patches")) {
+			WriteTransaction transaction(writer_, db_);
+			bool newDatabase = !db_.tableExists("patches");
+			if (newDatabase) {
 				createPatchTable();
+				// Don't create these for older databases before the migration has run, as the migration to schema 9 renames the patches table
+				createPatchCategoryTable();
+				createNameCountTable();
+				createBlobTable();
+				createImportCountTable();
 			}
 			if (!db_.tableExists("imports")) {
 				db_.exec("CREATE TABLE IF NOT EXISTS imports (synth TEXT, name TEXT, id TEXT, date TEXT)");
@@ -324,10 +1704,21 @@ namespace midikraft {
 			if (!db_.tableExists("patch_in_list")) {
 				createPatchInListTable();
 			}
+			if (!db_.tableExists("imported_files")) {
+				createImportedFilesTable();
+			}
+			if (newDatabase) {
+				// Older databases get it with the migration to schema 18, the triggers need the tables in their final form
+				createChangeJournal();
+				createOrderingIndexes();
+				// And this with the one to schema 25, which also fills it
+				createSyncedBanksTable();
+			}
 
 			// Creating indexes
 			db_.exec("CREATE INDEX IF NOT EXISTS patch_synth_name_idx ON patches (synth, name)");
 			db_.exec("CREATE INDEX IF NOT EXISTS patch_sourceid_idx ON patches (sourceID)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_in_list_order_idx ON patch_in_list (id, order_num)");
 
 			// Commit transaction
 			transaction.commit();
@@ -376,49 +1767,263 @@ namespace midikraft {
 			}
 		}
 
-		bool putPatch(PatchHolder const& patch, std::string const& sourceID) {
+		void createFullTextIndex() {
+			// The full text index is optional - it requires SQLite to be compiled with FTS5 and the trigram tokenizer. 
+			// It is not part of the schema version, so a database can be opened with and without it. Triggers keep it in sync with the patches table.
+			// Note that it is keyed by the rowid of the patches table, so it needs to be rebuilt should we ever VACUUM again after creating it.
 			try {
-				SQLite::Statement sql(db_, "INSERT INTO patches (synth, md5, name, type, data, favorite, hidden, sourceID, sourceName, sourceInfo, midiBankNo, midiProgramNo, categories, categoryUserDecision, comment)"
-					" VALUES (:SYN, :MD5, :NAM, :TYP, :DAT, :FAV, :HID, :SID, :SNM, :SRC, :BNK, :PRG, :CAT, :CUD, :COM)");
-
-				// Insert values into prepared statement
-				sql.bind(":SYN", patch.synth()->getName().c_str());
-				sql.bind(":MD5", patch.md5());
-				sql.bind(":NAM", patch.name());
-				sql.bind(":TYP", patch.getType());
-				sql.bind(":DAT", patch.patch()->data().data(), (int)patch.patch()->data().size());
-				sql.bind(":FAV", (int)patch.howFavorite().is());
-				sql.bind(":HID", patch.isHidden());
-				sql.bind(":SID", sourceID);
-				sql.bind(":SNM", patch.sourceInfo()->toDisplayString(patch.synth(), false));
-				sql.bind(":SRC", patch.sourceInfo()->toString());
-				sql.bind(":BNK", patch.bankNumber().isValid() ? patch.bankNumber().toZeroBased() : 0);
-				sql.bind(":PRG", patch.patchNumber().toZeroBasedWithBank());
-				sql.bind(":CAT", (int64_t) bitfield.categorySetAsBitfield(patch.categories()));
-				sql.bind(":CUD", (int64_t) bitfield.categorySetAsBitfield(patch.userDecisionSet()));
-				sql.bind(":COM", patch.comment());
-
-				sql.exec();
+				if (db_.tableExists("patch_fts")) {
+					hasFullTextIndex_ = true;
+				}
+				else if (mode_ != OpenMode::READ_ONLY) {
+					WriteTransaction transaction(writer_, db_);
+					db_.exec("CREATE VIRTUAL TABLE patch_fts USING fts5(name, comment, tokenize = 'trigram')");
+					db_.exec("INSERT INTO patch_fts (rowid, name, comment) SELECT rowid, name, comment FROM patches");
+					db_.exec("CREATE TRIGGER IF NOT EXISTS patch_fts_insert AFTER INSERT ON patches BEGIN "
+						"INSERT INTO patch_fts (rowid, name, comment) VALUES (new.rowid, new.name, new.comment); END");
+					db_.exec("CREATE TRIGGER IF NOT EXISTS patch_fts_delete AFTER DELETE ON patches BEGIN "
+						"DELETE FROM patch_fts WHERE rowid = old.rowid; END");
+					db_.exec("CREATE TRIGGER IF NOT EXISTS patch_fts_update AFTER UPDATE OF name, comment ON patches BEGIN "
+						"UPDATE patch_fts SET name = new.name, comment = new.comment WHERE rowid = old.rowid; END");
+					transaction.commit();
+					hasFullTextIndex_ = true;
+				}
 			}
 			catch (SQLite::Exception& ex) {
-				spdlog::error("DATABASE ERROR in putPatch: SQL Exception {}", ex.what());
+				spdlog::info("Full text index not available, name search will use LIKE: {}", ex.what());
+				hasFullTextIndex_ = false;
+			}
+		}
+
+		bool useFullTextSearch(PatchFilter const& filter) const {
+			// The trigram tokenizer can only match search strings with at least 3 characters
+			return hasFullTextIndex_ && String::fromUTF8(filter.name.c_str()).length() >= 3;
+		}
+
+		void updatePatchCategoryIndex(std::string const& synthName, std::string const& md5, CategorySet const& categories) {
+			// Keep the patch_category table in sync with the categories bitfield of the patch
+			auto clear = statements_.acquire("DELETE FROM patch_category WHERE synth = :SYN AND md5 = :MD5");
+			clear->bind(":SYN", synthName);
+			clear->bind(":MD5", md5);
+			clear->exec();
+			for (auto const& cat : categories.categories()) {
+				auto insert = statements_.acquire("INSERT OR IGNORE INTO patch_category (synth, md5, bitIndex) VALUES (:SYN, :MD5, :BIT)");
+				insert->bind(":SYN", synthName);
+				insert->bind(":MD5", md5);
+				insert->bind(":BIT", cat.def()->id);
+				insert->exec();
 			}
-			return true;
 		}
 
 		std::vector<ImportInfo> getImportsList(Synth* activeSynth) {
-			SQLite::Statement query(db_, "SELECT imports.name, id, count(patches.md5) AS patchCount FROM imports JOIN patches on imports.id == patches.sourceID WHERE patches.synth = :SYN AND imports.synth = :SYN GROUP BY imports.id ORDER BY date");
-			query.bind(":SYN", activeSynth->getName());
+			// Cached per synth until the patches or the import names change
+			uint64_t version = patchesVersion_;
+			{
+				ScopedLock lock(importsCacheLock_);
+				auto found = importsCache_.find(activeSynth->getName());
+				if (found != importsCache_.end() && found->second.first == version) {
+					return found->second.second;
+				}
+			}
 			std::vector<ImportInfo> result;
-			while (query.executeStep()) {
-				result.push_back({ query.getColumn("name").getText(), query.getColumn("id").getText(), query.getColumn("patchCount").getInt() });
+			try {
+				auto reader = readers_.acquire();
+				auto query = reader.statements().acquire("SELECT imports.name, imports.id, import_counts.count AS patchCount FROM imports "
+					"JOIN import_counts ON import_counts.synth = imports.synth AND import_counts.import_id = imports.id WHERE imports.synth = :SYN ORDER BY date");
+				query->bind(":SYN", activeSynth->getName());
+				while (query->executeStep()) {
+					result.push_back({ query->getColumn("name").getText(), query->getColumn("id").getText(), query->getColumn("patchCount").getInt() });
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getImportsList: SQL Exception {}", ex.what());
+				return result;
+			}
+			ScopedLock lock(importsCacheLock_);
+			importsCache_[activeSynth->getName()] = { version, result };
+			return result;
+		}
+
+		std::map<std::string, ImportedFileInfo> getImportedFiles(std::string const& synthName) {
+			std::map<std::string, ImportedFileInfo> result;
+			try {
+				auto reader = readers_.acquire();
+				auto query = reader.statements().acquire("SELECT path, size, modified, hash, import_id FROM imported_files WHERE synth = :SYN");
+				query->bind(":SYN", synthName);
+				while (query->executeStep()) {
+					ImportedFileInfo info{ synthName, query->getColumn("path").getString(), query->getColumn("size").getInt64(), query->getColumn("modified").getInt64(),
+						query->getColumn("hash").getString(), query->getColumn("import_id").getString() };
+					result[info.path] = info;
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getImportedFiles: SQL Exception {}", ex.what());
 			}
 			return result;
 		}
 
+		bool putImportedFiles(std::vector<ImportedFileInfo> const& files) {
+			try {
+				WriteTransaction transaction(writer_, db_);
+				for (auto const& file : files) {
+					auto upsert = statements_.acquire("INSERT OR REPLACE INTO imported_files (synth, path, size, modified, hash, import_id) VALUES (:SYN, :PTH, :SIZ, :MOD, :HSH, :IID)");
+					upsert->bind(":SYN", file.synth);
+					upsert->bind(":PTH", file.path);
+					upsert->bind(":SIZ", file.size);
+					upsert->bind(":MOD", file.modified);
+					upsert->bind(":HSH", file.hash);
+					upsert->bind(":IID", file.importId);
+					upsert->exec();
+				}
+				transaction.commit();
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in putImportedFiles: SQL Exception {}", ex.what());
+				return false;
+			}
+		}
+
+		bool changesSince(int64_t sinceSequence, int limit, std::vector<ChangeRecord>& outChanges) {
+			outChanges.clear();
+			try {
+				auto reader = readers_.acquire();
+				// If entries after the one asked for have been pruned, the caller has missed changes and needs to compare everything again
+				auto oldest = reader.statements().acquire("SELECT COALESCE((SELECT MIN(seq) FROM changes), (SELECT seq + 1 FROM sqlite_sequence WHERE name = 'changes'), 1)");
+				if (oldest->executeStep() && sinceSequence + 1 < oldest->getColumn(0).getInt64() && oldest->getColumn(0).getInt64() > 1) {
+					return false;
+				}
+				std::string select = "SELECT seq, kind, operation, synth, md5, list_id, bit_index, changed_at FROM changes WHERE seq > :SEQ ORDER BY seq";
+				if (limit != -1) {
+					select += " LIMIT :LIM";
+				}
+				auto query = reader.statements().acquire(select);
+				query->bind(":SEQ", sinceSequence);
+				if (limit != -1) {
+					query->bind(":LIM", limit);
+				}
+				while (query->executeStep()) {
+					ChangeRecord change;
+					change.sequence = query->getColumn("seq").getInt64();
+					change.kind = static_cast<ChangeKind>(query->getColumn("kind").getInt());
+					change.operation = static_cast<ChangeOperation>(query->getColumn("operation").getInt());
+					change.synth = query->getColumn("synth").getString();
+					change.md5 = query->getColumn("md5").getString();
+					change.listId = query->getColumn("list_id").getString();
+					change.bitIndex = query->getColumn("bit_index").isNull() ? -1 : query->getColumn("bit_index").getInt();
+					change.changedAt = query->getColumn("changed_at").getInt64();
+					outChanges.push_back(change);
+				}
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in changesSince: SQL Exception {}", ex.what());
+				return false;
+			}
+		}
+
+		int64_t latestChangeSequence() {
+			try {
+				auto reader = readers_.acquire();
+				auto query = reader.statements().acquire("SELECT COALESCE((SELECT seq FROM sqlite_sequence WHERE name = 'changes'), 0)");
+				if (query->executeStep()) {
+					return query->getColumn(0).getInt64();
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in latestChangeSequence: SQL Exception {}", ex.what());
+			}
+			return 0;
+		}
+
+		void setDataCompressionEnabled(bool enabled) {
+			dataCompressionEnabled_ = enabled;
+		}
+
+		int recompressPatchData(ProgressHandler* progress) {
+			// Rewrites the blobs whose storage doesn't match the current setting, in chunks each with its own transaction so it can be aborted
+			// and continued later. The file only shrinks after a VACUUM, until then SQLite reuses the freed pages
+			const int kChunk = 200;
+			int rewritten = 0;
+			try {
+				int total = 0;
+				{
+					SQLite::Statement count(db_, "SELECT COUNT(*) FROM blobs WHERE length(blob_data) >= :MIN OR blob_encoding = :ZLB");
+					count.bind(":MIN", (int64_t)kMinCompressedDataBytes);
+					count.bind(":ZLB", kDataEncodingZlib);
+					if (count.executeStep()) {
+						total = count.getColumn(0).getInt();
+					}
+				}
+				int64_t lastRow = 0;
+				int done = 0;
+				bool more = true;
+				while (more) {
+					if (progress && progress->shouldAbort()) break;
+					std::vector<std::pair<int64_t, std::vector<uint8>>> toRewrite;
+					{
+						auto select = statements_.acquire("SELECT rowid, blob_data, blob_encoding FROM blobs WHERE rowid > :ROW AND (length(blob_data) >= :MIN OR blob_encoding = :ZLB) ORDER BY rowid LIMIT :LIM");
+						select->bind(":ROW", lastRow);
+						select->bind(":MIN", (int64_t)kMinCompressedDataBytes);
+						select->bind(":ZLB", kDataEncodingZlib);
+						select->bind(":LIM", kChunk);
+						int rows = 0;
+						while (select->executeStep()) {
+							rows++;
+							lastRow = select->getColumn("rowid").getInt64();
+							auto dataColumn = select->getColumn("blob_data");
+							int encoding = select->getColumn("blob_encoding").getInt();
+							std::vector<uint8> patchData;
+							std::vector<uint8> stored;
+							if (dataColumn.isBlob() && decodePatchData(dataColumn, encoding, patchData)
+								&& encodePatchData(patchData, dataCompressionEnabled_, stored) != encoding) {
+								toRewrite.emplace_back(lastRow, std::move(patchData));
+							}
+						}
+						more = rows == kChunk;
+						done += rows;
+					}
+					if (!toRewrite.empty()) {
+						WriteTransaction transaction(writer_, db_);
+						auto update = statements_.acquire("UPDATE blobs SET blob_data = ?, blob_encoding = ? WHERE rowid = ?");
+						for (auto const& [row, patchData] : toRewrite) {
+							int index = 1;
+							bindPatchData(*update, index, patchData);
+							update->bind(index, row);
+							update->exec();
+							update->reset();
+						}
+						transaction.commit();
+						rewritten += (int)toRewrite.size();
+					}
+					if (progress && total > 0) progress->setProgressPercentage(done / (double)total);
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in recompressPatchData: SQL Exception {}", ex.what());
+				return -1;
+			}
+			return rewritten;
+		}
+
+		int pruneChanges(int64_t upToSequence) {
+			try {
+				WriteTransaction transaction(writer_, db_);
+				auto prune = statements_.acquire("DELETE FROM changes WHERE seq <= :SEQ");
+				prune->bind(":SEQ", upToSequence);
+				int rows = prune->exec();
+				transaction.commit();
+				return rows;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in pruneChanges: SQL Exception {}", ex.what());
+				return -1;
+			}
+		}
+
 		bool renameImport(std::string synthName, std::string importID, std::string newName) {
 			try {
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				SQLite::Statement update(db_, "UPDATE imports set name = :NAM where id = :IID and synth = :SYN");
 				update.bind(":NAM", newName);
 				update.bind(":IID", importID);
@@ -427,6 +2032,8 @@ namespace midikraft {
 				if (rowsModified == 1) {
 					// Success
 					transaction.commit();
+					ScopedLock lock(importsCacheLock_);
+					importsCache_.erase(synthName);
 					return true;
 				}
 				else if (rowsModified == 0) {
@@ -444,25 +2051,35 @@ namespace midikraft {
 			}
 		}
 
-		std::string buildWhereClause(PatchFilter filter, bool needsCollate) {
+		std::string buildWhereClause(PatchFilter filter, bool needsCollate, bool fullTextSearch = true) {
 			std::string where = " WHERE 1 == 1 ";
 			if (!filter.synths.empty()) {
-				//TODO does SQlite do "IN" clause?
-				where += " AND ( ";
-				int s = 0;
-				for (auto synth : filter.synths) {
-					if (s != 0) where += " OR ";
-					where += "patches.synth = " + synthVariable(s++);
+				// One synth is a plain equality, several are a single IN list. Both let SQLite seek into the indexes starting with the synth
+				// column once per synth, where the OR chain of equalities this used to be made it scan instead
+				if (filter.synths.size() == 1) {
+					where += " AND patches.synth = " + synthVariable(0) + " ";
+				}
+				else {
+					std::string variables;
+					for (int s = 0; s < (int)filter.synths.size(); s++) {
+						if (s != 0) variables += ", ";
+						variables += synthVariable(s);
+					}
+					where += " AND patches.synth IN (" + variables + ") ";
 				}
-				where += " ) ";
 			}
 			if (!filter.importID.empty()) {
 				where += " AND sourceID = :SID";
 			}
 			if (!filter.name.empty()) {
-				where += " AND (name LIKE :NAM or comment LIKE :NAM)";
-				if (needsCollate) {
-					where += " COLLATE NOCASE";
+				if (fullTextSearch && useFullTextSearch(filter)) {
+					where += " AND patches.rowid IN (SELECT rowid FROM patch_fts WHERE patch_fts MATCH :FTS)";
+				}
+				else {
+					where += " AND (name LIKE :NAM or comment LIKE :NAM)";
+					if (needsCollate) {
+						where += " COLLATE NOCASE";
+					}
 				}
 			}
 			if (!filter.listID.empty()) {
@@ -472,56 +2089,9 @@ namespace midikraft {
 				where += " AND type == :TYP";
 			}
 
-			// Show Hidden and Show Faves are special in that they can be combined
-			// and need explicit code for the 4 cases
-			if (filter.onlyFaves) {
-				if (filter.showHidden) {
-					if (filter.showUndecided) {
-						// No op, just retrieve all
-					}
-					else
-					{
-						// Don't show all
-						where += " AND (hidden == 1 OR favorite == 1)";
-					}
-				}
-				else
-				{
-					if (filter.showUndecided) {
-						// Everything that is not hidden
-						where += " AND (hidden is null or hidden != 1)";
-					}
-					else
-					{
-						// Only favorites that are not hidden
-						where += " AND (favorite == 1) AND (hidden is null or hidden != 1)";
-					}
-				}
-			}
-			else {
-				if (filter.showHidden) {
-					if (filter.showUndecided) {
-						// All that's not favorite
-						where += " AND (favorite != 1)";
-					}
-					else
-					{
-						// Only hidden
-						where += " AND (hidden == 1)";
-					}
-				}
-				else
-				{
-					if (filter.showUndecided) {
-						// Everything that is not hidden and not fave
-						where += " AND (favorite != 1) AND (hidden is null or hidden != 1)";
-					}
-					else
-					{
-						// All that is not hidden
-						where += " AND (hidden is null or hidden != 1)";
-					}
-				}
+			auto flags = favoriteHiddenCondition(filter);
+			if (!flags.empty()) {
+				where += " AND " + flags;
 			}
 
 			if (filter.onlyUntagged) {
@@ -529,37 +2099,54 @@ namespace midikraft {
 			}
 			else if (!filter.categories.empty()) {
 				// Empty category filter set will of course return everything
-				//TODO this has bad query performance as it will force a table scan, but for now I cannot see this becoming a problem as long as the database is not multi-tenant
-				// The correct way to do this would be to create a many to many relationship and run an "exists" query or join/unique the category table. Returning the list of categories also requires 
-				// a concat on sub-query, so we're running into more complex SQL territory here.
+				// Use the many to many relation table patch_category, which has an index on the bit index, instead of a table scan over the bitfield column
+				std::string categoryVariables;
+				for (size_t c = 0; c < filter.categories.size(); c++) {
+					categoryVariables = prependWithComma(categoryVariables, categoryVariable(c));
+				}
 				if (!filter.andCategories) {
-					where += " AND (categories & :CAT != 0)";
+					where += " AND ((patches.synth, patches.md5) IN (SELECT synth, md5 FROM patch_category WHERE bitIndex IN (" + categoryVariables + ")))";
 				}
 				else {
-					where += " AND (categories & :CAT == :CAT)";
+					where += " AND ((patches.synth, patches.md5) IN (SELECT synth, md5 FROM patch_category WHERE bitIndex IN (" + categoryVariables + ") GROUP BY synth, md5 HAVING COUNT(*) == :CCN))";
 				}
 			}
 			if (filter.onlyDuplicateNames) {
-				where += " AND patches_count.count > 1";
+				// name_counts is kept up to date by triggers, so this is an index lookup instead of grouping all patches by name
+				where += " AND ((patches.synth, patches.name) IN (SELECT synth, name FROM name_counts WHERE count > 1))";
 			}
 			//spdlog::debug(where);
 			return where;
 		}
 
 		std::string buildOrderClause(PatchFilter filter) {
+			if (filter.orderBy == PatchOrdering::No_ordering) {
+				return "";
+			}
+			// The same expressions as for keyset paging, so both can use the ordering indexes. NULLs sort as before
 			std::string orderByClause;
-			switch (filter.orderBy) {
-			case PatchOrdering::No_ordering: orderByClause = ""; break;
-			case PatchOrdering::Order_by_Import_id: orderByClause = " ORDER BY sourceID, midiBankNo, midiProgramNo ";; break;
-			case PatchOrdering::Order_by_Name: orderByClause = " ORDER BY name, midiBankNo, midiProgramNo "; break;
-			case PatchOrdering::Order_by_Place_in_List: orderByClause = " ORDER BY order_num"; break;
-			case PatchOrdering::Order_by_ProgramNo: orderByClause = " ORDER BY midiProgramNo, name"; break;
-			case PatchOrdering::Order_by_BankNo: orderByClause = " ORDER BY midiBankNo, midiProgramNo, name"; break;
+			for (auto const& key : keysetColumns(filter.orderBy)) {
+				orderByClause += orderByClause.empty() ? " ORDER BY " : ", ";
+				orderByClause += key;
+			}
+			return orderByClause;
+		}
+
+		std::vector<std::string> keysetColumns(PatchOrdering ordering) {
+			// The sort key for keyset paging must be unique, so always end with the rowid. NULLs are mapped to values that sort the same way, 
+			// because a row value comparison with NULL would silently drop rows
+			switch (ordering) {
+			case PatchOrdering::No_ordering: return { "patches.rowid" };
+			case PatchOrdering::Order_by_Import_id: return { "COALESCE(sourceID, '')", "COALESCE(midiBankNo, -1)", "COALESCE(midiProgramNo, -1)", "patches.rowid" };
+			case PatchOrdering::Order_by_Name: return { "COALESCE(name, '')", "COALESCE(midiBankNo, -1)", "COALESCE(midiProgramNo, -1)", "patches.rowid" };
+			case PatchOrdering::Order_by_Place_in_List: return { "order_num", "patches.rowid" };
+			case PatchOrdering::Order_by_ProgramNo: return { "COALESCE(midiProgramNo, -1)", "COALESCE(name, '')", "patches.rowid" };
+			case PatchOrdering::Order_by_BankNo: return { "COALESCE(midiBankNo, -1)", "COALESCE(midiProgramNo, -1)", "COALESCE(name, '')", "patches.rowid" };
 			default:
 				jassertfalse;
-				spdlog::error("Program error - encountered invalid ordering field in buildOrderClause");
+				spdlog::error("Program error - encountered invalid ordering field in keysetColumns");
+				return { "patches.rowid" };
 			}
-			return orderByClause;
 		}
 
 		std::string buildJoinClause(PatchFilter filter) {
@@ -568,35 +2155,19 @@ namespace midikraft {
 			if (!filter.listID.empty()) {
 				joinClause += " INNER JOIN patch_in_list ON patches.md5 = patch_in_list.md5 AND patches.synth = patch_in_list.synth";
 			}
-			if (filter.onlyDuplicateNames) {
-				joinClause += " JOIN patches_count ON patches.synth = patches_count.synth AND patches.name = patches_count.dup_name";
-				/*if (filter.showHidden)
-					joinClause += " JOIN (select name as dup_name, synth, count(*) as name_count from patches group by dup_name, synth) as ordinal_table on patches.name = ordinal_table.dup_name and patches.synth = ordinal_table.synth";
-				else
-					joinClause += " JOIN (select name as dup_name, synth, count(*) as name_count from patches where hidden = 0 group by dup_name, synth) as ordinal_table on patches.name = ordinal_table.dup_name and patches.synth = ordinal_table.synth";*/
-			}
 			return joinClause;
 		}
 
-		std::string buildCTE(PatchFilter filter) {
-			if (filter.onlyDuplicateNames) {
-				return R"sql(WITH patches_count AS (
-   SELECT synth, name as dup_name, COUNT(*) as count
-   FROM patches
-   GROUP BY synth, name
-))sql";
-			}
-			else {
-				return "";
-			}
+		std::string categoryVariable(size_t no) {
+			return fmt::format(":C{:02d}", no);
 		}
 
 		std::string synthVariable(int no) {
-			// Calculate a variable name to bind the synth name to. This will blow up if you query for more than 99 synths.
+			// Calculate a variable name to bind the synth name to. Names just get longer beyond 99 synths, far below SQLite's limit for variables
 			return fmt::format(":S{:02d}", no);
 		}
 
-		void bindWhereClause(SQLite::Statement& query, PatchFilter filter) {
+		void bindWhereClause(SQLite::Statement& query, PatchFilter filter, bool fullTextSearch = true) {
 			int s = 0;
 			for (auto const& synth : filter.synths) {
 				query.bind(synthVariable(s++), synth.second.lock()->getName());
@@ -608,22 +2179,43 @@ namespace midikraft {
 				query.bind(":LID", filter.listID);
 			}
 			if (!filter.name.empty()) {
-				query.bind(":NAM", "%" + filter.name + "%");
+				if (fullTextSearch && useFullTextSearch(filter)) {
+					// Search for the whole string as a phrase, which the trigram tokenizer matches as a substring. Double quotes need to be escaped by doubling
+					query.bind(":FTS", "\"" + String(filter.name).replace("\"", "\"\"").toStdString() + "\"");
+				}
+				else {
+					query.bind(":NAM", "%" + filter.name + "%");
+				}
 			}
 			if (filter.onlySpecifcType) {
 				query.bind(":TYP", filter.typeID);
 			}
 			if (!filter.onlyUntagged && !filter.categories.empty()) {
-				query.bind(":CAT", (int64_t) bitfield.categorySetAsBitfield(filter.categories));
+				size_t c = 0;
+				for (auto const& cat : filter.categories) {
+					query.bind(categoryVariable(c++), cat.def()->id);
+				}
+				if (filter.andCategories) {
+					query.bind(":CCN", (int) filter.categories.size());
+				}
 			}
 		}
 
-		int getPatchesCount(PatchFilter filter) {
+		int getPatchesCount(PatchFilter filter, bool* success = nullptr) {
+			if (success) {
+				*success = true;
+			}
+			int indexedCount;
+			if (countFromMetadataIndex(filter, indexedCount)) {
+				return indexedCount;
+			}
 			try {
-				std::string queryString = fmt::format("{} SELECT count(*) FROM patches {} {}", buildCTE(filter), buildJoinClause(filter), buildWhereClause(filter, false));
-				SQLite::Statement query(db_, queryString);
+				std::string queryString = fmt::format("SELECT count(*) FROM patches {} {}", buildJoinClause(filter), buildWhereClause(filter, false));
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), queryString);
 				bindWhereClause(query, filter);
-				if (query.executeStep()) {
+				QueryProfiler::Scope profile(queryProfiler_, reader.db(), query, queryString);
+				if (profile.step()) {
 					int count = query.getColumn(0).getInt();
 					return count;
 				}
@@ -631,10 +2223,249 @@ namespace midikraft {
 			catch (SQLite::Exception& ex) {
 				spdlog::error("DATABASE ERROR in getPatchesCount: SQL Exception {}", ex.what());
 			}
+			if (success) {
+				*success = false;
+			}
 			return 0;
 		}
 
+		void setMetadataIndexEnabled(bool enabled) {
+			metadataIndexEnabled_ = enabled;
+			if (!enabled) {
+				ScopedLock lock(metadataIndexLock_);
+				metadataIndexes_.clear();
+				similarityIndexes_.clear();
+			}
+		}
+
+		void patchesModified() {
+			// Called after every committed write to the patches table, the indexes will be rebuilt when next needed
+			patchesVersion_++;
+			contentModified();
+		}
+
+		void contentModified() {
+			// Called after writes that change query results without touching the patches table, e.g. list contents
+			writeGeneration_++;
+		}
+
+		uint64_t writeGeneration() const {
+			return writeGeneration_;
+		}
+
+		QueryResultCache& resultCache() {
+			return resultCache_;
+		}
+
+		bool canUseMetadataIndex(PatchFilter const& filter) const {
+			return metadataIndexEnabled_ && !filter.synths.empty() && PatchMetadataIndex::canEvaluate(filter);
+		}
+
+		std::shared_ptr<PatchMetadataIndex const> metadataIndex(std::string const& synthName) {
+			uint64_t version = patchesVersion_;
+			{
+				ScopedLock lock(metadataIndexLock_);
+				auto found = metadataIndexes_.find(synthName);
+				if (found != metadataIndexes_.end() && found->second->version() == version) {
+					return found->second;
+				}
+			}
+			// Build outside of the lock. Should the patches be modified meanwhile, the version taken before reading marks this index as stale already
+			auto index = std::make_shared<PatchMetadataIndex>(version);
+			try {
+				auto reader = readers_.acquire();
+				auto count = reader.statements().acquire("SELECT count(*) FROM patches WHERE synth = :SYN");
+				count->bind(":SYN", synthName);
+				if (count->executeStep()) {
+					index->reserve((size_t)count->getColumn(0).getInt());
+				}
+				auto query = reader.statements().acquire("SELECT md5, name, comment, type, favorite, hidden, categories, sourceID, midiBankNo, midiProgramNo FROM patches WHERE synth = :SYN ORDER BY rowid");
+				query->bind(":SYN", synthName);
+				while (query->executeStep()) {
+					PatchMetadataIndex::Row row;
+					row.md5 = query->getColumn("md5").getString();
+					row.name = query->getColumn("name").getString();
+					row.comment = query->getColumn("comment").getString();
+					row.sourceId = query->getColumn("sourceID").getString();
+					row.type = query->getColumn("type").getInt();
+					auto favorite = query->getColumn("favorite");
+					if (!favorite.isNull()) row.favorite = favorite.getInt();
+					auto hidden = query->getColumn("hidden");
+					if (!hidden.isNull()) row.hidden = hidden.getInt();
+					auto categories = query->getColumn("categories");
+					if (!categories.isNull()) row.categories = categories.getInt64();
+					auto bank = query->getColumn("midiBankNo");
+					if (!bank.isNull()) row.bank = bank.getInt();
+					auto program = query->getColumn("midiProgramNo");
+					if (!program.isNull()) row.program = program.getInt();
+					index->add(row);
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				if (ex.getErrorCode() != SQLITE_INTERRUPT) {
+					spdlog::error("DATABASE ERROR building the patch index for {}: SQL Exception {}", synthName, ex.what());
+				}
+				return nullptr;
+			}
+			ScopedLock lock(metadataIndexLock_);
+			metadataIndexes_[synthName] = index;
+			return index;
+		}
+
+		bool metadataIndexesForFilter(PatchFilter const& filter, std::vector<std::pair<std::shared_ptr<Synth>, std::shared_ptr<PatchMetadataIndex const>>>& outIndexes) {
+			if (!canUseMetadataIndex(filter)) {
+				return false;
+			}
+			for (auto const& synth : filter.synths) {
+				auto locked = synth.second.lock();
+				if (!locked) {
+					return false;
+				}
+				auto index = metadataIndex(locked->getName());
+				if (!index) {
+					return false;
+				}
+				outIndexes.emplace_back(locked, index);
+			}
+			return true;
+		}
+
+		bool countFromMetadataIndex(PatchFilter const& filter, int& outCount) {
+			std::vector<std::pair<std::shared_ptr<Synth>, std::shared_ptr<PatchMetadataIndex const>>> indexes;
+			if (!metadataIndexesForFilter(filter, indexes)) {
+				return false;
+			}
+			size_t count = 0;
+			for (auto const& [synth, index] : indexes) {
+				count += index->countMatching(filter);
+			}
+			outCount = (int)count;
+			return true;
+		}
+
+		bool getPatchesFromMetadataIndex(PatchFilter const& filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit, int* outTotal) {
+			std::vector<std::pair<std::shared_ptr<Synth>, std::shared_ptr<PatchMetadataIndex const>>> indexes;
+			if (!metadataIndexesForFilter(filter, indexes)) {
+				return false;
+			}
+
+			// Filter and sort in memory, then only load the page itself from the database
+			struct Match {
+				size_t synth;
+				uint32_t row;
+			};
+			std::vector<Match> matches;
+			for (size_t s = 0; s < indexes.size(); s++) {
+				for (auto row : indexes[s].second->matchingRows(filter)) {
+					matches.push_back({ s, row });
+				}
+			}
+			if (outTotal) {
+				*outTotal = (int)matches.size();
+			}
+			if (filter.orderBy != PatchOrdering::No_ordering) {
+				std::stable_sort(matches.begin(), matches.end(), [&](Match const& a, Match const& b) {
+					return PatchMetadataIndex::lessThan(filter.orderBy, *indexes[a.synth].second, a.row, *indexes[b.synth].second, b.row);
+					});
+			}
+			size_t first = std::min((size_t)std::max(0, skip), matches.size());
+			size_t last = std::min(first + (size_t)limit, matches.size());
+
+			std::map<size_t, std::vector<std::string>> pageBySynth;
+			for (size_t i = first; i < last; i++) {
+				pageBySynth[matches[i].synth].push_back(indexes[matches[i].synth].second->md5(matches[i].row));
+			}
+			const size_t kChunkSize = 500;
+			std::map<std::pair<size_t, std::string>, PatchHolder> loaded;
+			try {
+				auto reader = readers_.acquire();
+				QueryRowScratch scratch(currentBitfield());
+				for (auto const& [s, md5s] : pageBySynth) {
+					auto synth = indexes[s].first;
+					for (size_t chunkStart = 0; chunkStart < md5s.size(); chunkStart += kChunkSize) {
+						size_t chunkLength = std::min(kChunkSize, md5s.size() - chunkStart);
+						std::string inClause;
+						for (size_t i = 0; i < chunkLength; i++) {
+							inClause = prependWithComma(inClause, md5Variable(i));
+						}
+						SQLite::Statement query(reader.db(), "SELECT * FROM patches" + kPatchDataJoin + " WHERE synth = :SYN AND md5 IN (" + inClause + ")");
+						query.bind(":SYN", synth->getName());
+						for (size_t i = 0; i < chunkLength; i++) {
+							query.bind(md5Variable(i), md5s[chunkStart + i]);
+						}
+						while (query.executeStep()) {
+							std::vector<PatchHolder> row;
+							if (loadPatchFromQueryRow(synth, query, scratch, row)) {
+								std::string md5stored = query.getColumn("md5");
+								if (row.back().md5() != md5stored) {
+									needsReindexing.emplace_back(md5stored, row.back());
+								}
+								loaded.emplace(std::make_pair(s, md5stored), row.back());
+							}
+						}
+					}
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				if (ex.getErrorCode() == SQLITE_INTERRUPT) {
+					spdlog::debug("Query in getPatches was superseded by a newer one");
+				}
+				else {
+					spdlog::error("DATABASE ERROR in getPatches: SQL Exception {}", ex.what());
+				}
+				return false;
+			}
+			for (size_t i = first; i < last; i++) {
+				auto found = loaded.find(std::make_pair(matches[i].synth, indexes[matches[i].synth].second->md5(matches[i].row)));
+				// Rows deleted since the index was built are just left out
+				if (found != loaded.end()) {
+					result.push_back(found->second);
+				}
+			}
+			return true;
+		}
+
 		std::vector<Category> getCategories() {
+			ScopedLock lock(categoryLock_);
+			// Only go to the database if the category table has been modified since we last loaded it
+			if (categoryCacheVersion_ != categoryTableVersion_) {
+				categoryDefinitions_ = loadCategories();
+				categoryCacheVersion_ = categoryTableVersion_;
+			}
+			return categoryDefinitions_;
+		}
+
+		CategoryBitfield currentBitfield() {
+			ScopedLock lock(categoryLock_);
+			getCategories();
+			return bitfield;
+		}
+
+		void invalidateCategoryCache() {
+			ScopedLock lock(categoryLock_);
+			categoryTableVersion_++;
+		}
+
+		std::shared_ptr<SourceInfo> internedSourceInfo(std::shared_ptr<Synth> synth, std::string const& sourceInfoText) {
+			// Thousands of patches share the very same source info string, as they came in with the same import. Parse each distinct string only once
+			// and hand out the same immutable instance. The decoding depends on the synth (bank sizes), so that is part of the key
+			const size_t kMaxInternedSourceInfos = 4096;
+			auto key = std::make_pair(synth->getName(), sourceInfoText);
+			ScopedLock lock(sourceInfoLock_);
+			auto found = sourceInfoCache_.find(key);
+			if (found != sourceInfoCache_.end()) {
+				return found->second;
+			}
+			if (sourceInfoCache_.size() >= kMaxInternedSourceInfos) {
+				// Keep it simple, a database with that many imports just starts over
+				sourceInfoCache_.clear();
+			}
+			auto sourceInfo = SourceInfo::fromString(synth, sourceInfoText);
+			sourceInfoCache_.emplace(key, sourceInfo);
+			return sourceInfo;
+		}
+
+		std::vector<Category> loadCategories() {
 			ScopedLock lock(categoryLock_);
 			SQLite::Statement query(db_, "SELECT * FROM categories ORDER BY bitIndex");
 			std::vector<std::shared_ptr<CategoryDefinition>> activeDefinitions;
@@ -691,7 +2522,7 @@ namespace midikraft {
 
 		void updateCategories(std::vector<CategoryDefinition> const& newdefs) {
 			try {
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 
 				for (auto c : newdefs) {
 					// Check if insert or update
@@ -718,7 +2549,8 @@ namespace midikraft {
 				}
 				transaction.commit();
 				// Refresh our internal data 
-				categoryDefinitions_ = getCategories();
+				invalidateCategoryCache();
+				getCategories();
 			}
 			catch (SQLite::Exception& ex) {
 				spdlog::error("DATABASE ERROR in updateCategories: SQL Exception {}", ex.what());
@@ -741,31 +2573,32 @@ namespace midikraft {
 		}
 
 		bool loadPatchFromQueryRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, std::vector<PatchHolder>& result) {
-			ScopedLock lock(categoryLock_);
-
-			std::shared_ptr<DataFile> newPatch;
+			return loadPatchFromQueryRow(synth, query, currentBitfield(), result);
+		}
 
-			// Create the patch itself, from the BLOB stored
-			auto dataColumn = query.getColumn("data");
+		bool loadPatchFromQueryRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, CategoryBitfield const& categoryBits, std::vector<PatchHolder>& result) {
+			QueryRowScratch scratch(categoryBits);
+			return loadPatchFromQueryRow(synth, query, scratch, result);
+		}
 
+		bool loadPatchFromQueryRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, QueryRowScratch& scratch, std::vector<PatchHolder>& result) {
+			std::shared_ptr<DataFile> newPatch;
 
 			MidiProgramNumber program = MidiProgramNumber::invalidProgram();
 			MidiBankNumber bank = MidiBankNumber::invalid();
 			loadBankAndProgram(synth, query, bank, program);
 
-			// Load the BLOB
-			if (dataColumn.isBlob()) {
-			std::vector<uint8> patchData((uint8*)dataColumn.getBlob(), ((uint8*)dataColumn.getBlob()) + dataColumn.getBytes());
-			//TODO I should not need the midiProgramNumber here
-			newPatch = synth->patchFromPatchData(patchData, program);
+			// Create the patch itself, from the BLOB stored. The synth copies what it needs, so the buffer can be reused for the next row
+			std::vector<uint8>& patchData = scratch.patchData();
+			if (readPatchData(query, patchData)) {
+				//TODO I should not need the midiProgramNumber here
+				newPatch = synth->patchFromPatchData(patchData, program);
 			}
 
-			// We need the current categories
-			categoryDefinitions_ = getCategories();
 			if (newPatch) {
 				auto sourceColumn = query.getColumn("sourceInfo");
 				if (sourceColumn.isText()) {
-					PatchHolder holder(synth, SourceInfo::fromString(synth, sourceColumn.getString()), newPatch);
+					PatchHolder holder(synth, internedSourceInfo(synth, sourceColumn.getString()), newPatch);
 					holder.setBank(bank);
 					holder.setPatchNumber(program);
 
@@ -786,18 +2619,15 @@ namespace midikraft {
 					if (hiddenColumn.isInteger()) {
 						holder.setHidden(hiddenColumn.getInt() == 1);
 					}
-					std::set<Category> updateSet;
-					bitfield.makeSetOfCategoriesFromBitfield(updateSet, query.getColumn("categories").getInt64());
-					holder.setCategories(updateSet);
-					bitfield.makeSetOfCategoriesFromBitfield(updateSet, query.getColumn("categoryUserDecision").getInt64());
-					holder.setUserDecisions(updateSet);
+					holder.setCategories(scratch.categorySet(query.getColumn("categories").getInt64()));
+					holder.setUserDecisions(scratch.categorySet(query.getColumn("categoryUserDecision").getInt64()));
 
 					auto commentColumn = query.getColumn("comment");
 					if (commentColumn.isText()) {
 						holder.setComment(std::string(commentColumn.getText()));
 					}
 
-					result.push_back(holder);
+					result.push_back(std::move(holder));
 					return true;
 				}
 				else {
@@ -812,11 +2642,11 @@ namespace midikraft {
 
 		bool getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result) {
 			try {
-				SQLite::Statement query(db_, "SELECT * FROM patches WHERE md5 = :MD5 and synth = :SYN");
-				query.bind(":SYN", synth->getName());
-				query.bind(":MD5", md5);
-				if (query.executeStep()) {
-					return loadPatchFromQueryRow(synth, query, result);
+				auto query = statements_.acquire("SELECT * FROM patches" + kPatchDataJoin + " WHERE md5 = :MD5 and synth = :SYN");
+				query->bind(":SYN", synth->getName());
+				query->bind(":MD5", md5);
+				if (query->executeStep()) {
+					return loadPatchFromQueryRow(synth, *query, result);
 				}
 			}
 			catch (SQLite::Exception& ex) {
@@ -825,18 +2655,78 @@ namespace midikraft {
 			return false;
 		}
 
+		std::shared_ptr<PatchSimilarityIndex const> similarityIndex(std::shared_ptr<Synth> synth) {
+			// Built on first use and after the patches have been modified, like the metadata index. This needs to read and parse all sysex data of the synth
+			uint64_t version = patchesVersion_;
+			{
+				ScopedLock lock(metadataIndexLock_);
+				auto found = similarityIndexes_.find(synth->getName());
+				if (found != similarityIndexes_.end() && found->second->version() == version) {
+					return found->second;
+				}
+			}
+			auto index = std::make_shared<PatchSimilarityIndex>(version);
+			try {
+				auto reader = readers_.acquire();
+				auto query = reader.statements().acquire("SELECT md5, blob_data, blob_encoding, midiBankNo, midiProgramNo FROM patches" + kPatchDataJoin + " WHERE synth = :SYN");
+				query->bind(":SYN", synth->getName());
+				while (query->executeStep()) {
+					std::vector<uint8> patchData;
+					if (!readPatchData(*query, patchData)) {
+						continue;
+					}
+					MidiProgramNumber program = MidiProgramNumber::invalidProgram();
+					MidiBankNumber bank = MidiBankNumber::invalid();
+					loadBankAndProgram(synth, *query, bank, program);
+					auto patch = synth->patchFromPatchData(patchData, program);
+					if (patch) {
+						index->add(query->getColumn("md5").getString(), synth->filterVoiceRelevantData(patch));
+					}
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR building the similarity index for {}: SQL Exception {}", synth->getName(), ex.what());
+				return nullptr;
+			}
+			ScopedLock lock(metadataIndexLock_);
+			similarityIndexes_[synth->getName()] = index;
+			return index;
+		}
+
+		std::vector<SimilarPatch> findSimilarPatches(PatchHolder const& patch, size_t k) {
+			std::vector<SimilarPatch> result;
+			auto synth = patch.smartSynth();
+			if (!synth || !patch.patch()) {
+				return result;
+			}
+			auto index = similarityIndex(synth);
+			if (!index) {
+				return result;
+			}
+			for (auto const& neighbour : index->nearest(synth->filterVoiceRelevantData(patch.patch()), k, patch.md5())) {
+				std::vector<PatchHolder> loaded;
+				if (getSinglePatch(synth, neighbour.md5, loaded)) {
+					result.push_back({ loaded.back(), neighbour.distance });
+				}
+			}
+			return result;
+		}
+
 		std::vector<MidiProgramNumber> getBankPositions(std::shared_ptr<Synth> synth, std::string const& md5) {
 			std::vector<MidiProgramNumber> result;
 			try {
-				SQLite::Statement query(db_, "SELECT lists.midi_bank_number, pil.order_num FROM lists JOIN patch_in_list AS PIL ON lists.id = pil.id "
+				auto reader = readers_.acquire();
+				// The order keys have gaps, so the program place is the number of entries sorted before this one
+				auto query = reader.statements().acquire("SELECT lists.midi_bank_number, (SELECT COUNT(*) FROM patch_in_list AS p2 WHERE p2.id = pil.id AND p2.order_num < pil.order_num) AS position "
+					"FROM lists JOIN patch_in_list AS PIL ON lists.id = pil.id "
 					"WHERE pil.md5 = :MD5 and lists.synth = :SYN AND lists.last_synced IS NOT NULL AND lists.last_synced > 0 AND lists.midi_bank_number IS NOT NULL");
-				query.bind(":SYN", synth->getName());
-				query.bind(":MD5", md5);
-				while (query.executeStep()) {
-					int bankNo = query.getColumn("midi_bank_number").getInt();
+				query->bind(":SYN", synth->getName());
+				query->bind(":MD5", md5);
+				while (query->executeStep()) {
+					int bankNo = query->getColumn("midi_bank_number").getInt();
 					if (auto descriptors = Capability::hasCapability<HasBankDescriptorsCapability>(synth)) {
 						if (bankNo >= 0 && bankNo < descriptors->bankDescriptors().size()) {
-							result.push_back(MidiProgramNumber::fromZeroBaseWithBank(MidiBankNumber::fromZeroBase(bankNo, descriptors->bankDescriptors()[bankNo].size), query.getColumn("order_num").getInt()));
+							result.push_back(MidiProgramNumber::fromZeroBaseWithBank(MidiBankNumber::fromZeroBase(bankNo, descriptors->bankDescriptors()[bankNo].size), query->getColumn("position").getInt()));
 						}
 						else {
 							spdlog::error("Data error - bank number stored is bigger than bank descriptors allow for!");
@@ -845,7 +2735,7 @@ namespace midikraft {
 					else if (auto banks = Capability::hasCapability<HasBanksCapability>(synth)) {
 						// All banks have the same size
 						if (bankNo >= 0 && bankNo < banks->numberOfBanks()) {
-							result.push_back(MidiProgramNumber::fromZeroBaseWithBank(MidiBankNumber::fromZeroBase(bankNo, banks->numberOfPatches()), query.getColumn("order_num").getInt()));
+							result.push_back(MidiProgramNumber::fromZeroBaseWithBank(MidiBankNumber::fromZeroBase(bankNo, banks->numberOfPatches()), query->getColumn("position").getInt()));
 						}
 						else {
 							spdlog::error("Data error - bank number stored is bigger than banks count allows for!");
@@ -857,85 +2747,380 @@ namespace midikraft {
 				}
 			}
 			catch (SQLite::Exception& ex) {
-				spdlog::error("DATABASE ERROR in getSinglePatch: SQL Exception {}", ex.what());
+				spdlog::error("DATABASE ERROR in getSinglePatch: SQL Exception {}", ex.what());
+			}
+			return result;
+		}
+
+		std::vector<std::string> getSyncedBankFingerprints(std::shared_ptr<Synth> synth, MidiBankNumber bank) {
+			std::vector<std::string> result;
+			try {
+				auto reader = readers_.acquire();
+				// The snapshot of the last sync, not the bank list, which the user may have edited since
+				auto query = reader.statements().acquire("SELECT md5 FROM synced_banks WHERE id = :ID ORDER BY position");
+				query->bind(":ID", ActiveSynthBank::makeId(synth, bank));
+				while (query->executeStep()) {
+					result.push_back(query->getColumn("md5").getString());
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getSyncedBankFingerprints: SQL Exception {}", ex.what());
+			}
+			return result;
+		}
+
+		bool getPatches(PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit, int* outTotal = nullptr) {
+			// Only worth it for pages, a query for all patches is best done in one pass by the database
+			if (limit != -1 && getPatchesFromMetadataIndex(filter, result, needsReindexing, skip, limit, outTotal)) {
+				return true;
+			}
+			// For a page the count comes along as an uncorrelated subquery, evaluated once. It is the query of getPatchesCount(), so it reads no blobs
+			// and counts over the indexes. A COUNT(*) OVER () window would make SQLite buffer every matching row with its data before LIMIT applies.
+			// Named parameters occurring twice share their value, so the one binding serves both
+			bool countInQuery = outTotal && limit != -1;
+			std::string countColumn;
+			if (countInQuery) {
+				countColumn = fmt::format(", (SELECT count(*) FROM patches {} {}) AS total_count", buildJoinClause(filter), buildWhereClause(filter, false));
+			}
+			std::string selectStatement = fmt::format("SELECT *{} FROM patches{} {} {} {}", countColumn,
+				kPatchDataJoin, buildJoinClause(filter), buildWhereClause(filter, true), buildOrderClause(filter));
+			spdlog::debug("SQL {}", selectStatement);
+			if (limit != -1) {
+				selectStatement += " LIMIT :LIM ";
+				selectStatement += " OFFSET :OFS";
+			}
+			try {
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), selectStatement.c_str());
+
+				bindWhereClause(query, filter);
+				if (limit != -1) {
+					query.bind(":LIM", limit);
+					query.bind(":OFS", skip);
+				}
+				QueryProfiler::Scope profile(queryProfiler_, reader.db(), query, selectStatement);
+				// The category definitions can't change during a single query, so build the bitfield only once
+				QueryRowScratch scratch(currentBitfield());
+				if (limit != -1) {
+					result.reserve(result.size() + (size_t)limit);
+				}
+				int rows = 0;
+				while (profile.step()) {
+					if (countInQuery && rows == 0) {
+						*outTotal = query.getColumn("total_count").getInt();
+					}
+					rows++;
+					// Find the synth this patch is for
+					auto synthName = query.getColumn("synth");
+					if (filter.synths.find(synthName) == filter.synths.end()) {
+						spdlog::error("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString());
+						continue;
+					}
+					auto thisSynth = filter.synths[synthName].lock();
+
+					if (loadPatchFromQueryRow(thisSynth, query, scratch, result)) {
+						// Check if the MD5 is the correct one (the algorithm might have changed!)
+						std::string md5stored = query.getColumn("md5");
+						if (result.back().md5() != md5stored) {
+							needsReindexing.emplace_back(md5stored, result.back());
+						}
+					}
+				}
+				if (outTotal) {
+					if (!countInQuery) {
+						// All rows have been read
+						*outTotal = rows;
+					}
+					else if (rows == 0) {
+						// Skipped past the end, so there was no row to carry the count
+						bool counted;
+						*outTotal = getPatchesCount(filter, &counted);
+						return counted;
+					}
+				}
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				if (ex.getErrorCode() == SQLITE_INTERRUPT) {
+					spdlog::debug("Query in getPatches was superseded by a newer one");
+				}
+				else {
+					spdlog::error("DATABASE ERROR in getPatches: SQL Exception {}", ex.what());
+				}
+			}
+			return false;
+		}
+
+		bool getPatchPage(PatchFilter filter, PatchPageToken const& after, int limit, std::vector<PatchHolder>& result, PatchPageToken& outNext) {
+			auto keys = keysetColumns(filter.orderBy);
+			bool continuing = !after.isStart();
+			if (continuing && (after.ordering != filter.orderBy || after.lastKey.size() != keys.size())) {
+				spdlog::warn("Page token does not match the ordering of the filter, restarting from the first page");
+				continuing = false;
+			}
+			outNext = PatchPageToken();
+			outNext.ordering = filter.orderBy;
+			if (after.atEnd) {
+				outNext.atEnd = true;
+				return true;
+			}
+
+			std::string keyColumns;
+			std::string keyAliases;
+			std::string keyVariables;
+			for (size_t i = 0; i < keys.size(); i++) {
+				keyColumns = prependWithComma(keyColumns, keys[i]);
+				keyAliases += fmt::format(", {} AS keyset_{}", keys[i], i);
+				keyVariables = prependWithComma(keyVariables, fmt::format(":K{:02d}", i));
+			}
+			std::string whereClause = buildWhereClause(filter, true);
+			if (continuing) {
+				whereClause += fmt::format(" AND ({}) > ({})", keyColumns, keyVariables);
+			}
+			std::string selectStatement = fmt::format("SELECT *{} FROM patches{} {} {} ORDER BY {}", keyAliases, kPatchDataJoin, buildJoinClause(filter), whereClause, keyColumns);
+			if (limit != -1) {
+				selectStatement += " LIMIT :LIM";
+			}
+			try {
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), selectStatement.c_str());
+				bindWhereClause(query, filter);
+				if (continuing) {
+					for (size_t i = 0; i < after.lastKey.size(); i++) {
+						auto variable = fmt::format(":K{:02d}", i);
+						if (std::holds_alternative<int64_t>(after.lastKey[i])) {
+							query.bind(variable, std::get<int64_t>(after.lastKey[i]));
+						}
+						else {
+							query.bind(variable, std::get<std::string>(after.lastKey[i]));
+						}
+					}
+				}
+				if (limit != -1) {
+					query.bind(":LIM", limit);
+				}
+				QueryProfiler::Scope profile(queryProfiler_, reader.db(), query, selectStatement);
+				QueryRowScratch scratch(currentBitfield());
+				int rows = 0;
+				while (profile.step()) {
+					rows++;
+					// Remember the key of every row, the last one is where the next page starts
+					outNext.lastKey.clear();
+					for (size_t i = 0; i < keys.size(); i++) {
+						auto keyColumn = query.getColumn(fmt::format("keyset_{}", i).c_str());
+						if (keyColumn.isText()) {
+							outNext.lastKey.emplace_back(keyColumn.getString());
+						}
+						else {
+							outNext.lastKey.emplace_back((int64_t) keyColumn.getInt64());
+						}
+					}
+
+					auto synthName = query.getColumn("synth");
+					if (filter.synths.find(synthName) == filter.synths.end()) {
+						spdlog::error("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString());
+						continue;
+					}
+					auto thisSynth = filter.synths[synthName].lock();
+					loadPatchFromQueryRow(thisSynth, query, scratch, result);
+				}
+				if (limit == -1 || rows < limit) {
+					outNext.atEnd = true;
+				}
+				if (rows == 0) {
+					// Nothing more, keep the old position
+					outNext.lastKey = after.lastKey;
+				}
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getPatchPage: SQL Exception {}", ex.what());
 			}
-			return result;
+			return false;
 		}
 
-		bool getPatches(PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit) {
-			std::string selectStatement = fmt::format("{} SELECT * FROM patches {} {} {}", buildCTE(filter), buildJoinClause(filter), buildWhereClause(filter, true), buildOrderClause(filter));
-			spdlog::debug("SQL {}", selectStatement);
+		bool getPatchSummaries(PatchFilter filter, std::vector<PatchSummary>& result, int skip, int limit) {
+			// Same as getPatches, but with a projection that does not include the data BLOB
+			std::string selectStatement = fmt::format("SELECT patches.synth AS synth, patches.md5 AS md5, name, type, favorite, hidden, sourceID, sourceInfo, midiBankNo, midiProgramNo, categories, categoryUserDecision, comment FROM patches {} {} {}",
+				buildJoinClause(filter), buildWhereClause(filter, true), buildOrderClause(filter));
 			if (limit != -1) {
 				selectStatement += " LIMIT :LIM ";
 				selectStatement += " OFFSET :OFS";
 			}
 			try {
-				SQLite::Statement query(db_, selectStatement.c_str());
-
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), selectStatement.c_str());
 				bindWhereClause(query, filter);
 				if (limit != -1) {
 					query.bind(":LIM", limit);
 					query.bind(":OFS", skip);
 				}
-				while (query.executeStep()) {
-					// Find the synth this patch is for
-					auto synthName = query.getColumn("synth");
+				QueryProfiler::Scope profile(queryProfiler_, reader.db(), query, selectStatement);
+				auto categoryBits = currentBitfield();
+				while (profile.step()) {
+					std::string synthName = query.getColumn("synth");
 					if (filter.synths.find(synthName) == filter.synths.end()) {
-						spdlog::error("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString());
+						spdlog::error("Program error, query returned patch for synth {} which was not part of the filter", synthName);
 						continue;
 					}
 					auto thisSynth = filter.synths[synthName].lock();
 
-					if (loadPatchFromQueryRow(thisSynth, query, result)) {
-						// Check if the MD5 is the correct one (the algorithm might have changed!)
-						std::string md5stored = query.getColumn("md5");
-						if (result.back().md5() != md5stored) {
-							needsReindexing.emplace_back(md5stored, result.back());
-						}
+					PatchSummary summary;
+					summary.synth = synthName;
+					summary.md5 = query.getColumn("md5").getString();
+					summary.name = query.getColumn("name").getString();
+					summary.sourceId = query.getColumn("sourceID").getString();
+					summary.sourceInfo = query.getColumn("sourceInfo").getString();
+					auto commentColumn = query.getColumn("comment");
+					if (commentColumn.isText()) {
+						summary.comment = commentColumn.getString();
+					}
+					summary.type = query.getColumn("type").getInt();
+					auto favoriteColumn = query.getColumn("favorite");
+					if (favoriteColumn.isInteger()) {
+						summary.favorite = Favorite(favoriteColumn.getInt());
 					}
+					auto hiddenColumn = query.getColumn("hidden");
+					summary.hidden = hiddenColumn.isInteger() && hiddenColumn.getInt() == 1;
+					categoryBits.makeSetOfCategoriesFromBitfield(summary.categories, query.getColumn("categories").getInt64());
+					categoryBits.makeSetOfCategoriesFromBitfield(summary.userDecisions, query.getColumn("categoryUserDecision").getInt64());
+					loadBankAndProgram(thisSynth, query, summary.bank, summary.program);
+					result.push_back(summary);
 				}
 				return true;
 			}
 			catch (SQLite::Exception& ex) {
-				spdlog::error("DATABASE ERROR in getPatches: SQL Exception {}", ex.what());
+				spdlog::error("DATABASE ERROR in getPatchSummaries: SQL Exception {}", ex.what());
 			}
 			return false;
 		}
 
+		std::shared_ptr<DataFile> loadPatchData(std::shared_ptr<Synth> synth, std::string const& md5) {
+			try {
+				auto query = statements_.acquire("SELECT blob_data, blob_encoding, midiBankNo, midiProgramNo FROM patches" + kPatchDataJoin + " WHERE md5 = :MD5 and synth = :SYN");
+				query->bind(":SYN", synth->getName());
+				query->bind(":MD5", md5);
+				if (query->executeStep()) {
+					MidiProgramNumber program = MidiProgramNumber::invalidProgram();
+					MidiBankNumber bank = MidiBankNumber::invalid();
+					loadBankAndProgram(synth, *query, bank, program);
+					std::vector<uint8> patchData;
+					if (readPatchData(*query, patchData)) {
+						return synth->patchFromPatchData(patchData, program);
+					}
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in loadPatchData: SQL Exception {}", ex.what());
+			}
+			return nullptr;
+		}
+
+		static void primeFingerprints(std::vector<PatchHolder> const& patches) {
+			// Hash all incoming patches up front on multiple threads, the fingerprints get cached on the DataFiles so all later md5() calls are cheap
+			std::map<Synth*, TPatchVector> dataFilesBySynth;
+			for (auto const& ph : patches) {
+				if (ph.synth() && ph.patch()) {
+					dataFilesBySynth[ph.synth()].push_back(ph.patch());
+				}
+			}
+			for (auto const& [synth, dataFiles] : dataFilesBySynth) {
+				synth->fingerprints(dataFiles);
+			}
+		}
+
 		std::map<std::string, PatchHolder> bulkGetPatches(std::vector<PatchHolder> const& patches, ProgressHandler* progress) {
+			TraceSpan span("PatchDatabase::bulkGetPatches", [&patches]() { return fmt::format("{} patches", patches.size()); });
 			// Query the database for exactly those patches, we want to know which ones are already there!
 			std::map<std::string, PatchHolder> result;
 
-			int checkedForExistance = 0;
-			for (auto ph : patches) {
+			// First, calculate list of "IDs" per synth. Remember the first incoming patch for each md5, as we need its synth and source info
+			std::map<std::string, std::map<std::string, PatchHolder const*>> incomingBySynth;
+			primeFingerprints(patches);
+			for (auto const& ph : patches) {
 				if (progress && progress->shouldAbort()) return std::map<std::string, PatchHolder>();
-				// First, calculate list of "IDs"
-				// Query the database if this exists. Normally, I would bulk, but as the database is local for now I think we're going to be fine
-				try {
-					std::string md5 = ph.md5();
-					SQLite::Statement query(db_, "SELECT md5, name, midiProgramNo, midiBankNo FROM patches WHERE md5 = :MD5 and synth = :SYN");
-					query.bind(":SYN", ph.synth()->getName());
-					query.bind(":MD5", md5);
-					if (query.executeStep()) {
-						MidiProgramNumber program = MidiProgramNumber::invalidProgram();
-						MidiBankNumber bank = MidiBankNumber::invalid();
-						loadBankAndProgram(ph.smartSynth(), query, bank, program);
-						PatchHolder existingPatch(ph.smartSynth(), ph.sourceInfo(), nullptr);
-						existingPatch.setBank(bank);
-						existingPatch.setPatchNumber(program);
-						std::string name = query.getColumn("name");
-						existingPatch.setName(name);
-						result.emplace(md5, existingPatch);
+				incomingBySynth[ph.synth()->getName()].emplace(ph.md5(), &ph);
+			}
+			// Duplicates are queried once only, so the progress is measured against the distinct patches
+			size_t distinctPatches = 0;
+			for (auto const& incoming : incomingBySynth) {
+				distinctPatches += incoming.second.size();
+			}
+
+			// Now query the database in chunks of md5s, using an IN clause. Stay well below the SQLite limit of bound variables per statement
+			// Load all columns that the merge needs, but not the sysex data
+			const size_t kChunkSize = 500;
+			auto categoryBits = currentBitfield();
+			size_t checkedForExistance = 0;
+			for (auto const& [synthName, incoming] : incomingBySynth) {
+				auto chunkStart = incoming.cbegin();
+				while (chunkStart != incoming.cend()) {
+					if (progress && progress->shouldAbort()) return std::map<std::string, PatchHolder>();
+					size_t chunkLength = std::min(kChunkSize, (size_t) std::distance(chunkStart, incoming.cend()));
+					auto chunkEnd = std::next(chunkStart, (ptrdiff_t) chunkLength);
+					try {
+						std::string inClause;
+						for (size_t i = 0; i < chunkLength; i++) {
+							inClause = prependWithComma(inClause, md5Variable(i));
+						}
+						auto query = statements_.acquire("SELECT md5, name, midiProgramNo, midiBankNo, favorite, hidden, categories, categoryUserDecision, comment FROM patches WHERE synth = :SYN AND md5 IN (" + inClause + ")");
+						query->bind(":SYN", synthName);
+						size_t i = 0;
+						for (auto it = chunkStart; it != chunkEnd; it++) {
+							query->bind(md5Variable(i++), it->first);
+						}
+						while (query->executeStep()) {
+							std::string md5 = query->getColumn("md5");
+							auto found = incoming.find(md5);
+							if (found == incoming.end()) {
+								jassertfalse;
+								continue;
+							}
+							auto const& ph = *found->second;
+							MidiProgramNumber program = MidiProgramNumber::invalidProgram();
+							MidiBankNumber bank = MidiBankNumber::invalid();
+							loadBankAndProgram(ph.smartSynth(), *query, bank, program);
+							PatchHolder existingPatch(ph.smartSynth(), ph.sourceInfo(), nullptr);
+							existingPatch.setBank(bank);
+							existingPatch.setPatchNumber(program);
+							std::string name = query->getColumn("name");
+							existingPatch.setName(name);
+							auto favoriteColumn = query->getColumn("favorite");
+							if (favoriteColumn.isInteger()) {
+								existingPatch.setFavorite(Favorite(favoriteColumn.getInt()));
+							}
+							auto hiddenColumn = query->getColumn("hidden");
+							if (hiddenColumn.isInteger()) {
+								existingPatch.setHidden(hiddenColumn.getInt() == 1);
+							}
+							CategorySet updateSet;
+							categoryBits.makeSetOfCategoriesFromBitfield(updateSet, query->getColumn("categories").getInt64());
+							existingPatch.setCategories(updateSet);
+							categoryBits.makeSetOfCategoriesFromBitfield(updateSet, query->getColumn("categoryUserDecision").getInt64());
+							existingPatch.setUserDecisions(updateSet);
+							auto commentColumn = query->getColumn("comment");
+							if (commentColumn.isText()) {
+								existingPatch.setComment(commentColumn.getString());
+							}
+							result.emplace(md5, existingPatch);
+						}
 					}
+					catch (SQLite::Exception& ex) {
+						spdlog::error("DATABASE ERROR in bulkGetPatches: SQL Exception {}", ex.what());
+					}
+					checkedForExistance += chunkLength;
+					chunkStart = chunkEnd;
+					if (progress) progress->setProgressPercentage(checkedForExistance / (double)distinctPatches);
 				}
-				catch (SQLite::Exception& ex) {
-					spdlog::error("DATABASE ERROR in bulkGetPatches: SQL Exception {}", ex.what());
-				}
-				if (progress) progress->setProgressPercentage(checkedForExistance++ / (double)patches.size());
 			}
 			return result;
 		}
 
+		std::string md5Variable(size_t no) {
+			// Calculate a variable name to bind an md5 to in an IN clause
+			return fmt::format(":M{:03d}", no);
+		}
+
 		std::string prependWithComma(std::string const& target, std::string const& suffix) {
 			if (target.empty())
 				return suffix;
@@ -948,26 +3133,22 @@ namespace midikraft {
 			// user decisions. Adding a category most often is more useful than removing one
 
 			// Turn off existing user decisions where a new user decision exists
-			auto newPatchesUserDecided = category_intersection(newPatch.categories(), newPatch.userDecisionSet());
-			auto newPatchesAutomatic = category_difference(newPatch.categories(), newPatch.userDecisionSet());
-			auto oldUserDecided = category_intersection(existingPatch.categories(), existingPatch.userDecisionSet());
-
+			auto const& newCategorySet = newPatch.categorySet();
+			auto const& newUserDecisionSet = newPatch.userDecisionCategorySet();
+			auto const& existingUserDecisionSet = existingPatch.userDecisionCategorySet();
+			auto newPatchesUserDecided = newCategorySet.intersectionWith(newUserDecisionSet);
+			auto newPatchesAutomatic = newCategorySet.difference(newUserDecisionSet);
+			auto oldUserDecided = existingPatch.categorySet().intersectionWith(existingUserDecisionSet);
 
 			// The new categories are calculated as all categories from the new patch, unless there is a user decision at the existing patch not marked as overridden by a new user decision
 			// plus all existing patch categories where there is no new user decision
-			auto newAutomaticWithoutExistingOverride = category_difference(newPatchesAutomatic, existingPatch.userDecisionSet());
-			auto oldUserDecidedWithoutNewOverride = category_difference(oldUserDecided, newPatch.userDecisionSet());
-			std::set<Category> newCategories = category_union(newPatchesUserDecided, newAutomaticWithoutExistingOverride);
-			std::set<Category> finalResult = category_union(newCategories, oldUserDecidedWithoutNewOverride);
-			newPatch.setCategories(finalResult);
-
-			//int64 newPatchUserDecided = bitfield.categorySetAsBitfield(newPatch.categories()) & bitfield.categorySetAsBitfield(newPatch.userDecisionSet());
-			//int64 newPatchAutomatic = bitfield.categorySetAsBitfield(newPatch.categories()) & ~bitfield.categorySetAsBitfield(newPatch.userDecisionSet());
-			//int64 oldUserDecided = bitfield.categorySetAsBitfield(existingPatch.categories()) & bitfield.categorySetAsBitfield(existingPatch.userDecisionSet());
-			//int64 result = newPatchUserDecided | (newPatchAutomatic & ~bitfield.categorySetAsBitfield(existingPatch.userDecisionSet())) | (oldUserDecided & ~bitfield.categorySetAsBitfield(newPatch.userDecisionSet()));
+			auto newAutomaticWithoutExistingOverride = newPatchesAutomatic.difference(existingUserDecisionSet);
+			auto oldUserDecidedWithoutNewOverride = oldUserDecided.difference(newUserDecisionSet);
+			auto finalResult = newPatchesUserDecided.unionWith(newAutomaticWithoutExistingOverride).unionWith(oldUserDecidedWithoutNewOverride);
 
 			// User decisions are now a union of both
-			std::set<Category> newUserDecisions = category_union(newPatch.userDecisionSet(), existingPatch.userDecisionSet());
+			auto newUserDecisions = newUserDecisionSet.unionWith(existingUserDecisionSet);
+			newPatch.setCategories(finalResult);
 			newPatch.setUserDecisions(newUserDecisions);
 		}
 
@@ -982,55 +3163,6 @@ namespace midikraft {
 			}
 		}
 
-		void updatePatch(PatchHolder newPatch, PatchHolder existingPatch, unsigned updateChoices) {
-			if (updateChoices) {
-				std::string updateClause;
-				if (updateChoices & UPDATE_CATEGORIES) updateClause = prependWithComma(updateClause, "categories = :CAT, categoryUserDecision = :CUD");
-				if (updateChoices & UPDATE_NAME) updateClause = prependWithComma(updateClause, "name = :NAM");
-				if (updateChoices & UPDATE_HIDDEN) updateClause = prependWithComma(updateClause, "hidden = :HID");
-				if (updateChoices & UPDATE_DATA) updateClause = prependWithComma(updateClause, "data = :DAT");
-				if (updateChoices & UPDATE_FAVORITE) updateClause = prependWithComma(updateClause, "favorite = :FAV");
-				if (updateChoices & UPDATE_COMMENT) updateClause = prependWithComma(updateClause, "comment = :COM");
-
-				try {
-					SQLite::Statement sql(db_, "UPDATE patches SET " + updateClause + " WHERE md5 = :MD5 and synth = :SYN");
-					if (updateChoices & UPDATE_CATEGORIES) {
-						calculateMergedCategories(newPatch, existingPatch);
-						sql.bind(":CAT", (int64_t) bitfield.categorySetAsBitfield(newPatch.categories()));
-						sql.bind(":CUD", (int64_t) bitfield.categorySetAsBitfield(newPatch.userDecisionSet()));
-					}
-					if (updateChoices & UPDATE_NAME) {
-						sql.bind(":NAM", newPatch.name());
-					}
-					if (updateChoices & UPDATE_DATA) {
-						sql.bind(":DAT", newPatch.patch()->data().data(), (int)newPatch.patch()->data().size());
-					}
-					if (updateChoices & UPDATE_HIDDEN) {
-						sql.bind(":HID", newPatch.isHidden());
-					}
-					if (updateChoices & UPDATE_FAVORITE) {
-						sql.bind(":FAV", calculateMergedFavorite(newPatch, existingPatch));
-					}
-					if (updateChoices & UPDATE_COMMENT) {
-						std::string newComment = newPatch.comment();
-						if (newComment.empty()) {
-							newComment = existingPatch.comment();
-						}
-						sql.bind(":COM", newComment);
-					}
-					sql.bind(":MD5", newPatch.md5());
-					sql.bind(":SYN", existingPatch.synth()->getName());
-					if (sql.exec() != 1) {
-						jassert(false);
-						throw std::runtime_error("FATAL, I don't want to ruin your database");
-					}
-				}
-				catch (SQLite::Exception& ex) {
-					spdlog::error("DATABASE ERROR in updatePatch: SQL Exception {}", ex.what());
-				}
-			}
-		}
-
 		bool hasDefaultName(DataFile* patch, std::string const& patchName) {
 			auto defaultNameCapa = midikraft::Capability::hasCapability<DefaultNameCapability>(patch);
 			if (defaultNameCapa) {
@@ -1042,22 +3174,22 @@ namespace midikraft {
 		bool insertImportInfo(std::string const& synthname, std::string const& source_id, std::string const& importName) {
 			// Check if this import already exists 
 			try {
-				SQLite::Statement query(db_, "SELECT count(*) AS numExisting FROM imports WHERE synth = :SYN and id = :SID");
-				query.bind(":SYN", synthname);
-				query.bind(":SID", source_id);
-				if (query.executeStep()) {
-					auto existing = query.getColumn("numExisting");
+				auto query = statements_.acquire("SELECT count(*) AS numExisting FROM imports WHERE synth = :SYN and id = :SID");
+				query->bind(":SYN", synthname);
+				query->bind(":SID", source_id);
+				if (query->executeStep()) {
+					auto existing = query->getColumn("numExisting");
 					if (existing.getInt() == 1) {
 						return false;
 					}
 				}
 
 				// Record this import in the import table for later filtering! The name of the import might differ for different patches (bulk import), use the first patch to calculate it
-				SQLite::Statement sql(db_, "INSERT INTO imports (synth, name, id, date) VALUES (:SYN, :NAM, :SID, datetime('now'))");
-				sql.bind(":SYN", synthname);
-				sql.bind(":NAM", importName);
-				sql.bind(":SID", source_id);
-				sql.exec();
+				auto sql = statements_.acquire("INSERT INTO imports (synth, name, id, date) VALUES (:SYN, :NAM, :SID, datetime('now'))");
+				sql->bind(":SYN", synthname);
+				sql->bind(":NAM", importName);
+				sql->bind(":SID", source_id);
+				sql->exec();
 				return true;
 			}
 			catch (SQLite::Exception& ex) {
@@ -1066,53 +3198,228 @@ namespace midikraft {
 			return false;
 		}
 
+		struct PendingUpdate {
+			std::string synth;
+			std::string md5;
+			PatchHolder merged; // The new patch with categories, favorite and comment already merged with the existing row
+			unsigned updateChoices;
+		};
+
+		struct PendingInsert {
+			PatchHolder patch;
+			std::string sourceID;
+			std::string name; // Might be replaced by a better name from a duplicate, without poking it into the patch data
+		};
+
+		PendingUpdate mergeWithExisting(PatchHolder const& newPatch, PatchHolder& existingPatch, unsigned updateChoices) {
+			// Calculate the values the row will have after the update, in memory
+			PendingUpdate update{ existingPatch.synth()->getName(), newPatch.md5(), newPatch, updateChoices };
+			if (updateChoices & UPDATE_CATEGORIES) {
+				calculateMergedCategories(update.merged, existingPatch);
+				existingPatch.setCategories(update.merged.categories());
+				existingPatch.setUserDecisions(update.merged.userDecisionSet());
+			}
+			if (updateChoices & UPDATE_FAVORITE) {
+				update.merged.setFavorite(Favorite(calculateMergedFavorite(newPatch, existingPatch)));
+				existingPatch.setFavorite(update.merged.howFavorite());
+			}
+			if (updateChoices & UPDATE_COMMENT) {
+				if (update.merged.comment().empty()) {
+					update.merged.setComment(existingPatch.comment());
+				}
+				existingPatch.setComment(update.merged.comment());
+			}
+			if (updateChoices & UPDATE_NAME) {
+				existingPatch.setName(newPatch.name());
+			}
+			if (updateChoices & UPDATE_HIDDEN) {
+				existingPatch.setHidden(newPatch.isHidden());
+			}
+			return update;
+		}
+
+		std::vector<std::string> updateColumns(unsigned updateChoices) {
+			std::vector<std::string> columns;
+			if (updateChoices & UPDATE_CATEGORIES) { columns.push_back("categories"); columns.push_back("categoryUserDecision"); }
+			if (updateChoices & UPDATE_NAME) columns.push_back("name");
+			if (updateChoices & UPDATE_HIDDEN) columns.push_back("hidden");
+			if (updateChoices & UPDATE_DATA) columns.push_back("blob_hash");
+			if (updateChoices & UPDATE_FAVORITE) columns.push_back("favorite");
+			if (updateChoices & UPDATE_COMMENT) columns.push_back("comment");
+			return columns;
+		}
+
+		std::string valuesClause(size_t rows, size_t columns) {
+			std::string row;
+			for (size_t c = 0; c < columns; c++) {
+				row = prependWithComma(row, "?");
+			}
+			std::string values;
+			for (size_t r = 0; r < rows; r++) {
+				values = prependWithComma(values, "(" + row + ")");
+			}
+			return values;
+		}
+
+		void bindPatchData(SQLite::Statement& sql, int& index, std::vector<uint8> const& data) {
+			// Binds both the blob_data and the blob_encoding column
+			std::vector<uint8> stored;
+			int encoding = encodePatchData(data, dataCompressionEnabled_, stored);
+			auto const& bytes = encoding == kDataEncodingRaw ? data : stored;
+			sql.bind(index++, bytes.data(), (int)bytes.size());
+			sql.bind(index++, encoding);
+		}
+
+		size_t rowsPerChunk(size_t columns) {
+			// Stay below the historic SQLite limit of 999 bound variables per statement
+			return std::max((size_t) 1, std::min((size_t) 100, 999 / columns));
+		}
+
+		int updatePatchRow(std::string const& synthName, std::string const& md5, PatchHolder const& patch, unsigned updateChoices) {
+			// A plain UPDATE of the chosen columns, which never inserts a partial row. Returns the rows changed, 0 if the patch is not in the database
+			std::string setClause;
+			for (auto const& column : updateColumns(updateChoices)) {
+				setClause = prependWithComma(setClause, column + " = ?");
+			}
+			int rows;
+			{
+				auto sql = statements_.acquire(fmt::format("UPDATE patches SET {} WHERE synth = ? AND md5 = ?", setClause));
+				int index = 1;
+				if (updateChoices & UPDATE_CATEGORIES) {
+					sql->bind(index++, (int64_t) bitfield.categorySetAsBitfield(patch.categorySet()));
+					sql->bind(index++, (int64_t) bitfield.categorySetAsBitfield(patch.userDecisionCategorySet()));
+				}
+				if (updateChoices & UPDATE_NAME) sql->bind(index++, patch.name());
+				if (updateChoices & UPDATE_HIDDEN) sql->bind(index++, patch.isHidden());
+				if (updateChoices & UPDATE_DATA) sql->bind(index++, storePatchData(patch.patch()->data()));
+				if (updateChoices & UPDATE_FAVORITE) sql->bind(index++, (int)patch.howFavorite().is());
+				if (updateChoices & UPDATE_COMMENT) sql->bind(index++, patch.comment());
+				sql->bind(index++, synthName);
+				sql->bind(index++, md5);
+				rows = sql->exec();
+			}
+			if (rows > 0 && (updateChoices & UPDATE_CATEGORIES)) {
+				updatePatchCategoryIndex(synthName, md5, patch.categorySet());
+			}
+			return rows;
+		}
+
+		void updatePatches(std::vector<PendingUpdate> const& updates, ProgressHandler* progress) {
+			// The rows were all found by the bulk get while holding the writer lock, so each update must change exactly one. Throws on any failure,
+			// so the caller's transaction is rolled back instead of committing half a merge
+			size_t done = 0;
+			for (auto const& update : updates) {
+				if (progress && progress->shouldAbort()) return;
+				if (update.updateChoices) {
+					int rows = updatePatchRow(update.synth, update.md5, update.merged, update.updateChoices);
+					if (rows != 1) {
+						jassertfalse;
+						throw SQLite::Exception(fmt::format("Program error - update of existing patch {} modified {} rows", update.md5, rows));
+					}
+				}
+				done++;
+				if (progress && done % 100 == 0) progress->setProgressPercentage(done / (double)updates.size());
+			}
+		}
+
+		size_t insertPatches(std::vector<PendingInsert> const& inserts, ProgressHandler* progress) {
+			const size_t kColumns = 15;
+			size_t chunkSize = rowsPerChunk(kColumns);
+			size_t inserted = 0;
+			for (size_t start = 0; start < inserts.size(); start += chunkSize) {
+				if (progress && progress->shouldAbort()) break;
+				size_t count = std::min(chunkSize, inserts.size() - start);
+				try {
+					auto sql = statements_.acquire("INSERT INTO patches (synth, md5, name, type, blob_hash, favorite, hidden, sourceID, sourceName, sourceInfo, midiBankNo, midiProgramNo, categories, categoryUserDecision, comment)"
+						" VALUES " + valuesClause(count, kColumns));
+					int index = 1;
+					for (size_t i = start; i < start + count; i++) {
+						auto const& patch = inserts[i].patch;
+						sql->bind(index++, patch.synth()->getName());
+						sql->bind(index++, patch.md5());
+						sql->bind(index++, inserts[i].name);
+						sql->bind(index++, patch.getType());
+						sql->bind(index++, storePatchData(patch.patch()->data()));
+						sql->bind(index++, (int)patch.howFavorite().is());
+						sql->bind(index++, patch.isHidden());
+						sql->bind(index++, inserts[i].sourceID);
+						sql->bind(index++, patch.sourceInfo()->toDisplayString(patch.synth(), false));
+						sql->bind(index++, patch.sourceInfo()->toString());
+						sql->bind(index++, patch.bankNumber().isValid() ? patch.bankNumber().toZeroBased() : 0);
+						sql->bind(index++, patch.patchNumber().toZeroBasedWithBank());
+						sql->bind(index++, (int64_t) bitfield.categorySetAsBitfield(patch.categorySet()));
+						sql->bind(index++, (int64_t) bitfield.categorySetAsBitfield(patch.userDecisionCategorySet()));
+						sql->bind(index++, patch.comment());
+					}
+					sql->exec();
+					for (size_t i = start; i < start + count; i++) {
+						auto const& patch = inserts[i].patch;
+						updatePatchCategoryIndex(patch.synth()->getName(), patch.md5(), patch.categorySet());
+					}
+					inserted += count;
+				}
+				catch (SQLite::Exception& ex) {
+					spdlog::error("DATABASE ERROR in insertPatches: SQL Exception {}", ex.what());
+					throw;
+				}
+				if (progress) progress->setProgressPercentage((start + count) / (double)inserts.size());
+			}
+			return inserted;
+		}
+
+		bool updateExistingPatches(std::vector<PatchHolder> const& patches, unsigned updateChoice) {
+			// Writes the chosen fields as they are, in one transaction. Unlike the merge this never inserts, so a patch deleted in the meantime
+			// stays deleted. Returns false if nothing was written
+			updateChoice &= ~UPDATE_DATA;
+			if (updateChoice == 0 || patches.empty()) {
+				return true;
+			}
+			try {
+				WriteTransaction transaction(writer_, db_);
+				for (auto const& patch : patches) {
+					updatePatchRow(patch.synth()->getName(), patch.md5(), patch, updateChoice);
+				}
+				transaction.commit();
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in updateExistingPatches: SQL Exception {}", ex.what());
+				return false;
+			}
+		}
+
 		size_t mergePatchesIntoDatabase(std::vector<PatchHolder>& patches, std::vector<PatchHolder>& outNewPatches, ProgressHandler* progress, unsigned updateChoice, bool useTransaction) {
+			TraceSpan span("PatchDatabase::mergePatchesIntoDatabase", [&patches]() { return fmt::format("{} patches", patches.size()); });
+			// No other write may change the patches known until the merge result has been written
+			std::lock_guard<WriterLock> writing(writer_);
 			// This works by doing a bulk get operation for the patches from the database...
 			auto knownPatches = bulkGetPatches(patches, progress);
 
-			std::unique_ptr<SQLite::Transaction> transaction;
-			if (useTransaction) {
-				transaction = std::make_unique<SQLite::Transaction>(db_);
-			}
-
-			int loop = 0;
+			// ...then merging everything in memory...
 			int updatedNames = 0;
+			std::vector<PendingUpdate> updates;
 			for (auto& patch : patches) {
 				if (progress && progress->shouldAbort()) return 0;
 
 				auto md5_key = patch.md5();
-
-				if (knownPatches.find(md5_key) != knownPatches.end()) {
+				auto known = knownPatches.find(md5_key);
+				if (known != knownPatches.end()) {
 					// Super special logic - do not set the name if the patch name is a default name to prevent us from losing manually given names or those imported from "better" sysex files
 					unsigned onlyUpdateThis = updateChoice;
 					if (hasDefaultName(patch.patch().get(), patch.name())) {
 						onlyUpdateThis = onlyUpdateThis & (~UPDATE_NAME);
 					}
-					if ((onlyUpdateThis & UPDATE_NAME) && (patch.name() != knownPatches[md5_key].name())) {
+					if ((onlyUpdateThis & UPDATE_NAME) && (patch.name() != known->second.name())) {
 						updatedNames++;
-						spdlog::info("Renaming {} with better name {}", knownPatches[md5_key].name(), patch.name());
-					}
-
-					// Update the database with the new info. If more than the name should be updated, we first need to load the full existing patch (the bulkGetPatches only is a projection with the name loaded only)
-					if (onlyUpdateThis != UPDATE_NAME) {
-						std::vector<PatchHolder> result;
-						if (getSinglePatch(patch.smartSynth(), md5_key, result)) {
-							updatePatch(patch, result.back(), onlyUpdateThis);
-						}
-						else {
-							jassertfalse;
-						}
-					}
-					else {
-						// We don't need to get back to the database if we only update the name
-						updatePatch(patch, knownPatches[md5_key], UPDATE_NAME);
+						spdlog::info("Renaming {} with better name {}", known->second.name(), patch.name());
 					}
+					// The bulk get has loaded all columns needed for the merge, and the merge result is remembered in case the same patch comes again
+					updates.push_back(mergeWithExisting(patch, known->second, onlyUpdateThis));
 				}
 				else {
 					// This is a new patch - it needs to be uploaded into the database!
 					outNewPatches.push_back(patch);
 				}
-				if (progress) progress->setProgressPercentage(loop++ / (double)patches.size());
 			}
 
 			// Did we find better names? Then log it
@@ -1126,61 +3433,61 @@ namespace midikraft {
 			for (const auto& newPatch : outNewPatches) {
 				if (!newPatch.sourceInfo()) {
 					// Patch with no source info, probably very old or from 3rd party system
+					continue;
 				}
-				else if (SourceInfo::isEditBufferImport(newPatch.sourceInfo())) {
+				std::string patchMD5 = newPatch.md5();
+				if (SourceInfo::isEditBufferImport(newPatch.sourceInfo())) {
 					// EditBuffer, nothing to do
 					// In case this is an EditBuffer import (no bank known), always use the same "fake UUID" "EditBufferImport"
-					mapMD5_to_idOfImport[newPatch.md5()] = "EditBufferImport";
+					mapMD5_to_idOfImport[patchMD5] = "EditBufferImport";
 					importsToBeCreated.emplace(newPatch.synth()->getName(), "EditBufferImport", "Edit buffer imports");
 				}
 				else {
 					std::string importDisplayString = newPatch.sourceInfo()->toDisplayString(newPatch.synth(), true);;
 					std::string importUID = newPatch.sourceInfo()->md5(newPatch.synth());
-					if (mapMD5_to_idOfImport.find(newPatch.md5()) == mapMD5_to_idOfImport.end()) {
+					if (mapMD5_to_idOfImport.find(patchMD5) == mapMD5_to_idOfImport.end()) {
 						// Only use the import ID of the first instance of the patch found, because the loop below will skip all duplicates!
-						mapMD5_to_idOfImport[newPatch.md5()] = importUID;
+						mapMD5_to_idOfImport[patchMD5] = importUID;
 						importsToBeCreated.emplace(newPatch.synth()->getName(), importUID, importDisplayString);
 					}
 				}
 			}
 
-			//TODO can be replaced by repaired bulkPut
-			std::map<String, PatchHolder> md5Inserted;
-			std::map<Synth*, int> synthsWithUploadedItems;
-			int sumOfAll = 0;
+			// Build the list of rows to insert, skipping duplicates but picking up better names from them
+			std::vector<PendingInsert> inserts;
+			std::map<std::string, size_t> md5Inserted;
 			for (const auto& newPatch : outNewPatches) {
-				if (progress && progress->shouldAbort()) {
-					return (size_t)sumOfAll;
-				}
 				std::string patchMD5 = newPatch.md5();
-				if (md5Inserted.find(patchMD5) != md5Inserted.end()) {
-					auto duplicate = md5Inserted[patchMD5];
-
+				auto duplicate = md5Inserted.find(patchMD5);
+				if (duplicate != md5Inserted.end()) {
+					auto& first = inserts[duplicate->second];
 					// The new one could have better name?
-					if (hasDefaultName(duplicate.patch().get(), duplicate.name()) && !hasDefaultName(newPatch.patch().get(), newPatch.name())) {
-						updatePatch(newPatch, duplicate, UPDATE_NAME);
-						spdlog::info("Updating patch name {} to better one: {}", duplicate.name(), newPatch.name());
+					if (hasDefaultName(first.patch.patch().get(), first.name) && !hasDefaultName(newPatch.patch().get(), newPatch.name())) {
+						spdlog::info("Updating patch name {} to better one: {}", first.name, newPatch.name());
+						first.name = newPatch.name();
 					}
 					else {
-						spdlog::info("Skipping patch {} because it is a duplicate of {}", newPatch.name(),  duplicate.name());
+						spdlog::info("Skipping patch {} because it is a duplicate of {}", newPatch.name(), first.name);
 					}
 				}
 				else {
-					if (newPatch.sourceId().empty()) {
-						putPatch(newPatch, mapMD5_to_idOfImport[patchMD5]);
-						if (synthsWithUploadedItems.find(newPatch.synth()) == synthsWithUploadedItems.end()) {
-							// First time this synth sees an upload
-							synthsWithUploadedItems[newPatch.synth()] = 0;
-						}
-						synthsWithUploadedItems[newPatch.synth()] += 1;
-					}
-					else {
-						putPatch(newPatch, newPatch.sourceId());
-					}
-					md5Inserted[patchMD5] = newPatch;
-					sumOfAll++;
+					md5Inserted[patchMD5] = inserts.size();
+					inserts.push_back({ newPatch, newPatch.sourceId().empty() ? mapMD5_to_idOfImport[patchMD5] : newPatch.sourceId(), newPatch.name() });
 				}
-				if (progress) progress->setProgressPercentage(sumOfAll / (double)outNewPatches.size());
+			}
+
+			// ...and finally writing it in batches
+			std::unique_ptr<WriteTransaction> transaction;
+			if (useTransaction) {
+				transaction = std::make_unique<WriteTransaction>(writer_, db_);
+			}
+
+			updatePatches(updates, progress);
+			if (progress && progress->shouldAbort()) return 0;
+
+			size_t sumOfAll = insertPatches(inserts, progress);
+			if (progress && progress->shouldAbort()) {
+				return sumOfAll;
 			}
 
 			for (auto import : importsToBeCreated) {
@@ -1206,6 +3513,7 @@ namespace midikraft {
 					deleteStatement = "DELETE FROM patches WHERE ROWID IN (SELECT patches.ROWID FROM patches "
 						+ buildJoinClause(filter) + buildWhereClause(filter, false) + ")";
 				}
+				WriteTransaction transaction(writer_, db_);
 				SQLite::Statement query(db_, deleteStatement.c_str());
 				bindWhereClause(query, filter);
 
@@ -1215,6 +3523,7 @@ namespace midikraft {
 				// Make sure there are no orphans left in any patch list
 				removeAllOrphansFromPatchLists();
 
+				transaction.commit();
 				return rowsDeleted;
 			}
 			catch (SQLite::Exception& ex) {
@@ -1225,120 +3534,385 @@ namespace midikraft {
 
 		std::pair<int, int> deletePatches(std::string const& synth, std::vector<std::string> const& md5s) {
 			try {
-				int rowsDeleted = 0;
-				int rowsHidden = 0;
-				for (auto md5 : md5s) {
-					// We need to check if the patch to be deleted is part of a bank. Then it cannot be deleted, but just hidden
-					// it can be deleted from regular user lists, though, so let's do this first;
-					removePatchFromSimpleList(synth, md5);
-
-					if (isPatchPartOfBank(synth, md5)) {
-						// Just hide it
-						SQLite::Statement query(db_, "UPDATE patches SET hidden = 1 WHERE synth = :SYN and md5 = :MD5");
-						query.bind(":SYN", synth);
-						query.bind(":MD5", md5);
-						rowsHidden += query.exec();
+				WriteTransaction transaction(writer_, db_);
+				auto result = deletePatchesInTransaction(synth, md5s);
+				transaction.commit();
+				return result;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in deletePatches via md5s: SQL Exception {}", ex.what());
+			}
+			return{ 0, 0 };
+		}
+
+		std::pair<int, int> deletePatchesInTransaction(std::string const& synth, std::vector<std::string> const& md5s) {
+			// Call this within a transaction, it throws on errors. Set based, so the number of statements does not depend on how many patches are deleted. 
+			// The md5s go into a temp table first, which lives as long as the connection and is only ever seen by it
+			db_.exec("CREATE TEMP TABLE IF NOT EXISTS delete_md5s(md5 TEXT PRIMARY KEY)");
+			db_.exec("DELETE FROM delete_md5s");
+			auto insert = statements_.acquire("INSERT OR IGNORE INTO delete_md5s (md5) VALUES (:MD5)");
+			for (auto const& md5 : md5s) {
+				insert->bind(":MD5", md5);
+				insert->exec();
+				insert->reset();
+			}
+
+			// Patches can be deleted from regular user lists, so let's do this first
+			auto removeFromSimpleLists = statements_.acquire("DELETE FROM patch_in_list WHERE synth = :SYN AND md5 IN (SELECT md5 FROM delete_md5s) "
+				"AND EXISTS (SELECT * FROM lists WHERE id = patch_in_list.id AND synth IS NULL)");
+			removeFromSimpleLists->bind(":SYN", synth);
+			removeFromSimpleLists->exec();
+
+			// A patch that is part of a bank cannot be deleted, but just hidden
+			std::string partOfBank = "EXISTS (SELECT * FROM lists INNER JOIN patch_in_list AS pil ON lists.id = pil.id WHERE lists.synth = :SYN AND pil.md5 = patches.md5)";
+			auto hide = statements_.acquire("UPDATE patches SET hidden = 1 WHERE synth = :SYN AND md5 IN (SELECT md5 FROM delete_md5s) AND " + partOfBank);
+			hide->bind(":SYN", synth);
+			int rowsHidden = hide->exec();
+			auto remove = statements_.acquire("DELETE FROM patches WHERE synth = :SYN AND md5 IN (SELECT md5 FROM delete_md5s) AND NOT " + partOfBank);
+			remove->bind(":SYN", synth);
+			int rowsDeleted = remove->exec();
+
+			db_.exec("DELETE FROM delete_md5s");
+			return { rowsDeleted, rowsHidden };
+		}
+
+		int bulkUpdate(std::string const& synth, std::vector<std::string> const* md5s, PatchFilter const* filter, unsigned field, int value, int categoryBit) {
+			// Only rows whose value changes are touched, so the change journal and the count returned only see real changes
+			std::string setClause;
+			std::string changedClause;
+			switch (field) {
+			case UPDATE_FAVORITE:
+				setClause = "favorite = :BULK_VALUE";
+				changedClause = "favorite IS NOT :BULK_VALUE";
+				break;
+			case UPDATE_HIDDEN:
+				setClause = "hidden = :BULK_VALUE";
+				changedClause = "hidden IS NOT :BULK_VALUE";
+				break;
+			case UPDATE_CATEGORIES:
+				if (categoryBit < 0 || categoryBit > 63) {
+					spdlog::error("Program error - category bit index {} out of range for bulk update", categoryBit);
+					return -1;
+				}
+				setClause = fmt::format("categories = COALESCE(categories, 0) {}, categoryUserDecision = COALESCE(categoryUserDecision, 0) | :BULK_MASK",
+					value ? "| :BULK_MASK" : "& ~:BULK_MASK");
+				changedClause = fmt::format("((COALESCE(categories, 0) & :BULK_MASK) {} 0 OR (COALESCE(categoryUserDecision, 0) & :BULK_MASK) = 0)", value ? "=" : "<>");
+				break;
+			default:
+				spdlog::error("Program error - bulk update only supports favorite, hidden and categories");
+				return -1;
+			}
+
+			try {
+				WriteTransaction transaction(writer_, db_);
+				std::string selection;
+				if (md5s) {
+					// Same as for deleting, the md5s go into a temp table only this connection sees
+					db_.exec("CREATE TEMP TABLE IF NOT EXISTS bulk_md5s(md5 TEXT PRIMARY KEY)");
+					db_.exec("DELETE FROM bulk_md5s");
+					auto insert = statements_.acquire("INSERT OR IGNORE INTO bulk_md5s (md5) VALUES (:MD5)");
+					for (auto const& md5 : *md5s) {
+						insert->bind(":MD5", md5);
+						insert->exec();
+						insert->reset();
+					}
+					selection = "patches.synth = :SYN AND patches.md5 IN (SELECT md5 FROM bulk_md5s)";
+				}
+				else {
+					// As for deleting via filter, the join of a list filter has to become a subquery
+					selection = "patches.ROWID IN (SELECT patches.ROWID FROM patches " + buildJoinClause(*filter) + buildWhereClause(*filter, false) + ")";
+				}
+				auto bindSelection = [&](SQLite::Statement& statement) {
+					if (md5s) {
+						statement.bind(":SYN", synth);
 					}
 					else {
-						// Build a delete query
-						std::string deleteStatement = "DELETE FROM patches WHERE md5 = :MD5 AND synth = :SYN";
-						SQLite::Statement query(db_, deleteStatement.c_str());
-						query.bind(":SYN", synth);
-						query.bind(":MD5", md5);
-						// Execute
-						rowsDeleted += query.exec();
+						bindWhereClause(statement, *filter);
 					}
+				};
+
+				if (field == UPDATE_CATEGORIES) {
+					// Keep the patch_category table in sync with the bitfields, set based as well. This has to come first: the selection can filter on
+					// the very column the update changes, e.g. untagged patches, and would not find the rows anymore afterwards. Every selected row
+					// ends up with the bit as given, so the index can be written for all of them
+					std::string indexStatement = value
+						? "INSERT OR IGNORE INTO patch_category (synth, md5, bitIndex) SELECT patches.synth, patches.md5, :BIT FROM patches WHERE " + selection
+						: "DELETE FROM patch_category WHERE bitIndex = :BIT AND EXISTS (SELECT 1 FROM patches WHERE patches.synth = patch_category.synth "
+							"AND patches.md5 = patch_category.md5 AND " + selection + ")";
+					SQLite::Statement index(db_, indexStatement);
+					bindSelection(index);
+					index.bind(":BIT", categoryBit);
+					index.exec();
 				}
 
-				// Make sure there are no orphans left in any patch list
-				//removeAllOrphansFromPatchLists();
+				SQLite::Statement update(db_, fmt::format("UPDATE patches SET {} WHERE {} AND {}", setClause, selection, changedClause));
+				bindSelection(update);
+				if (field == UPDATE_CATEGORIES) {
+					update.bind(":BULK_MASK", (int64_t)(1ULL << categoryBit));
+				}
+				else {
+					update.bind(":BULK_VALUE", value);
+				}
+				int changed = update.exec();
 
-				return { rowsDeleted, rowsHidden };
+				if (md5s) {
+					db_.exec("DELETE FROM bulk_md5s");
+				}
+				transaction.commit();
+				return changed;
 			}
 			catch (SQLite::Exception& ex) {
-				spdlog::error("DATABASE ERROR in deletePatches via md5s: SQL Exception {}", ex.what());
+				spdlog::error("DATABASE ERROR in bulkUpdate: SQL Exception {}", ex.what());
 			}
-			return{ 0, 0 };
+			return -1;
 		}
 
-		int reindexPatches(PatchFilter filter) {
+		int reindexPatches(PatchFilter filter, ProgressHandler* progress) {
 			// Give up if more than one synth is selected
 			if (filter.synths.size() > 1) {
 				spdlog::error("Aborting reindexing - please select only one synth at a time in the advanced filter dialog!");
 				return -1;
 			}
+			if (filter.synths.empty()) {
+				return 0;
+			}
+			auto synth = filter.synths.begin()->second.lock();
+
+			// Walk the table in rowid order, one chunk at a time, so we never have more than one chunk of patches in memory. Every chunk is
+			// committed on its own - should this be aborted, running it again will find only the patches not yet reindexed
+			const int kChunkSize = 500;
+			int total = getPatchesCount(filter);
+			int processed = 0;
+			int reindexed = 0;
+			int64_t lastRowid = -1;
+			std::string selectStatement = fmt::format("SELECT *, patches.rowid AS reindex_rowid FROM patches{} {} {} AND patches.rowid > :ROW ORDER BY patches.rowid LIMIT :LIM",
+				kPatchDataJoin, buildJoinClause(filter), buildWhereClause(filter, true));
+			while (true) {
+				if (progress && progress->shouldAbort()) {
+					spdlog::info("Reindexing aborted after {} patches, run it again to continue", reindexed);
+					break;
+				}
+
+				// Load the next chunk and calculate the fingerprints
+				std::vector<std::pair<std::string, PatchHolder>> toBeReindexed;
+				int rowsInChunk = 0;
+				try {
+					SQLite::Statement query(db_, selectStatement.c_str());
+					bindWhereClause(query, filter);
+					query.bind(":ROW", (int64_t) lastRowid);
+					query.bind(":LIM", kChunkSize);
+					QueryRowScratch scratch(currentBitfield());
+					std::vector<PatchHolder> loaded;
+					std::vector<std::string> storedMD5s;
+					while (query.executeStep()) {
+						rowsInChunk++;
+						lastRowid = query.getColumn("reindex_rowid").getInt64();
+						if (loadPatchFromQueryRow(synth, query, scratch, loaded)) {
+							storedMD5s.push_back(query.getColumn("md5"));
+						}
+					}
+					// Check if the MD5 is the correct one (the algorithm might have changed!). Hash the whole chunk in parallel
+					TPatchVector dataFiles;
+					for (auto const& patch : loaded) {
+						dataFiles.push_back(patch.patch());
+					}
+					auto calculatedMD5s = synth->fingerprints(dataFiles);
+					for (size_t i = 0; i < loaded.size(); i++) {
+						if (calculatedMD5s[i] != storedMD5s[i]) {
+							toBeReindexed.emplace_back(storedMD5s[i], loaded[i]);
+						}
+					}
+				}
+				catch (SQLite::Exception& e) {
+					spdlog::error("Aborting reindexing - database error retrieving the filtered patches: {}", e.what());
+					return -1;
+				}
+				if (rowsInChunk == 0) {
+					break;
+				}
 
-			// Retrieve the patches to reindex
-			std::vector<PatchHolder> result;
-			std::vector<std::pair<std::string, PatchHolder>> toBeReindexed;
-			if (getPatches(filter, result, toBeReindexed, 0, -1)) {
 				if (!toBeReindexed.empty()) {
-					std::vector<std::string> toBeDeleted;
+					// This is a complex database operation, use a transaction to make sure we get all or nothing for this chunk
+					WriteTransaction transaction(writer_, db_);
+
+					// First insert the retrieved patches back into the database. The merge logic will handle the multiple instance situation
 					std::vector<PatchHolder> toBeReinserted;
-					for (auto d : toBeReindexed) {
+					std::vector<std::string> toBeDeleted;
+					for (auto const& d : toBeReindexed) {
 						toBeDeleted.push_back(d.first);
 						toBeReinserted.push_back(d.second);
 					}
-
-					// This is a complex database operation, use a transaction to make sure we get all or nothing
-					SQLite::Transaction transaction(db_);
-
-					// First insert the retrieved patches back into the database. The merge logic will handle the multiple instance situation
 					std::vector<PatchHolder> remainingPatches;
-					mergePatchesIntoDatabase(toBeReinserted, remainingPatches, nullptr, UPDATE_ALL, false);
+					try {
+						mergePatchesIntoDatabase(toBeReinserted, remainingPatches, nullptr, UPDATE_ALL, false);
+					}
+					catch (SQLite::Exception& e) {
+						spdlog::error("Aborting reindexing - could not store the reindexed patches: {}", e.what());
+						return -1;
+					}
 
 					// Now, update the patch in list table to point to the newly inserted patch
-					for (auto remap : toBeReindexed) {
+					for (auto const& remap : toBeReindexed) {
 						try {
-							SQLite::Statement query(db_, "SELECT count(*) as num_entries from patch_in_list WHERE synth = :SYN and md5 = :MD5");
-							query.bind(":SYN", remap.second.synth()->getName());
-							query.bind(":MD5", remap.first);
-							bool worked = query.executeStep();
-							if (!worked) {
-								spdlog::error("Failed to query patch_in_list table, program error");
-								return -1;
-							}
-							int found = query.getColumn("num_entries").getInt();
-							if (found > 0) {
-								spdlog::error("Found {} list entries for patch, updating {}", found, remap.first);
-								SQLite::Statement query(db_, "UPDATE patch_in_list SET md5 = :MDN WHERE synth = :SYN and md5 = :MD5");
-								query.bind(":SYN", remap.second.synth()->getName());
-								query.bind(":MD5", remap.first);
-								query.bind(":MDN", remap.second.md5());
-								int rowUpdated = query.exec();
-								if (rowUpdated != found) {
-									spdlog::error("Aborting reindexing - could not update patch in list entry for md5 {}: {} updated but {} expected", remap.first, rowUpdated, found);
-									return -1;
-								}
+							auto query = statements_.acquire("UPDATE patch_in_list SET md5 = :MDN WHERE synth = :SYN and md5 = :MD5");
+							query->bind(":SYN", synth->getName());
+							query->bind(":MD5", remap.first);
+							query->bind(":MDN", remap.second.md5());
+							int rowUpdated = query->exec();
+							if (rowUpdated > 0) {
+								spdlog::info("Updated {} list entries for patch {}", rowUpdated, remap.first);
 							}
 						}
 						catch (SQLite::Exception& e) {
-							spdlog::error("Database error when reindexing patches: {}", e.what());
+							spdlog::error("Aborting reindexing - could not update patch in list entry for md5 {}: {}", remap.first, e.what());
 							return -1;
 						}
 					}
 
-					// We got everything into the RAM - do we dare do delete them from the database now?
-					auto [deleted, hidden] = deletePatches(filter.synths.begin()->second.lock()->getName(), toBeDeleted);
+					// Now that nothing refers to them anymore, delete the old entries. Already inside this chunk's transaction
+					int deleted = 0;
+					try {
+						deleted = deletePatchesInTransaction(synth->getName(), toBeDeleted).first;
+					}
+					catch (SQLite::Exception& e) {
+						spdlog::error("Aborting reindexing - could not delete the old entries: {}", e.what());
+						return -1;
+					}
 					if (deleted != (int)toBeReindexed.size()) {
 						spdlog::error("Aborting reindexing - count of deleted patches does not match count of retrieved patches. Program Error.");
 						return -1;
 					}
 
 					transaction.commit();
+					reindexed += (int)toBeReindexed.size();
+				}
+
+				processed += rowsInChunk;
+				if (progress && total > 0) progress->setProgressPercentage(std::min(1.0, processed / (double)total));
+			}
+
+			if (reindexed == 0) {
+				spdlog::info("None of the selected patches needed reindexing skipping!");
+			}
+			else {
+				spdlog::info("Reindexed {} patches", reindexed);
+			}
+			return getPatchesCount(filter);
+		}
+
+		bool patchesCarryStoredTags(std::shared_ptr<Synth> synth, PatchFilter const& filter) {
+			// The categorizer only needs the sysex data if the synth stores tags in the patch itself. Probe the first patch to find out
+			try {
+				std::string selectStatement = fmt::format("SELECT * FROM patches{} {} {} LIMIT 1", kPatchDataJoin, buildJoinClause(filter), buildWhereClause(filter, true));
+				SQLite::Statement query(db_, selectStatement.c_str());
+				bindWhereClause(query, filter);
+				std::vector<PatchHolder> probe;
+				if (query.executeStep() && loadPatchFromQueryRow(synth, query, probe)) {
+					return Capability::hasCapability<StoredTagCapability>(probe.back().patch()) != nullptr;
+				}
+			}
+			catch (SQLite::Exception& e) {
+				spdlog::error("DATABASE ERROR in patchesCarryStoredTags: SQL Exception {}", e.what());
+			}
+			return false;
+		}
+
+		int recategorize(PatchFilter filter, std::shared_ptr<AutomaticCategory> categorizer, ProgressHandler* progress) {
+			if (!categorizer) {
+				return 0;
+			}
+
+			// Same chunked walk in rowid order as the reindexing, but only the columns the categorizer looks at are loaded, and each synth is done on its own
+			const int kChunkSize = 1000;
+			int total = getPatchesCount(filter);
+			int processed = 0;
+			int changed = 0;
+			auto categoryBits = currentBitfield();
+			for (auto const& [synthName, weakSynth] : filter.synths) {
+				auto synth = weakSynth.lock();
+				if (!synth) continue;
+				PatchFilter synthFilter = filter;
+				synthFilter.synths = { { synthName, weakSynth } };
+				bool needsPatchData = patchesCarryStoredTags(synth, synthFilter);
+				std::string columns = needsPatchData ? "*" : "patches.md5, patches.name, patches.categories, patches.categoryUserDecision";
+				std::string selectStatement = fmt::format("SELECT {}, patches.rowid AS recat_rowid FROM patches{} {} {} AND patches.rowid > :ROW ORDER BY patches.rowid LIMIT :LIM",
+					columns, needsPatchData ? kPatchDataJoin : "", buildJoinClause(synthFilter), buildWhereClause(synthFilter, true));
+				int64_t lastRowid = -1;
+				while (true) {
+					if (progress && progress->shouldAbort()) {
+						spdlog::info("Recategorization aborted after {} changed patches", changed);
+						return changed;
+					}
+
+					std::vector<int64_t> rowids;
+					std::vector<std::string> md5s;
+					std::vector<PatchHolder> patches;
+					try {
+						SQLite::Statement query(db_, selectStatement.c_str());
+						bindWhereClause(query, synthFilter);
+						query.bind(":ROW", (int64_t) lastRowid);
+						query.bind(":LIM", kChunkSize);
+						int rowsInChunk = 0;
+						while (query.executeStep()) {
+							rowsInChunk++;
+							lastRowid = query.getColumn("recat_rowid").getInt64();
+							if (needsPatchData) {
+								if (!loadPatchFromQueryRow(synth, query, categoryBits, patches)) continue;
+							}
+							else {
+								PatchHolder holder(synth, nullptr, nullptr);
+								holder.setName(query.getColumn("name").getString());
+								CategorySet categorySet;
+								categoryBits.makeSetOfCategoriesFromBitfield(categorySet, query.getColumn("categories").getInt64());
+								holder.setCategories(categorySet);
+								categoryBits.makeSetOfCategoriesFromBitfield(categorySet, query.getColumn("categoryUserDecision").getInt64());
+								holder.setUserDecisions(categorySet);
+								patches.push_back(holder);
+							}
+							rowids.push_back(lastRowid);
+							md5s.push_back(query.getColumn("md5").getString());
+						}
+						if (rowsInChunk == 0) {
+							break;
+						}
+						processed += rowsInChunk;
+					}
+					catch (SQLite::Exception& e) {
+						spdlog::error("Aborting recategorization - database error retrieving the filtered patches: {}", e.what());
+						return -1;
+					}
+
+					// Run the rules on all threads, the categorizer is not modified while matching
+					std::vector<char> hasChanged(patches.size(), 0);
+					ParallelFor::run(patches.size(), [&](size_t i) {
+						hasChanged[i] = patches[i].autoCategorizeAgain(categorizer) ? 1 : 0;
+					});
 
-					return getPatchesCount(filter);
-				}
-				else {
-					spdlog::info("None of the selected patches needed reindexing skipping!");
-					return getPatchesCount(filter);
+					// Write back only the patches that did change, in one transaction per chunk
+					if (std::find(hasChanged.cbegin(), hasChanged.cend(), 1) != hasChanged.cend()) {
+						try {
+							WriteTransaction transaction(writer_, db_);
+							for (size_t i = 0; i < patches.size(); i++) {
+								if (!hasChanged[i]) continue;
+								auto update = statements_.acquire("UPDATE patches SET categories = :CAT WHERE rowid = :ROW");
+								update->bind(":CAT", (int64_t) categoryBits.categorySetAsBitfield(patches[i].categorySet()));
+								update->bind(":ROW", (int64_t) rowids[i]);
+								update->exec();
+								updatePatchCategoryIndex(synthName, md5s[i], patches[i].categorySet());
+								changed++;
+							}
+							transaction.commit();
+						}
+						catch (SQLite::Exception& e) {
+							spdlog::error("Aborting recategorization - database error writing the new categories: {}", e.what());
+							return -1;
+						}
+					}
+					if (progress && total > 0) progress->setProgressPercentage(std::min(1.0, processed / (double)total));
 				}
 			}
-			else {
-				spdlog::error("Aborting reindexing - database error retrieving the filtered patches");
-				return -1;
-			}
-
+			spdlog::info("Recategorized {} patches, categories changed for {}", processed, changed);
+			return changed;
 		}
 
 		std::string databaseFileName() const
@@ -1346,10 +3920,23 @@ namespace midikraft {
 			return db_.getFilename();
 		}
 
+		StatementCacheStatistics getStatementCacheStatistics() const {
+			return statements_.statistics();
+		}
+
+		OperationStatistics& operationStatistics() {
+			return operationStatistics_;
+		}
+
+		QueryProfiler& queryProfiler() {
+			return queryProfiler_;
+		}
+
 		std::shared_ptr<AutomaticCategory> getCategorizer() {
 			ScopedLock lock(categoryLock_);
 			// Force reload of the categories from the database table
-			categoryDefinitions_ = getCategories();
+			invalidateCategoryCache();
+			getCategories();
 			int bitindex = bitfield.maxBitIndex();
 
 			// The Categorizer currently is constructed from two sources - the list of categories in the database including the bit index
@@ -1358,45 +3945,61 @@ namespace midikraft {
 			auto categorizer = std::make_shared<AutomaticCategory>(categoryDefinitions_);
 
 			// First pass - check that all categories referenced in the auto category file are stored in the database, else they will have no bit index!
-			SQLite::Transaction transaction(db_);
-			for (auto rule : categorizer->loadedRules()) {
+			std::vector<AutoCategoryRule> missing;
+			for (auto const &rule : categorizer->loadedRules()) {
 				auto exists = false;
-				for (auto cat : categoryDefinitions_) {
+				for (auto const &cat : categoryDefinitions_) {
 					if (cat.category() == rule.category().category()) {
 						exists = true;
 						break;
 					}
 				}
 				if (!exists) {
-					// Need to create a new entry in the database
-					if (bitindex < 63) {
-						bitindex++;
-						SQLite::Statement sql(db_, "INSERT INTO categories VALUES (:BIT, :NAM, :COL, 1)");
-						sql.bind(":BIT", bitindex);
-						sql.bind(":NAM", rule.category().category());
-						sql.bind(":COL", rule.category().color().toDisplayString(true).toStdString());
-						sql.exec();
-					}
-					else {
-						jassert(false);
-						spdlog::error("FATAL ERROR - Can only deal with 64 different categories. Please remove some categories from the rules file!");
-						return categorizer;
-					}
+					missing.push_back(rule);
+				}
+			}
+			if (missing.empty()) {
+				// The usual case once the database has been opened before, no need to write anything or to read the categories again
+				mergeCategoryRules(categorizer);
+				return categorizer;
+			}
+
+			WriteTransaction transaction(writer_, db_);
+			for (auto const &rule : missing) {
+				// Need to create a new entry in the database
+				if (bitindex < 63) {
+					bitindex++;
+					SQLite::Statement sql(db_, "INSERT INTO categories VALUES (:BIT, :NAM, :COL, 1)");
+					sql.bind(":BIT", bitindex);
+					sql.bind(":NAM", rule.category().category());
+					sql.bind(":COL", rule.category().color().toDisplayString(true).toStdString());
+					sql.exec();
+				}
+				else {
+					jassert(false);
+					spdlog::error("FATAL ERROR - Can only deal with 64 different categories. Please remove some categories from the rules file!");
+					return categorizer;
 				}
 			}
 			transaction.commit();
 
 			// Refresh from database
-			categoryDefinitions_ = getCategories();
+			invalidateCategoryCache();
+			getCategories();
+			mergeCategoryRules(categorizer);
+			return categorizer;
+		}
 
+		void mergeCategoryRules(std::shared_ptr<AutomaticCategory> categorizer) {
 			// Now we need to merge the database persisted categories with the ones defined in the automatic categories from the json string
-			for (auto cat : categoryDefinitions_) {
+			auto rules = categorizer->loadedRules();
+			for (auto const &cat : categoryDefinitions_) {
 				bool exists = false;
-				for (auto rule : categorizer->loadedRules()) {
+				for (auto const &rule : rules) {
 					if (cat.category() == rule.category().category()) {
-						// Copy the rules
+						// Copy the rules. Only the patterns, the regexes are compiled when first needed
 						exists = true;
-						categorizer->addAutoCategory(AutoCategoryRule(rule.category(), rule.patchNameMatchers()));
+						categorizer->addAutoCategory(AutoCategoryRule(rule.category(), rule.patchNamePatterns()));
 						break;
 					}
 				}
@@ -1405,14 +4008,13 @@ namespace midikraft {
 					categorizer->addAutoCategory(AutoCategoryRule(Category(cat), std::vector<std::string>()));
 				}
 			}
-
-			return categorizer;
 		}
 
 		std::vector<ListInfo> allSynthBanks(std::shared_ptr<Synth> synth)
 		{
 			try {
-				SQLite::Statement query(db_, "SELECT * FROM lists WHERE synth = :SYN AND midi_bank_number is not NULL");
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), "SELECT * FROM lists WHERE synth = :SYN AND midi_bank_number is not NULL");
 				query.bind(":SYN", synth->getName());
 				std::vector<ListInfo> result;
 				while (query.executeStep()) {
@@ -1433,7 +4035,8 @@ namespace midikraft {
 		std::vector<ListInfo> allUserBanks(std::shared_ptr<Synth> synth)
 		{
 			try {
-				SQLite::Statement query(db_, "SELECT * FROM lists WHERE synth = :SYN AND midi_bank_number is not NULL");
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), "SELECT * FROM lists WHERE synth = :SYN AND midi_bank_number is not NULL");
 				query.bind(":SYN", synth->getName());
 				std::vector<ListInfo> result;
 				while (query.executeStep()) {
@@ -1454,7 +4057,8 @@ namespace midikraft {
 		std::vector<ListInfo> allPatchLists()
 		{
 			try {
-				SQLite::Statement query(db_, "SELECT * FROM lists WHERE synth is null");
+				auto reader = readers_.acquire();
+				SQLite::Statement query(reader.db(), "SELECT * FROM lists WHERE synth is null");
 				std::vector<ListInfo> result;
 				while (query.executeStep()) {
 					result.push_back({ query.getColumn("id").getText(), query.getColumn("name").getText() });
@@ -1468,95 +4072,192 @@ namespace midikraft {
 		}
 
 		bool doesListExist(std::string listId) {
-			SQLite::Statement query(db_, "SELECT count(*) as num_lists FROM lists WHERE id = :ID");
-			query.bind(":ID", listId);
-			if (query.executeStep()) {
-				auto result = query.getColumn("num_lists");
+			auto reader = readers_.acquire();
+			auto query = reader.statements().acquire("SELECT count(*) as num_lists FROM lists WHERE id = :ID");
+			query->bind(":ID", listId);
+			if (query->executeStep()) {
+				auto result = query->getColumn("num_lists");
 				return result.getInt() != 0;
 			}
 			return false;
 		}
 
+		std::shared_ptr<midikraft::PatchList> createListFromRow(SQLite::Statement& queryList, std::map<std::string, std::weak_ptr<Synth>> const& synths) {
+			std::string listId = queryList.getColumn("id").getString();
+			if (queryList.getColumn("synth").isNull()) {
+				return std::make_shared<midikraft::PatchList>(listId, queryList.getColumn("name").getText());
+			}
+			// Find synth
+			auto synthName = queryList.getColumn("synth").getText();
+			for (auto synth : synths) {
+				auto s = synth.second.lock();
+				if (s->getName() == synthName) {
+					int bankInt = queryList.getColumn("midi_bank_number").getInt();
+					if (listId.find(synthName) != 0) {
+						// This is a stored user bank
+						return std::make_shared<UserBank>(listId, queryList.getColumn("name").getText(),
+							s
+							, MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(s, bankInt))
+							);
+					}
+					else {
+						// This is an active bank
+						return std::make_shared<ActiveSynthBank>(s
+							, MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(s, bankInt))
+							, juce::Time(queryList.getColumn("last_synced").getInt64())
+							);
+					}
+				}
+			}
+			spdlog::error("Can't load list of synth that is not configured!");
+			return nullptr;
+		}
+
 		std::shared_ptr<midikraft::PatchList> getPatchList(ListInfo info, std::map<std::string, std::weak_ptr<Synth>> synths)
 		{
-			// First load the list
-			SQLite::Statement queryList(db_, "SELECT * FROM lists WHERE id = :ID");
-			queryList.bind(":ID", info.id);
-			std::shared_ptr<midikraft::PatchList> list;
-			if (queryList.executeStep()) {
-				if (queryList.getColumn("synth").isNull()) {
-					list = std::make_shared<midikraft::PatchList>(info.id, queryList.getColumn("name").getText());
-				}
-				else {
-					// Find synth
-					auto synthName = queryList.getColumn("synth").getText();
-					for (auto synth : synths) {
-						auto s = synth.second.lock();
-						if (s->getName() == synthName) {
-							int bankInt = queryList.getColumn("midi_bank_number").getInt();
-							if (info.id.find(synthName) != 0) {
-								// This is a stored user bank
-								list = std::make_shared<UserBank>(info.id, queryList.getColumn("name").getText(),
-									s
-									, MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(s, bankInt))
-									);
-							}
-							else {
-								// This is an active bank
-								list = std::make_shared<ActiveSynthBank>(s
-									, MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(s, bankInt))
-									, juce::Time(queryList.getColumn("last_synced").getInt64())
-									);
-							}
-							break;
+			auto lists = getPatchLists({ info }, synths);
+			if (lists.empty()) {
+				spdlog::error("Failed to create list!");
+				return nullptr;
+			}
+			return lists.front();
+		}
+
+		std::vector<std::shared_ptr<midikraft::PatchList>> getPatchLists(std::vector<ListInfo> const& infos, std::map<std::string, std::weak_ptr<Synth>> synths)
+		{
+			// Load the lists and all their members with one joined query per chunk of lists, instead of one query per list entry
+			const size_t kChunkSize = 500;
+			std::map<std::string, std::shared_ptr<midikraft::PatchList>> listsById;
+			try {
+				auto reader = readers_.acquire();
+				QueryRowScratch scratch(currentBitfield());
+				for (size_t chunkStart = 0; chunkStart < infos.size(); chunkStart += kChunkSize) {
+					size_t chunkEnd = std::min(infos.size(), chunkStart + kChunkSize);
+					std::string inClause;
+					for (size_t i = chunkStart; i < chunkEnd; i++) {
+						inClause = prependWithComma(inClause, listVariable(i - chunkStart));
+					}
+
+					SQLite::Statement queryList(reader.db(), fmt::format("SELECT * FROM lists WHERE id IN ({})", inClause));
+					for (size_t i = chunkStart; i < chunkEnd; i++) {
+						queryList.bind(listVariable(i - chunkStart), infos[i].id);
+					}
+					while (queryList.executeStep()) {
+						auto list = createListFromRow(queryList, synths);
+						if (list) {
+							listsById[list->id()] = list;
+						}
+					}
+
+					SQLite::Statement query(reader.db(), fmt::format("SELECT pil.id AS list_id, patches.*, blobs.blob_data, blobs.blob_encoding FROM patch_in_list AS pil "
+						"JOIN patches ON patches.synth = pil.synth AND patches.md5 = pil.md5" + kPatchDataJoin + " WHERE pil.id IN ({}) ORDER BY pil.id, pil.order_num", inClause));
+					for (size_t i = chunkStart; i < chunkEnd; i++) {
+						query.bind(listVariable(i - chunkStart), infos[i].id);
+					}
+					std::map<std::string, std::vector<PatchHolder>> patchesById;
+					while (query.executeStep()) {
+						auto synth = synths.find(query.getColumn("synth").getString());
+						if (synth != synths.end()) {
+							loadPatchFromQueryRow(synth->second.lock(), query, scratch, patchesById[query.getColumn("list_id").getString()]);
 						}
 					}
-					if (!list) {
-						spdlog::error("Can't load list of synth that is not configured!");
-						return nullptr;
+					for (auto& [listId, patches] : patchesById) {
+						auto list = listsById.find(listId);
+						if (list != listsById.end()) {
+							list->second->setPatches(patches);
+						}
 					}
 				}
 			}
-			if (!list) {
-				spdlog::error("Failed to create list!");
-				return nullptr;
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getPatchLists: SQL Exception {}", ex.what());
+				return {};
 			}
 
-			// Now load the patches in this list
-			SQLite::Statement query(db_, "SELECT * from patch_in_list where id=:ID order by order_num");
-			query.bind(":ID", info.id.c_str());
-			std::vector<std::pair<std::string, std::string>> md5s;
-			while (query.executeStep()) {
-				md5s.push_back({ query.getColumn("synth").getText(), query.getColumn("md5").getText() });
+			// Return in the order asked for
+			std::vector<std::shared_ptr<midikraft::PatchList>> result;
+			for (auto const& info : infos) {
+				auto list = listsById.find(info.id);
+				if (list != listsById.end()) {
+					result.push_back(list->second);
+				}
 			}
-			std::vector<PatchHolder> result;
-			for (auto const& md5 : md5s) {
-				if (synths.find(md5.first) != synths.end()) {
-					getSinglePatch(synths[md5.first].lock(), md5.second, result);
+			return result;
+		}
+
+		std::string listVariable(size_t no) {
+			// Calculate a variable name to bind a list id to in an IN clause
+			return fmt::format(":L{:03d}", no);
+		}
+
+		struct ListEntry {
+			int64_t rowid;
+			int64_t orderKey;
+		};
+
+		std::optional<ListEntry> listEntryAtPosition(std::string const& listId, int position) {
+			if (position < 0) {
+				return {};
+			}
+			auto query = statements_.acquire("SELECT rowid, order_num FROM patch_in_list WHERE id = :ID ORDER BY order_num LIMIT 1 OFFSET :POS");
+			query->bind(":ID", listId);
+			query->bind(":POS", position);
+			if (query->executeStep()) {
+				return ListEntry{ query->getColumn(0).getInt64(), query->getColumn(1).getInt64() };
+			}
+			return {};
+		}
+
+		void rebalanceList(std::string const& listId) {
+			// Call this within a transaction! Spreads the order keys of the list out again evenly, keeping the order
+			auto rebalance = statements_.acquire("WITH po AS (SELECT rowid AS r, ROW_NUMBER() OVER (ORDER BY order_num, rowid) - 1 AS new_order FROM patch_in_list WHERE id = :ID) "
+				"UPDATE patch_in_list SET order_num = (SELECT new_order * :GAP FROM po WHERE po.r = patch_in_list.rowid) WHERE id = :ID");
+			rebalance->bind(":ID", listId);
+			rebalance->bind(":GAP", kListOrderGap);
+			rebalance->exec();
+		}
+
+		int64_t orderKeyForInsertBefore(std::string const& listId, int position) {
+			// Call this within a transaction! Finds an order key that sorts between the entries currently at position - 1 and position.
+			// Only if the two neighbours have no room left between them the list is rebalanced, which happens rarely given the gap size
+			for (int attempt = 0; attempt < 2; attempt++) {
+				auto after = listEntryAtPosition(listId, position);
+				if (!after) {
+					// Append
+					auto last = statements_.acquire("SELECT MAX(order_num) FROM patch_in_list WHERE id = :ID");
+					last->bind(":ID", listId);
+					if (last->executeStep() && !last->getColumn(0).isNull()) {
+						return last->getColumn(0).getInt64() + kListOrderGap;
+					}
+					return 0;
+				}
+				auto before = listEntryAtPosition(listId, position - 1);
+				if (!before) {
+					return after->orderKey - kListOrderGap;
 				}
+				if (after->orderKey - before->orderKey >= 2) {
+					return before->orderKey + (after->orderKey - before->orderKey) / 2;
+				}
+				rebalanceList(listId);
 			}
-			list->setPatches(result);
-			return list;
+			jassertfalse;
+			throw SQLite::Exception("Program error - no room for order key even after rebalancing the list");
 		}
 
-		void addPatchToListInternal(std::string const& listId, std::string const& synthName, std::string const& md5, int insertIndex) {
-			SQLite::Statement insert(db_, "INSERT INTO patch_in_list (id, synth, md5, order_num) VALUES (:ID, :SYN, :MD5, :ONO)");
-			insert.bind(":ID", listId);
-			insert.bind(":SYN", synthName);
-			insert.bind(":MD5", md5);
-			insert.bind(":ONO", insertIndex);
-			insert.exec();
+		void addPatchToListInternal(std::string const& listId, std::string const& synthName, std::string const& md5, int64_t orderKey) {
+			auto insert = statements_.acquire("INSERT INTO patch_in_list (id, synth, md5, order_num) VALUES (:ID, :SYN, :MD5, :ONO)");
+			insert->bind(":ID", listId);
+			insert->bind(":SYN", synthName);
+			insert->bind(":MD5", md5);
+			insert->bind(":ONO", orderKey);
+			insert->exec();
 		}
 
 		void addPatchToList(ListInfo info, PatchHolder const& patch, int insertIndex) {
 			try {
-				SQLite::Transaction transaction(db_);
-				// First make room by moving existing items up
-				SQLite::Statement update(db_, "UPDATE patch_in_list SET order_num = order_num + 1 WHERE id = :ID AND order_num >= :ONO");
-				update.bind(":ID", info.id);
-				update.bind(":ONO", insertIndex);
-				update.exec();
-				addPatchToListInternal(info.id, patch.synth()->getName(), patch.md5(), insertIndex);
+				WriteTransaction transaction(writer_, db_);
+				// The new entry gets a key between its neighbours, no other row is touched
+				addPatchToListInternal(info.id, patch.synth()->getName(), patch.md5(), orderKeyForInsertBefore(info.id, insertIndex));
 				transaction.commit();
 			}
 			catch (SQLite::Exception& ex) {
@@ -1564,32 +4265,25 @@ namespace midikraft {
 			}
 		}
 
-		void renumList(std::string const& list_id) {
-			// Call this within a transaction!
-			SQLite::Statement renum(db_, "WITH po AS (SELECT*, ROW_NUMBER() OVER(order by order_num) - 1 AS new_order FROM patch_in_list WHERE id = :ID) "
-				"UPDATE patch_in_list AS pl SET order_num = (SELECT new_order FROM po WHERE pl.synth = po.synth AND pl.md5 = po.md5 AND pl.order_num = po.order_num) where id = :ID");
-			renum.bind(":ID", list_id);
-			renum.exec();
-		}
-
 		void movePatchInList(ListInfo info, PatchHolder const& patch, int previousIndex, int newIndex) {
 			try {
-				SQLite::Transaction transaction(db_);
-				// First make room by moving existing items up
-				SQLite::Statement update(db_, "UPDATE patch_in_list SET order_num = order_num + 1 WHERE id = :ID AND order_num >= :ONO");
-				update.bind(":ID", info.id);
-				update.bind(":ONO", newIndex);
-				update.exec();
-				// Now update the existing element at the previous index at put it at the new Index
-				SQLite::Statement update2(db_, "UPDATE patch_in_list SET order_num = :ONO WHERE id = :ID AND synth = :SYN AND md5 = :MD5 AND order_num = :INC");
-				update2.bind(":ID", info.id);
-				update2.bind(":SYN", patch.smartSynth()->getName());
-				update2.bind(":MD5", patch.md5());
-				update2.bind(":INC", newIndex > previousIndex ? previousIndex : previousIndex + 1);
-				update2.bind(":ONO", newIndex);
-				update2.exec();
-				// Then we may have created a gap in the list, so just renum the whole list
-				renumList(info.id);
+				WriteTransaction transaction(writer_, db_);
+				// The entry at previousIndex is moved in front of the entry currently at newIndex, by giving it a key between the new neighbours
+				auto moved = listEntryAtPosition(info.id, previousIndex);
+				if (!moved) {
+					spdlog::error("Program error - list {} has no entry at position {} to move", info.id, previousIndex);
+					return;
+				}
+				int64_t newKey = orderKeyForInsertBefore(info.id, newIndex);
+				auto update = statements_.acquire("UPDATE patch_in_list SET order_num = :ONO WHERE rowid = :RID AND synth = :SYN AND md5 = :MD5");
+				update->bind(":ONO", newKey);
+				update->bind(":RID", moved->rowid);
+				update->bind(":SYN", patch.smartSynth()->getName());
+				update->bind(":MD5", patch.md5());
+				if (update->exec() != 1) {
+					spdlog::error("Program error - entry at position {} of list {} is not the patch to be moved", previousIndex, info.id);
+					return;
+				}
 				transaction.commit();
 			}
 			catch (SQLite::Exception& ex) {
@@ -1599,14 +4293,16 @@ namespace midikraft {
 
 		void removePatchFromList(std::string const& list_id, std::string const& synth_name, std::string const& md5, int order_num) {
 			try {
-				SQLite::Transaction transaction(db_);
-				SQLite::Statement removeIt(db_, "DELETE FROM patch_in_list WHERE id = :ID AND synth = :SYN AND md5 = :MD5 AND order_num = :ONO");
-				removeIt.bind(":ID", list_id);
-				removeIt.bind(":SYN", synth_name);
-				removeIt.bind(":MD5", md5);
-				removeIt.bind(":ONO", order_num);
-				removeIt.exec();
-				renumList(list_id);
+				WriteTransaction transaction(writer_, db_);
+				// order_num is the position in the list, the keys stored have gaps. Removing an entry doesn't require to renumber the rest
+				auto entry = listEntryAtPosition(list_id, order_num);
+				if (entry) {
+					auto removeIt = statements_.acquire("DELETE FROM patch_in_list WHERE rowid = :RID AND synth = :SYN AND md5 = :MD5");
+					removeIt->bind(":RID", entry->rowid);
+					removeIt->bind(":SYN", synth_name);
+					removeIt->bind(":MD5", md5);
+					removeIt->exec();
+				}
 				transaction.commit();
 			}
 			catch (SQLite::Exception& ex) {
@@ -1618,7 +4314,7 @@ namespace midikraft {
 		{
 			try {
 				// Check if it exists
-				SQLite::Transaction transaction(db_);
+				WriteTransaction transaction(writer_, db_);
 				SQLite::Statement search(db_, "SELECT * FROM lists WHERE id = :ID");
 				search.bind(":ID", patchList->id());
 				auto isSynthBank = std::dynamic_pointer_cast<SynthBank>(patchList);
@@ -1669,9 +4365,9 @@ namespace midikraft {
 					insert.exec();
 				}
 				// If this list already has a list of patches, make sure to add them into the patch list as well!
-				int i = 0;
-				for (auto patch : patchList->patches()) {
-					addPatchToListInternal(patchList->id(), patch.synth()->getName(), patch.md5(), i++);
+				int64_t i = 0;
+				for (auto const& patch : patchList->patches()) {
+					addPatchToListInternal(patchList->id(), patch.synth()->getName(), patch.md5(), kListOrderGap * i++);
 				}
 
 				transaction.commit();
@@ -1681,75 +4377,555 @@ namespace midikraft {
 			}
 		}
 
+		void putSyncedBank(std::shared_ptr<ActiveSynthBank> bank)
+		{
+			putPatchList(bank);
+			try {
+				WriteTransaction transaction(writer_, db_);
+				SQLite::Statement removeSnapshot(db_, "DELETE FROM synced_banks WHERE id = :ID");
+				removeSnapshot.bind(":ID", bank->id());
+				removeSnapshot.exec();
+				int position = 0;
+				for (auto const& patch : bank->patches()) {
+					auto insert = statements_.acquire("INSERT INTO synced_banks (id, position, md5) VALUES (:ID, :POS, :MD5)");
+					insert->bind(":ID", bank->id());
+					insert->bind(":POS", position++);
+					insert->bind(":MD5", patch.md5());
+					insert->exec();
+				}
+				transaction.commit();
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in putSyncedBank: SQL Exception {}", ex.what());
+			}
+		}
+
 		void deletePatchlist(ListInfo info) {
 			try {
+				WriteTransaction transaction(writer_, db_);
+				SQLite::Statement deleteSnapshot(db_, "DELETE FROM synced_banks WHERE id = :ID");
+				deleteSnapshot.bind(":ID", info.id);
+				deleteSnapshot.exec();
 				SQLite::Statement deleteMembers(db_, "DELETE FROM patch_in_list WHERE id = :ID");
 				deleteMembers.bind(":ID", info.id);
 				deleteMembers.exec();
 				SQLite::Statement deleteIt(db_, "DELETE FROM lists WHERE id = :ID");
 				deleteIt.bind(":ID", info.id);
 				deleteIt.exec();
+				transaction.commit();
 			}
 			catch (SQLite::Exception& ex) {
 				spdlog::error("DATABASE ERROR in deletePatchlist: SQL Exception {}", ex.what());
 			}
 		}
 
-		void removePatchFromSimpleList(std::string const& synth, std::string const& md5) {
-			// Simple List as in - this is not a bank. It is not allowed to delete patches that are part of a bank
-			SQLite::Statement removeFromSimpleList(db_, "DELETE FROM patch_in_list WHERE synth = :SYN AND md5 = :MD5 AND EXISTS (SELECT * FROM lists WHERE id = patch_in_list.id AND synth IS NULL)");
-			removeFromSimpleList.bind(":SYN", synth);
-			removeFromSimpleList.bind(":MD5", md5);
-			removeFromSimpleList.exec();
+		bool attachDatabase(std::string const& databaseFile, std::string const& alias) {
+			// The alias ends up in the SQL text, so only plain identifiers
+			bool validAlias = !alias.empty() && !std::isdigit((unsigned char)alias[0]) && alias != "main" && alias != "temp"
+				&& std::all_of(alias.begin(), alias.end(), [](char c) { return std::isalnum((unsigned char)c) || c == '_'; });
+			if (!validAlias) {
+				spdlog::error("Invalid name '{}' for an attached database, use letters, digits and underscores only", alias);
+				return false;
+			}
+			ScopedLock lock(federationLock_);
+			for (auto const& attached : attachedDatabases_) {
+				if (attached.first == alias) {
+					spdlog::error("There is already a database attached as {}", alias);
+					return false;
+				}
+			}
+			bool isAttached = false;
+			try {
+				if (!federation_) {
+					if (db_.getFilename().empty() || db_.getFilename() == ":memory:") {
+						spdlog::error("Can't attach other databases to an in-memory database");
+						return false;
+					}
+					auto federation = std::make_unique<SQLite::Database>(db_.getFilename(), SQLite::OPEN_READONLY);
+					federation->setBusyTimeout(kBusyTimeoutMilliseconds);
+					applyConnectionProfile(*federation, profile_);
+					sqlite3_progress_handler(federation->getHandle(), 1000, queryProgressHandler, nullptr);
+					federation_ = std::move(federation);
+				}
+				// Attached files are opened with the flags of the connection, so they are read-only as well
+				SQLite::Statement attach(*federation_, fmt::format("ATTACH DATABASE :FIL AS {}", alias));
+				attach.bind(":FIL", databaseFile);
+				attach.exec();
+				isAttached = true;
+				// Read-only there is no way to migrate, so the schema has to be the current one
+				int version = -1;
+				SQLite::Statement schemaVersion(*federation_, fmt::format("SELECT number FROM {}.schema_version", alias));
+				if (schemaVersion.executeStep()) {
+					version = schemaVersion.getColumn(0).getInt();
+				}
+				schemaVersion.reset();
+				if (version != SCHEMA_VERSION) {
+					spdlog::error("Cannot attach {}, it has schema version {} instead of {}. Open it once on its own to upgrade it", databaseFile, version, SCHEMA_VERSION);
+					federation_->exec(fmt::format("DETACH DATABASE {}", alias));
+					return false;
+				}
+				attachedDatabases_.emplace_back(alias, databaseFile);
+				createFederatedViews();
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR attaching {}: SQL Exception {}", databaseFile, ex.what());
+			}
+			// Don't leave it attached half way
+			if (isAttached) {
+				attachedDatabases_.erase(std::remove_if(attachedDatabases_.begin(), attachedDatabases_.end(), [&alias](auto const& attached) { return attached.first == alias; }), attachedDatabases_.end());
+				try {
+					createFederatedViews();
+					federation_->exec(fmt::format("DETACH DATABASE {}", alias));
+				}
+				catch (SQLite::Exception& ex) {
+					spdlog::error("DATABASE ERROR detaching {}: SQL Exception {}", alias, ex.what());
+				}
+			}
+			return false;
+		}
+
+		bool detachDatabase(std::string const& alias) {
+			ScopedLock lock(federationLock_);
+			auto found = std::find_if(attachedDatabases_.begin(), attachedDatabases_.end(), [&alias](auto const& attached) { return attached.first == alias; });
+			if (found == attachedDatabases_.end()) {
+				return false;
+			}
+			attachedDatabases_.erase(found);
+			try {
+				// The views refer to the attached database, so they have to go first
+				createFederatedViews();
+				federation_->exec(fmt::format("DETACH DATABASE {}", alias));
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR detaching {}: SQL Exception {}", alias, ex.what());
+			}
+			return false;
+		}
+
+		std::vector<std::pair<std::string, std::string>> attachedDatabases() {
+			ScopedLock lock(federationLock_);
+			return attachedDatabases_;
+		}
+
+		bool getFederatedPatches(PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::string>& outSourceDatabases, int skip, int limit) {
+			// The views carry the patch data along, and the full text index only covers the database itself
+			std::string selectStatement = fmt::format("SELECT * FROM patches {} {} {}", buildJoinClause(filter), buildWhereClause(filter, true, false), buildOrderClause(filter));
+			if (limit != -1) {
+				selectStatement += " LIMIT :LIM OFFSET :OFS";
+			}
+			ScopedLock lock(federationLock_);
+			if (!federation_) {
+				return false;
+			}
+			try {
+				SQLite::Statement query(*federation_, selectStatement);
+				bindWhereClause(query, filter, false);
+				if (limit != -1) {
+					query.bind(":LIM", limit);
+					query.bind(":OFS", skip);
+				}
+				QueryProfiler::Scope profile(queryProfiler_, *federation_, query, selectStatement);
+				QueryRowScratch scratch(currentBitfield());
+				while (profile.step()) {
+					auto synthName = query.getColumn("synth");
+					if (filter.synths.find(synthName) == filter.synths.end()) {
+						spdlog::error("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString());
+						continue;
+					}
+					if (loadPatchFromQueryRow(filter.synths[synthName].lock(), query, scratch, result)) {
+						outSourceDatabases.push_back(query.getColumn("source_database").getString());
+					}
+				}
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getFederatedPatches: SQL Exception {}", ex.what());
+			}
+			return false;
+		}
+
+		int getFederatedPatchesCount(PatchFilter filter) {
+			std::string queryString = fmt::format("SELECT count(*) FROM patches {} {}", buildJoinClause(filter), buildWhereClause(filter, false, false));
+			ScopedLock lock(federationLock_);
+			if (!federation_) {
+				return 0;
+			}
+			try {
+				SQLite::Statement query(*federation_, queryString);
+				bindWhereClause(query, filter, false);
+				QueryProfiler::Scope profile(queryProfiler_, *federation_, query, queryString);
+				if (profile.step()) {
+					return query.getColumn(0).getInt();
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in getFederatedPatchesCount: SQL Exception {}", ex.what());
+			}
+			return 0;
+		}
+
+		std::vector<FederatedDuplicate> findFederatedDuplicates(PatchFilter filter) {
+			std::string queryString = fmt::format("SELECT patches.synth AS synth, patches.md5 AS md5, MIN(patches.name) AS name, group_concat(DISTINCT source_database) AS databases "
+				"FROM patches {} {} GROUP BY patches.synth, patches.md5 HAVING COUNT(DISTINCT source_database) > 1 ORDER BY synth, name",
+				buildJoinClause(filter), buildWhereClause(filter, false, false));
+			std::vector<FederatedDuplicate> result;
+			ScopedLock lock(federationLock_);
+			if (!federation_) {
+				return result;
+			}
+			try {
+				SQLite::Statement query(*federation_, queryString);
+				bindWhereClause(query, filter, false);
+				QueryProfiler::Scope profile(queryProfiler_, *federation_, query, queryString);
+				while (profile.step()) {
+					FederatedDuplicate duplicate;
+					duplicate.synth = query.getColumn("synth").getString();
+					duplicate.md5 = query.getColumn("md5").getString();
+					duplicate.name = query.getColumn("name").getString();
+					// Aliases are identifiers, so they never contain the separator
+					for (auto const& database : StringArray::fromTokens(query.getColumn("databases").getText(), ",", "")) {
+						duplicate.databases.push_back(database.toStdString());
+					}
+					result.push_back(duplicate);
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in findFederatedDuplicates: SQL Exception {}", ex.what());
+			}
+			return result;
+		}
+
+		void removeAllOrphansFromPatchLists() {
+			try {
+				std::lock_guard<WriterLock> writing(writer_);
+				SQLite::Statement cleanupPatchLists(db_,
+					"delete from patch_in_list as pil where not exists(select * from patches as p where p.md5 = pil.md5 and p.synth = pil.synth)");
+				cleanupPatchLists.exec();
+			}
+			catch (SQLite::Exception& ex) {
+				spdlog::error("DATABASE ERROR in removeAllOrphansFromPatchLists: SQL Exception {}", ex.what());
+			}
+		}
+
+	private:
+		void createFederatedViews() {
+			// Temp objects are found before those of main, so these views stand in for the tables in all the SQL built for filters, and that SQL
+			// runs unchanged across all databases. Only on the federation connection, of course
+			static const std::vector<std::string> kFederatedTables = { "patches", "patch_category", "patch_in_list", "name_counts" };
+			for (auto const& table : kFederatedTables) {
+				federation_->exec("DROP VIEW IF EXISTS temp." + table);
+			}
+			if (attachedDatabases_.empty()) {
+				return;
+			}
+			std::vector<std::string> schemas = { "main" };
+			for (auto const& attached : attachedDatabases_) {
+				schemas.push_back(attached.first);
+			}
+			for (auto const& table : kFederatedTables) {
+				// Name the columns, a database that was migrated can have them in a different order than a new one
+				std::string columns;
+				SQLite::Statement tableInfo(*federation_, fmt::format("PRAGMA main.table_info({})", table));
+				while (tableInfo.executeStep()) {
+					columns += fmt::format("{}{}.{}", columns.empty() ? "" : ", ", table, tableInfo.getColumn("name").getString());
+				}
+				std::string selects;
+				for (auto const& schema : schemas) {
+					if (!selects.empty()) selects += " UNION ALL ";
+					if (table == "patches") {
+						// With the patch data and where it came from
+						selects += fmt::format("SELECT patches.rowid AS rowid, {}, blobs.blob_data AS blob_data, blobs.blob_encoding AS blob_encoding, '{}' AS source_database "
+							"FROM {}.patches LEFT JOIN {}.blobs ON blobs.blob_hash = patches.blob_hash", columns, schema, schema, schema);
+					}
+					else {
+						selects += fmt::format("SELECT {} FROM {}.{}", columns, schema, table);
+					}
+				}
+				if (table == "name_counts") {
+					// The same name in two databases is a duplicate as well
+					federation_->exec(fmt::format("CREATE TEMP VIEW name_counts AS SELECT synth, name, SUM(count) AS count FROM ({}) GROUP BY synth, name", selects));
+				}
+				else {
+					federation_->exec(fmt::format("CREATE TEMP VIEW {} AS {}", table, selects));
+				}
+			}
+		}
+
+		SQLite::Database db_;
+		WriterLock writer_; // Held by every write to db_, see WriteTransaction
+		OpenMode mode_;
+		DatabasePerformanceProfile profile_;
+		CategoryBitfield bitfield;
+		std::vector<Category> categoryDefinitions_;
+		CriticalSection categoryLock_;
+		int categoryTableVersion_; // Incremented whenever the categories table is modified
+		int categoryCacheVersion_; // The version categoryDefinitions_ and bitfield have been loaded from
+		bool hasFullTextIndex_;
+		std::map<std::pair<std::string, std::string>, std::shared_ptr<SourceInfo>> sourceInfoCache_; // Synth name and source info text to the shared decoded instance
+		CriticalSection sourceInfoLock_;
+		StatementCache statements_; // Must be destroyed before db_
+		ReaderPool readers_;
+		std::unique_ptr<BackgroundBackup> backgroundBackup_;
+		std::unique_ptr<BackgroundMaintenance> backgroundMaintenance_;
+		Time modifiedAtOpen_; // Of the database file, to tell whether the newest backup is current
+		std::atomic<uint64_t> patchesVersion_; // Incremented after each write to the patches table
+		std::atomic<bool> metadataIndexEnabled_;
+		std::atomic<bool> dataCompressionEnabled_;
+		std::map<std::string, std::shared_ptr<PatchMetadataIndex const>> metadataIndexes_; // By synth name
+		std::map<std::string, std::shared_ptr<PatchSimilarityIndex const>> similarityIndexes_; // By synth name
+		CriticalSection metadataIndexLock_;
+		std::map<std::string, std::pair<uint64_t, std::vector<ImportInfo>>> importsCache_; // By synth name, with the patchesVersion_ it was loaded at
+		CriticalSection importsCacheLock_;
+		OperationStatistics operationStatistics_;
+		QueryProfiler queryProfiler_;
+		std::atomic<uint64_t> writeGeneration_; // Incremented after each write to patches, lists or categories, for the result cache
+		QueryResultCache resultCache_;
+		std::unique_ptr<SQLite::Database> federation_; // Read-only connection the other databases are attached to, opened by the first attach
+		std::vector<std::pair<std::string, std::string>> attachedDatabases_; // Alias and file name
+		CriticalSection federationLock_;
+	};
+
+	struct PatchDatabase::AsyncGenerations {
+		uint64 next(std::string const& channel) {
+			ScopedLock lock(lock_);
+			return ++latest_[channel];
+		}
+
+		bool isCurrent(std::string const& channel, uint64 generation) {
+			ScopedLock lock(lock_);
+			return latest_[channel] == generation;
+		}
+
+		// Records the filter of the newest request on the channel, true if it differs from the one before
+		bool filterChanged(std::string const& channel, PatchFilter const& filter) {
+			ScopedLock lock(lock_);
+			auto found = filters_.find(channel);
+			if (found != filters_.end() && found->second == filter) {
+				return false;
+			}
+			filters_[channel] = filter;
+			return true;
+		}
+
+		static std::string prefetchChannel(std::string const& channel) {
+			return channel + "#prefetch";
+		}
+
+	private:
+		CriticalSection lock_;
+		std::map<std::string, uint64> latest_;
+		std::map<std::string, PatchFilter> filters_;
+	};
+
+	// Collects the edits of putPatchDeferred, and writes all of them in one merge per kind of edit. Edits being written stay visible to the readers
+	// until the write is done, so a read never misses an edit
+	class PatchDatabase::WriteBehindQueue : public Thread {
+	public:
+		struct Pending {
+			PatchHolder patch;
+			unsigned updateChoice;
+		};
+		typedef std::pair<std::string, std::string> Key; // Synth name and md5
+
+		WriteBehindQueue(PatchDatabase &database, int intervalMilliseconds) : Thread("DatabaseWriteBehind"), database_(database), intervalMilliseconds_(intervalMilliseconds),
+			pendingChoices_(0)
+		{
+			startThread();
+		}
+
+		~WriteBehindQueue() override {
+			signalThreadShouldExit();
+			notify();
+			stopThread(5000);
+			flush();
+		}
+
+		void put(Key const &key, PatchHolder const &patch, unsigned updateChoice) {
+			ScopedLock lock(pendingLock_);
+			auto found = pending_.find(key);
+			if (found != pending_.end()) {
+				// The newest holder has the newest values of all fields edited so far
+				found->second.patch = patch;
+				found->second.updateChoice |= updateChoice;
+			}
+			else {
+				pending_.emplace(key, Pending{ patch, updateChoice });
+			}
+			pendingChoices_ |= updateChoice;
+		}
+
+		unsigned pendingChoices() const {
+			return pendingChoices_;
+		}
+
+		void setInterval(int milliseconds) {
+			intervalMilliseconds_ = milliseconds;
+			notify();
+		}
+
+		void overlay(std::vector<PatchHolder> &patches) const {
+			if (pendingChoices_ == 0) {
+				return;
+			}
+			ScopedLock lock(pendingLock_);
+			for (auto &patch : patches) {
+				if (!patch.synth()) continue;
+				Key key(patch.synth()->getName(), patch.md5());
+				auto found = pending_.find(key);
+				if (found == pending_.end()) {
+					found = inFlight_.find(key);
+					if (found == inFlight_.end()) continue;
+				}
+				applyEdits(patch, found->second);
+			}
+		}
+
+		void overlay(std::vector<PatchSummary> &summaries) const {
+			if (pendingChoices_ == 0) {
+				return;
+			}
+			ScopedLock lock(pendingLock_);
+			for (auto &summary : summaries) {
+				Key key(summary.synth, summary.md5);
+				auto found = pending_.find(key);
+				if (found == pending_.end()) {
+					found = inFlight_.find(key);
+					if (found == inFlight_.end()) continue;
+				}
+				auto const &edited = found->second.patch;
+				unsigned choice = found->second.updateChoice;
+				if (choice & UPDATE_NAME) summary.name = edited.name();
+				if (choice & UPDATE_CATEGORIES) {
+					summary.categories = edited.categories();
+					summary.userDecisions = edited.userDecisionSet();
+				}
+				if (choice & UPDATE_HIDDEN) summary.hidden = edited.isHidden();
+				if (choice & UPDATE_FAVORITE) summary.favorite = edited.howFavorite();
+				if (choice & UPDATE_COMMENT) summary.comment = edited.comment();
+			}
+		}
+
+		void flush() {
+			// Only one flush writes at a time, so a later edit of a patch is never overwritten by an earlier one
+			ScopedLock flushing(flushLock_);
+			flushLocked();
 		}
 
-		bool isPatchPartOfBank(std::string const& synth, std::string const& md5) {
-			SQLite::Statement findBankForPatch(db_, "SELECT COUNT(*) FROM lists INNER JOIN patch_in_list AS pil ON lists.id = pil.id WHERE lists.synth = :SYN AND pil.md5 = :MD5");
-			findBankForPatch.bind(":SYN", synth);
-			findBankForPatch.bind(":MD5", md5);
-			if (findBankForPatch.executeStep()) {
-				return findBankForPatch.getColumn(0).getInt() > 0;
+		// Writes what is pending, then calls whileHeld before any other flush can start, e.g. to replace the database the edits go to.
+		// Edits that could not be written are dropped, they would end up in the wrong database
+		void flushAndHold(std::function<void()> const &whileHeld) {
+			ScopedLock flushing(flushLock_);
+			flushLocked();
+			{
+				ScopedLock lock(pendingLock_);
+				if (!pending_.empty()) {
+					spdlog::error("Dropping {} deferred edits that could not be written to the database", pending_.size());
+					pending_.clear();
+					pendingChoices_ = 0;
+				}
 			}
-			spdlog::error("Program error determining if patch is part of bank, hoping for the best from here...");
-			return false;
+			whileHeld();
 		}
 
-		void removeAllOrphansFromPatchLists() {
-			try {
-				SQLite::Statement cleanupPatchLists(db_,
-					"delete from patch_in_list as pil where not exists(select * from patches as p where p.md5 = pil.md5 and p.synth = pil.synth)");
-				cleanupPatchLists.exec();
+	private:
+		void flushLocked() {
+			{
+				ScopedLock lock(pendingLock_);
+				if (pending_.empty()) {
+					return;
+				}
+				inFlight_.swap(pending_);
+				pendingChoices_ = 0;
+				// Edits still being written count as pending for the readers
+				for (auto const &edit : inFlight_) {
+					pendingChoices_ |= edit.second.updateChoice;
+				}
 			}
-			catch (SQLite::Exception& ex) {
-				spdlog::error("DATABASE ERROR in removeAllOrphansFromPatchLists: SQL Exception {}", ex.what());
+
+			// Grouped by what was edited, usually there is only one group
+			std::map<unsigned, std::vector<PatchHolder>> byChoice;
+			for (auto const &edit : inFlight_) {
+				byChoice[edit.second.updateChoice].push_back(edit.second.patch);
+			}
+			std::set<unsigned> failed;
+			for (auto &group : byChoice) {
+				if (!database_.impl->updateExistingPatches(group.second, group.first)) {
+					spdlog::error("DATABASE ERROR writing {} deferred edits, will try again", group.second.size());
+					failed.insert(group.first);
+				}
+			}
+			database_.impl->patchesModified();
+
+			ScopedLock lock(pendingLock_);
+			for (auto &edit : inFlight_) {
+				if (failed.count(edit.second.updateChoice)) {
+					// Back into the queue. An edit made in the meantime has the newer values, it only needs to write the fields of the failed one as well
+					auto found = pending_.find(edit.first);
+					if (found != pending_.end()) {
+						found->second.updateChoice |= edit.second.updateChoice;
+					}
+					else {
+						pending_.emplace(edit.first, edit.second);
+					}
+				}
+			}
+			inFlight_.clear();
+			pendingChoices_ = 0;
+			for (auto const &edit : pending_) {
+				pendingChoices_ |= edit.second.updateChoice;
 			}
 		}
 
+		static void applyEdits(PatchHolder &patch, Pending const &edit) {
+			auto const &edited = edit.patch;
+			if (edit.updateChoice & UPDATE_NAME) patch.setName(edited.name());
+			if (edit.updateChoice & UPDATE_CATEGORIES) {
+				patch.setCategories(edited.categorySet());
+				patch.setUserDecisions(edited.userDecisionCategorySet());
+			}
+			if (edit.updateChoice & UPDATE_HIDDEN) patch.setHidden(edited.isHidden());
+			if (edit.updateChoice & UPDATE_FAVORITE) patch.setFavorite(edited.howFavorite());
+			if (edit.updateChoice & UPDATE_COMMENT) patch.setComment(edited.comment());
+		}
 
-	private:
-		SQLite::Database db_;
-		OpenMode mode_;
-		CategoryBitfield bitfield;
-		std::vector<Category> categoryDefinitions_;
-		CriticalSection categoryLock_;
+		void run() override {
+			while (!threadShouldExit()) {
+				wait(std::max(1, intervalMilliseconds_.load()));
+				if (!threadShouldExit()) {
+					flush();
+				}
+			}
+		}
+
+		PatchDatabase &database_;
+		std::atomic<int> intervalMilliseconds_;
+		CriticalSection pendingLock_;
+		CriticalSection flushLock_;
+		std::map<Key, Pending> pending_;
+		std::map<Key, Pending> inFlight_;
+		std::atomic<unsigned> pendingChoices_; // All update choices of pending_ and inFlight_, to skip the overlay when there is nothing
 	};
 
-	PatchDatabase::PatchDatabase(bool overwrite) {
+	PatchDatabase::PatchDatabase(bool overwrite) : asyncGenerations_(std::make_shared<AsyncGenerations>()), writeBehindIntervalMilliseconds_(kWriteBehindIntervalMilliseconds),
+		prefetchAdjacentPages_(false) {
 		try {
 			File location(generateDefaultDatabaseLocation());
 			if (location.exists() && !overwrite) {
 				location = location.getNonexistentSibling();
 			}
-			impl.reset(new PatchDataBaseImpl(location.getFullPathName().toStdString(), OpenMode::READ_WRITE));
+			impl.reset(new PatchDataBaseImpl(location.getFullPathName().toStdString(), OpenMode::READ_WRITE, DatabasePerformanceProfile()));
 		}
 		catch (SQLite::Exception& e) {
 			throw PatchDatabaseException(e.what());
 		}
 	}
 
-	PatchDatabase::PatchDatabase(std::string const& databaseFile, OpenMode mode) {
+	PatchDatabase::PatchDatabase(std::string const& databaseFile, OpenMode mode, DatabasePerformanceProfile const& profile) : asyncGenerations_(std::make_shared<AsyncGenerations>()),
+		writeBehindIntervalMilliseconds_(kWriteBehindIntervalMilliseconds), prefetchAdjacentPages_(false) {
 		try {
-			impl.reset(new PatchDataBaseImpl(databaseFile, mode));
+			impl.reset(new PatchDataBaseImpl(databaseFile, mode, profile));
 		}
 		catch (SQLite::Exception& e) {
 			if (e.getErrorCode() == SQLITE_READONLY) {
@@ -1762,6 +4938,80 @@ namespace midikraft {
 	}
 
 	PatchDatabase::~PatchDatabase() {
+		// Writes what is still pending, while the database is still open
+		writeBehind_.reset();
+	}
+
+	void PatchDatabase::putPatchDeferred(PatchHolder const& patch, unsigned updateChoice)
+	{
+		if (!patch.synth()) {
+			spdlog::error("Program error - can't store a patch without synth");
+			return;
+		}
+		jassert((updateChoice & UPDATE_DATA) == 0);
+		updateChoice &= ~UPDATE_DATA;
+		if (updateChoice == 0) {
+			return;
+		}
+		ScopedLock lock(writeBehindLock_);
+		if (!writeBehind_) {
+			writeBehind_ = std::make_unique<WriteBehindQueue>(*this, writeBehindIntervalMilliseconds_);
+		}
+		writeBehind_->put({ patch.synth()->getName(), patch.md5() }, patch, updateChoice);
+	}
+
+	void PatchDatabase::flushPendingWrites()
+	{
+		WriteBehindQueue* queue;
+		{
+			ScopedLock lock(writeBehindLock_);
+			queue = writeBehind_.get();
+		}
+		// The queue lives until the database is destroyed, so it can be used outside of the lock
+		if (queue) {
+			OperationStatistics::Timer timer(impl->operationStatistics(), "flushPendingWrites");
+			queue->flush();
+		}
+	}
+
+	void PatchDatabase::setWriteBehindInterval(int milliseconds)
+	{
+		ScopedLock lock(writeBehindLock_);
+		writeBehindIntervalMilliseconds_ = milliseconds;
+		if (writeBehind_) {
+			writeBehind_->setInterval(milliseconds);
+		}
+	}
+
+	bool PatchDatabase::needsFlushFor(PatchFilter const& filter) const
+	{
+		WriteBehindQueue* queue;
+		{
+			ScopedLock lock(writeBehindLock_);
+			queue = writeBehind_.get();
+		}
+		unsigned pending = queue ? queue->pendingChoices() : 0;
+		if (pending == 0) {
+			return false;
+		}
+		// The overlay can change the values shown, but not which rows match or how they sort
+		unsigned affecting = updateChoicesFilteredOn(filter);
+		for (auto const& key : impl->keysetColumns(filter.orderBy)) {
+			if (key.find("name") != std::string::npos) affecting |= UPDATE_NAME;
+		}
+		return (pending & affecting) != 0;
+	}
+
+	void PatchDatabase::overlayPendingEdits(std::vector<PatchHolder>& patches) const
+	{
+		WriteBehindQueue* queue;
+		{
+			ScopedLock lock(writeBehindLock_);
+			queue = writeBehind_.get();
+		}
+		if (queue) {
+			queue->overlay(patches);
+		}
 	}
 
 	std::string PatchDatabase::getCurrentDatabaseFileName() const
@@ -1769,41 +5019,208 @@ namespace midikraft {
 		return impl->databaseFileName();
 	}
 
-	bool PatchDatabase::switchDatabaseFile(std::string const& newDatabaseFile, OpenMode mode)
+	bool PatchDatabase::switchDatabaseFile(std::string const& newDatabaseFile, OpenMode mode, DatabasePerformanceProfile const& profile)
 	{
+		std::unique_ptr<PatchDataBaseImpl> newDatabase;
 		try {
-			auto newDatabase = new PatchDataBaseImpl(newDatabaseFile, mode);
-			// If no exception was thrown, this worked
-			impl.reset(newDatabase);
-			return true;
+			newDatabase = std::make_unique<PatchDataBaseImpl>(newDatabaseFile, mode, profile);
 		}
 		catch (SQLite::Exception& ex) {
 			spdlog::error("Failed to open database: {}", ex.what());
+			return false;
+		}
+
+		WriteBehindQueue* queue;
+		{
+			ScopedLock lock(writeBehindLock_);
+			queue = writeBehind_.get();
+		}
+		if (queue) {
+			// Pending edits belong to the database they were made in. The queue's thread must not be writing while the old one goes away
+			queue->flushAndHold([this, &newDatabase]() {
+				impl = std::move(newDatabase);
+			});
+		}
+		else {
+			impl = std::move(newDatabase);
+		}
+		return true;
+	}
+
+	void PatchDatabase::setMetadataIndexEnabled(bool enabled)
+	{
+		impl->setMetadataIndexEnabled(enabled);
+	}
+
+	void PatchDatabase::setQueryResultCacheSize(size_t entries)
+	{
+		impl->resultCache().setMaxEntries(entries);
+	}
+
+	bool PatchDatabase::attachDatabase(std::string const& databaseFile, std::string const& alias)
+	{
+		return impl->attachDatabase(databaseFile, alias);
+	}
+
+	bool PatchDatabase::detachDatabase(std::string const& alias)
+	{
+		return impl->detachDatabase(alias);
+	}
+
+	std::vector<std::pair<std::string, std::string>> PatchDatabase::attachedDatabases() const
+	{
+		return impl->attachedDatabases();
+	}
+
+	std::vector<PatchHolder> PatchDatabase::getPatchesAcrossDatabases(PatchFilter filter, int skip, int limit)
+	{
+		std::vector<std::string> sourceDatabases;
+		return getPatchesAcrossDatabases(filter, skip, limit, sourceDatabases);
+	}
+
+	std::vector<PatchHolder> PatchDatabase::getPatchesAcrossDatabases(PatchFilter filter, int skip, int limit, std::vector<std::string>& outSourceDatabases)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchesAcrossDatabases");
+		outSourceDatabases.clear();
+		if (impl->attachedDatabases().empty()) {
+			auto result = getPatches(filter, skip, limit);
+			outSourceDatabases.assign(result.size(), "main");
+			return result;
+		}
+		// The federation connection only sees what has been committed
+		if (needsFlushFor(filter)) flushPendingWrites();
+		std::vector<PatchHolder> result;
+		if (impl->getFederatedPatches(filter, result, outSourceDatabases, skip, limit)) {
+			// The pending edits are for this database only. An attached file can hold a patch with the same synth and fingerprint, that one must stay as stored there
+			std::vector<size_t> ownRows;
+			std::vector<PatchHolder> own;
+			for (size_t i = 0; i < result.size(); i++) {
+				if (outSourceDatabases[i] == "main") {
+					ownRows.push_back(i);
+					own.push_back(result[i]);
+				}
+			}
+			overlayPendingEdits(own);
+			for (size_t i = 0; i < ownRows.size(); i++) {
+				result[ownRows[i]] = own[i];
+			}
+			return result;
+		}
+		outSourceDatabases.clear();
+		return {};
+	}
+
+	int PatchDatabase::getPatchesCountAcrossDatabases(PatchFilter filter)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchesCountAcrossDatabases");
+		if (impl->attachedDatabases().empty()) {
+			return getPatchesCount(filter);
+		}
+		if (needsFlushFor(filter)) flushPendingWrites();
+		return impl->getFederatedPatchesCount(filter);
+	}
+
+	std::vector<FederatedDuplicate> PatchDatabase::findDuplicatesAcrossDatabases(PatchFilter filter)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "findDuplicatesAcrossDatabases");
+		flushPendingWrites();
+		return impl->findFederatedDuplicates(filter);
+	}
+
+	void PatchDatabase::setAdjacentPagePrefetch(bool enabled)
+	{
+		prefetchAdjacentPages_ = enabled;
+	}
+
+	void PatchDatabase::prefetchAdjacentPages(std::string const& channel, PatchFilter const& filter, int skip, int limit)
+	{
+		if (!prefetchAdjacentPages_ || limit <= 0 || !impl->resultCache().isEnabled()) {
+			return;
+		}
+		// A newer prefetch on the channel supersedes this one, and so does a request with a different filter
+		auto generations = asyncGenerations_;
+		auto prefetch = AsyncGenerations::prefetchChannel(channel);
+		uint64 generation = generations->next(prefetch);
+		for (int pageSkip : { skip + limit, skip - limit }) {
+			if (pageSkip < 0) {
+				continue;
+			}
+			// Queued behind the requests already waiting, and the result only goes into the query result cache
+			pool_.addJob([this, generations, prefetch, generation, filter, pageSkip, limit]() {
+				if (!generations->isCurrent(prefetch, generation)) {
+					return;
+				}
+				ScopedQueryCancellation cancellation([generations, prefetch, generation]() { return !generations->isCurrent(prefetch, generation); });
+				getPatches(filter, pageSkip, limit);
+				});
 		}
-		return false;
 	}
 
 	int PatchDatabase::getPatchesCount(PatchFilter filter)
 	{
-		return impl->getPatchesCount(filter);
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchesCount");
+		if (needsFlushFor(filter)) flushPendingWrites();
+		uint64_t generation = impl->writeGeneration();
+		int count;
+		if (impl->resultCache().findCount(generation, filter, count)) {
+			return count;
+		}
+		bool success;
+		count = impl->getPatchesCount(filter, &success);
+		if (success) {
+			impl->resultCache().putCount(generation, filter, count);
+		}
+		return count;
 	}
 
 	bool PatchDatabase::getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result)
 	{
-		return impl->getSinglePatch(synth, md5, result);
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getSinglePatch");
+		bool found = impl->getSinglePatch(synth, md5, result);
+		overlayPendingEdits(result);
+		return found;
+	}
+
+	std::vector<SimilarPatch> PatchDatabase::findSimilarPatches(PatchHolder const& patch, size_t k)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "findSimilarPatches");
+		return impl->findSimilarPatches(patch, k);
 	}
 
 	std::vector<MidiProgramNumber> PatchDatabase::getBankPositions(std::shared_ptr<Synth> synth, std::string const& md5) {
 		return impl->getBankPositions(synth, md5);
 	}
 
+	std::vector<std::string> PatchDatabase::getSyncedBankFingerprints(std::shared_ptr<Synth> synth, MidiBankNumber bank) {
+		return impl->getSyncedBankFingerprints(synth, bank);
+	}
+
+	std::map<std::string, ImportedFileInfo> PatchDatabase::getImportedFiles(std::string const& synthName) {
+		return impl->getImportedFiles(synthName);
+	}
+
+	bool PatchDatabase::putImportedFiles(std::vector<ImportedFileInfo> const& files) {
+		return impl->putImportedFiles(files);
+	}
+
 	bool PatchDatabase::putPatch(PatchHolder const& patch) {
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "putPatch");
+		TraceSpan span("PatchDatabase::putPatch");
 		// From the logic, this is an UPSERT (REST call put)
 		// Use the merge functionality for this!
 		std::vector<PatchHolder> newPatches;
 		newPatches.push_back(patch);
 		std::vector<PatchHolder> insertedPatches;
-		return impl->mergePatchesIntoDatabase(newPatches, insertedPatches, nullptr, UPDATE_ALL, true);
+		try {
+			impl->mergePatchesIntoDatabase(newPatches, insertedPatches, nullptr, UPDATE_ALL, true);
+		}
+		catch (SQLite::Exception& e) {
+			spdlog::error("DATABASE ERROR in putPatch, nothing was stored: {}", e.what());
+			return false;
+		}
+		impl->patchesModified();
+		return true;
 	}
 
 	bool PatchDatabase::putPatches(std::vector<PatchHolder> const& patches) {
@@ -1823,7 +5240,9 @@ namespace midikraft {
 
 	void PatchDatabase::updateCategories(std::vector<CategoryDefinition> const& newdefs)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "updateCategories");
 		impl->updateCategories(newdefs);
+		impl->contentModified();
 	}
 
 	std::vector<ListInfo> PatchDatabase::allPatchLists()
@@ -1847,58 +5266,156 @@ namespace midikraft {
 
 	std::shared_ptr<midikraft::PatchList> PatchDatabase::getPatchList(ListInfo info, std::map<std::string, std::weak_ptr<Synth>> synths)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchList");
+		flushPendingWrites();
 		return impl->getPatchList(info, synths);
 	}
 
+	std::vector<std::shared_ptr<midikraft::PatchList>> PatchDatabase::getPatchLists(std::vector<ListInfo> const& infos, std::map<std::string, std::weak_ptr<Synth>> synths)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchLists");
+		return impl->getPatchLists(infos, synths);
+	}
+
 	void PatchDatabase::putPatchList(std::shared_ptr<PatchList> patchList)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "putPatchList");
 		impl->putPatchList(patchList);
+		impl->contentModified();
+	}
+
+	void PatchDatabase::putSyncedBank(std::shared_ptr<ActiveSynthBank> bank)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "putSyncedBank");
+		impl->putSyncedBank(bank);
+		impl->contentModified();
 	}
 
 	void PatchDatabase::deletePatchlist(ListInfo info)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "deletePatchlist");
 		impl->deletePatchlist(info);
+		impl->contentModified();
 	}
 
 	void PatchDatabase::addPatchToList(ListInfo info, PatchHolder const& patch, int insertIndex)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "addPatchToList");
 		impl->addPatchToList(info, patch, insertIndex);
+		impl->contentModified();
 	}
 
 	void PatchDatabase::movePatchInList(ListInfo info, PatchHolder const& patch, int previousIndex, int newIndex)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "movePatchInList");
 		impl->movePatchInList(info, patch, previousIndex, newIndex);
+		impl->contentModified();
 	}
 
 	void PatchDatabase::removePatchFromList(std::string const& list_id, std::string const& synth_name, std::string const& md5, int order_num)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "removePatchFromList");
 		impl->removePatchFromList(list_id, synth_name, md5, order_num);
+		impl->contentModified();
 	}
 
 	int PatchDatabase::deletePatches(PatchFilter filter)
 	{
-		return impl->deletePatches(filter);
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "deletePatches");
+		int deleted = impl->deletePatches(filter);
+		impl->patchesModified();
+		return deleted;
 	}
 
 	std::pair<int, int> PatchDatabase::deletePatches(std::string const& synth, std::vector<std::string> const& md5s)
 	{
-		return impl->deletePatches(synth, md5s);
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "deletePatches");
+		auto result = impl->deletePatches(synth, md5s);
+		impl->patchesModified();
+		return result;
+	}
+
+	int PatchDatabase::bulkUpdate(std::string const& synth, std::vector<std::string> const& md5s, UpdateChoice field, int value)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "bulkUpdate");
+		int changed = impl->bulkUpdate(synth, &md5s, nullptr, field, value, -1);
+		impl->patchesModified();
+		return changed;
+	}
+
+	int PatchDatabase::bulkUpdate(PatchFilter filter, UpdateChoice field, int value)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "bulkUpdate");
+		int changed = impl->bulkUpdate("", nullptr, &filter, field, value, -1);
+		impl->patchesModified();
+		return changed;
+	}
+
+	int PatchDatabase::bulkUpdateCategory(std::string const& synth, std::vector<std::string> const& md5s, Category const& category, bool hasIt)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "bulkUpdate");
+		int changed = impl->bulkUpdate(synth, &md5s, nullptr, UPDATE_CATEGORIES, hasIt ? 1 : 0, category.def()->id);
+		impl->patchesModified();
+		return changed;
+	}
+
+	int PatchDatabase::bulkUpdateCategory(PatchFilter filter, Category const& category, bool hasIt)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "bulkUpdate");
+		int changed = impl->bulkUpdate("", nullptr, &filter, UPDATE_CATEGORIES, hasIt ? 1 : 0, category.def()->id);
+		impl->patchesModified();
+		return changed;
 	}
 
 	int PatchDatabase::reindexPatches(PatchFilter filter)
 	{
-		return impl->reindexPatches(filter);
+		return reindexPatches(filter, nullptr);
+	}
+
+	int PatchDatabase::reindexPatches(PatchFilter filter, ProgressHandler* progress)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "reindexPatches");
+		int result = impl->reindexPatches(filter, progress);
+		impl->patchesModified();
+		return result;
+	}
+
+	int PatchDatabase::recategorize(PatchFilter filter, std::shared_ptr<AutomaticCategory> categorizer, ProgressHandler* progress)
+	{
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "recategorize");
+		int changed = impl->recategorize(filter, categorizer, progress);
+		impl->patchesModified();
+		return changed;
 	}
 
 	std::vector<PatchHolder> PatchDatabase::getPatches(PatchFilter filter, int skip, int limit)
 	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatches");
+		if (needsFlushFor(filter)) flushPendingWrites();
+		// Read before querying, so a write that happens meanwhile leaves the stored result stale
+		uint64_t generation = impl->writeGeneration();
 		std::vector<PatchHolder> result;
+		if (impl->resultCache().findPage(generation, filter, skip, limit, nullptr, result, nullptr)) {
+			overlayPendingEdits(result);
+			return result;
+		}
 		std::vector<std::pair<std::string, PatchHolder>> faultyIndexedPatches;
 		bool success = impl->getPatches(filter, result, faultyIndexedPatches, skip, limit);
 		if (success) {
 			if (!faultyIndexedPatches.empty()) {
 				spdlog::warn("Found {} patches with inconsistent MD5 - please run the Edit... Reindex Patches command for this synth", faultyIndexedPatches.size());
 			}
+			impl->resultCache().putPage(generation, filter, skip, limit, nullptr, result, nullptr);
+			overlayPendingEdits(result);
 			return result;
 		}
 		else {
@@ -1906,6 +5423,101 @@ namespace midikraft {
 		}
 	}
 
+	std::vector<PatchHolder> PatchDatabase::getPatches(PatchFilter filter, int skip, int limit, int& outTotal)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchesWithCount");
+		if (needsFlushFor(filter)) flushPendingWrites();
+		uint64_t generation = impl->writeGeneration();
+		std::vector<PatchHolder> result;
+		if (impl->resultCache().findCount(generation, filter, outTotal) && impl->resultCache().findPage(generation, filter, skip, limit, nullptr, result, nullptr)) {
+			overlayPendingEdits(result);
+			return result;
+		}
+		result.clear();
+		std::vector<std::pair<std::string, PatchHolder>> faultyIndexedPatches;
+		if (impl->getPatches(filter, result, faultyIndexedPatches, skip, limit, &outTotal)) {
+			if (!faultyIndexedPatches.empty()) {
+				spdlog::warn("Found {} patches with inconsistent MD5 - please run the Edit... Reindex Patches command for this synth", faultyIndexedPatches.size());
+			}
+			impl->resultCache().putPage(generation, filter, skip, limit, nullptr, result, nullptr);
+			impl->resultCache().putCount(generation, filter, outTotal);
+			overlayPendingEdits(result);
+			return result;
+		}
+		outTotal = 0;
+		return {};
+	}
+
+	std::vector<PatchHolder> PatchDatabase::getPatches(PatchFilter filter, PatchPageToken const& after, int limit, PatchPageToken& outNext)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchPage");
+		if (needsFlushFor(filter)) flushPendingWrites();
+		uint64_t generation = impl->writeGeneration();
+		std::vector<PatchHolder> result;
+		if (impl->resultCache().findPage(generation, filter, 0, limit, &after, result, &outNext)) {
+			overlayPendingEdits(result);
+			return result;
+		}
+		if (impl->getPatchPage(filter, after, limit, result, outNext)) {
+			impl->resultCache().putPage(generation, filter, 0, limit, &after, result, &outNext);
+			overlayPendingEdits(result);
+			return result;
+		}
+		outNext = after;
+		return {};
+	}
+
+	void PatchDatabase::getPatchesAsync(PatchFilter filter, PatchPageToken const& after, int limit, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const&, PatchPageToken const& next)> finished)
+	{
+		pool_.addJob([this, filter, after, finished, limit]() {
+			PatchPageToken next;
+			auto result = getPatches(filter, after, limit, next);
+			MessageManager::callAsync([filter, finished, result, next]() {
+				finished(filter, result, next);
+				});
+			});
+	}
+
+	std::vector<PatchSummary> PatchDatabase::getPatchSummaries(PatchFilter filter, int skip, int limit)
+	{
+		OperationStatistics::Timer timer(impl->operationStatistics(), "getPatchSummaries");
+		if (needsFlushFor(filter)) flushPendingWrites();
+		std::vector<PatchSummary> result;
+		if (impl->getPatchSummaries(filter, result, skip, limit)) {
+			ScopedLock lock(writeBehindLock_);
+			if (writeBehind_) {
+				writeBehind_->overlay(result);
+			}
+			return result;
+		}
+		return {};
+	}
+
+	PatchHolder PatchDatabase::patchHolderFromSummary(std::shared_ptr<Synth> synth, PatchSummary const& summary)
+	{
+		PatchHolder holder(synth, impl->internedSourceInfo(synth, summary.sourceInfo), nullptr);
+		holder.setBank(summary.bank);
+		holder.setPatchNumber(summary.program);
+		holder.setName(summary.name);
+		holder.setSourceId(summary.sourceId);
+		holder.setFavorite(summary.favorite);
+		holder.setHidden(summary.hidden);
+		holder.setCategories(summary.categories);
+		holder.setUserDecisions(summary.userDecisions);
+		holder.setComment(summary.comment);
+		// Only now install the loader, so the setters above don't trigger loading the data. It holds on to the database the summary came from,
+		// weakly, so a holder outliving this PatchDatabase or a switch of the database file gets no data instead of a dangling pointer or the wrong file
+		std::string md5 = summary.md5;
+		std::weak_ptr<PatchDataBaseImpl> database = impl;
+		holder.setLazyPatch([database, synth, md5]() -> std::shared_ptr<DataFile> {
+			if (auto source = database.lock()) {
+				return source->loadPatchData(synth, md5);
+			}
+			return nullptr;
+		}, md5);
+		return holder;
+	}
+
 	void PatchDatabase::getPatchesAsync(PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const&)> finished, int skip, int limit)
 	{
 		pool_.addJob([this, filter, finished, skip, limit]() {
@@ -1916,9 +5528,82 @@ namespace midikraft {
 			});
 	}
 
+	void PatchDatabase::getPatchesAsync(std::string const& channel, PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const&)> finished, int skip, int limit)
+	{
+		auto generations = asyncGenerations_;
+		uint64 generation = generations->next(channel);
+		if (generations->filterChanged(channel, filter)) {
+			// Adjacent pages of the old filter are of no use anymore
+			generations->next(AsyncGenerations::prefetchChannel(channel));
+		}
+		pool_.addJob([this, generations, channel, generation, filter, finished, skip, limit]() {
+			// Skip the job completely if it has been superseded while waiting in the queue
+			if (!generations->isCurrent(channel, generation)) {
+				return;
+			}
+			std::vector<PatchHolder> result;
+			{
+				ScopedQueryCancellation cancellation([generations, channel, generation]() { return !generations->isCurrent(channel, generation); });
+				result = getPatches(filter, skip, limit);
+			}
+			if (!generations->isCurrent(channel, generation)) {
+				return;
+			}
+			prefetchAdjacentPages(channel, filter, skip, limit);
+			MessageManager::callAsync([generations, channel, generation, filter, finished, result]() {
+				// Check again, a newer request might have been made while this was waiting for the message thread
+				if (generations->isCurrent(channel, generation)) {
+					finished(filter, result);
+				}
+				});
+			});
+	}
+
+	void PatchDatabase::getPatchesWithCountAsync(std::string const& channel, PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const&, int total)> finished, int skip, int limit)
+	{
+		auto generations = asyncGenerations_;
+		uint64 generation = generations->next(channel);
+		if (generations->filterChanged(channel, filter)) {
+			// Adjacent pages of the old filter are of no use anymore
+			generations->next(AsyncGenerations::prefetchChannel(channel));
+		}
+		pool_.addJob([this, generations, channel, generation, filter, finished, skip, limit]() {
+			if (!generations->isCurrent(channel, generation)) {
+				return;
+			}
+			std::vector<PatchHolder> result;
+			int total = 0;
+			{
+				ScopedQueryCancellation cancellation([generations, channel, generation]() { return !generations->isCurrent(channel, generation); });
+				result = getPatches(filter, skip, limit, total);
+			}
+			if (!generations->isCurrent(channel, generation)) {
+				return;
+			}
+			prefetchAdjacentPages(channel, filter, skip, limit);
+			MessageManager::callAsync([generations, channel, generation, filter, finished, result, total]() {
+				if (generations->isCurrent(channel, generation)) {
+					finished(filter, result, total);
+				}
+				});
+			});
+	}
+
 	size_t PatchDatabase::mergePatchesIntoDatabase(std::vector<PatchHolder>& patches, std::vector<PatchHolder>& outNewPatches, ProgressHandler* progress, unsigned updateChoice)
 	{
-		return impl->mergePatchesIntoDatabase(patches, outNewPatches, progress, updateChoice, true);
+		flushPendingWrites();
+		OperationStatistics::Timer timer(impl->operationStatistics(), "mergePatchesIntoDatabase");
+		size_t merged;
+		try {
+			merged = impl->mergePatchesIntoDatabase(patches, outNewPatches, progress, updateChoice, true);
+		}
+		catch (SQLite::Exception& e) {
+			// The transaction was rolled back, nothing of the merge is in the database
+			outNewPatches.clear();
+			throw PatchDatabaseException(e.what());
+		}
+		impl->patchesModified();
+		return merged;
 	}
 
 	std::vector<ImportInfo> PatchDatabase::getImportsList(Synth* activeSynth) const {
@@ -1939,11 +5624,13 @@ namespace midikraft {
 	}
 
 	std::string PatchDatabase::makeDatabaseBackup(std::string const& suffix) {
+		flushPendingWrites();
 		return impl->makeDatabaseBackup(suffix);
 	}
 
 	void PatchDatabase::makeDatabaseBackup(File backupFileToCreate)
 	{
+		flushPendingWrites();
 		impl->makeDatabaseBackup(backupFileToCreate);
 	}
 
@@ -1952,10 +5639,68 @@ namespace midikraft {
 		PatchDataBaseImpl::makeDatabaseBackup(databaseFile, backupFileToCreate);
 	}
 
+	bool PatchDatabase::startBackgroundBackup(std::string const& suffix, int minBackupsKept, size_t maxBackupBytes)
+	{
+		flushPendingWrites();
+		return impl->startBackgroundBackup(suffix, minBackupsKept, maxBackupBytes);
+	}
+
+	bool PatchDatabase::isBackgroundBackupRunning() const
+	{
+		return impl->isBackgroundBackupRunning();
+	}
+
+	bool PatchDatabase::changesSince(int64_t sinceSequence, std::vector<ChangeRecord>& outChanges, int limit) {
+		flushPendingWrites();
+		return impl->changesSince(sinceSequence, limit, outChanges);
+	}
+
+	int64_t PatchDatabase::latestChangeSequence() {
+		return impl->latestChangeSequence();
+	}
+
+	int PatchDatabase::pruneChanges(int64_t upToSequence) {
+		return impl->pruneChanges(upToSequence);
+	}
+
+	void PatchDatabase::setDataCompressionEnabled(bool enabled) {
+		impl->setDataCompressionEnabled(enabled);
+	}
+
+	int PatchDatabase::recompressPatchData(ProgressHandler* progress) {
+		flushPendingWrites();
+		return impl->recompressPatchData(progress);
+	}
+
 	bool PatchDatabase::renameImport(std::string synthName, std::string importID, std::string newName) {
+		flushPendingWrites();
 		return impl->renameImport(synthName, importID, newName);
 	}
 
+	PatchDatabase::StatementCacheStatistics PatchDatabase::getStatementCacheStatistics() const {
+		return impl->getStatementCacheStatistics();
+	}
+
+	std::map<std::string, OperationTiming> PatchDatabase::getOperationStatistics() const {
+		return impl->operationStatistics().snapshot();
+	}
+
+	void PatchDatabase::resetOperationStatistics() {
+		impl->operationStatistics().reset();
+	}
+
+	std::vector<PatchDatabase::QueryProfile> PatchDatabase::getQueryProfiles() const {
+		return impl->queryProfiler().profiles();
+	}
+
+	void PatchDatabase::resetQueryProfiles() {
+		impl->queryProfiler().reset();
+	}
+
+	void PatchDatabase::setSlowQueryThreshold(double milliseconds) {
+		impl->queryProfiler().setSlowQueryThreshold(milliseconds);
+	}
+
 	std::vector<Category> PatchDatabase::getCategories() const {
 		return impl->getCategories();
 	}
@@ -6,12 +6,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
+#include <variant>
 
 #include "Synth.h"
 
 #include "ProgressHandler.h"
+#include "OperationStatistics.h"
 #include "PatchHolder.h"
 #include "PatchList.h"
 #include "PatchFilter.h"
@@ -20,17 +23,106 @@
 
 namespace midikraft {
 
+	class ActiveSynthBank;
+
 	struct ImportInfo {
 		std::string name; // The name of the import
 		std::string id; // The database ID, as a unique identifier
 		int countPatches; // The number of patches that currently macht this import ID
 	};
 
+	// What was imported from a file last time, so an unchanged file can be skipped when importing the folder again
+	struct ImportedFileInfo {
+		std::string synth; // The file was imported for this synth, the same file can be imported for another one as well
+		std::string path;
+		int64_t size;
+		int64_t modified; // Milliseconds since epoch
+		std::string hash; // MD5 of the file content
+		std::string importId;
+	};
+
+	// SQLite settings applied to each connection when a database is opened. The defaults suit a library of a few 100000 patches on a desktop machine
+	struct DatabasePerformanceProfile {
+		enum class Synchronous { OFF, NORMAL, FULL, EXTRA };
+
+		int pageSize = 4096; // Bytes, only takes effect when a new database file is created
+		int cacheSizeKiB = 32768; // Page cache of each connection
+		int64_t mmapSizeBytes = 268435456; // Reads go through memory mapped I/O up to this many bytes of the file, 0 switches it off
+		bool tempStoreInMemory = true; // Sorts and temporary indexes stay in memory instead of going to temp files
+		Synchronous synchronous = Synchronous::NORMAL; // For READ_WRITE. With WAL, NORMAL can only lose the last transactions on power loss, it can't corrupt the file
+		Synchronous synchronousNoBackups = Synchronous::FULL; // For READ_WRITE_NO_BACKUPS, as there is no backup to go back to
+		int optimizeIntervalMinutes = 60; // How often the background maintenance runs PRAGMA optimize while the database is open, 0 for only once after opening
+	};
+
 	struct ListInfo {
 		std::string id; // The database ID
 		std::string name; // The given name of the list
 	};
 
+	// Lightweight projection of a row of the patches table, without the sysex data. Use this for grid views
+	struct PatchSummary {
+		std::string synth;
+		std::string md5;
+		std::string name;
+		std::string sourceId;
+		std::string sourceInfo; // Unparsed JSON, only decoded when a PatchHolder is created from the summary
+		std::string comment;
+		int type = 0;
+		Favorite favorite;
+		bool hidden = false;
+		std::set<Category> categories;
+		std::set<Category> userDecisions;
+		MidiBankNumber bank = MidiBankNumber::invalid();
+		MidiProgramNumber program = MidiProgramNumber::invalidProgram();
+	};
+
+	// Result of PatchDatabase::findSimilarPatches
+	struct SimilarPatch {
+		PatchHolder patch;
+		int distance; // Number of voice relevant bytes differing from the patch searched for
+	};
+
+	// Result of PatchDatabase::findDuplicatesAcrossDatabases
+	struct FederatedDuplicate {
+		std::string synth;
+		std::string md5;
+		std::string name; // As stored in one of the databases
+		std::vector<std::string> databases; // "main" for this database, else the alias it was attached as
+	};
+
+	// Continuation token for keyset paging through getPatches. Treat this as opaque, it records the sort key of the last row delivered
+	struct PatchPageToken {
+		PatchOrdering ordering = PatchOrdering::No_ordering;
+		std::vector<std::variant<int64_t, std::string>> lastKey; // Empty means start from the first row
+		bool atEnd = false; // True if the previous page was the last one
+
+		bool isStart() const { return lastKey.empty(); }
+	};
+
+	enum class ChangeKind {
+		Patch = 0, // synth and md5 are set
+		List = 1, // listId is set, and synth for synth banks
+		Category = 2 // bitIndex is set
+	};
+
+	enum class ChangeOperation {
+		Insert = 0,
+		Update = 1,
+		Delete = 2
+	};
+
+	// An entry of the change journal. Adding, moving or removing a patch in a list is an update of the list
+	struct ChangeRecord {
+		int64_t sequence = 0;
+		ChangeKind kind = ChangeKind::Patch;
+		ChangeOperation operation = ChangeOperation::Update;
+		std::string synth;
+		std::string md5;
+		std::string listId;
+		int bitIndex = -1;
+		int64_t changedAt = 0; // Milliseconds since epoch
+	};
+
 	class PatchDatabaseException : public std::runtime_error {
 		using std::runtime_error::runtime_error;
 	};
@@ -57,35 +149,137 @@ namespace midikraft {
 			UPDATE_ALL = UPDATE_NAME | UPDATE_CATEGORIES | UPDATE_HIDDEN | UPDATE_DATA | UPDATE_FAVORITE | UPDATE_COMMENT
 		};
 
+		struct StatementCacheStatistics {
+			size_t hits; // Number of times a prepared statement could be reused
+			size_t misses; // Number of times a statement had to be compiled
+			size_t cachedStatements; // Number of distinct statements currently kept
+		};
+
+		struct QueryProfile {
+			std::string sql; // Without the values bound, so there is one profile per combination of filter settings
+			size_t executions = 0;
+			size_t slowExecutions = 0; // Executions that took longer than the slow query threshold
+			double totalMs = 0.0; // In sqlite stepping through the rows only
+			double maxMs = 0.0;
+			double decodeMs = 0.0; // Turning the rows into results, e.g. parsing the patches. Not part of the times above
+			int64_t rowsReturned = 0;
+			int64_t fullScanSteps = 0; // Rows stepped through in full table scans. Many more than rowsReturned means an index is missing
+			int64_t sorts = 0; // Executions that needed a sort step instead of reading in index order
+			int64_t autoIndexRows = 0; // Rows put into automatic indexes SQLite had to build on the fly
+			std::string queryPlan; // EXPLAIN QUERY PLAN of the first slow execution
+		};
+
 		explicit PatchDatabase(bool overwrite); // Default location
-		PatchDatabase(std::string const &databaseFile, OpenMode mode); // Specific file
+		PatchDatabase(std::string const &databaseFile, OpenMode mode, DatabasePerformanceProfile const &profile = DatabasePerformanceProfile()); // Specific file
 		~PatchDatabase();
 
 		std::string getCurrentDatabaseFileName() const;
-		bool switchDatabaseFile(std::string const &newDatabaseFile, OpenMode mode);
+		bool switchDatabaseFile(std::string const &newDatabaseFile, OpenMode mode, DatabasePerformanceProfile const &profile = DatabasePerformanceProfile());
+
+		// Counts and pages for filters on favorites, hidden, type, categories, import and name are answered from an in memory index of the
+		// patch metadata, which is rebuilt after the patches have been modified. On by default, turn it off to always query the database
+		void setMetadataIndexEnabled(bool enabled);
+		// The most recent results of getPatches, getPatchesAsync and getPatchesCount are kept until the next write to patches, lists or categories,
+		// so showing the same view again doesn't query at all. The default is 32 results, 0 switches the cache off
+		void setQueryResultCacheSize(size_t entries);
+		// After a page has been delivered on a channel, load the pages before and after it into the query result cache in the background, so
+		// scrolling to them shows them at once. A request with a different filter on the channel cancels the prefetch. Off by default
+		void setAdjacentPagePrefetch(bool enabled);
 
 		int getPatchesCount(PatchFilter filter);
 		bool getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result);
 		std::vector<MidiProgramNumber> getBankPositions(std::shared_ptr<Synth> synth, std::string const& md5);
+		// The k patches of the same synth whose voice relevant data is closest to the given patch, nearest first. The patch itself is not included.
+		// Uses an index built on first use, and again after patches were modified, so only the first call has to read all patches of the synth.
+		// Patches that differ in many bytes or have a different data length are not found
+		std::vector<SimilarPatch> findSimilarPatches(PatchHolder const &patch, size_t k);
+		// The fingerprints of the patches in the synth's bank as of the last sync, by position, as recorded by putSyncedBank(). Empty if the bank has never been synced
+		std::vector<std::string> getSyncedBankFingerprints(std::shared_ptr<Synth> synth, MidiBankNumber bank);
 		std::vector<PatchHolder> getPatches(PatchFilter filter, int skip, int limit);
+		std::vector<PatchSummary> getPatchSummaries(PatchFilter filter, int skip, int limit);
+		// Creates a PatchHolder whose DataFile is only loaded from the database on first access to patch()
+		PatchHolder patchHolderFromSummary(std::shared_ptr<Synth> synth, PatchSummary const& summary);
 
 		void getPatchesAsync(PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &)> finished, int skip, int limit);
+		// Requests on the same channel supersede each other: a newer request cancels queued and running older ones, and only the newest result is delivered
+		void getPatchesAsync(std::string const &channel, PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &)> finished, int skip, int limit);
+		// Other database files can be attached read-only, so the AcrossDatabases queries see the patches of all of them in a single query instead
+		// of switching between the files. Use letters, digits and underscores for the alias. A file needs the current schema version, as it can't be
+		// upgraded read-only. Categories are matched by bit index and shown as defined in this database. Attachments end with switchDatabaseFile
+		bool attachDatabase(std::string const &databaseFile, std::string const &alias);
+		bool detachDatabase(std::string const &alias);
+		std::vector<std::pair<std::string, std::string>> attachedDatabases() const; // Alias and file name
+		std::vector<PatchHolder> getPatchesAcrossDatabases(PatchFilter filter, int skip, int limit);
+		// Same, with the alias of the database each patch came from, "main" for this one. Only those can be edited, the attached files are read-only
+		std::vector<PatchHolder> getPatchesAcrossDatabases(PatchFilter filter, int skip, int limit, std::vector<std::string> &outSourceDatabases);
+		int getPatchesCountAcrossDatabases(PatchFilter filter);
+		// The patches stored in more than one of the databases
+		std::vector<FederatedDuplicate> findDuplicatesAcrossDatabases(PatchFilter filter);
+		// The page plus the number of all patches matching the filter, from a single query instead of getPatchesCount followed by getPatches
+		std::vector<PatchHolder> getPatches(PatchFilter filter, int skip, int limit, int &outTotal);
+		void getPatchesWithCountAsync(std::string const &channel, PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &, int total)> finished, int skip, int limit);
 
+		// Keyset paging - pass the token returned for the previous page to continue after its last row, or a default constructed token to start
+		std::vector<PatchHolder> getPatches(PatchFilter filter, PatchPageToken const &after, int limit, PatchPageToken &outNext);
+		void getPatchesAsync(PatchFilter filter, PatchPageToken const &after, int limit, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &, PatchPageToken const &next)> finished);
+
+		// All or nothing. Throws PatchDatabaseException if writing failed, then nothing of the merge is stored
 		size_t mergePatchesIntoDatabase(std::vector<PatchHolder> &patches, std::vector<PatchHolder> &outNewPatches, ProgressHandler *progress, unsigned updateChoice);
 		std::vector<ImportInfo> getImportsList(Synth *activeSynth) const;
 		bool putPatch(PatchHolder const &patch);
 		bool putPatches(std::vector<PatchHolder> const &patches);
+		// For the small edits a user makes, e.g. favorite, hide, rename or toggling a category. Returns immediately, the edit is written later together
+		// with all others pending, in one transaction every write behind interval, before any other write, and on close. Several edits of the same patch
+		// are merged into one update of the fields named by the update choices. Patches read meanwhile show the pending edits, and a query filtering on
+		// an edited field writes them first. UPDATE_DATA can't be deferred and is ignored
+		void putPatchDeferred(PatchHolder const &patch, unsigned updateChoice);
+		void flushPendingWrites();
+		void setWriteBehindInterval(int milliseconds); // The default is 500 ms
 
 		int deletePatches(PatchFilter filter);
 		std::pair<int, int> deletePatches(std::string const& synth, std::vector<std::string> const& md5s);
+		// Set based edits of a selection, e.g. the patches marked in the grid or all matching a filter. One statement no matter how many patches,
+		// and only those whose value actually changes are written. The value is the stored Favorite for UPDATE_FAVORITE, 0 or 1 for UPDATE_HIDDEN.
+		// Returns the number of patches changed, or -1 on error
+		int bulkUpdate(std::string const &synth, std::vector<std::string> const &md5s, UpdateChoice field, int value);
+		int bulkUpdate(PatchFilter filter, UpdateChoice field, int value);
+		// Sets or clears the category, recorded as the user's decision so the automatic categorizer won't change it again
+		int bulkUpdateCategory(std::string const &synth, std::vector<std::string> const &md5s, Category const &category, bool hasIt);
+		int bulkUpdateCategory(PatchFilter filter, Category const &category, bool hasIt);
 		int reindexPatches(PatchFilter filter);
+		int reindexPatches(PatchFilter filter, ProgressHandler *progress);
+		// Runs the categorizer again over all patches matched by the filter, respecting user decisions. Returns the number of patches whose categories changed, or -1 on error
+		int recategorize(PatchFilter filter, std::shared_ptr<AutomaticCategory> categorizer, ProgressHandler *progress);
 
 		std::string makeDatabaseBackup(std::string const &suffix);
 		void makeDatabaseBackup(File backupFileToCreate);
 		static void makeDatabaseBackup(File databaseFile, File backupFileToCreate);
+		// Copies the database step by step on a background thread, the database stays fully usable meanwhile. On success, old backups with the same suffix
+		// are removed so they take up at most maxBackupBytes, but the newest minBackupsKept copies are always kept. Returns false if no backup was started
+		bool startBackgroundBackup(std::string const &suffix, int minBackupsKept = 3, size_t maxBackupBytes = 500000000);
+		bool isBackgroundBackupRunning() const;
 
 		bool renameImport(std::string synthName, std::string importID, std::string newName);
 
+		// The change journal records every modification of patches, lists and categories with an ever increasing sequence number, so a sync or backup 
+		// only has to look at what changed since the sequence number it saw last. Returns false if that part of the journal has been pruned already,
+		// then the caller needs to compare everything. Databases created before schema 18 start with an empty journal
+		bool changesSince(int64_t sinceSequence, std::vector<ChangeRecord> &outChanges, int limit = -1);
+		int64_t latestChangeSequence();
+		// Removes the entries up to and including the sequence number, once all syncs have seen them. Returns the number removed, or -1 on error
+		int pruneChanges(int64_t upToSequence);
+
+		// The patch data is stored once per distinct content, no matter how many patches of which synths refer to it. Data of at least 4 KB,
+		// e.g. complete banks stored as one patch, is stored zlib compressed if that pays off. Reading is transparent and both kinds can be mixed.
+		// On by default, switching it off only affects what is written from then on
+		void setDataCompressionEnabled(bool enabled);
+		// Rewrites the stored patch data to match the current setting, e.g. to compress a database created before schema 19. Returns the number
+		// of distinct data BLOBs rewritten, or -1 on error
+		int recompressPatchData(ProgressHandler *progress);
+
+		std::map<std::string, ImportedFileInfo> getImportedFiles(std::string const &synthName); // By path
+		bool putImportedFiles(std::vector<ImportedFileInfo> const &files);
+
 		std::vector<Category> getCategories() const;
 		std::shared_ptr<AutomaticCategory> getCategorizer();
 		int getNextBitindex();
@@ -96,18 +290,45 @@ namespace midikraft {
 		std::vector<ListInfo> allPatchLists();
 		bool doesListExist(std::string listId);
 		std::shared_ptr<PatchList> getPatchList(ListInfo info, std::map<std::string, std::weak_ptr<Synth>> synths);
+		// Loads several lists with all their patches at once, e.g. all banks returned by allSynthBanks(). Lists not found are left out of the result
+		std::vector<std::shared_ptr<PatchList>> getPatchLists(std::vector<ListInfo> const &infos, std::map<std::string, std::weak_ptr<Synth>> synths);
 		void putPatchList(std::shared_ptr<PatchList> patchList);
+		// Call after the bank has been downloaded from or sent to the synth, to record what the synth has now. Stores the bank like putPatchList() and
+		// keeps a copy of its fingerprints that later edits of the list don't touch
+		void putSyncedBank(std::shared_ptr<ActiveSynthBank> bank);
 		void deletePatchlist(ListInfo info);
 		void addPatchToList(ListInfo info, PatchHolder const& patch, int insertIndex);
 		void movePatchInList(ListInfo info, PatchHolder const& patch, int previousIndex, int newIndex);
 		void removePatchFromList(std::string const &list_id, std::string const &synth_name, std::string const &md5, int order_num);
 
+		StatementCacheStatistics getStatementCacheStatistics() const;
+		// Time spent in merging, querying, reindexing, list and category operations since the database was opened or the statistics were reset,
+		// by operation name. To quantify a performance change on a real library, or to spot a regression in the field
+		std::map<std::string, OperationTiming> getOperationStatistics() const; // Also see OperationStatistics::global()
+		void resetOperationStatistics();
+		// Profiles of the queries for patches, counts and summaries, the most expensive first. Executions slower than the threshold are logged as
+		// warnings with their query plan, the default is 250 ms. Use a negative threshold to switch that off
+		std::vector<QueryProfile> getQueryProfiles() const;
+		void resetQueryProfiles();
+		void setSlowQueryThreshold(double milliseconds);
+
 		// For backward compatibility
 		static std::string generateDefaultDatabaseLocation();
 
 	private:
 		class PatchDataBaseImpl;
-		std::unique_ptr<PatchDataBaseImpl> impl;
+		struct AsyncGenerations;
+		class WriteBehindQueue;
+		bool needsFlushFor(PatchFilter const &filter) const;
+		void overlayPendingEdits(std::vector<PatchHolder> &patches) const;
+		void prefetchAdjacentPages(std::string const &channel, PatchFilter const &filter, int skip, int limit);
+
+		std::shared_ptr<PatchDataBaseImpl> impl; // Shared only so lazily loading PatchHolders can hold a weak handle to the database they came from
+		std::shared_ptr<AsyncGenerations> asyncGenerations_;
+		CriticalSection writeBehindLock_;
+		std::unique_ptr<WriteBehindQueue> writeBehind_; // Created with the first deferred edit
+		std::atomic<int> writeBehindIntervalMilliseconds_;
+		std::atomic<bool> prefetchAdjacentPages_;
 		ThreadPool pool_;
 	};
 
@@ -6,6 +6,8 @@
 
 #include "PatchFilter.h"
 
+#include <functional>
+
 
 namespace midikraft {
 
@@ -46,34 +48,63 @@ namespace midikraft {
 		showUndecided = true;
 	}
 
-	bool operator!=(PatchFilter const& a, PatchFilter const& b)
+	bool operator==(PatchFilter const& a, PatchFilter const& b)
 	{
-		// Check complex fields 
-		for (auto const& asynth : a.synths) {
-			if (b.synths.find(asynth.first) == b.synths.end()) {
-				return true;
-			}
-		}
-		for (auto const& bsynth : b.synths) {
-			if (a.synths.find(bsynth.first) == a.synths.end()) {
-				return true;
+		// Check complex fields. Both maps are sorted by synth name
+		if (a.synths.size() != b.synths.size())
+			return false;
+		for (auto asynth = a.synths.cbegin(), bsynth = b.synths.cbegin(); asynth != a.synths.cend(); asynth++, bsynth++) {
+			if (asynth->first != bsynth->first) {
+				return false;
 			}
 		}
 
 		if (a.categories != b.categories)
-			return true;
+			return false;
 
 		// Then check simple fields
-		return a.importID != b.importID
-			|| a.name != b.name
-			|| a.listID != b.listID
-			|| a.onlyFaves != b.onlyFaves
-			|| a.onlySpecifcType != b.onlySpecifcType
-			|| a.typeID != b.typeID
-			|| a.showHidden != b.showHidden
-			|| a.showUndecided != b.showUndecided
-			|| a.andCategories != b.andCategories
-			|| a.onlyUntagged != b.onlyUntagged;
+		return a.orderBy == b.orderBy
+			&& a.importID == b.importID
+			&& a.name == b.name
+			&& a.listID == b.listID
+			&& a.onlyFaves == b.onlyFaves
+			&& a.onlySpecifcType == b.onlySpecifcType
+			&& a.typeID == b.typeID
+			&& a.showHidden == b.showHidden
+			&& a.showUndecided == b.showUndecided
+			&& a.andCategories == b.andCategories
+			&& a.onlyUntagged == b.onlyUntagged
+			&& a.onlyDuplicateNames == b.onlyDuplicateNames;
+	}
+
+	bool operator!=(PatchFilter const& a, PatchFilter const& b)
+	{
+		return !(a == b);
+	}
+
+	static void hashCombine(size_t& seed, size_t value)
+	{
+		seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	}
+
+	size_t PatchFilterHash::operator()(PatchFilter const& filter) const
+	{
+		size_t seed = 0;
+		for (auto const& synth : filter.synths) {
+			hashCombine(seed, std::hash<std::string>()(synth.first));
+		}
+		for (auto const& category : filter.categories) {
+			hashCombine(seed, std::hash<int>()(category.def() ? category.def()->id : -1));
+		}
+		hashCombine(seed, std::hash<int>()(static_cast<int>(filter.orderBy)));
+		hashCombine(seed, std::hash<std::string>()(filter.importID));
+		hashCombine(seed, std::hash<std::string>()(filter.name));
+		hashCombine(seed, std::hash<std::string>()(filter.listID));
+		hashCombine(seed, std::hash<int>()(filter.typeID));
+		unsigned flags = (filter.onlyFaves ? 1 : 0) | (filter.onlySpecifcType ? 2 : 0) | (filter.showHidden ? 4 : 0) | (filter.showUndecided ? 8 : 0)
+			| (filter.andCategories ? 16 : 0) | (filter.onlyUntagged ? 32 : 0) | (filter.onlyDuplicateNames ? 64 : 0);
+		hashCombine(seed, std::hash<unsigned>()(flags));
+		return seed;
 	}
 
 
@@ -51,7 +51,14 @@ namespace midikraft {
 		void initDefaults();
 	};
 
-	// Inequality operator for patch filters - this can be used to e.g. match if a database query result is for a specific filter setup
+	// Equality for patch filters - this can be used to e.g. match if a database query result is for a specific filter setup.
+	// Synths compare by name and categories by id, all other fields by value
+	bool operator ==(PatchFilter const& a, PatchFilter const& b);
 	bool operator !=(PatchFilter const& a, PatchFilter const& b);
 
+	// Consistent with operator ==, for keying caches and unordered containers by filter
+	struct PatchFilterHash {
+		size_t operator()(PatchFilter const& filter) const;
+	};
+
 }
\ No newline at end of file
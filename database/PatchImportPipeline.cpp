@@ -0,0 +1,159 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PatchImportPipeline.h"
+
+#include <spdlog/spdlog.h>
+
+namespace midikraft {
+
+	// A batch that doesn't fill up is written anyway after this, so a slow download still shows up in the database bit by bit
+	const std::chrono::milliseconds kBatchLinger(200);
+
+	PatchImportPipeline::PatchImportPipeline(PatchDatabase& database, unsigned updateChoice, TBatchWrittenHandler onBatchWritten, size_t batchSize, size_t capacity) :
+		Thread("PatchImportPipeline"), database_(database), updateChoice_(updateChoice), onBatchWritten_(onBatchWritten), batchSize_(std::max((size_t)1, batchSize)),
+		capacity_(std::max(batchSize, capacity)), closed_(false), overflowing_(false), written_(0), new_(0)
+	{
+		startThread();
+	}
+
+	PatchImportPipeline::~PatchImportPipeline()
+	{
+		finish();
+	}
+
+	bool PatchImportPipeline::push(PatchHolder const& patch)
+	{
+		std::unique_lock<std::mutex> lock(queueLock_);
+		notFull_.wait(lock, [this]() { return closed_ || queue_.size() < capacity_; });
+		if (closed_) {
+			return false;
+		}
+		queue_.push_back(patch);
+		if (queue_.size() >= batchSize_) {
+			notEmpty_.notify_one();
+		}
+		return true;
+	}
+
+	bool PatchImportPipeline::push(std::vector<PatchHolder> const& patches)
+	{
+		for (auto const& patch : patches) {
+			if (!push(patch)) {
+				return false;
+			}
+		}
+		{
+			// Don't let the tail of a file wait for the linger
+			std::lock_guard<std::mutex> lock(queueLock_);
+			notEmpty_.notify_one();
+		}
+		return true;
+	}
+
+	bool PatchImportPipeline::pushWithoutWaiting(PatchHolder const& patch)
+	{
+		std::lock_guard<std::mutex> lock(queueLock_);
+		if (closed_) {
+			return false;
+		}
+		if (queue_.size() >= capacity_) {
+			// Better use more memory than drop patches or stall the MIDI input. Only log when the queue starts to overflow, not for every patch
+			if (!overflowing_) {
+				spdlog::warn("Import pipeline queue is full with {} patches, the database can't keep up. Queueing beyond the limit", queue_.size());
+				overflowing_ = true;
+			}
+		}
+		else {
+			overflowing_ = false;
+		}
+		queue_.push_back(patch);
+		if (queue_.size() >= batchSize_) {
+			notEmpty_.notify_one();
+		}
+		return true;
+	}
+
+	Librarian::TPatchReceivedHandler PatchImportPipeline::receiver()
+	{
+		// Called on the MIDI input thread, which must never wait for the database
+		return [this](PatchHolder const& patch) {
+			pushWithoutWaiting(patch);
+		};
+	}
+
+	void PatchImportPipeline::close()
+	{
+		std::lock_guard<std::mutex> lock(queueLock_);
+		closed_ = true;
+		notEmpty_.notify_all();
+		notFull_.notify_all();
+	}
+
+	void PatchImportPipeline::finish()
+	{
+		close();
+		stopThread(-1);
+	}
+
+	void PatchImportPipeline::cancel()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueLock_);
+			queue_.clear();
+		}
+		signalThreadShouldExit();
+		finish();
+	}
+
+	size_t PatchImportPipeline::writtenCount() const
+	{
+		return written_;
+	}
+
+	size_t PatchImportPipeline::newCount() const
+	{
+		return new_;
+	}
+
+	void PatchImportPipeline::run()
+	{
+		while (!threadShouldExit()) {
+			std::vector<PatchHolder> batch;
+			{
+				std::unique_lock<std::mutex> lock(queueLock_);
+				notEmpty_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+				if (!closed_ && queue_.size() < batchSize_) {
+					notEmpty_.wait_for(lock, kBatchLinger, [this]() { return closed_ || queue_.size() >= batchSize_; });
+				}
+				if (queue_.empty()) {
+					// Only possible when closed
+					break;
+				}
+				size_t count = std::min(batchSize_, queue_.size());
+				batch.assign(queue_.begin(), queue_.begin() + count);
+				queue_.erase(queue_.begin(), queue_.begin() + count);
+				notFull_.notify_all();
+			}
+
+			std::vector<PatchHolder> newPatches;
+			try {
+				database_.mergePatchesIntoDatabase(batch, newPatches, nullptr, updateChoice_);
+			}
+			catch (std::exception& e) {
+				// Database errors come as PatchDatabaseException or SQLite::Exception, both must not end the writer thread
+				spdlog::error("Import pipeline could not write {} patches into the database: {}", batch.size(), e.what());
+				continue;
+			}
+			written_ += batch.size();
+			new_ += newPatches.size();
+			if (onBatchWritten_) {
+				onBatchWritten_(newPatches);
+			}
+		}
+	}
+
+}
@@ -0,0 +1,69 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "PatchDatabase.h"
+#include "Librarian.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace midikraft {
+
+	// Writes patches into the database while they are still being produced, e.g. by a multi bank download or loading many files.
+	// Producers push into a bounded queue, a writer thread takes them out in batches and merges each batch in one transaction.
+	// So MIDI or disk I/O, parsing and fingerprinting carry on while SQLite is writing. The merge holds the database's writer lock like every other write,
+	// so a batch never runs inside a transaction of the UI thread or the other way round
+	class PatchImportPipeline : private Thread {
+	public:
+		// Called on the writer thread after each batch with the patches that were new to the database
+		typedef std::function<void(std::vector<PatchHolder> const &newPatches)> TBatchWrittenHandler;
+
+		PatchImportPipeline(PatchDatabase &database, unsigned updateChoice, TBatchWrittenHandler onBatchWritten = nullptr, size_t batchSize = 500, size_t capacity = 5000);
+		virtual ~PatchImportPipeline() override; // Writes what is still queued
+
+		// Safe to call from any thread. Blocks while the queue is full, returns false if the pipeline has been closed already
+		bool push(PatchHolder const &patch);
+		bool push(std::vector<PatchHolder> const &patches);
+
+		// To hand to Librarian::startDownloadingAllPatches, the patches go into the database as they come in from the synth.
+		// This never blocks the MIDI thread, if the queue is full it grows beyond its capacity
+		Librarian::TPatchReceivedHandler receiver();
+
+		// No more patches will come. The writer empties the queue, then stops. finish() also waits for that
+		void close();
+		void finish();
+		void cancel(); // Drops what is still queued
+
+		size_t writtenCount() const; // Patches merged into the database so far
+		size_t newCount() const; // Of these, the ones that were not in the database before
+
+	private:
+		bool pushWithoutWaiting(PatchHolder const &patch);
+		void run() override;
+
+		PatchDatabase &database_;
+		unsigned updateChoice_;
+		TBatchWrittenHandler onBatchWritten_;
+		size_t batchSize_;
+		size_t capacity_;
+
+		std::mutex queueLock_;
+		std::condition_variable notEmpty_;
+		std::condition_variable notFull_;
+		std::deque<PatchHolder> queue_;
+		bool closed_;
+		bool overflowing_; // Queue is above capacity, to log that only once
+
+		std::atomic<size_t> written_;
+		std::atomic<size_t> new_;
+	};
+
+}
@@ -0,0 +1,231 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PatchMetadataIndex.h"
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
+namespace midikraft {
+
+	namespace {
+
+		std::string asciiLowercase(std::string const& text) {
+			// SQLite's LIKE only folds ASCII letters, so do just the same
+			std::string result(text);
+			for (auto& c : result) {
+				if (c >= 'A' && c <= 'Z') {
+					c = (char)(c - 'A' + 'a');
+				}
+			}
+			return result;
+		}
+
+		int64_t nullsFirst(std::optional<int> const& value) {
+			return value.has_value() ? (int64_t) *value : std::numeric_limits<int64_t>::min();
+		}
+
+	}
+
+	PatchMetadataIndex::PatchMetadataIndex(uint64_t version) : version_(version)
+	{
+	}
+
+	void PatchMetadataIndex::reserve(size_t rows)
+	{
+		md5s_.reserve(rows);
+		names_.reserve(rows);
+		namesLowercase_.reserve(rows);
+		commentsLowercase_.reserve(rows);
+		sourceIds_.reserve(rows);
+		types_.reserve(rows);
+		flags_.reserve(rows);
+		categories_.reserve(rows);
+		banks_.reserve(rows);
+		programs_.reserve(rows);
+	}
+
+	void PatchMetadataIndex::add(Row const& row)
+	{
+		md5s_.push_back(row.md5);
+		names_.push_back(row.name);
+		namesLowercase_.push_back(asciiLowercase(row.name));
+		commentsLowercase_.push_back(asciiLowercase(row.comment));
+		auto source = sourceIdNumbers_.find(row.sourceId);
+		if (source == sourceIdNumbers_.end()) {
+			source = sourceIdNumbers_.emplace(row.sourceId, (int32_t)sourceIdNames_.size()).first;
+			sourceIdNames_.push_back(row.sourceId);
+		}
+		sourceIds_.push_back(source->second);
+		types_.push_back(row.type);
+		uint8_t flags = 0;
+		if (!row.favorite.has_value()) flags |= kFavoriteNull;
+		else if (*row.favorite == 1) flags |= kFavorite;
+		if (row.hidden.has_value() && *row.hidden == 1) flags |= kHidden;
+		if (!row.categories.has_value()) flags |= kCategoriesNull;
+		flags_.push_back(flags);
+		categories_.push_back((uint64_t)row.categories.value_or(0));
+		banks_.push_back(nullsFirst(row.bank));
+		programs_.push_back(nullsFirst(row.program));
+	}
+
+	uint64_t PatchMetadataIndex::version() const
+	{
+		return version_;
+	}
+
+	size_t PatchMetadataIndex::size() const
+	{
+		return md5s_.size();
+	}
+
+	std::string const& PatchMetadataIndex::md5(uint32_t row) const
+	{
+		return md5s_[row];
+	}
+
+	bool PatchMetadataIndex::canEvaluate(PatchFilter const& filter)
+	{
+		if (!filter.listID.empty() || filter.onlyDuplicateNames) {
+			return false;
+		}
+		for (auto c : filter.name) {
+			if ((unsigned char)c >= 0x80 || c == '%' || c == '_') {
+				return false;
+			}
+		}
+		for (auto const& cat : filter.categories) {
+			if (!cat.def() || cat.def()->id < 0 || cat.def()->id >= 64) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	size_t PatchMetadataIndex::countMatching(PatchFilter const& filter) const
+	{
+		return selection(filter).count();
+	}
+
+	std::vector<uint32_t> PatchMetadataIndex::matchingRows(PatchFilter const& filter) const
+	{
+		auto selected = selection(filter);
+		std::vector<uint32_t> result;
+		result.reserve(selected.count());
+		selected.forEachSelected([&result](size_t row) {
+			result.push_back((uint32_t)row);
+			});
+		return result;
+	}
+
+	bool PatchMetadataIndex::lessThan(PatchOrdering ordering, PatchMetadataIndex const& a, uint32_t rowA, PatchMetadataIndex const& b, uint32_t rowB)
+	{
+		// Same sort keys as PatchDatabase's ORDER BY clauses. Strings compare bytewise, like SQLite's default BINARY collation does
+		switch (ordering) {
+		case PatchOrdering::Order_by_Name:
+			return std::tie(a.names_[rowA], a.banks_[rowA], a.programs_[rowA]) < std::tie(b.names_[rowB], b.banks_[rowB], b.programs_[rowB]);
+		case PatchOrdering::Order_by_Import_id:
+			return std::tie(a.sourceIdNames_[(size_t)a.sourceIds_[rowA]], a.banks_[rowA], a.programs_[rowA]) 
+				< std::tie(b.sourceIdNames_[(size_t)b.sourceIds_[rowB]], b.banks_[rowB], b.programs_[rowB]);
+		case PatchOrdering::Order_by_ProgramNo:
+			return std::tie(a.programs_[rowA], a.names_[rowA]) < std::tie(b.programs_[rowB], b.names_[rowB]);
+		case PatchOrdering::Order_by_BankNo:
+			return std::tie(a.banks_[rowA], a.programs_[rowA], a.names_[rowA]) < std::tie(b.banks_[rowB], b.programs_[rowB], b.names_[rowB]);
+		case PatchOrdering::No_ordering:
+		case PatchOrdering::Order_by_Place_in_List:
+		default:
+			return false;
+		}
+	}
+
+	uint16_t PatchMetadataIndex::acceptedFlags(PatchFilter const& filter)
+	{
+		// Bit n of the result is set if a row with flags n passes the favorite and hidden conditions of the filter. 
+		// This mirrors the four cases in PatchDatabase's where clause, including how SQL treats NULL columns. 
+		// Also rejects NULL categories for the untagged filter, so the category kernel only needs to look at the bits
+		uint16_t accepted = 0;
+		for (uint8_t flags = 0; flags < 16; flags++) {
+			bool favorite = flags & kFavorite;
+			bool notFavorite = !favorite && !(flags & kFavoriteNull); // favorite != 1 is not true for NULL
+			bool hidden = flags & kHidden;
+			bool pass;
+			if (filter.onlyFaves) {
+				if (filter.showHidden) {
+					pass = filter.showUndecided ? true : (hidden || favorite);
+				}
+				else {
+					pass = filter.showUndecided ? !hidden : (favorite && !hidden);
+				}
+			}
+			else {
+				if (filter.showHidden) {
+					pass = filter.showUndecided ? notFavorite : hidden;
+				}
+				else {
+					pass = filter.showUndecided ? (notFavorite && !hidden) : !hidden;
+				}
+			}
+			if (filter.onlyUntagged && (flags & kCategoriesNull)) {
+				pass = false;
+			}
+			if (pass) {
+				accepted |= (uint16_t)(1 << flags);
+			}
+		}
+		return accepted;
+	}
+
+	SelectionBitmap PatchMetadataIndex::selection(PatchFilter const& filter) const
+	{
+		// One kernel call per criterion, each narrowing down the selection by one column. Words with no row left are skipped by the later kernels
+		SelectionBitmap selected(size(), true);
+
+		if (!filter.importID.empty()) {
+			auto source = sourceIdNumbers_.find(filter.importID);
+			if (source == sourceIdNumbers_.end()) {
+				selected.clear();
+				return selected;
+			}
+			SelectionKernels::keepEqual(selected, sourceIds_.data(), source->second);
+		}
+
+		if (filter.onlySpecifcType) {
+			SelectionKernels::keepEqual(selected, types_.data(), filter.typeID);
+		}
+
+		SelectionKernels::keepAcceptedFlags(selected, flags_.data(), acceptedFlags(filter));
+
+		if (filter.onlyUntagged) {
+			SelectionKernels::keepMasked(selected, categories_.data(), ~(uint64_t)0, 0, false);
+		}
+		else if (!filter.categories.empty()) {
+			uint64_t mask = 0;
+			for (auto const& cat : filter.categories) {
+				mask |= 1ULL << cat.def()->id;
+			}
+			if (filter.andCategories) {
+				SelectionKernels::keepMasked(selected, categories_.data(), mask, mask, false);
+			}
+			else {
+				SelectionKernels::keepMasked(selected, categories_.data(), mask, 0, true);
+			}
+		}
+
+		if (!filter.name.empty()) {
+			// The substring search can't be vectorized like this, so it only looks at the rows still selected
+			auto needle = asciiLowercase(filter.name);
+			auto candidates = selected;
+			candidates.forEachSelected([&](size_t i) {
+				if (namesLowercase_[i].find(needle) == std::string::npos && commentsLowercase_[i].find(needle) == std::string::npos) {
+					selected.reset(i);
+				}
+				});
+		}
+		return selected;
+	}
+
+}
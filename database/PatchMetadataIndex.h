@@ -0,0 +1,81 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "PatchFilter.h"
+#include "SelectionBitmap.h"
+
+#include <cstdint>
+#include <optional>
+
+namespace midikraft {
+
+	// In memory copy of the filterable columns of the patches table for one synth, without the sysex data. Each column is stored as its own 
+	// contiguous array, so a PatchFilter is evaluated by a few tight loops over these instead of a round trip to SQLite.
+	// The index is immutable once built. It remembers the modification count of the database it was built for, so the owner can tell when it is stale
+	class PatchMetadataIndex {
+	public:
+		// One row of the patches table, NULL columns are empty optionals
+		struct Row {
+			std::string md5;
+			std::string name;
+			std::string comment;
+			std::string sourceId;
+			int type = 0;
+			std::optional<int> favorite;
+			std::optional<int> hidden;
+			std::optional<int64_t> categories;
+			std::optional<int> bank;
+			std::optional<int> program;
+		};
+
+		explicit PatchMetadataIndex(uint64_t version);
+
+		void reserve(size_t rows);
+		void add(Row const &row);
+
+		uint64_t version() const;
+		size_t size() const;
+		std::string const &md5(uint32_t row) const;
+
+		// True if the index can evaluate all criteria of the filter exactly like the SQL query would. Lists, duplicate names, and name searches 
+		// with non-ASCII characters or LIKE wildcards are left to the database. The synths of the filter are not checked here, as each index covers one synth
+		static bool canEvaluate(PatchFilter const &filter);
+
+		size_t countMatching(PatchFilter const &filter) const;
+		std::vector<uint32_t> matchingRows(PatchFilter const &filter) const; // In the order the rows were added
+
+		// Compares two rows, possibly of different indexes, with the same sort keys the database uses for the ordering
+		static bool lessThan(PatchOrdering ordering, PatchMetadataIndex const &a, uint32_t rowA, PatchMetadataIndex const &b, uint32_t rowB);
+
+	private:
+		enum Flags : uint8_t {
+			kFavorite = 1, // favorite == 1
+			kFavoriteNull = 2,
+			kHidden = 4, // hidden == 1
+			kCategoriesNull = 8
+		};
+
+		SelectionBitmap selection(PatchFilter const &filter) const;
+		static uint16_t acceptedFlags(PatchFilter const &filter);
+
+		uint64_t version_;
+		std::vector<std::string> md5s_;
+		std::vector<std::string> names_;
+		std::vector<std::string> namesLowercase_;
+		std::vector<std::string> commentsLowercase_;
+		std::vector<int32_t> sourceIds_; // Interned into sourceIdNumbers_
+		std::vector<int32_t> types_;
+		std::vector<uint8_t> flags_;
+		std::vector<uint64_t> categories_; // NULL as 0, with kCategoriesNull set in the flags
+		std::vector<int64_t> banks_; // NULL as the lowest value, so it sorts first like in SQLite
+		std::vector<int64_t> programs_;
+		std::map<std::string, int32_t> sourceIdNumbers_;
+		std::vector<std::string> sourceIdNames_;
+	};
+
+}
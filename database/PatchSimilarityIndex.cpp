@@ -0,0 +1,132 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PatchSimilarityIndex.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <tuple>
+#include <unordered_set>
+
+namespace midikraft {
+
+	PatchSimilarityIndex::PatchSimilarityIndex(uint64_t version, size_t bands) : version_(version), bands_(std::max((size_t)1, bands)), size_(0)
+	{
+	}
+
+	PatchSimilarityIndex::LengthGroup& PatchSimilarityIndex::groupFor(size_t length)
+	{
+		auto found = groups_.find(length);
+		if (found != groups_.end()) {
+			return found->second;
+		}
+		// Sample about one in eight bytes per band. With 8 bands, two patches differing in 3 of 100 bytes still share a band with 99.9% probability.
+		// The seed only depends on the length, so the sampling is the same every time the index is built
+		LengthGroup group;
+		size_t bytesPerBand = std::min((size_t)16, std::max((size_t)1, length / 8));
+		std::mt19937 random((uint32_t)length);
+		std::vector<size_t> allPositions(length);
+		std::iota(allPositions.begin(), allPositions.end(), (size_t)0);
+		for (size_t b = 0; b < bands_; b++) {
+			std::shuffle(allPositions.begin(), allPositions.end(), random);
+			std::vector<size_t> positions(allPositions.begin(), allPositions.begin() + (std::ptrdiff_t)std::min(bytesPerBand, length));
+			std::sort(positions.begin(), positions.end());
+			group.bandPositions.push_back(positions);
+		}
+		group.bandTables.resize(bands_);
+		return groups_.emplace(length, std::move(group)).first->second;
+	}
+
+	uint64_t PatchSimilarityIndex::bandKey(uint8_t const* data, std::vector<size_t> const& positions)
+	{
+		// FNV-1a over the sampled bytes
+		uint64_t hash = 14695981039346656037ULL;
+		for (auto position : positions) {
+			hash ^= data[position];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	void PatchSimilarityIndex::add(std::string const& md5, std::vector<uint8_t> const& voiceData)
+	{
+		if (voiceData.empty()) {
+			return;
+		}
+		auto& group = groupFor(voiceData.size());
+		uint32_t entry = (uint32_t)group.md5s.size();
+		group.md5s.push_back(md5);
+		group.data.insert(group.data.end(), voiceData.begin(), voiceData.end());
+		for (size_t b = 0; b < bands_; b++) {
+			group.bandTables[b].emplace(bandKey(voiceData.data(), group.bandPositions[b]), entry);
+		}
+		size_++;
+	}
+
+	uint64_t PatchSimilarityIndex::version() const
+	{
+		return version_;
+	}
+
+	size_t PatchSimilarityIndex::size() const
+	{
+		return size_;
+	}
+
+	std::vector<PatchSimilarityIndex::Neighbour> PatchSimilarityIndex::nearest(std::vector<uint8_t> const& voiceData, size_t k, std::string const& excludeMd5) const
+	{
+		auto found = groups_.find(voiceData.size());
+		if (found == groups_.end() || k == 0) {
+			return {};
+		}
+		auto const& group = found->second;
+		size_t length = voiceData.size();
+
+		std::unordered_set<uint32_t> candidates;
+		for (size_t b = 0; b < bands_; b++) {
+			auto range = group.bandTables[b].equal_range(bandKey(voiceData.data(), group.bandPositions[b]));
+			for (auto it = range.first; it != range.second; it++) {
+				candidates.insert(it->second);
+			}
+		}
+
+		struct Scored {
+			uint32_t entry;
+			int distance;
+			int delta; // Sum of the absolute byte differences, to rank patches with the same number of differing bytes
+		};
+		std::vector<Scored> scored;
+		scored.reserve(candidates.size());
+		for (auto entry : candidates) {
+			if (group.md5s[entry] == excludeMd5) {
+				continue;
+			}
+			uint8_t const* other = group.data.data() + (size_t)entry * length;
+			int distance = 0;
+			int delta = 0;
+			for (size_t i = 0; i < length; i++) {
+				int difference = std::abs((int)voiceData[i] - (int)other[i]);
+				distance += difference != 0;
+				delta += difference;
+			}
+			scored.push_back({ entry, distance, delta });
+		}
+		size_t count = std::min(k, scored.size());
+		std::partial_sort(scored.begin(), scored.begin() + (std::ptrdiff_t)count, scored.end(), [](Scored const& a, Scored const& b) {
+			return std::tie(a.distance, a.delta, a.entry) < std::tie(b.distance, b.delta, b.entry);
+			});
+
+		std::vector<Neighbour> result;
+		for (size_t i = 0; i < count; i++) {
+			result.push_back({ group.md5s[scored[i].entry], scored[i].distance });
+		}
+		return result;
+	}
+
+}
@@ -0,0 +1,56 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace midikraft {
+
+	// Finds patches whose voice relevant bytes differ in only a few places, e.g. the same sound with one parameter changed, without comparing 
+	// against every patch. Uses locality sensitive hashing: each band hashes a fixed random sample of byte positions, patches agreeing on all 
+	// positions of at least one band become candidates, and only those are compared byte by byte.
+	// Only patches with the same data length are compared. The index is immutable once built
+	class PatchSimilarityIndex {
+	public:
+		struct Neighbour {
+			std::string md5;
+			int distance; // Number of bytes that differ
+		};
+
+		explicit PatchSimilarityIndex(uint64_t version, size_t bands = 8);
+
+		void add(std::string const &md5, std::vector<uint8_t> const &voiceData);
+
+		uint64_t version() const;
+		size_t size() const;
+
+		// Up to k patches closest to the given data, nearest first. Patches with the md5 given are skipped, pass the query patch's own fingerprint
+		std::vector<Neighbour> nearest(std::vector<uint8_t> const &voiceData, size_t k, std::string const &excludeMd5) const;
+
+	private:
+		// All patches of the same data length, with the data stored back to back
+		struct LengthGroup {
+			std::vector<std::vector<size_t>> bandPositions;
+			std::vector<std::unordered_multimap<uint64_t, uint32_t>> bandTables;
+			std::vector<std::string> md5s;
+			std::vector<uint8_t> data;
+		};
+
+		LengthGroup &groupFor(size_t length);
+		static uint64_t bandKey(uint8_t const *data, std::vector<size_t> const &positions);
+
+		uint64_t version_;
+		size_t bands_;
+		size_t size_;
+		std::map<size_t, LengthGroup> groups_;
+	};
+
+}
@@ -0,0 +1,315 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "SelectionBitmap.h"
+
+#include <algorithm>
+#include <bitset>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define MIDIKRAFT_SELECTION_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIDIKRAFT_SELECTION_SSE2
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#define MIDIKRAFT_SELECTION_SSSE3
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define MIDIKRAFT_SELECTION_NEON
+#include <arm_neon.h>
+#endif
+
+namespace midikraft {
+
+	namespace {
+
+		// Each kernel is a function calculating the match bits of up to 64 rows, the vectorized ones only handle full words, 
+		// the tail of the column is left to the scalar version
+
+		uint64_t equalScalar(int32_t const* column, size_t rows, int32_t value) {
+			uint64_t word = 0;
+			for (size_t i = 0; i < rows; i++) {
+				word |= (uint64_t)(column[i] == value) << i;
+			}
+			return word;
+		}
+
+		uint64_t maskedScalar(uint64_t const* column, size_t rows, uint64_t mask, uint64_t expected, bool invert) {
+			uint64_t word = 0;
+			for (size_t i = 0; i < rows; i++) {
+				word |= (uint64_t)(((column[i] & mask) == expected) != invert) << i;
+			}
+			return word;
+		}
+
+		uint64_t flagsScalar(uint8_t const* column, size_t rows, uint16_t accepted) {
+			uint64_t word = 0;
+			for (size_t i = 0; i < rows; i++) {
+				word |= (uint64_t)((accepted >> (column[i] & 0x0f)) & 1) << i;
+			}
+			return word;
+		}
+
+#if defined(MIDIKRAFT_SELECTION_AVX2)
+		uint64_t equalWord(int32_t const* column, int32_t value) {
+			__m256i v = _mm256_set1_epi32(value);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 8) {
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(column + i));
+				word |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(c, v))) << i;
+			}
+			return word;
+		}
+
+		uint64_t maskedWord(uint64_t const* column, uint64_t mask, uint64_t expected, bool invert) {
+			__m256i m = _mm256_set1_epi64x((long long)mask);
+			__m256i e = _mm256_set1_epi64x((long long)expected);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 4) {
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(column + i));
+				word |= (uint64_t)(uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(c, m), e))) << i;
+			}
+			return invert ? ~word : word;
+		}
+
+		__m256i flagsTable(uint16_t accepted) {
+			alignas(32) uint8_t table[32];
+			for (int i = 0; i < 32; i++) {
+				table[i] = ((accepted >> (i & 0x0f)) & 1) ? 0xff : 0;
+			}
+			return _mm256_load_si256(reinterpret_cast<__m256i const*>(table));
+		}
+
+		uint64_t flagsWord(uint8_t const* column, __m256i const& table) {
+			// The flags are below 16, so they index the table directly. The shuffle looks up within each 128 bit lane, which is why the table is there twice
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 32) {
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(column + i));
+				word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_shuffle_epi8(table, c)) << i;
+			}
+			return word;
+		}
+#elif defined(MIDIKRAFT_SELECTION_SSE2)
+		uint64_t equalWord(int32_t const* column, int32_t value) {
+			__m128i v = _mm_set1_epi32(value);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 4) {
+				__m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(column + i));
+				word |= (uint64_t)(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(c, v))) << i;
+			}
+			return word;
+		}
+
+		uint64_t maskedWord(uint64_t const* column, uint64_t mask, uint64_t expected, bool invert) {
+			__m128i m = _mm_set1_epi64x((long long)mask);
+			__m128i e = _mm_set1_epi64x((long long)expected);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 2) {
+				__m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(column + i));
+				// No 64 bit compare in SSE2, both 32 bit halves need to be equal
+				__m128i halves = _mm_cmpeq_epi32(_mm_and_si128(c, m), e);
+				__m128i equal = _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+				word |= (uint64_t)(uint32_t)_mm_movemask_pd(_mm_castsi128_pd(equal)) << i;
+			}
+			return invert ? ~word : word;
+		}
+
+#if defined(MIDIKRAFT_SELECTION_SSSE3)
+		__m128i flagsTable(uint16_t accepted) {
+			alignas(16) uint8_t table[16];
+			for (int i = 0; i < 16; i++) {
+				table[i] = ((accepted >> i) & 1) ? 0xff : 0;
+			}
+			return _mm_load_si128(reinterpret_cast<__m128i const*>(table));
+		}
+
+		uint64_t flagsWord(uint8_t const* column, __m128i const& table) {
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 16) {
+				__m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(column + i));
+				word |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_shuffle_epi8(table, c)) << i;
+			}
+			return word;
+		}
+#endif
+#elif defined(MIDIKRAFT_SELECTION_NEON)
+		uint64_t equalWord(int32_t const* column, int32_t value) {
+			int32x4_t v = vdupq_n_s32(value);
+			const uint32_t weights[4] = { 1, 2, 4, 8 };
+			uint32x4_t w = vld1q_u32(weights);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 4) {
+				uint32x4_t equal = vceqq_s32(vld1q_s32(column + i), v);
+				word |= (uint64_t)vaddvq_u32(vandq_u32(equal, w)) << i;
+			}
+			return word;
+		}
+
+		uint64_t maskedWord(uint64_t const* column, uint64_t mask, uint64_t expected, bool invert) {
+			uint64x2_t m = vdupq_n_u64(mask);
+			uint64x2_t e = vdupq_n_u64(expected);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 2) {
+				uint64x2_t equal = vceqq_u64(vandq_u64(vld1q_u64(column + i), m), e);
+				word |= ((vgetq_lane_u64(equal, 0) & 1) | ((vgetq_lane_u64(equal, 1) & 1) << 1)) << i;
+			}
+			return invert ? ~word : word;
+		}
+
+		uint8x16_t flagsTable(uint16_t accepted) {
+			uint8_t table[16];
+			for (int i = 0; i < 16; i++) {
+				table[i] = ((accepted >> i) & 1) ? 0xff : 0;
+			}
+			return vld1q_u8(table);
+		}
+
+		uint64_t flagsWord(uint8_t const* column, uint8x16_t const& table) {
+			const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+			uint8x16_t w = vld1q_u8(weights);
+			uint64_t word = 0;
+			for (size_t i = 0; i < 64; i += 16) {
+				uint8x16_t bits = vandq_u8(vqtbl1q_u8(table, vld1q_u8(column + i)), w);
+				word |= ((uint64_t)vaddv_u8(vget_low_u8(bits)) | ((uint64_t)vaddv_u8(vget_high_u8(bits)) << 8)) << i;
+			}
+			return word;
+		}
+#endif
+
+		size_t rowsInWord(size_t rows, size_t w) {
+			return std::min((size_t)64, rows - w * 64);
+		}
+
+	}
+
+	SelectionBitmap::SelectionBitmap(size_t rows, bool selected) : rows_(rows), words_((rows + 63) / 64, selected ? ~(uint64_t)0 : 0)
+	{
+		// Bits beyond the last row must stay clear, else count() would be off
+		if (selected && rows % 64 != 0) {
+			words_.back() = ((uint64_t)1 << (rows % 64)) - 1;
+		}
+	}
+
+	size_t SelectionBitmap::size() const
+	{
+		return rows_;
+	}
+
+	size_t SelectionBitmap::count() const
+	{
+		size_t result = 0;
+		for (auto word : words_) {
+			result += std::bitset<64>(word).count();
+		}
+		return result;
+	}
+
+	bool SelectionBitmap::test(size_t row) const
+	{
+		return (words_[row / 64] >> (row % 64)) & 1;
+	}
+
+	void SelectionBitmap::reset(size_t row)
+	{
+		words_[row / 64] &= ~((uint64_t)1 << (row % 64));
+	}
+
+	void SelectionBitmap::clear()
+	{
+		std::fill(words_.begin(), words_.end(), 0);
+	}
+
+	std::vector<uint64_t>& SelectionBitmap::words()
+	{
+		return words_;
+	}
+
+	std::vector<uint64_t> const& SelectionBitmap::words() const
+	{
+		return words_;
+	}
+
+	size_t SelectionBitmap::lowestBit(uint64_t word)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return (size_t)index;
+#else
+		return (size_t)__builtin_ctzll(word);
+#endif
+	}
+
+	void SelectionKernels::keepEqual(SelectionBitmap& selection, int32_t const* column, int32_t value)
+	{
+		auto& words = selection.words();
+		for (size_t w = 0; w < words.size(); w++) {
+			if (!words[w]) continue;
+			size_t rows = rowsInWord(selection.size(), w);
+#if defined(MIDIKRAFT_SELECTION_AVX2) || defined(MIDIKRAFT_SELECTION_SSE2) || defined(MIDIKRAFT_SELECTION_NEON)
+			words[w] &= rows == 64 ? equalWord(column + w * 64, value) : equalScalar(column + w * 64, rows, value);
+#else
+			words[w] &= equalScalar(column + w * 64, rows, value);
+#endif
+		}
+	}
+
+	void SelectionKernels::keepMasked(SelectionBitmap& selection, uint64_t const* column, uint64_t mask, uint64_t expected, bool invert)
+	{
+		auto& words = selection.words();
+		for (size_t w = 0; w < words.size(); w++) {
+			if (!words[w]) continue;
+			size_t rows = rowsInWord(selection.size(), w);
+#if defined(MIDIKRAFT_SELECTION_AVX2) || defined(MIDIKRAFT_SELECTION_SSE2) || defined(MIDIKRAFT_SELECTION_NEON)
+			words[w] &= rows == 64 ? maskedWord(column + w * 64, mask, expected, invert) : maskedScalar(column + w * 64, rows, mask, expected, invert);
+#else
+			words[w] &= maskedScalar(column + w * 64, rows, mask, expected, invert);
+#endif
+		}
+	}
+
+	void SelectionKernels::keepAcceptedFlags(SelectionBitmap& selection, uint8_t const* column, uint16_t accepted)
+	{
+		if (accepted == 0xffff) {
+			return;
+		}
+#if defined(MIDIKRAFT_SELECTION_AVX2) || defined(MIDIKRAFT_SELECTION_SSSE3) || defined(MIDIKRAFT_SELECTION_NEON)
+		auto table = flagsTable(accepted);
+#endif
+		auto& words = selection.words();
+		for (size_t w = 0; w < words.size(); w++) {
+			if (!words[w]) continue;
+			size_t rows = rowsInWord(selection.size(), w);
+#if defined(MIDIKRAFT_SELECTION_AVX2) || defined(MIDIKRAFT_SELECTION_SSSE3) || defined(MIDIKRAFT_SELECTION_NEON)
+			words[w] &= rows == 64 ? flagsWord(column + w * 64, table) : flagsScalar(column + w * 64, rows, accepted);
+#else
+			words[w] &= flagsScalar(column + w * 64, rows, accepted);
+#endif
+		}
+	}
+
+	const char* SelectionKernels::implementation()
+	{
+#if defined(MIDIKRAFT_SELECTION_AVX2)
+		return "AVX2";
+#elif defined(MIDIKRAFT_SELECTION_SSSE3)
+		return "SSSE3";
+#elif defined(MIDIKRAFT_SELECTION_SSE2)
+		return "SSE2";
+#elif defined(MIDIKRAFT_SELECTION_NEON)
+		return "NEON";
+#else
+		return "scalar";
+#endif
+	}
+
+}
@@ -0,0 +1,62 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace midikraft {
+
+	// One bit per row of a column store, set if the row is selected. Rows are grouped into 64 bit words, row i is bit (i % 64) of word (i / 64)
+	class SelectionBitmap {
+	public:
+		SelectionBitmap(size_t rows, bool selected);
+
+		size_t size() const;
+		size_t count() const;
+		bool test(size_t row) const;
+		void reset(size_t row);
+		void clear();
+
+		std::vector<uint64_t> &words();
+		std::vector<uint64_t> const &words() const;
+
+		// Calls f(row) for each selected row in ascending order
+		template <class F>
+		void forEachSelected(F f) const {
+			for (size_t w = 0; w < words_.size(); w++) {
+				uint64_t word = words_[w];
+				while (word) {
+					f(w * 64 + lowestBit(word));
+					word &= word - 1;
+				}
+			}
+		}
+
+	private:
+		static size_t lowestBit(uint64_t word);
+
+		size_t rows_;
+		std::vector<uint64_t> words_;
+	};
+
+	// Narrow down a selection by the values of one column, i.e. clear the bit of every row not matching. The columns must have one entry per row
+	// of the selection. Uses AVX2, SSE2 (SSSE3 for the flags) or NEON if the compiler targets them, else plain loops
+	class SelectionKernels {
+	public:
+		// Keeps rows with column[row] == value
+		static void keepEqual(SelectionBitmap &selection, int32_t const *column, int32_t value);
+		// Keeps rows with ((column[row] & mask) == expected) != invert
+		static void keepMasked(SelectionBitmap &selection, uint64_t const *column, uint64_t mask, uint64_t expected, bool invert);
+		// Keeps rows whose flags, all below 16, have their bit set in accepted
+		static void keepAcceptedFlags(SelectionBitmap &selection, uint8_t const *column, uint16_t accepted);
+
+		static const char *implementation(); // For logging which variant was compiled in
+	};
+
+}
@@ -0,0 +1,191 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "AuditionCache.h"
+
+#include "Capability.h"
+#include "DataFileSendCapability.h"
+#include "MidiController.h"
+#include "MidiLocationCapability.h"
+#include "Synth.h"
+
+#include <spdlog/spdlog.h>
+
+namespace midikraft {
+
+	AuditionCache::AuditionCache(size_t maxEntries) : Thread("AuditionCache"), maxEntries_(std::max((size_t)1, maxEntries))
+	{
+	}
+
+	AuditionCache::~AuditionCache()
+	{
+		signalThreadShouldExit();
+		pendingEvent_.signal();
+		stopThread(1000);
+	}
+
+	bool AuditionCache::sendToSynth(PatchHolder const& patch, std::shared_ptr<SendTarget> target)
+	{
+		auto synth = patch.smartSynth();
+		if (!synth) {
+			return false;
+		}
+		auto midiLocation = midikraft::Capability::hasCapability<MidiLocationCapability>(synth);
+		if (!midiLocation || !midiLocation->channel().isValid()) {
+			spdlog::error("Synth {} has no valid channel and output defined, don't know where to send!", synth->getName());
+			return false;
+		}
+
+		std::string key;
+		TMessages messages;
+		if (keyFor(patch, target, key)) {
+			messages = find(key);
+		}
+		if (!messages) {
+			messages = render(patch, target);
+			if (!key.empty()) {
+				put(key, messages);
+			}
+		}
+		if (messages->empty()) {
+			return false;
+		}
+
+		auto midiOutput = midiLocation->midiOutput();
+		spdlog::debug("Data file sent is '{}' for synth {} to device {}", patch.name(), synth->getName(), midiOutput.name.toStdString());
+		// Only open the output the first time, or again after the device went away
+		auto &output = outputs_[midiOutput.identifier];
+		if (!output || !output->isValid()) {
+			MidiController::instance()->enableMidiOutput(midiOutput);
+			output = MidiController::instance()->getMidiOutput(midiOutput);
+		}
+		synth->sendBlockOfMessagesToSynth(midiOutput, *messages);
+		return true;
+	}
+
+	void AuditionCache::prerender(std::vector<PatchHolder> const& patches, std::shared_ptr<SendTarget> target)
+	{
+		// Synths that can't fingerprint from another thread are converted when sent only
+		std::vector<PatchHolder> renderable;
+		for (auto const& patch : patches) {
+			auto synth = patch.smartSynth();
+			if (synth && synth->canCalculateFingerprintsConcurrently()) {
+				renderable.push_back(patch);
+			}
+		}
+		bool anything = !renderable.empty();
+		{
+			std::lock_guard<std::mutex> lock(pendingLock_);
+			pending_ = std::move(renderable);
+			pendingTarget_ = target;
+		}
+		if (!anything) {
+			return;
+		}
+		if (!isThreadRunning()) {
+			startThread(Thread::lowestPriority);
+		}
+		pendingEvent_.signal();
+	}
+
+	void AuditionCache::clear()
+	{
+		{
+			std::lock_guard<std::mutex> lock(pendingLock_);
+			pending_.clear();
+		}
+		std::lock_guard<std::mutex> lock(lock_);
+		entries_.clear();
+		index_.clear();
+	}
+
+	void AuditionCache::run()
+	{
+		while (!threadShouldExit()) {
+			pendingEvent_.wait(500);
+			while (!threadShouldExit()) {
+				// Take one patch at a time, so a new page replaces the rest of the old one right away
+				PatchHolder patch;
+				std::shared_ptr<SendTarget> target;
+				{
+					std::lock_guard<std::mutex> lock(pendingLock_);
+					if (pending_.empty()) {
+						break;
+					}
+					patch = pending_.front();
+					pending_.erase(pending_.begin());
+					target = pendingTarget_;
+				}
+				std::string key;
+				if (!keyFor(patch, target, key) || find(key)) {
+					continue;
+				}
+				try {
+					put(key, render(patch, target));
+				}
+				catch (std::exception& e) {
+					spdlog::warn("Could not pre-render patch {} for audition: {}", patch.name(), e.what());
+				}
+			}
+		}
+	}
+
+	bool AuditionCache::keyFor(PatchHolder const& patch, std::shared_ptr<SendTarget> target, std::string& outKey)
+	{
+		auto synth = patch.smartSynth();
+		if (!synth) {
+			return false;
+		}
+		// The channel is part of the key as many synths put it into the sysex
+		auto midiLocation = midikraft::Capability::hasCapability<MidiLocationCapability>(synth);
+		int channel = (midiLocation && midiLocation->channel().isValid()) ? midiLocation->channel().toZeroBasedInt() : -1;
+		auto md5 = patch.md5();
+		if (md5.empty()) {
+			return false;
+		}
+		// The name too, as it is not part of the fingerprint but is sent along, so a renamed patch must be converted again
+		outKey = synth->getName() + '\n' + md5 + '\n' + patch.name() + '\n' + std::to_string(channel) + '\n' + (target ? target->name() : std::string());
+		return true;
+	}
+
+	AuditionCache::TMessages AuditionCache::find(std::string const& key)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		auto found = index_.find(key);
+		if (found == index_.end()) {
+			return nullptr;
+		}
+		entries_.splice(entries_.begin(), entries_, found->second);
+		return found->second->messages;
+	}
+
+	void AuditionCache::put(std::string const& key, TMessages messages)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		auto found = index_.find(key);
+		if (found != index_.end()) {
+			found->second->messages = messages;
+			entries_.splice(entries_.begin(), entries_, found->second);
+			return;
+		}
+		entries_.push_front(Entry{ key, messages });
+		index_[key] = entries_.begin();
+		while (entries_.size() > maxEntries_) {
+			index_.erase(entries_.back().key);
+			entries_.pop_back();
+		}
+	}
+
+	AuditionCache::TMessages AuditionCache::render(PatchHolder const& patch, std::shared_ptr<SendTarget> target)
+	{
+		auto data = patch.patch();
+		if (!data) {
+			return std::make_shared<const std::vector<MidiMessage>>();
+		}
+		return std::make_shared<const std::vector<MidiMessage>>(patch.smartSynth()->dataFileToSysex(data, target));
+	}
+
+}
@@ -0,0 +1,69 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "MidiController.h"
+#include "PatchHolder.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace midikraft {
+
+	class SendTarget;
+
+	// Keeps the sysex of recently auditioned patches ready to send, so stepping through a grid of patches doesn't convert each one again.
+	// The messages are keyed by synth, fingerprint, name, channel and send target, the least recently sent are dropped first.
+	// This replaces Synth::sendDataFileToSynth for auditioning, so synths overriding that are sent the dataFileToSysex() result via sendBlockOfMessagesToSynth.
+	// Call sendToSynth() from the message thread, prerender() may be called from anywhere
+	class AuditionCache : private Thread {
+	public:
+		explicit AuditionCache(size_t maxEntries = 256);
+		virtual ~AuditionCache() override;
+
+		// Sends the patch to its synth's MIDI output, converting it only if not cached already. Returns false if there was nothing to send or nowhere to send it to
+		bool sendToSynth(PatchHolder const &patch, std::shared_ptr<SendTarget> target = nullptr);
+
+		// Converts the patches on a background thread, e.g. the page just shown. Replaces what is still waiting from a previous call.
+		// Patches of synths that return false from canCalculateFingerprintsConcurrently() are skipped
+		void prerender(std::vector<PatchHolder> const &patches, std::shared_ptr<SendTarget> target = nullptr);
+
+		void clear(); // Drops all cached messages, e.g. after the synth setup changed
+
+	private:
+		typedef std::shared_ptr<const std::vector<MidiMessage>> TMessages;
+
+		struct Entry {
+			std::string key;
+			TMessages messages;
+		};
+
+		void run() override;
+		static bool keyFor(PatchHolder const &patch, std::shared_ptr<SendTarget> target, std::string &outKey);
+		TMessages find(std::string const &key);
+		void put(std::string const &key, TMessages messages);
+		static TMessages render(PatchHolder const &patch, std::shared_ptr<SendTarget> target);
+
+		size_t maxEntries_;
+		std::mutex lock_;
+		std::list<Entry> entries_; // Most recently used first
+		std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+
+		std::mutex pendingLock_;
+		std::vector<PatchHolder> pending_;
+		std::shared_ptr<SendTarget> pendingTarget_;
+		WaitableEvent pendingEvent_;
+
+		// The outputs sent to, by device identifier, so auditioning on the same synth again doesn't need to open them. Only used by sendToSynth()
+		std::map<String, std::shared_ptr<SafeMidiOutput>> outputs_;
+	};
+
+}
@@ -10,6 +10,7 @@
 #include "Patch.h"
 #include "PatchHolder.h"
 #include "StoredTagCapability.h"
+#include "OperationStatistics.h"
 
 #include "BinaryResources.h"
 
@@ -43,27 +44,207 @@ namespace midikraft {
 		}
 	}
 
-	std::map<std::string, std::map<std::string, std::string>> const &AutomaticCategory::importMappings()
+	namespace {
+
+		std::string asciiLowercase(std::string const &input) {
+			std::string result(input);
+			for (auto &c : result) {
+				if (c >= 'A' && c <= 'Z') c = (char) (c - 'A' + 'a');
+			}
+			return result;
+		}
+
+		bool isRegexSpecial(char c) {
+			return std::string(".[](){}*+?|^$\\").find(c) != std::string::npos;
+		}
+
+		bool isWordCharacter(char c) {
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+		}
+
+		bool isAscii(char c) {
+			return (unsigned char) c < 128;
+		}
+
+		// Returns true if the pattern is just a literal, optionally anchored at the start and/or the end of the name
+		bool parseAnchoredLiteral(std::string const &pattern, bool &anchoredStart, bool &anchoredEnd, std::string &literal) {
+			size_t i = 0;
+			size_t end = pattern.size();
+			anchoredStart = !pattern.empty() && pattern[0] == '^';
+			if (anchoredStart) i++;
+			anchoredEnd = end > i && pattern[end - 1] == '$' && !(end >= 2 && pattern[end - 2] == '\\');
+			if (anchoredEnd) end--;
+			literal.clear();
+			for (; i < end; i++) {
+				char c = pattern[i];
+				if (c == '\\') {
+					// Only escaped punctuation is a literal, \d, \b and friends are not
+					if (i + 1 >= end || isWordCharacter(pattern[i + 1]) || !isAscii(pattern[i + 1])) return false;
+					literal.push_back(pattern[++i]);
+				}
+				else if (isRegexSpecial(c) || !isAscii(c)) {
+					return false;
+				}
+				else {
+					literal.push_back(c);
+				}
+			}
+			return !literal.empty();
+		}
+
+		// Find the longest run of literal characters any match of the pattern must contain. Gives up on alternatives and groups, as
+		// these could make any part of the pattern optional
+		std::string requiredLiteral(std::string const &pattern) {
+			if (pattern.find_first_of("|(") != std::string::npos) {
+				return "";
+			}
+			std::string longest;
+			std::string current;
+			auto endRun = [&]() {
+				if (current.size() > longest.size()) longest = current;
+				current.clear();
+			};
+			for (size_t i = 0; i < pattern.size(); i++) {
+				char c = pattern[i];
+				if (c == '*' || c == '?' || c == '{') {
+					// The previous character is optional
+					if (!current.empty()) current.pop_back();
+					endRun();
+					if (c == '{') {
+						auto close = pattern.find('}', i);
+						if (close == std::string::npos) return "";
+						i = close;
+					}
+				}
+				else if (c == '[') {
+					endRun();
+					// Skip the character class
+					size_t j = i + 1;
+					if (j < pattern.size() && pattern[j] == '^') j++;
+					if (j < pattern.size() && pattern[j] == ']') j++;
+					while (j < pattern.size() && pattern[j] != ']') {
+						if (pattern[j] == '\\') j++;
+						j++;
+					}
+					if (j >= pattern.size()) return "";
+					i = j;
+				}
+				else if (c == '\\') {
+					if (i + 1 < pattern.size() && !isWordCharacter(pattern[i + 1]) && isAscii(pattern[i + 1])) {
+						current.push_back(pattern[++i]);
+					}
+					else {
+						endRun();
+						i++;
+					}
+				}
+				else if (isRegexSpecial(c) || !isAscii(c)) {
+					// ., ^, $ and +, the latter still requires the character before it
+					endRun();
+				}
+				else {
+					current.push_back(c);
+				}
+			}
+			endRun();
+			return longest;
+		}
+
+	}
+
+	bool AutomaticCategory::NameMatcher::matches(std::string const &name, std::string const &foldedName) const
 	{
+		std::string const &subject = caseSensitive ? name : foldedName;
+		switch (kind) {
+		case Kind::CONTAINS:
+			return subject.find(literal) != std::string::npos;
+		case Kind::STARTS_WITH:
+			return subject.compare(0, literal.size(), literal) == 0;
+		case Kind::ENDS_WITH:
+			return subject.size() >= literal.size() && subject.compare(subject.size() - literal.size(), literal.size(), literal) == 0;
+		case Kind::EQUALS:
+			return subject == literal;
+		case Kind::REGEX:
+			if (!literal.empty() && subject.find(literal) == std::string::npos) {
+				return false;
+			}
+			std::call_once(regex->compiled, [this]() {
+				try {
+					regex->regex = std::regex(pattern, flags);
+					regex->valid = true;
+				}
+				catch (std::regex_error const &e) {
+					spdlog::error("Invalid regex '{}' in the automatic category rules, it will never match: {}", pattern, e.what());
+				}
+			});
+			return regex->valid && std::regex_search(name, regex->regex);
+		}
+		return false;
+	}
+
+	AutomaticCategory::NameMatcher AutomaticCategory::compileMatcher(std::string const &pattern, std::regex::flag_type flags)
+	{
+		NameMatcher result{ NameMatcher::Kind::REGEX, (flags & std::regex::icase) == 0, "", pattern, flags, nullptr };
+		bool anchoredStart, anchoredEnd;
+		std::string literal;
+		if (parseAnchoredLiteral(pattern, anchoredStart, anchoredEnd, literal)) {
+			if (anchoredStart && anchoredEnd) result.kind = NameMatcher::Kind::EQUALS;
+			else if (anchoredStart) result.kind = NameMatcher::Kind::STARTS_WITH;
+			else if (anchoredEnd) result.kind = NameMatcher::Kind::ENDS_WITH;
+			else result.kind = NameMatcher::Kind::CONTAINS;
+		}
+		else {
+			literal = requiredLiteral(pattern);
+			result.regex = std::make_shared<LazyRegex>();
+		}
+		result.literal = result.caseSensitive ? literal : asciiLowercase(literal);
+		return result;
+	}
+
+	void AutomaticCategory::compileRules()
+	{
+		compiledRules_.clear();
+		for (auto const &rule : predefinedCategories_) {
+			CompiledRule compiled{ rule.second.category_, {} };
+			for (auto const &matcher : rule.second.patchNamePatterns_) {
+				compiled.matchers.push_back(compileMatcher(matcher.first, matcher.second));
+			}
+			compiledRules_.push_back(compiled);
+		}
+	}
+
+	std::map<std::string, std::map<std::string, std::string>> AutomaticCategory::importMappings() const
+	{
+		ScopedReadLock lock(rulesLock_);
 		return importMappings_;
 	}
 
 	std::set<Category> AutomaticCategory::determineAutomaticCategories(PatchHolder const &patch)
 	{
-		std::set <Category> result;
+		return determineAutomaticCategorySet(patch).asSet();
+	}
+
+	CategorySet AutomaticCategory::determineAutomaticCategorySet(PatchHolder const &patch)
+	{
+		OperationStatistics::Timer timer(OperationStatistics::global(), "AutomaticCategory::determineAutomaticCategorySet");
+		ScopedReadLock lock(rulesLock_);
+		CategorySet result;
 
 		// First step, the synth might support stored categories
 		auto storedTags = midikraft::Capability::hasCapability<StoredTagCapability>(patch.patch());
 		if (storedTags) {
 			// Ah, that synth supports storing tags in the patch data itself, nice! Let's see if we can use them
 			auto tags = storedTags->tags();
-			auto mappings = importMappings();
+			// Only const lookups here, this is called from several threads by the batch recategorization and the file import
+			auto const &mappings = importMappings_;
 			std::string synthname = patch.synth()->getName();
 			for (auto tag : tags) {
 				// Let's see if we can map it
-				if (mappings.find(synthname) != mappings.end()) {
-					if (mappings[synthname].find(tag.name()) != mappings[synthname].end()) {
-						std::string categoryName = mappings[synthname][tag.name()];
+				auto synthMapping = mappings.find(synthname);
+				if (synthMapping != mappings.end()) {
+					auto tagMapping = synthMapping->second.find(tag.name());
+					if (tagMapping != synthMapping->second.end()) {
+						std::string categoryName = tagMapping->second;
 						if (categoryName != "None") {
 							auto found = predefinedCategories_.find(categoryName);
 							if (found != predefinedCategories_.end()) {
@@ -87,11 +268,14 @@ namespace midikraft {
 
 		if (result.empty()) {
 			// Second step, if we have no category yet, try to detect the category from the name using the regex rule set stored in the file automatic_categories.jsonc
-			for (auto autoCat : predefinedCategories_) {
-				for (auto matcher : autoCat.second.patchNameMatchers_) {
-					bool found = std::regex_search(patch.name(), matcher.second);
-					if (found) {
-						result.insert(autoCat.second.category_);
+			// The rules have been compiled into simple string operations where possible, see compileMatcher()
+			std::string name = patch.name();
+			std::string foldedName = asciiLowercase(name);
+			for (auto const &rule : compiledRules_) {
+				for (auto const &matcher : rule.matchers) {
+					if (matcher.matches(name, foldedName)) {
+						result.insert(rule.category);
+						break;
 					}
 				}
 			}
@@ -103,12 +287,20 @@ namespace midikraft {
 		category_(category)
 	{
 		for (auto regex : regexes) {
-			patchNameMatchers_[regex] = (std::regex(regex, std::regex::icase));
+			patchNamePatterns_[regex] = std::regex::icase;
 		}
 	}
 
 	AutoCategoryRule::AutoCategoryRule(Category category, std::map<std::string, std::regex> const &regexes) :
-		category_(category), patchNameMatchers_(regexes)
+		category_(category)
+	{
+		for (auto const &regex : regexes) {
+			patchNamePatterns_[regex.first] = regex.second.flags();
+		}
+	}
+
+	AutoCategoryRule::AutoCategoryRule(Category category, std::map<std::string, std::regex::flag_type> const &patterns) :
+		category_(category), patchNamePatterns_(patterns)
 	{
 	}
 
@@ -119,7 +311,16 @@ namespace midikraft {
 
 	std::map<std::string, std::regex> AutoCategoryRule::patchNameMatchers() const
 	{
-		return patchNameMatchers_;
+		std::map<std::string, std::regex> result;
+		for (auto const &pattern : patchNamePatterns_) {
+			result[pattern.first] = std::regex(pattern.first, pattern.second);
+		}
+		return result;
+	}
+
+	std::map<std::string, std::regex::flag_type> AutoCategoryRule::patchNamePatterns() const
+	{
+		return patchNamePatterns_;
 	}
 
 	void AutomaticCategory::loadFromFile(std::vector<Category> existingCats, std::string fullPathToJson)
@@ -138,19 +339,20 @@ namespace midikraft {
 	}
 
 	void AutomaticCategory::loadFromString(std::vector<Category> existingCats, std::string const fileContent) {
+		ScopedWriteLock lock(rulesLock_);
 		// Parse as JSON, allowing comments in the file
 		auto doc = nlohmann::json::parse(fileContent, nullptr, true, true);
 		if (doc.is_object()) {
 			for (auto const& member : doc.items()) {
 				auto categoryName = member.key();
-				std::map<std::string, std::regex> regexes;
+				std::map<std::string, std::regex::flag_type> regexes;
 				if (member.value().is_array()) {
 					auto a = member.value();
 					for (auto s = a.cbegin(); s != a.cend(); s++) {
 
 						if (s->is_string()) {
 							// Simple Regex
-							regexes[s->get<std::string>()] = std::regex(s->get<std::string>(), std::regex::icase);
+							regexes[s->get<std::string>()] = std::regex::icase;
 						}
 						else if (s->is_object()) {
 							bool case_sensitive = false;
@@ -165,7 +367,7 @@ namespace midikraft {
 								auto regex = (*s)["regex"];
 								if (regex.is_string()) {
 									auto value = regex.get<std::string>();
-									regexes[value] = std::regex(value, case_sensitive ? std::regex_constants::ECMAScript : (std::regex::icase));
+									regexes[value] = case_sensitive ? std::regex_constants::ECMAScript : (std::regex::icase);
 								}
 							}
 						}
@@ -189,6 +391,7 @@ namespace midikraft {
 
 	std::vector<midikraft::AutoCategoryRule> AutomaticCategory::loadedRules() const
 	{
+		ScopedReadLock lock(rulesLock_);
 		std::vector<midikraft::AutoCategoryRule> result;
 		for (auto const& rule : predefinedCategories_) {
 			result.push_back(rule.second);
@@ -197,6 +400,7 @@ namespace midikraft {
 	}
 
 	void AutomaticCategory::loadMappingFromString(std::string const fileContent) {
+		ScopedWriteLock lock(rulesLock_);
 		// Parse as JSON
 		auto doc = nlohmann::json::parse(fileContent, nullptr, true, true);
 		if (doc.is_object()) {
@@ -271,6 +475,7 @@ namespace midikraft {
 
 	void AutomaticCategory::addAutoCategory(AutoCategoryRule const &autoCat)
 	{
+		ScopedWriteLock lock(rulesLock_);
 		auto found = predefinedCategories_.find(autoCat.category_.category());
 		if (found == predefinedCategories_.end()) {
 			// First time
@@ -280,8 +485,9 @@ namespace midikraft {
 		{
 			// Already exists, need to update. Take over category definition and merge rules
 			found->second.category_ = autoCat.category_;
-			found->second.patchNameMatchers_.insert(autoCat.patchNameMatchers_.cbegin(), autoCat.patchNameMatchers_.cend());
+			found->second.patchNamePatterns_.insert(autoCat.patchNamePatterns_.cbegin(), autoCat.patchNamePatterns_.cend());
 		}
+		compileRules();
 	}
 
 	std::string AutomaticCategory::defaultJson()
@@ -12,6 +12,8 @@
 
 #include <set>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
 
 namespace midikraft {
@@ -22,23 +24,29 @@ namespace midikraft {
 	public:
 		AutoCategoryRule(Category category, std::vector<std::string> const &regexes);
 		AutoCategoryRule(Category category, std::map<std::string, std::regex> const &regexes);
+		AutoCategoryRule(Category category, std::map<std::string, std::regex::flag_type> const &patterns);
 		Category category() const;
 
+		// Compiles every regex of the rule, prefer patchNamePatterns() when only copying rules around
 		std::map<std::string, std::regex> patchNameMatchers() const;
+		// The regex source with its syntax flags. The categorizer only compiles these when a patch name gets that far, see NameMatcher
+		std::map<std::string, std::regex::flag_type> patchNamePatterns() const;
 
 	private:
 		friend class AutomaticCategory; // Refactoring help
 
 		Category category_;
-		std::map<std::string, std::regex> patchNameMatchers_;
+		std::map<std::string, std::regex::flag_type> patchNamePatterns_;
 	};
 
+	// Safe to use from several threads, e.g. when loading many files in parallel. Categorizing only takes a read lock, loading new rules the write lock
 	class AutomaticCategory {
 	public:
 		AutomaticCategory(std::vector<Category> existingCats);
 
 		std::set<Category> determineAutomaticCategories(PatchHolder const &patch);
-		std::map<std::string, std::map<std::string, std::string>> const &importMappings();
+		CategorySet determineAutomaticCategorySet(PatchHolder const &patch);
+		std::map<std::string, std::map<std::string, std::string>> importMappings() const;
 
 		void loadFromFile(std::vector<Category> existingCats, std::string fullPathToJson);
 		void loadFromString(std::vector<Category> existingCats, std::string const fileContent);
@@ -53,13 +61,42 @@ namespace midikraft {
 		void addAutoCategory(AutoCategoryRule const &autoCat);
 
 	private:
+		// Precompiled form of a single rule regex. Most rules are just a literal with an optional anchor, these are matched with plain string
+		// operations on the case folded name. Everything else falls back to std::regex, but only if a literal that must occur in any match is found first.
+		// Compiling a std::regex is expensive, so that only happens the first time a name passes the prefilter, and never for a rule no name gets to
+		struct LazyRegex {
+			std::once_flag compiled;
+			std::regex regex;
+			bool valid = false;
+		};
+		struct NameMatcher {
+			enum class Kind { CONTAINS, STARTS_WITH, ENDS_WITH, EQUALS, REGEX };
+			Kind kind;
+			bool caseSensitive;
+			std::string literal; // For REGEX, the required literal prefilter, empty if none could be determined
+			std::string pattern;
+			std::regex::flag_type flags;
+			std::shared_ptr<LazyRegex> regex; // Only for REGEX, shared by the copies of the matcher
+
+			bool matches(std::string const &name, std::string const &foldedName) const;
+		};
+		struct CompiledRule {
+			Category category;
+			std::vector<NameMatcher> matchers;
+		};
+
+		static NameMatcher compileMatcher(std::string const &pattern, std::regex::flag_type flags);
+		void compileRules();
+
 		void loadMappingFromString(std::string const fileContent);
 
 		std::string defaultJson();
 		std::string defaultJsonMapping();
 
 		std::map<std::string, AutoCategoryRule> predefinedCategories_;
+		std::vector<CompiledRule> compiledRules_; // Rebuilt whenever predefinedCategories_ changes
 		std::map<std::string, std::map<std::string, std::string>> importMappings_;
+		mutable ReadWriteLock rulesLock_; // Guards the three above
 	};
 
 }
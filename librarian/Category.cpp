@@ -42,6 +42,152 @@ namespace midikraft {
 		return result;
 	}
 
+	CategorySet::CategorySet(std::set<Category> const &categories)
+	{
+		// The std::set is already sorted by id
+		for (auto const &category : categories) {
+			insert(category);
+		}
+	}
+
+	bool CategorySet::isValidId(int id)
+	{
+		return id >= 0 && id < kMaxCategories;
+	}
+
+	bool CategorySet::contains(Category const &category) const
+	{
+		int id = category.def()->id;
+		return isValidId(id) && (bits_ & (1ULL << id));
+	}
+
+	void CategorySet::insert(Category const &category)
+	{
+		int id = category.def()->id;
+		if (!isValidId(id)) {
+			jassertfalse;
+			return;
+		}
+		if (!contains(category)) {
+			bits_ |= 1ULL << id;
+			auto members = std::make_shared<std::vector<Category>>(categories());
+			members->insert(std::upper_bound(members->begin(), members->end(), category), category);
+			members_ = members;
+		}
+	}
+
+	void CategorySet::erase(Category const &category)
+	{
+		if (contains(category)) {
+			bits_ &= ~(1ULL << category.def()->id);
+			if (bits_ == 0) {
+				members_.reset();
+				return;
+			}
+			auto members = std::make_shared<std::vector<Category>>(*members_);
+			members->erase(std::lower_bound(members->begin(), members->end(), category));
+			members_ = members;
+		}
+	}
+
+	void CategorySet::clear()
+	{
+		bits_ = 0;
+		members_.reset();
+	}
+
+	bool CategorySet::empty() const
+	{
+		return bits_ == 0;
+	}
+
+	size_t CategorySet::size() const
+	{
+		return members_ ? members_->size() : 0;
+	}
+
+	uint64 CategorySet::bits() const
+	{
+		return bits_;
+	}
+
+	CategorySet CategorySet::selectFrom(CategorySet const &a, CategorySet const &b, uint64 mask)
+	{
+		// Nothing to build if the result is one of the inputs
+		CategorySet result;
+		if (mask == 0) {
+			return result;
+		}
+		if (mask == b.bits_) {
+			return b;
+		}
+		if (mask == a.bits_) {
+			return a;
+		}
+		// Merge the two sorted member lists, keeping only those whose bit is in the mask
+		auto const &membersA = a.categories();
+		auto const &membersB = b.categories();
+		auto members = std::make_shared<std::vector<Category>>();
+		members->reserve((size_t) std::min(membersA.size() + membersB.size(), (size_t) kMaxCategories));
+		auto ia = membersA.cbegin();
+		auto ib = membersB.cbegin();
+		while (ia != membersA.cend() || ib != membersB.cend()) {
+			Category const *next;
+			if (ib == membersB.cend() || (ia != membersA.cend() && *ia < *ib)) {
+				next = &*ia++;
+			}
+			else {
+				if (ia != membersA.cend() && *ia == *ib) {
+					ia++;
+				}
+				next = &*ib++;
+			}
+			if (mask & (1ULL << next->def()->id)) {
+				members->push_back(*next);
+			}
+		}
+		result.bits_ = mask;
+		result.members_ = members;
+		return result;
+	}
+
+	CategorySet CategorySet::unionWith(CategorySet const &other) const
+	{
+		return selectFrom(*this, other, bits_ | other.bits_);
+	}
+
+	CategorySet CategorySet::intersectionWith(CategorySet const &other) const
+	{
+		return selectFrom(*this, CategorySet(), bits_ & other.bits_);
+	}
+
+	CategorySet CategorySet::difference(CategorySet const &other) const
+	{
+		return selectFrom(*this, CategorySet(), bits_ & ~other.bits_);
+	}
+
+	std::vector<Category> const &CategorySet::categories() const
+	{
+		static const std::vector<Category> kNoCategories;
+		return members_ ? *members_ : kNoCategories;
+	}
+
+	std::set<Category> CategorySet::asSet() const
+	{
+		auto const &members = categories();
+		return std::set<Category>(members.cbegin(), members.cend());
+	}
+
+	bool operator==(CategorySet const &left, CategorySet const &right)
+	{
+		return left.bits_ == right.bits_;
+	}
+
+	bool operator!=(CategorySet const &left, CategorySet const &right)
+	{
+		return !(left == right);
+	}
+
 	std::string Category::category() const
 	{
 		return def_->name;
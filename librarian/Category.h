@@ -33,6 +33,47 @@ namespace midikraft {
 		std::shared_ptr<CategoryDefinition> def_;
 	};
 
+	// Compact set of categories, using the category id (which is the bit index in the database) as the index into a 64 bit mask.
+	// Membership tests and comparisons only look at the mask, the categories themselves are kept sorted by id for iteration
+	class CategorySet {
+	public:
+		CategorySet() = default;
+		CategorySet(std::set<Category> const &categories);
+
+		static const int kMaxCategories = 63;
+
+		bool contains(Category const &category) const;
+		void insert(Category const &category);
+		void erase(Category const &category);
+		void clear();
+		bool empty() const;
+		size_t size() const;
+
+		// The mask with bit n set for the category with id n
+		uint64 bits() const;
+
+		CategorySet unionWith(CategorySet const &other) const;
+		CategorySet intersectionWith(CategorySet const &other) const;
+		CategorySet difference(CategorySet const &other) const;
+
+		std::vector<Category> const &categories() const;
+		std::set<Category> asSet() const;
+
+	private:
+		friend bool operator ==(CategorySet const &left, CategorySet const &right);
+
+		static bool isValidId(int id);
+		static CategorySet selectFrom(CategorySet const &a, CategorySet const &b, uint64 mask);
+
+		uint64 bits_ = 0;
+		// Sorted by id, one entry per bit set. Shared between copies and only replaced, never modified, so the many patches with the same
+		// categories cost a pointer each. Null when empty
+		std::shared_ptr<const std::vector<Category>> members_;
+	};
+
+	bool operator ==(CategorySet const &left, CategorySet const &right);
+	bool operator !=(CategorySet const &left, CategorySet const &right);
+
 	std::set<Category> category_union(std::set<Category> const &a, std::set<Category> const &b);
 	std::set<Category> category_intersection(std::set<Category> const &, std::set<Category> const &);
 	std::set<Category> category_difference(std::set<Category> const &, std::set<Category> const &);
@@ -0,0 +1,1028 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "DownloadSession.h"
+
+#include "Librarian.h"
+#include "SynthBank.h"
+#include "BankDumpCapability.h"
+#include "EditBufferCapability.h"
+#include "ProgramDumpCapability.h"
+#include "SendsProgramChangeCapability.h"
+#include "MidiLocationCapability.h"
+
+#include "RunWithRetry.h"
+
+#include <iterator>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include "SpdLogJuce.h"
+
+namespace midikraft {
+
+	// Items not answered by then are requested again, and after the retries are used up left as a gap for the final pass
+	const uint32 kItemTimeoutMs = 2000;
+	const int kMaxItemRetries = 2;
+	const int kWatchdogIntervalMs = 250;
+
+	DownloadSession::DownloadSession(Librarian &librarian, std::shared_ptr<SafeMidiOutput> midiOutput, ProgressHandler *progressHandler) :
+		librarian_(librarian), midiOutput_(midiOutput), progressHandler_(progressHandler), finished_(false), currentDownloadBank_(MidiBankNumber::invalid()),
+		downloadNumber_(0), startDownloadNumber_(0), endDownloadNumber_(0), expectedDownloadNumber_(0), bankIndex_(0),
+		itemType_(ItemDownloadType::PROGRAM_DUMPS), itemWindow_(1), gapPass_(false), itemGeneration_(0), itemParsesPending_(0), itemFinishPending_(false), duplicatesExpected_(0), itemTimeouts_(0), itemStartMs_(0.0),
+		streamAhead_(0), streamRequested_(-1), streamFirstElement_(0), handshakeDeadline_(0), handshakeRetries_(0), handshakeTimeouts_(0), handshakeStepMs_(0.0), handshakeStartMs_(0.0),
+		sequencer_(nullptr), dataTypeIndex_(0), dataWindow_(1), nextDataItem_(0), dataItemsReceived_(0), dataItemsExpected_(0), dataItemsDone_(0), dataItemsTotal_(0)
+	{
+	}
+
+	DownloadSession::~DownloadSession()
+	{
+		cancel();
+	}
+
+	void DownloadSession::cancel()
+	{
+		ScopedLock lock(lock_);
+		clearHandlers();
+		finished_ = true;
+	}
+
+	bool DownloadSession::isFinished() const
+	{
+		return finished_;
+	}
+
+	juce::MidiDeviceInfo DownloadSession::output() const
+	{
+		return midiOutput_->deviceInfo();
+	}
+
+	void DownloadSession::afterUnlock(std::function<void()> work)
+	{
+		unlockedWork_.push_back(work);
+	}
+
+	void DownloadSession::runUnlockedWork()
+	{
+		// The work can queue more, e.g. parsing the last reply of a bank starts the next bank
+		while (true) {
+			std::vector<std::function<void()>> work;
+			{
+				ScopedLock lock(lock_);
+				work.swap(unlockedWork_);
+			}
+			if (work.empty()) return;
+			for (auto const &item : work) {
+				item();
+			}
+		}
+	}
+
+	void DownloadSession::sendUnlocked(std::vector<MidiMessage> const &messages)
+	{
+		if (messages.empty()) return;
+		auto synth = synth_;
+		auto output = midiOutput_->deviceInfo();
+		afterUnlock([synth, output, messages]() {
+			synth->sendBlockOfMessagesToSynth(output, messages);
+			});
+	}
+
+	void DownloadSession::reportSuccess()
+	{
+		if (auto progressHandler = progressHandler_) {
+			afterUnlock([progressHandler]() { progressHandler->onSuccess(); });
+		}
+	}
+
+	void DownloadSession::reportCancel()
+	{
+		if (auto progressHandler = progressHandler_) {
+			afterUnlock([progressHandler]() { progressHandler->onCancel(); });
+		}
+	}
+
+	void DownloadSession::reportFailure(std::string const &reason)
+	{
+		spdlog::error("Download from {} failed: {}", synth_->getName(), reason);
+		if (auto onFailed = onFailed_) {
+			auto progressHandler = progressHandler_;
+			afterUnlock([progressHandler, onFailed, reason]() {
+				if (progressHandler) {
+					progressHandler->setMessage(reason);
+				}
+				onFailed(reason);
+				});
+		}
+		else {
+			reportCancel();
+		}
+	}
+
+	void DownloadSession::bindInput(Synth *synth)
+	{
+		auto location = synth ? midikraft::Capability::hasCapability<MidiLocationCapability>(synth) : nullptr;
+		inputIdentifier_ = location ? location->midiInput().identifier : juce::String();
+	}
+
+	void DownloadSession::addHandler(std::function<void(DownloadSession &session, MidiMessage const &message)> handler)
+	{
+		// Only a weak reference, the session may be dropped by its owner while a message is being dispatched
+		std::weak_ptr<DownloadSession> weakSession = shared_from_this();
+		auto handle = MidiController::makeOneHandle();
+		// Another synth of the same model on a different input must not end up in this download
+		auto filter = MidiMessageFilter::nonRealtime().fromInput(inputIdentifier_);
+		MidiController::instance()->addMessageHandler(handle, filter, [weakSession, handler](MidiInput*, const juce::MidiMessage& message) {
+			if (auto session = weakSession.lock()) {
+				UnlockedWork unlockedWork{ *session };
+				ScopedLock lock(session->lock_);
+				handler(*session, message);
+			}
+			});
+		handles_.push(handle);
+	}
+
+	void DownloadSession::clearHandlers()
+	{
+		// This is to clear up any remaining MIDI callback handlers, e.g. on User canceling an operation
+		while (!handles_.empty()) {
+			auto handle = handles_.top();
+			handles_.pop();
+			MidiController::instance()->removeMessageHandler(handle);
+		}
+		itemWatchdog_.stopTimer();
+		outstandingItems_.clear();
+		toRequest_.clear();
+	}
+
+	void DownloadSession::finished()
+	{
+		clearHandlers();
+		finished_ = true;
+	}
+
+	std::vector<PatchHolder> DownloadSession::tagPatches(TPatchVector &patches, MidiBankNumber bankNo, int firstPatchIndex)
+	{
+		auto result = librarian_.tagPatchesWithImportFromSynth(synth_, patches, bankNo, bankImportTime_, firstPatchIndex);
+		if (banks_.size() > 1) {
+			librarian_.tagPatchesWithMultiBulkImport(result, bulkImportTime_);
+		}
+		return result;
+	}
+
+	void DownloadSession::reportPatches(std::vector<PatchHolder> const &patches)
+	{
+		if (auto onPatchReceived = onPatchReceived_) {
+			afterUnlock([onPatchReceived, patches]() {
+				for (auto const& patch : patches) {
+					// Fingerprint now, on the MIDI thread, so the receiver can look it up without waiting
+					patch.md5();
+					onPatchReceived(patch);
+				}
+				});
+		}
+	}
+
+	void DownloadSession::startBanks(std::shared_ptr<Synth> synth, std::vector<MidiBankNumber> const &banks, TFinishedHandler onFinished, TPatchReceivedHandler onPatchReceived,
+		TFailedHandler onFailed)
+	{
+		UnlockedWork unlockedWork{ *this };
+		ScopedLock lock(lock_);
+		synth_ = synth;
+		bindInput(synth.get());
+		onPatchReceived_ = onPatchReceived;
+		onFailed_ = onFailed;
+		bulkImportTime_ = Time::getCurrentTime();
+		banks_ = banks;
+		bankIndex_ = 0;
+		downloadedPatches_.clear();
+		if (banks_.empty()) {
+			finished_ = true;
+			return;
+		}
+
+		onBanksFinished_ = onFinished;
+		onFinished_ = [this](std::vector<PatchHolder> const &patchesLoaded) {
+			bankFinished(patchesLoaded);
+		};
+		if (progressHandler_) progressHandler_->setMessage(fmt::format("Importing {} from {}...", SynthBank::friendlyBankName(synth, banks_[0]), synth->getName()));
+		startBank(banks_[0]);
+	}
+
+	void DownloadSession::bankFinished(std::vector<PatchHolder> const &patchesLoaded)
+	{
+		downloadedPatches_.insert(downloadedPatches_.end(), patchesLoaded.begin(), patchesLoaded.end());
+		bankIndex_++;
+		if (bankIndex_ == banks_.size()) {
+			finished();
+			auto onBanksFinished = onBanksFinished_;
+			auto patches = downloadedPatches_;
+			afterUnlock([onBanksFinished, patches]() { onBanksFinished(patches); });
+		}
+		else if (progressHandler_ && progressHandler_->shouldAbort()) {
+			finished();
+		}
+		else {
+			if (progressHandler_) progressHandler_->setMessage(fmt::format("Importing {} from {}...", SynthBank::friendlyBankName(synth_, banks_[bankIndex_]), synth_->getName()));
+			startBank(banks_[bankIndex_]);
+		}
+	}
+
+	void DownloadSession::startBank(MidiBankNumber bankNo)
+	{
+		clearHandlers();
+		finished_ = false;
+		bankImportTime_ = Time::getCurrentTime();
+
+		// Ok, for this we need to send a program change message, and then a request edit buffer message from the active synth
+		// Once we get that, store the patch and increment number by one
+		downloadNumber_ = 0;
+		currentDownload_.clear();
+
+		auto synth = synth_;
+		auto midiOutput = midiOutput_;
+
+		// Determine what we will do with the answer...
+		switch (librarian_.determineBankDownloadMethod(synth)) {
+		case BankDownloadMethod::STREAMING: {
+			auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth);
+			// Simple enough, we hope
+			addHandler([](DownloadSession &session, const juce::MidiMessage& message) {
+				session.handleNextStreamPart(message, StreamLoadCapability::StreamType::BANK_DUMP);
+				});
+			currentDownloadBank_ = bankNo;
+			expectedDownloadNumber_ = SynthBank::numberOfPatchesInBank(synth, bankNo);
+			if (expectedDownloadNumber_ > 0) {
+				startStreamDownload(StreamLoadCapability::StreamType::BANK_DUMP, bankNo.toZeroBased());
+			}
+		}
+			break;
+		case BankDownloadMethod::HANDSHAKES: {
+			auto handshakeLoadingRequired = midikraft::Capability::hasCapability<HandshakeLoadingCapability>(synth);
+			// These are proper protocols that are implemented - each message we get from the synth has to be answered by an appropriate next message
+			std::shared_ptr<HandshakeLoadingCapability::ProtocolState>  state = handshakeLoadingRequired->createStateObject();
+			if (state) {
+				startHandshakeDownload(bankNo, handshakeLoadingRequired, state);
+			}
+			else {
+				jassert(false);
+			}
+			break;
+		}
+		case BankDownloadMethod::BANKS: {
+			auto bankCapableSynth = midikraft::Capability::hasCapability<BankDumpRequestCapability>(synth);
+			// This is a mixture - you send one message (bank request), and then you get either one message back (like Kawai K3) or a stream of messages with
+			// one message per patch (e.g. Access Virus or Matrix1000)
+			auto buffer = bankCapableSynth->requestBankDump(bankNo);
+			auto outname = midiOutput->deviceInfo();
+			addHandler([bankNo](DownloadSession &session, const juce::MidiMessage& message) {
+				session.handleNextBankDump(message, bankNo);
+				});
+			std::weak_ptr<DownloadSession> weakSession = shared_from_this();
+			RunWithRetry::start([weakSession, synth, outname, buffer, bankNo]() {
+				if (auto session = weakSession.lock()) {
+					ScopedLock lock(session->lock_);
+					session->expectedDownloadNumber_ = SynthBank::numberOfPatchesInBank(synth, bankNo);
+				}
+				synth->sendBlockOfMessagesToSynth(outname, buffer);
+				},
+				[weakSession]() {
+					auto session = weakSession.lock();
+					if (!session) return false;
+					ScopedLock lock(session->lock_);
+					return !session->finished_ && session->currentDownload_.empty();
+				},
+					3,
+					500,
+					"initiating bank dump");
+			break;
+		}
+		case BankDownloadMethod::PROGRAM_BUFFERS: {
+			// Uh, stone age, need to start a loop
+			auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
+			if (programDumpCapability) {
+				// Synths that can queue requests get a window of them in flight instead of paying a full round trip per program
+				auto pipelining = midikraft::Capability::hasCapability<ProgramDumpPipeliningCapability>(synth);
+				int window = pipelining ? std::max(1, pipelining->programDumpRequestWindow()) : 1;
+				int start = SynthBank::startIndexInBank(synth, bankNo);
+				startItemDownload(bankNo, ItemDownloadType::PROGRAM_DUMPS, window, start, start + SynthBank::numberOfPatchesInBank(synth, bankNo));
+			}
+			break;
+		}
+		case BankDownloadMethod::EDIT_BUFFERS: {
+			// Uh, stone age, need to start a loop
+			auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth);
+			if (editBufferCapability) {
+				int start = SynthBank::startIndexInBank(synth, bankNo);
+				startItemDownload(bankNo, ItemDownloadType::EDIT_BUFFERS_WITH_PROGRAM_CHANGE, 1, start, start + SynthBank::numberOfPatchesInBank(synth, bankNo));
+			}
+			break;
+		}
+		default:
+			spdlog::error("Error: This synth has not implemented a single method to retrieve a bank. Please consult the documentation!");
+			finished_ = true;
+		}
+	}
+
+	void DownloadSession::startEditBuffer(std::shared_ptr<Synth> synth, TFinishedHandler onFinished)
+	{
+		UnlockedWork unlockedWork{ *this };
+		ScopedLock lock(lock_);
+		clearHandlers();
+		synth_ = synth;
+		bindInput(synth.get());
+		finished_ = false;
+		onPatchReceived_ = nullptr;
+		onFailed_ = nullptr;
+		banks_.clear();
+		bankImportTime_ = Time::getCurrentTime();
+
+		downloadNumber_ = 0;
+		currentDownload_.clear();
+		onFinished_ = [this, onFinished](std::vector<PatchHolder> const &patches) {
+			finished();
+			afterUnlock([onFinished, patches]() { onFinished(patches); });
+		};
+		auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth);
+		auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth);
+		auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
+		auto programChangeCapability = midikraft::Capability::hasCapability<SendsProgramChangeCapability>(synth);
+		if (streamLoading) {
+			// Simple enough, we hope
+			addHandler([](DownloadSession &session, const juce::MidiMessage& message) {
+				session.handleNextStreamPart(message, StreamLoadCapability::StreamType::EDIT_BUFFER_DUMP);
+				});
+			startStreamDownload(StreamLoadCapability::StreamType::EDIT_BUFFER_DUMP, 0);
+		}
+		else if (editBufferCapability) {
+			// Special case - load only a single patch. In this case we're interested in the edit buffer only, no program change required, we want exactly one edit buffer, the current one
+			startItemDownload(MidiBankNumber::fromZeroBase(0, SynthBank::numberOfPatchesInBank(synth, 0)), ItemDownloadType::EDIT_BUFFERS, 1, 0, 1);
+		}
+		else if (programDumpCapability && programChangeCapability) {
+			sendUnlocked(programDumpCapability->requestPatch(programChangeCapability->lastProgramChange().toZeroBasedWithBank()));
+			finished_ = true;
+		}
+		else {
+			spdlog::error("The {} has no way to request the edit buffer or program place", synth->getName());
+			finished_ = true;
+		}
+	}
+
+	void DownloadSession::startSequencerData(DataFileLoadCapability *sequencer, int dataFileIdentifier, TStepSequencerFinishedHandler onFinished)
+	{
+		// One at a time, as before, for sequencers that might not cope with requests queueing up
+		startSequencerData(sequencer, std::vector<int>({ dataFileIdentifier }), 1, onFinished);
+	}
+
+	void DownloadSession::startSequencerData(DataFileLoadCapability *sequencer, std::vector<int> const &dataTypeIDs, int window, TStepSequencerFinishedHandler onFinished,
+		TDataFilesReceivedHandler onDataReceived)
+	{
+		UnlockedWork unlockedWork{ *this };
+		ScopedLock lock(lock_);
+		clearHandlers();
+		finished_ = false;
+
+		sequencer_ = sequencer;
+		bindInput(dynamic_cast<Synth *>(sequencer));
+		dataTypes_ = dataTypeIDs;
+		dataTypeIndex_ = 0;
+		dataWindow_ = std::max(1, window);
+		dataItemsDone_ = 0;
+		dataItemsTotal_ = 0;
+		for (auto dataType : dataTypes_) {
+			dataItemsTotal_ += sequencer_->numberOfDataItemsPerType(dataType);
+		}
+		loadedData_.clear();
+		onSequencerFinished_ = onFinished;
+		onDataReceived_ = onDataReceived;
+
+		addHandler([](DownloadSession &session, const MidiMessage& message) {
+			session.handleNextDataItem(message);
+			});
+		if (!startDataType()) {
+			// Nothing to download at all
+			sequencerFinished();
+		}
+	}
+
+	void DownloadSession::sequencerFinished()
+	{
+		finished();
+		auto onSequencerFinished = onSequencerFinished_;
+		auto loaded = loadedData_;
+		afterUnlock([onSequencerFinished, loaded]() { onSequencerFinished(loaded); });
+		reportSuccess();
+	}
+
+	bool DownloadSession::startDataType()
+	{
+		// Skips types that have no items
+		while (dataTypeIndex_ < dataTypes_.size()) {
+			nextDataItem_ = 0;
+			dataItemsReceived_ = 0;
+			dataItemsExpected_ = sequencer_->numberOfDataItemsPerType(dataTypes_[dataTypeIndex_]);
+			dataItemBatch_.clear();
+			if (dataItemsExpected_ > 0) {
+				fillDataWindow();
+				return true;
+			}
+			dataTypeIndex_++;
+		}
+		return false;
+	}
+
+	void DownloadSession::fillDataWindow()
+	{
+		while (nextDataItem_ < dataItemsExpected_ && nextDataItem_ - dataItemsReceived_ < dataWindow_) {
+			requestDataItem(nextDataItem_++);
+		}
+	}
+
+	void DownloadSession::handleNextDataItem(const juce::MidiMessage& message)
+	{
+		if (finished_ || dataTypeIndex_ >= dataTypes_.size() || !sequencer_->isDataFile(message, dataTypes_[dataTypeIndex_])) {
+			return;
+		}
+		dataItemBatch_.push_back(message);
+		dataItemsReceived_++;
+		dataItemsDone_++;
+		if (dataItemBatch_.size() >= (size_t)dataWindow_ || dataItemsReceived_ >= dataItemsExpected_) {
+			flushDataItems();
+		}
+		bool typeComplete = dataItemsReceived_ >= dataItemsExpected_;
+		if (typeComplete && dataTypeIndex_ + 1 >= dataTypes_.size()) {
+			sequencerFinished();
+		}
+		else if (progressHandler_ && progressHandler_->shouldAbort()) {
+			finished();
+			reportCancel();
+		}
+		else {
+			if (typeComplete) {
+				dataTypeIndex_++;
+				if (!startDataType()) {
+					// Only empty types left
+					sequencerFinished();
+					return;
+				}
+			}
+			else {
+				fillDataWindow();
+			}
+			if (progressHandler_) progressHandler_->setProgressPercentage(dataItemsDone_ / (double)dataItemsTotal_);
+		}
+	}
+
+	void DownloadSession::flushDataItems()
+	{
+		if (dataItemBatch_.empty()) {
+			return;
+		}
+		int dataType = dataTypes_[dataTypeIndex_];
+		auto loaded = sequencer_->loadData(dataItemBatch_, dataType);
+		dataItemBatch_.clear();
+		loadedData_.insert(loadedData_.end(), loaded.begin(), loaded.end());
+		if (auto onDataReceived = onDataReceived_) {
+			if (!loaded.empty()) {
+				afterUnlock([onDataReceived, dataType, loaded]() { onDataReceived(dataType, loaded); });
+			}
+		}
+	}
+
+	void DownloadSession::startItemDownload(MidiBankNumber bankNo, ItemDownloadType type, int window, int startProgram, int endProgram)
+	{
+		currentDownloadBank_ = bankNo;
+		itemType_ = type;
+		itemWindow_ = window;
+		startDownloadNumber_ = startProgram;
+		endDownloadNumber_ = endProgram;
+		toRequest_.clear();
+		for (int program = startProgram; program < endProgram; program++) {
+			toRequest_.push_back(program);
+		}
+		outstandingItems_.clear();
+		receivedItems_.clear();
+		gaps_.clear();
+		gapPass_ = false;
+		currentItemDump_.clear();
+		itemGeneration_++;
+		itemParsesPending_ = 0;
+		itemFinishPending_ = false;
+		retriedItemDump_.clear();
+		duplicatesExpected_ = 0;
+		itemLatency_ = LatencyHistogram();
+		itemTimeouts_ = 0;
+		itemStartMs_ = Time::getMillisecondCounterHiRes();
+
+		addHandler([](DownloadSession &session, const juce::MidiMessage& message) {
+			session.handleNextItemMessage(message);
+			});
+		std::weak_ptr<DownloadSession> weakSession = shared_from_this();
+		itemWatchdog_.onTick = [weakSession]() {
+			if (auto session = weakSession.lock()) {
+				session->checkItemDeadlines();
+			}
+		};
+		itemWatchdog_.startTimer(kWatchdogIntervalMs);
+		fillItemWindow();
+	}
+
+	void DownloadSession::requestItem(int program)
+	{
+		std::vector<MidiMessage> messages;
+		if (itemType_ == ItemDownloadType::PROGRAM_DUMPS) {
+			if (auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth_)) {
+				messages = programDumpCapability->requestPatch(program);
+			}
+		}
+		else if (auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth_)) {
+			auto midiLocation = midikraft::Capability::hasCapability<MidiLocationCapability>(synth_);
+			if (midiLocation) {
+				// To continue with more than one download makes only sense if we send program change commands
+				if (itemType_ == ItemDownloadType::EDIT_BUFFERS_WITH_PROGRAM_CHANGE) {
+					messages.push_back(MidiMessage::programChange(midiLocation->channel().toOneBasedInt(), program));
+				}
+				auto requestMessages = editBufferCapability->requestEditBufferDump();
+				std::copy(requestMessages.cbegin(), requestMessages.cend(), std::back_inserter(messages));
+			}
+			else {
+				spdlog::error("Can't send to synth because no MIDI location implemented for it");
+			}
+		}
+		// A retry starts the dump from scratch. With more in flight, what has arrived might be the start of another program's reply, so keep it
+		if (outstandingItems_.size() == 1) {
+			currentItemDump_.clear();
+		}
+		auto item = outstandingItems_.find(program);
+		if (item != outstandingItems_.end()) {
+			item->second.deadline = Time::getMillisecondCounter() + kItemTimeoutMs;
+			item->second.requestedMs = Time::getMillisecondCounterHiRes();
+		}
+		MidiController::instance()->telemetry().recordRequest(synth_->getName());
+		sendUnlocked(messages);
+	}
+
+	void DownloadSession::fillItemWindow()
+	{
+		while ((int)outstandingItems_.size() < itemWindow_ && !toRequest_.empty()) {
+			int program = toRequest_.front();
+			toRequest_.pop_front();
+			outstandingItems_.emplace(program, OutstandingItem{ 0, 0, 0.0 });
+			requestItem(program);
+		}
+		if (outstandingItems_.empty() && toRequest_.empty()) {
+			if (!gaps_.empty() && !gapPass_) {
+				// One more pass over everything that got lost, so a single dropped message doesn't cost the whole bank
+				spdlog::info("Re-requesting {} programs that were not received", gaps_.size());
+				gapPass_ = true;
+				toRequest_.assign(gaps_.begin(), gaps_.end());
+				gaps_.clear();
+				fillItemWindow();
+			}
+			else {
+				finishItemDownload();
+			}
+		}
+	}
+
+	void DownloadSession::handleNextItemMessage(const juce::MidiMessage& message)
+	{
+		if (outstandingItems_.empty()) return;
+
+		bool isPart = false;
+		bool isComplete = false;
+		int reportedProgram = -1;
+		std::vector<MidiMessage> handshakeReply;
+		if (itemType_ == ItemDownloadType::PROGRAM_DUMPS) {
+			if (auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth_)) {
+				auto handshake = programDumpCapability->isMessagePartOfProgramDump(message);
+				isPart = handshake.isPartOfProgramDump;
+				handshakeReply = handshake.handshakeReply;
+				if (isPart) {
+					currentItemDump_.push_back(message);
+					isComplete = programDumpCapability->isSingleProgramDump(currentItemDump_);
+					if (isComplete) {
+						auto reported = programDumpCapability->getProgramNumber(currentItemDump_);
+						if (reported.isValid()) {
+							reportedProgram = reported.toZeroBasedWithBank();
+						}
+					}
+				}
+			}
+		}
+		else if (auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth_)) {
+			auto handshake = editBufferCapability->isMessagePartOfEditBuffer(message);
+			isPart = handshake.isPartOfEditBufferDump;
+			handshakeReply = handshake.handshakeReply;
+			if (isPart) {
+				currentItemDump_.push_back(message);
+				isComplete = editBufferCapability->isEditBufferDump(currentItemDump_);
+			}
+		}
+		if (!isPart) return;
+
+		// The reply is still coming in. A long dump on a slow link takes longer than the timeout, so nothing in flight should be requested again yet
+		auto deadline = Time::getMillisecondCounter() + kItemTimeoutMs;
+		for (auto& item : outstandingItems_) {
+			item.second.deadline = std::max(item.second.deadline, deadline);
+		}
+
+		// See if we should send a reply (ACK)
+		sendUnlocked(handshakeReply);
+		if (!isComplete) return;
+
+		// A program requested more than once can be answered more than once. The late replies must not be stored under the program requested next
+		if (reportedProgram >= 0 && outstandingItems_.find(reportedProgram) == outstandingItems_.end() && receivedItems_.find(reportedProgram) != receivedItems_.end()) {
+			spdlog::debug("Ignoring another reply for program {}, which was already received", reportedProgram);
+			currentItemDump_.clear();
+			return;
+		}
+		if (reportedProgram < 0 && duplicatesExpected_ > 0 && sameMessages(currentItemDump_, retriedItemDump_)) {
+			spdlog::debug("Ignoring another reply to a program that was requested again");
+			duplicatesExpected_--;
+			currentItemDump_.clear();
+			return;
+		}
+
+		// Put the dump where the synth says it belongs. Without a program number that was asked for, it can only be placed if just one request is in flight
+		int program;
+		if (reportedProgram >= 0 && outstandingItems_.find(reportedProgram) != outstandingItems_.end()) {
+			program = reportedProgram;
+		}
+		else if (outstandingItems_.size() == 1) {
+			program = outstandingItems_.begin()->first;
+		}
+		else {
+			// Guessing would store patches under the wrong program. Drop it, the deadline requests it again, and only ask for one program at a time from now on
+			spdlog::warn("{} answered with a program dump that doesn't match any of the requested programs, continuing with one request at a time", synth_->getName());
+			currentItemDump_.clear();
+			itemWindow_ = 1;
+			return;
+		}
+		auto item = outstandingItems_.find(program);
+		double latencyMs = Time::getMillisecondCounterHiRes() - item->second.requestedMs;
+		itemLatency_.add(latencyMs);
+		MidiController::instance()->telemetry().recordReply(synth_->getName(), latencyMs);
+		if (item->second.retries > 0) {
+			retriedItemDump_ = currentItemDump_;
+			duplicatesExpected_ = item->second.retries;
+		}
+		outstandingItems_.erase(item);
+		// Parse right away, the patch can be shown and stored while the rest of the bank is still coming in. That happens outside the lock,
+		// so the next reply can be taken off the wire meanwhile. The program counts as received already
+		receivedItems_[program] = {};
+		itemParsesPending_++;
+		std::vector<MidiMessage> dump;
+		dump.swap(currentItemDump_);
+		auto synth = synth_;
+		int generation = itemGeneration_;
+		afterUnlock([this, synth, dump, program, generation]() {
+			auto patches = synth->loadSysex(dump);
+			ScopedLock lock(lock_);
+			if (generation != itemGeneration_ || finished_) return;
+			receivedItems_[program] = tagPatches(patches, currentDownloadBank_, program - startDownloadNumber_);
+			reportPatches(receivedItems_[program]);
+			if (--itemParsesPending_ == 0 && itemFinishPending_) {
+				finishItemDownload();
+			}
+			});
+
+		if (progressHandler_ && progressHandler_->shouldAbort()) {
+			cancelItemDownload();
+			return;
+		}
+		if (progressHandler_) progressHandler_->setProgressPercentage(receivedItems_.size() / (double)(endDownloadNumber_ - startDownloadNumber_));
+		fillItemWindow();
+	}
+
+	bool DownloadSession::sameMessages(std::vector<MidiMessage> const& a, std::vector<MidiMessage> const& b)
+	{
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i].getRawDataSize() != b[i].getRawDataSize() || memcmp(a[i].getRawData(), b[i].getRawData(), (size_t)a[i].getRawDataSize()) != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void DownloadSession::checkItemDeadlines()
+	{
+		UnlockedWork unlockedWork{ *this };
+		ScopedLock lock(lock_);
+		if (outstandingItems_.empty()) return;
+		if (progressHandler_ && progressHandler_->shouldAbort()) {
+			cancelItemDownload();
+			return;
+		}
+		auto now = Time::getMillisecondCounter();
+		std::vector<int> expired;
+		for (auto const& item : outstandingItems_) {
+			if (now > item.second.deadline) {
+				expired.push_back(item.first);
+			}
+		}
+		for (int program : expired) {
+			auto& item = outstandingItems_.find(program)->second;
+			itemTimeouts_++;
+			MidiController::instance()->telemetry().recordTimeout(synth_->getName());
+			if (item.retries < kMaxItemRetries) {
+				item.retries++;
+				spdlog::debug("No reply for program {}, requesting again (retry {})", program, item.retries);
+				requestItem(program);
+			}
+			else {
+				outstandingItems_.erase(program);
+				gaps_.insert(program);
+				MidiController::instance()->telemetry().recordGap(synth_->getName());
+			}
+		}
+		if (!expired.empty()) {
+			fillItemWindow();
+		}
+	}
+
+	void DownloadSession::cancelItemDownload()
+	{
+		finished();
+		reportCancel();
+	}
+
+	void DownloadSession::finishItemDownload()
+	{
+		if (itemParsesPending_ > 0) {
+			// The last parse to finish comes back here
+			itemFinishPending_ = true;
+			return;
+		}
+		itemFinishPending_ = false;
+		clearHandlers();
+		if (!gaps_.empty()) {
+			std::string missing;
+			for (int program : gaps_) {
+				missing += (missing.empty() ? "" : ", ") + fmt::format("{}", program);
+			}
+			spdlog::warn("Could not download {} programs from {}, no reply to requests for {}", gaps_.size(), synth_->getName(), missing);
+		}
+		if (MidiController::instance()->telemetry().logDownloadSummaries()) {
+			spdlog::info("Downloaded {} programs from {} in {:.1f} s, reply latency median {:.0f} ms, 95% {:.0f} ms, max {:.0f} ms, {} timeouts, {} not received",
+				itemLatency_.count(), synth_->getName(), (Time::getMillisecondCounterHiRes() - itemStartMs_) / 1000.0, itemLatency_.percentileMs(50),
+				itemLatency_.percentileMs(95), itemLatency_.maxMs(), itemTimeouts_, gaps_.size());
+		}
+		// Assemble the download in program order
+		std::vector<PatchHolder> patches;
+		for (auto& item : receivedItems_) {
+			std::move(item.second.begin(), item.second.end(), std::back_inserter(patches));
+		}
+		receivedItems_.clear();
+		onFinished_(patches);
+		reportSuccess();
+	}
+
+	void DownloadSession::startHandshakeDownload(MidiBankNumber bankNo, std::shared_ptr<HandshakeLoadingCapability> handshake, std::shared_ptr<HandshakeLoadingCapability::ProtocolState> state)
+	{
+		currentDownloadBank_ = bankNo;
+		handshake_ = handshake;
+		handshakeState_ = state;
+		handshakeLastSent_.clear();
+		handshakeRetries_ = 0;
+		handshakeTimeouts_ = 0;
+		handshakeLatency_ = LatencyHistogram();
+		handshakeStartMs_ = Time::getMillisecondCounterHiRes();
+
+		addHandler([](DownloadSession &session, const juce::MidiMessage& message) {
+			session.handleNextHandshakeMessage(message);
+			});
+		if (handshake_->stepTimeoutMilliseconds() > 0) {
+			std::weak_ptr<DownloadSession> weakSession = shared_from_this();
+			itemWatchdog_.onTick = [weakSession]() {
+				if (auto session = weakSession.lock()) {
+					session->checkHandshakeDeadline();
+				}
+			};
+			itemWatchdog_.startTimer(kWatchdogIntervalMs);
+		}
+		armHandshakeStep();
+		MidiController::instance()->telemetry().recordRequest(synth_->getName());
+		startHandshakeUnlocked();
+	}
+
+	void DownloadSession::startHandshakeUnlocked()
+	{
+		auto handshake = handshake_;
+		auto midiOutput = midiOutput_;
+		auto state = handshakeState_;
+		afterUnlock([handshake, midiOutput, state]() {
+			handshake->startDownload(midiOutput, state);
+			});
+	}
+
+	void DownloadSession::armHandshakeStep()
+	{
+		int timeout = handshake_->stepTimeoutMilliseconds();
+		handshakeDeadline_ = timeout > 0 ? Time::getMillisecondCounter() + (uint32)timeout : 0;
+		handshakeStepMs_ = Time::getMillisecondCounterHiRes();
+	}
+
+	void DownloadSession::handleNextHandshakeMessage(const juce::MidiMessage& message)
+	{
+		if (!handshakeState_) return;
+
+		std::vector<MidiMessage> answer;
+		if (handshake_->isNextMessage(message, answer, handshakeState_)) {
+			currentDownload_.push_back(message);
+			// The synth made progress, so this step is done and the next one starts
+			double latencyMs = Time::getMillisecondCounterHiRes() - handshakeStepMs_;
+			handshakeLatency_.add(latencyMs);
+			MidiController::instance()->telemetry().recordReply(synth_->getName(), latencyMs);
+			handshakeRetries_ = 0;
+			armHandshakeStep();
+		}
+		if (!answer.empty()) {
+			// Queued on the output's send thread, so the MIDI input thread is free again for the synth's next message right away
+			handshakeLastSent_ = answer;
+			MidiController::instance()->telemetry().recordRequest(synth_->getName());
+			synth_->enqueueBlockOfMessagesToSynth(midiOutput_->deviceInfo(), answer);
+			armHandshakeStep();
+		}
+		if (progressHandler_) progressHandler_->setProgressPercentage(handshakeState_->progress());
+
+		if (handshakeState_->isFinished() || (progressHandler_ && progressHandler_->shouldAbort())) {
+			finishHandshakeDownload(handshakeState_->wasSuccessful());
+		}
+	}
+
+	void DownloadSession::checkHandshakeDeadline()
+	{
+		UnlockedWork unlockedWork{ *this };
+		ScopedLock lock(lock_);
+		if (!handshakeState_ || handshakeDeadline_ == 0) return;
+		if (progressHandler_ && progressHandler_->shouldAbort()) {
+			finishHandshakeDownload(false);
+			return;
+		}
+		if (Time::getMillisecondCounter() <= handshakeDeadline_) return;
+
+		handshakeTimeouts_++;
+		MidiController::instance()->telemetry().recordTimeout(synth_->getName());
+		if (handshakeRetries_ >= handshake_->maxStepRetries()) {
+			finishHandshakeDownload(false, fmt::format("{} stopped answering, no reply after {} retries", synth_->getName(), handshakeRetries_));
+			return;
+		}
+		handshakeRetries_++;
+		armHandshakeStep();
+		if (!handshakeLastSent_.empty()) {
+			spdlog::debug("No reply from {} to the last handshake message, sending it again (retry {})", synth_->getName(), handshakeRetries_);
+			synth_->enqueueBlockOfMessagesToSynth(midiOutput_->deviceInfo(), handshakeLastSent_);
+		}
+		else if (currentDownload_.empty()) {
+			// Nothing came back at all, so it is the initial request that got lost
+			spdlog::debug("No reply from {} to the download request, sending it again (retry {})", synth_->getName(), handshakeRetries_);
+			startHandshakeUnlocked();
+		}
+		// Else the synth sends on its own without being answered, there is nothing to repeat and it has until the retries are used up
+	}
+
+	void DownloadSession::finishHandshakeDownload(bool successful, std::string const &failure)
+	{
+		clearHandlers();
+		handshakeState_.reset();
+		if (MidiController::instance()->telemetry().logDownloadSummaries()) {
+			spdlog::info("Handshake download from {} took {:.1f} s for {} messages, step latency median {:.0f} ms, 95% {:.0f} ms, max {:.0f} ms, {} timeouts",
+				synth_->getName(), (Time::getMillisecondCounterHiRes() - handshakeStartMs_) / 1000.0, handshakeLatency_.count(), handshakeLatency_.percentileMs(50),
+				handshakeLatency_.percentileMs(95), handshakeLatency_.maxMs(), handshakeTimeouts_);
+		}
+		if (successful) {
+			// Parse patches and send them back
+			auto patches = synth_->loadSysex(currentDownload_);
+			auto tagged = tagPatches(patches, currentDownloadBank_, 0);
+			reportPatches(tagged);
+			onFinished_(tagged);
+			reportSuccess();
+		}
+		else {
+			finished_ = true;
+			if (failure.empty()) {
+				reportCancel();
+			}
+			else {
+				reportFailure(failure);
+			}
+		}
+	}
+
+	void DownloadSession::requestDataItem(int itemNo) {
+		std::vector<MidiMessage> request = sequencer_->requestDataItem(itemNo, dataTypes_[dataTypeIndex_]);
+		// If this is a synth, it has a throttled send method
+		auto synth = dynamic_cast<Synth*>(sequencer_);
+		auto midiOutput = midiOutput_;
+		afterUnlock([synth, midiOutput, request]() {
+			if (synth) {
+				synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), request);
+			}
+			else {
+				// This is not a synth... fall back to old behavior
+				midiOutput->sendBlockOfMessagesFullSpeed(request);
+			}
+			});
+	}
+
+	void DownloadSession::startStreamDownload(StreamLoadCapability::StreamType streamType, int firstElement)
+	{
+		auto pipelining = midikraft::Capability::hasCapability<StreamLoadPipeliningCapability>(synth_);
+		streamAhead_ = pipelining ? std::max(0, pipelining->streamElementsRequestedAhead(streamType)) : 0;
+		auto tracking = midikraft::Capability::hasCapability<StreamTrackingCapability>(synth_);
+		streamTracker_ = tracking ? tracking->createStreamTracker(streamType) : nullptr;
+		streamRequested_ = -1;
+		streamFirstElement_ = firstElement;
+		requestStreamElements(streamType);
+	}
+
+	void DownloadSession::requestStreamElements(StreamLoadCapability::StreamType streamType)
+	{
+		// Keep the element being received and the ones ahead of it requested
+		auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth_);
+		while (streamLoading && streamRequested_ < downloadNumber_ + streamAhead_) {
+			streamRequested_++;
+			auto messages = streamLoading->requestStreamElement(streamRequested_ == 0 ? streamFirstElement_ : streamRequested_, streamType);
+			sendUnlocked(messages);
+		}
+	}
+
+	void DownloadSession::handleNextStreamPart(const juce::MidiMessage& message, StreamLoadCapability::StreamType streamType)
+	{
+		auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth_);
+		if (streamLoading) {
+			if (streamLoading->isMessagePartOfStream(message, streamType)) {
+				currentDownload_.push_back(message);
+				int progressTotal = streamLoading->numberOfStreamMessagesExpected(streamType);
+				if (progressTotal > 0 && progressHandler_) {
+					progressHandler_->setProgressPercentage(currentDownload_.size() / (double)progressTotal);
+				}
+				// A tracker looks at each message once, without one the capability has to look at the whole stream so far
+				int elementsCompleted = 0;
+				bool isComplete;
+				if (streamTracker_) {
+					elementsCompleted = streamTracker_->addMessage(message);
+					isComplete = streamTracker_->isComplete();
+				}
+				else {
+					isComplete = streamLoading->isStreamComplete(currentDownload_, streamType);
+				}
+				if (isComplete) {
+					clearHandlers();
+					streamTracker_.reset();
+					auto result = synth_->loadSysex(currentDownload_);
+					auto tagged = tagPatches(result, currentDownloadBank_, 0);
+					reportPatches(tagged);
+					onFinished_(tagged);
+					reportSuccess();
+				}
+				else if (progressHandler_ && progressHandler_->shouldAbort()) {
+					finished();
+					reportCancel();
+				}
+				else {
+					if (!streamTracker_ && streamLoading->shouldStreamAdvance(currentDownload_, streamType)) {
+						elementsCompleted = 1;
+					}
+					if (elementsCompleted > 0) {
+						downloadNumber_ += elementsCompleted;
+						requestStreamElements(streamType);
+						if (progressTotal == -1 && progressHandler_) progressHandler_->setProgressPercentage(downloadNumber_ / (double)expectedDownloadNumber_);
+					}
+				}
+			}
+		}
+		else {
+			jassertfalse;
+		}
+	}
+
+	void DownloadSession::handleNextBankDump(const juce::MidiMessage& bankDump, MidiBankNumber bankNo)
+	{
+		auto bankDumpCapability = midikraft::Capability::hasCapability<BankDumpCapability>(synth_);
+		if (bankDumpCapability && bankDumpCapability->isBankDump(bankDump)) {
+			currentDownload_.push_back(bankDump);
+			if (bankDumpCapability->isBankDumpFinished(currentDownload_)) {
+				clearHandlers();
+				auto patches = synth_->loadSysex(currentDownload_);
+				auto tagged = tagPatches(patches, bankNo, 0);
+				reportPatches(tagged);
+				onFinished_(tagged);
+				reportSuccess();
+			}
+			else if (progressHandler_ && progressHandler_->shouldAbort()) {
+				finished();
+				reportCancel();
+			}
+			else if (progressHandler_) {
+				progressHandler_->setProgressPercentage(currentDownload_.size() / (double)(expectedDownloadNumber_));
+			}
+		}
+	}
+
+}
@@ -0,0 +1,208 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "MidiController.h"
+#include "Synth.h"
+#include "ProgressHandler.h"
+#include "MidiBankNumber.h"
+#include "PatchHolder.h"
+#include "DataFileLoadCapability.h"
+#include "HandshakeLoadingCapability.h"
+#include "StreamLoadCapability.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <set>
+#include <stack>
+
+namespace midikraft {
+
+	class Librarian;
+
+	// All state of one download from one synth. Sessions on different MIDI outputs are independent, so several synths can be downloaded at the same time.
+	// The MIDI handlers only hold a weak reference, the owner keeps the session alive until it is finished or canceled
+	class DownloadSession : public std::enable_shared_from_this<DownloadSession> {
+	public:
+		typedef std::function<void(std::vector<PatchHolder> const &)> TFinishedHandler;
+		typedef std::function<void(std::vector<std::shared_ptr<DataFile>> const &)> TStepSequencerFinishedHandler;
+		typedef std::function<void(PatchHolder const &)> TPatchReceivedHandler;
+		typedef std::function<void(int dataTypeID, std::vector<std::shared_ptr<DataFile>> const &)> TDataFilesReceivedHandler;
+		typedef std::function<void(std::string const &reason)> TFailedHandler;
+
+		DownloadSession(Librarian &librarian, std::shared_ptr<SafeMidiOutput> midiOutput, ProgressHandler *progressHandler);
+		~DownloadSession();
+
+		// If the synth stops answering, onFailed is called with the reason instead of the progress handler's onCancel, which then only means the user
+		// aborted. Without onFailed the progress handler is canceled as before, so it is closed either way
+		void startBanks(std::shared_ptr<Synth> synth, std::vector<MidiBankNumber> const &banks, TFinishedHandler onFinished, TPatchReceivedHandler onPatchReceived = nullptr,
+			TFailedHandler onFailed = nullptr);
+		void startEditBuffer(std::shared_ptr<Synth> synth, TFinishedHandler onFinished);
+		void startSequencerData(DataFileLoadCapability *sequencer, int dataFileIdentifier, TStepSequencerFinishedHandler onFinished);
+		// The data types one after the other, with up to window items requested ahead. Replies are counted in order, as the capability has no way to tell
+		// which item a message answers. If given, onDataReceived is called from the MIDI thread with the files of each window's worth of items as soon
+		// as they are loaded, onFinished gets all of them at the end
+		void startSequencerData(DataFileLoadCapability *sequencer, std::vector<int> const &dataTypeIDs, int window, TStepSequencerFinishedHandler onFinished,
+			TDataFilesReceivedHandler onDataReceived = nullptr);
+
+		void cancel(); // Silently, without calling any handler
+		bool isFinished() const;
+		juce::MidiDeviceInfo output() const;
+
+	private:
+		// Edit buffer and program dump downloads fetch one item per program, with a deadline per item, bounded retries and a final pass over the gaps
+		enum class ItemDownloadType {
+			EDIT_BUFFERS,
+			EDIT_BUFFERS_WITH_PROGRAM_CHANGE,
+			PROGRAM_DUMPS
+		};
+
+		void startBank(MidiBankNumber bankNo);
+		void bankFinished(std::vector<PatchHolder> const &patchesLoaded);
+		// Sending MIDI and calling back into the owner must not happen under the lock, else the MIDI thread waits on it. Such work is queued
+		// and run by the thread that queued it as soon as it releases the lock. Declare an UnlockedWork before taking the lock to do that
+		struct UnlockedWork {
+			DownloadSession &session;
+			~UnlockedWork() { session.runUnlockedWork(); }
+		};
+		void afterUnlock(std::function<void()> work);
+		void runUnlockedWork();
+		void sendUnlocked(std::vector<MidiMessage> const &messages);
+		void reportSuccess();
+		void reportCancel();
+		void reportFailure(std::string const &reason);
+
+		void bindInput(Synth *synth);
+		void addHandler(std::function<void(DownloadSession &session, MidiMessage const &message)> handler);
+		void clearHandlers();
+		void finished();
+		void sequencerFinished();
+		std::vector<PatchHolder> tagPatches(TPatchVector &patches, MidiBankNumber bankNo, int firstPatchIndex);
+		void reportPatches(std::vector<PatchHolder> const &patches);
+
+		void startItemDownload(MidiBankNumber bankNo, ItemDownloadType type, int window, int startProgram, int endProgram);
+		void requestItem(int program);
+		void fillItemWindow();
+		void handleNextItemMessage(const juce::MidiMessage& message);
+		void checkItemDeadlines();
+		static bool sameMessages(std::vector<MidiMessage> const &a, std::vector<MidiMessage> const &b);
+		void cancelItemDownload();
+		void finishItemDownload();
+
+		// Handshake protocols get a deadline per step, the last message is sent again when the synth goes quiet
+		void startHandshakeDownload(MidiBankNumber bankNo, std::shared_ptr<HandshakeLoadingCapability> handshake, std::shared_ptr<HandshakeLoadingCapability::ProtocolState> state);
+		void startHandshakeUnlocked();
+		void armHandshakeStep();
+		void handleNextHandshakeMessage(const juce::MidiMessage& message);
+		void checkHandshakeDeadline();
+		void finishHandshakeDownload(bool successful, std::string const &failure = ""); // An empty failure is a cancel
+
+		bool startDataType();
+		void requestDataItem(int itemNo);
+		void fillDataWindow();
+		void handleNextDataItem(const juce::MidiMessage& message);
+		void flushDataItems();
+		void startStreamDownload(StreamLoadCapability::StreamType streamType, int firstElement);
+		void requestStreamElements(StreamLoadCapability::StreamType streamType);
+		void handleNextStreamPart(const juce::MidiMessage &message, StreamLoadCapability::StreamType streamType);
+		void handleNextBankDump(const juce::MidiMessage& bankDump, MidiBankNumber bankNo);
+
+		class Watchdog : public Timer {
+		public:
+			std::function<void()> onTick;
+			void timerCallback() override { if (onTick) onTick(); }
+		};
+		struct OutstandingItem {
+			uint32 deadline;
+			int retries;
+			double requestedMs; // When the last request for it was sent, for the reply latency
+		};
+
+		Librarian &librarian_;
+		std::shared_ptr<SafeMidiOutput> midiOutput_;
+		ProgressHandler *progressHandler_;
+		std::shared_ptr<Synth> synth_;
+		juce::String inputIdentifier_; // The input the synth answers on, messages from other inputs are ignored. Empty if not known, then all inputs are heard
+
+		// The MIDI thread, the watchdog timer and the owner all drive the session, so everything below is guarded by the lock
+		CriticalSection lock_;
+		std::vector<std::function<void()>> unlockedWork_;
+		std::stack<MidiController::HandlerHandle> handles_;
+		std::atomic<bool> finished_;
+		std::vector<MidiMessage> currentDownload_;
+		MidiBankNumber currentDownloadBank_;
+		TFinishedHandler onFinished_;
+		int downloadNumber_;
+		int startDownloadNumber_;
+		int endDownloadNumber_;
+		int expectedDownloadNumber_;
+
+		// To download multiple banks
+		std::vector<MidiBankNumber> banks_;
+		size_t bankIndex_;
+		TFinishedHandler onBanksFinished_;
+		TPatchReceivedHandler onPatchReceived_;
+		TFailedHandler onFailed_;
+		Time bankImportTime_;
+		Time bulkImportTime_;
+		std::vector<PatchHolder> downloadedPatches_;
+
+		Watchdog itemWatchdog_;
+		ItemDownloadType itemType_;
+		int itemWindow_; // Requests in flight at the same time
+		std::deque<int> toRequest_;
+		std::map<int, OutstandingItem> outstandingItems_; // Requested but not received yet, by program
+		std::map<int, std::vector<PatchHolder>> receivedItems_; // Parsed as soon as each dump is complete, so the raw messages are not kept
+		std::set<int> gaps_;
+		bool gapPass_;
+		std::vector<MidiMessage> currentItemDump_; // The reply coming in. Which request it answers is only known once it is complete
+		int itemGeneration_; // Counts the item downloads, so a reply parsed outside the lock is dropped if another download has started meanwhile
+		int itemParsesPending_; // Replies taken off the wire but still being parsed
+		bool itemFinishPending_; // All replies are in, finish as soon as the last one is parsed
+		std::vector<MidiMessage> retriedItemDump_; // The reply that completed the last item requested more than once, to recognize late replies to its other requests
+		int duplicatesExpected_; // How many of those late replies can still come
+		LatencyHistogram itemLatency_; // Of this item download only, for the summary at its end
+		int itemTimeouts_;
+		double itemStartMs_;
+
+		// To download a stream, downloadNumber_ is the element being received
+		int streamAhead_; // Elements requested beyond that one
+		int streamRequested_; // The last element requested
+		int streamFirstElement_; // What to request as element 0, the bank number for bank streams
+		std::shared_ptr<StreamTrackingCapability::StreamTracker> streamTracker_; // If the synth can track the stream incrementally
+
+		// To download with a handshake protocol
+		std::shared_ptr<HandshakeLoadingCapability> handshake_;
+		std::shared_ptr<HandshakeLoadingCapability::ProtocolState> handshakeState_; // Only set while the protocol is running
+		std::vector<MidiMessage> handshakeLastSent_; // To repeat after a timeout
+		uint32 handshakeDeadline_; // 0 for no deadline
+		int handshakeRetries_; // Of the current step
+		int handshakeTimeouts_;
+		double handshakeStepMs_; // When the current step started, for its latency
+		double handshakeStartMs_;
+		LatencyHistogram handshakeLatency_;
+
+		// To download sequencer data
+		DataFileLoadCapability *sequencer_;
+		std::vector<int> dataTypes_;
+		size_t dataTypeIndex_;
+		int dataWindow_;
+		int nextDataItem_; // Of the current type, the next one to request
+		int dataItemsReceived_; // Of the current type
+		int dataItemsExpected_; // Of the current type
+		int dataItemsDone_; // Of all types, for the progress
+		int dataItemsTotal_;
+		std::vector<MidiMessage> dataItemBatch_; // Received, but not loaded yet
+		std::vector<std::shared_ptr<DataFile>> loadedData_;
+		TStepSequencerFinishedHandler onSequencerFinished_;
+		TDataFilesReceivedHandler onDataReceived_;
+	};
+
+}
@@ -0,0 +1,52 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "InternedString.h"
+
+#include <mutex>
+#include <unordered_set>
+
+namespace midikraft {
+
+	namespace {
+		// The nodes of an unordered_set never move, so the pointers handed out stay valid for the lifetime of the program
+		std::mutex sPoolLock;
+		std::unordered_set<std::string> &pool() {
+			static std::unordered_set<std::string> sPool;
+			return sPool;
+		}
+	}
+
+	InternedString::InternedString(std::string const &text)
+	{
+		if (!text.empty()) {
+			std::lock_guard<std::mutex> lock(sPoolLock);
+			text_ = &*pool().insert(text).first;
+		}
+	}
+
+	std::string const &InternedString::str() const
+	{
+		static const std::string kEmpty;
+		return text_ ? *text_ : kEmpty;
+	}
+
+	bool InternedString::empty() const
+	{
+		return text_ == nullptr;
+	}
+
+	bool InternedString::operator==(InternedString const &other) const
+	{
+		return text_ == other.text_;
+	}
+
+	bool InternedString::operator!=(InternedString const &other) const
+	{
+		return text_ != other.text_;
+	}
+
+}
@@ -0,0 +1,30 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <string>
+
+namespace midikraft {
+
+	// An immutable string stored once for all its holders, for values that repeat across many patches like the import ID.
+	// Copies and comparisons only look at a pointer. The pool never shrinks, so only use it for values from a bounded set
+	class InternedString {
+	public:
+		InternedString() = default; // The empty string, without going to the pool
+		explicit InternedString(std::string const &text);
+
+		std::string const &str() const;
+		bool empty() const;
+
+		bool operator ==(InternedString const &other) const;
+		bool operator !=(InternedString const &other) const;
+
+	private:
+		std::string const *text_ = nullptr;
+	};
+
+}
@@ -6,6 +6,7 @@
 
 #include "JsonSerialization.h"
 
+#include "Base64Codec.h"
 #include "JsonSchema.h"
 #include "Synth.h"
 
@@ -40,14 +41,13 @@ namespace midikraft {
 	}
 
 	std::string JsonSerialization::dataToString(std::vector<uint8> const &data) {
-		return Base64::toBase64(data.data(), data.size()).toStdString();
+		return Base64Codec::encode(data);
 	}
 
 	std::vector<uint8> JsonSerialization::stringToData(std::string const string)
 	{
-		std::vector<uint8> outBuffer(2048, 0);
-		MemoryOutputStream output(outBuffer.data(), outBuffer.size());
-		if (Base64::convertFromBase64(output, string)) {
+		std::vector<uint8> outBuffer;
+		if (Base64Codec::decode(string, outBuffer)) {
 			return outBuffer;
 		}
 		else {
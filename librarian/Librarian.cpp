@@ -19,12 +19,17 @@
 #include "SendsProgramChangeCapability.h"
 #include "PatchInterchangeFormat.h"
 
-#include "RunWithRetry.h"
 #include "MidiHelpers.h"
 #include "FileHelpers.h"
+#include "ParallelFor.h"
+#include "Tracing.h"
 
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
 #include <set>
 #include "Settings.h"
 #include "SpdLogJuce.h"
@@ -35,30 +40,39 @@ namespace midikraft {
 		clearHandlers();
 	}
 
-	void Librarian::startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, std::vector<MidiBankNumber> bankNo,
-		ProgressHandler* progressHandler, TFinishedHandler onFinished) {
-
-		downloadBankNumber_ = 0;
-		if (!bankNo.empty()) {
-			currentDownloadedPatches_.clear();
-			nextBankHandler_ = [this, midiOutput, synth, progressHandler, bankNo, onFinished](std::vector<midikraft::PatchHolder> patchesLoaded) {
-				std::copy(patchesLoaded.begin(), patchesLoaded.end(), std::back_inserter(currentDownloadedPatches_));
-				downloadBankNumber_++;
-				if (downloadBankNumber_ == static_cast<int>(bankNo.size())) {
-					if (bankNo.size() > 1) {
-						tagPatchesWithMultiBulkImport(currentDownloadedPatches_);
-					}
-					onFinished(currentDownloadedPatches_);
+	std::shared_ptr<DownloadSession> Librarian::startSession(std::shared_ptr<SafeMidiOutput> midiOutput, ProgressHandler* progressHandler)
+	{
+		// One download per MIDI output at a time, a new one replaces whatever was still running there. Downloads on other outputs carry on
+		auto session = std::make_shared<DownloadSession>(*this, midiOutput, progressHandler);
+		std::vector<std::shared_ptr<DownloadSession>> replaced;
+		{
+			ScopedLock lock(sessionLock_);
+			auto identifier = midiOutput->deviceInfo().identifier;
+			for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+				if ((*it)->isFinished()) {
+					it = sessions_.erase(it);
+				}
+				else if ((*it)->output().identifier == identifier) {
+					replaced.push_back(*it);
+					it = sessions_.erase(it);
 				}
 				else {
-					if (!progressHandler->shouldAbort()) {
-						progressHandler->setMessage(fmt::format("Importing {} from {}...", SynthBank::friendlyBankName(synth, bankNo[downloadBankNumber_]), synth->getName()));
-						startDownloadingAllPatches(midiOutput, synth, bankNo[downloadBankNumber_], progressHandler, nextBankHandler_);
-					}
+					++it;
 				}
-			};
-			progressHandler->setMessage(fmt::format("Importing {} from {}...", SynthBank::friendlyBankName(synth, bankNo[0]), synth->getName()));
-			startDownloadingAllPatches(midiOutput, synth, bankNo[0], progressHandler, nextBankHandler_);
+			}
+			sessions_.push_back(session);
+		}
+		// Outside of the list lock, as a session might be calling back into the Librarian right now
+		for (auto& old : replaced) {
+			old->cancel();
+		}
+		return session;
+	}
+
+	void Librarian::startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, std::vector<MidiBankNumber> bankNo,
+		ProgressHandler* progressHandler, TFinishedHandler onFinished, TPatchReceivedHandler onPatchReceived, TFailedHandler onFailed) {
+		if (!bankNo.empty()) {
+			startSession(midiOutput, progressHandler)->startBanks(synth, bankNo, onFinished, onPatchReceived, onFailed);
 		}
 	}
 
@@ -92,245 +106,30 @@ namespace midikraft {
 	}
 
 	void Librarian::startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, MidiBankNumber bankNo,
-		ProgressHandler* progressHandler, TFinishedHandler onFinished)
+		ProgressHandler* progressHandler, TFinishedHandler onFinished, TPatchReceivedHandler onPatchReceived, TFailedHandler onFailed)
 	{
-		// First things first - this should not be called more than once at a time, and there should be no other Librarian callback handlers be registered!
-		jassert(handles_.empty());
-		clearHandlers();
-
-		// Ok, for this we need to send a program change message, and then a request edit buffer message from the active synth
-		// Once we get that, store the patch and increment number by one
-		downloadNumber_ = 0;
-		currentDownload_.clear();
-		onFinished_ = onFinished;
-
-		// Determine what we will do with the answer...
-		auto handle = MidiController::makeOneHandle();
-
-		switch (determineBankDownloadMethod(synth)) {
-		case BankDownloadMethod::STREAMING: {
-			auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth);
-			// Simple enough, we hope
-			MidiController::instance()->addMessageHandler(handle, [this, synth, progressHandler, midiOutput](MidiInput* source, const juce::MidiMessage& editBuffer) {
-				ignoreUnused(source);
-				this->handleNextStreamPart(midiOutput, synth, progressHandler, editBuffer, StreamLoadCapability::StreamType::BANK_DUMP);
-				});
-			handles_.push(handle);
-			currentDownloadBank_ = bankNo;
-			expectedDownloadNumber_ = SynthBank::numberOfPatchesInBank(synth, bankNo);
-			if (expectedDownloadNumber_ > 0) {
-				auto messages = streamLoading->requestStreamElement(bankNo.toZeroBased(), StreamLoadCapability::StreamType::BANK_DUMP);
-				synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), messages);
-			}
-		}
-			break;
-		case BankDownloadMethod::HANDSHAKES: {
-			auto handshakeLoadingRequired = midikraft::Capability::hasCapability<HandshakeLoadingCapability>(synth);
-			// These are proper protocols that are implemented - each message we get from the synth has to be answered by an appropriate next message
-			std::shared_ptr<HandshakeLoadingCapability::ProtocolState>  state = handshakeLoadingRequired->createStateObject();
-			if (state) {
-				MidiController::instance()->addMessageHandler(handle, [this, handshakeLoadingRequired, state, progressHandler, midiOutput, synth, bankNo](MidiInput* source, const juce::MidiMessage& protocolMessage) {
-					ignoreUnused(source);
-					std::vector<MidiMessage> answer;
-					if (handshakeLoadingRequired->isNextMessage(protocolMessage, answer, state)) {
-						// Store message
-						currentDownload_.push_back(protocolMessage);
-					}
-					// Send an answer if the handshake handler constructed one
-					if (!answer.empty()) {
-						synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), answer);
-					}
-					// Update progress handler
-					progressHandler->setProgressPercentage(state->progress());
-
-					// Stop handler when finished
-					if (state->isFinished() || progressHandler->shouldAbort()) {
-						clearHandlers();
-						if (state->wasSuccessful()) {
-							// Parse patches and send them back 
-							auto patches = synth->loadSysex(currentDownload_);
-							onFinished_(tagPatchesWithImportFromSynth(synth, patches, bankNo));
-							progressHandler->onSuccess();
-						}
-						else {
-							progressHandler->onCancel();
-						}
-					}
-					});
-				handles_.push(handle);
-				handshakeLoadingRequired->startDownload(midiOutput, state);
-			}
-			else {
-				jassert(false);
-			}
-			break;
-		}
-		case BankDownloadMethod::BANKS: {
-			auto bankCapableSynth = midikraft::Capability::hasCapability<BankDumpRequestCapability>(synth);
-			// This is a mixture - you send one message (bank request), and then you get either one message back (like Kawai K3) or a stream of messages with
-			// one message per patch (e.g. Access Virus or Matrix1000)
-			auto buffer = bankCapableSynth->requestBankDump(bankNo);
-			auto outname = midiOutput->deviceInfo();
-			RunWithRetry::start([this, synth, outname, buffer, bankNo]() {
-				expectedDownloadNumber_ = SynthBank::numberOfPatchesInBank(synth, bankNo);
-				synth->sendBlockOfMessagesToSynth(outname, buffer);
-				},
-				[this]() {
-					return currentDownload_.empty();
-				},
-					3,
-					500,
-					"initiating bank dump");
-
-			MidiController::instance()->addMessageHandler(handle, [this, synth, progressHandler, midiOutput, bankNo](MidiInput* source, const juce::MidiMessage& editBuffer) {
-				ignoreUnused(source);
-				this->handleNextBankDump(midiOutput, synth, progressHandler, editBuffer, bankNo);
-				});
-			handles_.push(handle);
-			currentDownload_.clear();
-			break;
-		}
-		case BankDownloadMethod::PROGRAM_BUFFERS: {
-			// Uh, stone age, need to start a loop
-			auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
-			if (programDumpCapability) {
-				MidiController::instance()->addMessageHandler(handle, [this, synth, progressHandler, midiOutput, bankNo](MidiInput* source, const juce::MidiMessage& editBuffer) {
-					ignoreUnused(source);
-					this->handleNextProgramBuffer(midiOutput, synth, progressHandler, editBuffer, bankNo);
-					});
-				handles_.push(handle);
-				downloadNumber_ = SynthBank::startIndexInBank(synth, bankNo);
-				startDownloadNumber_ = downloadNumber_;
-				endDownloadNumber_ = downloadNumber_ + SynthBank::numberOfPatchesInBank(synth, bankNo);
-				startDownloadNextPatch(midiOutput, synth);
-			}
-			break;
-		}
-		case BankDownloadMethod::EDIT_BUFFERS: {
-			// Uh, stone age, need to start a loop
-			auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth);
-			if (editBufferCapability) {
-				MidiController::instance()->addMessageHandler(handle, [this, synth, progressHandler, midiOutput, bankNo](MidiInput* source, const juce::MidiMessage& editBuffer) {
-					ignoreUnused(source);
-					this->handleNextEditBuffer(midiOutput, synth, progressHandler, editBuffer, bankNo);
-					});
-				handles_.push(handle);
-				downloadNumber_ = SynthBank::startIndexInBank(synth, bankNo);
-				startDownloadNumber_ = downloadNumber_;
-				endDownloadNumber_ = downloadNumber_ + SynthBank::numberOfPatchesInBank(synth, bankNo);
-				startDownloadNextEditBuffer(midiOutput, synth, true);
-			}
-			break;
-		}
-		default:
-			spdlog::error("Error: This synth has not implemented a single method to retrieve a bank. Please consult the documentation!");
-		}
+		startSession(midiOutput, progressHandler)->startBanks(synth, { bankNo }, onFinished, onPatchReceived, onFailed);
 	}
 
 	void Librarian::downloadEditBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, TFinishedHandler onFinished)
 	{
-		// First things first - this should not be called more than once at a time, and there should be no other Librarian callback handlers be registered!
-		jassert(handles_.empty());
-		clearHandlers();
-
-		// Ok, for this we need to send a program change message, and then a request edit buffer message from the active synth
-		// Once we get that, store the patch and increment number by one
-		downloadNumber_ = 0;
-		currentDownload_.clear();
-		onFinished_ = onFinished;
-		auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth);
-		auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth);
-		auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
-		auto programChangeCapability = midikraft::Capability::hasCapability<SendsProgramChangeCapability>(synth);
-		auto handle = MidiController::makeOneHandle();
-		if (streamLoading) {
-			// Simple enough, we hope
-			MidiController::instance()->addMessageHandler(handle, [this, synth, progressHandler, midiOutput](MidiInput* source, const juce::MidiMessage& editBuffer) {
-				ignoreUnused(source);
-				this->handleNextStreamPart(midiOutput, synth, progressHandler, editBuffer, StreamLoadCapability::StreamType::EDIT_BUFFER_DUMP);
-				});
-			handles_.push(handle);
-			currentDownload_.clear();
-			auto messages = streamLoading->requestStreamElement(0, StreamLoadCapability::StreamType::EDIT_BUFFER_DUMP);
-			synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), messages);
-		}
-		else if (editBufferCapability) {
-			MidiController::instance()->addMessageHandler(handle, [this, synth, progressHandler, midiOutput](MidiInput* source, const juce::MidiMessage& editBuffer) {
-				ignoreUnused(source);
-				this->handleNextEditBuffer(midiOutput, synth, progressHandler, editBuffer, MidiBankNumber::fromZeroBase(0, SynthBank::numberOfPatchesInBank(synth, 0)));
-				});
-			handles_.push(handle);
-			// Special case - load only a single patch. In this case we're interested in the edit buffer only!
-			startDownloadNumber_ = 0;
-			endDownloadNumber_ = 1;
-			startDownloadNextEditBuffer(midiOutput, synth, false); // No program change required, we want exactly one edit buffer, the current one
-		}
-		else if (programDumpCapability && programChangeCapability) {
-			auto messages = programDumpCapability->requestPatch(programChangeCapability->lastProgramChange().toZeroBasedWithBank());
-			synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), messages);
-		}
-		else {
-			spdlog::error("The {} has no way to request the edit buffer or program place", synth->getName());
-		}
+		startSession(midiOutput, progressHandler)->startEditBuffer(synth, onFinished);
 	}
 
 	void Librarian::startDownloadingSequencerData(std::shared_ptr<SafeMidiOutput> midiOutput, DataFileLoadCapability* sequencer, int dataFileIdentifier, ProgressHandler* progressHandler, TStepSequencerFinishedHandler onFinished)
 	{
-		// First things first - this should not be called more than once at a time, and there should be no other Librarian callback handlers be registered!
-		jassert(handles_.empty());
-		clearHandlers();
+		startSession(midiOutput, progressHandler)->startSequencerData(sequencer, dataFileIdentifier, onFinished);
+	}
 
-		downloadNumber_ = 0;
-		currentDownload_.clear();
-		onSequencerFinished_ = onFinished;
-
-		auto handle = MidiController::makeOneHandle(); 
-		MidiController::instance()->addMessageHandler(handle, [this, sequencer, progressHandler, midiOutput, dataFileIdentifier](MidiInput* source, const MidiMessage& message) {
-			ignoreUnused(source);
-			if (sequencer->isDataFile(message, dataFileIdentifier)) {
-				currentDownload_.push_back(message);
-				downloadNumber_++;
-				if (downloadNumber_ >= sequencer->numberOfDataItemsPerType(dataFileIdentifier)) {
-					auto loadedData = sequencer->loadData(currentDownload_, dataFileIdentifier);
-					clearHandlers();
-					onSequencerFinished_(loadedData);
-					if (progressHandler) progressHandler->onSuccess();
-				}
-				else if (progressHandler->shouldAbort()) {
-					clearHandlers();
-					if (progressHandler) progressHandler->onCancel();
-				}
-				else {
-					startDownloadNextDataItem(midiOutput, sequencer, dataFileIdentifier);
-					if (progressHandler) progressHandler->setProgressPercentage(downloadNumber_ / (double)sequencer->numberOfDataItemsPerType(dataFileIdentifier));
-				}
-			}
-			});
-		handles_.push(handle);
-		startDownloadNextDataItem(midiOutput, sequencer, dataFileIdentifier);
+	void Librarian::startDownloadingSequencerData(std::shared_ptr<SafeMidiOutput> midiOutput, DataFileLoadCapability* sequencer, std::vector<int> const& dataFileIdentifiers, int window,
+		ProgressHandler* progressHandler, TStepSequencerFinishedHandler onFinished, TDataFilesReceivedHandler onDataReceived)
+	{
+		startSession(midiOutput, progressHandler)->startSequencerData(sequencer, dataFileIdentifiers, window, onFinished, onDataReceived);
 	}
 
 	Synth* Librarian::sniffSynth(std::vector<MidiMessage> const& messages) const
 	{
-		std::set<Synth*> result;
-		for (auto message : messages) {
-			for (auto synth : synths_) {
-				if (synth.synth() && synth.synth()->isOwnSysex(message)) {
-					result.insert(synth.synth().get());
-				}
-			}
-		}
-		if (result.size() > 1) {
-			// oh oh
-			jassert(false);
-			return *result.begin();
-		}
-		else if (result.size() == 1) {
-			return *result.begin();
-		}
-		else {
-			return nullptr;
-		}
+		return sniffer_.sniff(messages).get();
 	}
 
 	class LoadManyPatchFiles : public ThreadWithProgressWindow {
@@ -341,17 +140,36 @@ namespace midikraft {
 		}
 
 		void run() {
+			// The files are loaded in parallel, the results are merged in file order afterwards
 			int filesDiscovered = files_.size();
-			int filesDone = 0;
-			for (auto fileChosen : files_) {
-				if (threadShouldExit()) {
-					return;
+			std::vector<std::vector<PatchHolder>> perFile((size_t)filesDiscovered);
+			std::atomic<int> filesDone(0);
+			// Loading fingerprints the patches. If the synth can't do that concurrently, all files go into one batch and are loaded one after the other
+			size_t batchSize = librarian_->canLoadConcurrently(synth_) ? 1 : (size_t)filesDiscovered;
+			ParallelFor loading((size_t)filesDiscovered, [&](size_t index) {
+				auto fileChosen = files_[(int)index];
+				auto pathChosen = fileChosen.getFullPathName().toStdString();
+				try {
+					perFile[index] = librarian_->loadSysexPatchesFromDisk(synth_, pathChosen, fileChosen.getFileName().toStdString(), automaticCategories_);
 				}
+				catch (std::exception& e) {
+					spdlog::error("Failed to load patches from {}: {}", pathChosen, e.what());
+				}
+				filesDone++;
+			}, batchSize);
+			while (!loading.isFinished() && !threadShouldExit()) {
 				setProgress(filesDone / (double)filesDiscovered);
-				auto pathChosen = fileChosen.getFullPathName().toStdString();
-				auto newPatches = librarian_->loadSysexPatchesFromDisk(synth_, pathChosen, fileChosen.getFileName().toStdString(), automaticCategories_);
+				setStatusMessage(fmt::format("Loaded {} of {} files", filesDone.load(), filesDiscovered));
+				wait(50);
+			}
+			loading.stop();
+			loading.join();
+			if (threadShouldExit()) {
+				return;
+			}
+
+			for (auto const& newPatches : perFile) {
 				std::copy(newPatches.begin(), newPatches.end(), std::back_inserter(result_));
-				filesDone++;
 			}
 		}
 
@@ -376,18 +194,22 @@ namespace midikraft {
 		}
 	}
 
-	std::vector<PatchHolder> Librarian::loadSysexPatchesFromDisk(std::shared_ptr<Synth> synth, std::shared_ptr<AutomaticCategory> automaticCategories)
+	std::string Librarian::supportedFileExtensions(std::shared_ptr<Synth> synth)
 	{
-		updateLastPath(lastPath_, "lastImportPath");
-
 		std::string standardFileExtensions = "*.syx;*.mid;*.zip;*.txt;*.json";
 		auto legacyLoader = midikraft::Capability::hasCapability<LegacyLoaderCapability>(synth);
 		if (legacyLoader) {
 			standardFileExtensions += ";" + legacyLoader->additionalFileExtensions();
 		}
+		return standardFileExtensions;
+	}
+
+	std::vector<PatchHolder> Librarian::loadSysexPatchesFromDisk(std::shared_ptr<Synth> synth, std::shared_ptr<AutomaticCategory> automaticCategories)
+	{
+		updateLastPath(lastPath_, "lastImportPath");
 
 		FileChooser sysexChooser("Please select the sysex or other patch file you want to load...",
-			File(lastPath_), standardFileExtensions);
+			File(lastPath_), supportedFileExtensions(synth));
 		if (sysexChooser.browseForMultipleFilesToOpen())
 		{
 			if (sysexChooser.getResults().size() > 0) {
@@ -395,57 +217,124 @@ namespace midikraft {
 				lastPath_ = sysexChooser.getResults()[0].getParentDirectory().getFullPathName().toStdString();
 				Settings::instance().set("lastImportPath", lastPath_);
 			}
+			return loadPatchFiles(synth, sysexChooser.getResults(), automaticCategories);
+		}
+		// Nothing loaded
+		return std::vector<PatchHolder>();
+	}
 
-			LoadManyPatchFiles backgroundTask(this, synth, sysexChooser.getResults(), automaticCategories);
-			if (backgroundTask.runThread()) {
-				auto result = backgroundTask.result();
-				// If this was more than one file, replace the source info with a bulk info source
-				Time current = Time::getCurrentTime();
-				if (sysexChooser.getResults().size() > 1) {
-					for (auto& holder : result) {
-						auto newSourceInfo = std::make_shared<FromBulkImportSource>(current, holder.sourceInfo());
-						holder.setSourceInfo(newSourceInfo);
-					}
+	std::vector<PatchHolder> Librarian::loadSysexPatchesFromDirectory(std::shared_ptr<Synth> synth, File const& directory, std::shared_ptr<AutomaticCategory> automaticCategories, TFileFilter filter)
+	{
+		Array<File> files;
+		int skipped = 0;
+		for (auto const& file : directory.findChildFiles(File::findFiles, true, supportedFileExtensions(synth))) {
+			if (!filter || filter(file)) {
+				files.add(file);
+			}
+			else {
+				skipped++;
+			}
+		}
+		if (skipped > 0) {
+			spdlog::info("Skipping {} files in {} that have not changed since they were last imported", skipped, directory.getFullPathName());
+		}
+		if (files.isEmpty()) {
+			return std::vector<PatchHolder>();
+		}
+		return loadPatchFiles(synth, files, automaticCategories);
+	}
+
+	std::vector<PatchHolder> Librarian::loadPatchFiles(std::shared_ptr<Synth> synth, Array<File> const& files, std::shared_ptr<AutomaticCategory> automaticCategories)
+	{
+		LoadManyPatchFiles backgroundTask(this, synth, files, automaticCategories);
+		if (backgroundTask.runThread()) {
+			auto result = backgroundTask.result();
+			// If this was more than one file, replace the source info with a bulk info source
+			Time current = Time::getCurrentTime();
+			if (files.size() > 1) {
+				for (auto& holder : result) {
+					auto newSourceInfo = std::make_shared<FromBulkImportSource>(current, holder.sourceInfo());
+					holder.setSourceInfo(newSourceInfo);
 				}
-				return result;
 			}
+			return result;
 		}
-		// Nothing loaded
 		return std::vector<PatchHolder>();
 	}
 
+	// Splits raw MIDI bytes into messages in place, e.g. straight out of a memory mapped file. Same rules as reading a sysex file, running status included
+	static std::vector<MidiMessage> messagesFromMemory(uint8 const* data, size_t size) {
+		std::vector<MidiMessage> result;
+		uint8 lastStatusByte = 0;
+		size_t position = 0;
+		while (position < size) {
+			if (data[position] < 0x80 && lastStatusByte == 0) {
+				// Garbage before the first status byte
+				position++;
+				continue;
+			}
+			int bytesUsed = 0;
+			int available = (int)std::min(size - position, (size_t)std::numeric_limits<int>::max());
+			MidiMessage message(data + position, available, bytesUsed, lastStatusByte, 0.0, false);
+			if (bytesUsed <= 0) {
+				break;
+			}
+			if (message.getRawDataSize() > 0) {
+				lastStatusByte = message.getRawData()[0];
+				result.push_back(message);
+			}
+			position += (size_t)bytesUsed;
+		}
+		return result;
+	}
+
 	std::vector<PatchHolder> Librarian::loadSysexPatchesFromDisk(std::shared_ptr<Synth> synth, std::string const& fullpath, std::string const& filename, std::shared_ptr<AutomaticCategory> automaticCategories) {
+		TraceSpan span("Librarian::loadSysexPatchesFromDisk", [&filename]() { return filename; });
 		auto legacyLoader = midikraft::Capability::hasCapability<LegacyLoaderCapability>(synth);
 		TPatchVector patches;
+		std::vector<MidiMessage> messagesLoaded;
+		File file = File::createFileWithoutCheckingPath(fullpath);
 		if (legacyLoader && legacyLoader->supportsExtension(fullpath)) {
-			File legacyFile = File::createFileWithoutCheckingPath(fullpath);
-			if (legacyFile.existsAsFile()) {
-				FileInputStream inputStream(legacyFile);
-				std::vector<uint8> data((size_t)inputStream.getTotalLength());
-				inputStream.read(&data[0], (int)inputStream.getTotalLength()); // 4 GB Limit
-				patches = legacyLoader->load(fullpath, data);
+			if (file.existsAsFile()) {
+				// Map the file instead of reading it, large archives with samples don't need a transient copy of their own size
+				MemoryMappedFile mapped(file, MemoryMappedFile::readOnly);
+				if (mapped.getData() != nullptr) {
+					patches = legacyLoader->loadFromMemory(fullpath, static_cast<uint8 const*>(mapped.getData()), mapped.getSize());
+				}
+				else {
+					FileInputStream inputStream(file);
+					std::vector<uint8> data((size_t)inputStream.getTotalLength());
+					if (!data.empty()) {
+						inputStream.read(data.data(), (int)data.size());
+					}
+					patches = legacyLoader->load(fullpath, data);
+				}
 			}
 		}
+		else if (file.hasFileExtension(".syx") && file.existsAsFile()) {
+			MemoryMappedFile mapped(file, MemoryMappedFile::readOnly);
+			messagesLoaded = mapped.getData() != nullptr ? messagesFromMemory(static_cast<uint8 const*>(mapped.getData()), mapped.getSize()) : Sysex::loadSysex(fullpath);
+			if (synth) {
+				patches = synth->loadSysex(messagesLoaded);
+			}
+		}
+		else if (file.hasFileExtension(".zip") && file.existsAsFile()) {
+			return loadPatchesFromZip(synth, file, automaticCategories);
+		}
 		else if (File(fullpath).getFileExtension() == ".json") {
 			std::map<std::string, std::shared_ptr<Synth>> synths;
 			synths[synth->getName()] = synth;
 			return PatchInterchangeFormat::load(synths, fullpath, automaticCategories);
 		}
 		else {
-			auto messagesLoaded = Sysex::loadSysex(fullpath);
+			messagesLoaded = Sysex::loadSysex(fullpath);
 			if (synth) {
 				patches = synth->loadSysex(messagesLoaded);
 			}
 		}
 
-		if (patches.empty()) {
-			// Bugger - probably the file is for some synth that is correctly not the active one... happens frequently for me
-			// Let's try to sniff the synth from the magics given and then try to reload the file with the correct synth
-			//auto detectedSynth = sniffSynth(messagesLoaded);
-			//if (detectedSynth) {
-				// That's better, now try again
-				//patches = detectedSynth->loadSysex(messagesLoaded);
-			//}
+		if (patches.empty() && !messagesLoaded.empty()) {
+			patches = loadWithSniffedSynth(synth, messagesLoaded, filename);
 		}
 
 		return createPatchHoldersFromPatchList(synth, patches, MidiBankNumber::invalid(), [fullpath, filename](MidiBankNumber bankNo, MidiProgramNumber programNo) {
@@ -454,13 +343,133 @@ namespace midikraft {
 			}, automaticCategories);
 	}
 
-	std::vector<PatchHolder> Librarian::createPatchHoldersFromPatchList(std::shared_ptr<Synth> synth, TPatchVector const& patches, MidiBankNumber bankNo, std::function<std::shared_ptr<SourceInfo>(MidiBankNumber, MidiProgramNumber)> generateSourceinfo, std::shared_ptr<AutomaticCategory> automaticCategories)
+	TPatchVector Librarian::loadWithSniffedSynth(std::shared_ptr<Synth>& synth, std::vector<MidiMessage> const& messages, std::string const& filename)
+	{
+		// Bugger - probably the file is for some synth that is correctly not the active one... happens frequently for me
+		// Let's try to sniff the synth from the magics given and then try to reload the file with the correct synth
+		TPatchVector patches;
+		auto detectedSynth = sniffer_.sniff(messages);
+		if (detectedSynth && detectedSynth != synth) {
+			// That's better, now try again
+			patches = detectedSynth->loadSysex(messages);
+			if (!patches.empty()) {
+				spdlog::info("File {} is for the {}, loaded {} patches for it", filename, detectedSynth->getName(), patches.size());
+				synth = detectedSynth;
+			}
+		}
+		return patches;
+	}
+
+	bool Librarian::canLoadConcurrently(std::shared_ptr<Synth> synth)
+	{
+		if (synth && !synth->canCalculateFingerprintsConcurrently()) {
+			return false;
+		}
+		for (auto& holder : synths_) {
+			auto other = holder.synth();
+			if (other && !other->canCalculateFingerprintsConcurrently()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::vector<PatchHolder> Librarian::loadPatchesFromZip(std::shared_ptr<Synth> synth, File const& zipFile, std::shared_ptr<AutomaticCategory> automaticCategories)
+	{
+		TraceSpan span("Librarian::loadPatchesFromZip", [&zipFile]() { return zipFile.getFileName().toStdString(); });
+		// Opened from the file, so every entry stream reads through its own file handle and the entries can be decompressed in parallel
+		ZipFile zip(zipFile);
+		int numEntries = zip.getNumEntries();
+		if (numEntries <= 0) {
+			spdlog::warn("Zip file {} contains no entries or could not be read", zipFile.getFullPathName());
+			return {};
+		}
+		auto legacyLoader = midikraft::Capability::hasCapability<LegacyLoaderCapability>(synth);
+		auto fullpath = zipFile.getFullPathName().toStdString();
+
+		std::vector<std::vector<PatchHolder>> perEntry((size_t)numEntries);
+		// Parsing fingerprints the patches, so a synth that can't do that concurrently gets all entries in one batch
+		size_t batchSize = canLoadConcurrently(synth) ? 1 : (size_t)numEntries;
+		ParallelFor::run((size_t)numEntries, [&](size_t index) {
+			auto entry = zip.getEntry((int)index);
+			if (entry == nullptr || entry->filename.endsWithChar('/') || entry->uncompressedSize <= 0) {
+				return;
+			}
+			auto entryName = entry->filename.toStdString();
+			auto extension = File::createFileWithoutCheckingPath(entry->filename).getFileExtension().toLowerCase();
+			bool isLegacy = legacyLoader && legacyLoader->supportsExtension(entryName);
+			if (!isLegacy && extension != ".syx" && extension != ".mid") {
+				// Readme files and the like
+				return;
+			}
+			try {
+				std::unique_ptr<InputStream> stream(zip.createStreamForEntry((int)index));
+				if (!stream) {
+					spdlog::error("Could not read entry {} of zip file {}", entryName, fullpath);
+					return;
+				}
+				MemoryBlock data;
+				stream->readIntoMemoryBlock(data);
+
+				auto entrySynth = synth;
+				TPatchVector patches;
+				if (isLegacy) {
+					patches = legacyLoader->loadFromMemory(entryName, static_cast<uint8 const*>(data.getData()), data.getSize());
+				}
+				else {
+					std::vector<MidiMessage> messages;
+					if (extension == ".mid") {
+						MemoryInputStream midiStream(data, false);
+						MidiFile midiFile;
+						if (midiFile.readFrom(midiStream)) {
+							for (int track = 0; track < midiFile.getNumTracks(); track++) {
+								auto sequence = midiFile.getTrack(track);
+								for (int event = 0; event < sequence->getNumEvents(); event++) {
+									auto const& message = sequence->getEventPointer(event)->message;
+									if (message.isSysEx()) {
+										messages.push_back(message);
+									}
+								}
+							}
+						}
+					}
+					else {
+						messages = messagesFromMemory(static_cast<uint8 const*>(data.getData()), data.getSize());
+					}
+					if (synth) {
+						patches = synth->loadSysex(messages);
+					}
+					if (patches.empty() && !messages.empty()) {
+						patches = loadWithSniffedSynth(entrySynth, messages, entryName);
+					}
+				}
+				auto entryFilename = File::createFileWithoutCheckingPath(entry->filename).getFileName().toStdString();
+				perEntry[index] = createPatchHoldersFromPatchList(entrySynth, patches, MidiBankNumber::invalid(), [entryFilename, fullpath](MidiBankNumber bankNo, MidiProgramNumber programNo) {
+					ignoreUnused(bankNo);
+					return std::make_shared<FromFileSource>(entryFilename, fullpath, programNo);
+					}, automaticCategories);
+			}
+			catch (std::exception& e) {
+				spdlog::error("Failed to load patches from entry {} of zip file {}: {}", entryName, fullpath, e.what());
+			}
+		}, batchSize);
+
+		std::vector<PatchHolder> result;
+		for (auto const& newPatches : perEntry) {
+			std::copy(newPatches.begin(), newPatches.end(), std::back_inserter(result));
+		}
+		spdlog::debug("Loaded {} patches from {} entries of zip file {}", result.size(), numEntries, fullpath);
+		return result;
+	}
+
+	std::vector<PatchHolder> Librarian::createPatchHoldersFromPatchList(std::shared_ptr<Synth> synth, TPatchVector const& patches, MidiBankNumber bankNo, std::function<std::shared_ptr<SourceInfo>(MidiBankNumber, MidiProgramNumber)> generateSourceinfo, std::shared_ptr<AutomaticCategory> automaticCategories, int firstPatchIndex)
 	{
+		TraceSpan span("Librarian::createPatchHoldersFromPatchList", [&patches]() { return fmt::format("{} patches", patches.size()); });
 		// Add the meta information
 		std::vector<PatchHolder> result;
 		int i = 0;
 		for (auto const& patch : patches) {
-			auto runningPatchNumber = MidiProgramNumber::fromZeroBaseWithBank(bankNo, i);
+			auto runningPatchNumber = MidiProgramNumber::fromZeroBaseWithBank(bankNo, firstPatchIndex + i);
 			auto sourceInfo = generateSourceinfo(bankNo, runningPatchNumber);
 			auto patchHolder = PatchHolder(synth, sourceInfo, patch, automaticCategories);
 
@@ -503,6 +512,32 @@ namespace midikraft {
 	}
 
 	void Librarian::sendBankToSynth(SynthBank const& synthBank, bool fullBank, ProgressHandler* progressHandler, std::function<void(bool completed)> finishedHandler)
+	{
+		std::set<int> positions;
+		int bankSize = (int)synthBank.patches().size();
+		for (int i = 0; i < bankSize; i++) {
+			if (fullBank || synthBank.isPositionDirty(i)) {
+				positions.insert(i);
+			}
+		}
+		sendPositionsToSynth(synthBank, positions, progressHandler, finishedHandler);
+	}
+
+	void Librarian::sendBankToSynth(SynthBank const& synthBank, std::vector<std::string> const& syncedFingerprints, ProgressHandler* progressHandler, std::function<void(bool completed)> finishedHandler)
+	{
+		// The bank keeps the fingerprints of its patches, so nothing needs to be hashed here
+		std::set<int> positions;
+		int bankSize = (int)synthBank.patches().size();
+		for (int i = 0; i < bankSize; i++) {
+			if (i >= (int)syncedFingerprints.size() || syncedFingerprints[i] != synthBank.fingerprintAt(i)) {
+				positions.insert(i);
+			}
+		}
+		spdlog::debug("{} of {} programs differ from the synth's last synced state", positions.size(), bankSize);
+		sendPositionsToSynth(synthBank, positions, progressHandler, finishedHandler);
+	}
+
+	void Librarian::sendPositionsToSynth(SynthBank const& synthBank, std::set<int> const& positions, ProgressHandler* progressHandler, std::function<void(bool completed)> finishedHandler)
 	{
 		auto synth = synthBank.synth();
 		if (!synth) {
@@ -510,16 +545,49 @@ namespace midikraft {
 		}
 
 		auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
-		if (programDumpCapability) {
-			// Count how many to send first
-			int count = 0;
-			int i = 0;
-			for (auto const& patch : synthBank.patches()) {
-				ignoreUnused(patch);
-				if (fullBank || synthBank.isPositionDirty(i++)) {
-					count++;
+		auto bankSendCapability = midikraft::Capability::hasCapability<BankSendCapability>(synth);
+		auto const &patches = synthBank.patches();
+		int bankSize = SynthBank::numberOfPatchesInBank(synth, synthBank.bankNumber());
+		bool wholeBank = !positions.empty() && (int)positions.size() == bankSize && (int)patches.size() == bankSize;
+		if (bankSendCapability && (wholeBank || !programDumpCapability)) {
+			// One bulk transfer instead of a program dump per patch. If the synth can do both, only worth it if the whole bank goes anyway
+			auto location = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth);
+			if (!location || !location->channel().isValid()) {
+				spdlog::warn("Synth {} is currently not detected, please turn on and re-run connectivity check", synth->getName());
+				return;
+			}
+			if (positions.empty()) {
+				if (finishedHandler) {
+					finishedHandler(true);
+				}
+				return;
+			}
+			TPatchVector data;
+			for (auto const& patch : patches) {
+				data.push_back(patch.patch());
+			}
+			auto messages = bankSendCapability->createBankMessages(synthBank.bankNumber(), data);
+			if (messages.empty()) {
+				spdlog::error("The {} could not create a bank dump for {}", synth->getName(), synthBank.targetBankName());
+				if (finishedHandler) {
+					finishedHandler(false);
 				}
+				return;
+			}
+			if (progressHandler) {
+				progressHandler->setMessage(fmt::format("Sending {} as one bank dump...", synthBank.targetBankName()));
 			}
+			synth->enqueueBlockOfMessagesToSynth(location->midiOutput(), messages, [progressHandler, finishedHandler](bool completed) {
+				if (progressHandler) {
+					progressHandler->setProgressPercentage(1.0);
+				}
+				if (finishedHandler) {
+					finishedHandler(completed);
+				}
+				});
+		}
+		else if (programDumpCapability) {
+			int count = (int)positions.size();
 
 			auto location = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth);
 			if (!location || !location->channel().isValid() /* || !synth->wasDetected()*/) {
@@ -527,30 +595,60 @@ namespace midikraft {
 				return;
 			}
 
-			// Now to send and update the progressHandler
-			int sent = 0;
-			i = 0;
-			for (auto const& patch : synthBank.patches()) {
-				if (progressHandler) progressHandler->setMessage(fmt::format("Sending patch {} to {}", patch.name(), synth->friendlyProgramName(patch.patchNumber())));
-				if (fullBank || synthBank.isPositionDirty(i++)) {
-					auto messages = programDumpCapability->patchToProgramDumpSysex(patch.patch(), patch.patchNumber());
-					synth->sendBlockOfMessagesToSynth(location->midiOutput(), messages);
+			if (count == 0) {
+				if (finishedHandler) {
+					finishedHandler(true);
 				}
-				if (progressHandler) {
-					progressHandler->setMessage(fmt::format("Sending patch #{}: '{}'...", sent, patch.name()));
-					progressHandler->setProgressPercentage(++sent / (double)count);
-				}
-				if (progressHandler && progressHandler->shouldAbort()) {
-					spdlog::warn("Canceled bank upload in mid-flight!");
-					if (finishedHandler) {
-						finishedHandler(false);
+				return;
+			}
+
+			// Now queue one send job per patch, the progress is updated when each job has gone out on the wire
+			struct BankSendState {
+				CriticalSection lock;
+				std::vector<MidiSendQueue::JobID> jobs;
+				int sent = 0;
+				bool finished = false;
+			};
+			auto state = std::make_shared<BankSendState>();
+			auto midiOutput = MidiController::instance()->getMidiOutput(location->midiOutput());
+			{
+				ScopedLock lock(state->lock); // Hold back the first callbacks until all jobs are known, so an abort can cancel all of them
+				int i = 0;
+				for (auto const& patch : patches) {
+					if (positions.count(i++)) {
+						auto messages = programDumpCapability->patchToProgramDumpSysex(patch.patch(), patch.patchNumber());
+						auto patchName = patch.name();
+						state->jobs.push_back(synth->enqueueBlockOfMessagesToSynth(location->midiOutput(), messages, [state, midiOutput, progressHandler, finishedHandler, patchName, count](bool completed) {
+							std::vector<MidiSendQueue::JobID> toCancel;
+							{
+								ScopedLock stateLock(state->lock);
+								if (state->finished) return;
+								if (completed && !(progressHandler && progressHandler->shouldAbort())) {
+									state->sent++;
+									if (progressHandler) {
+										progressHandler->setMessage(fmt::format("Sending patch #{}: '{}'...", state->sent, patchName));
+										progressHandler->setProgressPercentage(state->sent / (double)count);
+									}
+									if (state->sent < count) return;
+								}
+								else {
+									spdlog::warn("Canceled bank upload in mid-flight!");
+									toCancel = state->jobs;
+									completed = false;
+								}
+								state->finished = true;
+							}
+							// The remaining jobs are notified with false, which the finished flag ignores
+							for (auto job : toCancel) {
+								midiOutput->cancelSend(job);
+							}
+							if (finishedHandler) {
+								finishedHandler(completed);
+							}
+							}));
 					}
-					return;
 				}
 			}
-			if (finishedHandler) {
-				finishedHandler(true);
-			}
 		}
 		else {
 			spdlog::warn("Sending banks to {} is not implemented yet", synth->getName());
@@ -574,35 +672,81 @@ namespace midikraft {
 				return;
 			}
 
-			// Create a temporary directory to build the result
-			TemporaryDirectory tempDir("KnobKraftOrm", "sysex_export_tmp");
+			std::unique_ptr<FileOutputStream> stream;
+			if (params.fileOption != Librarian::MANY_FILES) {
+				stream = std::make_unique<FileOutputStream>(destination, 1 << 16);
+				if (!stream->openedOk()) {
+					spdlog::error("Failed to open {} for writing: {}", destination.getFullPathName().toStdString(), stream->getStatus().getErrorMessage().toStdString());
+					return;
+				}
+			}
+			int64 trackLengthPosition = 0;
+			if (params.fileOption == Librarian::MID_FILE) {
+				// Standard MIDI file type 1 with a single track at 96 ticks per quarter note, the track length is filled in at the end
+				stream->write("MThd", 4);
+				stream->writeIntBigEndian(6);
+				stream->writeShortBigEndian(1);
+				stream->writeShortBigEndian(1);
+				stream->writeShortBigEndian(96);
+				stream->write("MTrk", 4);
+				trackLengthPosition = stream->getPosition();
+				stream->writeIntBigEndian(0);
+			}
+
+			// The sysex is generated in parallel, and this thread writes the results in patch order
+			// as they become ready, so the workers are never more than kLookAhead patches ahead and the memory use stays bounded
+			const size_t kLookAhead = 256;
+			size_t numPatches = patches.size();
+			std::vector<std::vector<MidiMessage>> results(numPatches);
+			std::vector<char> ready(numPatches, 0);
+			std::mutex resultLock;
+			std::condition_variable resultChanged;
+			size_t written = 0;
+			bool stopWorkers = false;
+			ParallelFor generating(numPatches, [&](size_t index) {
+				{
+					std::unique_lock<std::mutex> lock(resultLock);
+					resultChanged.wait(lock, [&]() { return stopWorkers || index < written + kLookAhead; });
+					if (stopWorkers) {
+						return;
+					}
+				}
+				std::vector<MidiMessage> sysexMessages;
+				try {
+					sysexMessages = sysexForPatch(patches[index]);
+				}
+				catch (std::exception& e) {
+					spdlog::error("Failed to create sysex for patch {}: {}", patches[index].name(), e.what());
+				}
+				{
+					std::lock_guard<std::mutex> lock(resultLock);
+					results[index] = std::move(sysexMessages);
+					ready[index] = 1;
+				}
+				resultChanged.notify_all();
+			});
 
-			// Now, iterate over the list of patches and pack them one by one into the zip file!		
 			ZipFile::Builder builder;
-			std::vector<MidiMessage> allMessages;
-			int count = 0;
-			for (const auto& patch : patches) {
-				if (patch.patch()) {
-					std::vector<MidiMessage> sysexMessages;
-					switch (params.formatOption) {
-					case Librarian::PROGRAM_DUMPS:
-					{
-						// Let's see if we have program dump capability for the synth!
-						auto pdc = Capability::hasCapability<ProgramDumpCabability>(patch.synth());
-						if (pdc) {
-							sysexMessages = pdc->patchToProgramDumpSysex(patch.patch(), patch.patchNumber());
-							break;
-						}
+			std::set<std::string> usedNames;
+			int64 trackLength = 0;
+			bool ok = true;
+			for (size_t i = 0; i < numPatches && ok && !threadShouldExit(); i++) {
+				std::vector<MidiMessage> sysexMessages;
+				{
+					std::unique_lock<std::mutex> lock(resultLock);
+					while (!ready[i] && !threadShouldExit()) {
+						resultChanged.wait_for(lock, std::chrono::milliseconds(50));
 					}
-					// fall through do default then
-					default:
-					case Librarian::EDIT_BUFFER_DUMPS:
-						// Every synth is forced to have an implementation for this
-						sysexMessages = patch.synth()->dataFileToSysex(patch.patch(), nullptr);
+					if (!ready[i]) {
 						break;
 					}
+					sysexMessages = std::move(results[i]);
+					written = i + 1;
+				}
+				resultChanged.notify_all();
 
-					String fileName = patch.name();
+				if (!sysexMessages.empty()) {
+					String fileName = patches[i].name();
 					switch (params.fileOption) {
 					case Librarian::MANY_FILES:
 					{
@@ -611,66 +755,123 @@ namespace midikraft {
 					}
 					case Librarian::ZIPPED_FILES:
 					{
-						std::string result = Sysex::saveSysexIntoNewFile(tempDir.name(), File::createLegalFileName(fileName.trim()).toStdString(), sysexMessages);
-						builder.addFile(File(result), 6);
+						// Straight from memory into the zip, the builder owns the stream
+						MemoryBlock data;
+						for (auto const& message : sysexMessages) {
+							data.append(message.getRawData(), (size_t)message.getRawDataSize());
+						}
+						builder.addEntry(new MemoryInputStream(data, true), 6, uniqueEntryName(File::createLegalFileName(fileName.trim()).toStdString(), usedNames), Time::getCurrentTime());
 						break;
 					}
-					case Librarian::MID_FILE:
 					case Librarian::ONE_FILE:
 					{
-						std::copy(sysexMessages.begin(), sysexMessages.end(), std::back_inserter(allMessages));
+						for (auto const& message : sysexMessages) {
+							ok = ok && stream->write(message.getRawData(), (size_t)message.getRawDataSize());
+						}
+						break;
+					}
+					case Librarian::MID_FILE:
+					{
+						for (auto const& message : sysexMessages) {
+							trackLength += writeTrackEvent(*stream, message);
+						}
 						break;
 					}
 					}
 				}
-				setProgress(count++ / (double)patches.size());
-				if (threadShouldExit()) {
-					break;
-				}
+				setProgress(i / (double)numPatches);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(resultLock);
+				stopWorkers = true;
 			}
+			resultChanged.notify_all();
+			generating.stop();
+			generating.join();
+
 			switch (params.fileOption)
 			{
 			case Librarian::ZIPPED_FILES:
+				builder.writeToStream(*stream, nullptr);
+				break;
+			case Librarian::MID_FILE:
 			{
-				FileOutputStream targetStream(destination);
-				builder.writeToStream(targetStream, nullptr);
+				// End of track, then go back and fill in the length
+				uint8 endOfTrack[] = { 0x00, 0xff, 0x2f, 0x00 };
+				stream->write(endOfTrack, sizeof(endOfTrack));
+				trackLength += sizeof(endOfTrack);
+				stream->setPosition(trackLengthPosition);
+				stream->writeIntBigEndian((int)trackLength);
 				break;
 			}
-			case Librarian::ONE_FILE:
-			{
-				Sysex::saveSysex(destination.getFullPathName().toStdString(), allMessages);
+			default:
+				// Nothing to do
 				break;
 			}
-			case Librarian::MID_FILE:
-			{
-				MidiFile midiFile;
-				MidiMessageSequence mmSeq;
-				for (const auto& msg : allMessages) {
-					mmSeq.addEvent(msg, 0.0);
+			if (stream) {
+				stream->flush();
+				if (!ok || stream->getStatus().failed()) {
+					spdlog::error("Failed to write export file {}", destination.getFullPathName().toStdString());
 				}
+			}
+		}
 
-				// Add to track 1 of MIDI file
-				midiFile.addTrack(mmSeq);
-				midiFile.setTicksPerQuarterNote(96);
-
-				// Done, write to file
-				File file(destination);
-				if (file.existsAsFile()) {
-					file.deleteFile();
-				}
-				FileOutputStream stream(file);
-				if (!midiFile.writeTo(stream, 1)) {
-					spdlog::error("Failed to write SMF file to {}", destination.getFullPathName());
+	private:
+		std::vector<MidiMessage> sysexForPatch(PatchHolder const& patch) const {
+			if (!patch.patch()) {
+				return {};
+			}
+			if (params.formatOption == Librarian::PROGRAM_DUMPS) {
+				// Let's see if we have program dump capability for the synth!
+				auto pdc = Capability::hasCapability<ProgramDumpCabability>(patch.synth());
+				if (pdc) {
+					return pdc->patchToProgramDumpSysex(patch.patch(), patch.patchNumber());
 				}
-				stream.flush();
 			}
-			default:
-				// Nothing to do
-				break;
+			// Every synth is forced to have an implementation for this
+			return patch.synth()->dataFileToSysex(patch.patch(), nullptr);
+		}
+
+		// Several patches can have the same name, number them like new files in a directory would be
+		static String uniqueEntryName(std::string const& baseName, std::set<std::string>& usedNames) {
+			std::string name = baseName + ".syx";
+			for (int suffix = 2; usedNames.count(name) > 0; suffix++) {
+				name = fmt::format("{} ({}).syx", baseName, suffix);
+			}
+			usedNames.insert(name);
+			return String(name);
+		}
+
+		// One event with delta time 0, as all messages are put on the same tick. Returns the number of bytes written
+		static int64 writeTrackEvent(OutputStream& out, MidiMessage const& message) {
+			auto data = message.getRawData();
+			int size = message.getRawDataSize();
+			if (size <= 0) {
+				return 0;
+			}
+			int64 bytes = 1;
+			out.writeByte(0);
+			if (message.isSysEx()) {
+				// F0, then the remaining length as variable length quantity, then the bytes after the F0 including the F7
+				out.writeByte((char)0xf0);
+				uint32 length = (uint32)(size - 1);
+				uint8 quantity[5];
+				int count = 0;
+				do {
+					quantity[count++] = (uint8)(length & 0x7f);
+					length >>= 7;
+				} while (length > 0);
+				for (int i = count - 1; i >= 0; i--) {
+					out.writeByte((char)(quantity[i] | (i > 0 ? 0x80 : 0)));
+				}
+				out.write(data + 1, (size_t)(size - 1));
+				return bytes + 1 + count + size - 1;
 			}
+			out.write(data, (size_t)size);
+			return bytes + size;
 		}
 
-	private:
 		File destination;
 		Librarian::ExportParameters params;
 		std::vector<PatchHolder> const& patches;
@@ -757,219 +958,36 @@ namespace midikraft {
 
 	void Librarian::clearHandlers()
 	{
-		// This is to clear up any remaining MIDI callback handlers, e.g. on User canceling an operation
-		while (!handles_.empty()) {
-			auto handle = handles_.top();
-			handles_.pop();
-			MidiController::instance()->removeMessageHandler(handle);
-		}
-	}
-
-	void Librarian::startDownloadNextEditBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, bool sendProgramChange) {
-		// Get all commands
-		std::vector<MidiMessage> messages;
-		auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth);
-		if (editBufferCapability) {
-			currentEditBuffer_.clear();
-			auto midiLocation = midikraft::Capability::hasCapability<MidiLocationCapability>(synth);
-			if (midiLocation) {
-				if (sendProgramChange) {
-					messages.push_back(MidiMessage::programChange(midiLocation->channel().toOneBasedInt(), downloadNumber_));
-				}
-				auto requestMessages = editBufferCapability->requestEditBufferDump();
-				std::copy(requestMessages.cbegin(), requestMessages.cend(), std::back_inserter(messages));
-			}
-			else {
-				spdlog::error("Can't send to synth because no MIDI location implemented for it");
-			}
-		}
-		else {
-			spdlog::error("Failure: This synth does not implement any valid capability to start downloading a full bank");
-			downloadNumber_ = endDownloadNumber_;
-		}
-
-		// Send messages
-		if (!messages.empty()) {
-			synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), messages);
-		}
-	}
-
-	void Librarian::startDownloadNextPatch(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth) {
-		// Get all commands
-		std::vector<MidiMessage> messages;
-		auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
-		if (programDumpCapability) {
-			currentProgramDump_.clear();
-			messages = programDumpCapability->requestPatch(downloadNumber_);
-		}
-		else {
-			spdlog::error("Failure: This synth does not implement any valid capability to start downloading a full bank");
-			downloadNumber_ = endDownloadNumber_;
-		}
-
-		// Send messages
-		if (!messages.empty()) {
-			synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), messages);
-		}
-	}
-
-	void Librarian::startDownloadNextDataItem(std::shared_ptr<SafeMidiOutput> midiOutput, DataFileLoadCapability* sequencer, int dataFileIdentifier) {
-		std::vector<MidiMessage> request = sequencer->requestDataItem(downloadNumber_, dataFileIdentifier);
-		// If this is a synth, it has a throttled send method
-		auto synth = dynamic_cast<Synth*>(sequencer);
-		if (synth) {
-			synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), request);
-		}
-		else {
-			// This is not a synth... fall back to old behavior
-			midiOutput->sendBlockOfMessagesFullSpeed(request);
-		}
-	}
-
-	void Librarian::handleNextStreamPart(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, const juce::MidiMessage& message, StreamLoadCapability::StreamType streamType)
-	{
-		auto streamLoading = midikraft::Capability::hasCapability<StreamLoadCapability>(synth);
-		if (streamLoading) {
-			if (streamLoading->isMessagePartOfStream(message, streamType)) {
-				currentDownload_.push_back(message);
-				int progressTotal = streamLoading->numberOfStreamMessagesExpected(streamType);
-				if (progressTotal > 0 && progressHandler) {
-					progressHandler->setProgressPercentage(currentDownload_.size() / (double)progressTotal);
-				}
-				if (streamLoading->isStreamComplete(currentDownload_, streamType)) {
-					clearHandlers();
-					auto result = synth->loadSysex(currentDownload_);
-					onFinished_(tagPatchesWithImportFromSynth(synth, result, currentDownloadBank_));
-					if (progressHandler) progressHandler->onSuccess();
-				}
-				else if (progressHandler && progressHandler->shouldAbort()) {
-					clearHandlers();
-					progressHandler->onCancel();
-				}
-				else if (streamLoading->shouldStreamAdvance(currentDownload_, streamType)) {
-					downloadNumber_++;
-					auto messages = streamLoading->requestStreamElement(downloadNumber_, streamType);
-					synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), messages);
-					if (progressTotal == -1 && progressHandler) progressHandler->setProgressPercentage(downloadNumber_ / (double)expectedDownloadNumber_);
-				}
-			}
-		}
-		else {
-			jassertfalse;
-		}
-	}
-
-	void Librarian::handleNextEditBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, const juce::MidiMessage& editBuffer, MidiBankNumber bankNo) {
-		auto editBufferCapability = midikraft::Capability::hasCapability<EditBufferCapability>(synth);
-		// This message might be a part of a multi-message program dump?
-		if (editBufferCapability) {
-			auto handshake = editBufferCapability->isMessagePartOfEditBuffer(editBuffer);
-			if (handshake.isPartOfEditBufferDump) {
-				// See if we should send a reply (ACK)
-				if (!handshake.handshakeReply.empty()) {
-					synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), handshake.handshakeReply);
-				}
-				currentEditBuffer_.push_back(editBuffer);
-				if (editBufferCapability->isEditBufferDump(currentEditBuffer_)) {
-					// Ok, that worked, save it and continue!
-					std::copy(currentEditBuffer_.begin(), currentEditBuffer_.end(), std::back_inserter(currentDownload_));
-
-					// Finished?
-					if (downloadNumber_ >= endDownloadNumber_ - 1) {
-						clearHandlers();
-						auto patches = synth->loadSysex(currentDownload_);
-						onFinished_(tagPatchesWithImportFromSynth(synth, patches, bankNo));
-						if (progressHandler) progressHandler->onSuccess();
-					}
-					else if (progressHandler->shouldAbort()) {
-						clearHandlers();
-						if (progressHandler) progressHandler->onCancel();
-					}
-					else {
-						downloadNumber_++;
-						startDownloadNextEditBuffer(midiOutput, synth, true); // To continue with more than one download makes only sense if we send program change commands
-						if (progressHandler) progressHandler->setProgressPercentage((downloadNumber_ - startDownloadNumber_) / (double)(endDownloadNumber_ - startDownloadNumber_));
-					}
-				}
-			}
+		// This is to stop all downloads still running, e.g. on User canceling an operation
+		std::vector<std::shared_ptr<DownloadSession>> sessions;
+		{
+			ScopedLock lock(sessionLock_);
+			sessions.swap(sessions_);
 		}
-		else {
-			// Ignore message
+		for (auto& session : sessions) {
+			session->cancel();
 		}
 	}
 
-	void Librarian::handleNextProgramBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, const juce::MidiMessage& editBuffer, MidiBankNumber bankNo) {
-		auto programDumpCapability = midikraft::Capability::hasCapability<ProgramDumpCabability>(synth);
-		// This message might be a part of a multi-message program dump?
-		if (programDumpCapability) {
-			auto handshake = programDumpCapability->isMessagePartOfProgramDump(editBuffer);
-			if (handshake.isPartOfProgramDump) {
-				currentProgramDump_.push_back(editBuffer);
-				// See if we should send a reply (ACK)
-				if (!handshake.handshakeReply.empty()) {
-					synth->sendBlockOfMessagesToSynth(midiOutput->deviceInfo(), handshake.handshakeReply);
-				}
-				if (programDumpCapability->isSingleProgramDump(currentProgramDump_)) {
-					// Ok, that worked, save it and continue!
-					std::copy(currentProgramDump_.begin(), currentProgramDump_.end(), std::back_inserter(currentDownload_));
-
-					// Finished?
-					if (downloadNumber_ >= endDownloadNumber_ - 1) {
-						clearHandlers();
-						auto patches = synth->loadSysex(currentDownload_);
-						onFinished_(tagPatchesWithImportFromSynth(synth, patches, bankNo));
-						if (progressHandler) progressHandler->onSuccess();
-					}
-					else if (progressHandler->shouldAbort()) {
-						clearHandlers();
-						if (progressHandler) progressHandler->onCancel();
-					}
-					else {
-						downloadNumber_++;
-						startDownloadNextPatch(midiOutput, synth);
-						if (progressHandler) progressHandler->setProgressPercentage((downloadNumber_ - startDownloadNumber_) / (double)(endDownloadNumber_ - startDownloadNumber_));
-					}
-				}
-			}
-		}
-	}
-
-	void Librarian::handleNextBankDump(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, const juce::MidiMessage& bankDump, MidiBankNumber bankNo)
-	{
-		ignoreUnused(midiOutput); //TODO why?
-		auto bankDumpCapability = midikraft::Capability::hasCapability<BankDumpCapability>(synth);
-		if (bankDumpCapability && bankDumpCapability->isBankDump(bankDump)) {
-			currentDownload_.push_back(bankDump);
-			if (bankDumpCapability->isBankDumpFinished(currentDownload_)) {
-				clearHandlers();
-				auto patches = synth->loadSysex(currentDownload_);
-				onFinished_(tagPatchesWithImportFromSynth(synth, patches, bankNo));
-				progressHandler->onSuccess();
-			}
-			else if (progressHandler->shouldAbort()) {
-				clearHandlers();
-				progressHandler->onCancel();
-			}
-			else {
-				progressHandler->setProgressPercentage(currentDownload_.size() / (double)(expectedDownloadNumber_));
-			}
-		}
+	std::vector<PatchHolder> Librarian::tagPatchesWithImportFromSynth(std::shared_ptr<Synth> synth, TPatchVector& patches, MidiBankNumber bankNo) {
+		return tagPatchesWithImportFromSynth(synth, patches, bankNo, Time::getCurrentTime(), 0);
 	}
 
-	std::vector<PatchHolder> Librarian::tagPatchesWithImportFromSynth(std::shared_ptr<Synth> synth, TPatchVector& patches, MidiBankNumber bankNo) {
-		std::vector<PatchHolder> result;
-		auto now = Time::getCurrentTime();
-		return createPatchHoldersFromPatchList(synth, patches, bankNo, [now](MidiBankNumber bank, MidiProgramNumber programNumber) {
+	std::vector<PatchHolder> Librarian::tagPatchesWithImportFromSynth(std::shared_ptr<Synth> synth, TPatchVector& patches, MidiBankNumber bankNo, Time importTime, int firstPatchIndex) {
+		return createPatchHoldersFromPatchList(synth, patches, bankNo, [importTime](MidiBankNumber bank, MidiProgramNumber programNumber) {
 			ignoreUnused(programNumber);
-			return std::make_shared<FromSynthSource>(now, bank);
-			}, nullptr);
+			return std::make_shared<FromSynthSource>(importTime, bank);
+			}, nullptr, firstPatchIndex);
 	}
 
 	void Librarian::tagPatchesWithMultiBulkImport(std::vector<PatchHolder>& patches) {
+		tagPatchesWithMultiBulkImport(patches, Time::getCurrentTime());
+	}
+
+	void Librarian::tagPatchesWithMultiBulkImport(std::vector<PatchHolder>& patches, Time importTime) {
 		// We have multiple import sources, so we need to modify the SourceInfo in the patches with a BulkImport info
-		Time now = Time::getCurrentTime();
 		for (auto& patch : patches) {
-			auto bulkInfo = std::make_shared<FromBulkImportSource>(now, patch.sourceInfo());
+			auto bulkInfo = std::make_shared<FromBulkImportSource>(importTime, patch.sourceInfo());
 			patch.setSourceInfo(bulkInfo);
 		}
 	}
@@ -17,8 +17,10 @@
 #include "DataFileLoadCapability.h"
 #include "StreamLoadCapability.h"
 #include "SynthBank.h"
+#include "DownloadSession.h"
+#include "SysexSniffer.h"
 
-#include <stack>
+#include <set>
 
 namespace midikraft {
 
@@ -26,26 +28,44 @@ namespace midikraft {
 
 	class Librarian {
 	public:
-		typedef std::function<void(std::vector<PatchHolder>)> TFinishedHandler;
-		typedef std::function<void(std::vector<std::shared_ptr<DataFile>>)> TStepSequencerFinishedHandler;
-
-		Librarian(std::vector<SynthHolder> const &synths) : synths_(synths), currentDownloadBank_(MidiBankNumber::invalid()), downloadNumber_(0), startDownloadNumber_(0), endDownloadNumber_(0) {}
+		typedef std::function<void(std::vector<PatchHolder> const &)> TFinishedHandler;
+		typedef std::function<void(std::vector<std::shared_ptr<DataFile>> const &)> TStepSequencerFinishedHandler;
+		typedef DownloadSession::TPatchReceivedHandler TPatchReceivedHandler;
+		typedef DownloadSession::TDataFilesReceivedHandler TDataFilesReceivedHandler;
+		typedef DownloadSession::TFailedHandler TFailedHandler;
+		typedef std::function<bool(File const &file)> TFileFilter; // Return false to skip the file
+
+		Librarian(std::vector<SynthHolder> const &synths) : synths_(synths), sniffer_(synths) {}
 		~Librarian();
 
 		BankDownloadMethod determineBankDownloadMethod(std::shared_ptr<Synth> synth);
-		void startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, MidiBankNumber bankNo, ProgressHandler *progressHandler, TFinishedHandler onFinished);
-		void startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, std::vector<MidiBankNumber> bankNo, ProgressHandler *progressHandler, TFinishedHandler onFinished);
+		// If given, onPatchReceived is called from the MIDI thread for each patch as soon as it is parsed, already fingerprinted, so it can be shown or stored
+		// before the download is complete. For synths sending one dump per program this happens while the bank is still coming in
+		// If given, onFailed is called with the reason when the synth stops answering, instead of canceling the progress handler
+		void startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, MidiBankNumber bankNo, ProgressHandler *progressHandler, TFinishedHandler onFinished, TPatchReceivedHandler onPatchReceived = nullptr, TFailedHandler onFailed = nullptr);
+		void startDownloadingAllPatches(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, std::vector<MidiBankNumber> bankNo, ProgressHandler *progressHandler, TFinishedHandler onFinished, TPatchReceivedHandler onPatchReceived = nullptr, TFailedHandler onFailed = nullptr);
 
 		void downloadEditBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler *progressHandler, TFinishedHandler onFinished);
 
 		void startDownloadingSequencerData(std::shared_ptr<SafeMidiOutput> midiOutput, DataFileLoadCapability *sequencer, int dataFileIdentifier, ProgressHandler *progressHandler, TStepSequencerFinishedHandler onFinished);
+		// Several data types in one session, with up to window items requested at the same time. onDataReceived is called from the MIDI thread as batches are loaded
+		void startDownloadingSequencerData(std::shared_ptr<SafeMidiOutput> midiOutput, DataFileLoadCapability *sequencer, std::vector<int> const &dataFileIdentifiers, int window,
+			ProgressHandler *progressHandler, TStepSequencerFinishedHandler onFinished, TDataFilesReceivedHandler onDataReceived = nullptr);
 
+		// The synth that claims the most of the messages, nullptr if none does
 		Synth *sniffSynth(std::vector<MidiMessage> const &messages) const;
 		std::vector<PatchHolder> loadSysexPatchesFromDisk(std::shared_ptr<Synth> synth, std::shared_ptr<AutomaticCategory> automaticCategories);
 		std::vector<PatchHolder> loadSysexPatchesFromDisk(std::shared_ptr<Synth> synth, std::string const &fullpath, std::string const &filename, std::shared_ptr<AutomaticCategory> automaticCategories);
+		// Loads all patch files found in the directory and its subdirectories. Files rejected by the filter are not even opened, e.g. those unchanged since the last import
+		std::vector<PatchHolder> loadSysexPatchesFromDirectory(std::shared_ptr<Synth> synth, File const &directory, std::shared_ptr<AutomaticCategory> automaticCategories, TFileFilter filter = nullptr);
 		std::vector<PatchHolder> loadSysexPatchesManualDump(std::shared_ptr<Synth> synth, std::vector<MidiMessage> const &messages, std::shared_ptr<AutomaticCategory> automaticCategories);
 
+		// Queues the patches on the synth's output and returns at once. Progress and the finished handler are reported from the MIDI send thread, so the
+		// progress handler must stay alive until the finished handler has been called. An abort is noticed each time a program dump has gone out
 		void sendBankToSynth(SynthBank const& synthBank, bool fullBank, ProgressHandler *progressHandler, std::function<void(bool completed)> finishedHandler);
+		// Same, but only sends the programs whose fingerprint differs from what the synth had at the last sync, e.g. from PatchDatabase::getSyncedBankFingerprints().
+		// This survives a restart, unlike the dirty flags of the bank. With no synced state known, the whole bank is sent
+		void sendBankToSynth(SynthBank const& synthBank, std::vector<std::string> const &syncedFingerprints, ProgressHandler *progressHandler, std::function<void(bool completed)> finishedHandler);
 
 		enum ExportFormatOption {
 			PROGRAM_DUMPS = 0,
@@ -64,41 +84,38 @@ namespace midikraft {
 		};
 		void saveSysexPatchesToDisk(ExportParameters params, std::vector<PatchHolder> const &patches);
 
+		// Stops all downloads still running
 		void clearHandlers();
 
 	private:
-		void startDownloadNextEditBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, bool sendProgramChange);
-		void startDownloadNextPatch(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth);
-		void startDownloadNextDataItem(std::shared_ptr<SafeMidiOutput> midiOutput, DataFileLoadCapability *sequencer, int dataFileIdentifier);
-		void handleNextStreamPart(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler *progressHandler, const juce::MidiMessage &message, StreamLoadCapability::StreamType streamType);
-		void handleNextEditBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler *progressHandler, const juce::MidiMessage &editBuffer, MidiBankNumber bankNo);
-		void handleNextProgramBuffer(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, const juce::MidiMessage& editBuffer, MidiBankNumber bankNo);
-		void handleNextBankDump(std::shared_ptr<SafeMidiOutput> midiOutput, std::shared_ptr<Synth> synth, ProgressHandler* progressHandler, const juce::MidiMessage& bankDump, MidiBankNumber bankNo);
-
-		std::vector<PatchHolder> createPatchHoldersFromPatchList(std::shared_ptr<Synth> synth, TPatchVector const& patches, MidiBankNumber bankNo, std::function<std::shared_ptr<SourceInfo>(MidiBankNumber, MidiProgramNumber)> generateSourceinfo, std::shared_ptr<AutomaticCategory> automaticCategories);
+		friend class DownloadSession;
+
+		std::shared_ptr<DownloadSession> startSession(std::shared_ptr<SafeMidiOutput> midiOutput, ProgressHandler *progressHandler);
+		std::string supportedFileExtensions(std::shared_ptr<Synth> synth);
+		std::vector<PatchHolder> loadPatchFiles(std::shared_ptr<Synth> synth, Array<File> const &files, std::shared_ptr<AutomaticCategory> automaticCategories);
+		// The entries are decompressed into memory and parsed on a few threads, no temporary files
+		std::vector<PatchHolder> loadPatchesFromZip(std::shared_ptr<Synth> synth, File const &zipFile, std::shared_ptr<AutomaticCategory> automaticCategories);
+		// For messages the synth given didn't take. Tries the synth sniffed from them instead and returns it in synth if it loaded anything
+		TPatchVector loadWithSniffedSynth(std::shared_ptr<Synth> &synth, std::vector<MidiMessage> const &messages, std::string const &filename);
+		// False if the synth, or any synth a file could be sniffed for instead, must not calculate fingerprints on several threads at once
+		bool canLoadConcurrently(std::shared_ptr<Synth> synth);
+		void sendPositionsToSynth(SynthBank const& synthBank, std::set<int> const &positions, ProgressHandler *progressHandler, std::function<void(bool completed)> finishedHandler);
+
+		std::vector<PatchHolder> createPatchHoldersFromPatchList(std::shared_ptr<Synth> synth, TPatchVector const& patches, MidiBankNumber bankNo, std::function<std::shared_ptr<SourceInfo>(MidiBankNumber, MidiProgramNumber)> generateSourceinfo, std::shared_ptr<AutomaticCategory> automaticCategories, int firstPatchIndex = 0);
 		std::vector<PatchHolder> tagPatchesWithImportFromSynth(std::shared_ptr<Synth> synth, TPatchVector &patches, MidiBankNumber bankNo);
+		// Patches parsed piece by piece need the same import time to end up in the same import
+		std::vector<PatchHolder> tagPatchesWithImportFromSynth(std::shared_ptr<Synth> synth, TPatchVector &patches, MidiBankNumber bankNo, Time importTime, int firstPatchIndex);
 		void tagPatchesWithMultiBulkImport(std::vector<PatchHolder> &patches);
+		void tagPatchesWithMultiBulkImport(std::vector<PatchHolder> &patches, Time importTime);
 
 		void updateLastPath(std::string &lastPathVariable, std::string const &settingsKey);
 
 		std::vector<SynthHolder> synths_;
-		std::vector<MidiMessage> currentDownload_;
-		std::vector<MidiMessage> currentEditBuffer_;
-		std::vector<MidiMessage> currentProgramDump_;
-		MidiBankNumber currentDownloadBank_;
-		std::stack<MidiController::HandlerHandle> handles_;
-		TFinishedHandler onFinished_;
-		TStepSequencerFinishedHandler onSequencerFinished_;
-		int downloadNumber_;
-		int startDownloadNumber_;
-		int endDownloadNumber_;
-		int expectedDownloadNumber_;
-
-		// To download multiple banks. This needs to go into its own context object
-		TFinishedHandler nextBankHandler_;
-		std::vector<midikraft::PatchHolder> currentDownloadedPatches_;
-		int downloadBankNumber_;
-		//int endDownloadBankNumber_;
+		SysexSniffer sniffer_; // Over synths_
+
+		// Downloads running, at most one per MIDI output
+		CriticalSection sessionLock_;
+		std::vector<std::shared_ptr<DownloadSession>> sessions_;
 
 		std::string lastPath_; // Last import path
 		std::string lastExportDirectory_; 
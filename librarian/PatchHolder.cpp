@@ -43,7 +43,7 @@ namespace midikraft {
 		if (patch) {
 			name_ = activeSynth->nameForPatch(patch);
 			if (detector) {
-				categories_ = detector->determineAutomaticCategories(*this);
+				categories_ = detector->determineAutomaticCategorySet(*this);
 			}
 		}
 	}
@@ -54,9 +54,34 @@ namespace midikraft {
 
 	std::shared_ptr<DataFile> PatchHolder::patch() const
 	{
+		if (lazy_) {
+			std::lock_guard<std::mutex> lock(lazy_->lock);
+			if (lazy_->loader) {
+				lazy_->patch = lazy_->loader();
+				lazy_->loader = nullptr;
+			}
+			return lazy_->patch;
+		}
 		return patch_;
 	}
 
+	void PatchHolder::setLazyPatch(std::function<std::shared_ptr<DataFile>()> loader, std::string const &knownMD5)
+	{
+		patch_.reset();
+		lazy_ = std::make_shared<LazyPatch>();
+		lazy_->loader = loader;
+		lazy_->knownMD5 = knownMD5;
+	}
+
+	bool PatchHolder::isPatchLoaded() const
+	{
+		if (lazy_) {
+			std::lock_guard<std::mutex> lock(lazy_->lock);
+			return lazy_->patch != nullptr;
+		}
+		return patch_ != nullptr;
+	}
+
 	midikraft::Synth * PatchHolder::synth() const
 	{
 		return !synth_.expired() ? synth_.lock().get() : nullptr;
@@ -69,7 +94,7 @@ namespace midikraft {
 
 	int PatchHolder::getType() const
 	{
-		return patch_->dataTypeID();
+		return patch()->dataTypeID();
 	}
 
 	void PatchHolder::setName(std::string const &newName)
@@ -92,12 +117,12 @@ namespace midikraft {
 
 	void PatchHolder::setSourceId(std::string const &source_id)
 	{
-		sourceId_ = source_id;
+		sourceId_ = InternedString(source_id);
 	}
 
 	std::string PatchHolder::sourceId() const
 	{
-		return sourceId_;
+		return sourceId_.str();
 	}
 
 	void PatchHolder::setPatchNumber(MidiProgramNumber number)
@@ -152,15 +177,13 @@ namespace midikraft {
 
 	bool PatchHolder::hasCategory(Category const &category) const
 	{
-		return categories_.find(category) != categories_.end();
+		return categories_.contains(category);
 	}
 
 	void PatchHolder::setCategory(Category const &category, bool hasIt)
 	{
 		if (!hasIt) {
-			if (hasCategory(category)) {
-				categories_.erase(category);
-			}
+			categories_.erase(category);
 		}
 		else {
 			categories_.insert(category);
@@ -168,6 +191,11 @@ namespace midikraft {
 	}
 
 	void PatchHolder::setCategories(std::set<Category> const &cats)
+	{
+		categories_ = CategorySet(cats);
+	}
+
+	void PatchHolder::setCategories(CategorySet const &cats)
 	{
 		categories_ = cats;
 	}
@@ -178,11 +206,21 @@ namespace midikraft {
 	}
 
 	std::set<Category> PatchHolder::categories() const
+	{
+		return categories_.asSet();
+	}
+
+	CategorySet const &PatchHolder::categorySet() const
 	{
 		return categories_;
 	}
 
 	std::set<midikraft::Category> PatchHolder::userDecisionSet() const
+	{
+		return userDecisions_.asSet();
+	}
+
+	CategorySet const &PatchHolder::userDecisionCategorySet() const
 	{
 		return userDecisions_;
 	}
@@ -204,23 +242,12 @@ namespace midikraft {
 
 	bool PatchHolder::autoCategorizeAgain(std::shared_ptr<AutomaticCategory> detector)
 	{
-		auto previous = categories();
-		auto newCategories = detector->determineAutomaticCategories(*this);
+		auto previous = categories_;
+		auto newCategories = detector->determineAutomaticCategorySet(*this);
 		if (previous != newCategories) {
-			for (auto n : newCategories) {
-				if (userDecisions_.find(n) == userDecisions_.end()) {
-					// For this category no user decision has been recorded, so we can safely set it!
-					categories_.insert(n);
-				}
-			}
-			for (auto o : previous) {
-				if (newCategories.find(o) == newCategories.end()) {
-					// This category has been removed by the auto categorizer, let's check if there is no user decision on it!
-					if (userDecisions_.find(o) == userDecisions_.end()) {
-						categories_.erase(o);
-					}
-				}
-			}
+			// Keep everything the user decided on, take the rest from the auto categorizer
+			auto userDecided = previous.intersectionWith(userDecisions_);
+			categories_ = userDecided.unionWith(newCategories.difference(userDecisions_));
 			return previous != categories_;
 		}
 		else {
@@ -230,8 +257,14 @@ namespace midikraft {
 
 	std::string PatchHolder::md5() const
 	{
-		if (!synth_.expired() && patch_)
-			return synth_.lock()->calculateFingerprint(patch_);
+		if (lazy_) {
+			std::lock_guard<std::mutex> lock(lazy_->lock);
+			if (lazy_->loader && !lazy_->knownMD5.empty())
+				return lazy_->knownMD5;
+		}
+		auto data = patch();
+		if (!synth_.expired() && data)
+			return synth_.lock()->fingerprint(data);
 		else
 			return "empty";
 	}
@@ -239,10 +272,11 @@ namespace midikraft {
 	std::string PatchHolder::createDragInfoString() const
 	{
 		// The drag info should be... "PATCH", synth, type, and md5
+		auto data = patch();
 		nlohmann::json dragInfo = {
 			{ "drag_type", "PATCH"},
 			{ "synth", synth_.lock()->getName()},
-			{ "data_type", patch_ ? patch_->dataTypeID() : 0},
+			{ "data_type", data ? data->dataTypeID() : 0},
 			{ "patch_name", name()},
 			{ "md5", md5() }
 		};
@@ -275,6 +309,11 @@ namespace midikraft {
 	}
 
 	void PatchHolder::setUserDecisions(std::set<Category> const &cats)
+	{
+		userDecisions_ = CategorySet(cats);
+	}
+
+	void PatchHolder::setUserDecisions(CategorySet const &cats)
 	{
 		userDecisions_ = cats;
 	}
@@ -315,6 +354,17 @@ namespace midikraft {
 		return jsonRep_;
 	}
 
+	std::string SourceInfo::cachedMD5(Synth *synth, std::function<std::string()> calculate) const
+	{
+		auto cached = std::atomic_load(&md5_);
+		if (cached && cached->synth == synth) {
+			return cached->md5;
+		}
+		std::string result = calculate();
+		std::atomic_store(&md5_, std::make_shared<CachedMD5 const>(CachedMD5{ synth, result }));
+		return result;
+	}
+
 	std::shared_ptr<SourceInfo> SourceInfo::fromString(std::shared_ptr<Synth> synth, std::string const &str)
 	{
 		try {
@@ -362,8 +412,10 @@ namespace midikraft {
 
 	std::string FromSynthSource::md5(Synth *synth) const
 	{
-		String displayString(toDisplayString(synth, false));
-		return MD5(displayString.toUTF8()).toHexString().toStdString();
+		return cachedMD5(synth, [this, synth]() {
+			String displayString(toDisplayString(synth, false));
+			return MD5(displayString.toUTF8()).toHexString().toStdString();
+		});
 	}
 
 	std::string FromSynthSource::toDisplayString(Synth *synth, bool shortVersion) const
@@ -451,8 +503,10 @@ namespace midikraft {
 
 	std::string FromFileSource::md5(Synth *synth) const
 	{
-		String displayString(toDisplayString(synth, true));
-		return MD5(displayString.toUTF8()).toHexString().toStdString();
+		return cachedMD5(synth, [this, synth]() {
+			String displayString(toDisplayString(synth, true));
+			return MD5(displayString.toUTF8()).toHexString().toStdString();
+		});
 	}
 
 	std::string FromFileSource::toDisplayString(Synth *, bool shortVersion) const
@@ -498,8 +552,11 @@ namespace midikraft {
 	std::string FromBulkImportSource::md5(Synth *synth) const
 	{
 		ignoreUnused(synth);
-		String uuid(fmt::format("Bulk import {}", timestamp_.formatted("%x at %X").toStdString()));
-		return MD5(uuid.toUTF8()).toHexString().toStdString();
+		// Independent of the synth, so always cache it under nullptr
+		return cachedMD5(nullptr, [this]() {
+			String uuid(fmt::format("Bulk import {}", timestamp_.formatted("%x at %X").toStdString()));
+			return MD5(uuid.toUTF8()).toHexString().toStdString();
+		});
 	}
 
 	std::string FromBulkImportSource::toDisplayString(Synth *synth, bool shortVersion) const
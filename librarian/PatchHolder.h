@@ -11,6 +11,7 @@
 #include "Patch.h"
 #include "MidiBankNumber.h"
 #include "AutomaticCategory.h"
+#include "InternedString.h"
 // Turn off warning on unknown pragmas for VC++
 #pragma warning(push)
 #pragma warning(disable: 4068)
@@ -21,6 +22,8 @@
 #pragma warning(pop)
 
 #include <set>
+#include <functional>
+#include <mutex>
 
 namespace midikraft {
 
@@ -48,7 +51,17 @@ namespace midikraft {
 		static bool isEditBufferImport(std::shared_ptr<SourceInfo> sourceInfo);
 
 	protected:
+		// The source infos are immutable, so the md5 only depends on the synth asked for it. Remember the last one calculated
+		std::string cachedMD5(Synth *synth, std::function<std::string()> calculate) const;
+
 		std::string jsonRep_;
+
+	private:
+		struct CachedMD5 {
+			Synth *synth;
+			std::string md5;
+		};
+		mutable std::shared_ptr<CachedMD5 const> md5_; // Used with std::atomic_load/store, as one source info is shared by many patches
 	};
 
 	class FromSynthSource : public SourceInfo {
@@ -112,6 +125,11 @@ namespace midikraft {
 			std::shared_ptr<AutomaticCategory> detector = nullptr);
 
 		std::shared_ptr<DataFile> patch() const;
+		// Install a loader that will provide the DataFile on first access to patch(), e.g. to defer loading the sysex from the database
+		// If the fingerprint is already known, pass it in so md5() can answer without loading the data. Copies of the holder share the loader,
+		// it runs only once even when several threads ask at the same time
+		void setLazyPatch(std::function<std::shared_ptr<DataFile>()> loader, std::string const &knownMD5 = "");
+		bool isPatchLoaded() const;
 		Synth *synth() const;
 		std::shared_ptr<Synth> smartSynth() const; // This is for refactoring
 
@@ -140,11 +158,15 @@ namespace midikraft {
 		bool hasCategory(Category const &category) const;
 		void setCategory(Category const &category, bool hasIt);
 		void setCategories(std::set<Category> const &cats);
+		void setCategories(CategorySet const &cats);
 		void clearCategories();
 		std::set<Category> categories() const;
+		CategorySet const &categorySet() const;
 		std::set<Category> userDecisionSet() const;
+		CategorySet const &userDecisionCategorySet() const;
 		void setUserDecision(Category const &clicked);
 		void setUserDecisions(std::set<Category> const &cats);
+		void setUserDecisions(CategorySet const &cats);
 
 		std::shared_ptr<SourceInfo> sourceInfo() const;
 
@@ -162,14 +184,22 @@ namespace midikraft {
 		static bool dragItemIsList(nlohmann::json const& dragInfo);
 
 	private:
-		std::shared_ptr<DataFile> patch_;
+		struct LazyPatch {
+			std::mutex lock;
+			std::function<std::shared_ptr<DataFile>()> loader; // Cleared once it has run
+			std::shared_ptr<DataFile> patch;
+			std::string knownMD5; // Only used as long as the patch is not loaded, after that the fingerprint cached on the DataFile is used
+		};
+
+		std::shared_ptr<DataFile> patch_; // Not used while lazy_ is set
+		std::shared_ptr<LazyPatch> lazy_;
 		std::weak_ptr<Synth> synth_;
 		std::string name_;
-		std::string sourceId_;
+		InternedString sourceId_; // The import, shared by all patches that came in with it
 		Favorite isFavorite_;
 		bool isHidden_;
-		std::set<Category> categories_;
-		std::set<Category> userDecisions_;
+		CategorySet categories_;
+		CategorySet userDecisions_;
 		MidiBankNumber bankNumber_;
 		MidiProgramNumber patchNumber_;
 		std::shared_ptr<SourceInfo> sourceInfo_;
@@ -8,7 +8,9 @@
 
 #include "SynthBank.h"
 
+#include "Base64Codec.h"
 #include "Logger.h"
+#include "OperationStatistics.h"
 #include "Sysex.h"
 
 #include <fmt/format.h>
@@ -16,8 +18,9 @@
 
 #include "JsonSerialization.h"
 
-#include <fstream>
-#include <ostream>
+#include <cstring>
+#include <istream>
+#include <streambuf>
 
 namespace {
 
@@ -37,6 +40,45 @@ const char *kFileFormat = "FileFormat";
 const char *kPIF = "PatchInterchangeFormat";
 const char *kVersion = "Version";
 
+// Lets nlohmann read from a JUCE InputStream, so the parser can pull a compressed file through the decompressor chunk by chunk
+class InputStreamBuffer : public std::streambuf {
+public:
+	explicit InputStreamBuffer(juce::InputStream &source) : source_(source), buffer_(1 << 16) {
+	}
+
+protected:
+	int_type underflow() override {
+		if (gptr() < egptr()) {
+			return traits_type::to_int_type(*gptr());
+		}
+		int bytesRead = source_.read(buffer_.data(), (int)buffer_.size());
+		if (bytesRead <= 0) {
+			return traits_type::eof();
+		}
+		setg(buffer_.data(), buffer_.data(), buffer_.data() + bytesRead);
+		return traits_type::to_int_type(*gptr());
+	}
+
+private:
+	juce::InputStream &source_;
+	std::vector<char> buffer_;
+};
+
+const char *kBinaryArchiveExtension = ".kkarchive";
+const char kArchiveMagic[] = "KKPIFBIN";
+const char kArchiveEndMagic[] = "KKPIFEND";
+
+bool startsWithArchiveMagic(juce::File const &file) {
+	juce::FileInputStream in(file);
+	char magic[8];
+	return in.openedOk() && in.read(magic, 8) == 8 && memcmp(magic, kArchiveMagic, 8) == 0;
+}
+
+bool startsWithGzipMagic(juce::File const &file) {
+	juce::FileInputStream in(file);
+	return in.openedOk() && in.readByte() == (char)0x1f && in.readByte() == (char)0x8b;
+}
+
 }
 
 namespace midikraft {
@@ -72,321 +114,867 @@ namespace midikraft {
 	*
 	*   0  - This file format has no header information and is just an array of Patches. It was exported by the Rev2SequencerTool, the KnobKraft Orm predecessor, to export data stored in the AWS DynamoDB
 	*   1  - First version with header containing name of file format and version number, else it is identical to version 0 containing the patches in the field "Library" (to mark it is not a bank!)
+	*
+	* The file is parsed as a stream, each patch object is turned into a PatchHolder and dropped from the document as soon as it is complete.
+	* So memory use stays flat no matter how many patches the file contains. Gzip compressed files are decompressed on the fly. Only if the Library comes before the Header, which our own writer never does,
+	* the patches are kept until the header has been checked.
 	*/
 
-	std::vector<midikraft::PatchHolder> PatchInterchangeFormat::load(std::map<std::string, std::shared_ptr<Synth>> activeSynths, std::string const &filename, std::shared_ptr<AutomaticCategory> detector)
-	{
-		std::vector<midikraft::PatchHolder> result;
+	static bool checkHeader(nlohmann::json const& header) {
+		if (!header.is_object() || !header.contains(kFileFormat) || !header[kFileFormat].is_string()) {
+			spdlog::error("File header block has no string member to define FileFormat. Aborting.");
+			return false;
+		}
+		if (header[kFileFormat] != kPIF) {
+			spdlog::error("File header defines different FileFormat than PatchInterchangeFormat. Aborting.");
+			return false;
+		}
+		if (!header.contains(kVersion) || !header[kVersion].is_number_integer()) {
+			spdlog::error("File header has no integer-values member defining file Version. Aborting.");
+			return false;
+		}
+		// Header all good. All versions so far only differ in where the patches are, which the reader tells from the structure
+		return true;
+	}
 
-		// Check if file exists
-		File pif(filename);
-		auto fileSource = std::make_shared<FromFileSource>(pif.getFileName().toStdString(), pif.getFullPathName().toStdString(), MidiProgramNumber::invalidProgram());
-		if (pif.existsAsFile()) {
-			FileInputStream in(pif);
-			String content = in.readEntireStreamAsString();
-
-			// Try to parse it!
-			try {
-				auto jsonDoc = nlohmann::json::parse(content.toStdString());
-
-				int version = 0;
-				if (jsonDoc.is_object()) {
-					if (!jsonDoc.contains(kHeader)) {
-						spdlog::error("This is not a PatchInterchangeFormat JSON file - no header defined. Aborting.");
-						return {};
-					}
-					nlohmann::json header;
-					if (jsonDoc[kHeader].is_object()) {
-						// Proper format, use the header object, not the manually hacked header which was needed to get the files back into version 1.11.0
-						// Eventually, the header = jsonDoc special case should be removed again.
-						header = jsonDoc[kHeader];
-					}
-					if (!header.contains(kFileFormat) || !header[kFileFormat].is_string()) {
-						spdlog::error("File header block has no string member to define FileFormat. Aborting.");
-						return {};
-					}
-					if (header[kFileFormat] != kPIF) {
-						spdlog::error("File header defines different FileFormat than PatchInterchangeFormat. Aborting.");
-						return {};
+	// What the interchange formats store about a patch besides its sysex
+	struct PatchMetadata {
+		std::string name;
+		Favorite favorite;
+		MidiBankNumber bank;
+		MidiProgramNumber place;
+		std::vector<Category> categories;
+		std::vector<Category> nonCategories;
+		std::shared_ptr<SourceInfo> sourceInfo;
+		std::string comment;
+	};
+
+	static bool patchFromSysex(std::shared_ptr<Synth> activeSynth, MemoryBlock const& sysexData, PatchMetadata const& metadata, std::shared_ptr<AutomaticCategory> detector, std::shared_ptr<SourceInfo> fileSource, PatchHolder& outPatch) {
+		auto messages = Sysex::memoryBlockToMessages(sysexData);
+		auto patches = activeSynth->loadSysex(messages);
+		//jassert(patches.size() == 1);
+		if (patches.size() == 1) {
+			PatchHolder holder(activeSynth, fileSource, patches[0], detector);
+			holder.setFavorite(metadata.favorite);
+			holder.setBank(metadata.bank);
+			holder.setPatchNumber(metadata.place);
+			holder.setName(metadata.name);
+			for (const auto& cat : metadata.categories) {
+				holder.setCategory(cat, true);
+				holder.setUserDecision(cat); // All Categories loaded via PatchInterchangeFormat are considered user decisions
+			}
+			for (const auto& noncat : metadata.nonCategories) {
+				holder.setUserDecision(noncat); // A Category mentioned here says it might not be present, but that is a user decision!
+			}
+			if (metadata.sourceInfo) {
+				holder.setSourceInfo(metadata.sourceInfo);
+			}
+			holder.setComment(metadata.comment);
+			outPatch = holder;
+			return true;
+		}
+		return false;
+	}
+
+	static bool patchFromJson(std::map<std::string, std::shared_ptr<Synth>> const& activeSynths, nlohmann::json const& item, std::shared_ptr<AutomaticCategory> detector, std::shared_ptr<SourceInfo> fileSource, PatchHolder& outPatch) {
+		if (!item.is_object()) {
+			spdlog::warn("Skipping patch entry which is not a JSON object");
+			return false;
+		}
+		if (!item.contains(kSynth)) {
+			spdlog::warn("Skipping patch which has no 'Synth' field");
+			return false;
+		}
+		std::string synthname = item[kSynth];
+		auto found = activeSynths.find(synthname);
+		if (found == activeSynths.end()) {
+			spdlog::warn("Skipping patch which is for synth {} and not for any present in the list given", synthname);
+			return false;
+		}
+		auto activeSynth = found->second;
+		if (!item.contains(kName)) {
+			spdlog::warn("Skipping patch which has no 'Name' field");
+			return false;
+		}
+		std::string patchName = item[kName]; //TODO this is not robust, as it might have a non-string type
+		if (!item.contains(kSysex)) {
+			spdlog::warn("Skipping patch {} which has no 'Sysex' field", patchName);
+			return false;
+		}
+
+		// Optional fields!
+		Favorite fav;
+		if (item.contains(kFavorite)) {
+			if (item[kFavorite].is_number_integer()) {
+				fav = Favorite(item[kFavorite] != 0);
+			}
+			else if (item[kFavorite].is_null()) {
+				fav = Favorite(-1);
+			}
+			else {
+				std::string favoriteStr = item[kFavorite];
+				try {
+					bool favorite = std::stoi(favoriteStr) != 0;
+					fav = Favorite(favorite);
+				}
+				catch (std::invalid_argument&) {
+					spdlog::warn("Ignoring favorite information for patch {} because {} does not convert to an integer", patchName, favoriteStr);
+				}
+			}
+		}
+
+		MidiBankNumber bank = MidiBankNumber::invalid();
+		if (item.contains(kBank)) {
+			if (item[kBank].is_number_integer()) {
+				int bankInt = item[kBank];
+				bank = MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(activeSynth, bankInt));
+			}
+			else {
+				std::string bankStr = item[kBank];
+				try {
+					int bankInt = std::stoi(bankStr);
+					bank = MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(activeSynth, bankInt));
+				}
+				catch (std::invalid_argument&) {
+					spdlog::warn("Ignoring MIDI bank information for patch {} because {} does not convert to an integer", patchName, bankStr);
+				}
+			}
+		}
+
+		MidiProgramNumber place = MidiProgramNumber::invalidProgram();
+		if (item.contains(kPlace)) {
+			if (item[kPlace].is_number_integer()) {
+				if (bank.isValid()) {
+					place = MidiProgramNumber::fromZeroBaseWithBank(bank, item[kPlace]);
+				}
+				else {
+					place = MidiProgramNumber::fromZeroBase(item[kPlace]);
+				}
+			}
+			else {
+				std::string placeStr = item[kPlace];
+				try {
+					if (bank.isValid()) {
+						place = MidiProgramNumber::fromZeroBaseWithBank(bank, std::stoi(placeStr));
 					}
-					if (!header.contains(kVersion) || !header[kVersion].is_number_integer()) {
-						spdlog::error("File header has no integer-values member defining file Version. Aborting.");
-						return {};
+					else {
+						place = MidiProgramNumber::fromZeroBase(std::stoi(placeStr));
 					}
-					// Header all good, let's read the Version of the format
-					version = header[kVersion];
 				}
+				catch (std::invalid_argument&) {
+					spdlog::warn("Ignoring MIDI place information for patch {} because {} does not convert to an integer", patchName, placeStr);
+				}
+			}
+		}
 
-				nlohmann::json patchArray;
-				if (version == 0) {
-					// Original version had no header, whole file was an array of patches
-					if (!jsonDoc.is_array()) {
-					}
-					patchArray = jsonDoc;
+		std::vector<Category> categories;
+		if (item.contains(kCategories) && item[kCategories].is_array()) {
+			auto const &cats = item[kCategories];
+			for (auto cat = cats.cbegin(); cat != cats.cend(); cat++) {
+				midikraft::Category category(nullptr);
+				if (findCategory(detector, cat->get<std::string>().c_str(), category)) {
+					categories.push_back(category);
 				}
 				else {
-					// From version 1 on, Patches are stored in a Member Field called "Library"
-					if (jsonDoc.contains(kLibrary) && jsonDoc[kLibrary].is_array()) {
-						patchArray = jsonDoc[kLibrary];
-					}
+					spdlog::warn("Ignoring category {} of patch {} because it is not part of our standard categories!", cat->get<std::string>(), patchName);
 				}
+			}
+		}
 
-				if (patchArray.is_array()) {
-					for (auto item = patchArray.cbegin(); item != patchArray.cend(); item++) {
-						if (!item->contains(kSynth)) {
-							spdlog::warn("Skipping patch which has no 'Synth' field");
-							continue;
-						}
-						std::string synthname = (*item)[kSynth];
-						if (activeSynths.find(synthname) == activeSynths.end()) {
-							spdlog::warn("Skipping patch which is for synth {} and not for any present in the list given", synthname);
-							continue;
-						}
-						auto activeSynth = activeSynths[synthname];
-						if (!item->contains(kName)) {
-							spdlog::warn("Skipping patch which has no 'Name' field");
-							continue;
-						}
-						std::string patchName = (*item)[kName]; //TODO this is not robust, as it might have a non-string type
-						if (!item->contains(kSysex)) {
-							spdlog::warn("Skipping patch {} which has no 'Sysex' field", patchName);
-							continue;
-						}
-
-						// Optional fields!
-						Favorite fav;
-						if (item->contains(kFavorite)) {
-							if ((*item)[kFavorite].is_number_integer()) {
-								fav = Favorite((*item)[kFavorite] != 0);
-							}
-							else if ((*item)[kFavorite].is_null()) {
-								fav = Favorite(-1);
-							}
-							else {
-								std::string favoriteStr = (*item)[kFavorite];
-								try {
-									bool favorite = std::stoi(favoriteStr) != 0;
-									fav = Favorite(favorite);
-								}
-								catch (std::invalid_argument&) {
-									spdlog::warn("Ignoring favorite information for patch {} because {} does not convert to an integer", patchName, favoriteStr);
-								}
-							}
-						}
-
-						MidiBankNumber bank = MidiBankNumber::invalid();
-						if (item->contains(kBank)) {
-							if ((*item)[kBank].is_number_integer()) {
-								int bankInt = (*item)[kBank];
-								bank = MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(activeSynth, bankInt));
-							}
-							else {
-								std::string bankStr = (*item)[kBank];
-								try {
-									int bankInt = std::stoi(bankStr);
-									bank = MidiBankNumber::fromZeroBase(bankInt, SynthBank::numberOfPatchesInBank(activeSynth, bankInt));
-								}
-								catch (std::invalid_argument&) {
-									spdlog::warn("Ignoring MIDI bank information for patch {} because {} does not convert to an integer", patchName, bankStr);
-								}
-							}
-						}
-
-						MidiProgramNumber place = MidiProgramNumber::invalidProgram();
-						if (item->contains(kPlace)) {
-							if ((*item)[kPlace].is_number_integer()) {
-								if (bank.isValid()) {
-									place = MidiProgramNumber::fromZeroBaseWithBank(bank, (*item)[kPlace]);
-								}
-								else {
-									place = MidiProgramNumber::fromZeroBase((*item)[kPlace]);
-								}
-							}
-							else {
-								std::string placeStr = (*item)[kPlace];
-								try {
-									if (bank.isValid()) {
-										place = MidiProgramNumber::fromZeroBaseWithBank(bank, std::stoi(placeStr));
-									}
-									else {
-										place = MidiProgramNumber::fromZeroBase(std::stoi(placeStr));
-									}
-								}
-								catch (std::invalid_argument&) {
-									spdlog::warn("Ignoring MIDI place information for patch {} because {} does not convert to an integer", patchName, placeStr);
-								}
-							}
-						}
-
-						std::vector<Category> categories;
-						if (item->contains(kCategories) && (*item)[kCategories].is_array()) {
-							auto cats = (*item)[kCategories];
-							for (auto cat = cats.cbegin(); cat != cats.cend(); cat++) {
-								midikraft::Category category(nullptr);
-								if (findCategory(detector, cat->get<std::string>().c_str(), category)) {
-									categories.push_back(category);
-								}
-								else {
-									spdlog::warn("Ignoring category {} of patch {} because it is not part of our standard categories!", cat->get<std::string>(), patchName);
-								}
-							}
-						}
-
-						std::vector<Category> nonCategories;
-						if (item->contains(kNonCategories) && item->at(kNonCategories).is_array()) {
-							auto cats = (*item)[kNonCategories];
-							for (auto cat = cats.cbegin(); cat != cats.cend(); cat++) {
-								midikraft::Category category(nullptr);
-								if (findCategory(detector, cat->get<std::string>().c_str(), category)) {
-									nonCategories.push_back(category);
-								}
-								else {
-									spdlog::warn("Ignoring non-category {} of patch {} because it is not part of our standard categories!", cat->get<std::string>(), patchName);
-								}
-							}
-						}
-
-						std::shared_ptr<midikraft::SourceInfo> importInfo;
-						if (item->contains(kSourceInfo)) {
-							if ((*item)[kSourceInfo].is_string())
-								importInfo = SourceInfo::fromString(activeSynth, (*item)[kSourceInfo]);
-							else
-								importInfo = SourceInfo::fromString(activeSynth, (*item)[kSourceInfo].dump());
-						}
-
-						std::string comment;
-						if (item->contains(kComment)) {
-							comment = (*item)[kComment];
-						}
-
-						// All mandatory fields found, we can parse the data!
-						MemoryBlock sysexData;
-						MemoryOutputStream writeToBlock(sysexData, false);
-						String base64encoded = (*item)[kSysex].get<std::string>();
-						if (Base64::convertFromBase64(writeToBlock, base64encoded)) {
-							writeToBlock.flush();
-							auto messages = Sysex::memoryBlockToMessages(sysexData);
-							auto patches = activeSynth->loadSysex(messages);
-							//jassert(patches.size() == 1);
-							if (patches.size() == 1) {
-								PatchHolder holder(activeSynth, fileSource, patches[0], detector);
-								holder.setFavorite(fav);
-								holder.setBank(bank);
-								holder.setPatchNumber(place);
-								holder.setName(patchName);
-								for (const auto& cat : categories) {
-									holder.setCategory(cat, true);
-									holder.setUserDecision(cat); // All Categories loaded via PatchInterchangeFormat are considered user decisions
-								}
-								for (const auto& noncat : nonCategories) {
-									holder.setUserDecision(noncat); // A Category mentioned here says it might not be present, but that is a user decision!
-								}
-								if (importInfo) {
-									holder.setSourceInfo(importInfo);
-								}
-								holder.setComment(comment);
-								result.push_back(holder);
-							}
-						}
-						else {
-							spdlog::warn("Skipping patch with invalid base64 encoded data!");
-						}
-					}
+		std::vector<Category> nonCategories;
+		if (item.contains(kNonCategories) && item.at(kNonCategories).is_array()) {
+			auto const &cats = item[kNonCategories];
+			for (auto cat = cats.cbegin(); cat != cats.cend(); cat++) {
+				midikraft::Category category(nullptr);
+				if (findCategory(detector, cat->get<std::string>().c_str(), category)) {
+					nonCategories.push_back(category);
 				}
 				else {
-				spdlog::warn("No Library patches defined in PatchInterchangeFormat, no patches loaded");
+					spdlog::warn("Ignoring non-category {} of patch {} because it is not part of our standard categories!", cat->get<std::string>(), patchName);
 				}
 			}
-			catch (nlohmann::json::exception const& e) {
-				spdlog::error("JSON error loading PIF file {}, import aborted: {}", filename, e.what());
+		}
+
+		std::shared_ptr<midikraft::SourceInfo> importInfo;
+		if (item.contains(kSourceInfo)) {
+			if (item[kSourceInfo].is_string())
+				importInfo = SourceInfo::fromString(activeSynth, item[kSourceInfo]);
+			else
+				importInfo = SourceInfo::fromString(activeSynth, item[kSourceInfo].dump());
+		}
+
+		std::string comment;
+		if (item.contains(kComment)) {
+			comment = item[kComment];
+		}
+
+		// All mandatory fields found, we can parse the data!
+		std::vector<uint8> decoded;
+		if (item[kSysex].is_string() && Base64Codec::decode(item[kSysex].get_ref<std::string const&>(), decoded)) {
+			MemoryBlock sysexData(decoded.data(), decoded.size());
+			PatchMetadata metadata{ patchName, fav, bank, place, categories, nonCategories, importInfo, comment };
+			return patchFromSysex(activeSynth, sysexData, metadata, detector, fileSource, outPatch);
+		}
+		else {
+			spdlog::warn("Skipping patch with invalid base64 encoded data!");
+		}
+		return false;
+	}
+
+	static size_t loadBinaryArchive(std::map<std::string, std::shared_ptr<Synth>> const& activeSynths, File const& archive, std::shared_ptr<AutomaticCategory> detector, PatchInterchangeFormat::TPatchLoadedHandler onPatchLoaded);
+
+	// Thrown from the parser callback to stop reading a file that turned out not to be a PatchInterchangeFormat file
+	struct PifAbort {};
+
+	size_t PatchInterchangeFormat::load(std::map<std::string, std::shared_ptr<Synth>> const& activeSynths, std::string const& filename, std::shared_ptr<AutomaticCategory> detector, TPatchLoadedHandler onPatchLoaded)
+	{
+		OperationStatistics::Timer timer(OperationStatistics::global(), "PatchInterchangeFormat::load");
+		// Check if file exists
+		File pif(filename);
+		if (!pif.existsAsFile()) {
+			return 0;
+		}
+		if (startsWithArchiveMagic(pif)) {
+			return loadBinaryArchive(activeSynths, pif, detector, onPatchLoaded);
+		}
+		auto fileSource = std::make_shared<FromFileSource>(pif.getFileName().toStdString(), pif.getFullPathName().toStdString(), MidiProgramNumber::invalidProgram());
+		auto fileInput = std::make_unique<FileInputStream>(pif);
+		if (!fileInput->openedOk()) {
+			spdlog::error("Could not open PIF file {} for reading", filename);
+			return 0;
+		}
+		std::unique_ptr<InputStream> fileStream = std::move(fileInput);
+		if (startsWithGzipMagic(pif)) {
+			// Written by PatchInterchangeFormatWriter with compression turned on
+			fileStream = std::make_unique<GZIPDecompressorInputStream>(fileStream.release(), true, GZIPDecompressorInputStream::gzipFormat);
+		}
+		InputStreamBuffer buffer(*fileStream);
+		std::istream in(&buffer);
+
+		size_t loaded = 0;
+		auto deliver = [&](nlohmann::json const& item) {
+			PatchHolder holder;
+			if (patchFromJson(activeSynths, item, detector, fileSource, holder)) {
+				onPatchLoaded(holder);
+				loaded++;
+			}
+		};
+
+		// Where the patches are depends on the version: the elements of the top level array in version 0, the elements of the "Library" array from version 1 on.
+		// Both is decided by the structure of the document, the parser callback tells us the nesting depth of each event
+		bool topLevelIsArray = false;
+		bool headerChecked = false;
+		bool inLibrary = false;
+		bool libraryFound = false;
+		std::string topLevelKey;
+		std::vector<nlohmann::json> waitingForHeader;
+
+		nlohmann::json::parser_callback_t callback = [&](int depth, nlohmann::json::parse_event_t event, nlohmann::json& parsed) {
+			switch (event) {
+			case nlohmann::json::parse_event_t::array_start:
+				if (depth == 0) {
+					topLevelIsArray = true;
+					libraryFound = true;
+				}
+				else if (depth == 1 && !topLevelIsArray && topLevelKey == kLibrary) {
+					inLibrary = true;
+					libraryFound = true;
+				}
+				break;
+			case nlohmann::json::parse_event_t::array_end:
+				if (depth == 1 && inLibrary) {
+					inLibrary = false;
+				}
+				break;
+			case nlohmann::json::parse_event_t::key:
+				if (depth == 1 && !topLevelIsArray) {
+					topLevelKey = parsed.get<std::string>();
+				}
+				break;
+			case nlohmann::json::parse_event_t::object_end:
+				if (depth == 1 && topLevelIsArray) {
+					deliver(parsed);
+					return false;
+				}
+				if (depth == 1 && topLevelKey == kHeader) {
+					if (!checkHeader(parsed)) {
+						throw PifAbort();
+					}
+					headerChecked = true;
+					for (auto const& item : waitingForHeader) {
+						deliver(item);
+					}
+					waitingForHeader.clear();
+				}
+				else if (depth == 2 && inLibrary) {
+					if (headerChecked) {
+						deliver(parsed);
+					}
+					else {
+						waitingForHeader.push_back(std::move(parsed));
+					}
+					return false;
+				}
+				break;
+			default:
+				break;
+			}
+			return true;
+		};
+
+		// Try to parse it!
+		try {
+			nlohmann::json::parse(in, callback);
+			if (!topLevelIsArray && !headerChecked) {
+				spdlog::error("This is not a PatchInterchangeFormat JSON file - no header defined. Aborting.");
+				return 0;
+			}
+			if (!libraryFound) {
+				spdlog::warn("No Library patches defined in PatchInterchangeFormat, no patches loaded");
 			}
 		}
+		catch (PifAbort&) {
+			// Already logged
+		}
+		catch (nlohmann::json::exception const& e) {
+			spdlog::error("JSON error loading PIF file {}, import aborted: {}", filename, e.what());
+		}
+		return loaded;
+	}
+
+	std::vector<midikraft::PatchHolder> PatchInterchangeFormat::load(std::map<std::string, std::shared_ptr<Synth>> activeSynths, std::string const &filename, std::shared_ptr<AutomaticCategory> detector)
+	{
+		std::vector<midikraft::PatchHolder> result;
+		load(activeSynths, filename, detector, [&result](PatchHolder const& patch) {
+			result.push_back(patch);
+		});
 		return result;
 	}
 
-	void PatchInterchangeFormat::save(std::vector<PatchHolder> const &patches, std::string const &toFilename)
+	static std::vector<uint8> sysexForTransport(PatchHolder const& patch) {
+		auto sysexMessages = patch.synth()->dataFileToSysex(patch.patch(), nullptr);
+		std::vector<uint8> data;
+		// Just concatenate all messages generated into one uint8 array
+		for (auto const& m : sysexMessages) {
+			std::copy(m.getRawData(), m.getRawData() + m.getRawDataSize(), std::back_inserter(data));
+		}
+		return data;
+	}
+
+	static nlohmann::json patchToJson(PatchHolder const& patch) {
+		nlohmann::json patchJson;
+		patchJson[kSynth] = patch.synth()->getName();
+		patchJson[kName] = patch.name();
+		switch (patch.howFavorite().is()) {
+		case Favorite::TFavorite::DONTKNOW:
+			patchJson[kFavorite] = nlohmann::json();
+			break;
+		case Favorite::TFavorite::YES:
+			patchJson[kFavorite] = 1;
+			break;
+		case Favorite::TFavorite::NO:
+			patchJson[kFavorite] = 0;
+			break;
+		default:
+			spdlog::error("Missing code to write Favoriate value of {} to PIF, program error!", static_cast<int>(patch.howFavorite().is()));
+			patchJson[kFavorite] = nlohmann::json();
+		}
+		
+		if (patch.bankNumber().isValid()) {
+			patchJson[kBank] = patch.bankNumber().toZeroBased();
+		}
+		patchJson[kPlace] = patch.patchNumber().toZeroBasedDiscardingBank();
+		auto categoriesSet = patch.categories();
+		auto userDecisions = patch.userDecisionSet();
+		auto userDefinedCategories = category_intersection(categoriesSet, userDecisions);
+		if (!userDefinedCategories.empty()) {
+			// Here is a list of categories to write
+			auto categoryList = nlohmann::json::array();
+			for (auto cat : userDefinedCategories) {
+				categoryList.emplace_back(cat.category());
+			}
+			patchJson[kCategories] = categoryList;
+		}
+		auto userDefinedNonCategories = category_difference(userDecisions, categoriesSet);
+		if (!userDefinedNonCategories.empty()) {
+			// Here is a list of non-categories to write
+			auto nonCategoryList = nlohmann::json::array();
+			for (auto cat : userDefinedNonCategories) {
+				nonCategoryList.emplace_back(cat.category());
+			}
+			patchJson[kNonCategories] = nonCategoryList;
+		}
+
+		if (patch.sourceInfo()) {
+			patchJson[kSourceInfo] = nlohmann::json::parse(patch.sourceInfo()->toString());
+		}
+
+		if (!patch.comment().empty()) {
+			patchJson[kComment] = patch.comment();
+		}
+
+		// Now the fun part, pack the sysex for transport
+		std::string base64encoded = JsonSerialization::dataToString(sysexForTransport(patch));
+		patchJson[kSysex] = base64encoded;
+
+		return patchJson;
+	}
+
+	PatchInterchangeFormatWriter::PatchInterchangeFormatWriter(std::string const& toFilename, bool gzipCompressed) : filename_(toFilename), out_(nullptr), written_(0), ok_(false)
 	{
 		File outputFile(toFilename);
 		if (outputFile.existsAsFile()) {
 			outputFile.deleteFile();
 		}
-
-		nlohmann::json doc;
+		file_ = std::make_unique<FileOutputStream>(outputFile, 1 << 16);
+		if (!file_->openedOk()) {
+			spdlog::error("Could not open {} for writing the PatchInterchangeFormat: {}", toFilename, file_->getStatus().getErrorMessage().toStdString());
+			file_.reset();
+			return;
+		}
+		out_ = file_.get();
+		if (gzipCompressed) {
+			compressor_ = std::make_unique<GZIPCompressorOutputStream>(*file_, 9, GZIPCompressorOutputStream::windowBitsGZIP);
+			out_ = compressor_.get();
+		}
 
 		nlohmann::json header;
 		header[kFileFormat] = kPIF;
 		header[kVersion] = 1;
-		doc[kHeader] = header;
-
-		auto library = nlohmann::json::array();
-		for (auto patch : patches) {
-			nlohmann::json patchJson;
-			patchJson[kSynth] = patch.synth()->getName();
-			patchJson[kName] = patch.name();
-			switch (patch.howFavorite().is()) {
-			case Favorite::TFavorite::DONTKNOW:
-				patchJson[kFavorite] = nlohmann::json();
-				break;
-			case Favorite::TFavorite::YES:
-				patchJson[kFavorite] = 1;
-				break;
-			case Favorite::TFavorite::NO:
-				patchJson[kFavorite] = 0;
-				break;
-			default:
-				spdlog::error("Missing code to write Favoriate value of {} to PIF, program error!", static_cast<int>(patch.howFavorite().is()));
-				patchJson[kFavorite] = nlohmann::json();
-			}
-			
-			if (patch.bankNumber().isValid()) {
-				patchJson[kBank] = patch.bankNumber().toZeroBased();
-			}
-			patchJson[kPlace] = patch.patchNumber().toZeroBasedDiscardingBank();
- 			auto categoriesSet = patch.categories();
-			auto userDecisions = patch.userDecisionSet();
-			auto userDefinedCategories = category_intersection(categoriesSet, userDecisions);
-			if (!userDefinedCategories.empty()) {
-				// Here is a list of categories to write
-				auto categoryList = nlohmann::json::array();
-				for (auto cat : userDefinedCategories) {
-					categoryList.emplace_back(cat.category());
+		// Same layout as dumping the whole document with an indent of 4, only that the Library is written one patch at a time
+		ok_ = writeText(fmt::format("{{\n    \"{}\": {},\n    \"{}\": [", kHeader, indented(header.dump(4), 1), kLibrary));
+	}
+
+	PatchInterchangeFormatWriter::~PatchInterchangeFormatWriter()
+	{
+		finish();
+	}
+
+	bool PatchInterchangeFormatWriter::isOpen() const
+	{
+		return out_ != nullptr && ok_;
+	}
+
+	bool PatchInterchangeFormatWriter::write(PatchHolder const& patch)
+	{
+		if (!isOpen()) {
+			return false;
+		}
+		if (!patch.synth() || !patch.patch()) {
+			spdlog::warn("Skipping patch {} without synth or data, can't write it to the PatchInterchangeFormat", patch.name());
+			return true;
+		}
+		std::string separator = written_ == 0 ? "\n        " : ",\n        ";
+		ok_ = writeText(separator + indented(patchToJson(patch).dump(4), 2));
+		if (ok_) {
+			written_++;
+		}
+		return ok_;
+	}
+
+	bool PatchInterchangeFormatWriter::finish()
+	{
+		if (out_ == nullptr) {
+			return ok_;
+		}
+		if (ok_) {
+			ok_ = writeText(written_ == 0 ? "]\n}\n" : "\n    ]\n}\n");
+		}
+		// The compressor only writes its last block when destroyed
+		compressor_.reset();
+		out_ = nullptr;
+		file_->flush();
+		if (file_->getStatus().failed()) {
+			spdlog::error("Error writing PatchInterchangeFormat file {}: {}", filename_, file_->getStatus().getErrorMessage().toStdString());
+			ok_ = false;
+		}
+		file_.reset();
+		return ok_;
+	}
+
+	size_t PatchInterchangeFormatWriter::patchesWritten() const
+	{
+		return written_;
+	}
+
+	bool PatchInterchangeFormatWriter::writeText(std::string const& text)
+	{
+		if (!out_->write(text.data(), text.size())) {
+			spdlog::error("Error writing PatchInterchangeFormat file {}, disk full?", filename_);
+			return false;
+		}
+		return true;
+	}
+
+	std::string PatchInterchangeFormatWriter::indented(std::string const& json, int level)
+	{
+		std::string indent = "\n" + std::string(4 * level, ' ');
+		std::string result;
+		result.reserve(json.size());
+		for (char c : json) {
+			if (c == '\n') {
+				result += indent;
+			}
+			else {
+				result.push_back(c);
+			}
+		}
+		return result;
+	}
+
+	/*
+	* The binary archive format, for fast backup and restore of a whole library. Same content as the JSON format, but the sysex is stored raw,
+	* and synth and category names only once in a string table at the end of the file. All numbers are little endian, counts and ids are
+	* written as JUCE compressed ints.
+	*
+	*   "KKPIFBIN", int32 version, int32 flags (bit 0: records are zlib compressed)
+	*   Records, each an int32 length followed by the record. A record contains
+	*     synth (string id), name, favorite, bank (+1, 0 is none), place, categories and non-categories (count, string ids),
+	*     source info (empty for none), comment and the sysex (length, raw bytes). Strings inline are a length followed by the UTF-8 bytes
+	*   Footer: string table (count, strings), the index (int64 count, int64 file offset of each record)
+	*   Trailer: int64 file offset of the footer, "KKPIFEND"
+	*
+	* The string table and the index go last so the writer can stream, the reader seeks to the trailer first.
+	*/
+	const int kArchiveVersion = 1;
+	const int kArchiveCompressed = 1;
+
+	static void writeArchiveString(OutputStream& out, std::string const& text) {
+		out.writeCompressedInt((int)text.size());
+		out.write(text.data(), text.size());
+	}
+
+	static bool readArchiveString(InputStream& in, std::string& outText) {
+		int length = in.readCompressedInt();
+		if (length < 0 || length > in.getNumBytesRemaining()) {
+			return false;
+		}
+		outText.resize((size_t)length);
+		return length == 0 || in.read(&outText[0], length) == length;
+	}
+
+	bool PatchInterchangeFormat::isBinaryArchive(std::string const& filename)
+	{
+		return File(filename).hasFileExtension(kBinaryArchiveExtension);
+	}
+
+	PatchArchiveWriter::PatchArchiveWriter(std::string const& toFilename, bool compressed) : filename_(toFilename), compressed_(compressed), ok_(false)
+	{
+		File outputFile(toFilename);
+		if (outputFile.existsAsFile()) {
+			outputFile.deleteFile();
+		}
+		file_ = std::make_unique<FileOutputStream>(outputFile, 1 << 16);
+		if (!file_->openedOk()) {
+			spdlog::error("Could not open {} for writing the patch archive: {}", toFilename, file_->getStatus().getErrorMessage().toStdString());
+			file_.reset();
+			return;
+		}
+		ok_ = file_->write(kArchiveMagic, 8) && file_->writeInt(kArchiveVersion) && file_->writeInt(compressed ? kArchiveCompressed : 0);
+	}
+
+	PatchArchiveWriter::~PatchArchiveWriter()
+	{
+		finish();
+	}
+
+	bool PatchArchiveWriter::isOpen() const
+	{
+		return file_ != nullptr && ok_;
+	}
+
+	bool PatchArchiveWriter::write(PatchHolder const& patch)
+	{
+		if (!isOpen()) {
+			return false;
+		}
+		if (!patch.synth() || !patch.patch()) {
+			spdlog::warn("Skipping patch {} without synth or data, can't write it to the patch archive", patch.name());
+			return true;
+		}
+
+		MemoryOutputStream record;
+		record.writeCompressedInt(stringId(patch.synth()->getName()));
+		writeArchiveString(record, patch.name());
+		record.writeCompressedInt(static_cast<int>(patch.howFavorite().is()));
+		record.writeCompressedInt(patch.bankNumber().isValid() ? patch.bankNumber().toZeroBased() + 1 : 0);
+		record.writeCompressedInt(patch.patchNumber().toZeroBasedDiscardingBank());
+		// Like the JSON format, only the categories that are user decisions are stored. The others will be found again by the detector when loading
+		auto categoriesSet = patch.categories();
+		auto userDecisions = patch.userDecisionSet();
+		for (auto const& categories : { category_intersection(categoriesSet, userDecisions), category_difference(userDecisions, categoriesSet) }) {
+			record.writeCompressedInt((int)categories.size());
+			for (auto const& cat : categories) {
+				record.writeCompressedInt(stringId(cat.category()));
+			}
+		}
+		writeArchiveString(record, patch.sourceInfo() ? patch.sourceInfo()->toString() : std::string());
+		writeArchiveString(record, patch.comment());
+		auto sysex = sysexForTransport(patch);
+		record.writeCompressedInt((int)sysex.size());
+		record.write(sysex.data(), sysex.size());
+
+		if (compressed_) {
+			MemoryOutputStream packed;
+			{
+				GZIPCompressorOutputStream zipper(packed, 9);
+				zipper.write(record.getData(), record.getDataSize());
+			}
+			return writeRecord(packed.getData(), packed.getDataSize());
+		}
+		return writeRecord(record.getData(), record.getDataSize());
+	}
+
+	bool PatchArchiveWriter::finish()
+	{
+		if (!file_) {
+			return ok_;
+		}
+		if (ok_) {
+			int64 footerOffset = file_->getPosition();
+			file_->writeCompressedInt((int)strings_.size());
+			for (auto const& text : strings_) {
+				writeArchiveString(*file_, text);
+			}
+			file_->writeInt64((int64)offsets_.size());
+			for (auto offset : offsets_) {
+				file_->writeInt64(offset);
+			}
+			file_->writeInt64(footerOffset);
+			file_->write(kArchiveEndMagic, 8);
+		}
+		file_->flush();
+		if (file_->getStatus().failed()) {
+			spdlog::error("Error writing patch archive {}: {}", filename_, file_->getStatus().getErrorMessage().toStdString());
+			ok_ = false;
+		}
+		file_.reset();
+		return ok_;
+	}
+
+	size_t PatchArchiveWriter::patchesWritten() const
+	{
+		return offsets_.size();
+	}
+
+	int PatchArchiveWriter::stringId(std::string const& text)
+	{
+		auto found = stringIds_.find(text);
+		if (found != stringIds_.end()) {
+			return found->second;
+		}
+		int id = (int)strings_.size();
+		strings_.push_back(text);
+		stringIds_[text] = id;
+		return id;
+	}
+
+	bool PatchArchiveWriter::writeRecord(void const* data, size_t size)
+	{
+		int64 offset = file_->getPosition();
+		ok_ = file_->writeInt((int)size) && file_->write(data, size);
+		if (!ok_) {
+			spdlog::error("Error writing patch archive {}, disk full?", filename_);
+			return false;
+		}
+		offsets_.push_back(offset);
+		return true;
+	}
+
+	// The patch records can be read in any order through the index, this goes through them front to back
+	static size_t loadBinaryArchive(std::map<std::string, std::shared_ptr<Synth>> const& activeSynths, File const& archive, std::shared_ptr<AutomaticCategory> detector, PatchInterchangeFormat::TPatchLoadedHandler onPatchLoaded) {
+		FileInputStream in(archive);
+		if (!in.openedOk()) {
+			spdlog::error("Could not open patch archive {} for reading", archive.getFullPathName().toStdString());
+			return 0;
+		}
+		char magic[8];
+		int64 fileSize = in.getTotalLength();
+		if (fileSize < 40 || in.read(magic, 8) != 8 || memcmp(magic, kArchiveMagic, 8) != 0) {
+			spdlog::error("File {} is not a patch archive, aborting", archive.getFullPathName().toStdString());
+			return 0;
+		}
+		int version = in.readInt();
+		int flags = in.readInt();
+		if (version > kArchiveVersion) {
+			spdlog::error("Patch archive {} has version {}, which is newer than this program understands. Aborting.", archive.getFullPathName().toStdString(), version);
+			return 0;
+		}
+
+		// Footer first, it has the string table and the index
+		in.setPosition(fileSize - 16);
+		int64 footerOffset = in.readInt64();
+		if (in.read(magic, 8) != 8 || memcmp(magic, kArchiveEndMagic, 8) != 0 || footerOffset < 16 || footerOffset > fileSize - 16) {
+			spdlog::error("Patch archive {} is truncated, the index is missing. Aborting.", archive.getFullPathName().toStdString());
+			return 0;
+		}
+		in.setPosition(footerOffset);
+		// Every string takes at least the byte of its length, so a count beyond the bytes left can't be right and must not be allocated
+		int stringCount = in.readCompressedInt();
+		if (stringCount < 0 || stringCount > in.getNumBytesRemaining()) {
+			spdlog::error("Patch archive {} has a broken string table. Aborting.", archive.getFullPathName().toStdString());
+			return 0;
+		}
+		std::vector<std::string> strings((size_t)stringCount);
+		for (auto& text : strings) {
+			if (!readArchiveString(in, text)) {
+				spdlog::error("Patch archive {} has a broken string table. Aborting.", archive.getFullPathName().toStdString());
+				return 0;
+			}
+		}
+		int64 count = in.readInt64();
+		if (count < 0 || count * 8 > in.getNumBytesRemaining()) {
+			spdlog::error("Patch archive {} has a broken index. Aborting.", archive.getFullPathName().toStdString());
+			return 0;
+		}
+		std::vector<int64> offsets((size_t)count);
+		for (auto& offset : offsets) {
+			offset = in.readInt64();
+		}
+
+		// Find the categories only once per name
+		std::map<int, std::shared_ptr<Category>> categoryForId;
+		auto lookupCategory = [&](int id, std::string const& patchName, std::vector<Category>& outCategories) {
+			if (id < 0 || id >= (int)strings.size()) {
+				return;
+			}
+			auto found = categoryForId.find(id);
+			if (found == categoryForId.end()) {
+				midikraft::Category category(nullptr);
+				std::shared_ptr<Category> known;
+				if (findCategory(detector, strings[id].c_str(), category)) {
+					known = std::make_shared<Category>(category);
 				}
-				patchJson[kCategories] = categoryList;
-			}
-			auto userDefinedNonCategories = category_difference(userDecisions, categoriesSet);
-			if (!userDefinedNonCategories.empty()) {
-				// Here is a list of non-categories to write
-				auto nonCategoryList = nlohmann::json::array();
-				for (auto cat : userDefinedNonCategories) {
-					nonCategoryList.emplace_back(cat.category());
+				found = categoryForId.emplace(id, known).first;
+			}
+			if (found->second) {
+				outCategories.push_back(*found->second);
+			}
+			else {
+				spdlog::warn("Ignoring category {} of patch {} because it is not part of our standard categories!", strings[id], patchName);
+			}
+		};
+
+		auto fileSource = std::make_shared<FromFileSource>(archive.getFileName().toStdString(), archive.getFullPathName().toStdString(), MidiProgramNumber::invalidProgram());
+		size_t loaded = 0;
+		MemoryBlock recordData;
+		for (auto offset : offsets) {
+			if (offset < 16 || offset >= footerOffset || !in.setPosition(offset)) {
+				spdlog::warn("Skipping patch with invalid index entry in patch archive");
+				continue;
+			}
+			int size = in.readInt();
+			if (size < 0 || offset + 4 + size > footerOffset) {
+				spdlog::warn("Skipping broken patch record in patch archive");
+				continue;
+			}
+			recordData.setSize((size_t)size);
+			if (in.read(recordData.getData(), size) != size) {
+				continue;
+			}
+			if (flags & kArchiveCompressed) {
+				MemoryBlock unpacked;
+				{
+					MemoryInputStream packed(recordData, false);
+					GZIPDecompressorInputStream unzipper(packed);
+					MemoryOutputStream out(unpacked, false);
+					out.writeFromInputStream(unzipper, -1);
 				}
-				patchJson[kNonCategories] = nonCategoryList;
+				recordData.swapWith(unpacked);
 			}
 
-			if (patch.sourceInfo()) {
-				patchJson[kSourceInfo] = nlohmann::json::parse(patch.sourceInfo()->toString());
+			MemoryInputStream record(recordData, false);
+			int synthId = record.readCompressedInt();
+			if (synthId < 0 || synthId >= (int)strings.size()) {
+				spdlog::warn("Skipping patch with invalid synth in patch archive");
+				continue;
+			}
+			auto synth = activeSynths.find(strings[synthId]);
+			if (synth == activeSynths.end()) {
+				spdlog::warn("Skipping patch which is for synth {} and not for any present in the list given", strings[synthId]);
+				continue;
+			}
+			PatchMetadata metadata{ "", Favorite(), MidiBankNumber::invalid(), MidiProgramNumber::invalidProgram(), {}, {}, nullptr, "" };
+			if (!readArchiveString(record, metadata.name)) {
+				spdlog::warn("Skipping broken patch record in patch archive");
+				continue;
+			}
+			metadata.favorite = Favorite(record.readCompressedInt());
+			int bankPlusOne = record.readCompressedInt();
+			if (bankPlusOne > 0) {
+				metadata.bank = MidiBankNumber::fromZeroBase(bankPlusOne - 1, SynthBank::numberOfPatchesInBank(synth->second, bankPlusOne - 1));
+			}
+			int place = record.readCompressedInt();
+			metadata.place = metadata.bank.isValid() ? MidiProgramNumber::fromZeroBaseWithBank(metadata.bank, place) : MidiProgramNumber::fromZeroBase(place);
+			for (auto categories : { &metadata.categories, &metadata.nonCategories }) {
+				int categoryCount = record.readCompressedInt();
+				for (int i = 0; i < categoryCount && !record.isExhausted(); i++) {
+					lookupCategory(record.readCompressedInt(), metadata.name, *categories);
+				}
+			}
+			std::string sourceInfo;
+			std::string sysexString;
+			if (!readArchiveString(record, sourceInfo) || !readArchiveString(record, metadata.comment) || !readArchiveString(record, sysexString)) {
+				spdlog::warn("Skipping broken patch record {} in patch archive", metadata.name);
+				continue;
+			}
+			if (!sourceInfo.empty()) {
+				metadata.sourceInfo = SourceInfo::fromString(synth->second, sourceInfo);
 			}
+			PatchHolder holder;
+			if (patchFromSysex(synth->second, MemoryBlock(sysexString.data(), sysexString.size()), metadata, detector, fileSource, holder)) {
+				onPatchLoaded(holder);
+				loaded++;
+			}
+		}
+		return loaded;
+	}
 
-			if (!patch.comment().empty()) {
-				patchJson[kComment] = patch.comment();
+	// Both writers have the same interface, there is no need for a common base class
+	template<typename TWriter> static bool writePatches(TWriter& writer, std::vector<PatchHolder> const& patches) {
+		for (auto const& patch : patches) {
+			if (!writer.write(patch)) {
+				return false;
 			}
+		}
+		return true;
+	}
 
-			// Now the fun part, pack the sysex for transport
-			auto sysexMessages = patch.synth()->dataFileToSysex(patch.patch(), nullptr);
-			std::vector<uint8> data;
-			// Just concatenate all messages generated into one uint8 array
-			for (auto m : sysexMessages) {
-				std::copy(m.getRawData(), m.getRawData() + m.getRawDataSize(), std::back_inserter(data));
+	template<typename TWriter> static bool writeAll(TWriter& writer, PatchInterchangeFormat::TPatchSource nextPatches) {
+		std::vector<PatchHolder> chunk;
+		while (writer.isOpen() && nextPatches(chunk)) {
+			if (!writePatches(writer, chunk)) {
+				break;
 			}
-			std::string base64encoded = JsonSerialization::dataToString(data);
-			patchJson[kSysex] = base64encoded;
+			chunk.clear();
+		}
+		return writer.finish();
+	}
 
-			library.emplace_back(patchJson);
+	void PatchInterchangeFormat::save(std::vector<PatchHolder> const &patches, std::string const &toFilename)
+	{
+		OperationStatistics::Timer timer(OperationStatistics::global(), "PatchInterchangeFormat::save");
+		if (isBinaryArchive(toFilename)) {
+			PatchArchiveWriter writer(toFilename);
+			writePatches(writer, patches);
+			writer.finish();
 		}
-		doc[kLibrary] = library;
+		else {
+			PatchInterchangeFormatWriter writer(toFilename);
+			writePatches(writer, patches);
+			writer.finish();
+		}
+	}
 
-		std::ofstream o(toFilename);
-		o << std::setw(4) << doc << std::endl;
-}
+	bool PatchInterchangeFormat::save(TPatchSource nextPatches, std::string const& toFilename, bool compressed)
+	{
+		OperationStatistics::Timer timer(OperationStatistics::global(), "PatchInterchangeFormat::save");
+		if (isBinaryArchive(toFilename)) {
+			PatchArchiveWriter writer(toFilename, compressed);
+			return writeAll(writer, nextPatches);
+		}
+		PatchInterchangeFormatWriter writer(toFilename, compressed);
+		return writeAll(writer, nextPatches);
+	}
 
 }
@@ -15,8 +15,70 @@ namespace midikraft {
 
 	class PatchInterchangeFormat {
 	public:
+		typedef std::function<void(PatchHolder const &patch)> TPatchLoadedHandler;
+
+		// Streams the file and hands over each patch as soon as it is decoded, e.g. to PatchImportPipeline::receiver(). Returns the number of patches loaded.
+		// Reads the JSON format, gzipped or not, and the binary archive format, whatever the file contains
+		static size_t load(std::map<std::string, std::shared_ptr<Synth>> const &activeSynths, std::string const &filename, std::shared_ptr<AutomaticCategory> detector, TPatchLoadedHandler onPatchLoaded);
 		static std::vector<PatchHolder> load(std::map<std::string, std::shared_ptr<Synth>> activeSynths, std::string const &filename, std::shared_ptr<AutomaticCategory> detector);
+		// Files with the extension .kkarchive are written in the binary archive format, all others as JSON
 		static void save(std::vector<PatchHolder> const &patches, std::string const &toFilename);
+
+		// Pulls the patches to write chunk by chunk, return false when there are no more. E.g. page through PatchDatabase::getPatches with a PatchPageToken,
+		// so a whole database can be exported without ever having it in memory. Returns false if the file could not be written completely
+		typedef std::function<bool(std::vector<PatchHolder> &nextChunk)> TPatchSource;
+		static bool save(TPatchSource nextPatches, std::string const &toFilename, bool compressed);
+
+		static bool isBinaryArchive(std::string const &filename);
+	};
+
+	// Writes a PatchInterchangeFormat file one patch at a time through a buffered file stream, optionally gzip compressed. load() detects compressed files by themselves
+	class PatchInterchangeFormatWriter {
+	public:
+		PatchInterchangeFormatWriter(std::string const &toFilename, bool gzipCompressed = false);
+		~PatchInterchangeFormatWriter(); // Calls finish()
+
+		bool isOpen() const; // False if the file could not be created, or a write has failed
+		bool write(PatchHolder const &patch);
+		bool finish(); // Closes the Library and the file. Returns false if anything went wrong on the way
+		size_t patchesWritten() const;
+
+	private:
+		bool writeText(std::string const &text);
+		static std::string indented(std::string const &json, int level);
+
+		std::string filename_;
+		std::unique_ptr<FileOutputStream> file_;
+		std::unique_ptr<GZIPCompressorOutputStream> compressor_;
+		OutputStream *out_;
+		size_t written_;
+		bool ok_;
+	};
+
+	// Writes the binary archive format: raw sysex instead of base64, names of synths and categories only once in a string table, and an index
+	// of all records at the end. Much smaller and faster to load than JSON, meant for backing up and restoring whole libraries.
+	// With compression turned on, each record is zlib compressed on its own so the index stays usable
+	class PatchArchiveWriter {
+	public:
+		PatchArchiveWriter(std::string const &toFilename, bool compressed = false);
+		~PatchArchiveWriter(); // Calls finish()
+
+		bool isOpen() const;
+		bool write(PatchHolder const &patch);
+		bool finish(); // Writes string table and index, and closes the file
+		size_t patchesWritten() const;
+
+	private:
+		int stringId(std::string const &text);
+		bool writeRecord(void const *data, size_t size);
+
+		std::string filename_;
+		std::unique_ptr<FileOutputStream> file_;
+		bool compressed_;
+		std::vector<std::string> strings_;
+		std::map<std::string, int> stringIds_;
+		std::vector<int64> offsets_;
+		bool ok_;
 	};
 
 }
@@ -35,26 +35,27 @@ namespace midikraft {
 
 	void PatchList::setPatches(std::vector<PatchHolder> patches)
 	{
-		patches_ = patches;
+		patches_ = std::move(patches);
 	}
 
-	std::vector<midikraft::PatchHolder> PatchList::patches() const
+	std::vector<midikraft::PatchHolder> const &PatchList::patches() const
 	{
 		return patches_;
 	}
 
 	void PatchList::addPatch(PatchHolder patch)
 	{
-		patches_.push_back(patch);
+		patches_.push_back(std::move(patch));
 	}
 
 	void PatchList::insertPatchAtTopAndRemoveDuplicates(PatchHolder patch)
 	{
-		auto newend = std::remove_if(patches_.begin(), patches_.end(), [&](PatchHolder listEntry) {
-			return listEntry.synth() == patch.synth() && listEntry.md5() == patch.md5();
+		auto md5 = patch.md5();
+		auto newend = std::remove_if(patches_.begin(), patches_.end(), [&](PatchHolder const &listEntry) {
+			return listEntry.synth() == patch.synth() && listEntry.md5() == md5;
 			});
 		patches_.erase(newend, patches_.end());
-		patches_.insert(patches_.begin(), patch);
+		patches_.insert(patches_.begin(), std::move(patch));
 	}
 
 }
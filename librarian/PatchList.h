@@ -24,7 +24,8 @@ namespace midikraft {
 		virtual void addPatch(PatchHolder patch);
 		virtual void insertPatchAtTopAndRemoveDuplicates(PatchHolder patch);
 
-		std::vector<PatchHolder> patches() const;
+		// Take a copy if you need to keep the list while modifying this one
+		std::vector<PatchHolder> const &patches() const;
 		
 	private:
 		std::string id_;
@@ -19,6 +19,8 @@ namespace midikraft {
 		PatchList(name)
 		, synth_(synth)
 		, bankNo_(bank)
+		, loaded_(false)
+		, dirtyCount_(0)
 	{
 	}
 
@@ -26,10 +28,44 @@ namespace midikraft {
 		PatchList(id, name)
 		, synth_(synth)
 		, bankNo_(bank)
+		, loaded_(false)
+		, dirtyCount_(0)
 	{
 	}
 
 	void SynthBank::setPatches(std::vector<PatchHolder> patches)
+	{
+		if (!storePatches(std::move(patches))) {
+			return;
+		}
+		int count = static_cast<int>(this->patches().size());
+		fingerprints_.assign((size_t)count, Fingerprint());
+		for (int position = 0; position < count; position++) {
+			updateFingerprint(position);
+		}
+		if (!loaded_) {
+			loaded_ = true;
+			synced_ = fingerprints_;
+		}
+		dirty_.assign((size_t)count, false);
+		dirtyCount_ = 0;
+		for (int position = 0; position < count; position++) {
+			updateDirty(position);
+		}
+	}
+
+	void SynthBank::storeChangedPatches(std::vector<PatchHolder> patches, std::vector<int> const& changedPositions)
+	{
+		if (!storePatches(std::move(patches))) {
+			return;
+		}
+		for (int position : changedPositions) {
+			updateFingerprint(position);
+			updateDirty(position);
+		}
+	}
+
+	bool SynthBank::storePatches(std::vector<PatchHolder> patches)
 	{
 		// Renumber the patches, the original patch information will not reflect the position 
 		// of the patch in the bank, so it needs to be fixed.
@@ -54,12 +90,68 @@ namespace midikraft {
 		}
 
 		// Validate everything worked
-		for (auto patch : patches) {
+		for (auto const& patch : patches) {
 			if (!validatePatchInfo(patch)) {
-				return;
+				return false;
+			}
+		}
+		PatchList::setPatches(std::move(patches));
+		return true;
+	}
+
+	void SynthBank::updateFingerprint(int position)
+	{
+		auto const& current = patches();
+		if (position < 0 || position >= static_cast<int>(current.size())) {
+			return;
+		}
+		if (position >= static_cast<int>(fingerprints_.size())) {
+			fingerprints_.resize((size_t)position + 1);
+		}
+		fingerprints_[position] = { current[position].md5(), current[position].name() };
+	}
+
+	void SynthBank::updateDirty(int position)
+	{
+		if (position < 0 || position >= static_cast<int>(fingerprints_.size())) {
+			return;
+		}
+		if (position >= static_cast<int>(dirty_.size())) {
+			dirty_.resize((size_t)position + 1, false);
+		}
+		bool dirty = position >= static_cast<int>(synced_.size()) || synced_[position] != fingerprints_[position];
+		if (dirty != dirty_[position]) {
+			dirty_[position] = dirty;
+			if (dirty) dirtyCount_++; else dirtyCount_--;
+		}
+	}
+
+	void SynthBank::clearDirty()
+	{
+		synced_ = fingerprints_;
+		loaded_ = true;
+		dirty_.assign(fingerprints_.size(), false);
+		dirtyCount_ = 0;
+	}
+
+	std::string SynthBank::fingerprintAt(int position) const
+	{
+		if (position < 0 || position >= static_cast<int>(fingerprints_.size())) {
+			return {};
+		}
+		return fingerprints_[position].md5;
+	}
+
+	std::vector<int> SynthBank::differingPositions(SynthBank const& other) const
+	{
+		std::vector<int> result;
+		size_t count = std::max(fingerprints_.size(), other.fingerprints_.size());
+		for (size_t position = 0; position < count; position++) {
+			if (position >= fingerprints_.size() || position >= other.fingerprints_.size() || fingerprints_[position] != other.fingerprints_[position]) {
+				result.push_back(static_cast<int>(position));
 			}
 		}
-		PatchList::setPatches(patches);
+		return result;
 	}
 
 	void SynthBank::addPatch(PatchHolder patch)
@@ -67,7 +159,10 @@ namespace midikraft {
 		if (!validatePatchInfo(patch)) {
 			return;
 		}
-		PatchList::addPatch(patch);
+		PatchList::addPatch(std::move(patch));
+		int position = static_cast<int>(patches().size()) - 1;
+		updateFingerprint(position);
+		updateDirty(position);
 	}
 
 	std::string SynthBank::targetBankName() const {
@@ -87,26 +182,26 @@ namespace midikraft {
 		return true;
 	}
 
-	void SynthBank::fillWithPatch(PatchHolder initPatch) {
+	void SynthBank::fillWithPatch(PatchHolder const &initPatch) {
 		auto copy = patches();
-		bool modified = false;
+		std::vector<int> changed;
 		for (auto patch = copy.begin(); patch != copy.end(); patch++) {
 			if (patch->patch() == nullptr) {
 				// This is an empty button, put out Patch into it!
-				auto old = *patch;
+				auto bank = patch->bankNumber();
+				auto program = patch->patchNumber();
 				*patch = initPatch;
-				patch->setBank(old.bankNumber());
-				patch->setPatchNumber(old.patchNumber());
-				modified = true;
-				dirtyPositions_.insert(old.patchNumber().toZeroBasedDiscardingBank());
+				patch->setBank(bank);
+				patch->setPatchNumber(program);
+				changed.push_back(program.toZeroBasedDiscardingBank());
 			}
 		}
-		if (modified) {
-			setPatches(copy);
+		if (!changed.empty()) {
+			storeChangedPatches(std::move(copy), changed);
 		}
 	}
 
-	void SynthBank::changePatchAtPosition(MidiProgramNumber programPlace, PatchHolder patch)
+	void SynthBank::changePatchAtPosition(MidiProgramNumber programPlace, PatchHolder const &patch)
 	{
         updatePatchAtPosition(programPlace, patch);
 		int position = programPlace.toZeroBasedDiscardingBank();
@@ -118,16 +213,13 @@ namespace midikraft {
 		}
 	}
 
-	void SynthBank::updatePatchAtPosition(MidiProgramNumber programPlace, PatchHolder patch)
+	void SynthBank::updatePatchAtPosition(MidiProgramNumber programPlace, PatchHolder const &patch)
 	{
 		auto currentList = patches();
 		int position = programPlace.toZeroBasedDiscardingBank();
 		if (position < static_cast<int>(currentList.size())) {
-            if (currentList[position].md5() != patch.md5() || currentList[position].name() != patch.name()) {
-				dirtyPositions_.insert(position);
-            }
 			currentList[position] = patch;
-			setPatches(currentList);
+			storeChangedPatches(std::move(currentList), { position });
 		}
 		else {
 			jassertfalse;
@@ -139,27 +231,28 @@ namespace midikraft {
 		auto currentList = patches();
 		int position = programPlace.toZeroBasedDiscardingBank();
 		if (position < static_cast<int>(currentList.size())) {
-			auto listToCopy = list.patches();
+			auto const &listToCopy = list.patches();
 			int read_pos = 0;
 			int write_pos = position;
-			while (write_pos < static_cast<int>(std::min(currentList.size(), position + list.patches().size())) && read_pos < static_cast<int>(listToCopy.size())) {
+			std::vector<int> changed;
+			while (write_pos < static_cast<int>(std::min(currentList.size(), position + listToCopy.size())) && read_pos < static_cast<int>(listToCopy.size())) {
 				if (listToCopy[read_pos].synth()->getName() == synth_->getName()) {
 					currentList[write_pos] = listToCopy[read_pos++];
-					dirtyPositions_.insert(write_pos++);
+					changed.push_back(write_pos++);
 				}
 				else {
 					spdlog::info("Skipping patch {} because it is for synth {} and cannot be put into the bank", listToCopy[read_pos].name(), listToCopy[read_pos].synth()->getName());
 					read_pos++;
 				}
 			}
-			setPatches(currentList);
+			storeChangedPatches(std::move(currentList), changed);
 		}
 		else {
 			jassertfalse;
 		}
 	}
 
-	bool SynthBank::validatePatchInfo(PatchHolder patch) 
+	bool SynthBank::validatePatchInfo(PatchHolder const &patch) 
 	{
 		if (patch.smartSynth() && patch.smartSynth()->getName() != synth_->getName()) {
 			spdlog::error("program error - list contains patches not for the synth of this bank, aborting");
@@ -25,10 +25,10 @@ namespace midikraft {
 		// Test if this is a ROM bank
 		bool isWritable() const;
 
-		virtual void fillWithPatch(PatchHolder patch);
+		virtual void fillWithPatch(PatchHolder const &patch);
 		
-		virtual void changePatchAtPosition(MidiProgramNumber programPlace, PatchHolder patch);
-		virtual void updatePatchAtPosition(MidiProgramNumber programPlace, PatchHolder patch);
+		virtual void changePatchAtPosition(MidiProgramNumber programPlace, PatchHolder const &patch);
+		virtual void updatePatchAtPosition(MidiProgramNumber programPlace, PatchHolder const &patch);
 		
 		void copyListToPosition(MidiProgramNumber programPlace, PatchList const& list);
 
@@ -42,19 +42,24 @@ namespace midikraft {
 			return bankNo_;
 		}
 
+		// A position is dirty while its patch or name differs from what the bank had when it was loaded or last synced.
+		// Changing a patch back to the synced one makes it clean again
 		bool isDirty() const {
-			return !dirtyPositions_.empty();
+			return dirtyCount_ > 0;
 		}
 
 		bool isPositionDirty(int position) const
 		{
-			return dirtyPositions_.find(position) != dirtyPositions_.end();
+			return position >= 0 && position < static_cast<int>(dirty_.size()) && dirty_[position];
 		}
 
-		void clearDirty()
-		{
-			dirtyPositions_.clear();
-		}
+		// Call after the bank has been sent to or received from the synth, the current content becomes the synced state
+		void clearDirty();
+
+		// The fingerprint of the patch at the position, as kept with the bank. Empty if out of range
+		std::string fingerprintAt(int position) const;
+		// The positions whose patch or name differs from the other bank's at the same position. Only compares the fingerprints kept with both banks
+		std::vector<int> differingPositions(SynthBank const &other) const;
 
 		int patchCapacity() {
 			return numberOfPatchesInBank(synth_, bankNo_);
@@ -69,11 +74,27 @@ namespace midikraft {
 		SynthBank(std::string const& id, std::string const& name, std::shared_ptr<Synth> synth, MidiBankNumber bank);
 
 	private:
-		bool validatePatchInfo(PatchHolder patch);
+		struct Fingerprint {
+			std::string md5;
+			std::string name;
+			bool operator==(Fingerprint const &other) const { return md5 == other.md5 && name == other.name; }
+			bool operator!=(Fingerprint const &other) const { return !(*this == other); }
+		};
+
+		bool validatePatchInfo(PatchHolder const &patch);
+		bool storePatches(std::vector<PatchHolder> patches);
+		// For the edits, only the positions changed get a new fingerprint
+		void storeChangedPatches(std::vector<PatchHolder> patches, std::vector<int> const &changedPositions);
+		void updateFingerprint(int position);
+		void updateDirty(int position);
 
 		std::shared_ptr<Synth> synth_;
-		std::set<int> dirtyPositions_;
 		MidiBankNumber bankNo_;
+		bool loaded_; // The first setPatches is the load, and taken as the synced state
+		std::vector<Fingerprint> fingerprints_; // By position, of the current patches
+		std::vector<Fingerprint> synced_; // By position, at load or the last clearDirty
+		std::vector<bool> dirty_;
+		size_t dirtyCount_;
 		
 	};
 
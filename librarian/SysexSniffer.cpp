@@ -0,0 +1,106 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "SysexSniffer.h"
+
+#include <algorithm>
+
+namespace midikraft {
+
+	SysexSniffer::SysexSniffer(std::vector<SynthHolder> const& synths) : nodes_(1)
+	{
+		for (auto holder : synths) {
+			auto synth = holder.synth();
+			if (!synth) {
+				continue;
+			}
+			size_t index = synths_.size();
+			synths_.push_back(synth);
+			auto prefixes = synth->sysexHeaderPrefixes();
+			bool indexed = false;
+			for (auto const& prefix : prefixes) {
+				if (!prefix.empty()) {
+					addPrefix(prefix, index);
+					indexed = true;
+				}
+			}
+			if (!indexed) {
+				unindexed_.push_back(index);
+			}
+		}
+	}
+
+	void SysexSniffer::addPrefix(std::vector<uint8> const& prefix, size_t synthIndex)
+	{
+		size_t node = 0;
+		for (auto byte : prefix) {
+			auto found = nodes_[node].children.find(byte);
+			if (found == nodes_[node].children.end()) {
+				nodes_.emplace_back();
+				found = nodes_[node].children.emplace(byte, nodes_.size() - 1).first;
+			}
+			node = found->second;
+		}
+		auto& registered = nodes_[node].synths;
+		if (std::find(registered.begin(), registered.end(), synthIndex) == registered.end()) {
+			registered.push_back(synthIndex);
+		}
+	}
+
+	std::vector<size_t> SysexSniffer::candidates(MidiMessage const& message) const
+	{
+		std::vector<size_t> result = unindexed_;
+		if (!message.isSysEx()) {
+			return result;
+		}
+		// Walk down as far as the message's bytes match, every synth on the way registered a prefix of the message
+		auto data = message.getSysExData();
+		int size = message.getSysExDataSize();
+		size_t node = 0;
+		for (int i = 0; i < size; i++) {
+			auto found = nodes_[node].children.find(data[i]);
+			if (found == nodes_[node].children.end()) {
+				break;
+			}
+			node = found->second;
+			for (auto synth : nodes_[node].synths) {
+				if (std::find(result.begin(), result.end(), synth) == result.end()) {
+					result.push_back(synth);
+				}
+			}
+		}
+		return result;
+	}
+
+	std::vector<std::shared_ptr<Synth>> SysexSniffer::synthsForMessage(MidiMessage const& message) const
+	{
+		std::vector<std::shared_ptr<Synth>> result;
+		for (auto index : candidates(message)) {
+			if (synths_[index]->isOwnSysex(message)) {
+				result.push_back(synths_[index]);
+			}
+		}
+		return result;
+	}
+
+	std::shared_ptr<Synth> SysexSniffer::sniff(std::vector<MidiMessage> const& messages) const
+	{
+		std::vector<size_t> hits(synths_.size(), 0);
+		for (auto const& message : messages) {
+			for (auto index : candidates(message)) {
+				if (synths_[index]->isOwnSysex(message)) {
+					hits[index]++;
+				}
+			}
+		}
+		auto best = std::max_element(hits.begin(), hits.end());
+		if (best == hits.end() || *best == 0) {
+			return nullptr;
+		}
+		return synths_[(size_t)std::distance(hits.begin(), best)];
+	}
+
+}
@@ -0,0 +1,44 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include "Synth.h"
+#include "SynthHolder.h"
+
+#include <map>
+
+namespace midikraft {
+
+	// Finds out which synth sysex messages are for. The header prefixes registered by the synths, see Synth::sysexHeaderPrefixes(), are put into a trie,
+	// so a message is classified by looking at its first few bytes, and isOwnSysex is only asked of the synths whose prefix matches.
+	// Synths that register no prefix are asked for every message. Immutable after construction, so safe to use from several threads
+	class SysexSniffer {
+	public:
+		explicit SysexSniffer(std::vector<SynthHolder> const &synths);
+
+		// The synths whose isOwnSysex accepts the message
+		std::vector<std::shared_ptr<Synth>> synthsForMessage(MidiMessage const &message) const;
+		// The synth claiming the most messages, nullptr if none claims any
+		std::shared_ptr<Synth> sniff(std::vector<MidiMessage> const &messages) const;
+
+	private:
+		struct Node {
+			std::map<uint8, size_t> children; // Index into nodes_
+			std::vector<size_t> synths; // Index into synths_, of the synths with a prefix ending here
+		};
+
+		void addPrefix(std::vector<uint8> const &prefix, size_t synthIndex);
+		std::vector<size_t> candidates(MidiMessage const &message) const;
+
+		std::vector<std::shared_ptr<Synth>> synths_;
+		std::vector<Node> nodes_; // The root is the first
+		std::vector<size_t> unindexed_; // Synths without prefixes
+	};
+
+}